@@ -24,6 +24,19 @@
 #include <stdlib.h>        /* for size_t */
 
 typedef struct rot_arena *rot_arena_t;
+typedef struct rot_arena_mark *rot_arena_mark_t;
+
+/**
+ * enum rot_arena_flags - Options for arenas that map their own memory.
+ * @ROT_ARENA_HUGE_PAGES: Back the arena with 2 MB pages, from the hugetlb pool
+ * if it has enough free pages, otherwise with transparent huge pages.
+ * @ROT_ARENA_PREFAULT: Fault in all of the arena's pages up front, so that
+ * first touches do not stall kernels later.
+ */
+enum rot_arena_flags {
+        ROT_ARENA_HUGE_PAGES = 1 << 0,
+        ROT_ARENA_PREFAULT = 1 << 1,
+};
 
 /**
  * ROT_arena_can_alloc() - Can `arena` satisfy a request to allocate
@@ -42,6 +55,10 @@ bool ROT_arena_can_alloc(const rot_arena_t arena,
  * @malloc_bytes: Number of bytes to allocate.
  * @backend: Backend to allocate for.
  *
+ * Allocation is lock free and safe to call from many threads at once on the
+ * same arena, for both CPU and GPU backends. It must not race with
+ * ROT_arena_mark, ROT_arena_rewind or ROT_arena_gpu_new on the same arena.
+ *
  * NULL is returned on error, e.g. if there is not enough memory in `arena` to
  * allocate `malloc_bytes`.
  */
@@ -49,6 +66,55 @@ void *ROT_arena_malloc(rot_arena_t arena,
                        size_t malloc_bytes,
                        enum rot_backend backend);
 
+/**
+ * ROT_arena_malloc_aligned() - Allocate memory from arena, aligned to
+ * `align_bytes`.
+ * @arena: Memory arena to allocate memory from.
+ * @malloc_bytes: Number of bytes to allocate.
+ * @align_bytes: Alignment of the returned pointer, as a power of two. For GPU
+ * backends this is the alignment of the offset into the GPU memory block,
+ * which is the same as the alignment of the pointer as long as the blocks
+ * themselves are at least that aligned.
+ * @backend: Backend to allocate for.
+ *
+ * NULL is returned on error.
+ */
+void *ROT_arena_malloc_aligned(rot_arena_t arena,
+                               size_t malloc_bytes,
+                               size_t align_bytes,
+                               enum rot_backend backend);
+
+/**
+ * ROT_arena_mark() - Records the current allocation state of `arena`.
+ * @arena: Memory arena to checkpoint.
+ *
+ * The mark saves the used bytes of the CPU region and of every GPU block, and
+ * is itself allocated from the CPU region. Passing it to ROT_arena_rewind
+ * releases everything allocated since, in all regions at once, including the
+ * mark.
+ *
+ * Marks nest: rewinding to a mark also discards every mark taken after it,
+ * which must not be used again. A typical training step takes a mark at the
+ * start of the step and rewinds to it at the end, releasing the step's
+ * temporaries in O(1).
+ *
+ * Returns NULL on error, e.g. if there is no space left for the mark.
+ */
+rot_arena_mark_t ROT_arena_mark(rot_arena_t arena);
+
+/**
+ * ROT_arena_rewind() - Releases everything allocated from `arena` since
+ * `mark` was taken.
+ * @arena: Memory arena that `mark` was taken from.
+ * @mark: Mark returned by ROT_arena_mark, that has not been rewound past.
+ *
+ * Rewinding past the creation of the GPU region by ROT_arena_gpu_new is not
+ * supported.
+ *
+ * Returns NULL on error, otherwise arena.
+ */
+rot_arena_t ROT_arena_rewind(rot_arena_t arena, rot_arena_mark_t mark);
+
 /**
  * ROT_arena_min_bytes() - Returns the minimum number of bytes in an arena.
  */
@@ -63,6 +129,25 @@ size_t ROT_arena_min_bytes(void);
  */
 rot_arena_t ROT_arena_new(void *memory, size_t mem_bytes);
 
+/**
+ * ROT_arena_map() - Creates a memory arena in memory mapped by the arena
+ * itself.
+ * @mem_bytes: Size of the arena in bytes, which is rounded up to a whole
+ * number of 2 MB pages.
+ * @flags: Bitwise or of enum rot_arena_flags.
+ *
+ * The arena must be released with ROT_arena_unmap.
+ *
+ * Returns NULL on error.
+ */
+rot_arena_t ROT_arena_map(size_t mem_bytes, uint32_t flags);
+
+/**
+ * ROT_arena_unmap() - Releases an arena created with ROT_arena_map, along with
+ * all the memory allocated from it.
+ */
+void ROT_arena_unmap(rot_arena_t arena);
+
 /**
  * arena_gpu_new() - Initializes a memory arena for the Radeon Open Compute
  * platform, i.e. AMD GPUs.
@@ -0,0 +1,90 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ROT_CONTEXT_H
+#define ROT_CONTEXT_H
+
+#include <stddef.h>  /* for size_t */
+#include <stdint.h>  /* for uint32_t */
+
+typedef struct rot_context *rot_context_t;
+
+/**
+ * ROT_context_new() - Creates an execution context, which owns the resources
+ * that ops would otherwise have to set up on every call.
+ * @num_threads: Number of threads that CPU ops run on, including the thread
+ * calling the op. Zero picks the number of online CPUs, or ROT_NUM_THREADS if
+ * set.
+ * @scratch_bytes: Size of the scratch arena of each thread, which holds GEMM
+ * packing buffers. With zero, or for products that do not fit, packing
+ * buffers come from the heap instead.
+ *
+ * A context owns a pool of `num_threads` - 1 worker threads, started up front
+ * and asleep between ops, a scratch arena per thread, and cuBLAS and rocBLAS
+ * handles, created by the first op that needs each of them.
+ *
+ * Ops use the context bound to the calling thread with ROT_context_bind, or
+ * else a default context shared by the whole process, without a scratch
+ * arena.
+ *
+ * Returns NULL on error.
+ */
+rot_context_t ROT_context_new(uint32_t num_threads, size_t scratch_bytes);
+
+/**
+ * ROT_context_free() - Joins the context's threads and releases its scratch
+ * arenas and BLAS handles.
+ *
+ * The context must not be bound to any thread other than the caller.
+ */
+void ROT_context_free(rot_context_t context);
+
+/**
+ * ROT_context_bind() - Makes ops called from the calling thread use `context`,
+ * or the default context if `context` is NULL.
+ *
+ * A context's scratch arenas and BLAS handles are not synchronised, so a
+ * context must only be bound to one thread at a time.
+ *
+ * Returns the context previously bound to the calling thread, or NULL if none
+ * was.
+ */
+rot_context_t ROT_context_bind(rot_context_t context);
+
+/**
+ * ROT_context_set_blas_threads() - Sets the number of threads that OpenBLAS
+ * calls made in `context` use, e.g. ROT_MATMUL_ENGINE_BLAS products.
+ * @num_threads: Number of BLAS threads, or zero to leave OpenBLAS's own
+ * setting alone, which is the default.
+ *
+ * The context's worker threads sleep while a BLAS call runs, so giving BLAS
+ * the context's number of threads shares the same CPUs between the two without
+ * oversubscribing them.
+ *
+ * OpenBLAS's thread count is global, so it is set here once rather than on
+ * every BLAS call, and contexts used at the same time should agree on it.
+ */
+void ROT_context_set_blas_threads(rot_context_t context, uint32_t num_threads);
+
+/**
+ * ROT_context_get_num_threads() - Returns the number of threads that CPU ops
+ * run on in `context`.
+ */
+uint32_t ROT_context_get_num_threads(const rot_context_t context);
+
+#endif /* ROT_CONTEXT_H */
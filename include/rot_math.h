@@ -30,6 +30,46 @@
  */
 typedef struct rot_tensor *rot_tensor_t;
 
+/**
+ * enum rot_matmul_engine - Implementation used for matmuls on CPU tensors.
+ * @ROT_MATMUL_ENGINE_DEFAULT: The engine chosen at build time through the
+ * `matmul_engine` Meson option.
+ * @ROT_MATMUL_ENGINE_BLAS: OpenBLAS `cblas_sgemm`.
+ * @ROT_MATMUL_ENGINE_NATIVE: The in-tree packed, cache-blocked SGEMM with
+ * AVX2/AVX-512 FMA microkernels.
+ */
+enum rot_matmul_engine {
+        ROT_MATMUL_ENGINE_DEFAULT = 0,
+        ROT_MATMUL_ENGINE_BLAS = 1,
+        ROT_MATMUL_ENGINE_NATIVE = 2,
+};
+
+/**
+ * enum rot_dtype - Type of the elements stored in a tensor.
+ * @ROT_DTYPE_FLOAT32: IEEE single precision.
+ * @ROT_DTYPE_BFLOAT16: The upper 16 bits of a single precision float, with
+ * the same range but only 8 bits of precision.
+ * @ROT_DTYPE_FLOAT16: IEEE half precision.
+ * @ROT_DTYPE_INT8: Signed 8-bit integers, quantized as described for
+ * ROT_tensor_set_quantization.
+ * @ROT_DTYPE_UINT8: Unsigned 8-bit integers, quantized likewise.
+ *
+ * The 16-bit types halve the memory traffic of memory bound ops. CPU ops
+ * widen them to single precision, and always compute and accumulate in single
+ * precision.
+ *
+ * The 8-bit types are for inference. Matmuls of two 8-bit operands multiply
+ * the integers and accumulate them in 32-bit integers, then scale the sums
+ * back to real numbers.
+ */
+enum rot_dtype {
+        ROT_DTYPE_FLOAT32 = 0,
+        ROT_DTYPE_BFLOAT16 = 1,
+        ROT_DTYPE_FLOAT16 = 2,
+        ROT_DTYPE_INT8 = 3,
+        ROT_DTYPE_UINT8 = 4,
+};
+
 /**
  * ROT_create_tensor() - Allocates and initializes a tensor with `num_dims`
  * dimensions given by `dims`.
@@ -38,6 +78,8 @@ typedef struct rot_tensor *rot_tensor_t;
  * @dims: Size of each dimension of the allocated tensor.
  * @backend: The backend used for the tensor.
  *
+ * The tensor's data starts on a 64 byte cache line, and its rows are packed.
+ *
  * Returns NULL on error.
  */
 rot_tensor_t ROT_create_tensor(rot_arena_t arena,
@@ -45,6 +87,154 @@ rot_tensor_t ROT_create_tensor(rot_arena_t arena,
                                const size_t *dims,
                                enum rot_backend backend);
 
+/**
+ * ROT_create_tensor_aligned() - ROT_create_tensor with layout options.
+ * @align_bytes: Alignment of the start of the tensor's data, as a power of
+ * two of at least sizeof(float).
+ * @is_ld_padded: Pad the leading dimension, i.e. the distance between
+ * consecutive rows of the last dimension, to a multiple of `align_bytes`, plus
+ * one more `align_bytes` if rows would then be a multiple of 4 KB apart.
+ * Every row then starts aligned, and walking down a column does not keep
+ * hitting the same cache sets. Only supported for CPU tensors.
+ *
+ * Rows of a padded tensor are ROT_tensor_get_ld floats apart, rather than
+ * dims[num_dims - 1].
+ *
+ * Returns NULL on error.
+ */
+rot_tensor_t ROT_create_tensor_aligned(rot_arena_t arena,
+                                       uint32_t num_dims,
+                                       const size_t *dims,
+                                       enum rot_backend backend,
+                                       size_t align_bytes,
+                                       bool is_ld_padded);
+
+/**
+ * ROT_create_tensor_dtype() - ROT_create_tensor for elements of type `dtype`.
+ *
+ * Tensors of 16-bit types are only supported on the CPU backend. Their data
+ * is read and written through ROT_tensor_convert, rather than
+ * ROT_tensor_get_data.
+ *
+ * Returns NULL on error.
+ */
+rot_tensor_t ROT_create_tensor_dtype(rot_arena_t arena,
+                                     uint32_t num_dims,
+                                     const size_t *dims,
+                                     enum rot_backend backend,
+                                     enum rot_dtype dtype);
+
+/**
+ * ROT_tensor_convert() - Copies `tensor` into `result`, converting each
+ * element to the type of `result`.
+ *
+ * Conversions to 16-bit types round to nearest even. Single precision
+ * denormals become zero when converted to bfloat16, which is what AVX-512
+ * BF16 does.
+ *
+ * Both tensors must be on the CPU backend. They must have the same number of
+ * elements if both are contiguous, and otherwise the same dimensions and
+ * contiguous rows.
+ *
+ * Returns NULL on error, otherwise returns result.
+ */
+rot_tensor_t ROT_tensor_convert(rot_tensor_t result, const rot_tensor_t tensor);
+
+/**
+ * ROT_tensor_set_quantization() - Sets the quantization of the 8-bit tensor
+ * `tensor`, whose integers q represent the real numbers scale*(q - zero_point).
+ * @scale: Positive scale, shared by every element.
+ * @zero_point: Integer representing zero, within the range of the type.
+ *
+ * Tensors start with a scale of 1 and zero point of 0. Conversions to and
+ * from 8-bit tensors by ROT_tensor_convert quantize and dequantize with their
+ * scales, rounding to nearest even and saturating.
+ *
+ * Returns NULL on error, otherwise returns tensor.
+ */
+rot_tensor_t ROT_tensor_set_quantization(rot_tensor_t tensor,
+                                         float scale,
+                                         int32_t zero_point);
+
+/**
+ * ROT_calibrate_quantization() - Sets the quantization of the 8-bit tensor
+ * `result` so that it covers the range of the float32 tensor `tensor`.
+ *
+ * ROT_DTYPE_UINT8 gets an asymmetric range, from the smaller of the minimum
+ * and zero to the larger of the maximum and zero, which suits activations.
+ * ROT_DTYPE_INT8 gets a range symmetric about zero, with a zero point of 0.
+ * Zero is always represented exactly.
+ *
+ * Returns NULL on error, otherwise returns result. `tensor` is not converted.
+ */
+rot_tensor_t ROT_calibrate_quantization(rot_tensor_t result,
+                                        const rot_tensor_t tensor);
+
+/**
+ * ROT_quantize_weights() - Allocates from `arena` a ROT_DTYPE_INT8 copy of
+ * the float32 weight matrix `weights`, quantized with a symmetric scale per
+ * row, i.e. per output channel of e.g. ROT_linear.
+ *
+ * The scales are also allocated from `arena`. The copy takes a quarter of
+ * the memory of `weights`, which can then be freed.
+ *
+ * Returns NULL on error.
+ */
+rot_tensor_t ROT_quantize_weights(rot_arena_t arena,
+                                  const rot_tensor_t weights);
+
+/**
+ * ROT_tensor_view_slice() - Returns a view of elements [start, end) of
+ * dimension `dim` of `tensor`.
+ * @arena: Arena to allocate the view's metadata from.
+ *
+ * Views share their data with `tensor`, so no data is copied, and writes
+ * through a view are seen by `tensor`. Views can be passed to ROT_matmul and
+ * the elementwise ops on the CPU. Only contiguous views are supported on GPU
+ * backends.
+ *
+ * Returns NULL on error.
+ */
+rot_tensor_t ROT_tensor_view_slice(rot_arena_t arena,
+                                   const rot_tensor_t tensor,
+                                   uint32_t dim,
+                                   size_t start,
+                                   size_t end);
+
+/**
+ * ROT_tensor_view_transpose() - Returns a view of `tensor` with dimensions
+ * `dim0` and `dim1` swapped.
+ *
+ * Transposed matrices are multiplied without being copied, by passing them to
+ * GEMM as transposed operands.
+ */
+rot_tensor_t ROT_tensor_view_transpose(rot_arena_t arena,
+                                       const rot_tensor_t tensor,
+                                       uint32_t dim0,
+                                       uint32_t dim1);
+
+/**
+ * ROT_tensor_view_permute() - Returns a view of `tensor` whose dimension i is
+ * dimension perm[i] of `tensor`.
+ * @perm: A permutation of [0, num_dims).
+ */
+rot_tensor_t ROT_tensor_view_permute(rot_arena_t arena,
+                                     const rot_tensor_t tensor,
+                                     const uint32_t *perm);
+
+/**
+ * ROT_tensor_view_reshape() - Returns a view of `tensor` with dimensions
+ * `dims`, listing the same elements in the same row-major order.
+ *
+ * Returns NULL if the number of elements differs, or if `tensor`'s strides
+ * cannot express the new dimensions without a copy, e.g. when merging the
+ * dimensions of a transposed view.
+ */
+rot_tensor_t ROT_tensor_view_reshape(rot_arena_t arena,
+                                     const rot_tensor_t tensor,
+                                     uint32_t num_dims,
+                                     const size_t *dims);
+
 /**
  * ROT_matmul()
  *
@@ -67,6 +257,13 @@ rot_tensor_t ROT_create_tensor(rot_arena_t arena,
  * For input tensors of dimension mxn and m'xn', the output tensor is a single
  * tensor of mxn'.
  *
+ * If both inputs are 8-bit quantized tensors, e.g. ROT_DTYPE_INT8 weights
+ * from ROT_quantize_weights and ROT_DTYPE_UINT8 activations, the output is
+ * either dequantized into a float32 tensor, or requantized into an 8-bit one.
+ * Per-channel scales must be along the rows of the first input, or the
+ * columns of the second. The inner dimension of quantized inputs must be at
+ * most 2^16, so that their integer products sum exactly in 32 bits.
+ *
  * If any input requirements are not satisfied, a and b are not touched and
  * NULL is returned.
  */
@@ -74,22 +271,124 @@ rot_tensor_t ROT_matmul(rot_tensor_t result,
                         const rot_tensor_t a,
                         const rot_tensor_t b);
 
+/**
+ * ROT_matmul_with_engine() - `ROT_matmul`, using `engine` for CPU tensors.
+ * @result: Output tensor.
+ * @a: Left operand.
+ * @b: Right operand.
+ * @engine: CPU matmul implementation to use. Ignored for GPU backends.
+ *
+ * Requirements and return value are the same as for `ROT_matmul`.
+ */
+rot_tensor_t ROT_matmul_with_engine(rot_tensor_t result,
+                                    const rot_tensor_t a,
+                                    const rot_tensor_t b,
+                                    enum rot_matmul_engine engine);
+
+/**
+ * ROT_gemm() - General matrix multiply, c <- alpha*op(a)*op(b) + beta*c.
+ * @c: mxn result. Its old contents are scaled by `beta` and added to, and are
+ * not read if `beta` is zero.
+ * @a: mxk matrix, or kxm if `trans_a` is set.
+ * @b: kxn matrix, or nxk if `trans_b` is set.
+ * @trans_a: Multiply by the transpose of `a`, i.e. op(a) = a^T.
+ * @trans_b: Multiply by the transpose of `b`.
+ * @alpha: Scale of the product.
+ * @beta: Scale of the old contents of `c`.
+ *
+ * Transposes are read in place and the sum is formed in the same pass as the
+ * product, so e.g. a weight gradient can be accumulated with
+ * ROT_gemm(w_grad, y_grad, x, false, true, 1, 1), without temporaries.
+ *
+ * The same backends, views and quantized types as for `ROT_matmul` are
+ * supported, including its limit of 2^16 on the depth k of quantized
+ * operands, and `c` must not overlap with either operand.
+ *
+ * Returns `c`, or NULL on error.
+ */
+rot_tensor_t ROT_gemm(rot_tensor_t c,
+                      const rot_tensor_t a,
+                      const rot_tensor_t b,
+                      bool trans_a,
+                      bool trans_b,
+                      float alpha,
+                      float beta);
+
+/**
+ * ROT_matmul_batched() - Multiplies a batch of same-shape matrices in one
+ * call.
+ *
+ * Requirements
+ *
+ *
+ * Inputs:
+ *
+ * `a` of dimensions [batch, m, k] and `b` of dimensions [batch, k, n]. Either
+ * one (but not both) of `a` and `b` may instead have dimension 2, i.e. mxk or
+ * kxn, in which case it is broadcast across the batch.
+ *
+ * `result` must have dimensions [batch, m, n] and must not overlap with the
+ * memory of either input.
+ *
+ *
+ * Output:
+ *
+ * result[i] = a[i]*b[i] for every i in [0, batch).
+ *
+ * Validation and backend dispatch happen once for the whole batch. On CPU, the
+ * products are spread across threads.
+ *
+ * If any input requirements are not satisfied, NULL is returned.
+ */
+rot_tensor_t ROT_matmul_batched(rot_tensor_t result,
+                                const rot_tensor_t a,
+                                const rot_tensor_t b);
+
 /**
  * ROT_tensor_get_data() - Returns a pointer to the float data in `tensor`.
  * @tensor: A tensor.
+ *
+ * Returns NULL if the elements of `tensor` are not ROT_DTYPE_FLOAT32.
  */
 float *ROT_tensor_get_data(rot_tensor_t tensor);
 
+/**
+ * ROT_tensor_get_dtype() - Returns the type of the elements of `tensor`.
+ */
+enum rot_dtype ROT_tensor_get_dtype(rot_tensor_t tensor);
+
 /**
  * ROT_tensor_get_dims() - Returns a pointer to the dimensions in `tensor`.
  * @tensor: A tensor.
  */
 const size_t *ROT_tensor_get_dims(rot_tensor_t tensor);
 
+/**
+ * ROT_tensor_get_ld() - Returns the leading dimension of `tensor`, i.e. the
+ * number of floats between the starts of consecutive rows of its last
+ * dimension.
+ * @tensor: A tensor.
+ *
+ * This is dims[num_dims - 1] unless the tensor was created with a padded
+ * leading dimension.
+ */
+size_t ROT_tensor_get_ld(rot_tensor_t tensor);
+
+/**
+ * ROT_tensor_get_strides() - Returns a pointer to the strides of `tensor`,
+ * i.e. the distance in elements between consecutive elements of each
+ * dimension.
+ * @tensor: A tensor.
+ */
+const size_t *ROT_tensor_get_strides(rot_tensor_t tensor);
+
 /**
  * ROT_tensor_get_size() - Returns the size in bytes of the data pointed to by
  * `tensor.data`.
  * @tensor: A tensor.
+ *
+ * This is the size of the elements only, excluding any leading dimension
+ * padding.
  */
 size_t ROT_tensor_get_size(rot_tensor_t tensor);
 
@@ -98,6 +397,8 @@ size_t ROT_tensor_get_size(rot_tensor_t tensor);
  * @tensor: A tensor.
  * @num_dims: Number of dimensions of the tensor to allocate.
  * @dims: Size of each dimension of the allocated tensor.
+ *
+ * The tensor's rows are treated as packed afterwards.
  */
 rot_tensor_t ROT_set_dims(struct rot_tensor *tensor,
                           uint32_t num_dims,
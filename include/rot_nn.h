@@ -22,11 +22,583 @@
 #include "rot_math.h"
 
 /**
- * ROT_relu() - ReLU on tensor.
+ * enum rot_activation - Elementwise nonlinearity applied by fused ops.
+ * @ROT_ACTIVATION_NONE: Identity.
+ * @ROT_ACTIVATION_RELU: max(x, 0).
+ * @ROT_ACTIVATION_SIGMOID: 1/(1 + e^-x).
+ * @ROT_ACTIVATION_TANH: tanh(x).
+ * @ROT_ACTIVATION_GELU: x*Phi(x), using the tanh approximation
+ * 0.5*x*(1 + tanh(sqrt(2/pi)*(x + 0.044715*x^3))).
+ * @ROT_ACTIVATION_GELU_ERF: Exact GELU, x*Phi(x) = 0.5*x*(1 + erf(x/sqrt(2))).
+ */
+enum rot_activation {
+        ROT_ACTIVATION_NONE = 0,
+        ROT_ACTIVATION_RELU = 1,
+        ROT_ACTIVATION_SIGMOID = 2,
+        ROT_ACTIVATION_TANH = 3,
+        ROT_ACTIVATION_GELU = 4,
+        ROT_ACTIVATION_GELU_ERF = 5,
+};
+
+/**
+ * enum rot_unary_op - Elementwise function computed by ROT_unary.
+ * @ROT_UNARY_RELU: max(x, 0).
+ * @ROT_UNARY_EXP: e^x, to within 1.01 ULP for x in [-87.3, 88.7]. Inputs
+ * below that range give 0, and inputs above it give +inf.
+ * @ROT_UNARY_LOG: Natural logarithm, to within 0.83 ULP for all positive x,
+ * including denormals. log(0) is -inf, and negative x give NaN.
+ * @ROT_UNARY_SIGMOID: 1/(1 + e^-x), to within 2.5 ULP for x in [-87, 87].
+ * @ROT_UNARY_TANH: tanh(x), to within 1.33 ULP.
+ * @ROT_UNARY_GELU: The tanh approximation of GELU as in ROT_ACTIVATION_GELU,
+ * to within 16.5 ULP of that formula for x >= -3.
+ * @ROT_UNARY_GELU_ERF: Exact GELU as in ROT_ACTIVATION_GELU_ERF, to within
+ * 8.5 ULP.
+ *
+ * Without AVX2 the ops run one element at a time, with libm for exp and log,
+ * and stay within the same bounds.
+ *
+ * Infinite inputs give the limit of each op, with -0 for both GELUs at -inf.
+ * NaN inputs give NaN, except for ReLU, which gives 0.
+ */
+enum rot_unary_op {
+        ROT_UNARY_RELU = 0,
+        ROT_UNARY_EXP = 1,
+        ROT_UNARY_LOG = 2,
+        ROT_UNARY_SIGMOID = 3,
+        ROT_UNARY_TANH = 4,
+        ROT_UNARY_GELU = 5,
+        ROT_UNARY_GELU_ERF = 6,
+};
+
+/**
+ * @result: mxn output tensor. Must not overlap `w`, `x` or `bias`.
+ * @result: mxn output tensor. Must be different from `w` and `x`.
+ * @w: mxk weight matrix.
+ * @x: kxn input, e.g. a single column vector or a batch of n column vectors.
+ * @bias: Contiguous float32 tensor of m elements, e.g. of dimensions [m] or
+ * [m, 1], added to every column of w*x. May be NULL for no bias.
+ * @activation: Nonlinearity applied after the bias.
+ *
+ * With the native matmul engine, the bias and activation are applied to each
+ * output tile of the GEMM while the tile is still in registers, so the output
+ * is written to memory exactly once.
+ *
+ * `w`, `x` and `result` may be of any rot_dtype, and are accumulated in
+ * single precision. Quantized `w` and `x` are multiplied as for `ROT_matmul`,
+ * so k must then be at most 2^16.
+ *
+ * Only CPU tensors are supported. Returns NULL on error, otherwise `result`.
+ */
+rot_tensor_t ROT_linear(rot_tensor_t result,
+                        const rot_tensor_t w,
+                        const rot_tensor_t x,
+                        const rot_tensor_t bias,
+                        enum rot_activation activation);
+
+/**
+ * ROT_relu() - ReLU on tensor, in place.
  * @tensor: Tensor to ReLU.
  *
- * Returns NULL if tensor is NULL, otherwise returns tensor.
+ * Every element of `tensor` is replaced by max(x, 0). Large tensors are split
+ * across threads.
+ *
+ * Returns NULL if tensor is NULL or is not a CPU tensor, otherwise returns
+ * tensor.
  */
 rot_tensor_t ROT_relu(rot_tensor_t tensor);
 
+/**
+ * ROT_relu_out() - Out-of-place ReLU, result <- max(tensor, 0).
+ * @result: Output tensor, with the same number of elements as `tensor`. May
+ * be `tensor` itself.
+ * @tensor: Input tensor.
+ *
+ * The tensors may be of different types, in which case the input is widened
+ * to single precision and the result rounded to the type of `result`.
+ *
+ * Returns NULL on error, otherwise returns result.
+ */
+rot_tensor_t ROT_relu_out(rot_tensor_t result, const rot_tensor_t tensor);
+
+/**
+ * ROT_unary() - Elementwise `op` on tensor, in place.
+ * @tensor: Tensor to transform.
+ * @op: Function to apply to every element.
+ *
+ * Large tensors are split across threads.
+ *
+ * Returns NULL on error, otherwise returns tensor.
+ */
+rot_tensor_t ROT_unary(rot_tensor_t tensor, enum rot_unary_op op);
+
+/**
+ * ROT_unary_out() - Out-of-place elementwise op, result <- op(tensor).
+ * @result: Output tensor, with the same number of elements as `tensor`. May
+ * be `tensor` itself.
+ * @tensor: Input tensor.
+ * @op: Function to apply to every element.
+ *
+ * The tensors may be of different types, in which case the input is widened
+ * to single precision and the result rounded to the type of `result`.
+ * Quantized tensors are not supported.
+ *
+ * Returns NULL on error, otherwise returns result.
+ */
+rot_tensor_t ROT_unary_out(rot_tensor_t result,
+                           const rot_tensor_t tensor,
+                           enum rot_unary_op op);
+
+/**
+ * ROT_relu_grad() - ReLU backward pass, out_grad <- in_grad*(activations > 0).
+ * @out_grad: Gradient with respect to the ReLU input. May be `in_grad`, in
+ * which case the gradient is masked in place.
+ * @in_grad: Gradient with respect to the ReLU output.
+ * @activations: Either the input or the output of the forward ReLU, which
+ * are positive in the same places.
+ *
+ * All three tensors must have the same number of elements. Large tensors are
+ * split across threads.
+ *
+ * Returns NULL on error, otherwise returns out_grad.
+ */
+rot_tensor_t ROT_relu_grad(rot_tensor_t out_grad,
+                           const rot_tensor_t in_grad,
+                           const rot_tensor_t activations);
+
+/**
+ * enum rot_layout - Order of the dimensions of a batch of images.
+ * @ROT_LAYOUT_NCHW: [batch, channels, height, width].
+ * @ROT_LAYOUT_NHWC: [batch, height, width, channels].
+ */
+enum rot_layout {
+        ROT_LAYOUT_NCHW = 0,
+        ROT_LAYOUT_NHWC = 1,
+};
+
+/**
+ * enum rot_conv2d_algo - Algorithm used by ROT_conv2d.
+ * @ROT_CONV2D_ALGO_AUTO: Winograd F(4x4, 3x3) for 3x3 convolutions with unit
+ * stride and dilation, no groups, and enough channels and pixels for it to
+ * pay off even with the filter transformed on every call, otherwise im2col.
+ * @ROT_CONV2D_ALGO_IM2COL: Always im2col, which is as accurate as a matmul.
+ * @ROT_CONV2D_ALGO_WINOGRAD: Winograd whenever the shape allows it, otherwise
+ * im2col.
+ *
+ * Winograd F(4x4, 3x3) does 4x fewer multiplies than im2col, at the cost
+ * of rounding errors several times larger, since its transforms scale terms
+ * by up to 100 before they cancel. Depthwise NHWC convolutions use their own
+ * direct kernels whatever the algorithm.
+ *
+ * ROT_conv2d does not cache transformed filters, since writes to a filter's
+ * data are not tracked and a cached transform could silently go stale.
+ * Filters that are reused, e.g. for inference, are better transformed once
+ * with ROT_winograd_transform_filter and run with ROT_conv2d_winograd, for
+ * which Winograd also pays off on smaller images.
+ *
+ * ROT_CONV2D_ALGO_AUTO chooses from the shape alone, and never falls back to
+ * im2col because of Winograd's larger rounding errors. Convolutions that
+ * cannot tolerate them must ask for ROT_CONV2D_ALGO_IM2COL.
+ */
+enum rot_conv2d_algo {
+        ROT_CONV2D_ALGO_AUTO = 0,
+        ROT_CONV2D_ALGO_IM2COL = 1,
+        ROT_CONV2D_ALGO_WINOGRAD = 2,
+};
+
+/**
+ * struct rot_conv2d_params - Hyperparameters of a 2D convolution, with pairs
+ * given as (vertical, horizontal).
+ * @stride: Distance between consecutive windows, at least one.
+ * @padding: Zeros implicitly added on each side of the input.
+ * @dilation: Distance between consecutive taps of the filter, at least one.
+ * @groups: Number of groups the channels are split into, where each group of
+ * output channels only reads the matching group of input channels. Must
+ * divide both the input and output channels.
+ * @layout: Layout of the input and result, which also sets the filter's.
+ * @activation: Nonlinearity applied after the bias.
+ * @algo: Algorithm choice, where zero is ROT_CONV2D_ALGO_AUTO.
+ */
+struct rot_conv2d_params {
+        uint32_t stride[2];
+        uint32_t padding[2];
+        uint32_t dilation[2];
+        uint32_t groups;
+        enum rot_layout layout;
+        enum rot_activation activation;
+        enum rot_conv2d_algo algo;
+};
+
+/**
+ * ROT_conv2d() - Fused 2D convolution,
+ * result <- activation(conv2d(input, filter) + bias).
+ * @result: Output images, with the input's layout, batch size and one channel
+ * per filter. Their height is
+ * (height + 2*padding[0] - dilation[0]*(filter height - 1) - 1)/stride[0] + 1,
+ * and their width likewise.
+ * @input: Input images.
+ * @filter: [out channels, in channels/groups, height, width] for NCHW, or
+ * [out channels, height, width, in channels/groups] for NHWC, so that the
+ * channels are innermost wherever they are innermost in the images.
+ * @bias: Contiguous tensor of one element per output channel, or NULL.
+ * @params: Hyperparameters of the convolution.
+ *
+ * All tensors must be contiguous float32 CPU tensors, and `result` must not
+ * overlap the others. As in cuDNN, the filter is not flipped, i.e. this is a
+ * cross-correlation.
+ *
+ * The convolution is lowered to GEMMs on tiles of the im2col matrix, whose
+ * columns (rows, for NHWC) are the input windows of consecutive output
+ * pixels. Tiles are sized to fit in L2 and built in the scratch arena of the
+ * current context's thread, so the whole im2col matrix is never materialised.
+ * Bias and activation are fused into the GEMM, and 1x1 convolutions with unit
+ * stride and no padding multiply the input directly. 3x3 convolutions may use
+ * Winograd instead, with the filter transformed on every call and no fallback
+ * to im2col on numerical error, see rot_conv2d_algo. NHWC convolutions with
+ * one group and one filter per channel, i.e. depthwise, are computed directly
+ * with the channels in the SIMD lanes.
+ *
+ * Returns NULL on error, otherwise returns result.
+ */
+rot_tensor_t ROT_conv2d(rot_tensor_t result,
+                        const rot_tensor_t input,
+                        const rot_tensor_t filter,
+                        const rot_tensor_t bias,
+                        const struct rot_conv2d_params *params);
+
+/**
+ * ROT_winograd_transform_filter() - Transforms a 3x3 filter for
+ * ROT_conv2d_winograd, so that it can be transformed once and reused.
+ * @arena: Arena to allocate the transformed filter from.
+ * @filter: Filter of a convolution without groups, as for ROT_conv2d, with
+ * 3x3 taps.
+ * @layout: Layout of `filter`.
+ *
+ * Returns NULL on error, otherwise a [36, out channels, in channels] tensor
+ * holding the filter in the Winograd F(4x4, 3x3) domain.
+ */
+rot_tensor_t ROT_winograd_transform_filter(rot_arena_t arena,
+                                           const rot_tensor_t filter,
+                                           enum rot_layout layout);
+
+/**
+ * ROT_conv2d_winograd() - ROT_conv2d with Winograd F(4x4, 3x3) and a filter
+ * from ROT_winograd_transform_filter.
+ * @params: Must have unit strides and dilations, and one group.
+ *
+ * The output is computed in 4x4 tiles, each from a 6x6 window of the input.
+ * Blocks of tiles are transformed into 36 matrices, one per point of the
+ * transform, which are each multiplied by the matching transformed filter in
+ * one GEMM, and then transformed back with the bias and activation applied.
+ * Blocks are sized so that their transforms stay in cache, and are spread
+ * across the current context's threads.
+ *
+ * Returns NULL on error, otherwise returns result.
+ */
+rot_tensor_t ROT_conv2d_winograd(rot_tensor_t result,
+                                 const rot_tensor_t input,
+                                 const rot_tensor_t transformed_filter,
+                                 const rot_tensor_t bias,
+                                 const struct rot_conv2d_params *params);
+
+/**
+ * ROT_conv2d_depthwise_separable() - Fused depthwise separable convolution,
+ * result <- pointwise_activation(conv1x1(activation(depthwise(input)))),
+ * where `activation` is the one in `params`, and both convolutions add their
+ * bias before their activation.
+ * @result: [batch, height, width, pointwise out channels] output images,
+ * with the height and width of the depthwise convolution.
+ * @input: [batch, height, width, channels] input images.
+ * @depthwise_filter: [channels, height, width, 1] filter.
+ * @depthwise_bias: One element per channel, or NULL.
+ * @pointwise_filter: [out channels, 1, 1, channels] filter.
+ * @pointwise_bias: One element per output channel, or NULL.
+ * @params: Hyperparameters of the depthwise convolution, which must be NHWC
+ * with one group per channel.
+ * @pointwise_activation: Nonlinearity applied to the result.
+ *
+ * The depthwise output is computed a few rows at a time into the scratch
+ * arena of the current context's thread, and multiplied by the pointwise
+ * filter while still in L2, so it is never written to memory in full.
+ *
+ * Returns NULL on error, otherwise returns result.
+ */
+rot_tensor_t
+ROT_conv2d_depthwise_separable(rot_tensor_t result,
+                               const rot_tensor_t input,
+                               const rot_tensor_t depthwise_filter,
+                               const rot_tensor_t depthwise_bias,
+                               const rot_tensor_t pointwise_filter,
+                               const rot_tensor_t pointwise_bias,
+                               const struct rot_conv2d_params *params,
+                               enum rot_activation pointwise_activation);
+
+/**
+ * struct rot_pool2d_params - Hyperparameters of a 2D pooling.
+ * @kernel: Height and width of the pooling window, of at most 256 taps.
+ * @stride: Vertical and horizontal distance between windows.
+ * @padding: Implicit padding of each side of the input, of at most half a
+ * window. Padding is left out of maxima and averages, so every average is
+ * over the taps inside the input.
+ * @layout: Layout of the images.
+ */
+struct rot_pool2d_params {
+        uint32_t kernel[2];
+        uint32_t stride[2];
+        uint32_t padding[2];
+        enum rot_layout layout;
+};
+
+/**
+ * ROT_maxpool2d() - 2D max pooling, result <- max over each window of input.
+ * @result: Output images, with the input's layout, batch size and channels.
+ * Their height is (height + 2*padding[0] - kernel[0])/stride[0] + 1, and
+ * their width likewise.
+ * @argmax: If not NULL, set to the argmax indices for ROT_maxpool2d_backward,
+ * allocated from `arena`. These are one byte per element of `result`, in the
+ * same order, holding the offset kh*kernel[1] + kw of the maximum in its
+ * window.
+ * @arena: Arena to allocate the argmax indices from, if `argmax` is not NULL.
+ * @input: Input images.
+ * @params: Hyperparameters of the pooling.
+ *
+ * All tensors must be contiguous float32 CPU tensors, and `result` must not
+ * overlap `input`. NHWC pools every channel of a pixel at once, in SIMD
+ * lanes, and is split across threads by rows of output. NCHW is split across
+ * threads by channel. Ties go to the first tap of the window.
+ *
+ * Returns NULL on error, otherwise returns result.
+ */
+rot_tensor_t ROT_maxpool2d(rot_tensor_t result,
+                           uint8_t **argmax,
+                           rot_arena_t arena,
+                           const rot_tensor_t input,
+                           const struct rot_pool2d_params *params);
+
+/**
+ * ROT_maxpool2d_backward() - Max pooling backward pass, which routes the
+ * gradient of each output to the input at its argmax.
+ * @input_grad: Gradient with respect to the pooling input, overwritten.
+ * @output_grad: Gradient with respect to the pooling output.
+ * @argmax: Argmax indices from the forward ROT_maxpool2d.
+ * @params: Hyperparameters of the forward pooling.
+ *
+ * The input is not needed, since the argmax indices say where each maximum
+ * came from. Work is split across threads by image and channel.
+ *
+ * Returns NULL on error, otherwise returns input_grad.
+ */
+rot_tensor_t ROT_maxpool2d_backward(rot_tensor_t input_grad,
+                                    const rot_tensor_t output_grad,
+                                    const uint8_t *argmax,
+                                    const struct rot_pool2d_params *params);
+
+/**
+ * ROT_avgpool2d() - 2D average pooling, result <- mean over each window of
+ * input, as for ROT_maxpool2d.
+ *
+ * Returns NULL on error, otherwise returns result.
+ */
+rot_tensor_t ROT_avgpool2d(rot_tensor_t result,
+                           const rot_tensor_t input,
+                           const struct rot_pool2d_params *params);
+
+/**
+ * ROT_avgpool2d_backward() - Average pooling backward pass, which spreads the
+ * gradient of each output evenly over its window.
+ * @input_grad: Gradient with respect to the pooling input, overwritten.
+ * @output_grad: Gradient with respect to the pooling output.
+ * @params: Hyperparameters of the forward pooling.
+ *
+ * Returns NULL on error, otherwise returns input_grad.
+ */
+rot_tensor_t ROT_avgpool2d_backward(rot_tensor_t input_grad,
+                                    const rot_tensor_t output_grad,
+                                    const struct rot_pool2d_params *params);
+
+/**
+ * ROT_global_avgpool2d() - Global average pooling, result <- mean of each
+ * channel of each image.
+ * @result: Contiguous [batch, channels] tensor, which may have trailing
+ * dimensions of 1, e.g. [batch, channels, 1, 1].
+ * @input: Input images.
+ * @layout: Layout of `input`.
+ *
+ * Returns NULL on error, otherwise returns result.
+ */
+rot_tensor_t ROT_global_avgpool2d(rot_tensor_t result,
+                                  const rot_tensor_t input,
+                                  enum rot_layout layout);
+
+/**
+ * ROT_global_avgpool2d_backward() - Global average pooling backward pass,
+ * which spreads each channel's gradient evenly over its image.
+ * @input_grad: Gradient with respect to the pooling input, overwritten.
+ * @output_grad: Gradient with respect to the pooled [batch, channels].
+ * @layout: Layout of `input_grad`.
+ *
+ * Returns NULL on error, otherwise returns input_grad.
+ */
+rot_tensor_t ROT_global_avgpool2d_backward(rot_tensor_t input_grad,
+                                           const rot_tensor_t output_grad,
+                                           enum rot_layout layout);
+
+/**
+ * struct rot_norm_params - Hyperparameters of a normalisation.
+ * @epsilon: Added to the variance before taking its square root.
+ * @momentum: Weight of each batch in batch normalisation's running
+ * statistics, running <- (1 - momentum)*running + momentum*batch. Unused by
+ * layer normalisation.
+ * @relu: Apply max(y, 0) to the output in the same pass, and mask the
+ * gradient to match in the backward pass.
+ * @layout: Layout of batch normalisation's images. Unused by layer
+ * normalisation.
+ */
+struct rot_norm_params {
+        float epsilon;
+        float momentum;
+        bool relu;
+        enum rot_layout layout;
+};
+
+/**
+ * struct rot_norm_stats - Statistics saved by the forward pass of a
+ * normalisation for its backward pass.
+ * @mean: Mean of each group of normalised elements, i.e. of each row for
+ * layer normalisation and of each channel for batch normalisation.
+ * @rstd: Reciprocal standard deviation 1/sqrt(variance + epsilon) of each
+ * group.
+ * @count: Number of groups.
+ */
+struct rot_norm_stats {
+        float *mean;
+        float *rstd;
+        size_t count;
+};
+
+/**
+ * ROT_layernorm() - Layer normalisation over the last dimension,
+ * result <- (input - mean)/sqrt(variance + epsilon)*gamma + beta.
+ * @result: Output, with the same dimensions as `input`. May be `input`
+ * itself, but must not otherwise overlap it.
+ * @stats: If not NULL, filled in with the mean and reciprocal standard
+ * deviation of each row, allocated from `arena`.
+ * @arena: Arena to allocate the statistics from, if `stats` is not NULL.
+ * @input: Input, whose rows along the last dimension are normalised.
+ * @gamma, @beta: Scale and shift, with one element per column. Either both
+ * or neither may be NULL, for no scale and shift.
+ * @params: Hyperparameters of the normalisation.
+ *
+ * All tensors must be contiguous float32 CPU tensors. Each row's mean and
+ * variance are found in one pass with Welford's algorithm, and the row is
+ * then normalised, scaled, shifted and optionally ReLUed in a second pass
+ * while it is still in cache. Rows are split across threads.
+ *
+ * Returns NULL on error, otherwise returns result.
+ */
+rot_tensor_t ROT_layernorm(rot_tensor_t result,
+                           struct rot_norm_stats *stats,
+                           rot_arena_t arena,
+                           const rot_tensor_t input,
+                           const rot_tensor_t gamma,
+                           const rot_tensor_t beta,
+                           const struct rot_norm_params *params);
+
+/**
+ * ROT_layernorm_backward() - Layer normalisation backward pass.
+ * @input_grad: Gradient with respect to `input`, overwritten. May be
+ * `output_grad`, but must not otherwise overlap it.
+ * @gamma_grad, @beta_grad: If not NULL, overwritten with the gradients with
+ * respect to `gamma` and `beta`.
+ * @output_grad: Gradient with respect to the forward result.
+ * @input, @gamma, @beta: Operands of the forward pass.
+ * @stats: Statistics saved by the forward pass.
+ * @params: Hyperparameters of the forward pass.
+ *
+ * The normalised input, and for ReLU the output, are recomputed from `input`
+ * and `stats` rather than read back. Rows are split across threads, which
+ * sum their own partial gradients of `gamma` and `beta`.
+ *
+ * Returns NULL on error, otherwise returns input_grad.
+ */
+rot_tensor_t ROT_layernorm_backward(rot_tensor_t input_grad,
+                                    rot_tensor_t gamma_grad,
+                                    rot_tensor_t beta_grad,
+                                    const rot_tensor_t output_grad,
+                                    const rot_tensor_t input,
+                                    const rot_tensor_t gamma,
+                                    const rot_tensor_t beta,
+                                    const struct rot_norm_stats *stats,
+                                    const struct rot_norm_params *params);
+
+/**
+ * ROT_batchnorm() - Batch normalisation in training mode, which normalises
+ * each channel by its mean and variance over the batch and image,
+ * result <- (input - mean)/sqrt(variance + epsilon)*gamma + beta.
+ * @result: Output, with the same dimensions as `input`. May be `input`
+ * itself, but must not otherwise overlap it.
+ * @stats: If not NULL, filled in with the mean and reciprocal standard
+ * deviation of each channel, allocated from `arena`.
+ * @arena: Arena to allocate the statistics from, if `stats` is not NULL.
+ * @input: Input images, in `params->layout`.
+ * @gamma, @beta: Scale and shift, with one element per channel. Either both
+ * or neither may be NULL.
+ * @running_mean, @running_var: If not NULL, running statistics with one
+ * element per channel, updated with `params->momentum`. The running variance
+ * is unbiased.
+ * @params: Hyperparameters of the normalisation.
+ *
+ * All tensors must be contiguous float32 CPU tensors. Statistics are found
+ * in one pass with Welford's algorithm, split across threads by channel, and
+ * the images are then normalised, scaled, shifted and optionally ReLUed in
+ * one pass split across threads by planes (NCHW) or pixels (NHWC).
+ *
+ * Returns NULL on error, otherwise returns result.
+ */
+rot_tensor_t ROT_batchnorm(rot_tensor_t result,
+                           struct rot_norm_stats *stats,
+                           rot_arena_t arena,
+                           const rot_tensor_t input,
+                           const rot_tensor_t gamma,
+                           const rot_tensor_t beta,
+                           rot_tensor_t running_mean,
+                           rot_tensor_t running_var,
+                           const struct rot_norm_params *params);
+
+/**
+ * ROT_batchnorm_inference() - Batch normalisation in inference mode, which
+ * normalises by `running_mean` and `running_var` in one fused pass.
+ *
+ * Operands are as for ROT_batchnorm, except that the running statistics are
+ * required and only read.
+ *
+ * Returns NULL on error, otherwise returns result.
+ */
+rot_tensor_t ROT_batchnorm_inference(rot_tensor_t result,
+                                     const rot_tensor_t input,
+                                     const rot_tensor_t gamma,
+                                     const rot_tensor_t beta,
+                                     const rot_tensor_t running_mean,
+                                     const rot_tensor_t running_var,
+                                     const struct rot_norm_params *params);
+
+/**
+ * ROT_batchnorm_backward() - Batch normalisation backward pass, for the
+ * training mode forward pass.
+ *
+ * Operands are as for ROT_layernorm_backward, with the statistics saved by
+ * ROT_batchnorm. The sums over each channel are split across threads by
+ * channel, and the input gradient by planes or pixels as in the forward pass.
+ *
+ * Returns NULL on error, otherwise returns input_grad.
+ */
+rot_tensor_t ROT_batchnorm_backward(rot_tensor_t input_grad,
+                                    rot_tensor_t gamma_grad,
+                                    rot_tensor_t beta_grad,
+                                    const rot_tensor_t output_grad,
+                                    const rot_tensor_t input,
+                                    const rot_tensor_t gamma,
+                                    const rot_tensor_t beta,
+                                    const struct rot_norm_stats *stats,
+                                    const struct rot_norm_params *params);
+
 #endif /* ROT_NN_H */
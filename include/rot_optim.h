@@ -0,0 +1,108 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ROT_OPTIM_H
+#define ROT_OPTIM_H
+
+#include "rot_arena.h"  /* for rot_arena_t */
+#include "rot_math.h"   /* for rot_tensor_t */
+#include <stddef.h>     /* for size_t */
+
+typedef struct rot_optim *rot_optim_t;
+
+/**
+ * enum rot_optim_algo - Update rule of an optimizer.
+ * @ROT_OPTIM_SGD: Stochastic gradient descent, with optional momentum,
+ * v <- momentum*v + g, param <- param - learning_rate*v.
+ * @ROT_OPTIM_ADAM: Adam, with bias corrected first and second moment
+ * estimates of the gradient.
+ * @ROT_OPTIM_ADAMW: Adam with weight decay decoupled from the gradient.
+ */
+enum rot_optim_algo {
+        ROT_OPTIM_SGD = 0,
+        ROT_OPTIM_ADAM = 1,
+        ROT_OPTIM_ADAMW = 2,
+};
+
+/**
+ * struct rot_optim_params - Hyperparameters of an optimizer.
+ * @algo: Update rule.
+ * @learning_rate: Step size.
+ * @momentum: SGD momentum, or zero for plain SGD.
+ * @nesterov: Use Nesterov momentum for SGD, stepping along g + momentum*v.
+ * @beta1, @beta2: Adam decay rates of the first and second moment estimates.
+ * @epsilon: Added to the square root of Adam's second moment estimate.
+ * @weight_decay: For SGD and Adam, an L2 penalty that adds
+ * weight_decay*param to the gradient. For AdamW, decoupled decay,
+ * param <- param*(1 - learning_rate*weight_decay), before the Adam step.
+ */
+struct rot_optim_params {
+        enum rot_optim_algo algo;
+        float learning_rate;
+        float momentum;
+        bool nesterov;
+        float beta1;
+        float beta2;
+        float epsilon;
+        float weight_decay;
+};
+
+/**
+ * ROT_optim_new() - Creates an optimizer for `num_params` parameters.
+ * @arena: Arena from which the optimizer and its state, i.e. SGD's velocity
+ * or Adam's moment estimates, are allocated. The state starts at zero.
+ * @num_params: Number of float32 parameters updated by each step, typically
+ * a flat region of the arena that the model's parameter tensors are views
+ * of.
+ * @params: Hyperparameters, which are copied.
+ *
+ * Returns NULL on error.
+ */
+rot_optim_t ROT_optim_new(rot_arena_t arena,
+                          size_t num_params,
+                          const struct rot_optim_params *params);
+
+/**
+ * ROT_optim_set_learning_rate() - Sets the learning rate of later steps, e.g.
+ * for a schedule.
+ *
+ * Returns NULL if optim is NULL, otherwise returns optim.
+ */
+rot_optim_t ROT_optim_set_learning_rate(rot_optim_t optim,
+                                        float learning_rate);
+
+/**
+ * ROT_optim_step() - Updates `params` in place from their gradients `grads`.
+ * @optim: Optimizer, whose state is updated along with the parameters.
+ * @params: Contiguous float32 CPU tensor of the optimizer's `num_params`
+ * parameters.
+ * @grads: Contiguous float32 CPU tensor of the gradients of `params`, with
+ * the same number of elements.
+ *
+ * `params`, `grads` and the optimizer's state must not overlap.
+ *
+ * Each element's parameter, gradient and state are read and written once,
+ * in a single vectorised sweep that is split across threads in chunks.
+ *
+ * Returns NULL on error, otherwise returns optim.
+ */
+rot_optim_t ROT_optim_step(rot_optim_t optim,
+                           rot_tensor_t params,
+                           const rot_tensor_t grads);
+
+#endif /* ROT_OPTIM_H */
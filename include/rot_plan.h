@@ -0,0 +1,113 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ROT_PLAN_H
+#define ROT_PLAN_H
+
+#include "rot_arena.h"  /* for rot_arena_t */
+#include "rot_math.h"   /* for rot_tensor_t */
+
+typedef struct rot_plan *rot_plan_t;
+
+/**
+ * ROT_plan_new() - Creates a static memory plan.
+ * @arena: Arena from which the plan, its tensors' metadata and finally the
+ * planned region are allocated.
+ * @max_tensors: Maximum number of planned tensors, at least one.
+ *
+ * A plan is used in three phases:
+ *
+ * 1. Declare the intermediate tensors of a graph with ROT_plan_create_tensor.
+ * These are ordinary tensors, except that they have no data yet.
+ *
+ * 2. Record the graph's ops, in execution order, with ROT_plan_record_op.
+ * This gives every planned tensor a lifetime, from the first op that uses it
+ * to the last.
+ *
+ * 3. Call ROT_plan_allocate, which places tensors whose lifetimes do not
+ * overlap at overlapping offsets of one region allocated from the arena, and
+ * points each tensor's data into that region.
+ *
+ * Afterwards the graph's ops are run on the planned tensors as usual.
+ *
+ * Returns NULL on error.
+ */
+rot_plan_t ROT_plan_new(rot_arena_t arena, uint32_t max_tensors);
+
+/**
+ * ROT_plan_create_tensor() - Creates a CPU tensor whose data will be placed by
+ * `plan`.
+ *
+ * The tensor's data pointer is NULL until ROT_plan_allocate is called.
+ * Returns NULL on error.
+ */
+rot_tensor_t ROT_plan_create_tensor(rot_plan_t plan,
+                                    uint32_t num_dims,
+                                    const size_t *dims);
+
+/**
+ * ROT_plan_record_op() - Records the next op of the graph.
+ * @plan: Plan being recorded.
+ * @tensors: Every tensor read or written by the op. Tensors that were not
+ * created by ROT_plan_create_tensor, such as weights and graph inputs, are
+ * ignored.
+ * @num_tensors: Number of tensors in `tensors`.
+ *
+ * Returns NULL on error, otherwise plan.
+ */
+rot_plan_t ROT_plan_record_op(rot_plan_t plan,
+                              const rot_tensor_t *tensors,
+                              uint32_t num_tensors);
+
+/**
+ * ROT_plan_keep() - Keeps `tensor` alive until the end of the graph, e.g.
+ * because it is a graph output or is needed by a backward pass.
+ *
+ * Returns NULL on error, otherwise plan.
+ */
+rot_plan_t ROT_plan_keep(rot_plan_t plan, const rot_tensor_t tensor);
+
+/**
+ * ROT_plan_allocate() - Assigns offsets to all planned tensors and allocates
+ * the planned region from the plan's arena.
+ *
+ * Tensors are placed greedily by decreasing size, each at the lowest offset
+ * that does not overlap any already placed tensor with an intersecting
+ * lifetime. Offsets are aligned to 64 bytes. Tensors never used by a recorded
+ * op are kept alive for the whole graph.
+ *
+ * No ops can be recorded after allocation. Returns NULL on error, otherwise
+ * plan.
+ */
+rot_plan_t ROT_plan_allocate(rot_plan_t plan);
+
+/**
+ * ROT_plan_get_peak_bytes() - Returns the size of the planned region, or zero
+ * if `plan` has not been allocated.
+ */
+size_t ROT_plan_get_peak_bytes(const rot_plan_t plan);
+
+/**
+ * ROT_plan_get_bump_bytes() - Returns the bytes that the planned tensors would
+ * take if each were allocated separately with ROT_create_tensor, including
+ * the padding that aligns each one's data, for comparison with
+ * ROT_plan_get_peak_bytes.
+ */
+size_t ROT_plan_get_bump_bytes(const rot_plan_t plan);
+
+#endif /* ROT_PLAN_H */
@@ -0,0 +1,103 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ROT_SPARSE_H
+#define ROT_SPARSE_H
+
+#include "rot_arena.h"  /* for rot_arena_t */
+#include "rot_math.h"   /* for rot_tensor_t */
+#include <stddef.h>     /* for size_t */
+
+typedef struct rot_sparse *rot_sparse_t;
+
+/**
+ * enum rot_sparse_format - Layout of the nonzeros of a sparse matrix.
+ * @ROT_SPARSE_CSR: Compressed sparse rows, storing single nonzero elements.
+ * @ROT_SPARSE_BSR_4X4: Block compressed sparse rows, storing the 4x4 blocks
+ * that have a nonzero element.
+ * @ROT_SPARSE_BSR_8X1: Block compressed sparse rows, storing the 8x1 column
+ * blocks that have a nonzero element.
+ *
+ * Blocks are stored whole, zeros included, so a block format stores more
+ * values than CSR for the same matrix. In exchange, each row of the dense
+ * operand of a matmul is read once per block rather than once per element,
+ * and the products are computed in vector registers without indexing. Block
+ * formats suit matrices pruned in blocks of their shape.
+ */
+enum rot_sparse_format {
+        ROT_SPARSE_CSR = 0,
+        ROT_SPARSE_BSR_4X4 = 1,
+        ROT_SPARSE_BSR_8X1 = 2,
+};
+
+/**
+ * ROT_sparse_from_dense() - Creates a sparse copy of the nonzero elements or
+ * blocks of `dense`.
+ * @arena: Arena the sparse matrix is allocated from, in one piece.
+ * @dense: float32 CPU matrix, with any strides.
+ * @format: Layout to store the nonzeros in.
+ *
+ * Blocks at the bottom and right edges of a matrix whose dimensions are not
+ * multiples of the block's are padded with zeros.
+ *
+ * Returns NULL on error.
+ */
+rot_sparse_t ROT_sparse_from_dense(rot_arena_t arena,
+                                   const rot_tensor_t dense,
+                                   enum rot_sparse_format format);
+
+/**
+ * ROT_sparse_to_dense() - Writes `sparse` into the dense matrix `result`,
+ * zeros included.
+ * @result: float32 CPU matrix of the same dimensions as `sparse`.
+ *
+ * Returns NULL on error, otherwise result.
+ */
+rot_tensor_t ROT_sparse_to_dense(rot_tensor_t result,
+                                 const rot_sparse_t sparse);
+
+/**
+ * ROT_sparse_matmul() - Sparse-dense matrix multiply, result <- a*b.
+ * @result: mxn float32 CPU matrix with contiguous rows. Must not overlap `b`.
+ * @a: mxk sparse matrix, e.g. pruned weights.
+ * @b: kxn float32 CPU matrix with contiguous rows, e.g. a batch of n column
+ * vectors of activations.
+ *
+ * Rows of blocks of `a` are split across the current context's threads. Each
+ * row of blocks is multiplied with a panel of `b` at a time, in vector
+ * accumulators that are written to `result` once, and only the rows of `b`
+ * matching stored blocks are read.
+ *
+ * Returns NULL on error, otherwise result.
+ */
+rot_tensor_t ROT_sparse_matmul(rot_tensor_t result,
+                               const rot_sparse_t a,
+                               const rot_tensor_t b);
+
+/**
+ * ROT_sparse_get_dims() - Returns the two dimensions of `sparse`.
+ */
+const size_t *ROT_sparse_get_dims(const rot_sparse_t sparse);
+
+/**
+ * ROT_sparse_get_nnz() - Returns the number of values stored by `sparse`,
+ * including the zeros inside stored blocks.
+ */
+size_t ROT_sparse_get_nnz(const rot_sparse_t sparse);
+
+#endif /* ROT_SPARSE_H */
@@ -0,0 +1,101 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef ROT_TAPE_H
+#define ROT_TAPE_H
+
+#include "rot_arena.h"  /* for rot_arena_t */
+#include "rot_math.h"   /* for rot_tensor_t */
+
+typedef struct rot_tape *rot_tape_t;
+
+/**
+ * ROT_tape_new() - Creates a gradient tape for reverse-mode differentiation.
+ * @arena: Arena from which the tape, and every gradient tensor it needs, is
+ * allocated.
+ * @max_ops: Maximum number of ops that can be recorded between resets, at
+ * least one.
+ *
+ * Ops are recorded by calling the ROT_tape_* variants of the forward ops, then
+ * differentiated by ROT_backward. Gradient tensors are allocated from `arena`
+ * the first time a tensor is seen by the tape, and are reused by every later
+ * step that records the same tensors, or fresh tensors of the same dimensions.
+ * So after the first training iteration recording and backpropagating
+ * allocate no memory at all.
+ *
+ * Returns NULL on error.
+ */
+rot_tape_t ROT_tape_new(rot_arena_t arena, uint32_t max_ops);
+
+/**
+ * ROT_tape_reset() - Forgets all recorded ops, keeping the gradient tensors
+ * for reuse by the next step.
+ *
+ * Tensors that the next step does not record again are forgotten too, and
+ * their gradient tensors are handed to the new tensors it records.
+ *
+ * Returns NULL if tape is NULL, otherwise returns tape.
+ */
+rot_tape_t ROT_tape_reset(rot_tape_t tape);
+
+/**
+ * ROT_tape_matmul() - ROT_matmul(result, a, b), recorded on `tape`.
+ *
+ * Only 2D CPU tensors are supported. Returns NULL on error, otherwise
+ * `result`.
+ */
+rot_tensor_t ROT_tape_matmul(rot_tape_t tape,
+                             rot_tensor_t result,
+                             const rot_tensor_t a,
+                             const rot_tensor_t b);
+
+/**
+ * ROT_tape_relu() - In-place ROT_relu(tensor), recorded on `tape`.
+ *
+ * Since the ReLU is in place, ops recorded before it that read `tensor` see
+ * its rectified value during the backward pass. Returns NULL on error,
+ * otherwise `tensor`.
+ */
+rot_tensor_t ROT_tape_relu(rot_tape_t tape, rot_tensor_t tensor);
+
+/**
+ * ROT_backward() - Backpropagates `output_grad` through every op on `tape`.
+ * @tape: Tape of recorded ops.
+ * @output: Tensor produced by a recorded op.
+ * @output_grad: Gradient of the loss with respect to `output`, with the same
+ * dimensions.
+ *
+ * Ops are replayed in reverse order, each with a fused adjoint kernel: the
+ * matmul adjoints are transposed GEMMs that accumulate straight into the
+ * operand gradients, and the ReLU adjoint is a masked pass in place. Afterwards
+ * ROT_tape_get_grad returns the gradient of every recorded tensor, which is
+ * zero for tensors that `output` does not depend on.
+ *
+ * Returns NULL on error, otherwise tape.
+ */
+rot_tape_t ROT_backward(rot_tape_t tape,
+                        const rot_tensor_t output,
+                        const rot_tensor_t output_grad);
+
+/**
+ * ROT_tape_get_grad() - Returns the gradient tensor of `tensor`, or NULL if
+ * `tensor` has not been recorded on `tape` since the last reset.
+ */
+rot_tensor_t ROT_tape_get_grad(rot_tape_t tape, const rot_tensor_t tensor);
+
+#endif /* ROT_TAPE_H */
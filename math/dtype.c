@@ -0,0 +1,577 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "math/dtype.h"
+#include "platform/cpu.h"  /* for cpu_get_isa, cpu_has_feature */
+
+#include <immintrin.h>     /* for _mm512_cvtneps_pbh, _mm256_cvtph_ps, ... */
+#include <math.h>          /* for nearbyintf, fminf, fmaxf */
+
+float dtype_f16_to_float(uint16_t x)
+{
+        uint32_t sign = (uint32_t)(x & 0x8000) << 16;
+        uint32_t exponent = (x >> 10) & 0x1F;
+        uint32_t mantissa = x & 0x3FF;
+
+        uint32_t bits;
+        if (exponent == 0x1F) {
+                bits = sign | 0x7F800000 | (mantissa << 13);
+        } else if (exponent != 0) {
+                bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+        } else {
+                /**
+                 * NOTE(brendan): Half precision denormals are mantissa*2^-24,
+                 * which is exact in single precision.
+                 */
+                float result = mantissa*(1.0f/16777216.0f);
+                return sign ? -result : result;
+        }
+
+        float result;
+        memcpy(&result, &bits, sizeof(result));
+
+        return result;
+}
+
+uint16_t dtype_float_to_f16(float x)
+{
+        uint32_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+
+        uint16_t sign = (bits >> 16) & 0x8000;
+        uint32_t abs_bits = bits & 0x7FFFFFFF;
+
+        if (abs_bits > 0x7F800000)
+                return sign | 0x7E00 | ((abs_bits >> 13) & 0x3FF);
+
+        /* NOTE(brendan): Halfway between 65504 and 65536 rounds up to inf. */
+        if (abs_bits >= 0x477FF000)
+                return sign | 0x7C00;
+
+        if (abs_bits < 0x38800000) {
+                /**
+                 * NOTE(brendan): Adding 0.5 lines the bits of a half precision
+                 * denormal up with the bottom of the single precision
+                 * mantissa, and the FPU rounds the rest off to nearest even.
+                 */
+                const uint32_t magic_bits = 126u << 23;
+                float magic;
+                memcpy(&magic, &magic_bits, sizeof(magic));
+
+                float abs_x;
+                memcpy(&abs_x, &abs_bits, sizeof(abs_x));
+                abs_x += magic;
+
+                uint32_t rounded;
+                memcpy(&rounded, &abs_x, sizeof(rounded));
+                return sign | (rounded - magic_bits);
+        }
+
+        uint32_t mantissa_odd = (abs_bits >> 13) & 1;
+        abs_bits += ((uint32_t)(15 - 127) << 23) + 0xFFF + mantissa_odd;
+
+        return sign | (abs_bits >> 13);
+}
+
+static void
+bf16_to_float_generic(const uint16_t *src, float *dst, size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                dst[i] = dtype_bf16_to_float(src[i]);
+        }
+}
+
+static void
+float_to_bf16_generic(const float *src, uint16_t *dst, size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                dst[i] = dtype_float_to_bf16(src[i]);
+        }
+}
+
+static void
+f16_to_float_generic(const uint16_t *src, float *dst, size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                dst[i] = dtype_f16_to_float(src[i]);
+        }
+}
+
+static void
+float_to_f16_generic(const float *src, uint16_t *dst, size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                dst[i] = dtype_float_to_f16(src[i]);
+        }
+}
+
+__attribute__((target("avx2")))
+static void
+bf16_to_float_avx2(const uint16_t *src, float *dst, size_t num_elems)
+{
+        size_t i = 0;
+        for (;
+             i + 8 <= num_elems;
+             i += 8) {
+                __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+                __m256i bits = _mm256_slli_epi32(_mm256_cvtepu16_epi32(x), 16);
+                _mm256_storeu_ps(dst + i, _mm256_castsi256_ps(bits));
+        }
+
+        bf16_to_float_generic(src + i, dst + i, num_elems - i);
+}
+
+__attribute__((target("avx2")))
+static void
+float_to_bf16_avx2(const float *src, uint16_t *dst, size_t num_elems)
+{
+        const __m256i abs_mask = _mm256_set1_epi32(0x7FFFFFFF);
+        const __m256i exponent_mask = _mm256_set1_epi32(0x7F800000);
+        const __m256i sign_mask = _mm256_set1_epi32(0x80000000);
+        const __m256i quiet_bit = _mm256_set1_epi32(0x400000);
+        const __m256i round_bias = _mm256_set1_epi32(0x7FFF);
+        const __m256i one = _mm256_set1_epi32(1);
+
+        size_t i = 0;
+        for (;
+             i + 8 <= num_elems;
+             i += 8) {
+                __m256i bits = _mm256_castps_si256(_mm256_loadu_ps(src + i));
+                __m256i lsb = _mm256_and_si256(_mm256_srli_epi32(bits, 16),
+                                               one);
+                __m256i rounded = _mm256_add_epi32(
+                        bits,
+                        _mm256_add_epi32(round_bias, lsb));
+
+                __m256i is_nan = _mm256_cmpgt_epi32(
+                        _mm256_and_si256(bits, abs_mask),
+                        exponent_mask);
+                rounded = _mm256_blendv_epi8(rounded,
+                                             _mm256_or_si256(bits, quiet_bit),
+                                             is_nan);
+
+                __m256i is_denormal = _mm256_cmpeq_epi32(
+                        _mm256_and_si256(bits, exponent_mask),
+                        _mm256_setzero_si256());
+                rounded = _mm256_blendv_epi8(rounded,
+                                             _mm256_and_si256(bits, sign_mask),
+                                             is_denormal);
+
+                rounded = _mm256_srli_epi32(rounded, 16);
+                __m128i packed = _mm_packus_epi32(
+                        _mm256_castsi256_si128(rounded),
+                        _mm256_extracti128_si256(rounded, 1));
+                _mm_storeu_si128((__m128i *)(dst + i), packed);
+        }
+
+        float_to_bf16_generic(src + i, dst + i, num_elems - i);
+}
+
+__attribute__((target("avx2,f16c")))
+static void
+f16_to_float_f16c(const uint16_t *src, float *dst, size_t num_elems)
+{
+        size_t i = 0;
+        for (;
+             i + 8 <= num_elems;
+             i += 8) {
+                __m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+                _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(x));
+        }
+
+        f16_to_float_generic(src + i, dst + i, num_elems - i);
+}
+
+__attribute__((target("avx2,f16c")))
+static void
+float_to_f16_f16c(const float *src, uint16_t *dst, size_t num_elems)
+{
+        size_t i = 0;
+        for (;
+             i + 8 <= num_elems;
+             i += 8) {
+                __m128i x = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                                            (_MM_FROUND_TO_NEAREST_INT |
+                                             _MM_FROUND_NO_EXC));
+                _mm_storeu_si128((__m128i *)(dst + i), x);
+        }
+
+        float_to_f16_generic(src + i, dst + i, num_elems - i);
+}
+
+__attribute__((target("avx512f")))
+static void
+bf16_to_float_avx512(const uint16_t *src, float *dst, size_t num_elems)
+{
+        size_t i = 0;
+        for (;
+             i + 16 <= num_elems;
+             i += 16) {
+                __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+                __m512i bits = _mm512_slli_epi32(_mm512_cvtepu16_epi32(x), 16);
+                _mm512_storeu_ps(dst + i, _mm512_castsi512_ps(bits));
+        }
+
+        bf16_to_float_generic(src + i, dst + i, num_elems - i);
+}
+
+__attribute__((target("avx512f")))
+static void
+float_to_bf16_avx512(const float *src, uint16_t *dst, size_t num_elems)
+{
+        const __m512i abs_mask = _mm512_set1_epi32(0x7FFFFFFF);
+        const __m512i exponent_mask = _mm512_set1_epi32(0x7F800000);
+        const __m512i sign_mask = _mm512_set1_epi32(0x80000000);
+        const __m512i quiet_bit = _mm512_set1_epi32(0x400000);
+        const __m512i round_bias = _mm512_set1_epi32(0x7FFF);
+        const __m512i one = _mm512_set1_epi32(1);
+
+        size_t i = 0;
+        for (;
+             i + 16 <= num_elems;
+             i += 16) {
+                __m512i bits = _mm512_castps_si512(_mm512_loadu_ps(src + i));
+                __m512i lsb = _mm512_and_si512(_mm512_srli_epi32(bits, 16),
+                                               one);
+                __m512i rounded = _mm512_add_epi32(
+                        bits,
+                        _mm512_add_epi32(round_bias, lsb));
+
+                __mmask16 is_nan = _mm512_cmpgt_epi32_mask(
+                        _mm512_and_si512(bits, abs_mask),
+                        exponent_mask);
+                rounded = _mm512_mask_mov_epi32(
+                        rounded,
+                        is_nan,
+                        _mm512_or_si512(bits, quiet_bit));
+
+                __mmask16 is_denormal = _mm512_testn_epi32_mask(bits,
+                                                                exponent_mask);
+                rounded = _mm512_mask_mov_epi32(
+                        rounded,
+                        is_denormal,
+                        _mm512_and_si512(bits, sign_mask));
+
+                __m256i packed = _mm512_cvtepi32_epi16(
+                        _mm512_srli_epi32(rounded, 16));
+                _mm256_storeu_si256((__m256i *)(dst + i), packed);
+        }
+
+        float_to_bf16_generic(src + i, dst + i, num_elems - i);
+}
+
+__attribute__((target("avx512f,avx512bf16")))
+static void
+float_to_bf16_avx512bf16(const float *src, uint16_t *dst, size_t num_elems)
+{
+        size_t i = 0;
+        for (;
+             i + 16 <= num_elems;
+             i += 16) {
+                __m256bh x = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+                _mm256_storeu_si256((__m256i *)(dst + i), (__m256i)x);
+        }
+
+        float_to_bf16_generic(src + i, dst + i, num_elems - i);
+}
+
+__attribute__((target("avx512f")))
+static void
+f16_to_float_avx512(const uint16_t *src, float *dst, size_t num_elems)
+{
+        size_t i = 0;
+        for (;
+             i + 16 <= num_elems;
+             i += 16) {
+                __m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+                _mm512_storeu_ps(dst + i, _mm512_cvtph_ps(x));
+        }
+
+        f16_to_float_generic(src + i, dst + i, num_elems - i);
+}
+
+__attribute__((target("avx512f")))
+static void
+float_to_f16_avx512(const float *src, uint16_t *dst, size_t num_elems)
+{
+        size_t i = 0;
+        for (;
+             i + 16 <= num_elems;
+             i += 16) {
+                __m256i x = _mm512_cvtps_ph(_mm512_loadu_ps(src + i),
+                                            (_MM_FROUND_TO_NEAREST_INT |
+                                             _MM_FROUND_NO_EXC));
+                _mm256_storeu_si256((__m256i *)(dst + i), x);
+        }
+
+        float_to_f16_generic(src + i, dst + i, num_elems - i);
+}
+
+void dtype_to_float(enum rot_dtype dtype,
+                    const void *src,
+                    float *dst,
+                    size_t num_elems)
+{
+        const uint16_t *src_16 = (const uint16_t *)src;
+        enum cpu_isa isa = cpu_get_isa();
+
+        switch (dtype) {
+        case ROT_DTYPE_BFLOAT16:
+                if (isa == CPU_ISA_AVX512)
+                        bf16_to_float_avx512(src_16, dst, num_elems);
+                else if (isa == CPU_ISA_AVX2)
+                        bf16_to_float_avx2(src_16, dst, num_elems);
+                else
+                        bf16_to_float_generic(src_16, dst, num_elems);
+                break;
+        case ROT_DTYPE_FLOAT16:
+                if (isa == CPU_ISA_AVX512)
+                        f16_to_float_avx512(src_16, dst, num_elems);
+                else if (cpu_has_feature(CPU_FEATURE_F16C))
+                        f16_to_float_f16c(src_16, dst, num_elems);
+                else
+                        f16_to_float_generic(src_16, dst, num_elems);
+                break;
+        default:
+                memcpy(dst, src, num_elems*sizeof(float));
+                break;
+        }
+}
+
+void dtype_from_float(enum rot_dtype dtype,
+                      const float *src,
+                      void *dst,
+                      size_t num_elems)
+{
+        uint16_t *dst_16 = (uint16_t *)dst;
+        enum cpu_isa isa = cpu_get_isa();
+
+        switch (dtype) {
+        case ROT_DTYPE_BFLOAT16:
+                if (cpu_has_feature(CPU_FEATURE_AVX512_BF16))
+                        float_to_bf16_avx512bf16(src, dst_16, num_elems);
+                else if (isa == CPU_ISA_AVX512)
+                        float_to_bf16_avx512(src, dst_16, num_elems);
+                else if (isa == CPU_ISA_AVX2)
+                        float_to_bf16_avx2(src, dst_16, num_elems);
+                else
+                        float_to_bf16_generic(src, dst_16, num_elems);
+                break;
+        case ROT_DTYPE_FLOAT16:
+                if (isa == CPU_ISA_AVX512)
+                        float_to_f16_avx512(src, dst_16, num_elems);
+                else if (cpu_has_feature(CPU_FEATURE_F16C))
+                        float_to_f16_f16c(src, dst_16, num_elems);
+                else
+                        float_to_f16_generic(src, dst_16, num_elems);
+                break;
+        default:
+                memcpy(dst, src, num_elems*sizeof(float));
+                break;
+        }
+}
+
+/**
+ * quantize_limits() - Sets `lo` and `hi` to the range of the 8-bit integer
+ * type `dtype`.
+ */
+static void
+quantize_limits(enum rot_dtype dtype, float *lo, float *hi)
+{
+        *lo = (dtype == ROT_DTYPE_INT8) ? -128.0f : 0.0f;
+        *hi = (dtype == ROT_DTYPE_INT8) ? 127.0f : 255.0f;
+}
+
+/**
+ * NOTE(brendan): The vector and scalar paths round and clamp in the same
+ * order, so that they agree exactly. NaNs quantize to the lower limit.
+ */
+static void
+quantize_generic(enum rot_dtype dtype,
+                 const float *src,
+                 uint8_t *dst,
+                 size_t num_elems,
+                 const float *scales,
+                 size_t scale_stride,
+                 int32_t zero_point)
+{
+        float lo;
+        float hi;
+        quantize_limits(dtype, &lo, &hi);
+
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                float x = nearbyintf(src[i]/scales[i*scale_stride]);
+                x = fminf(fmaxf(x + zero_point, lo), hi);
+                dst[i] = (uint8_t)(int32_t)x;
+        }
+}
+
+__attribute__((target("avx512f")))
+static void
+quantize_avx512(enum rot_dtype dtype,
+                const float *src,
+                uint8_t *dst,
+                size_t num_elems,
+                float scale,
+                int32_t zero_point)
+{
+        float lo;
+        float hi;
+        quantize_limits(dtype, &lo, &hi);
+
+        const __m512 scale_v = _mm512_set1_ps(scale);
+        const __m512 zero_point_v = _mm512_set1_ps(zero_point);
+        const __m512 lo_v = _mm512_set1_ps(lo);
+        const __m512 hi_v = _mm512_set1_ps(hi);
+        for (size_t i = 0;
+             i < num_elems;
+             i += 16) {
+                __mmask16 mask = ((num_elems - i >= 16) ?
+                                  0xFFFF : ((1u << (num_elems - i)) - 1));
+                __m512 x = _mm512_div_ps(_mm512_maskz_loadu_ps(mask, src + i),
+                                         scale_v);
+                x = _mm512_roundscale_ps(x,
+                                         (_MM_FROUND_TO_NEAREST_INT |
+                                          _MM_FROUND_NO_EXC));
+                x = _mm512_max_ps(_mm512_add_ps(x, zero_point_v), lo_v);
+                x = _mm512_min_ps(x, hi_v);
+                _mm512_mask_cvtepi32_storeu_epi8(dst + i,
+                                                 mask,
+                                                 _mm512_cvtps_epi32(x));
+        }
+}
+
+void dtype_quantize(enum rot_dtype dtype,
+                    const float *src,
+                    void *dst,
+                    size_t num_elems,
+                    const float *scales,
+                    size_t scale_stride,
+                    int32_t zero_point)
+{
+        uint8_t *dst_8 = (uint8_t *)dst;
+        if ((scale_stride == 0) && (cpu_get_isa() == CPU_ISA_AVX512)) {
+                quantize_avx512(dtype,
+                                src,
+                                dst_8,
+                                num_elems,
+                                *scales,
+                                zero_point);
+                return;
+        }
+
+        quantize_generic(dtype,
+                         src,
+                         dst_8,
+                         num_elems,
+                         scales,
+                         scale_stride,
+                         zero_point);
+}
+
+static void
+dequantize_generic(enum rot_dtype dtype,
+                   const void *src,
+                   float *dst,
+                   size_t num_elems,
+                   const float *scales,
+                   size_t scale_stride,
+                   int32_t zero_point)
+{
+        const int8_t *src_s8 = (const int8_t *)src;
+        const uint8_t *src_u8 = (const uint8_t *)src;
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                int32_t q = ((dtype == ROT_DTYPE_INT8) ?
+                             src_s8[i] : src_u8[i]);
+                dst[i] = scales[i*scale_stride]*(float)(q - zero_point);
+        }
+}
+
+__attribute__((target("avx512f")))
+static void
+dequantize_avx512(enum rot_dtype dtype,
+                  const void *src,
+                  float *dst,
+                  size_t num_elems,
+                  float scale,
+                  int32_t zero_point)
+{
+        const uint8_t *src_8 = (const uint8_t *)src;
+        const __m512 scale_v = _mm512_set1_ps(scale);
+        const __m512i zero_point_v = _mm512_set1_epi32(zero_point);
+        size_t i = 0;
+        for (;
+             i + 16 <= num_elems;
+             i += 16) {
+                __m128i q_8 = _mm_loadu_si128((const __m128i *)(src_8 + i));
+                __m512i q = ((dtype == ROT_DTYPE_INT8) ?
+                             _mm512_cvtepi8_epi32(q_8) :
+                             _mm512_cvtepu8_epi32(q_8));
+                q = _mm512_sub_epi32(q, zero_point_v);
+                _mm512_storeu_ps(dst + i,
+                                 _mm512_mul_ps(_mm512_cvtepi32_ps(q),
+                                               scale_v));
+        }
+
+        dequantize_generic(dtype,
+                           src_8 + i,
+                           dst + i,
+                           num_elems - i,
+                           &scale,
+                           0,
+                           zero_point);
+}
+
+void dtype_dequantize(enum rot_dtype dtype,
+                      const void *src,
+                      float *dst,
+                      size_t num_elems,
+                      const float *scales,
+                      size_t scale_stride,
+                      int32_t zero_point)
+{
+        if ((scale_stride == 0) && (cpu_get_isa() == CPU_ISA_AVX512)) {
+                dequantize_avx512(dtype,
+                                  src,
+                                  dst,
+                                  num_elems,
+                                  *scales,
+                                  zero_point);
+                return;
+        }
+
+        dequantize_generic(dtype,
+                           src,
+                           dst,
+                           num_elems,
+                           scales,
+                           scale_stride,
+                           zero_point);
+}
@@ -0,0 +1,154 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MATH_DTYPE_H
+#define MATH_DTYPE_H
+
+#include "rot_math.h"  /* for rot_dtype */
+#include <stddef.h>    /* for size_t */
+#include <stdint.h>    /* for uint16_t, uint32_t */
+#include <string.h>    /* for memcpy */
+
+/**
+ * dtype.h - Conversions between single precision and the 16-bit element
+ * types, bfloat16 and IEEE half precision, and quantization to and from the
+ * 8-bit integer types.
+ */
+
+/**
+ * dtype_get_size() - Returns the size in bytes of an element of type `dtype`.
+ */
+static inline size_t
+dtype_get_size(enum rot_dtype dtype)
+{
+        switch (dtype) {
+        case ROT_DTYPE_FLOAT32:
+                return sizeof(float);
+        case ROT_DTYPE_BFLOAT16:
+        case ROT_DTYPE_FLOAT16:
+                return sizeof(uint16_t);
+        case ROT_DTYPE_INT8:
+        case ROT_DTYPE_UINT8:
+                return sizeof(uint8_t);
+        default:
+                return 0;
+        }
+}
+
+/**
+ * dtype_is_quantized() - Are elements of type `dtype` integers that represent
+ * real numbers through a scale and zero point?
+ */
+static inline bool
+dtype_is_quantized(enum rot_dtype dtype)
+{
+        return (dtype == ROT_DTYPE_INT8) || (dtype == ROT_DTYPE_UINT8);
+}
+
+static inline float
+dtype_bf16_to_float(uint16_t x)
+{
+        uint32_t bits = (uint32_t)x << 16;
+        float result;
+        memcpy(&result, &bits, sizeof(result));
+
+        return result;
+}
+
+/**
+ * dtype_float_to_bf16() - Rounds `x` to the nearest bfloat16, with ties to
+ * even.
+ *
+ * NaNs stay NaNs, and denormals become zero of the same sign, matching
+ * VCVTNEPS2BF16.
+ */
+static inline uint16_t
+dtype_float_to_bf16(float x)
+{
+        uint32_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+
+        if ((bits & 0x7FFFFFFF) > 0x7F800000)
+                return (bits >> 16) | 0x40;
+
+        if ((bits & 0x7F800000) == 0)
+                return (bits >> 16) & 0x8000;
+
+        bits += 0x7FFF + ((bits >> 16) & 1);
+        return bits >> 16;
+}
+
+/**
+ * dtype_f16_to_float() - Widens the half precision float `x`, exactly.
+ */
+float dtype_f16_to_float(uint16_t x);
+
+/**
+ * dtype_float_to_f16() - Rounds `x` to the nearest half precision float, with
+ * ties to even. Values out of range become infinities, and NaNs stay NaNs.
+ */
+uint16_t dtype_float_to_f16(float x);
+
+/**
+ * dtype_to_float() - Widens `num_elems` consecutive elements of type `dtype`
+ * at `src` to floats in `dst`.
+ */
+void dtype_to_float(enum rot_dtype dtype,
+                    const void *src,
+                    float *dst,
+                    size_t num_elems);
+
+/**
+ * dtype_from_float() - Converts `num_elems` consecutive floats at `src` to
+ * elements of type `dtype` in `dst`, rounding as the scalar conversions do.
+ */
+void dtype_from_float(enum rot_dtype dtype,
+                      const float *src,
+                      void *dst,
+                      size_t num_elems);
+
+/**
+ * dtype_quantize() - Quantizes `num_elems` consecutive floats at `src` to the
+ * 8-bit integers of type `dtype` at `dst`, as
+ * clamp(round(src[i]/scales[i*scale_stride]) + zero_point).
+ * @scale_stride: 0 if every element shares `*scales`, or 1 for a scale per
+ * element.
+ *
+ * Rounding is to nearest even, and results saturate at the limits of `dtype`.
+ */
+void dtype_quantize(enum rot_dtype dtype,
+                    const float *src,
+                    void *dst,
+                    size_t num_elems,
+                    const float *scales,
+                    size_t scale_stride,
+                    int32_t zero_point);
+
+/**
+ * dtype_dequantize() - Inverse of dtype_quantize, dst[i] =
+ * scales[i*scale_stride]*(src[i] - zero_point).
+ */
+void dtype_dequantize(enum rot_dtype dtype,
+                      const void *src,
+                      float *dst,
+                      size_t num_elems,
+                      const float *scales,
+                      size_t scale_stride,
+                      int32_t zero_point);
+
+#endif /* MATH_DTYPE_H */
@@ -0,0 +1,1409 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "math/gemm.h"
+#include "error/log_error.h"  /* for LOG_ERROR */
+#include "math/dtype.h"       /* for dtype_to_float */
+#include "math/size_math.h"   /* for min_size, ceil_div, round_up */
+#include "math/vec_math.h"    /* for vec_activation_avx512, ... */
+#include "platform/context.h" /* for context_get_current, ... */
+#include "platform/cpu.h"     /* for cpu_get_isa */
+#include "platform/thread.h"  /* for parallel_for, thread_blas_begin, ... */
+
+#include "cblas.h"            /* for cblas_sgemm */
+
+#include <immintrin.h>        /* for __m256, __m512, _mm512_fmadd_ps, ... */
+#include <stdint.h>           /* for uint32_t */
+#include <stdlib.h>           /* for aligned_alloc, free */
+
+#define GEMM_MAX_MR 12
+#define GEMM_MAX_NR 32
+#define GEMM_MAX_KC 256
+#define GEMM_ALIGN_BYTES 64
+#define GEMM_PACK_PANELS_PER_TASK 8
+/**
+ * NOTE(brendan): Below roughly this many multiply-adds, the cost of waking
+ * helper threads outweighs the work they would take off the calling thread.
+ */
+#define GEMM_MIN_PARALLEL_MACS (64*64*64)
+#define GEMM_EPILOGUE_ROWS_PER_TASK 64
+
+/**
+ * struct gemm_tile_epilogue - `gemm_epilogue` restricted to a single mr x nr
+ * tile of C.
+ * @row_bias: mr floats of bias for the tile's rows, or NULL.
+ * @col_bias: nr floats of bias for the tile's columns, or NULL.
+ * @activation: Nonlinearity applied after the bias.
+ */
+struct gemm_tile_epilogue {
+        const float *row_bias;
+        const float *col_bias;
+        enum rot_activation activation;
+};
+
+/**
+ * gemm_microkernel_fn - Computes an mr x nr tile of C.
+ * @kc: Depth of the packed panels.
+ * @a_panel: kc columns of mr packed rows of op(A).
+ * @b_panel: kc rows of nr packed columns of op(B).
+ * @c: Top left corner of the output tile.
+ * @ldc: Row stride of `c`.
+ * @alpha: Scale applied to the product of the panels.
+ * @beta: Scale applied to the existing tile. If zero, `c` is not read.
+ * @epilogue: Applied to the tile before it is stored, or NULL.
+ */
+typedef void gemm_microkernel_fn(size_t kc,
+                                 const float *a_panel,
+                                 const float *b_panel,
+                                 float *c,
+                                 size_t ldc,
+                                 float alpha,
+                                 float beta,
+                                 const struct gemm_tile_epilogue *epilogue);
+
+/**
+ * struct gemm_kernel - Register and cache blocking parameters belonging to a
+ * microkernel.
+ * @mr, @nr: Rows and columns of the C tile computed by `microkernel`.
+ * @mc: Rows of op(A) packed per task, sized so the packed block sits in L2.
+ * @kc: Depth of a packed panel, sized so a B micro-panel sits in L1.
+ * @nc: Columns of op(B) packed at once, sized for L3.
+ * @is_bf16_packed: If true, panels hold pairs of bfloat16 values from
+ * consecutive k, each pair taking the place of one float, rather than floats.
+ */
+struct gemm_kernel {
+        uint32_t mr;
+        uint32_t nr;
+        size_t mc;
+        size_t kc;
+        size_t nc;
+        gemm_microkernel_fn *microkernel;
+        bool is_bf16_packed;
+};
+
+/**
+ * struct gemm_scratch - Packing buffer cached per calling thread, for
+ * contexts without a scratch arena, or products too big for it.
+ *
+ * NOTE(brendan): This file is compiled as C++, so the buffer is freed by the
+ * destructor of its thread_local when the owning thread exits.
+ */
+struct gemm_scratch {
+        float *mem;
+        size_t num_floats;
+
+        ~gemm_scratch()
+        {
+                free(mem);
+        }
+};
+
+static thread_local struct gemm_scratch gemm_scratch;
+
+/**
+ * struct gemm_block - Everything the packing and compute tasks need for one
+ * (jc, pc, ic) block of the GEMM loop nest.
+ * @a_dtype, @b_dtype: Types of the elements of A and B.
+ * @ic, @mc: First row and number of rows of op(A) packed in `a_packed`.
+ * @kc_packed: Depth of the packed panels in floats, which is half of `kc`,
+ * rounded up, for bfloat16 pairs.
+ */
+struct gemm_block {
+        const struct gemm_kernel *kernel;
+        bool trans_a;
+        bool trans_b;
+        enum rot_dtype a_dtype;
+        const void *a;
+        size_t lda;
+        enum rot_dtype b_dtype;
+        const void *b;
+        size_t ldb;
+        float *c;
+        size_t ldc;
+        float alpha;
+        float beta;
+        const struct gemm_epilogue *epilogue;
+        size_t jc;
+        size_t nc;
+        size_t pc;
+        size_t kc;
+        size_t kc_packed;
+        size_t ic;
+        size_t mc;
+        float *a_packed;
+        float *b_packed;
+        size_t num_a_pack_tasks;
+        size_t num_b_pack_tasks;
+        size_t mc_task;
+        size_t nc_task;
+        size_t num_nc_tasks;
+};
+
+static void
+microkernel_generic_4x8(size_t kc,
+                        const float *a_panel,
+                        const float *b_panel,
+                        float *c,
+                        size_t ldc,
+                        float alpha,
+                        float beta,
+                        const struct gemm_tile_epilogue *epilogue)
+{
+        float acc[4][8] = {};
+
+        for (size_t p = 0;
+             p < kc;
+             ++p) {
+                for (uint32_t i = 0;
+                     i < 4;
+                     ++i) {
+                        for (uint32_t j = 0;
+                             j < 8;
+                             ++j) {
+                                acc[i][j] += a_panel[i]*b_panel[j];
+                        }
+                }
+
+                a_panel += 4;
+                b_panel += 8;
+        }
+
+        for (uint32_t i = 0;
+             i < 4;
+             ++i) {
+                for (uint32_t j = 0;
+                     j < 8;
+                     ++j) {
+                        float *c_ij = c + i*ldc + j;
+                        float val = alpha*acc[i][j];
+                        if (beta != 0.0f)
+                                val += beta*(*c_ij);
+
+                        if (epilogue != NULL) {
+                                if (epilogue->row_bias != NULL)
+                                        val += epilogue->row_bias[i];
+                                if (epilogue->col_bias != NULL)
+                                        val += epilogue->col_bias[j];
+                                val = scalar_activation(val,
+                                                        epilogue->activation);
+                        }
+
+                        *c_ij = val;
+                }
+        }
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256
+tile_epilogue_avx2(__m256 val,
+                   const struct gemm_tile_epilogue *epilogue,
+                   uint32_t row,
+                   uint32_t col)
+{
+        if (epilogue->row_bias != NULL)
+                val = _mm256_add_ps(val,
+                                    _mm256_set1_ps(epilogue->row_bias[row]));
+        if (epilogue->col_bias != NULL)
+                val = _mm256_add_ps(val,
+                                    _mm256_loadu_ps(epilogue->col_bias + col));
+
+        return vec_activation_avx2(val, epilogue->activation);
+}
+
+__attribute__((target("avx2,fma")))
+static void
+microkernel_avx2_6x16(size_t kc,
+                      const float *a_panel,
+                      const float *b_panel,
+                      float *c,
+                      size_t ldc,
+                      float alpha,
+                      float beta,
+                      const struct gemm_tile_epilogue *epilogue)
+{
+        __m256 acc[6][2];
+#pragma GCC unroll 6
+        for (uint32_t i = 0;
+             i < 6;
+             ++i) {
+                acc[i][0] = _mm256_setzero_ps();
+                acc[i][1] = _mm256_setzero_ps();
+        }
+
+        for (size_t p = 0;
+             p < kc;
+             ++p) {
+                __m256 b0 = _mm256_load_ps(b_panel);
+                __m256 b1 = _mm256_load_ps(b_panel + 8);
+#pragma GCC unroll 6
+                for (uint32_t i = 0;
+                     i < 6;
+                     ++i) {
+                        __m256 a_i = _mm256_broadcast_ss(a_panel + i);
+                        acc[i][0] = _mm256_fmadd_ps(a_i, b0, acc[i][0]);
+                        acc[i][1] = _mm256_fmadd_ps(a_i, b1, acc[i][1]);
+                }
+
+                a_panel += 6;
+                b_panel += 16;
+        }
+
+        __m256 alpha_v = _mm256_set1_ps(alpha);
+        __m256 beta_v = _mm256_set1_ps(beta);
+#pragma GCC unroll 6
+        for (uint32_t i = 0;
+             i < 6;
+             ++i) {
+                float *c_i = c + i*ldc;
+                __m256 c0 = _mm256_mul_ps(alpha_v, acc[i][0]);
+                __m256 c1 = _mm256_mul_ps(alpha_v, acc[i][1]);
+                if (beta != 0.0f) {
+                        c0 = _mm256_fmadd_ps(beta_v,
+                                             _mm256_loadu_ps(c_i),
+                                             c0);
+                        c1 = _mm256_fmadd_ps(beta_v,
+                                             _mm256_loadu_ps(c_i + 8),
+                                             c1);
+                }
+                if (epilogue != NULL) {
+                        c0 = tile_epilogue_avx2(c0, epilogue, i, 0);
+                        c1 = tile_epilogue_avx2(c1, epilogue, i, 8);
+                }
+                _mm256_storeu_ps(c_i, c0);
+                _mm256_storeu_ps(c_i + 8, c1);
+        }
+}
+
+__attribute__((target("avx512f")))
+static inline __m512
+tile_epilogue_avx512(__m512 val,
+                     const struct gemm_tile_epilogue *epilogue,
+                     uint32_t row,
+                     uint32_t col)
+{
+        if (epilogue->row_bias != NULL)
+                val = _mm512_add_ps(val,
+                                    _mm512_set1_ps(epilogue->row_bias[row]));
+        if (epilogue->col_bias != NULL)
+                val = _mm512_add_ps(val,
+                                    _mm512_loadu_ps(epilogue->col_bias + col));
+
+        return vec_activation_avx512(val, epilogue->activation);
+}
+
+/**
+ * microkernel_avx512_store() - Scales the 12x32 tile of accumulators `acc` by
+ * alpha, adds beta*C and applies the epilogue, then stores it to `c`.
+ */
+__attribute__((target("avx512f")))
+static inline void
+microkernel_avx512_store(__m512 acc[12][2],
+                         float *c,
+                         size_t ldc,
+                         float alpha,
+                         float beta,
+                         const struct gemm_tile_epilogue *epilogue)
+{
+        __m512 alpha_v = _mm512_set1_ps(alpha);
+        __m512 beta_v = _mm512_set1_ps(beta);
+#pragma GCC unroll 12
+        for (uint32_t i = 0;
+             i < 12;
+             ++i) {
+                float *c_i = c + i*ldc;
+                __m512 c0 = _mm512_mul_ps(alpha_v, acc[i][0]);
+                __m512 c1 = _mm512_mul_ps(alpha_v, acc[i][1]);
+                if (beta != 0.0f) {
+                        c0 = _mm512_fmadd_ps(beta_v,
+                                             _mm512_loadu_ps(c_i),
+                                             c0);
+                        c1 = _mm512_fmadd_ps(beta_v,
+                                             _mm512_loadu_ps(c_i + 16),
+                                             c1);
+                }
+                if (epilogue != NULL) {
+                        c0 = tile_epilogue_avx512(c0, epilogue, i, 0);
+                        c1 = tile_epilogue_avx512(c1, epilogue, i, 16);
+                }
+                _mm512_storeu_ps(c_i, c0);
+                _mm512_storeu_ps(c_i + 16, c1);
+        }
+}
+
+__attribute__((target("avx512f")))
+static void
+microkernel_avx512_12x32(size_t kc,
+                         const float *a_panel,
+                         const float *b_panel,
+                         float *c,
+                         size_t ldc,
+                         float alpha,
+                         float beta,
+                         const struct gemm_tile_epilogue *epilogue)
+{
+        __m512 acc[12][2];
+#pragma GCC unroll 12
+        for (uint32_t i = 0;
+             i < 12;
+             ++i) {
+                acc[i][0] = _mm512_setzero_ps();
+                acc[i][1] = _mm512_setzero_ps();
+        }
+
+        for (size_t p = 0;
+             p < kc;
+             ++p) {
+                __m512 b0 = _mm512_load_ps(b_panel);
+                __m512 b1 = _mm512_load_ps(b_panel + 16);
+#pragma GCC unroll 12
+                for (uint32_t i = 0;
+                     i < 12;
+                     ++i) {
+                        __m512 a_i = _mm512_set1_ps(a_panel[i]);
+                        acc[i][0] = _mm512_fmadd_ps(a_i, b0, acc[i][0]);
+                        acc[i][1] = _mm512_fmadd_ps(a_i, b1, acc[i][1]);
+                }
+
+                a_panel += 12;
+                b_panel += 32;
+        }
+
+        microkernel_avx512_store(acc, c, ldc, alpha, beta, epilogue);
+}
+
+/**
+ * microkernel_avx512bf16_12x32() - The 12x32 microkernel for panels packed as
+ * bfloat16 pairs, which VDPBF16PS multiplies and adds to single precision
+ * accumulators two values of k at a time.
+ *
+ * Each float of `a_panel` holds the pair (A(i, p), A(i, p + 1)), and each
+ * float of `b_panel` the pair (B(p, j), B(p + 1, j)).
+ */
+__attribute__((target("avx512f,avx512bf16")))
+static void
+microkernel_avx512bf16_12x32(size_t kc,
+                             const float *a_panel,
+                             const float *b_panel,
+                             float *c,
+                             size_t ldc,
+                             float alpha,
+                             float beta,
+                             const struct gemm_tile_epilogue *epilogue)
+{
+        const uint32_t *a_pairs = (const uint32_t *)a_panel;
+        __m512 acc[12][2];
+#pragma GCC unroll 12
+        for (uint32_t i = 0;
+             i < 12;
+             ++i) {
+                acc[i][0] = _mm512_setzero_ps();
+                acc[i][1] = _mm512_setzero_ps();
+        }
+
+        for (size_t pair = 0;
+             pair < (kc + 1)/2;
+             ++pair) {
+                __m512bh b0 = (__m512bh)_mm512_load_si512(b_panel);
+                __m512bh b1 = (__m512bh)_mm512_load_si512(b_panel + 16);
+#pragma GCC unroll 12
+                for (uint32_t i = 0;
+                     i < 12;
+                     ++i) {
+                        __m512bh a_i =
+                                (__m512bh)_mm512_set1_epi32(a_pairs[i]);
+                        acc[i][0] = _mm512_dpbf16_ps(acc[i][0], a_i, b0);
+                        acc[i][1] = _mm512_dpbf16_ps(acc[i][1], a_i, b1);
+                }
+
+                a_pairs += 12;
+                b_panel += 32;
+        }
+
+        microkernel_avx512_store(acc, c, ldc, alpha, beta, epilogue);
+}
+
+static const struct gemm_kernel gemm_kernel_generic = {
+        .mr = 4,
+        .nr = 8,
+        .mc = 128,
+        .kc = 256,
+        .nc = 2048,
+        .microkernel = microkernel_generic_4x8,
+        .is_bf16_packed = false,
+};
+
+static const struct gemm_kernel gemm_kernel_avx2 = {
+        .mr = 6,
+        .nr = 16,
+        .mc = 288,
+        .kc = 256,
+        .nc = 4096,
+        .microkernel = microkernel_avx2_6x16,
+        .is_bf16_packed = false,
+};
+
+static const struct gemm_kernel gemm_kernel_avx512 = {
+        .mr = 12,
+        .nr = 32,
+        .mc = 480,
+        .kc = 256,
+        .nc = 4096,
+        .microkernel = microkernel_avx512_12x32,
+        .is_bf16_packed = false,
+};
+
+static const struct gemm_kernel gemm_kernel_avx512bf16 = {
+        .mr = 12,
+        .nr = 32,
+        .mc = 480,
+        .kc = 512,
+        .nc = 4096,
+        .microkernel = microkernel_avx512bf16_12x32,
+        .is_bf16_packed = true,
+};
+
+/**
+ * gemm_get_kernel() - Returns the kernel for the widest ISA the CPU supports,
+ * using bfloat16 dot products if both A and B are bfloat16.
+ */
+static const struct gemm_kernel *
+gemm_get_kernel(enum rot_dtype a_dtype, enum rot_dtype b_dtype)
+{
+        if ((a_dtype == ROT_DTYPE_BFLOAT16) &&
+            (b_dtype == ROT_DTYPE_BFLOAT16) &&
+            cpu_has_feature(CPU_FEATURE_AVX512_BF16))
+                return &gemm_kernel_avx512bf16;
+
+        switch (cpu_get_isa()) {
+        case CPU_ISA_AVX512:
+                return &gemm_kernel_avx512;
+        case CPU_ISA_AVX2:
+                return &gemm_kernel_avx2;
+        default:
+                return &gemm_kernel_generic;
+        }
+}
+
+/**
+ * gemm_get_heap_scratch() - Returns a 64-byte aligned buffer of at least
+ * `num_floats` floats, owned by the calling thread.
+ */
+static float *
+gemm_get_heap_scratch(size_t num_floats)
+{
+        if (num_floats <= gemm_scratch.num_floats)
+                return gemm_scratch.mem;
+
+        free(gemm_scratch.mem);
+
+        size_t bytes = round_up(num_floats*sizeof(float), GEMM_ALIGN_BYTES);
+        gemm_scratch.mem = (float *)aligned_alloc(GEMM_ALIGN_BYTES, bytes);
+        gemm_scratch.num_floats = ((gemm_scratch.mem != NULL) ?
+                                   bytes/sizeof(float) : 0);
+
+        return gemm_scratch.mem;
+}
+
+float *
+gemm_get_scratch(size_t num_floats, rot_arena_t *arena, rot_arena_mark_t *mark)
+{
+        size_t bytes = num_floats*sizeof(float);
+        *arena = context_get_scratch(context_get_current());
+        if ((*arena != NULL) &&
+            ROT_arena_can_alloc(*arena,
+                                bytes + 2*GEMM_ALIGN_BYTES,
+                                ROT_BACKEND_CPU)) {
+                *mark = ROT_arena_mark(*arena);
+                void *scratch = ROT_arena_malloc_aligned(*arena,
+                                                         bytes,
+                                                         GEMM_ALIGN_BYTES,
+                                                         ROT_BACKEND_CPU);
+                if (scratch != NULL)
+                        return (float *)scratch;
+
+                ROT_arena_rewind(*arena, *mark);
+        }
+
+        *arena = NULL;
+        return gemm_get_heap_scratch(num_floats);
+}
+
+/**
+ * gemm_load_run() - Widens `num_elems` consecutive elements of a matrix of
+ * type `dtype` at `matrix`, starting `offset` elements in, to floats in `dst`.
+ */
+static void
+gemm_load_run(enum rot_dtype dtype,
+              const void *matrix,
+              size_t offset,
+              size_t num_elems,
+              float *dst)
+{
+        if (dtype != ROT_DTYPE_FLOAT32) {
+                dtype_to_float(dtype,
+                               (const uint16_t *)matrix + offset,
+                               dst,
+                               num_elems);
+                return;
+        }
+
+        const float *src = (const float *)matrix + offset;
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                dst[i] = src[i];
+        }
+}
+
+/**
+ * gemm_pack_bf16_pairs() - Packs `count` <= `width` rows or columns of a
+ * bfloat16 matrix as pairs of consecutive k, zero-padding to `width` and to
+ * an even depth.
+ * @first: Offset of element (0, pc) of the panel in `matrix`.
+ * @k_stride: Distance between consecutive k.
+ * @stride: Distance between consecutive rows or columns of the panel.
+ */
+static void
+gemm_pack_bf16_pairs(const struct gemm_block *block,
+                     const uint16_t *matrix,
+                     size_t first,
+                     size_t k_stride,
+                     size_t stride,
+                     size_t count,
+                     uint32_t width,
+                     float *packed)
+{
+        uint16_t *packed_16 = (uint16_t *)packed;
+
+        for (size_t p = 0;
+             p < 2*block->kc_packed;
+             ++p) {
+                uint16_t *packed_p = packed_16 + (p/2)*2*width + (p % 2);
+                for (uint32_t i = 0;
+                     i < width;
+                     ++i) {
+                        uint16_t val = 0;
+                        if ((i < count) && (p < block->kc))
+                                val = matrix[first + p*k_stride + i*stride];
+                        packed_p[2*i] = val;
+                }
+        }
+}
+
+/**
+ * gemm_pack_a_panel() - Packs `rows` <= mr rows of op(A), starting at
+ * op(A)(row, pc), into `packed` as kc consecutive columns of mr floats,
+ * zero-padding to mr rows.
+ */
+static void
+gemm_pack_a_panel(const struct gemm_block *block,
+                  size_t row,
+                  size_t rows,
+                  float *packed)
+{
+        const uint32_t mr = block->kernel->mr;
+
+        if (block->kernel->is_bf16_packed) {
+                gemm_pack_bf16_pairs(
+                        block,
+                        (const uint16_t *)block->a,
+                        (block->trans_a ?
+                         (block->pc*block->lda + row) :
+                         (row*block->lda + block->pc)),
+                        block->trans_a ? block->lda : 1,
+                        block->trans_a ? 1 : block->lda,
+                        rows,
+                        mr,
+                        packed);
+                return;
+        }
+
+        if (block->trans_a) {
+                for (size_t p = 0;
+                     p < block->kc;
+                     ++p) {
+                        float *packed_p = packed + p*mr;
+                        gemm_load_run(block->a_dtype,
+                                      block->a,
+                                      (block->pc + p)*block->lda + row,
+                                      rows,
+                                      packed_p);
+                        for (uint32_t i = rows;
+                             i < mr;
+                             ++i) {
+                                packed_p[i] = 0.0f;
+                        }
+                }
+                return;
+        }
+
+        float run[GEMM_MAX_KC];
+        for (uint32_t i = 0;
+             i < mr;
+             ++i) {
+                if (i < rows)
+                        gemm_load_run(block->a_dtype,
+                                      block->a,
+                                      (row + i)*block->lda + block->pc,
+                                      block->kc,
+                                      run);
+
+                for (size_t p = 0;
+                     p < block->kc;
+                     ++p) {
+                        packed[p*mr + i] = (i < rows) ? run[p] : 0.0f;
+                }
+        }
+}
+
+/**
+ * gemm_pack_b_panel() - Packs `cols` <= nr columns of op(B), starting at
+ * op(B)(pc, col), into `packed` as kc consecutive rows of nr floats,
+ * zero-padding to nr columns.
+ */
+static void
+gemm_pack_b_panel(const struct gemm_block *block,
+                  size_t col,
+                  size_t cols,
+                  float *packed)
+{
+        const uint32_t nr = block->kernel->nr;
+
+        if (block->kernel->is_bf16_packed) {
+                gemm_pack_bf16_pairs(
+                        block,
+                        (const uint16_t *)block->b,
+                        (block->trans_b ?
+                         (col*block->ldb + block->pc) :
+                         (block->pc*block->ldb + col)),
+                        block->trans_b ? 1 : block->ldb,
+                        block->trans_b ? block->ldb : 1,
+                        cols,
+                        nr,
+                        packed);
+                return;
+        }
+
+        if (!block->trans_b) {
+                for (size_t p = 0;
+                     p < block->kc;
+                     ++p) {
+                        float *packed_p = packed + p*nr;
+                        gemm_load_run(block->b_dtype,
+                                      block->b,
+                                      (block->pc + p)*block->ldb + col,
+                                      cols,
+                                      packed_p);
+                        for (uint32_t j = cols;
+                             j < nr;
+                             ++j) {
+                                packed_p[j] = 0.0f;
+                        }
+                }
+                return;
+        }
+
+        float run[GEMM_MAX_KC];
+        for (uint32_t j = 0;
+             j < nr;
+             ++j) {
+                if (j < cols)
+                        gemm_load_run(block->b_dtype,
+                                      block->b,
+                                      (col + j)*block->ldb + block->pc,
+                                      block->kc,
+                                      run);
+
+                for (size_t p = 0;
+                     p < block->kc;
+                     ++p) {
+                        packed[p*nr + j] = (j < cols) ? run[p] : 0.0f;
+                }
+        }
+}
+
+/**
+ * gemm_pack_task() - Packs a group of A panels or B panels. Task indices
+ * [0, num_a_pack_tasks) pack A, and the rest pack B.
+ */
+static void
+gemm_pack_task(void *context, size_t task_i)
+{
+        const struct gemm_block *block = (const struct gemm_block *)context;
+        const struct gemm_kernel *kernel = block->kernel;
+
+        if (task_i < block->num_a_pack_tasks) {
+                size_t first_panel = task_i*GEMM_PACK_PANELS_PER_TASK;
+                for (size_t panel_i = first_panel;
+                     panel_i < first_panel + GEMM_PACK_PANELS_PER_TASK;
+                     ++panel_i) {
+                        size_t row = panel_i*kernel->mr;
+                        if (row >= block->mc)
+                                return;
+
+                        gemm_pack_a_panel(block,
+                                          block->ic + row,
+                                          min_size(kernel->mr,
+                                                   block->mc - row),
+                                          (block->a_packed +
+                                           row*block->kc_packed));
+                }
+        } else {
+                task_i -= block->num_a_pack_tasks;
+                size_t first_panel = task_i*GEMM_PACK_PANELS_PER_TASK;
+                for (size_t panel_i = first_panel;
+                     panel_i < first_panel + GEMM_PACK_PANELS_PER_TASK;
+                     ++panel_i) {
+                        size_t col = panel_i*kernel->nr;
+                        if (col >= block->nc)
+                                return;
+
+                        gemm_pack_b_panel(block,
+                                          block->jc + col,
+                                          min_size(kernel->nr,
+                                                   block->nc - col),
+                                          (block->b_packed +
+                                           col*block->kc_packed));
+                }
+        }
+}
+
+/**
+ * gemm_compute_tile_edge() - Computes a partial tile of C, with only `rows`
+ * rows and `cols` columns in bounds, through a full-size tile buffer.
+ */
+static void
+gemm_compute_tile_edge(const struct gemm_block *block,
+                       const float *a_panel,
+                       const float *b_panel,
+                       float *c_tile,
+                       size_t rows,
+                       size_t cols,
+                       const struct gemm_tile_epilogue *epilogue)
+{
+        const uint32_t nr = block->kernel->nr;
+        alignas(GEMM_ALIGN_BYTES) float tile[GEMM_MAX_MR*GEMM_MAX_NR] = {};
+
+        if (block->beta != 0.0f) {
+                for (size_t i = 0;
+                     i < rows;
+                     ++i) {
+                        for (size_t j = 0;
+                             j < cols;
+                             ++j) {
+                                tile[i*nr + j] = c_tile[i*block->ldc + j];
+                        }
+                }
+        }
+
+        /**
+         * NOTE(brendan): The microkernel reads a full mr or nr floats of bias,
+         * so out of bounds bias is padded with zeros.
+         */
+        float row_bias[GEMM_MAX_MR] = {};
+        float col_bias[GEMM_MAX_NR] = {};
+        struct gemm_tile_epilogue edge_epilogue;
+        if (epilogue != NULL) {
+                edge_epilogue = *epilogue;
+                if (epilogue->row_bias != NULL) {
+                        for (size_t i = 0;
+                             i < rows;
+                             ++i) {
+                                row_bias[i] = epilogue->row_bias[i];
+                        }
+                        edge_epilogue.row_bias = row_bias;
+                }
+                if (epilogue->col_bias != NULL) {
+                        for (size_t j = 0;
+                             j < cols;
+                             ++j) {
+                                col_bias[j] = epilogue->col_bias[j];
+                        }
+                        edge_epilogue.col_bias = col_bias;
+                }
+                epilogue = &edge_epilogue;
+        }
+
+        block->kernel->microkernel(block->kc,
+                                   a_panel,
+                                   b_panel,
+                                   tile,
+                                   nr,
+                                   block->alpha,
+                                   block->beta,
+                                   epilogue);
+
+        for (size_t i = 0;
+             i < rows;
+             ++i) {
+                for (size_t j = 0;
+                     j < cols;
+                     ++j) {
+                        c_tile[i*block->ldc + j] = tile[i*nr + j];
+                }
+        }
+}
+
+/**
+ * gemm_compute_task() - Multiplies one mc_task x nc_task tile of the current
+ * row block of C from the packed panels, sweeping the A panels for each B
+ * panel so that the B panel stays in L1 while A streams from L2.
+ *
+ * The epilogue, if any, is only applied on the last block of k, when the
+ * tile holds its final value.
+ */
+static void
+gemm_compute_task(void *context, size_t task_i)
+{
+        const struct gemm_block *block = (const struct gemm_block *)context;
+        const struct gemm_kernel *kernel = block->kernel;
+        const uint32_t mr = kernel->mr;
+        const uint32_t nr = kernel->nr;
+
+        size_t ic = (task_i/block->num_nc_tasks)*block->mc_task;
+        size_t mc = min_size(block->mc_task, block->mc - ic);
+        size_t jr_start = (task_i % block->num_nc_tasks)*block->nc_task;
+        size_t jr_end = min_size(jr_start + block->nc_task, block->nc);
+
+        const struct gemm_epilogue *epilogue = block->epilogue;
+        struct gemm_tile_epilogue tile_epilogue;
+        const struct gemm_tile_epilogue *tile_epilogue_ptr = NULL;
+        if (epilogue != NULL) {
+                tile_epilogue.activation = epilogue->activation;
+                tile_epilogue_ptr = &tile_epilogue;
+        }
+
+        for (size_t jr = jr_start;
+             jr < jr_end;
+             jr += nr) {
+                size_t cols = min_size(nr, jr_end - jr);
+                const float *b_panel = block->b_packed + jr*block->kc_packed;
+
+                for (size_t ir = ic;
+                     ir < ic + mc;
+                     ir += mr) {
+                        size_t rows = min_size(mr, ic + mc - ir);
+                        const float *a_panel = (block->a_packed +
+                                                ir*block->kc_packed);
+                        float *c_tile = (block->c +
+                                         (block->ic + ir)*block->ldc +
+                                         block->jc + jr);
+
+                        if (epilogue != NULL) {
+                                tile_epilogue.row_bias =
+                                        ((epilogue->row_bias != NULL) ?
+                                         (epilogue->row_bias +
+                                          block->ic + ir) :
+                                         NULL);
+                                tile_epilogue.col_bias =
+                                        ((epilogue->col_bias != NULL) ?
+                                         (epilogue->col_bias +
+                                          block->jc + jr) :
+                                         NULL);
+                        }
+
+                        if ((rows < mr) || (cols < nr)) {
+                                gemm_compute_tile_edge(block,
+                                                       a_panel,
+                                                       b_panel,
+                                                       c_tile,
+                                                       rows,
+                                                       cols,
+                                                       tile_epilogue_ptr);
+                                continue;
+                        }
+
+                        kernel->microkernel(block->kc,
+                                            a_panel,
+                                            b_panel,
+                                            c_tile,
+                                            block->ldc,
+                                            block->alpha,
+                                            block->beta,
+                                            tile_epilogue_ptr);
+                }
+        }
+}
+
+/**
+ * gemm_run_tasks() - Runs tasks on the thread pool if the GEMM is big enough
+ * to benefit, otherwise runs them inline.
+ */
+static void
+gemm_run_tasks(bool is_parallel,
+               size_t num_tasks,
+               parallel_task_fn *task_fn,
+               void *context)
+{
+        if (is_parallel) {
+                parallel_for(num_tasks, task_fn, context);
+                return;
+        }
+
+        for (size_t task_i = 0;
+             task_i < num_tasks;
+             ++task_i) {
+                task_fn(context, task_i);
+        }
+}
+
+static void
+gemm_scale(size_t m, size_t n, float beta, float *c, size_t ldc)
+{
+        for (size_t i = 0;
+             i < m;
+             ++i) {
+                for (size_t j = 0;
+                     j < n;
+                     ++j) {
+                        float *c_ij = c + i*ldc + j;
+                        *c_ij = (beta == 0.0f) ? 0.0f : beta*(*c_ij);
+                }
+        }
+}
+
+bool gemm_native_dtype(bool trans_a,
+                       bool trans_b,
+                       size_t m,
+                       size_t n,
+                       size_t k,
+                       float alpha,
+                       enum rot_dtype a_dtype,
+                       const void *a,
+                       size_t lda,
+                       enum rot_dtype b_dtype,
+                       const void *b,
+                       size_t ldb,
+                       float beta,
+                       float *c,
+                       size_t ldc,
+                       const struct gemm_epilogue *epilogue)
+{
+        if ((m == 0) || (n == 0))
+                return true;
+
+        if ((k == 0) || (alpha == 0.0f)) {
+                gemm_scale(m, n, beta, c, ldc);
+                if (epilogue != NULL)
+                        gemm_apply_epilogue(m, n, c, ldc, epilogue);
+                return true;
+        }
+
+        const struct gemm_kernel *kernel = gemm_get_kernel(a_dtype, b_dtype);
+        const size_t kc_max = min_size(kernel->kc, k);
+        const size_t kc_packed_max = (kernel->is_bf16_packed ?
+                                      ceil_div(kc_max, 2) : kc_max);
+        const size_t nc_max = min_size(kernel->nc, n);
+
+        bool is_parallel = ((m*n*k >= GEMM_MIN_PARALLEL_MACS) &&
+                            (thread_get_num_workers() > 1));
+        size_t num_workers = is_parallel ? thread_get_num_workers() : 1;
+
+        /**
+         * NOTE(brendan): Split rows first, since each row block streams its
+         * own packed A through L2. Only split columns as well when there are
+         * too few row blocks to keep every worker busy.
+         */
+        size_t mc_task = round_up(ceil_div(m, num_workers), kernel->mr);
+        mc_task = min_size(mc_task, kernel->mc);
+        size_t num_mc_tasks = min_size(ceil_div(m, mc_task), num_workers);
+        size_t num_nc_splits = ceil_div(num_workers, num_mc_tasks);
+
+        /**
+         * NOTE(brendan): op(A) is packed one row block of an mc_task per
+         * worker at a time, rather than all of its rows at once, so that the
+         * packing buffer does not grow with m. Compute tasks splitting the
+         * columns of a row block still share its packed panels.
+         */
+        size_t mc_block = num_mc_tasks*mc_task;
+        size_t a_packed_floats = round_up((round_up(min_size(mc_block, m),
+                                                    kernel->mr)*
+                                           kc_packed_max),
+                                          GEMM_ALIGN_BYTES/sizeof(float));
+        size_t b_packed_floats = round_up(nc_max, kernel->nr)*kc_packed_max;
+        rot_arena_t scratch_arena;
+        rot_arena_mark_t scratch_mark;
+        float *scratch = gemm_get_scratch(a_packed_floats + b_packed_floats,
+                                          &scratch_arena,
+                                          &scratch_mark);
+        if (scratch == NULL) {
+                LOG_ERROR("Failed to allocate GEMM packing buffers.");
+                return false;
+        }
+
+        struct gemm_block block = {.kernel = kernel,
+                                   .trans_a = trans_a,
+                                   .trans_b = trans_b,
+                                   .a_dtype = a_dtype,
+                                   .a = a,
+                                   .lda = lda,
+                                   .b_dtype = b_dtype,
+                                   .b = b,
+                                   .ldb = ldb,
+                                   .c = c,
+                                   .ldc = ldc,
+                                   .alpha = alpha,
+                                   .beta = beta,
+                                   .epilogue = NULL,
+                                   .jc = 0,
+                                   .nc = 0,
+                                   .pc = 0,
+                                   .kc = 0,
+                                   .kc_packed = 0,
+                                   .ic = 0,
+                                   .mc = 0,
+                                   .a_packed = scratch,
+                                   .b_packed = scratch + a_packed_floats,
+                                   .num_a_pack_tasks = 0,
+                                   .num_b_pack_tasks = 0,
+                                   .mc_task = mc_task,
+                                   .nc_task = 0,
+                                   .num_nc_tasks = 0};
+
+        for (size_t jc = 0;
+             jc < n;
+             jc += kernel->nc) {
+                block.jc = jc;
+                block.nc = min_size(kernel->nc, n - jc);
+
+                size_t b_panels = ceil_div(block.nc, kernel->nr);
+                block.num_b_pack_tasks = ceil_div(b_panels,
+                                                  GEMM_PACK_PANELS_PER_TASK);
+                block.nc_task = round_up(ceil_div(block.nc, num_nc_splits),
+                                         kernel->nr);
+                block.num_nc_tasks = ceil_div(block.nc, block.nc_task);
+
+                for (size_t pc = 0;
+                     pc < k;
+                     pc += kernel->kc) {
+                        block.pc = pc;
+                        block.kc = min_size(kernel->kc, k - pc);
+                        block.kc_packed = (kernel->is_bf16_packed ?
+                                           ceil_div(block.kc, 2) : block.kc);
+                        block.beta = (pc == 0) ? beta : 1.0f;
+                        block.epilogue = ((pc + block.kc == k) ?
+                                          epilogue : NULL);
+
+                        for (size_t ic = 0;
+                             ic < m;
+                             ic += mc_block) {
+                                block.ic = ic;
+                                block.mc = min_size(mc_block, m - ic);
+
+                                size_t a_panels = ceil_div(block.mc,
+                                                           kernel->mr);
+                                block.num_a_pack_tasks = ceil_div(
+                                        a_panels,
+                                        GEMM_PACK_PANELS_PER_TASK);
+
+                                /**
+                                 * NOTE(brendan): The B panels are packed
+                                 * along with the first row block, and reused
+                                 * by the rest.
+                                 */
+                                size_t num_pack_tasks =
+                                        (block.num_a_pack_tasks +
+                                         ((ic == 0) ?
+                                          block.num_b_pack_tasks : 0));
+                                gemm_run_tasks(is_parallel,
+                                               num_pack_tasks,
+                                               gemm_pack_task,
+                                               &block);
+
+                                gemm_run_tasks(
+                                        is_parallel,
+                                        (ceil_div(block.mc, mc_task)*
+                                         block.num_nc_tasks),
+                                        gemm_compute_task,
+                                        &block);
+                        }
+                }
+        }
+
+        if (scratch_arena != NULL)
+                ROT_arena_rewind(scratch_arena, scratch_mark);
+
+        return true;
+}
+
+bool gemm_native(bool trans_a,
+                 bool trans_b,
+                 size_t m,
+                 size_t n,
+                 size_t k,
+                 float alpha,
+                 const float *a,
+                 size_t lda,
+                 const float *b,
+                 size_t ldb,
+                 float beta,
+                 float *c,
+                 size_t ldc,
+                 const struct gemm_epilogue *epilogue)
+{
+        return gemm_native_dtype(trans_a,
+                                 trans_b,
+                                 m,
+                                 n,
+                                 k,
+                                 alpha,
+                                 ROT_DTYPE_FLOAT32,
+                                 a,
+                                 lda,
+                                 ROT_DTYPE_FLOAT32,
+                                 b,
+                                 ldb,
+                                 beta,
+                                 c,
+                                 ldc,
+                                 epilogue);
+}
+
+bool gemm_cpu(enum rot_matmul_engine engine,
+              bool trans_a,
+              bool trans_b,
+              size_t m,
+              size_t n,
+              size_t k,
+              float alpha,
+              const float *a,
+              size_t lda,
+              const float *b,
+              size_t ldb,
+              float beta,
+              float *c,
+              size_t ldc,
+              const struct gemm_epilogue *epilogue)
+{
+        if (gemm_small(trans_a,
+                       trans_b,
+                       m,
+                       n,
+                       k,
+                       alpha,
+                       a,
+                       lda,
+                       b,
+                       ldb,
+                       beta,
+                       c,
+                       ldc,
+                       epilogue))
+                return true;
+
+        if (gemm_resolve_engine(engine) == ROT_MATMUL_ENGINE_NATIVE) {
+                if (gemm_gemv(trans_a,
+                              trans_b,
+                              m,
+                              n,
+                              k,
+                              alpha,
+                              a,
+                              lda,
+                              b,
+                              ldb,
+                              beta,
+                              c,
+                              ldc,
+                              epilogue))
+                        return true;
+
+                return gemm_native(trans_a,
+                                   trans_b,
+                                   m,
+                                   n,
+                                   k,
+                                   alpha,
+                                   a,
+                                   lda,
+                                   b,
+                                   ldb,
+                                   beta,
+                                   c,
+                                   ldc,
+                                   epilogue);
+        }
+
+        thread_blas_begin();
+        cblas_sgemm(CblasRowMajor,
+                    trans_a ? CblasTrans : CblasNoTrans,
+                    trans_b ? CblasTrans : CblasNoTrans,
+                    m,
+                    n,
+                    k,
+                    alpha,
+                    a,
+                    lda,
+                    b,
+                    ldb,
+                    beta,
+                    c,
+                    ldc);
+        thread_blas_end();
+
+        if (epilogue != NULL)
+                gemm_apply_epilogue(m, n, c, ldc, epilogue);
+
+        return true;
+}
+
+/**
+ * struct gemm_epilogue_pass - A standalone epilogue over a whole matrix.
+ */
+struct gemm_epilogue_pass {
+        size_t m;
+        size_t n;
+        float *c;
+        size_t ldc;
+        const struct gemm_epilogue *epilogue;
+};
+
+static void
+epilogue_row_generic(size_t n,
+                     float *c_row,
+                     float row_bias,
+                     const float *col_bias,
+                     enum rot_activation activation)
+{
+        for (size_t j = 0;
+             j < n;
+             ++j) {
+                float val = c_row[j] + row_bias;
+                if (col_bias != NULL)
+                        val += col_bias[j];
+                c_row[j] = scalar_activation(val, activation);
+        }
+}
+
+__attribute__((target("avx2,fma")))
+static void
+epilogue_row_avx2(size_t n,
+                  float *c_row,
+                  float row_bias,
+                  const float *col_bias,
+                  enum rot_activation activation)
+{
+        __m256 row_bias_v = _mm256_set1_ps(row_bias);
+        size_t j = 0;
+        for (;
+             j + 8 <= n;
+             j += 8) {
+                __m256 val = _mm256_add_ps(_mm256_loadu_ps(c_row + j),
+                                           row_bias_v);
+                if (col_bias != NULL)
+                        val = _mm256_add_ps(val, _mm256_loadu_ps(col_bias + j));
+                _mm256_storeu_ps(c_row + j,
+                                 vec_activation_avx2(val, activation));
+        }
+
+        epilogue_row_generic(n - j,
+                             c_row + j,
+                             row_bias,
+                             (col_bias != NULL) ? col_bias + j : NULL,
+                             activation);
+}
+
+__attribute__((target("avx512f")))
+static void
+epilogue_row_avx512(size_t n,
+                    float *c_row,
+                    float row_bias,
+                    const float *col_bias,
+                    enum rot_activation activation)
+{
+        __m512 row_bias_v = _mm512_set1_ps(row_bias);
+        size_t j = 0;
+        for (;
+             j < n;
+             j += 16) {
+                __mmask16 mask = ((n - j >= 16) ?
+                                  0xFFFF : ((1u << (n - j)) - 1));
+                __m512 val = _mm512_maskz_loadu_ps(mask, c_row + j);
+                val = _mm512_add_ps(val, row_bias_v);
+                if (col_bias != NULL)
+                        val = _mm512_add_ps(
+                                val,
+                                _mm512_maskz_loadu_ps(mask, col_bias + j));
+                _mm512_mask_storeu_ps(c_row + j,
+                                      mask,
+                                      vec_activation_avx512(val, activation));
+        }
+}
+
+static void
+gemm_epilogue_task(void *context, size_t task_i)
+{
+        const struct gemm_epilogue_pass *pass =
+                (const struct gemm_epilogue_pass *)context;
+        const struct gemm_epilogue *epilogue = pass->epilogue;
+        enum cpu_isa isa = cpu_get_isa();
+
+        size_t row_start = task_i*GEMM_EPILOGUE_ROWS_PER_TASK;
+        size_t row_end = min_size(row_start + GEMM_EPILOGUE_ROWS_PER_TASK,
+                                  pass->m);
+        for (size_t i = row_start;
+             i < row_end;
+             ++i) {
+                float *c_row = pass->c + i*pass->ldc;
+                float row_bias = ((epilogue->row_bias != NULL) ?
+                                  epilogue->row_bias[i] : 0.0f);
+
+                switch (isa) {
+                case CPU_ISA_AVX512:
+                        epilogue_row_avx512(pass->n,
+                                            c_row,
+                                            row_bias,
+                                            epilogue->col_bias,
+                                            epilogue->activation);
+                        break;
+                case CPU_ISA_AVX2:
+                        epilogue_row_avx2(pass->n,
+                                          c_row,
+                                          row_bias,
+                                          epilogue->col_bias,
+                                          epilogue->activation);
+                        break;
+                default:
+                        epilogue_row_generic(pass->n,
+                                             c_row,
+                                             row_bias,
+                                             epilogue->col_bias,
+                                             epilogue->activation);
+                        break;
+                }
+        }
+}
+
+void gemm_apply_epilogue(size_t m,
+                         size_t n,
+                         float *c,
+                         size_t ldc,
+                         const struct gemm_epilogue *epilogue)
+{
+        struct gemm_epilogue_pass pass = {.m = m,
+                                          .n = n,
+                                          .c = c,
+                                          .ldc = ldc,
+                                          .epilogue = epilogue};
+
+        size_t num_tasks = ceil_div(m, GEMM_EPILOGUE_ROWS_PER_TASK);
+        gemm_run_tasks(m*n >= GEMM_MIN_PARALLEL_MACS,
+                       num_tasks,
+                       gemm_epilogue_task,
+                       &pass);
+}
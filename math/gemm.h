@@ -0,0 +1,231 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MATH_GEMM_H
+#define MATH_GEMM_H
+
+#include "rot_arena.h" /* for rot_arena_t, rot_arena_mark_t */
+#include "rot_math.h"  /* for rot_matmul_engine */
+#include "rot_nn.h"    /* for rot_activation */
+#include <stddef.h>    /* for size_t */
+
+/**
+ * gemm.h - Internal interface to the CPU matrix multiply engines: the in-tree
+ * GEMM, which accumulates in single precision, and OpenBLAS.
+ */
+
+/**
+ * NOTE(brendan): Overridden by the `matmul_engine` Meson option.
+ */
+#ifndef ROT_MATMUL_ENGINE_BUILD
+#define ROT_MATMUL_ENGINE_BUILD ROT_MATMUL_ENGINE_NATIVE
+#endif
+
+/**
+ * struct gemm_epilogue - Elementwise operations fused onto the end of a GEMM,
+ * C <- activation(C + row_bias + col_bias).
+ * @row_bias: m floats, where row_bias[i] is added to row i of C, or NULL.
+ * @col_bias: n floats, where col_bias[j] is added to column j of C, or NULL.
+ * @activation: Nonlinearity applied after the bias.
+ */
+struct gemm_epilogue {
+        const float *row_bias;
+        const float *col_bias;
+        enum rot_activation activation;
+};
+
+/**
+ * gemm_resolve_engine() - Maps `ROT_MATMUL_ENGINE_DEFAULT` to the engine
+ * chosen at build time, and returns any other engine unchanged.
+ */
+static inline enum rot_matmul_engine
+gemm_resolve_engine(enum rot_matmul_engine engine)
+{
+        if (engine == ROT_MATMUL_ENGINE_DEFAULT)
+                return ROT_MATMUL_ENGINE_BUILD;
+
+        return engine;
+}
+
+/**
+ * gemm_native() - Computes C <- alpha*op(A)*op(B) + beta*C, where all
+ * matrices are stored row-major.
+ * @trans_a: If true, op(A) = A^T and `a` is stored as a kxm matrix, otherwise
+ * op(A) = A and `a` is stored as an mxk matrix.
+ * @trans_b: If true, op(B) = B^T and `b` is stored as an nxk matrix, otherwise
+ * op(B) = B and `b` is stored as a kxn matrix.
+ * @m: Number of rows of op(A) and C.
+ * @n: Number of columns of op(B) and C.
+ * @k: Number of columns of op(A) and rows of op(B).
+ * @alpha: Scale applied to op(A)*op(B).
+ * @a: Data of A.
+ * @lda: Distance in floats between consecutive rows of `a`.
+ * @b: Data of B.
+ * @ldb: Distance in floats between consecutive rows of `b`.
+ * @beta: Scale applied to C before accumulating. If zero, C is not read.
+ * @c: Data of C, which must not overlap A or B.
+ * @ldc: Distance in floats between consecutive rows of `c`.
+ * @epilogue: Bias and activation applied to each output tile while it is still
+ * in registers, or NULL for none.
+ *
+ * The semantics match `cblas_sgemm` with `CblasRowMajor`. op(A) and op(B) are
+ * packed into cache-sized panels and multiplied by a register-blocked FMA
+ * microkernel chosen at runtime for the widest ISA the CPU supports.
+ *
+ * Returns false, having left C unwritten, if the packing buffers cannot be
+ * allocated.
+ */
+bool gemm_native(bool trans_a,
+                 bool trans_b,
+                 size_t m,
+                 size_t n,
+                 size_t k,
+                 float alpha,
+                 const float *a,
+                 size_t lda,
+                 const float *b,
+                 size_t ldb,
+                 float beta,
+                 float *c,
+                 size_t ldc,
+                 const struct gemm_epilogue *epilogue);
+
+/**
+ * gemm_native_dtype() - `gemm_native` for A and B with elements of types
+ * `a_dtype` and `b_dtype`, and `lda` and `ldb` counted in elements.
+ *
+ * 16-bit elements are widened to single precision while they are packed, so
+ * products are accumulated in single precision whatever the types. If A and B
+ * are both bfloat16 and the CPU supports AVX-512 BF16, they are packed as
+ * pairs of bfloat16 instead, and multiplied with VDPBF16PS, which also
+ * accumulates in single precision.
+ */
+bool gemm_native_dtype(bool trans_a,
+                       bool trans_b,
+                       size_t m,
+                       size_t n,
+                       size_t k,
+                       float alpha,
+                       enum rot_dtype a_dtype,
+                       const void *a,
+                       size_t lda,
+                       enum rot_dtype b_dtype,
+                       const void *b,
+                       size_t ldb,
+                       float beta,
+                       float *c,
+                       size_t ldc,
+                       const struct gemm_epilogue *epilogue);
+
+/**
+ * gemm_cpu() - `gemm_native`, or the equivalent using OpenBLAS, depending on
+ * `engine`.
+ *
+ * Whatever the engine, products that `gemm_small` handles are computed by it,
+ * since for those the packing or call overhead of either engine outweighs
+ * the arithmetic. Matrix-vector products go to `gemm_gemv` only with the
+ * native engine: with OpenBLAS they are left to its own tuned GEMV path.
+ *
+ * With OpenBLAS the epilogue cannot be fused, and is applied by
+ * `gemm_apply_epilogue` in a second pass over C.
+ *
+ * Returns false, having left C unwritten, if `gemm_native` fails.
+ */
+bool gemm_cpu(enum rot_matmul_engine engine,
+              bool trans_a,
+              bool trans_b,
+              size_t m,
+              size_t n,
+              size_t k,
+              float alpha,
+              const float *a,
+              size_t lda,
+              const float *b,
+              size_t ldb,
+              float beta,
+              float *c,
+              size_t ldc,
+              const struct gemm_epilogue *epilogue);
+
+/**
+ * gemm_small() - Computes the product described by the arguments of
+ * `gemm_native` without packing, if it is small enough for a kernel unrolled
+ * for its depth.
+ *
+ * Returns false, having done nothing, for any other product.
+ */
+bool gemm_small(bool trans_a,
+                bool trans_b,
+                size_t m,
+                size_t n,
+                size_t k,
+                float alpha,
+                const float *a,
+                size_t lda,
+                const float *b,
+                size_t ldb,
+                float beta,
+                float *c,
+                size_t ldc,
+                const struct gemm_epilogue *epilogue);
+
+/**
+ * gemm_gemv() - Computes the product described by the arguments of
+ * `gemm_native` without packing, if it is a matrix-vector product (`n` or `m`
+ * is one).
+ *
+ * Returns false, having done nothing, for any other product.
+ */
+bool gemm_gemv(bool trans_a,
+               bool trans_b,
+               size_t m,
+               size_t n,
+               size_t k,
+               float alpha,
+               const float *a,
+               size_t lda,
+               const float *b,
+               size_t ldb,
+               float beta,
+               float *c,
+               size_t ldc,
+               const struct gemm_epilogue *epilogue);
+
+/**
+ * gemm_get_scratch() - Returns a 64-byte aligned buffer of at least
+ * `num_floats` floats for the calling thread, from its scratch arena in the
+ * current context if that has room.
+ * @arena: Set to the arena the buffer came from, or NULL for the heap.
+ * @mark: Set to the mark to rewind `arena` to once the buffer is done with.
+ *
+ * The heap buffer is cached per thread and reused by the next call, so it
+ * must be done with before the thread calls into another GEMM.
+ */
+float *
+gemm_get_scratch(size_t num_floats, rot_arena_t *arena, rot_arena_mark_t *mark);
+
+/**
+ * gemm_apply_epilogue() - Applies `epilogue` to the mxn matrix `c` in place.
+ */
+void gemm_apply_epilogue(size_t m,
+                         size_t n,
+                         float *c,
+                         size_t ldc,
+                         const struct gemm_epilogue *epilogue);
+
+#endif /* MATH_GEMM_H */
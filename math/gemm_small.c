@@ -0,0 +1,997 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "math/gemm.h"
+#include "platform/cpu.h"     /* for cpu_get_isa */
+#include "platform/thread.h"  /* for parallel_for_range, ... */
+
+#include <immintrin.h>        /* for __m256, __m512, _mm512_fmadd_ps, ... */
+#include <stdint.h>           /* for int32_t */
+
+/**
+ * NOTE(brendan): Products with op(A) at most GEMM_SMALL_MAX_K columns deep
+ * are computed by a kernel unrolled for their depth, up to
+ * GEMM_SMALL_MAX_MACS multiply-adds if it vectorises along rows of op(B) and
+ * GEMM_SMALL_MAX_SCALAR_MACS otherwise. Past that the packed GEMM's
+ * microkernels win, despite the cost of packing. Rows of C narrower than
+ * GEMM_SMALL_MIN_ROW_N would leave most of each vector masked off, so are
+ * left to the scalar kernel.
+ */
+#define GEMM_SMALL_MAX_K 16
+#define GEMM_SMALL_MAX_MACS (16*1024)
+#define GEMM_SMALL_MAX_SCALAR_MACS 1024
+#define GEMM_SMALL_MIN_ROW_N 8
+/**
+ * NOTE(brendan): A GEMV reads each element of the matrix once, so it is
+ * memory bound and packing the matrix as the GEMM does only adds another
+ * pass over it.
+ */
+#define GEMV_BLOCK_K 512
+#define GEMV_GRAIN_ROWS 64
+#define GEMV_MIN_PARALLEL_MACS (64*64*64)
+
+/**
+ * gemm_small_fn - Computes C <- alpha*op(A)*op(B) + beta*C for a fixed depth
+ * of op(A) and op(B), where element (i, p) of op(A) is a[i*a_rs + p*a_cs] and
+ * element (p, j) of op(B) is b[p*b_rs + j*b_cs]. If `beta` is zero, `c` is
+ * not read.
+ */
+typedef void gemm_small_fn(size_t m,
+                           size_t n,
+                           float alpha,
+                           const float *a,
+                           size_t a_rs,
+                           size_t a_cs,
+                           const float *b,
+                           size_t b_rs,
+                           size_t b_cs,
+                           float beta,
+                           float *c,
+                           size_t ldc);
+
+/**
+ * struct gemm_small_kernel - Kernels unrolled for one depth of op(A) and
+ * op(B).
+ * @generic: For any strides.
+ * @rows_avx2, @rows_avx512: For op(B) with contiguous rows, which they
+ * vectorise along. They ignore `b_cs`.
+ */
+struct gemm_small_kernel {
+        gemm_small_fn *generic;
+        gemm_small_fn *rows_avx2;
+        gemm_small_fn *rows_avx512;
+};
+
+/**
+ * gemv_dot_fn - Computes y <- alpha*A*x + beta*y for `rows` x `k` matrix A
+ * with contiguous rows `lda` floats apart, and contiguous x. If `beta` is
+ * zero, `y` is not read.
+ */
+typedef void gemv_dot_fn(size_t rows,
+                         size_t k,
+                         float alpha,
+                         const float *a,
+                         size_t lda,
+                         const float *x,
+                         float beta,
+                         float *y,
+                         size_t incy);
+
+/**
+ * gemv_axpy_fn - Computes y <- alpha*A*x + beta*y for `rows` x `k` matrix A
+ * with contiguous columns `lda` floats apart. If `beta` is zero, `y` is not
+ * read.
+ */
+typedef void gemv_axpy_fn(size_t rows,
+                          size_t k,
+                          float alpha,
+                          const float *a,
+                          size_t lda,
+                          const float *x,
+                          size_t incx,
+                          float beta,
+                          float *y,
+                          size_t incy);
+
+/**
+ * struct gemv_kernel - GEMV kernels for one ISA.
+ * @dot: For matrices with contiguous rows.
+ * @axpy: For matrices with contiguous columns.
+ */
+struct gemv_kernel {
+        gemv_dot_fn *dot;
+        gemv_axpy_fn *axpy;
+};
+
+/**
+ * struct gemv_job - y <- alpha*A*x + beta*y, where element (i, p) of A is
+ * a[i*a_rs + p*a_cs], split into ranges of rows by `parallel_for_range`.
+ */
+struct gemv_job {
+        const struct gemv_kernel *kernel;
+        size_t k;
+        float alpha;
+        const float *a;
+        size_t a_rs;
+        size_t a_cs;
+        const float *x;
+        size_t incx;
+        float beta;
+        float *y;
+        size_t incy;
+};
+
+/**
+ * gemm_small_load() - Copies the first `P` elements of a row of op(A) to
+ * `a_row`. Unrolled by recursion, so that `a_row` can live in registers.
+ */
+template<size_t P>
+static inline void
+gemm_small_load(float *a_row, const float *a, size_t a_cs)
+{
+        gemm_small_load<P - 1>(a_row, a, a_cs);
+        a_row[P - 1] = a[(P - 1)*a_cs];
+}
+
+template<>
+inline void
+gemm_small_load<0>(float *, const float *, size_t)
+{
+}
+
+/**
+ * gemm_small_dot() - Returns the dot product of the first `P` elements of
+ * `a_row` and of a column of op(B), summed in order of increasing p.
+ */
+template<size_t P>
+static inline float
+gemm_small_dot(const float *a_row, const float *b, size_t b_rs)
+{
+        return (gemm_small_dot<P - 1>(a_row, b, b_rs) +
+                a_row[P - 1]*b[(P - 1)*b_rs]);
+}
+
+template<>
+inline float
+gemm_small_dot<0>(const float *, const float *, size_t)
+{
+        return 0.0f;
+}
+
+template<size_t K>
+static void
+gemm_small_fixed(size_t m,
+                 size_t n,
+                 float alpha,
+                 const float *a,
+                 size_t a_rs,
+                 size_t a_cs,
+                 const float *b,
+                 size_t b_rs,
+                 size_t b_cs,
+                 float beta,
+                 float *c,
+                 size_t ldc)
+{
+        for (size_t i = 0;
+             i < m;
+             ++i) {
+                float a_row[K];
+                gemm_small_load<K>(a_row, a + i*a_rs, a_cs);
+
+                float *c_row = c + i*ldc;
+                if (beta == 0.0f) {
+                        for (size_t j = 0;
+                             j < n;
+                             ++j) {
+                                c_row[j] = alpha*gemm_small_dot<K>(a_row,
+                                                                   b + j*b_cs,
+                                                                   b_rs);
+                        }
+                        continue;
+                }
+
+                for (size_t j = 0;
+                     j < n;
+                     ++j) {
+                        c_row[j] = (alpha*gemm_small_dot<K>(a_row,
+                                                            b + j*b_cs,
+                                                            b_rs) +
+                                    beta*c_row[j]);
+                }
+        }
+}
+
+__attribute__((target("avx2")))
+static __m256i
+gemv_mask_avx2(size_t remaining)
+{
+        int32_t count = (remaining < 8) ? (int32_t)remaining : 8;
+
+        return _mm256_cmpgt_epi32(_mm256_set1_epi32(count),
+                                  _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+/**
+ * gemm_small_row_avx2() - Returns eight consecutive elements of a row of
+ * op(A)*op(B), from the first `P` elements of the row `a_row` of op(A) and
+ * eight consecutive columns `b` of op(B), masked by `mask`.
+ */
+template<size_t P>
+__attribute__((target("avx2,fma")))
+static inline __m256
+gemm_small_row_avx2(const float *a_row,
+                    const float *b,
+                    size_t b_rs,
+                    __m256i mask)
+{
+        return _mm256_fmadd_ps(_mm256_set1_ps(a_row[P - 1]),
+                               _mm256_maskload_ps(b + (P - 1)*b_rs, mask),
+                               gemm_small_row_avx2<P - 1>(a_row,
+                                                          b,
+                                                          b_rs,
+                                                          mask));
+}
+
+template<>
+__attribute__((target("avx2,fma")))
+inline __m256
+gemm_small_row_avx2<0>(const float *, const float *, size_t, __m256i)
+{
+        return _mm256_setzero_ps();
+}
+
+template<size_t K>
+__attribute__((target("avx2,fma")))
+static void
+gemm_small_rows_avx2(size_t m,
+                     size_t n,
+                     float alpha,
+                     const float *a,
+                     size_t a_rs,
+                     size_t a_cs,
+                     const float *b,
+                     size_t b_rs,
+                     size_t,
+                     float beta,
+                     float *c,
+                     size_t ldc)
+{
+        const __m256 alpha_v = _mm256_set1_ps(alpha);
+        const __m256 beta_v = _mm256_set1_ps(beta);
+        for (size_t i = 0;
+             i < m;
+             ++i) {
+                float a_row[K];
+                gemm_small_load<K>(a_row, a + i*a_rs, a_cs);
+
+                float *c_row = c + i*ldc;
+                for (size_t j = 0;
+                     j < n;
+                     j += 8) {
+                        __m256i mask = gemv_mask_avx2(n - j);
+                        __m256 acc = _mm256_mul_ps(
+                                alpha_v,
+                                gemm_small_row_avx2<K>(a_row,
+                                                       b + j,
+                                                       b_rs,
+                                                       mask));
+                        if (beta != 0.0f) {
+                                acc = _mm256_fmadd_ps(
+                                        beta_v,
+                                        _mm256_maskload_ps(c_row + j, mask),
+                                        acc);
+                        }
+                        _mm256_maskstore_ps(c_row + j, mask, acc);
+                }
+        }
+}
+
+__attribute__((target("avx512f")))
+static __mmask16
+gemv_mask_avx512(size_t remaining)
+{
+        return (remaining >= 16) ? 0xFFFF : ((1u << remaining) - 1);
+}
+
+/**
+ * gemm_small_row_avx512() - `gemm_small_row_avx2` for sixteen columns.
+ */
+template<size_t P>
+__attribute__((target("avx512f")))
+static inline __m512
+gemm_small_row_avx512(const float *a_row,
+                      const float *b,
+                      size_t b_rs,
+                      __mmask16 mask)
+{
+        return _mm512_fmadd_ps(_mm512_set1_ps(a_row[P - 1]),
+                               _mm512_maskz_loadu_ps(mask,
+                                                     b + (P - 1)*b_rs),
+                               gemm_small_row_avx512<P - 1>(a_row,
+                                                            b,
+                                                            b_rs,
+                                                            mask));
+}
+
+template<>
+__attribute__((target("avx512f")))
+inline __m512
+gemm_small_row_avx512<0>(const float *, const float *, size_t, __mmask16)
+{
+        return _mm512_setzero_ps();
+}
+
+template<size_t K>
+__attribute__((target("avx512f")))
+static void
+gemm_small_rows_avx512(size_t m,
+                       size_t n,
+                       float alpha,
+                       const float *a,
+                       size_t a_rs,
+                       size_t a_cs,
+                       const float *b,
+                       size_t b_rs,
+                       size_t,
+                       float beta,
+                       float *c,
+                       size_t ldc)
+{
+        const __m512 alpha_v = _mm512_set1_ps(alpha);
+        const __m512 beta_v = _mm512_set1_ps(beta);
+        for (size_t i = 0;
+             i < m;
+             ++i) {
+                float a_row[K];
+                gemm_small_load<K>(a_row, a + i*a_rs, a_cs);
+
+                float *c_row = c + i*ldc;
+                for (size_t j = 0;
+                     j < n;
+                     j += 16) {
+                        __mmask16 mask = gemv_mask_avx512(n - j);
+                        __m512 acc = _mm512_mul_ps(
+                                alpha_v,
+                                gemm_small_row_avx512<K>(a_row,
+                                                         b + j,
+                                                         b_rs,
+                                                         mask));
+                        if (beta != 0.0f) {
+                                acc = _mm512_fmadd_ps(
+                                        beta_v,
+                                        _mm512_maskz_loadu_ps(mask, c_row + j),
+                                        acc);
+                        }
+                        _mm512_mask_storeu_ps(c_row + j, mask, acc);
+                }
+        }
+}
+
+template<size_t K>
+static constexpr struct gemm_small_kernel
+gemm_small_kernel_for(void)
+{
+        return {gemm_small_fixed<K>,
+                gemm_small_rows_avx2<K>,
+                gemm_small_rows_avx512<K>};
+}
+
+/**
+ * NOTE(brendan): gemm_small_kernels[k - 1] are the kernels for depth k.
+ */
+static const struct gemm_small_kernel gemm_small_kernels[GEMM_SMALL_MAX_K] = {
+        gemm_small_kernel_for<1>(),
+        gemm_small_kernel_for<2>(),
+        gemm_small_kernel_for<3>(),
+        gemm_small_kernel_for<4>(),
+        gemm_small_kernel_for<5>(),
+        gemm_small_kernel_for<6>(),
+        gemm_small_kernel_for<7>(),
+        gemm_small_kernel_for<8>(),
+        gemm_small_kernel_for<9>(),
+        gemm_small_kernel_for<10>(),
+        gemm_small_kernel_for<11>(),
+        gemm_small_kernel_for<12>(),
+        gemm_small_kernel_for<13>(),
+        gemm_small_kernel_for<14>(),
+        gemm_small_kernel_for<15>(),
+        gemm_small_kernel_for<16>(),
+};
+
+/**
+ * gemv_store() - Stores `rows` accumulated dot products `acc` to y.
+ */
+static inline void
+gemv_store(size_t rows,
+           const float *acc,
+           float alpha,
+           float beta,
+           float *y,
+           size_t incy)
+{
+        for (size_t i = 0;
+             i < rows;
+             ++i) {
+                float *y_i = y + i*incy;
+                *y_i = (beta == 0.0f) ? alpha*acc[i] : (alpha*acc[i] +
+                                                        beta*(*y_i));
+        }
+}
+
+static void
+gemv_dot_generic(size_t rows,
+                 size_t k,
+                 float alpha,
+                 const float *a,
+                 size_t lda,
+                 const float *x,
+                 float beta,
+                 float *y,
+                 size_t incy)
+{
+        for (size_t i = 0;
+             i < rows;
+             ++i) {
+                const float *a_row = a + i*lda;
+                float acc = 0.0f;
+                for (size_t p = 0;
+                     p < k;
+                     ++p) {
+                        acc += a_row[p]*x[p];
+                }
+                gemv_store(1, &acc, alpha, beta, y + i*incy, incy);
+        }
+}
+
+static void
+gemv_axpy_generic(size_t rows,
+                  size_t k,
+                  float alpha,
+                  const float *a,
+                  size_t lda,
+                  const float *x,
+                  size_t incx,
+                  float beta,
+                  float *y,
+                  size_t incy)
+{
+        float acc[GEMV_GRAIN_ROWS];
+        for (size_t i0 = 0;
+             i0 < rows;
+             i0 += GEMV_GRAIN_ROWS) {
+                const size_t num_rows = ((rows - i0 < GEMV_GRAIN_ROWS) ?
+                                         (rows - i0) : GEMV_GRAIN_ROWS);
+                for (size_t i = 0;
+                     i < num_rows;
+                     ++i) {
+                        acc[i] = 0.0f;
+                }
+
+                for (size_t p = 0;
+                     p < k;
+                     ++p) {
+                        const float *a_col = a + p*lda + i0;
+                        const float x_p = x[p*incx];
+                        for (size_t i = 0;
+                             i < num_rows;
+                             ++i) {
+                                acc[i] += a_col[i]*x_p;
+                        }
+                }
+
+                gemv_store(num_rows, acc, alpha, beta, y + i0*incy, incy);
+        }
+}
+
+__attribute__((target("avx2")))
+static float
+gemv_hsum_avx2(__m256 v)
+{
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v),
+                                _mm256_extractf128_ps(v, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+
+        return _mm_cvtss_f32(sum);
+}
+
+/**
+ * NOTE(brendan): The dot kernels take four rows at a time, so that each load
+ * of x is shared by four independent accumulators.
+ */
+__attribute__((target("avx2,fma")))
+static void
+gemv_dot_avx2(size_t rows,
+              size_t k,
+              float alpha,
+              const float *a,
+              size_t lda,
+              const float *x,
+              float beta,
+              float *y,
+              size_t incy)
+{
+        size_t i = 0;
+        for (;
+             i + 4 <= rows;
+             i += 4) {
+                const float *a0 = a + i*lda;
+                __m256 acc0 = _mm256_setzero_ps();
+                __m256 acc1 = _mm256_setzero_ps();
+                __m256 acc2 = _mm256_setzero_ps();
+                __m256 acc3 = _mm256_setzero_ps();
+                for (size_t p = 0;
+                     p < k;
+                     p += 8) {
+                        __m256i mask = gemv_mask_avx2(k - p);
+                        __m256 x_p = _mm256_maskload_ps(x + p, mask);
+                        acc0 = _mm256_fmadd_ps(
+                                _mm256_maskload_ps(a0 + p, mask), x_p, acc0);
+                        acc1 = _mm256_fmadd_ps(
+                                _mm256_maskload_ps(a0 + lda + p, mask),
+                                x_p,
+                                acc1);
+                        acc2 = _mm256_fmadd_ps(
+                                _mm256_maskload_ps(a0 + 2*lda + p, mask),
+                                x_p,
+                                acc2);
+                        acc3 = _mm256_fmadd_ps(
+                                _mm256_maskload_ps(a0 + 3*lda + p, mask),
+                                x_p,
+                                acc3);
+                }
+
+                const float acc[] = {gemv_hsum_avx2(acc0),
+                                     gemv_hsum_avx2(acc1),
+                                     gemv_hsum_avx2(acc2),
+                                     gemv_hsum_avx2(acc3)};
+                gemv_store(4, acc, alpha, beta, y + i*incy, incy);
+        }
+
+        for (;
+             i < rows;
+             ++i) {
+                const float *a_row = a + i*lda;
+                __m256 acc0 = _mm256_setzero_ps();
+                for (size_t p = 0;
+                     p < k;
+                     p += 8) {
+                        __m256i mask = gemv_mask_avx2(k - p);
+                        acc0 = _mm256_fmadd_ps(
+                                _mm256_maskload_ps(a_row + p, mask),
+                                _mm256_maskload_ps(x + p, mask),
+                                acc0);
+                }
+
+                const float acc = gemv_hsum_avx2(acc0);
+                gemv_store(1, &acc, alpha, beta, y + i*incy, incy);
+        }
+}
+
+/**
+ * NOTE(brendan): The axpy kernels keep four vectors of y in registers while
+ * streaming down the columns of A.
+ */
+__attribute__((target("avx2,fma")))
+static void
+gemv_axpy_avx2(size_t rows,
+               size_t k,
+               float alpha,
+               const float *a,
+               size_t lda,
+               const float *x,
+               size_t incx,
+               float beta,
+               float *y,
+               size_t incy)
+{
+        float acc[32];
+        for (size_t i0 = 0;
+             i0 < rows;
+             i0 += 32) {
+                const size_t num_rows = (rows - i0 < 32) ? (rows - i0) : 32;
+                const __m256i mask0 = gemv_mask_avx2(num_rows);
+                const __m256i mask1 = gemv_mask_avx2((num_rows > 8) ?
+                                                     (num_rows - 8) : 0);
+                const __m256i mask2 = gemv_mask_avx2((num_rows > 16) ?
+                                                     (num_rows - 16) : 0);
+                const __m256i mask3 = gemv_mask_avx2((num_rows > 24) ?
+                                                     (num_rows - 24) : 0);
+                __m256 acc0 = _mm256_setzero_ps();
+                __m256 acc1 = _mm256_setzero_ps();
+                __m256 acc2 = _mm256_setzero_ps();
+                __m256 acc3 = _mm256_setzero_ps();
+                for (size_t p = 0;
+                     p < k;
+                     ++p) {
+                        const float *a_col = a + p*lda + i0;
+                        const __m256 x_p = _mm256_set1_ps(x[p*incx]);
+                        acc0 = _mm256_fmadd_ps(
+                                _mm256_maskload_ps(a_col, mask0), x_p, acc0);
+                        acc1 = _mm256_fmadd_ps(
+                                _mm256_maskload_ps(a_col + 8, mask1),
+                                x_p,
+                                acc1);
+                        acc2 = _mm256_fmadd_ps(
+                                _mm256_maskload_ps(a_col + 16, mask2),
+                                x_p,
+                                acc2);
+                        acc3 = _mm256_fmadd_ps(
+                                _mm256_maskload_ps(a_col + 24, mask3),
+                                x_p,
+                                acc3);
+                }
+
+                _mm256_storeu_ps(acc, acc0);
+                _mm256_storeu_ps(acc + 8, acc1);
+                _mm256_storeu_ps(acc + 16, acc2);
+                _mm256_storeu_ps(acc + 24, acc3);
+                gemv_store(num_rows, acc, alpha, beta, y + i0*incy, incy);
+        }
+}
+
+__attribute__((target("avx512f")))
+static void
+gemv_dot_avx512(size_t rows,
+                size_t k,
+                float alpha,
+                const float *a,
+                size_t lda,
+                const float *x,
+                float beta,
+                float *y,
+                size_t incy)
+{
+        size_t i = 0;
+        for (;
+             i + 4 <= rows;
+             i += 4) {
+                const float *a0 = a + i*lda;
+                __m512 acc0 = _mm512_setzero_ps();
+                __m512 acc1 = _mm512_setzero_ps();
+                __m512 acc2 = _mm512_setzero_ps();
+                __m512 acc3 = _mm512_setzero_ps();
+                for (size_t p = 0;
+                     p < k;
+                     p += 16) {
+                        __mmask16 mask = gemv_mask_avx512(k - p);
+                        __m512 x_p = _mm512_maskz_loadu_ps(mask, x + p);
+                        acc0 = _mm512_fmadd_ps(
+                                _mm512_maskz_loadu_ps(mask, a0 + p),
+                                x_p,
+                                acc0);
+                        acc1 = _mm512_fmadd_ps(
+                                _mm512_maskz_loadu_ps(mask, a0 + lda + p),
+                                x_p,
+                                acc1);
+                        acc2 = _mm512_fmadd_ps(
+                                _mm512_maskz_loadu_ps(mask, a0 + 2*lda + p),
+                                x_p,
+                                acc2);
+                        acc3 = _mm512_fmadd_ps(
+                                _mm512_maskz_loadu_ps(mask, a0 + 3*lda + p),
+                                x_p,
+                                acc3);
+                }
+
+                const float acc[] = {_mm512_reduce_add_ps(acc0),
+                                     _mm512_reduce_add_ps(acc1),
+                                     _mm512_reduce_add_ps(acc2),
+                                     _mm512_reduce_add_ps(acc3)};
+                gemv_store(4, acc, alpha, beta, y + i*incy, incy);
+        }
+
+        for (;
+             i < rows;
+             ++i) {
+                const float *a_row = a + i*lda;
+                __m512 acc0 = _mm512_setzero_ps();
+                for (size_t p = 0;
+                     p < k;
+                     p += 16) {
+                        __mmask16 mask = gemv_mask_avx512(k - p);
+                        acc0 = _mm512_fmadd_ps(
+                                _mm512_maskz_loadu_ps(mask, a_row + p),
+                                _mm512_maskz_loadu_ps(mask, x + p),
+                                acc0);
+                }
+
+                const float acc = _mm512_reduce_add_ps(acc0);
+                gemv_store(1, &acc, alpha, beta, y + i*incy, incy);
+        }
+}
+
+__attribute__((target("avx512f")))
+static void
+gemv_axpy_avx512(size_t rows,
+                 size_t k,
+                 float alpha,
+                 const float *a,
+                 size_t lda,
+                 const float *x,
+                 size_t incx,
+                 float beta,
+                 float *y,
+                 size_t incy)
+{
+        float acc[64];
+        for (size_t i0 = 0;
+             i0 < rows;
+             i0 += 64) {
+                const size_t num_rows = (rows - i0 < 64) ? (rows - i0) : 64;
+                const __mmask16 mask0 = gemv_mask_avx512(num_rows);
+                const __mmask16 mask1 = gemv_mask_avx512((num_rows > 16) ?
+                                                         (num_rows - 16) : 0);
+                const __mmask16 mask2 = gemv_mask_avx512((num_rows > 32) ?
+                                                         (num_rows - 32) : 0);
+                const __mmask16 mask3 = gemv_mask_avx512((num_rows > 48) ?
+                                                         (num_rows - 48) : 0);
+                __m512 acc0 = _mm512_setzero_ps();
+                __m512 acc1 = _mm512_setzero_ps();
+                __m512 acc2 = _mm512_setzero_ps();
+                __m512 acc3 = _mm512_setzero_ps();
+                for (size_t p = 0;
+                     p < k;
+                     ++p) {
+                        const float *a_col = a + p*lda + i0;
+                        const __m512 x_p = _mm512_set1_ps(x[p*incx]);
+                        acc0 = _mm512_fmadd_ps(
+                                _mm512_maskz_loadu_ps(mask0, a_col),
+                                x_p,
+                                acc0);
+                        acc1 = _mm512_fmadd_ps(
+                                _mm512_maskz_loadu_ps(mask1, a_col + 16),
+                                x_p,
+                                acc1);
+                        acc2 = _mm512_fmadd_ps(
+                                _mm512_maskz_loadu_ps(mask2, a_col + 32),
+                                x_p,
+                                acc2);
+                        acc3 = _mm512_fmadd_ps(
+                                _mm512_maskz_loadu_ps(mask3, a_col + 48),
+                                x_p,
+                                acc3);
+                }
+
+                _mm512_storeu_ps(acc, acc0);
+                _mm512_storeu_ps(acc + 16, acc1);
+                _mm512_storeu_ps(acc + 32, acc2);
+                _mm512_storeu_ps(acc + 48, acc3);
+                gemv_store(num_rows, acc, alpha, beta, y + i0*incy, incy);
+        }
+}
+
+static const struct gemv_kernel gemv_kernel_generic = {
+        .dot = gemv_dot_generic,
+        .axpy = gemv_axpy_generic,
+};
+
+static const struct gemv_kernel gemv_kernel_avx2 = {
+        .dot = gemv_dot_avx2,
+        .axpy = gemv_axpy_avx2,
+};
+
+static const struct gemv_kernel gemv_kernel_avx512 = {
+        .dot = gemv_dot_avx512,
+        .axpy = gemv_axpy_avx512,
+};
+
+static const struct gemv_kernel *
+gemv_get_kernel(void)
+{
+        switch (cpu_get_isa()) {
+        case CPU_ISA_AVX512:
+                return &gemv_kernel_avx512;
+        case CPU_ISA_AVX2:
+                return &gemv_kernel_avx2;
+        default:
+                return &gemv_kernel_generic;
+        }
+}
+
+/**
+ * gemv_range() - Computes rows [begin, end) of the GEMV `context`.
+ *
+ * A strided x is gathered GEMV_BLOCK_K elements at a time for the dot
+ * kernels, which then accumulate each block into y.
+ */
+static void
+gemv_range(void *context, size_t begin, size_t end)
+{
+        const struct gemv_job *job = (const struct gemv_job *)context;
+        const float *a = job->a + begin*job->a_rs;
+        float *y = job->y + begin*job->incy;
+        if (job->a_cs != 1) {
+                job->kernel->axpy(end - begin,
+                                  job->k,
+                                  job->alpha,
+                                  a,
+                                  job->a_cs,
+                                  job->x,
+                                  job->incx,
+                                  job->beta,
+                                  y,
+                                  job->incy);
+                return;
+        }
+
+        if (job->incx == 1) {
+                job->kernel->dot(end - begin,
+                                 job->k,
+                                 job->alpha,
+                                 a,
+                                 job->a_rs,
+                                 job->x,
+                                 job->beta,
+                                 y,
+                                 job->incy);
+                return;
+        }
+
+        float x_block[GEMV_BLOCK_K];
+        for (size_t p0 = 0;
+             p0 < job->k;
+             p0 += GEMV_BLOCK_K) {
+                const size_t block_k = ((job->k - p0 < GEMV_BLOCK_K) ?
+                                        (job->k - p0) : GEMV_BLOCK_K);
+                for (size_t p = 0;
+                     p < block_k;
+                     ++p) {
+                        x_block[p] = job->x[(p0 + p)*job->incx];
+                }
+
+                job->kernel->dot(end - begin,
+                                 block_k,
+                                 job->alpha,
+                                 a + p0,
+                                 job->a_rs,
+                                 x_block,
+                                 (p0 == 0) ? job->beta : 1.0f,
+                                 y,
+                                 job->incy);
+        }
+}
+
+/**
+ * gemv() - Runs the GEMV `job` over `rows` rows, across threads if it is
+ * big enough.
+ */
+static void
+gemv(struct gemv_job *job, size_t rows)
+{
+        if ((rows*job->k < GEMV_MIN_PARALLEL_MACS) ||
+            (thread_get_num_workers() == 1)) {
+                gemv_range(job, 0, rows);
+                return;
+        }
+
+        parallel_for_range(0, rows, GEMV_GRAIN_ROWS, gemv_range, job);
+}
+
+bool gemm_small(bool trans_a,
+                bool trans_b,
+                size_t m,
+                size_t n,
+                size_t k,
+                float alpha,
+                const float *a,
+                size_t lda,
+                const float *b,
+                size_t ldb,
+                float beta,
+                float *c,
+                size_t ldc,
+                const struct gemm_epilogue *epilogue)
+{
+        if ((m == 0) || (n == 0) || (k == 0) || (alpha == 0.0f))
+                return false;
+
+        const size_t a_rs = trans_a ? 1 : lda;
+        const size_t a_cs = trans_a ? lda : 1;
+        const size_t b_rs = trans_b ? 1 : ldb;
+        const size_t b_cs = trans_b ? ldb : 1;
+        gemm_small_fn *small_fn = NULL;
+        if (k <= GEMM_SMALL_MAX_K) {
+                const struct gemm_small_kernel *kernel =
+                        gemm_small_kernels + (k - 1);
+                const size_t macs = m*n*k;
+                const enum cpu_isa isa = cpu_get_isa();
+                if ((b_cs == 1) &&
+                    (n >= GEMM_SMALL_MIN_ROW_N) &&
+                    (isa >= CPU_ISA_AVX2) &&
+                    (macs <= GEMM_SMALL_MAX_MACS)) {
+                        small_fn = ((isa >= CPU_ISA_AVX512) ?
+                                    kernel->rows_avx512 : kernel->rows_avx2);
+                } else if (macs <= GEMM_SMALL_MAX_SCALAR_MACS) {
+                        small_fn = kernel->generic;
+                }
+        }
+
+        if (small_fn == NULL)
+                return false;
+
+        small_fn(m, n, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, ldc);
+
+        if (epilogue != NULL)
+                gemm_apply_epilogue(m, n, c, ldc, epilogue);
+
+        return true;
+}
+
+bool gemm_gemv(bool trans_a,
+               bool trans_b,
+               size_t m,
+               size_t n,
+               size_t k,
+               float alpha,
+               const float *a,
+               size_t lda,
+               const float *b,
+               size_t ldb,
+               float beta,
+               float *c,
+               size_t ldc,
+               const struct gemm_epilogue *epilogue)
+{
+        if ((m == 0) || (n == 0) || (k == 0) || (alpha == 0.0f))
+                return false;
+
+        const size_t a_rs = trans_a ? 1 : lda;
+        const size_t a_cs = trans_a ? lda : 1;
+        const size_t b_rs = trans_b ? 1 : ldb;
+        const size_t b_cs = trans_b ? ldb : 1;
+        if (n == 1) {
+                struct gemv_job job = {.kernel = gemv_get_kernel(),
+                                       .k = k,
+                                       .alpha = alpha,
+                                       .a = a,
+                                       .a_rs = a_rs,
+                                       .a_cs = a_cs,
+                                       .x = b,
+                                       .incx = b_rs,
+                                       .beta = beta,
+                                       .y = c,
+                                       .incy = ldc};
+                gemv(&job, m);
+        } else if (m == 1) {
+                /**
+                 * NOTE(brendan): A row vector result is the transpose of
+                 * op(B)^T*op(A)^T.
+                 */
+                struct gemv_job job = {.kernel = gemv_get_kernel(),
+                                       .k = k,
+                                       .alpha = alpha,
+                                       .a = b,
+                                       .a_rs = b_cs,
+                                       .a_cs = b_rs,
+                                       .x = a,
+                                       .incx = a_cs,
+                                       .beta = beta,
+                                       .y = c,
+                                       .incy = 1};
+                gemv(&job, n);
+        } else {
+                return false;
+        }
+
+        if (epilogue != NULL)
+                gemm_apply_epilogue(m, n, c, ldc, epilogue);
+
+        return true;
+}
@@ -0,0 +1,696 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "math/qgemm.h"
+#include "error/log_error.h"  /* for LOG_ERROR */
+#include "math/dtype.h"       /* for dtype_quantize */
+#include "math/size_math.h"   /* for min_size, ceil_div, round_up */
+#include "platform/cpu.h"     /* for cpu_get_isa, cpu_has_feature */
+#include "platform/thread.h"  /* for parallel_for, thread_get_num_workers */
+
+#include <immintrin.h>        /* for __m512i, _mm512_dpbusd_epi32, ... */
+#include <stdint.h>           /* for int32_t, uint8_t */
+
+#define QGEMM_MAX_MR 12
+#define QGEMM_MAX_NR 32
+#define QGEMM_MC 96
+#define QGEMM_ALIGN_BYTES 64
+#define QGEMM_PACK_PANELS_PER_TASK 8
+/**
+ * NOTE(brendan): Columns of op(B) are packed in blocks of at most this many
+ * bytes, which sit in L2 alongside a block of packed A.
+ */
+#define QGEMM_NC_BYTES (512*1024)
+#define QGEMM_MIN_PARALLEL_MACS (64*64*64)
+
+/**
+ * qgemm_microkernel_fn - Computes the integer dot products of an mr x nr tile.
+ * @num_groups: Depth of the packed panels, in groups of consecutive k.
+ * @a_panel: Groups of mr packed rows of op(A), as unsigned integers.
+ * @b_panel: Groups of nr packed columns of op(B), as signed integers.
+ * @acc: Output mr x nr tile of sums, with rows nr apart.
+ */
+typedef void qgemm_microkernel_fn(size_t num_groups,
+                                  const void *a_panel,
+                                  const void *b_panel,
+                                  int32_t *acc);
+
+/**
+ * struct qgemm_kernel - Packing format belonging to a microkernel.
+ * @mr, @nr: Rows and columns of the tile computed by `microkernel`.
+ * @group: Number of consecutive k packed together for each row or column.
+ * @elem_bytes: Size of a packed element, 1 for bytes or 2 for 16-bit
+ * integers.
+ */
+struct qgemm_kernel {
+        uint32_t mr;
+        uint32_t nr;
+        uint32_t group;
+        uint32_t elem_bytes;
+        qgemm_microkernel_fn *microkernel;
+};
+
+/**
+ * struct qgemm_block - State shared by the packing and compute tasks of a
+ * quantized GEMM.
+ * @a_zero_point, @b_zero_point: Zero points of the packed operands, which are
+ * shifted by 128 when the sign of an operand is flipped for packing.
+ * @a_sums, @b_sums: Sums of the packed rows of the current block of op(A),
+ * and of the packed columns of the current block of op(B).
+ * @ic, @mc: First row and number of rows of op(A) packed in `a_packed`.
+ */
+struct qgemm_block {
+        const struct qgemm_kernel *kernel;
+        const struct qgemm_operand *a;
+        const struct qgemm_operand *b;
+        const struct qgemm_output *c;
+        const struct gemm_epilogue *epilogue;
+        size_t k;
+        size_t num_groups;
+        float alpha;
+        float beta;
+        int32_t a_zero_point;
+        int32_t b_zero_point;
+        uint8_t *a_packed;
+        int32_t *a_sums;
+        uint8_t *b_packed;
+        int32_t *b_sums;
+        size_t jc;
+        size_t nc;
+        size_t ic;
+        size_t mc;
+        size_t mc_task;
+        size_t nc_task;
+        size_t num_nc_tasks;
+};
+
+static void
+qgemm_microkernel_generic_6x16(size_t num_groups,
+                               const void *a_panel,
+                               const void *b_panel,
+                               int32_t *acc)
+{
+        const int16_t *a = (const int16_t *)a_panel;
+        const int16_t *b = (const int16_t *)b_panel;
+        for (uint32_t i = 0;
+             i < 6*16;
+             ++i) {
+                acc[i] = 0;
+        }
+
+        for (size_t g = 0;
+             g < num_groups;
+             ++g) {
+                for (uint32_t r = 0;
+                     r < 6;
+                     ++r) {
+                        int32_t a0 = a[2*(g*6 + r)];
+                        int32_t a1 = a[2*(g*6 + r) + 1];
+                        for (uint32_t col = 0;
+                             col < 16;
+                             ++col) {
+                                acc[r*16 + col] += (a0*b[2*(g*16 + col)] +
+                                                    a1*b[2*(g*16 + col) + 1]);
+                        }
+                }
+        }
+}
+
+/**
+ * NOTE(brendan): Each 32-bit lane of a packed B vector holds a pair of 16-bit
+ * integers from consecutive k of one column. VPMADDWD multiplies them by the
+ * broadcast pair of the row of A and adds the two products into the lane.
+ */
+__attribute__((target("avx2")))
+static void
+qgemm_microkernel_avx2_6x16(size_t num_groups,
+                            const void *a_panel,
+                            const void *b_panel,
+                            int32_t *acc)
+{
+        const int32_t *a = (const int32_t *)a_panel;
+        const __m256i *b = (const __m256i *)b_panel;
+        __m256i c[6][2];
+        for (uint32_t r = 0;
+             r < 6;
+             ++r) {
+                c[r][0] = _mm256_setzero_si256();
+                c[r][1] = _mm256_setzero_si256();
+        }
+
+        for (size_t g = 0;
+             g < num_groups;
+             ++g) {
+                __m256i b0 = _mm256_loadu_si256(b + 2*g);
+                __m256i b1 = _mm256_loadu_si256(b + 2*g + 1);
+                for (uint32_t r = 0;
+                     r < 6;
+                     ++r) {
+                        __m256i a_r = _mm256_set1_epi32(a[g*6 + r]);
+                        c[r][0] = _mm256_add_epi32(c[r][0],
+                                                   _mm256_madd_epi16(a_r, b0));
+                        c[r][1] = _mm256_add_epi32(c[r][1],
+                                                   _mm256_madd_epi16(a_r, b1));
+                }
+        }
+
+        for (uint32_t r = 0;
+             r < 6;
+             ++r) {
+                _mm256_storeu_si256((__m256i *)(acc + r*16), c[r][0]);
+                _mm256_storeu_si256((__m256i *)(acc + r*16 + 8), c[r][1]);
+        }
+}
+
+/**
+ * NOTE(brendan): As for AVX2, but with a group of four unsigned bytes of A
+ * broadcast to every lane, and four signed bytes of one column of B in each
+ * lane. VPDPBUSD adds the four products into the lane's accumulator.
+ */
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static void
+qgemm_microkernel_avx512vnni_12x32(size_t num_groups,
+                                   const void *a_panel,
+                                   const void *b_panel,
+                                   int32_t *acc)
+{
+        const int32_t *a = (const int32_t *)a_panel;
+        const __m512i *b = (const __m512i *)b_panel;
+        __m512i c[12][2];
+        for (uint32_t r = 0;
+             r < 12;
+             ++r) {
+                c[r][0] = _mm512_setzero_si512();
+                c[r][1] = _mm512_setzero_si512();
+        }
+
+        for (size_t g = 0;
+             g < num_groups;
+             ++g) {
+                __m512i b0 = _mm512_loadu_si512(b + 2*g);
+                __m512i b1 = _mm512_loadu_si512(b + 2*g + 1);
+                for (uint32_t r = 0;
+                     r < 12;
+                     ++r) {
+                        __m512i a_r = _mm512_set1_epi32(a[g*12 + r]);
+                        c[r][0] = _mm512_dpbusd_epi32(c[r][0], a_r, b0);
+                        c[r][1] = _mm512_dpbusd_epi32(c[r][1], a_r, b1);
+                }
+        }
+
+        for (uint32_t r = 0;
+             r < 12;
+             ++r) {
+                _mm512_storeu_si512(acc + r*32, c[r][0]);
+                _mm512_storeu_si512(acc + r*32 + 16, c[r][1]);
+        }
+}
+
+static const struct qgemm_kernel qgemm_kernel_generic = {
+        .mr = 6,
+        .nr = 16,
+        .group = 2,
+        .elem_bytes = 2,
+        .microkernel = qgemm_microkernel_generic_6x16};
+
+static const struct qgemm_kernel qgemm_kernel_avx2 = {
+        .mr = 6,
+        .nr = 16,
+        .group = 2,
+        .elem_bytes = 2,
+        .microkernel = qgemm_microkernel_avx2_6x16};
+
+static const struct qgemm_kernel qgemm_kernel_avx512vnni = {
+        .mr = 12,
+        .nr = 32,
+        .group = 4,
+        .elem_bytes = 1,
+        .microkernel = qgemm_microkernel_avx512vnni_12x32};
+
+/**
+ * NOTE(brendan): AVX-512 without VNNI runs the AVX2 kernel, since widening
+ * bytes to 16 bits in 512-bit vectors needs AVX-512 BW as well.
+ */
+static const struct qgemm_kernel *
+qgemm_get_kernel(void)
+{
+        if (cpu_has_feature(CPU_FEATURE_AVX512_VNNI))
+                return &qgemm_kernel_avx512vnni;
+
+        if (cpu_get_isa() >= CPU_ISA_AVX2)
+                return &qgemm_kernel_avx2;
+
+        return &qgemm_kernel_generic;
+}
+
+/**
+ * qgemm_load() - Returns element (i, p) of op(`operand`), where op(A) is mxk
+ * and op(B) is kxn, i.e. `i` indexes rows of op(A) or columns of op(B).
+ * @is_b: Whether `operand` is B, whose op() is indexed (p, i).
+ */
+static int32_t
+qgemm_load(const struct qgemm_operand *operand, bool is_b, size_t i, size_t p)
+{
+        bool is_row_major = (operand->is_trans == is_b);
+        size_t offset = (is_row_major ?
+                         (i*operand->ld + p) : (p*operand->ld + i));
+        if (operand->dtype == ROT_DTYPE_INT8)
+                return ((const int8_t *)operand->data)[offset];
+
+        return ((const uint8_t *)operand->data)[offset];
+}
+
+/**
+ * qgemm_pack_panel() - Packs `rows` rows of op(A), or columns of op(B),
+ * starting at `i`, into a panel of `width` = mr or nr, zero padded.
+ * @shift: Added to each integer so that A packs as unsigned and B as signed.
+ * @sums: Set to the sum of each packed row or column.
+ */
+static void
+qgemm_pack_panel(const struct qgemm_block *block,
+                 const struct qgemm_operand *operand,
+                 bool is_b,
+                 size_t i,
+                 size_t rows,
+                 uint32_t width,
+                 int32_t shift,
+                 uint8_t *panel,
+                 int32_t *sums)
+{
+        const struct qgemm_kernel *kernel = block->kernel;
+        const uint32_t group = kernel->group;
+        uint8_t *panel_8 = panel;
+        int16_t *panel_16 = (int16_t *)panel;
+
+        for (uint32_t r = 0;
+             r < width;
+             ++r) {
+                sums[r] = 0;
+        }
+
+        for (size_t g = 0;
+             g < block->num_groups;
+             ++g) {
+                for (uint32_t r = 0;
+                     r < width;
+                     ++r) {
+                        for (uint32_t e = 0;
+                             e < group;
+                             ++e) {
+                                size_t p = g*group + e;
+                                int32_t q = 0;
+                                if ((r < rows) && (p < block->k)) {
+                                        q = shift + qgemm_load(operand,
+                                                               is_b,
+                                                               i + r,
+                                                               p);
+                                        sums[r] += q;
+                                }
+
+                                size_t offset = (g*width + r)*group + e;
+                                if (kernel->elem_bytes == 1)
+                                        panel_8[offset] = (uint8_t)q;
+                                else
+                                        panel_16[offset] = (int16_t)q;
+                        }
+                }
+        }
+}
+
+/**
+ * qgemm_get_shift() - Returns the shift that makes integers of type `dtype`
+ * unsigned if `is_unsigned`, and signed otherwise.
+ */
+static int32_t
+qgemm_get_shift(enum rot_dtype dtype, bool is_unsigned)
+{
+        if (is_unsigned)
+                return (dtype == ROT_DTYPE_INT8) ? 128 : 0;
+
+        return (dtype == ROT_DTYPE_UINT8) ? -128 : 0;
+}
+
+/**
+ * qgemm_pack_panels() - Packs QGEMM_PACK_PANELS_PER_TASK panels of
+ * op(`operand`), starting at panel `task_i`, from the rows or columns of op()
+ * in [start, end).
+ */
+static void
+qgemm_pack_panels(const struct qgemm_block *block,
+                  size_t task_i,
+                  bool is_b,
+                  size_t start,
+                  size_t end,
+                  uint8_t *packed,
+                  int32_t *sums)
+{
+        const struct qgemm_kernel *kernel = block->kernel;
+        const size_t group_bytes = kernel->group*kernel->elem_bytes;
+        const struct qgemm_operand *operand = is_b ? block->b : block->a;
+        const uint32_t width = is_b ? kernel->nr : kernel->mr;
+        const int32_t shift = qgemm_get_shift(operand->dtype, !is_b);
+
+        size_t first = task_i*QGEMM_PACK_PANELS_PER_TASK*width;
+        size_t last = min_size(first + QGEMM_PACK_PANELS_PER_TASK*width,
+                               end - start);
+        for (size_t i = first;
+             i < last;
+             i += width) {
+                qgemm_pack_panel(block,
+                                 operand,
+                                 is_b,
+                                 start + i,
+                                 min_size(width, last - i),
+                                 width,
+                                 shift,
+                                 packed + i*block->num_groups*group_bytes,
+                                 sums + i);
+        }
+}
+
+static void
+qgemm_pack_a_task(void *context, size_t task_i)
+{
+        const struct qgemm_block *block = (const struct qgemm_block *)context;
+
+        qgemm_pack_panels(block,
+                          task_i,
+                          false,
+                          block->ic,
+                          block->ic + block->mc,
+                          block->a_packed,
+                          block->a_sums);
+}
+
+static void
+qgemm_pack_b_task(void *context, size_t task_i)
+{
+        const struct qgemm_block *block = (const struct qgemm_block *)context;
+
+        qgemm_pack_panels(block,
+                          task_i,
+                          true,
+                          block->jc,
+                          block->jc + block->nc,
+                          block->b_packed,
+                          block->b_sums);
+}
+
+/**
+ * qgemm_store_tile() - Turns a rows x cols tile of integer sums at row `i`
+ * and column `j` of C into real numbers, applies alpha, beta and the
+ * epilogue, and stores the tile to C.
+ */
+static void
+qgemm_store_tile(const struct qgemm_block *block,
+                 const int32_t *acc,
+                 size_t i,
+                 size_t j,
+                 size_t rows,
+                 size_t cols)
+{
+        const struct qgemm_kernel *kernel = block->kernel;
+        const struct qgemm_operand *a = block->a;
+        const struct qgemm_operand *b = block->b;
+        const struct qgemm_output *c = block->c;
+        const int64_t za = block->a_zero_point;
+        const int64_t zb = block->b_zero_point;
+        const int64_t zab = (int64_t)block->k*za*zb;
+        const int32_t *a_sums = block->a_sums + (i - block->ic);
+        const int32_t *b_sums = block->b_sums + (j - block->jc);
+        float tile[QGEMM_MAX_MR*QGEMM_MAX_NR];
+
+        /**
+         * NOTE(brendan): sum_p (a_ip - za)*(b_pj - zb) =
+         * sum_p a_ip*b_pj - zb*sum_p a_ip - za*sum_p b_pj + k*za*zb.
+         */
+        for (size_t r = 0;
+             r < rows;
+             ++r) {
+                float a_scale = ((a->channel_scales != NULL) ?
+                                 a->channel_scales[i + r] : a->scale);
+                int64_t row_offset = zab - zb*a_sums[r];
+                float *c_row = (float *)c->data + (i + r)*c->ld + j;
+                for (size_t col = 0;
+                     col < cols;
+                     ++col) {
+                        float b_scale = ((b->channel_scales != NULL) ?
+                                         b->channel_scales[j + col] :
+                                         b->scale);
+                        int64_t sum = (acc[r*kernel->nr + col] + row_offset -
+                                       za*b_sums[col]);
+                        float x = block->alpha*a_scale*b_scale*(float)sum;
+                        if (block->beta != 0.0f)
+                                x += block->beta*c_row[col];
+
+                        tile[r*QGEMM_MAX_NR + col] = x;
+                }
+        }
+
+        if (block->epilogue != NULL) {
+                const struct gemm_epilogue *epilogue = block->epilogue;
+                struct gemm_epilogue tile_epilogue = {
+                        .row_bias = ((epilogue->row_bias != NULL) ?
+                                     epilogue->row_bias + i : NULL),
+                        .col_bias = ((epilogue->col_bias != NULL) ?
+                                     epilogue->col_bias + j : NULL),
+                        .activation = epilogue->activation};
+                gemm_apply_epilogue(rows,
+                                    cols,
+                                    tile,
+                                    QGEMM_MAX_NR,
+                                    &tile_epilogue);
+        }
+
+        for (size_t r = 0;
+             r < rows;
+             ++r) {
+                const float *tile_row = tile + r*QGEMM_MAX_NR;
+                size_t offset = (i + r)*c->ld + j;
+                if (c->dtype == ROT_DTYPE_FLOAT32) {
+                        float *c_row = (float *)c->data + offset;
+                        for (size_t col = 0;
+                             col < cols;
+                             ++col) {
+                                c_row[col] = tile_row[col];
+                        }
+                        continue;
+                }
+
+                dtype_quantize(c->dtype,
+                               tile_row,
+                               (uint8_t *)c->data + offset,
+                               cols,
+                               &c->scale,
+                               0,
+                               c->zero_point);
+        }
+}
+
+static void
+qgemm_compute_task(void *context, size_t task_i)
+{
+        const struct qgemm_block *block = (const struct qgemm_block *)context;
+        const struct qgemm_kernel *kernel = block->kernel;
+        const uint32_t mr = kernel->mr;
+        const uint32_t nr = kernel->nr;
+        const size_t group_bytes = kernel->group*kernel->elem_bytes;
+
+        size_t ic = (task_i/block->num_nc_tasks)*block->mc_task;
+        size_t mc = min_size(block->mc_task, block->mc - ic);
+        size_t jr_start = (task_i % block->num_nc_tasks)*block->nc_task;
+        size_t jr_end = min_size(jr_start + block->nc_task, block->nc);
+
+        int32_t acc[QGEMM_MAX_MR*QGEMM_MAX_NR];
+        for (size_t jr = jr_start;
+             jr < jr_end;
+             jr += nr) {
+                const uint8_t *b_panel = (block->b_packed +
+                                          jr*block->num_groups*group_bytes);
+                for (size_t ir = ic;
+                     ir < ic + mc;
+                     ir += mr) {
+                        const uint8_t *a_panel = (block->a_packed +
+                                                  (ir*block->num_groups*
+                                                   group_bytes));
+                        kernel->microkernel(block->num_groups,
+                                            a_panel,
+                                            b_panel,
+                                            acc);
+                        qgemm_store_tile(block,
+                                         acc,
+                                         block->ic + ir,
+                                         block->jc + jr,
+                                         min_size(mr, ic + mc - ir),
+                                         min_size(nr, jr_end - jr));
+                }
+        }
+}
+
+/**
+ * qgemm_run_tasks() - Runs tasks on the thread pool if the GEMM is big enough
+ * to benefit, otherwise runs them inline.
+ */
+static void
+qgemm_run_tasks(bool is_parallel,
+                size_t num_tasks,
+                parallel_task_fn *task_fn,
+                void *context)
+{
+        if (is_parallel) {
+                parallel_for(num_tasks, task_fn, context);
+                return;
+        }
+
+        for (size_t task_i = 0;
+             task_i < num_tasks;
+             ++task_i) {
+                task_fn(context, task_i);
+        }
+}
+
+bool qgemm(size_t m,
+           size_t n,
+           size_t k,
+           float alpha,
+           const struct qgemm_operand *a,
+           const struct qgemm_operand *b,
+           float beta,
+           const struct qgemm_output *c,
+           const struct gemm_epilogue *epilogue)
+{
+        if ((m == 0) || (n == 0))
+                return true;
+
+        const struct qgemm_kernel *kernel = qgemm_get_kernel();
+        const size_t num_groups = (k > 0) ? ceil_div(k, kernel->group) : 1;
+        const size_t group_bytes = kernel->group*kernel->elem_bytes;
+        const size_t panel_bytes = num_groups*group_bytes;
+        size_t nc_max = round_up(QGEMM_NC_BYTES/panel_bytes, kernel->nr);
+        nc_max = min_size(nc_max, round_up(n, kernel->nr));
+
+        bool is_parallel = ((m*n*k >= QGEMM_MIN_PARALLEL_MACS) &&
+                            (thread_get_num_workers() > 1));
+        size_t num_workers = is_parallel ? thread_get_num_workers() : 1;
+
+        size_t mc_task = round_up(ceil_div(m, num_workers), kernel->mr);
+        mc_task = min_size(mc_task, QGEMM_MC);
+        size_t num_mc_tasks = min_size(ceil_div(m, mc_task), num_workers);
+        size_t num_nc_splits = ceil_div(num_workers, num_mc_tasks);
+
+        /**
+         * NOTE(brendan): As in `gemm_native`, op(A) is packed one row block
+         * of an mc_task per worker at a time, so that the packing buffer does
+         * not grow with m.
+         */
+        size_t mc_block = num_mc_tasks*mc_task;
+        size_t mc_padded = round_up(min_size(mc_block, m), kernel->mr);
+        size_t a_packed_bytes = round_up(mc_padded*panel_bytes,
+                                         QGEMM_ALIGN_BYTES);
+        size_t b_packed_bytes = round_up(nc_max*panel_bytes,
+                                         QGEMM_ALIGN_BYTES);
+        size_t a_sums_bytes = round_up(mc_padded*sizeof(int32_t),
+                                       QGEMM_ALIGN_BYTES);
+        size_t scratch_bytes = (a_packed_bytes +
+                                b_packed_bytes +
+                                a_sums_bytes +
+                                nc_max*sizeof(int32_t));
+        rot_arena_t scratch_arena;
+        rot_arena_mark_t scratch_mark;
+        uint8_t *scratch = (uint8_t *)gemm_get_scratch(
+                ceil_div(scratch_bytes, sizeof(float)),
+                &scratch_arena,
+                &scratch_mark);
+        if (scratch == NULL) {
+                LOG_ERROR("Failed to allocate quantized GEMM packing "
+                          "buffers.");
+                return false;
+        }
+
+        struct qgemm_block block = {
+                .kernel = kernel,
+                .a = a,
+                .b = b,
+                .c = c,
+                .epilogue = epilogue,
+                .k = k,
+                .num_groups = num_groups,
+                .alpha = alpha,
+                .beta = beta,
+                .a_zero_point = (a->zero_point +
+                                 qgemm_get_shift(a->dtype, true)),
+                .b_zero_point = (b->zero_point +
+                                 qgemm_get_shift(b->dtype, false)),
+                .a_packed = scratch,
+                .a_sums = (int32_t *)(scratch +
+                                      a_packed_bytes +
+                                      b_packed_bytes),
+                .b_packed = scratch + a_packed_bytes,
+                .b_sums = (int32_t *)(scratch +
+                                      a_packed_bytes +
+                                      b_packed_bytes +
+                                      a_sums_bytes),
+                .jc = 0,
+                .nc = 0,
+                .ic = 0,
+                .mc = 0,
+                .mc_task = mc_task,
+                .nc_task = 0,
+                .num_nc_tasks = 0};
+
+        for (size_t jc = 0;
+             jc < n;
+             jc += nc_max) {
+                block.jc = jc;
+                block.nc = min_size(nc_max, n - jc);
+                block.nc_task = round_up(ceil_div(block.nc, num_nc_splits),
+                                         kernel->nr);
+                block.num_nc_tasks = ceil_div(block.nc, block.nc_task);
+
+                qgemm_run_tasks(is_parallel,
+                                ceil_div(ceil_div(block.nc, kernel->nr),
+                                         QGEMM_PACK_PANELS_PER_TASK),
+                                qgemm_pack_b_task,
+                                &block);
+
+                for (size_t ic = 0;
+                     ic < m;
+                     ic += mc_block) {
+                        block.ic = ic;
+                        block.mc = min_size(mc_block, m - ic);
+
+                        qgemm_run_tasks(is_parallel,
+                                        ceil_div(ceil_div(block.mc,
+                                                          kernel->mr),
+                                                 QGEMM_PACK_PANELS_PER_TASK),
+                                        qgemm_pack_a_task,
+                                        &block);
+
+                        qgemm_run_tasks(is_parallel,
+                                        (ceil_div(block.mc, mc_task)*
+                                         block.num_nc_tasks),
+                                        qgemm_compute_task,
+                                        &block);
+                }
+        }
+
+        if (scratch_arena != NULL)
+                ROT_arena_rewind(scratch_arena, scratch_mark);
+
+        return true;
+}
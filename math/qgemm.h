@@ -0,0 +1,102 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MATH_QGEMM_H
+#define MATH_QGEMM_H
+
+#include "rot_math.h"  /* for rot_dtype */
+#include "math/gemm.h" /* for gemm_epilogue */
+#include <stddef.h>    /* for size_t */
+#include <stdint.h>    /* for int32_t */
+
+/**
+ * qgemm.h - Internal interface to the quantized GEMM, which multiplies 8-bit
+ * integer matrices with 32-bit integer accumulators.
+ */
+
+/**
+ * struct qgemm_operand - A quantized matrix operand of `qgemm`.
+ * @dtype: ROT_DTYPE_INT8 or ROT_DTYPE_UINT8.
+ * @data: Elements of the matrix, stored row-major.
+ * @ld: Distance in elements between consecutive rows of `data`.
+ * @is_trans: If true, the operand is transposed, as for `gemm_native`.
+ * @scale: Scale of every element, when `channel_scales` is NULL.
+ * @zero_point: Integer representing zero.
+ * @channel_scales: A scale per row of op(A), or per column of op(B), or NULL.
+ */
+struct qgemm_operand {
+        enum rot_dtype dtype;
+        const void *data;
+        size_t ld;
+        bool is_trans;
+        float scale;
+        int32_t zero_point;
+        const float *channel_scales;
+};
+
+/**
+ * struct qgemm_output - The output matrix of `qgemm`.
+ * @dtype: ROT_DTYPE_FLOAT32 to dequantize the output, or an 8-bit type to
+ * requantize it with `scale` and `zero_point`.
+ * @data: Elements of the matrix, stored row-major.
+ * @ld: Distance in elements between consecutive rows of `data`.
+ */
+struct qgemm_output {
+        enum rot_dtype dtype;
+        void *data;
+        size_t ld;
+        float scale;
+        int32_t zero_point;
+};
+
+/**
+ * NOTE(brendan): 32-bit sums of byte products are exact for depths up to
+ * QGEMM_MAX_K, and may overflow past it.
+ */
+#define QGEMM_MAX_K (1 << 16)
+
+/**
+ * qgemm() - Computes C <- activation(alpha*op(A)*op(B) + beta*C + bias) for
+ * quantized A and B.
+ * @k: Depth of op(A) and op(B), which must be at most QGEMM_MAX_K.
+ * @beta: Must be zero if C is quantized.
+ * @epilogue: Bias and activation, or NULL.
+ *
+ * The integer products are accumulated exactly in 32 bits. Zero points are
+ * subtracted from the sums afterwards, using the row sums of A and column sums
+ * of B, and each output tile is then scaled, offset by the epilogue and
+ * requantized while it is still in cache.
+ *
+ * With AVX-512 VNNI, the microkernel multiplies groups of four bytes with
+ * VPDPBUSD. Otherwise the integers are widened to 16 bits and multiplied in
+ * pairs with VPMADDWD, which unlike VPMADDUBSW cannot saturate.
+ *
+ * Returns false, having left C unwritten, if the packing buffers cannot be
+ * allocated.
+ */
+bool qgemm(size_t m,
+           size_t n,
+           size_t k,
+           float alpha,
+           const struct qgemm_operand *a,
+           const struct qgemm_operand *b,
+           float beta,
+           const struct qgemm_output *c,
+           const struct gemm_epilogue *epilogue);
+
+#endif /* MATH_QGEMM_H */
@@ -18,44 +18,40 @@
  */
 #include "rot_math.h"
 #include "error/log_error.h"  /* for LOG_ERROR, LOG_UNSUPPORTED, LOG_NULL */
-#include "platform/math.h"    /* for matmul_roc */
-
-#include "cblas.h"            /* for cblas_sgemm, CblasNoTrans, ... */
-
-struct rot_cpu_tensor {
-        /**
-         * NOTE(brendan): Use of the flexible array member here is to allow
-         * variable length tensors to be allocated.
-         */
-        float data[];
-};
-
-struct rot_gpu_tensor {
-        void *data;
-};
+#include "math/dtype.h"       /* for dtype_get_size, dtype_to_float, ... */
+#include "math/gemm.h"        /* for gemm_cpu, gemm_resolve_engine */
+#include "math/qgemm.h"       /* for qgemm, QGEMM_MAX_K */
+#include "math/tensor.h"      /* for rot_tensor, tensor_is_overlapping */
+#include "platform/context.h" /* for context_get_current */
+#include "platform/math.h"    /* for gemm_cuda, gemm_roc */
+#include "platform/thread.h"  /* for parallel_for, thread_get_num_workers */
+#include <math.h>             /* for fabsf, fminf, fmaxf, nearbyintf */
+#include <stdlib.h>           /* for malloc, free */
+#include <string.h>           /* for memcpy */
 
 /**
- * rot_tensor: Container for tensor data.
- *
- * NOTE(brendan): tensors are represented by contiguous memory. Viewing a
- * tensor's data starting from offset 0 and increasing, dims[0] represents the
- * slowest changing dimension, and dims[num_dims - 1] is the quickest changing
- * dimension.
- *
- * E.g. for a matrix, dims[0] would be the dimension of the rows, and dims[1]
- * would be the dimension for the columns.
- *
- * TODO(brendan): Supported dimensions? Different types?
+ * set_packed_strides() - Sets row-major strides for `tensor`, with rows of the
+ * last dimension `ld` elements apart.
  */
-struct rot_tensor {
-        enum rot_backend backend;
-        size_t *dims;
-        uint32_t num_dims;
-        union {
-                struct rot_cpu_tensor cpu;
-                struct rot_gpu_tensor gpu;
-        };
-};
+static void
+set_packed_strides(struct rot_tensor *tensor, size_t ld)
+{
+        if (tensor->num_dims == 0)
+                return;
+
+        uint32_t last = tensor->num_dims - 1;
+        tensor->strides[last] = 1;
+        if (last == 0)
+                return;
+
+        tensor->strides[last - 1] = ld;
+        for (uint32_t dim = last - 1;
+             dim > 0;
+             --dim) {
+                tensor->strides[dim - 1] = (tensor->strides[dim]*
+                                            tensor->dims[dim]);
+        }
+}
 
 static void
 set_dims_unchecked(struct rot_tensor *tensor,
@@ -69,6 +65,8 @@ set_dims_unchecked(struct rot_tensor *tensor,
         }
 
         tensor->num_dims = num_dims;
+        if (num_dims > 0)
+                set_packed_strides(tensor, dims[num_dims - 1]);
 }
 
 rot_tensor_t ROT_set_dims(struct rot_tensor *tensor,
@@ -79,12 +77,46 @@ rot_tensor_t ROT_set_dims(struct rot_tensor *tensor,
                 return NULL;
 
         set_dims_unchecked(tensor, num_dims, dims);
+
+        return tensor;
 }
 
-rot_tensor_t ROT_create_tensor(rot_arena_t arena,
-                               uint32_t num_dims,
-                               const size_t *dims,
-                               enum rot_backend backend)
+/**
+ * tensor_padded_ld() - Returns the leading dimension for rows of `row_elems`
+ * elements of `elem_bytes` each, padded as described for
+ * ROT_create_tensor_aligned.
+ */
+static size_t
+tensor_padded_ld(size_t row_elems, size_t align_bytes, size_t elem_bytes)
+{
+        size_t align_elems = align_bytes/elem_bytes;
+        size_t ld = ((row_elems + align_elems - 1)/align_elems)*align_elems;
+        /**
+         * NOTE(brendan): Addresses 4 KB apart map to the same L1 set, and
+         * loads are falsely flagged as aliasing earlier stores to them.
+         */
+        if ((ld*elem_bytes) % 4096 == 0)
+                ld += align_elems;
+
+        return ld;
+}
+
+/**
+ * tensor_create() - Allocates a tensor's metadata from `arena`, plus its data
+ * if `is_data_allocated` is true.
+ * @ld: Leading dimension of the tensor's rows, which must be at least the last
+ * dimension.
+ * @align_bytes: Alignment of the start of the data.
+ */
+static struct rot_tensor *
+tensor_create(rot_arena_t arena,
+              uint32_t num_dims,
+              const size_t *dims,
+              enum rot_backend backend,
+              enum rot_dtype dtype,
+              size_t ld,
+              size_t align_bytes,
+              bool is_data_allocated)
 {
         if ((dims == NULL) || (arena == NULL)) {
                 LOG_NULL();
@@ -104,118 +136,1513 @@ rot_tensor_t ROT_create_tensor(rot_arena_t arena,
                 return NULL;
         }
 
-        size_t required_bytes = sizeof(struct rot_tensor);
+        if (dtype_get_size(dtype) == 0) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        /* TODO(brendan): 16-bit storage for cuBLAS/rocBLAS. */
+        if ((dtype != ROT_DTYPE_FLOAT32) && (backend != ROT_BACKEND_CPU)) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
         /**
-         * NOTE(brendan): Storage for the dimensions' respective sizes must
-         * also be allocated. These dimension sizes are placed _after_ all the
-         * space for the data.
+         * NOTE(brendan): Storage for the dimensions' respective sizes and
+         * strides must also be allocated. These are placed directly after
+         * the tensor struct, and CPU data follows them, starting at the next
+         * multiple of `align_bytes`.
          *
-         * So, the memory layout of a tensor is:
-         * | backend | *dims | num_dims | data | dims |
-         * where *dims is a pointer to dims.
+         * So, the memory layout of a CPU tensor is:
+         * | backend | *dims | *strides | num_dims | *data | dims | strides |
+         * padding | data |
+         * where *dims, *strides and *data are pointers to dims, strides and
+         * data.
          */
-        size_t dim_sizes_bytes = sizeof(size_t)*num_dims;
-        required_bytes += dim_sizes_bytes;
+        size_t dim_sizes_bytes = 2*sizeof(size_t)*num_dims;
+        struct rot_tensor *result =
+                (struct rot_tensor *)ROT_arena_malloc_aligned(
+                        arena,
+                        sizeof(struct rot_tensor) + dim_sizes_bytes,
+                        sizeof(size_t),
+                        ROT_BACKEND_CPU);
+        if (result == NULL)
+                return NULL;
 
-        size_t data_bytes = dims[0]*sizeof(float);
-        for (uint32_t dim = 1;
-             dim < num_dims;
+        result->backend = backend;
+        result->dtype = dtype;
+        result->dims = (size_t *)(result + 1);
+        result->strides = result->dims + num_dims;
+        result->quant.scale = 1.0f;
+        result->quant.zero_point = 0;
+        result->quant.channel_scales = NULL;
+        result->quant.channel_dim = 0;
+
+        ROT_set_dims(result, num_dims, dims);
+        set_packed_strides(result, ld);
+
+        if (!is_data_allocated) {
+                result->cpu.data = NULL;
+                return result;
+        }
+
+        size_t data_bytes =
+                result->dims[0]*result->strides[0]*dtype_get_size(dtype);
+        void *data = ROT_arena_malloc_aligned(arena,
+                                              data_bytes,
+                                              align_bytes,
+                                              backend);
+        if (data == NULL)
+                return NULL;
+
+        if (backend == ROT_BACKEND_CPU)
+                result->cpu.data = (float *)data;
+        else
+                result->gpu.data = data;
+
+        return result;
+}
+
+struct rot_tensor *
+tensor_create_unallocated(rot_arena_t arena,
+                          uint32_t num_dims,
+                          const size_t *dims)
+{
+        if ((dims == NULL) || (num_dims == 0)) {
+                LOG_ERROR("Tensors must have a non-zero number of "
+                          "dimensions.");
+                return NULL;
+        }
+
+        return tensor_create(arena,
+                             num_dims,
+                             dims,
+                             ROT_BACKEND_CPU,
+                             ROT_DTYPE_FLOAT32,
+                             dims[num_dims - 1],
+                             TENSOR_DEFAULT_ALIGN_BYTES,
+                             false);
+}
+
+rot_tensor_t ROT_create_tensor(rot_arena_t arena,
+                               uint32_t num_dims,
+                               const size_t *dims,
+                               enum rot_backend backend)
+{
+        return ROT_create_tensor_aligned(arena,
+                                         num_dims,
+                                         dims,
+                                         backend,
+                                         TENSOR_DEFAULT_ALIGN_BYTES,
+                                         false);
+}
+
+/**
+ * tensor_create_aligned() - Implements ROT_create_tensor_aligned for tensors
+ * storing elements of type `dtype`.
+ */
+static struct rot_tensor *
+tensor_create_aligned(rot_arena_t arena,
+                      uint32_t num_dims,
+                      const size_t *dims,
+                      enum rot_backend backend,
+                      enum rot_dtype dtype,
+                      size_t align_bytes,
+                      bool is_ld_padded)
+{
+        if (dims == NULL) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (num_dims == 0) {
+                LOG_ERROR("Tensors must have a non-zero number of "
+                          "dimensions.");
+                return NULL;
+        }
+
+        if ((align_bytes < sizeof(float)) ||
+            ((align_bytes & (align_bytes - 1)) != 0)) {
+                LOG_ERROR("Tensor alignment must be a power of two of at "
+                          "least sizeof(float).");
+                return NULL;
+        }
+
+        size_t ld = dims[num_dims - 1];
+        if (is_ld_padded) {
+                /* TODO(brendan): Padded GPU tensors for cuBLAS/rocBLAS. */
+                if (backend != ROT_BACKEND_CPU) {
+                        LOG_UNSUPPORTED();
+                        return NULL;
+                }
+
+                ld = tensor_padded_ld(ld,
+                                      align_bytes,
+                                      dtype_get_size(dtype));
+        }
+
+        return tensor_create(arena,
+                             num_dims,
+                             dims,
+                             backend,
+                             dtype,
+                             ld,
+                             align_bytes,
+                             true);
+}
+
+rot_tensor_t ROT_create_tensor_aligned(rot_arena_t arena,
+                                       uint32_t num_dims,
+                                       const size_t *dims,
+                                       enum rot_backend backend,
+                                       size_t align_bytes,
+                                       bool is_ld_padded)
+{
+        return tensor_create_aligned(arena,
+                                     num_dims,
+                                     dims,
+                                     backend,
+                                     ROT_DTYPE_FLOAT32,
+                                     align_bytes,
+                                     is_ld_padded);
+}
+
+rot_tensor_t ROT_create_tensor_dtype(rot_arena_t arena,
+                                     uint32_t num_dims,
+                                     const size_t *dims,
+                                     enum rot_backend backend,
+                                     enum rot_dtype dtype)
+{
+        return tensor_create_aligned(arena,
+                                     num_dims,
+                                     dims,
+                                     backend,
+                                     dtype,
+                                     TENSOR_DEFAULT_ALIGN_BYTES,
+                                     false);
+}
+
+/**
+ * NOTE(brendan): Conversions that neither start nor end in single precision
+ * go through a buffer of this many floats on the stack.
+ */
+#define CONVERT_CHUNK_ELEMS 512
+
+/**
+ * struct convert_run - A run of consecutive elements of one side of a
+ * conversion.
+ * @elems: First element of the run.
+ * @scales: Scales of the run's elements, if quantized.
+ * @scale_stride: 0 if the run's elements share `*scales`, or 1 if each has
+ * its own.
+ */
+struct convert_run {
+        enum rot_dtype dtype;
+        void *elems;
+        const float *scales;
+        size_t scale_stride;
+        int32_t zero_point;
+};
+
+/**
+ * convert_get_run() - Describes the run of `tensor` starting at element `col`
+ * of row `row` of its last dimension.
+ */
+static struct convert_run
+convert_get_run(const struct rot_tensor *tensor, size_t row, size_t col)
+{
+        const struct tensor_quant *quant = &tensor->quant;
+        struct convert_run run = {
+                .dtype = tensor->dtype,
+                .elems = tensor_get_cpu_elem(
+                        tensor,
+                        tensor_get_row_offset(tensor, row) + col),
+                .scales = &quant->scale,
+                .scale_stride = 0,
+                .zero_point = quant->zero_point};
+        if (quant->channel_scales == NULL)
+                return run;
+
+        const uint32_t last = tensor->num_dims - 1;
+        if (quant->channel_dim == last) {
+                run.scales = quant->channel_scales + col;
+                run.scale_stride = 1;
+                return run;
+        }
+
+        size_t inner_rows = 1;
+        for (uint32_t dim = quant->channel_dim + 1;
+             dim < last;
              ++dim) {
-                data_bytes *= dims[dim];
+                inner_rows *= tensor->dims[dim];
         }
+        size_t channel = (row/inner_rows) % tensor->dims[quant->channel_dim];
+        run.scales = quant->channel_scales + channel;
+
+        return run;
+}
+
+/**
+ * convert_widen() - Converts `num_elems` elements of `run`, starting `i`
+ * elements into it, to floats in `dst`.
+ */
+static void
+convert_widen(const struct convert_run *run,
+              size_t i,
+              float *dst,
+              size_t num_elems)
+{
+        const char *src = ((const char *)run->elems +
+                           i*dtype_get_size(run->dtype));
+        if (dtype_is_quantized(run->dtype)) {
+                dtype_dequantize(run->dtype,
+                                 src,
+                                 dst,
+                                 num_elems,
+                                 run->scales + i*run->scale_stride,
+                                 run->scale_stride,
+                                 run->zero_point);
+                return;
+        }
+
+        dtype_to_float(run->dtype, src, dst, num_elems);
+}
+
+/**
+ * convert_narrow() - Converts `num_elems` floats from `src` to elements of
+ * `run`, starting `i` elements into it.
+ */
+static void
+convert_narrow(const struct convert_run *run,
+               size_t i,
+               const float *src,
+               size_t num_elems)
+{
+        char *dst = (char *)run->elems + i*dtype_get_size(run->dtype);
+        if (dtype_is_quantized(run->dtype)) {
+                dtype_quantize(run->dtype,
+                               src,
+                               dst,
+                               num_elems,
+                               run->scales + i*run->scale_stride,
+                               run->scale_stride,
+                               run->zero_point);
+                return;
+        }
+
+        dtype_from_float(run->dtype, src, dst, num_elems);
+}
+
+/**
+ * convert_copy() - Converts `num_elems` elements of the run `src` to the
+ * elements of the run `dst`.
+ */
+static void
+convert_copy(const struct convert_run *dst,
+             const struct convert_run *src,
+             size_t num_elems)
+{
+        if ((src->dtype == dst->dtype) && !dtype_is_quantized(src->dtype)) {
+                memcpy(dst->elems,
+                       src->elems,
+                       num_elems*dtype_get_size(src->dtype));
+                return;
+        }
+
+        if (src->dtype == ROT_DTYPE_FLOAT32) {
+                convert_narrow(dst, 0, (const float *)src->elems, num_elems);
+                return;
+        }
+
+        if (dst->dtype == ROT_DTYPE_FLOAT32) {
+                convert_widen(src, 0, (float *)dst->elems, num_elems);
+                return;
+        }
+
+        /* NOTE(brendan): Widening is exact, so this rounds only once. */
+        float chunk[CONVERT_CHUNK_ELEMS];
+        for (size_t i = 0;
+             i < num_elems;
+             i += CONVERT_CHUNK_ELEMS) {
+                size_t chunk_elems = num_elems - i;
+                if (chunk_elems > CONVERT_CHUNK_ELEMS)
+                        chunk_elems = CONVERT_CHUNK_ELEMS;
+
+                convert_widen(src, i, chunk, chunk_elems);
+                convert_narrow(dst, i, chunk, chunk_elems);
+        }
+}
+
+rot_tensor_t ROT_tensor_convert(rot_tensor_t result, const rot_tensor_t tensor)
+{
+        if ((result == NULL) || (tensor == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if ((result->backend != ROT_BACKEND_CPU) ||
+            (tensor->backend != ROT_BACKEND_CPU)) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        if (result == tensor)
+                return result;
 
         /**
-         * NOTE(brendan): In the case of CPU tensors, data is stored in memory
-         * directly contiguous with the tensor struct's metadata, and it can be
-         * checked here that there is enough memory to allocate struct + data.
+         * NOTE(brendan): Per-channel scales can change from row to row, so
+         * tensors with them are converted row by row.
          */
-        if (backend == ROT_BACKEND_CPU)
-                required_bytes += data_bytes;
+        size_t num_elems = tensor_get_num_elems(tensor);
+        if (tensor_is_contiguous(result) &&
+            tensor_is_contiguous(tensor) &&
+            (result->quant.channel_scales == NULL) &&
+            (tensor->quant.channel_scales == NULL)) {
+                if (tensor_get_num_elems(result) != num_elems) {
+                        LOG_ERROR("Converted tensors must have the same "
+                                  "number of elements.");
+                        return NULL;
+                }
 
-        struct rot_tensor *result =
-                (struct rot_tensor *)ROT_arena_malloc(arena,
-                                                      required_bytes,
-                                                      ROT_BACKEND_CPU);
+                struct convert_run dst = convert_get_run(result, 0, 0);
+                struct convert_run src = convert_get_run(tensor, 0, 0);
+                convert_copy(&dst, &src, num_elems);
+                return result;
+        }
+
+        bool is_dims_same = (result->num_dims == tensor->num_dims);
+        for (uint32_t dim = 0;
+             is_dims_same && (dim < tensor->num_dims);
+             ++dim) {
+                is_dims_same = (result->dims[dim] == tensor->dims[dim]);
+        }
+        if (!is_dims_same ||
+            !tensor_has_contiguous_rows(result) ||
+            !tensor_has_contiguous_rows(tensor)) {
+                LOG_ERROR("Converted views, or quantized tensors with "
+                          "per-channel scales, must have the same dimensions "
+                          "and contiguous rows.");
+                return NULL;
+        }
+
+        if (num_elems == 0)
+                return result;
+
+        const size_t row_elems = tensor->dims[tensor->num_dims - 1];
+        const size_t num_rows = num_elems/row_elems;
+        for (size_t row = 0;
+             row < num_rows;
+             ++row) {
+                struct convert_run dst = convert_get_run(result, row, 0);
+                struct convert_run src = convert_get_run(tensor, row, 0);
+                convert_copy(&dst, &src, row_elems);
+        }
+
+        return result;
+}
+
+rot_tensor_t ROT_tensor_set_quantization(rot_tensor_t tensor,
+                                         float scale,
+                                         int32_t zero_point)
+{
+        if (tensor == NULL) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (!dtype_is_quantized(tensor->dtype)) {
+                LOG_ERROR("Only 8-bit tensors are quantized.");
+                return NULL;
+        }
+
+        int32_t lo = (tensor->dtype == ROT_DTYPE_INT8) ? -128 : 0;
+        int32_t hi = (tensor->dtype == ROT_DTYPE_INT8) ? 127 : 255;
+        if (!(scale > 0.0f) ||
+            !isfinite(scale) ||
+            (zero_point < lo) ||
+            (zero_point > hi)) {
+                LOG_ERROR("Quantization needs a positive scale, and a zero "
+                          "point in the range of the type.");
+                return NULL;
+        }
+
+        tensor->quant.scale = scale;
+        tensor->quant.zero_point = zero_point;
+        tensor->quant.channel_scales = NULL;
+        tensor->quant.channel_dim = 0;
+
+        return tensor;
+}
+
+/**
+ * quant_check_float_rows() - Is `tensor` a float32 CPU tensor with contiguous
+ * rows, as the calibration helpers read?
+ */
+static bool
+quant_check_float_rows(const struct rot_tensor *tensor)
+{
+        if ((tensor->dtype != ROT_DTYPE_FLOAT32) ||
+            (tensor->backend != ROT_BACKEND_CPU) ||
+            !tensor_has_contiguous_rows(tensor)) {
+                LOG_ERROR("Quantization is calibrated from float32 CPU "
+                          "tensors with contiguous rows.");
+                return false;
+        }
+
+        return true;
+}
+
+rot_tensor_t ROT_calibrate_quantization(rot_tensor_t result,
+                                        const rot_tensor_t tensor)
+{
+        if ((result == NULL) || (tensor == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (!quant_check_float_rows(tensor))
+                return NULL;
+
+        float lo = 0.0f;
+        float hi = 0.0f;
+        size_t num_elems = tensor_get_num_elems(tensor);
+        const size_t row_elems = tensor->dims[tensor->num_dims - 1];
+        for (size_t row = 0;
+             (row_elems > 0) && (row < num_elems/row_elems);
+             ++row) {
+                const float *data = (tensor->cpu.data +
+                                     tensor_get_row_offset(tensor, row));
+                for (size_t col = 0;
+                     col < row_elems;
+                     ++col) {
+                        lo = fminf(lo, data[col]);
+                        hi = fmaxf(hi, data[col]);
+                }
+        }
+
+        float scale;
+        int32_t zero_point = 0;
+        if (result->dtype == ROT_DTYPE_INT8) {
+                scale = fmaxf(-lo, hi)/127.0f;
+        } else {
+                scale = (hi - lo)/255.0f;
+                if (scale > 0.0f)
+                        zero_point = (int32_t)nearbyintf(-lo/scale);
+        }
+
+        if (scale == 0.0f)
+                scale = 1.0f;
+
+        return ROT_tensor_set_quantization(result, scale, zero_point);
+}
+
+rot_tensor_t ROT_quantize_weights(rot_arena_t arena,
+                                  const rot_tensor_t weights)
+{
+        if ((arena == NULL) || (weights == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if ((weights->num_dims != 2) || !quant_check_float_rows(weights)) {
+                LOG_ERROR("Weights to quantize must be a matrix.");
+                return NULL;
+        }
+
+        struct rot_tensor *result = tensor_create_aligned(
+                arena,
+                2,
+                weights->dims,
+                ROT_BACKEND_CPU,
+                ROT_DTYPE_INT8,
+                TENSOR_DEFAULT_ALIGN_BYTES,
+                false);
         if (result == NULL)
                 return NULL;
 
-        result->backend = backend;
-        result->dims = (size_t *)((char *)result +
-                                  (required_bytes - dim_sizes_bytes));
+        const size_t rows = weights->dims[0];
+        const size_t cols = weights->dims[1];
+        float *scales = (float *)ROT_arena_malloc(arena,
+                                                  rows*sizeof(float),
+                                                  ROT_BACKEND_CPU);
+        if (scales == NULL)
+                return NULL;
 
-        ROT_set_dims(result, num_dims, dims);
+        for (size_t row = 0;
+             row < rows;
+             ++row) {
+                const float *data = (weights->cpu.data +
+                                     tensor_get_row_offset(weights, row));
+                float max_abs = 0.0f;
+                for (size_t col = 0;
+                     col < cols;
+                     ++col) {
+                        max_abs = fmaxf(max_abs, fabsf(data[col]));
+                }
+
+                scales[row] = (max_abs > 0.0f) ? (max_abs/127.0f) : 1.0f;
+        }
 
-        if ((backend == ROT_BACKEND_ROC) || (backend == ROT_BACKEND_CUDA)) {
-                result->gpu.data = ROT_arena_malloc(arena,
-                                                    data_bytes,
-                                                    backend);
-                if (result->gpu.data == NULL)
+        result->quant.channel_scales = scales;
+        result->quant.channel_dim = 0;
+
+        return ROT_tensor_convert(result, weights);
+}
+
+/**
+ * tensor_qgemm() - The part of tensor_gemm_cpu for quantized `a` and `b`,
+ * after transposes have been resolved.
+ * @a_row_dim: Dimension of `a` indexing the rows of op(a).
+ * @b_col_dim: Dimension of `b` indexing the columns of op(b).
+ */
+static bool
+tensor_qgemm(bool trans_a,
+             bool trans_b,
+             size_t m,
+             size_t n,
+             size_t k,
+             float alpha,
+             const struct rot_tensor *a,
+             size_t lda,
+             uint32_t a_row_dim,
+             const struct rot_tensor *b,
+             size_t ldb,
+             uint32_t b_col_dim,
+             float beta,
+             struct rot_tensor *c,
+             size_t ldc,
+             const struct gemm_epilogue *epilogue)
+{
+        bool is_c_valid = (dtype_is_quantized(c->dtype) ?
+                           ((c->quant.channel_scales == NULL) &&
+                            (beta == 0.0f)) :
+                           (c->dtype == ROT_DTYPE_FLOAT32));
+        if (!dtype_is_quantized(a->dtype) ||
+            !dtype_is_quantized(b->dtype) ||
+            ((a->quant.channel_scales != NULL) &&
+             (a->quant.channel_dim != a_row_dim)) ||
+            ((b->quant.channel_scales != NULL) &&
+             (b->quant.channel_dim != b_col_dim)) ||
+            !is_c_valid)
+                return false;
+
+        if (k > QGEMM_MAX_K) {
+                LOG_ERROR("Quantized matmul depth is too large to accumulate "
+                          "exactly in 32 bits.");
+                return false;
+        }
+
+        struct qgemm_operand qa = {
+                .dtype = a->dtype,
+                .data = a->cpu.data_8,
+                .ld = lda,
+                .is_trans = trans_a,
+                .scale = a->quant.scale,
+                .zero_point = a->quant.zero_point,
+                .channel_scales = a->quant.channel_scales};
+        struct qgemm_operand qb = {
+                .dtype = b->dtype,
+                .data = b->cpu.data_8,
+                .ld = ldb,
+                .is_trans = trans_b,
+                .scale = b->quant.scale,
+                .zero_point = b->quant.zero_point,
+                .channel_scales = b->quant.channel_scales};
+        struct qgemm_output qc = {
+                .dtype = c->dtype,
+                .data = tensor_get_cpu_elem(c, 0),
+                .ld = ldc,
+                .scale = c->quant.scale,
+                .zero_point = c->quant.zero_point};
+        return qgemm(m, n, k, alpha, &qa, &qb, beta, &qc, epilogue);
+}
+
+/**
+ * gemm_cpu_16bit_c() - Computes the product described by the arguments of
+ * `gemm_native_dtype` into the 16-bit matrix `c`, by accumulating in a single
+ * precision copy that is rounded once at the end.
+ */
+static bool
+gemm_cpu_16bit_c(bool trans_a,
+                 bool trans_b,
+                 size_t m,
+                 size_t n,
+                 size_t k,
+                 float alpha,
+                 enum rot_dtype a_dtype,
+                 const void *a,
+                 size_t lda,
+                 enum rot_dtype b_dtype,
+                 const void *b,
+                 size_t ldb,
+                 float beta,
+                 enum rot_dtype c_dtype,
+                 uint16_t *c,
+                 size_t ldc,
+                 const struct gemm_epilogue *epilogue)
+{
+        /**
+         * NOTE(brendan): The copy comes from the scratch arena if it has
+         * room, and is taken before the GEMM marks the arena for its own
+         * packing buffers.
+         */
+        size_t bytes = m*n*sizeof(float);
+        rot_arena_t arena = context_get_scratch(context_get_current());
+        rot_arena_mark_t mark;
+        float *c_f32 = NULL;
+        if ((arena != NULL) &&
+            ROT_arena_can_alloc(arena,
+                                bytes + TENSOR_DEFAULT_ALIGN_BYTES,
+                                ROT_BACKEND_CPU)) {
+                mark = ROT_arena_mark(arena);
+                c_f32 = (float *)ROT_arena_malloc_aligned(
+                        arena,
+                        bytes,
+                        TENSOR_DEFAULT_ALIGN_BYTES,
+                        ROT_BACKEND_CPU);
+        }
+        if (c_f32 == NULL) {
+                arena = NULL;
+                c_f32 = (float *)malloc(bytes);
+                if (c_f32 == NULL) {
+                        LOG_ERROR("Out of memory.");
+                        return false;
+                }
+        }
+
+        if (beta != 0.0f) {
+                for (size_t i = 0;
+                     i < m;
+                     ++i) {
+                        dtype_to_float(c_dtype, c + i*ldc, c_f32 + i*n, n);
+                }
+        }
+
+        const bool is_done = gemm_native_dtype(trans_a,
+                                               trans_b,
+                                               m,
+                                               n,
+                                               k,
+                                               alpha,
+                                               a_dtype,
+                                               a,
+                                               lda,
+                                               b_dtype,
+                                               b,
+                                               ldb,
+                                               beta,
+                                               c_f32,
+                                               n,
+                                               epilogue);
+        if (is_done) {
+                for (size_t i = 0;
+                     i < m;
+                     ++i) {
+                        dtype_from_float(c_dtype, c_f32 + i*n, c + i*ldc, n);
+                }
+        }
+
+        if (arena != NULL)
+                ROT_arena_rewind(arena, mark);
+        else
+                free(c_f32);
+
+        return is_done;
+}
+
+bool tensor_gemm_cpu(enum rot_matmul_engine engine,
+                     bool trans_a,
+                     bool trans_b,
+                     float alpha,
+                     const struct rot_tensor *a,
+                     const struct rot_tensor *b,
+                     float beta,
+                     struct rot_tensor *c,
+                     const struct gemm_epilogue *epilogue)
+{
+        bool is_a_trans;
+        bool is_b_trans;
+        bool is_c_trans;
+        size_t lda;
+        size_t ldb;
+        size_t ldc;
+        if (!tensor_get_matrix(a, 0, &is_a_trans, &lda) ||
+            !tensor_get_matrix(b, 0, &is_b_trans, &ldb) ||
+            !tensor_get_matrix(c, 0, &is_c_trans, &ldc))
+                return false;
+
+        size_t m = c->dims[0];
+        size_t n = c->dims[1];
+        const size_t k = trans_a ? a->dims[0] : a->dims[1];
+        if ((trans_a ? (a->dims[1] != m) : (a->dims[0] != m)) ||
+            (trans_b ? (b->dims[0] != n) : (b->dims[1] != n)) ||
+            (trans_b ? (b->dims[1] != k) : (b->dims[0] != k)))
+                return false;
+
+        /**
+         * NOTE(brendan): Dimensions of `a` and `b` indexing the rows of op(a)
+         * and the columns of op(b), which per-channel scales must be along.
+         */
+        uint32_t a_row_dim = trans_a ? 1 : 0;
+        uint32_t b_col_dim = trans_b ? 0 : 1;
+
+        /**
+         * NOTE(brendan): A column-major view is the row-major transpose of
+         * its storage, so it flips whether the GEMM has to transpose it.
+         */
+        trans_a = (trans_a != is_a_trans);
+        trans_b = (trans_b != is_b_trans);
+
+        struct gemm_epilogue transposed_epilogue;
+        if (is_c_trans) {
+                const struct rot_tensor *tmp_tensor = a;
+                a = b;
+                b = tmp_tensor;
+
+                bool tmp_trans = trans_a;
+                trans_a = !trans_b;
+                trans_b = !tmp_trans;
+
+                size_t tmp = lda;
+                lda = ldb;
+                ldb = tmp;
+
+                tmp = m;
+                m = n;
+                n = tmp;
+
+                uint32_t tmp_dim = a_row_dim;
+                a_row_dim = b_col_dim;
+                b_col_dim = tmp_dim;
+
+                if (epilogue != NULL) {
+                        transposed_epilogue.row_bias = epilogue->col_bias;
+                        transposed_epilogue.col_bias = epilogue->row_bias;
+                        transposed_epilogue.activation = epilogue->activation;
+                        epilogue = &transposed_epilogue;
+                }
+        }
+
+        if (dtype_is_quantized(a->dtype) || dtype_is_quantized(b->dtype)) {
+                return tensor_qgemm(trans_a,
+                                    trans_b,
+                                    m,
+                                    n,
+                                    k,
+                                    alpha,
+                                    a,
+                                    lda,
+                                    a_row_dim,
+                                    b,
+                                    ldb,
+                                    b_col_dim,
+                                    beta,
+                                    c,
+                                    ldc,
+                                    epilogue);
+        }
+
+        if (dtype_is_quantized(c->dtype))
+                return false;
+
+        if ((a->dtype == ROT_DTYPE_FLOAT32) &&
+            (b->dtype == ROT_DTYPE_FLOAT32) &&
+            (c->dtype == ROT_DTYPE_FLOAT32)) {
+                return gemm_cpu(engine,
+                                trans_a,
+                                trans_b,
+                                m,
+                                n,
+                                k,
+                                alpha,
+                                a->cpu.data,
+                                lda,
+                                b->cpu.data,
+                                ldb,
+                                beta,
+                                c->cpu.data,
+                                ldc,
+                                epilogue);
+        }
+
+        /**
+         * TODO(brendan): OpenBLAS has sbgemm for bfloat16 operands, but no
+         * mixed precision, so 16-bit operands always use the native engine.
+         */
+        if (c->dtype != ROT_DTYPE_FLOAT32) {
+                return gemm_cpu_16bit_c(trans_a,
+                                        trans_b,
+                                        m,
+                                        n,
+                                        k,
+                                        alpha,
+                                        a->dtype,
+                                        tensor_get_cpu_elem(a, 0),
+                                        lda,
+                                        b->dtype,
+                                        tensor_get_cpu_elem(b, 0),
+                                        ldb,
+                                        beta,
+                                        c->dtype,
+                                        c->cpu.data_16,
+                                        ldc,
+                                        epilogue);
+        }
+
+        return gemm_native_dtype(trans_a,
+                                 trans_b,
+                                 m,
+                                 n,
+                                 k,
+                                 alpha,
+                                 a->dtype,
+                                 tensor_get_cpu_elem(a, 0),
+                                 lda,
+                                 b->dtype,
+                                 tensor_get_cpu_elem(b, 0),
+                                 ldb,
+                                 beta,
+                                 c->cpu.data,
+                                 ldc,
+                                 epilogue);
+}
+
+/**
+ * tensor_view() - Allocates from `arena` the metadata of a view sharing
+ * `tensor`'s data, starting `offset` elements into it, with the same dimensions
+ * and strides as `tensor` for the caller to modify.
+ */
+static struct rot_tensor *
+tensor_view(rot_arena_t arena,
+            const struct rot_tensor *tensor,
+            uint32_t num_dims,
+            size_t offset)
+{
+        struct rot_tensor *view = tensor_create(arena,
+                                                num_dims,
+                                                tensor->dims,
+                                                tensor->backend,
+                                                tensor->dtype,
+                                                tensor->dims[num_dims - 1],
+                                                1,
+                                                false);
+        if (view == NULL)
+                return NULL;
+
+        for (uint32_t dim = 0;
+             dim < num_dims;
+             ++dim) {
+                view->strides[dim] = tensor->strides[dim];
+        }
+
+        view->quant = tensor->quant;
+
+        size_t offset_bytes = offset*dtype_get_size(tensor->dtype);
+        if (tensor->backend == ROT_BACKEND_CPU) {
+                char *data = (char *)tensor->cpu.data;
+                view->cpu.data = (float *)(data + offset_bytes);
+        } else {
+                char *gpu_data = (char *)tensor->gpu.data;
+                view->gpu.data = gpu_data + offset_bytes;
+        }
+
+        return view;
+}
+
+rot_tensor_t ROT_tensor_view_slice(rot_arena_t arena,
+                                   const rot_tensor_t tensor,
+                                   uint32_t dim,
+                                   size_t start,
+                                   size_t end)
+{
+        if ((arena == NULL) || (tensor == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if ((dim >= tensor->num_dims) ||
+            (start >= end) ||
+            (end > tensor->dims[dim])) {
+                LOG_ERROR("Slice is out of the tensor's bounds.");
+                return NULL;
+        }
+
+        struct rot_tensor *view = tensor_view(arena,
+                                              tensor,
+                                              tensor->num_dims,
+                                              start*tensor->strides[dim]);
+        if (view == NULL)
+                return NULL;
+
+        view->dims[dim] = end - start;
+        if ((view->quant.channel_scales != NULL) &&
+            (view->quant.channel_dim == dim))
+                view->quant.channel_scales += start;
+
+        return view;
+}
+
+rot_tensor_t ROT_tensor_view_transpose(rot_arena_t arena,
+                                       const rot_tensor_t tensor,
+                                       uint32_t dim0,
+                                       uint32_t dim1)
+{
+        if ((arena == NULL) || (tensor == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if ((dim0 >= tensor->num_dims) || (dim1 >= tensor->num_dims)) {
+                LOG_ERROR("Transposed dimensions out of range.");
+                return NULL;
+        }
+
+        struct rot_tensor *view = tensor_view(arena,
+                                              tensor,
+                                              tensor->num_dims,
+                                              0);
+        if (view == NULL)
+                return NULL;
+
+        view->dims[dim0] = tensor->dims[dim1];
+        view->dims[dim1] = tensor->dims[dim0];
+        view->strides[dim0] = tensor->strides[dim1];
+        view->strides[dim1] = tensor->strides[dim0];
+        if (tensor->quant.channel_dim == dim0)
+                view->quant.channel_dim = dim1;
+        else if (tensor->quant.channel_dim == dim1)
+                view->quant.channel_dim = dim0;
+
+        return view;
+}
+
+rot_tensor_t ROT_tensor_view_permute(rot_arena_t arena,
+                                     const rot_tensor_t tensor,
+                                     const uint32_t *perm)
+{
+        if ((arena == NULL) || (tensor == NULL) || (perm == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        for (uint32_t dim = 0;
+             dim < tensor->num_dims;
+             ++dim) {
+                bool is_repeated = false;
+                for (uint32_t prev = 0;
+                     prev < dim;
+                     ++prev) {
+                        if (perm[prev] == perm[dim])
+                                is_repeated = true;
+                }
+
+                if ((perm[dim] >= tensor->num_dims) || is_repeated) {
+                        LOG_ERROR("Invalid permutation of dimensions.");
                         return NULL;
+                }
         }
 
-        return result;
+        struct rot_tensor *view = tensor_view(arena,
+                                              tensor,
+                                              tensor->num_dims,
+                                              0);
+        if (view == NULL)
+                return NULL;
+
+        for (uint32_t dim = 0;
+             dim < tensor->num_dims;
+             ++dim) {
+                view->dims[dim] = tensor->dims[perm[dim]];
+                view->strides[dim] = tensor->strides[perm[dim]];
+                if (perm[dim] == tensor->quant.channel_dim)
+                        view->quant.channel_dim = dim;
+        }
+
+        return view;
+}
+
+/**
+ * reshape_strides() - Computes strides for viewing `tensor` with dimensions
+ * `dims`, without moving any data.
+ *
+ * Old and new dimensions are matched up into groups with equal products, as
+ * in NumPy. Each group of old dimensions must be contiguous with respect to
+ * each other, and the new dimensions of the group then subdivide the group's
+ * innermost stride. Dimensions of size 1 can go anywhere.
+ *
+ * Returns false if the view would need a copy.
+ */
+static bool
+reshape_strides(const struct rot_tensor *tensor,
+                uint32_t num_dims,
+                const size_t *dims,
+                size_t *strides)
+{
+        for (uint32_t dim = 0;
+             dim < num_dims;
+             ++dim) {
+                strides[dim] = 1;
+        }
+
+        uint32_t old_i = 0;
+        uint32_t new_i = 0;
+        while ((old_i < tensor->num_dims) && (new_i < num_dims)) {
+                const uint32_t old_start = old_i;
+                const uint32_t new_start = new_i;
+                size_t old_prod = tensor->dims[old_i];
+                size_t new_prod = dims[new_i];
+                while (old_prod != new_prod) {
+                        if (new_prod < old_prod) {
+                                if (++new_i == num_dims)
+                                        return false;
+                                new_prod *= dims[new_i];
+                        } else {
+                                if (++old_i == tensor->num_dims)
+                                        return false;
+                                old_prod *= tensor->dims[old_i];
+                        }
+                }
+
+                uint32_t inner = old_i;
+                for (uint32_t dim = old_i;
+                     dim > old_start;
+                     --dim) {
+                        if (tensor->dims[dim - 1] == 1)
+                                continue;
+
+                        if (tensor->dims[inner] != 1) {
+                                size_t packed = (tensor->strides[inner]*
+                                                 tensor->dims[inner]);
+                                if (tensor->strides[dim - 1] != packed)
+                                        return false;
+                        }
+                        inner = dim - 1;
+                }
+
+                strides[new_i] = tensor->strides[old_i];
+                for (uint32_t dim = new_i;
+                     dim > new_start;
+                     --dim) {
+                        strides[dim - 1] = strides[dim]*dims[dim];
+                }
+
+                ++old_i;
+                ++new_i;
+        }
+
+        return true;
+}
+
+rot_tensor_t ROT_tensor_view_reshape(rot_arena_t arena,
+                                     const rot_tensor_t tensor,
+                                     uint32_t num_dims,
+                                     const size_t *dims)
+{
+        if ((arena == NULL) || (tensor == NULL) || (dims == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        size_t num_elems = 1;
+        for (uint32_t dim = 0;
+             dim < num_dims;
+             ++dim) {
+                num_elems *= dims[dim];
+        }
+
+        if ((num_dims == 0) ||
+            (num_elems != tensor_get_num_elems(tensor)) ||
+            (num_elems == 0)) {
+                LOG_ERROR("Reshape must keep the same, non-zero, number of "
+                          "elements.");
+                return NULL;
+        }
+
+        /* TODO(brendan): Track the channel dimension through reshapes. */
+        if (tensor->quant.channel_scales != NULL) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        struct rot_tensor *view = tensor_create(arena,
+                                                num_dims,
+                                                dims,
+                                                tensor->backend,
+                                                tensor->dtype,
+                                                dims[num_dims - 1],
+                                                1,
+                                                false);
+        if (view == NULL)
+                return NULL;
+
+        if (!reshape_strides(tensor, num_dims, dims, view->strides)) {
+                LOG_ERROR("Reshaping this view would need a copy.");
+                return NULL;
+        }
+
+        view->quant = tensor->quant;
+
+        if (tensor->backend == ROT_BACKEND_CPU)
+                view->cpu.data = tensor->cpu.data;
+        else
+                view->gpu.data = tensor->gpu.data;
+
+        return view;
+}
+
+/**
+ * struct matmul_batch - A batch of same-shape row-major products
+ * C[i] = op(A[i])*op(B[i]), with op(A[i]) being mxk and op(B[i]) being kxn.
+ * @engine: CPU matmul engine, already resolved from the default.
+ * @trans_a, @trans_b: Whether A and B are stored transposed.
+ * @lda, @ldb, @ldc: Leading dimensions of A, B and C.
+ * @a_stride, @b_stride, @c_stride: Floats between consecutive matrices of A, B
+ * and C. A stride of zero broadcasts a single matrix across the batch.
+ * @is_failed: Set, atomically since products can run on different threads, if
+ * any product fails.
+ */
+struct matmul_batch {
+        enum rot_matmul_engine engine;
+        bool trans_a;
+        bool trans_b;
+        size_t m;
+        size_t n;
+        size_t k;
+        const float *a;
+        size_t lda;
+        size_t a_stride;
+        const float *b;
+        size_t ldb;
+        size_t b_stride;
+        float *c;
+        size_t ldc;
+        size_t c_stride;
+        bool is_failed;
+};
+
+static void
+matmul_batch_task(void *context, size_t batch_i)
+{
+        struct matmul_batch *batch = (struct matmul_batch *)context;
+
+        if (!gemm_cpu(batch->engine,
+                      batch->trans_a,
+                      batch->trans_b,
+                      batch->m,
+                      batch->n,
+                      batch->k,
+                      1.0f,
+                      batch->a + batch_i*batch->a_stride,
+                      batch->lda,
+                      batch->b + batch_i*batch->b_stride,
+                      batch->ldb,
+                      0.0f,
+                      batch->c + batch_i*batch->c_stride,
+                      batch->ldc,
+                      NULL))
+                __atomic_store_n(&batch->is_failed, true, __ATOMIC_RELAXED);
 }
 
 static rot_tensor_t
-matmul_cpu(rot_tensor_t result, const rot_tensor_t a, const rot_tensor_t b)
-{
-        cblas_sgemm(CblasRowMajor,
-                    CblasNoTrans,
-                    CblasNoTrans,
-                    a->dims[0],
-                    b->dims[1],
-                    a->dims[1],
-                    1.0f,
-                    a->cpu.data,
-                    a->dims[1],
-                    b->cpu.data,
-                    b->dims[1],
-                    0.0f,
-                    result->cpu.data,
-                    b->dims[1]);
+matmul_batched_cpu(rot_tensor_t result,
+                   const rot_tensor_t a,
+                   const rot_tensor_t b,
+                   size_t batch_size)
+{
+        /* TODO(brendan): Batched matmul of 16-bit tensors. */
+        if ((a->dtype != ROT_DTYPE_FLOAT32) ||
+            (b->dtype != ROT_DTYPE_FLOAT32) ||
+            (result->dtype != ROT_DTYPE_FLOAT32)) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        struct matmul_batch batch = {
+                .engine = gemm_resolve_engine(ROT_MATMUL_ENGINE_DEFAULT),
+                .trans_a = false,
+                .trans_b = false,
+                .m = a->dims[a->num_dims - 2],
+                .n = b->dims[b->num_dims - 1],
+                .k = a->dims[a->num_dims - 1],
+                .a = a->cpu.data,
+                .lda = 0,
+                .a_stride = 0,
+                .b = b->cpu.data,
+                .ldb = 0,
+                .b_stride = 0,
+                .c = result->cpu.data,
+                .ldc = 0,
+                .c_stride = result->strides[0],
+                .is_failed = false};
+        bool is_c_trans;
+        if (!tensor_get_matrix(a,
+                               a->num_dims - 2,
+                               &batch.trans_a,
+                               &batch.lda) ||
+            !tensor_get_matrix(b,
+                               b->num_dims - 2,
+                               &batch.trans_b,
+                               &batch.ldb) ||
+            !tensor_get_matrix(result, 1, &is_c_trans, &batch.ldc) ||
+            is_c_trans) {
+                LOG_ERROR("Batched matmul operands must have contiguous rows "
+                          "or columns, and results contiguous rows.");
+                return NULL;
+        }
+
+        if (a->num_dims == 3)
+                batch.a_stride = a->strides[0];
+        if (b->num_dims == 3)
+                batch.b_stride = b->strides[0];
+
+        /**
+         * NOTE(brendan): With at least one matrix per worker, whole matrices
+         * are spread across threads and each GEMM runs single threaded.
+         * Otherwise the matrices run one after another, each using all the
+         * threads itself. OpenBLAS threads internally, so it is always called
+         * from this thread.
+         */
+        if ((batch.engine == ROT_MATMUL_ENGINE_NATIVE) &&
+            (batch_size >= thread_get_num_workers())) {
+                parallel_for(batch_size, matmul_batch_task, &batch);
+        } else {
+                for (size_t batch_i = 0;
+                     (batch_i < batch_size) && !batch.is_failed;
+                     ++batch_i) {
+                        matmul_batch_task(&batch, batch_i);
+                }
+        }
+
+        if (batch.is_failed) {
+                LOG_ERROR("Batched matmul failed.");
+                return NULL;
+        }
 
         return result;
 }
 
+/**
+ * gemm_with_engine() - Validates and dispatches
+ * c <- alpha*op(a)*op(b) + beta*c to the backend of the operands.
+ */
+static rot_tensor_t
+gemm_with_engine(rot_tensor_t c,
+                 const rot_tensor_t a,
+                 const rot_tensor_t b,
+                 bool trans_a,
+                 bool trans_b,
+                 float alpha,
+                 float beta,
+                 enum rot_matmul_engine engine)
+{
+        if ((c == NULL) || (a == NULL) || (b == NULL)) {
+                LOG_ERROR("Null input.");
+                return NULL;
+        }
+
+        if ((a->num_dims != 2) || (b->num_dims != 2) || (c->num_dims != 2)) {
+                LOG_ERROR("Matrix dimensions must be 2.");
+                return NULL;
+        }
+
+        const size_t m = trans_a ? a->dims[1] : a->dims[0];
+        const size_t k = trans_a ? a->dims[0] : a->dims[1];
+        const size_t n = trans_b ? b->dims[0] : b->dims[1];
+        if ((k != (trans_b ? b->dims[1] : b->dims[0])) ||
+            (c->dims[0] != m) ||
+            (c->dims[1] != n)) {
+                LOG_ERROR("Matrix dimensions incompatible for "
+                          "multiplication.");
+                return NULL;
+        }
+
+        if ((a->backend != b->backend) || (a->backend != c->backend)) {
+                LOG_ERROR("Tensor arguments to matmul must use the same "
+                          "hardware backend.");
+                return NULL;
+        }
+
+        if (tensor_is_overlapping(c, a) || tensor_is_overlapping(c, b)) {
+                LOG_ERROR("Result tensor of matmul must not overlap either "
+                          "operand tensor.");
+                return NULL;
+        }
+
+        if ((a->backend != ROT_BACKEND_CPU) &&
+            (!tensor_is_contiguous(a) ||
+             !tensor_is_contiguous(b) ||
+             !tensor_is_contiguous(c))) {
+                /**
+                 * TODO(brendan): Pass strided views to cuBLAS/rocBLAS as
+                 * transposed operands, as on the CPU.
+                 */
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        struct rot_context *context = context_get_current();
+        switch (a->backend) {
+        case ROT_BACKEND_CPU:
+                if (!tensor_gemm_cpu(engine,
+                                     trans_a,
+                                     trans_b,
+                                     alpha,
+                                     a,
+                                     b,
+                                     beta,
+                                     c,
+                                     NULL)) {
+                        LOG_ERROR("Matmul operands must have contiguous rows "
+                                  "or columns, and compatible types.");
+                        return NULL;
+                }
+                return c;
+        case ROT_BACKEND_CUDA:
+                return gemm_cuda(context,
+                                 c,
+                                 a,
+                                 b,
+                                 trans_a,
+                                 trans_b,
+                                 alpha,
+                                 beta);
+        case ROT_BACKEND_ROC:
+                return gemm_roc(context,
+                                c,
+                                a,
+                                b,
+                                trans_a,
+                                trans_b,
+                                alpha,
+                                beta);
+        default:
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+}
+
 rot_tensor_t ROT_matmul(rot_tensor_t result,
                         const rot_tensor_t a,
                         const rot_tensor_t b)
+{
+        return ROT_matmul_with_engine(result,
+                                      a,
+                                      b,
+                                      ROT_MATMUL_ENGINE_DEFAULT);
+}
+
+rot_tensor_t ROT_matmul_with_engine(rot_tensor_t result,
+                                    const rot_tensor_t a,
+                                    const rot_tensor_t b,
+                                    enum rot_matmul_engine engine)
+{
+        return gemm_with_engine(result, a, b, false, false, 1.0f, 0.0f, engine);
+}
+
+rot_tensor_t ROT_gemm(rot_tensor_t c,
+                      const rot_tensor_t a,
+                      const rot_tensor_t b,
+                      bool trans_a,
+                      bool trans_b,
+                      float alpha,
+                      float beta)
+{
+        return gemm_with_engine(c,
+                                a,
+                                b,
+                                trans_a,
+                                trans_b,
+                                alpha,
+                                beta,
+                                ROT_MATMUL_ENGINE_DEFAULT);
+}
+
+rot_tensor_t ROT_matmul_batched(rot_tensor_t result,
+                                const rot_tensor_t a,
+                                const rot_tensor_t b)
 {
         if ((result == NULL) || (a == NULL) || (b == NULL)) {
-                LOG_ERROR("Null input.");
+                LOG_NULL();
                 return NULL;
         }
 
-        if ((a->num_dims != 2) || (b->num_dims != 2)) {
-                LOG_ERROR("Matrix dimensions must be 2.");
+        if ((a->num_dims < 2) || (a->num_dims > 3) ||
+            (b->num_dims < 2) || (b->num_dims > 3) ||
+            ((a->num_dims == 2) && (b->num_dims == 2))) {
+                LOG_ERROR("Batched matmul operands must have 3 dimensions, "
+                          "or 2 dimensions to broadcast one operand.");
                 return NULL;
         }
 
-        if (a->dims[1] != b->dims[0]) {
+        size_t batch_size = (a->num_dims == 3) ? a->dims[0] : b->dims[0];
+        if ((a->num_dims == 3) &&
+            (b->num_dims == 3) &&
+            (a->dims[0] != b->dims[0])) {
+                LOG_ERROR("Batched matmul operands have different batch "
+                          "sizes.");
+                return NULL;
+        }
+
+        size_t m = a->dims[a->num_dims - 2];
+        size_t k = a->dims[a->num_dims - 1];
+        size_t n = b->dims[b->num_dims - 1];
+        if (k != b->dims[b->num_dims - 2]) {
                 LOG_ERROR("Matrix dimensions incompatible for "
                           "multiplication.");
                 return NULL;
         }
 
-        if ((result == a) || (result == b)) {
-                LOG_ERROR("Result tensor of matmul must be different from "
-                          "either operand tensor.");
+        if ((result->num_dims != 3) ||
+            (result->dims[0] != batch_size) ||
+            (result->dims[1] != m) ||
+            (result->dims[2] != n)) {
+                LOG_ERROR("Batched matmul result must have dimensions "
+                          "[batch, m, n].");
                 return NULL;
         }
 
-        if (a->backend != b->backend) {
+        if ((a->backend != b->backend) || (a->backend != result->backend)) {
                 LOG_ERROR("Tensor arguments to matmul must use the same "
                           "hardware backend.");
                 return NULL;
         }
 
+        if (tensor_is_overlapping(result, a) ||
+            tensor_is_overlapping(result, b)) {
+                LOG_ERROR("Result tensor of matmul must not overlap either "
+                          "operand tensor.");
+                return NULL;
+        }
+
+        if ((a->backend != ROT_BACKEND_CPU) &&
+            (!tensor_is_contiguous(a) ||
+             !tensor_is_contiguous(b) ||
+             !tensor_is_contiguous(result))) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        bool is_a_broadcast = (a->num_dims == 2);
+        bool is_b_broadcast = (b->num_dims == 2);
         switch (a->backend) {
         case ROT_BACKEND_CPU:
-                return matmul_cpu(result, a, b);
+                return matmul_batched_cpu(result, a, b, batch_size);
         case ROT_BACKEND_CUDA:
-                return matmul_cuda(result, a, b);
+                return matmul_batched_cuda(context_get_current(),
+                                           result,
+                                           a,
+                                           b,
+                                           batch_size,
+                                           is_a_broadcast,
+                                           is_b_broadcast);
         case ROT_BACKEND_ROC:
-                return matmul_roc(result, a, b);
+                return matmul_batched_roc(context_get_current(),
+                                          result,
+                                          a,
+                                          b,
+                                          batch_size,
+                                          is_a_broadcast,
+                                          is_b_broadcast);
         default:
                 LOG_UNSUPPORTED();
                 return NULL;
@@ -224,6 +1651,12 @@ rot_tensor_t ROT_matmul(rot_tensor_t result,
 
 float *ROT_tensor_get_data(rot_tensor_t tensor)
 {
+        if (tensor->dtype != ROT_DTYPE_FLOAT32) {
+                LOG_ERROR("Only float32 tensors' data can be accessed as "
+                          "floats.");
+                return NULL;
+        }
+
         switch (tensor->backend) {
         case ROT_BACKEND_CPU:
                 return tensor->cpu.data;
@@ -236,17 +1669,35 @@ float *ROT_tensor_get_data(rot_tensor_t tensor)
         }
 }
 
+enum rot_dtype ROT_tensor_get_dtype(rot_tensor_t tensor)
+{
+        return tensor->dtype;
+}
+
 const size_t *ROT_tensor_get_dims(rot_tensor_t tensor)
 {
         return tensor->dims;
 }
 
+size_t ROT_tensor_get_ld(rot_tensor_t tensor)
+{
+        if (tensor->num_dims < 2)
+                return tensor->dims[0];
+
+        return tensor->strides[tensor->num_dims - 2];
+}
+
+const size_t *ROT_tensor_get_strides(rot_tensor_t tensor)
+{
+        return tensor->strides;
+}
+
 size_t ROT_tensor_get_size(rot_tensor_t tensor)
 {
         if (tensor->num_dims == 0)
                 return 0;
 
-        size_t size = sizeof(float);
+        size_t size = dtype_get_size(tensor->dtype);
         for (uint32_t i = 0;
              i < tensor->num_dims;
              ++i) {
@@ -0,0 +1,56 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MATH_SIZE_MATH_H
+#define MATH_SIZE_MATH_H
+
+#include <stddef.h>  /* for size_t */
+
+/**
+ * size_math.h - Arithmetic on sizes, shared by the CPU kernels that split
+ * their work into blocks and tiles.
+ */
+
+/**
+ * min_size() - Returns the smaller of `a` and `b`.
+ */
+static inline size_t
+min_size(size_t a, size_t b)
+{
+        return (a < b) ? a : b;
+}
+
+/**
+ * ceil_div() - Returns a/b rounded up, for b > 0.
+ */
+static inline size_t
+ceil_div(size_t a, size_t b)
+{
+        return (a + b - 1)/b;
+}
+
+/**
+ * round_up() - Returns `a` rounded up to a multiple of b > 0.
+ */
+static inline size_t
+round_up(size_t a, size_t b)
+{
+        return ceil_div(a, b)*b;
+}
+
+#endif /* MATH_SIZE_MATH_H */
@@ -0,0 +1,858 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "rot_sparse.h"
+#include "error/log_error.h"  /* for LOG_ERROR, LOG_NULL, LOG_UNSUPPORTED */
+#include "math/size_math.h"   /* for min_size, ceil_div */
+#include "math/tensor.h"      /* for rot_tensor, tensor_has_contiguous_rows */
+#include "platform/cpu.h"     /* for cpu_get_isa */
+#include "platform/thread.h"  /* for parallel_for_range */
+
+#include <immintrin.h>        /* for __m256, __m512, _mm512_fmadd_ps, ... */
+#include <stdint.h>           /* for uint32_t */
+
+#define SPARSE_MAX_BLOCK_ROWS 8
+#define SPARSE_VALUES_ALIGN_BYTES 64
+/**
+ * NOTE(brendan): Panels of `b` narrower than a kernel's tile, and every panel
+ * when there is no SIMD kernel, are multiplied by the generic kernel in tiles
+ * of at most this many columns.
+ */
+#define SPARSE_GENERIC_COLS 64
+/**
+ * NOTE(brendan): Threads take rows of blocks in chunks of about
+ * SPARSE_GRAIN_MACS multiply-adds, and matmuls with fewer than
+ * SPARSE_MIN_PARALLEL_MACS in total are run on the calling thread.
+ */
+#define SPARSE_GRAIN_MACS (64*1024)
+#define SPARSE_MIN_PARALLEL_MACS (4*SPARSE_GRAIN_MACS)
+
+/**
+ * struct rot_sparse - A sparse matrix in block compressed sparse row form,
+ * where CSR is the case of 1x1 blocks.
+ * @dims: Rows and columns of the matrix.
+ * @block_rows, @block_cols: Dimensions of each block.
+ * @row_offsets: For each row of blocks, the index of its first block, and
+ * one past the last block of the last row.
+ * @col_indices: Column of each block, counted in blocks.
+ * @values: Elements of each block, stored row-major, one block after another.
+ */
+struct rot_sparse {
+        enum rot_sparse_format format;
+        size_t dims[2];
+        uint32_t block_rows;
+        uint32_t block_cols;
+        size_t num_block_rows;
+        size_t *row_offsets;
+        uint32_t *col_indices;
+        float *values;
+};
+
+/**
+ * sparse_tile_fn - Computes a tile of `tile_cols` columns of a row of blocks
+ * of the product, starting at column `j0`.
+ * @block_row: Row of blocks of `a` to multiply.
+ * @b: Dense operand, with rows `ldb` apart.
+ * @c: Product, with rows `ldc` apart.
+ */
+typedef void sparse_tile_fn(const struct rot_sparse *a,
+                            size_t block_row,
+                            const float *b,
+                            size_t ldb,
+                            float *c,
+                            size_t ldc,
+                            size_t j0);
+
+/**
+ * struct sparse_kernel - A SIMD kernel for one block shape.
+ * @tile_cols: Number of columns of the product computed by `tile`.
+ * @tile: The kernel, or NULL to use the generic kernel throughout.
+ */
+struct sparse_kernel {
+        uint32_t tile_cols;
+        sparse_tile_fn *tile;
+};
+
+/**
+ * struct sparse_matmul_job - A sparse matmul, split by `parallel_for_range`
+ * over rows of blocks.
+ */
+struct sparse_matmul_job {
+        const struct rot_sparse *a;
+        const float *b;
+        size_t ldb;
+        float *c;
+        size_t ldc;
+        size_t n;
+        const struct sparse_kernel *kernel;
+};
+
+/**
+ * sparse_get_block_dims() - Sets `block_rows` and `block_cols` to the block
+ * dimensions of `format`.
+ *
+ * Returns false if `format` is unknown.
+ */
+static bool
+sparse_get_block_dims(enum rot_sparse_format format,
+                      uint32_t *block_rows,
+                      uint32_t *block_cols)
+{
+        switch (format) {
+        case ROT_SPARSE_CSR:
+                *block_rows = 1;
+                *block_cols = 1;
+                return true;
+        case ROT_SPARSE_BSR_4X4:
+                *block_rows = 4;
+                *block_cols = 4;
+                return true;
+        case ROT_SPARSE_BSR_8X1:
+                *block_rows = 8;
+                *block_cols = 1;
+                return true;
+        default:
+                return false;
+        }
+}
+
+/**
+ * sparse_check_dense() - Is `tensor` a float32 CPU matrix, with contiguous
+ * rows if `needs_contiguous_rows` is true?
+ */
+static bool
+sparse_check_dense(const struct rot_tensor *tensor, bool needs_contiguous_rows)
+{
+        if ((tensor->dtype != ROT_DTYPE_FLOAT32) ||
+            (tensor->backend != ROT_BACKEND_CPU) ||
+            (tensor->num_dims != 2) ||
+            (needs_contiguous_rows && !tensor_has_contiguous_rows(tensor))) {
+                LOG_ERROR("Dense operands of sparse ops must be float32 CPU "
+                          "matrices, and those multiplied or written by "
+                          "ROT_sparse_matmul must have contiguous rows.");
+                return false;
+        }
+
+        return true;
+}
+
+/**
+ * sparse_dense_elem() - Returns element (`row`, `col`) of the matrix `dense`.
+ */
+static float
+sparse_dense_elem(const struct rot_tensor *dense, size_t row, size_t col)
+{
+        return dense->cpu.data[row*dense->strides[0] + col*dense->strides[1]];
+}
+
+/**
+ * sparse_is_block_nonzero() - Does the block of `dense` with top left corner
+ * (`row0`, `col0`) have a nonzero element?
+ */
+static bool
+sparse_is_block_nonzero(const struct rot_tensor *dense,
+                        size_t row0,
+                        size_t col0,
+                        uint32_t block_rows,
+                        uint32_t block_cols)
+{
+        const size_t row_end = min_size(row0 + block_rows, dense->dims[0]);
+        const size_t col_end = min_size(col0 + block_cols, dense->dims[1]);
+        for (size_t row = row0;
+             row < row_end;
+             ++row) {
+                for (size_t col = col0;
+                     col < col_end;
+                     ++col) {
+                        if (sparse_dense_elem(dense, row, col) != 0.0f)
+                                return true;
+                }
+        }
+
+        return false;
+}
+
+rot_sparse_t ROT_sparse_from_dense(rot_arena_t arena,
+                                   const rot_tensor_t dense,
+                                   enum rot_sparse_format format)
+{
+        if ((arena == NULL) || (dense == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        uint32_t block_rows;
+        uint32_t block_cols;
+        if (!sparse_get_block_dims(format, &block_rows, &block_cols)) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        if (!sparse_check_dense(dense, false))
+                return NULL;
+
+        const size_t rows = dense->dims[0];
+        const size_t cols = dense->dims[1];
+        const size_t num_block_rows = ceil_div(rows, block_rows);
+        const size_t num_block_cols = ceil_div(cols, block_cols);
+        if (num_block_cols > UINT32_MAX) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        /**
+         * NOTE(brendan): The row offsets are placed directly after the
+         * struct. The number of blocks, and so the sizes of the column
+         * indices and values, are counted before those are allocated.
+         */
+        struct rot_sparse *result = (struct rot_sparse *)
+                ROT_arena_malloc_aligned(arena,
+                                         (sizeof(struct rot_sparse) +
+                                          ((num_block_rows + 1)*
+                                           sizeof(size_t))),
+                                         sizeof(size_t),
+                                         ROT_BACKEND_CPU);
+        if (result == NULL)
+                return NULL;
+
+        result->format = format;
+        result->dims[0] = rows;
+        result->dims[1] = cols;
+        result->block_rows = block_rows;
+        result->block_cols = block_cols;
+        result->num_block_rows = num_block_rows;
+        result->row_offsets = (size_t *)(result + 1);
+
+        size_t num_blocks = 0;
+        for (size_t block_row = 0;
+             block_row < num_block_rows;
+             ++block_row) {
+                result->row_offsets[block_row] = num_blocks;
+                for (size_t block_col = 0;
+                     block_col < num_block_cols;
+                     ++block_col) {
+                        num_blocks += sparse_is_block_nonzero(
+                                dense,
+                                block_row*block_rows,
+                                block_col*block_cols,
+                                block_rows,
+                                block_cols);
+                }
+        }
+        result->row_offsets[num_block_rows] = num_blocks;
+
+        const size_t block_size = block_rows*block_cols;
+        result->col_indices = (uint32_t *)ROT_arena_malloc(
+                arena,
+                num_blocks*sizeof(uint32_t),
+                ROT_BACKEND_CPU);
+        result->values = (float *)ROT_arena_malloc_aligned(
+                arena,
+                num_blocks*block_size*sizeof(float),
+                SPARSE_VALUES_ALIGN_BYTES,
+                ROT_BACKEND_CPU);
+        if ((result->col_indices == NULL) || (result->values == NULL))
+                return NULL;
+
+        size_t block_i = 0;
+        for (size_t block_row = 0;
+             block_row < num_block_rows;
+             ++block_row) {
+                const size_t row0 = block_row*block_rows;
+                for (size_t block_col = 0;
+                     block_col < num_block_cols;
+                     ++block_col) {
+                        const size_t col0 = block_col*block_cols;
+                        if (!sparse_is_block_nonzero(dense,
+                                                     row0,
+                                                     col0,
+                                                     block_rows,
+                                                     block_cols))
+                                continue;
+
+                        float *values = result->values + block_i*block_size;
+                        for (uint32_t r = 0;
+                             r < block_rows;
+                             ++r) {
+                                for (uint32_t c = 0;
+                                     c < block_cols;
+                                     ++c) {
+                                        bool is_inside =
+                                                ((row0 + r < rows) &&
+                                                 (col0 + c < cols));
+                                        values[r*block_cols + c] =
+                                                (is_inside ?
+                                                 sparse_dense_elem(dense,
+                                                                   row0 + r,
+                                                                   col0 + c) :
+                                                 0.0f);
+                                }
+                        }
+
+                        result->col_indices[block_i] = (uint32_t)block_col;
+                        ++block_i;
+                }
+        }
+
+        return result;
+}
+
+rot_tensor_t ROT_sparse_to_dense(rot_tensor_t result,
+                                 const rot_sparse_t sparse)
+{
+        if ((result == NULL) || (sparse == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (!sparse_check_dense(result, false))
+                return NULL;
+
+        if ((result->dims[0] != sparse->dims[0]) ||
+            (result->dims[1] != sparse->dims[1])) {
+                LOG_ERROR("Dense result must have the dimensions of the "
+                          "sparse matrix.");
+                return NULL;
+        }
+
+        const size_t ld = result->strides[0];
+        const size_t col_stride = result->strides[1];
+        for (size_t row = 0;
+             row < sparse->dims[0];
+             ++row) {
+                for (size_t col = 0;
+                     col < sparse->dims[1];
+                     ++col) {
+                        result->cpu.data[row*ld + col*col_stride] = 0.0f;
+                }
+        }
+
+        const uint32_t block_rows = sparse->block_rows;
+        const uint32_t block_cols = sparse->block_cols;
+        for (size_t block_row = 0;
+             block_row < sparse->num_block_rows;
+             ++block_row) {
+                const size_t row0 = block_row*block_rows;
+                for (size_t block_i = sparse->row_offsets[block_row];
+                     block_i < sparse->row_offsets[block_row + 1];
+                     ++block_i) {
+                        const size_t col0 = (sparse->col_indices[block_i]*
+                                             (size_t)block_cols);
+                        const float *values = (sparse->values +
+                                               block_i*block_rows*block_cols);
+                        const size_t row_end = min_size(row0 + block_rows,
+                                                        sparse->dims[0]);
+                        const size_t col_end = min_size(col0 + block_cols,
+                                                        sparse->dims[1]);
+                        for (size_t row = row0;
+                             row < row_end;
+                             ++row) {
+                                for (size_t col = col0;
+                                     col < col_end;
+                                     ++col) {
+                                        result->cpu.data[row*ld +
+                                                         col*col_stride] =
+                                                values[(row - row0)*
+                                                       block_cols +
+                                                       (col - col0)];
+                                }
+                        }
+                }
+        }
+
+        return result;
+}
+
+/**
+ * spmm_tile_generic() - Computes `num_cols` columns, starting at `j0`, of a
+ * row of blocks of the product, for any block shape and width.
+ */
+static void
+spmm_tile_generic(const struct rot_sparse *a,
+                  size_t block_row,
+                  const float *b,
+                  size_t ldb,
+                  float *c,
+                  size_t ldc,
+                  size_t j0,
+                  size_t num_cols)
+{
+        const uint32_t block_rows = a->block_rows;
+        const uint32_t block_cols = a->block_cols;
+        float acc[SPARSE_MAX_BLOCK_ROWS][SPARSE_GENERIC_COLS] = {};
+
+        for (size_t block_i = a->row_offsets[block_row];
+             block_i < a->row_offsets[block_row + 1];
+             ++block_i) {
+                const size_t col0 = a->col_indices[block_i]*(size_t)block_cols;
+                const float *values = (a->values +
+                                       block_i*block_rows*block_cols);
+                const size_t valid_cols = min_size(block_cols,
+                                                   a->dims[1] - col0);
+                for (size_t bc = 0;
+                     bc < valid_cols;
+                     ++bc) {
+                        const float *b_row = b + (col0 + bc)*ldb + j0;
+                        for (uint32_t r = 0;
+                             r < block_rows;
+                             ++r) {
+                                const float value = values[r*block_cols + bc];
+                                for (size_t j = 0;
+                                     j < num_cols;
+                                     ++j) {
+                                        acc[r][j] += value*b_row[j];
+                                }
+                        }
+                }
+        }
+
+        const size_t row0 = block_row*block_rows;
+        const size_t valid_rows = min_size(block_rows, a->dims[0] - row0);
+        for (size_t r = 0;
+             r < valid_rows;
+             ++r) {
+                float *c_row = c + (row0 + r)*ldc + j0;
+                for (size_t j = 0;
+                     j < num_cols;
+                     ++j) {
+                        c_row[j] = acc[r][j];
+                }
+        }
+}
+
+/**
+ * NOTE(brendan): The SIMD kernels keep a block_rows x num_vecs tile of
+ * accumulators in registers. For each column of a block, the matching row of
+ * `b` is loaded once and multiplied by each of the block's broadcast values
+ * in that column. The block shape is a constant in each kernel, so that the
+ * loops over it unroll. Padding of blocks past the bottom edge of `a` is
+ * computed and not stored, while padding past the right edge is skipped,
+ * since there are no rows of `b` to match it.
+ */
+__attribute__((target("avx512f"), always_inline))
+static inline void
+spmm_tile_avx512(const struct rot_sparse *a,
+                 size_t block_row,
+                 const float *b,
+                 size_t ldb,
+                 float *c,
+                 size_t ldc,
+                 size_t j0,
+                 const uint32_t block_rows,
+                 const uint32_t block_cols,
+                 const uint32_t num_vecs)
+{
+        __m512 acc[SPARSE_MAX_BLOCK_ROWS][4];
+#pragma GCC unroll 8
+        for (uint32_t r = 0;
+             r < block_rows;
+             ++r) {
+#pragma GCC unroll 4
+                for (uint32_t v = 0;
+                     v < num_vecs;
+                     ++v) {
+                        acc[r][v] = _mm512_setzero_ps();
+                }
+        }
+
+        for (size_t block_i = a->row_offsets[block_row];
+             block_i < a->row_offsets[block_row + 1];
+             ++block_i) {
+                const size_t col0 = a->col_indices[block_i]*(size_t)block_cols;
+                const float *values = (a->values +
+                                       block_i*block_rows*block_cols);
+                const size_t valid_cols = min_size(block_cols,
+                                                   a->dims[1] - col0);
+                for (size_t bc = 0;
+                     bc < valid_cols;
+                     ++bc) {
+                        const float *b_row = b + (col0 + bc)*ldb + j0;
+                        __m512 b_vecs[4];
+#pragma GCC unroll 4
+                        for (uint32_t v = 0;
+                             v < num_vecs;
+                             ++v) {
+                                b_vecs[v] = _mm512_loadu_ps(b_row + 16*v);
+                        }
+
+#pragma GCC unroll 8
+                        for (uint32_t r = 0;
+                             r < block_rows;
+                             ++r) {
+                                __m512 value = _mm512_set1_ps(
+                                        values[r*block_cols + bc]);
+#pragma GCC unroll 4
+                                for (uint32_t v = 0;
+                                     v < num_vecs;
+                                     ++v) {
+                                        acc[r][v] = _mm512_fmadd_ps(
+                                                value,
+                                                b_vecs[v],
+                                                acc[r][v]);
+                                }
+                        }
+                }
+        }
+
+        const size_t row0 = block_row*block_rows;
+        const size_t valid_rows = min_size(block_rows, a->dims[0] - row0);
+#pragma GCC unroll 8
+        for (uint32_t r = 0;
+             r < block_rows;
+             ++r) {
+                if (r == valid_rows)
+                        break;
+
+                float *c_row = c + (row0 + r)*ldc + j0;
+#pragma GCC unroll 4
+                for (uint32_t v = 0;
+                     v < num_vecs;
+                     ++v) {
+                        _mm512_storeu_ps(c_row + 16*v, acc[r][v]);
+                }
+        }
+}
+
+__attribute__((target("avx2,fma"), always_inline))
+static inline void
+spmm_tile_avx2(const struct rot_sparse *a,
+               size_t block_row,
+               const float *b,
+               size_t ldb,
+               float *c,
+               size_t ldc,
+               size_t j0,
+               const uint32_t block_rows,
+               const uint32_t block_cols,
+               const uint32_t num_vecs)
+{
+        __m256 acc[SPARSE_MAX_BLOCK_ROWS][4];
+#pragma GCC unroll 8
+        for (uint32_t r = 0;
+             r < block_rows;
+             ++r) {
+#pragma GCC unroll 4
+                for (uint32_t v = 0;
+                     v < num_vecs;
+                     ++v) {
+                        acc[r][v] = _mm256_setzero_ps();
+                }
+        }
+
+        for (size_t block_i = a->row_offsets[block_row];
+             block_i < a->row_offsets[block_row + 1];
+             ++block_i) {
+                const size_t col0 = a->col_indices[block_i]*(size_t)block_cols;
+                const float *values = (a->values +
+                                       block_i*block_rows*block_cols);
+                const size_t valid_cols = min_size(block_cols,
+                                                   a->dims[1] - col0);
+                for (size_t bc = 0;
+                     bc < valid_cols;
+                     ++bc) {
+                        const float *b_row = b + (col0 + bc)*ldb + j0;
+                        __m256 b_vecs[4];
+#pragma GCC unroll 4
+                        for (uint32_t v = 0;
+                             v < num_vecs;
+                             ++v) {
+                                b_vecs[v] = _mm256_loadu_ps(b_row + 8*v);
+                        }
+
+#pragma GCC unroll 8
+                        for (uint32_t r = 0;
+                             r < block_rows;
+                             ++r) {
+                                __m256 value = _mm256_broadcast_ss(
+                                        values + r*block_cols + bc);
+#pragma GCC unroll 4
+                                for (uint32_t v = 0;
+                                     v < num_vecs;
+                                     ++v) {
+                                        acc[r][v] = _mm256_fmadd_ps(
+                                                value,
+                                                b_vecs[v],
+                                                acc[r][v]);
+                                }
+                        }
+                }
+        }
+
+        const size_t row0 = block_row*block_rows;
+        const size_t valid_rows = min_size(block_rows, a->dims[0] - row0);
+#pragma GCC unroll 8
+        for (uint32_t r = 0;
+             r < block_rows;
+             ++r) {
+                if (r == valid_rows)
+                        break;
+
+                float *c_row = c + (row0 + r)*ldc + j0;
+#pragma GCC unroll 4
+                for (uint32_t v = 0;
+                     v < num_vecs;
+                     ++v) {
+                        _mm256_storeu_ps(c_row + 8*v, acc[r][v]);
+                }
+        }
+}
+
+/**
+ * NOTE(brendan): Tiles are sized to fill at most 16 accumulator registers,
+ * leaving room for the row of `b` and the broadcast value: 4 rows of 64 or 8
+ * rows of 32 columns with AVX-512, and 4 rows of 16 or 8 rows of 8 with AVX2.
+ */
+__attribute__((target("avx512f")))
+static void
+spmm_tile_avx512_csr(const struct rot_sparse *a,
+                     size_t block_row,
+                     const float *b,
+                     size_t ldb,
+                     float *c,
+                     size_t ldc,
+                     size_t j0)
+{
+        spmm_tile_avx512(a, block_row, b, ldb, c, ldc, j0, 1, 1, 4);
+}
+
+__attribute__((target("avx512f")))
+static void
+spmm_tile_avx512_4x4(const struct rot_sparse *a,
+                     size_t block_row,
+                     const float *b,
+                     size_t ldb,
+                     float *c,
+                     size_t ldc,
+                     size_t j0)
+{
+        spmm_tile_avx512(a, block_row, b, ldb, c, ldc, j0, 4, 4, 4);
+}
+
+__attribute__((target("avx512f")))
+static void
+spmm_tile_avx512_8x1(const struct rot_sparse *a,
+                     size_t block_row,
+                     const float *b,
+                     size_t ldb,
+                     float *c,
+                     size_t ldc,
+                     size_t j0)
+{
+        spmm_tile_avx512(a, block_row, b, ldb, c, ldc, j0, 8, 1, 2);
+}
+
+__attribute__((target("avx2,fma")))
+static void
+spmm_tile_avx2_csr(const struct rot_sparse *a,
+                   size_t block_row,
+                   const float *b,
+                   size_t ldb,
+                   float *c,
+                   size_t ldc,
+                   size_t j0)
+{
+        spmm_tile_avx2(a, block_row, b, ldb, c, ldc, j0, 1, 1, 4);
+}
+
+__attribute__((target("avx2,fma")))
+static void
+spmm_tile_avx2_4x4(const struct rot_sparse *a,
+                   size_t block_row,
+                   const float *b,
+                   size_t ldb,
+                   float *c,
+                   size_t ldc,
+                   size_t j0)
+{
+        spmm_tile_avx2(a, block_row, b, ldb, c, ldc, j0, 4, 4, 2);
+}
+
+__attribute__((target("avx2,fma")))
+static void
+spmm_tile_avx2_8x1(const struct rot_sparse *a,
+                   size_t block_row,
+                   const float *b,
+                   size_t ldb,
+                   float *c,
+                   size_t ldc,
+                   size_t j0)
+{
+        spmm_tile_avx2(a, block_row, b, ldb, c, ldc, j0, 8, 1, 1);
+}
+
+/* NOTE(brendan): Kernels are indexed by enum rot_sparse_format. */
+static const struct sparse_kernel sparse_kernels_avx512[] = {
+        {.tile_cols = 64, .tile = spmm_tile_avx512_csr},
+        {.tile_cols = 64, .tile = spmm_tile_avx512_4x4},
+        {.tile_cols = 32, .tile = spmm_tile_avx512_8x1},
+};
+
+static const struct sparse_kernel sparse_kernels_avx2[] = {
+        {.tile_cols = 32, .tile = spmm_tile_avx2_csr},
+        {.tile_cols = 16, .tile = spmm_tile_avx2_4x4},
+        {.tile_cols = 8, .tile = spmm_tile_avx2_8x1},
+};
+
+static const struct sparse_kernel sparse_kernel_generic = {
+        .tile_cols = SPARSE_GENERIC_COLS,
+        .tile = NULL};
+
+static const struct sparse_kernel *
+sparse_get_kernel(enum rot_sparse_format format)
+{
+        enum cpu_isa isa = cpu_get_isa();
+        if (isa >= CPU_ISA_AVX512)
+                return sparse_kernels_avx512 + format;
+
+        if (isa >= CPU_ISA_AVX2)
+                return sparse_kernels_avx2 + format;
+
+        return &sparse_kernel_generic;
+}
+
+/**
+ * sparse_matmul_range() - Multiplies rows of blocks [begin, end) of `a`.
+ *
+ * Panels of `b` are the outer loop, so that a panel is reused from cache by
+ * every row of blocks in the range.
+ */
+static void
+sparse_matmul_range(void *context, size_t begin, size_t end)
+{
+        const struct sparse_matmul_job *job =
+                (const struct sparse_matmul_job *)context;
+        const struct sparse_kernel *kernel = job->kernel;
+        for (size_t j0 = 0;
+             j0 < job->n;
+             j0 += kernel->tile_cols) {
+                const size_t num_cols = min_size(kernel->tile_cols,
+                                                 job->n - j0);
+                const bool is_full_tile = ((kernel->tile != NULL) &&
+                                           (num_cols == kernel->tile_cols));
+                for (size_t block_row = begin;
+                     block_row < end;
+                     ++block_row) {
+                        if (is_full_tile) {
+                                kernel->tile(job->a,
+                                             block_row,
+                                             job->b,
+                                             job->ldb,
+                                             job->c,
+                                             job->ldc,
+                                             j0);
+                                continue;
+                        }
+
+                        for (size_t jg = j0;
+                             jg < j0 + num_cols;
+                             jg += SPARSE_GENERIC_COLS) {
+                                spmm_tile_generic(
+                                        job->a,
+                                        block_row,
+                                        job->b,
+                                        job->ldb,
+                                        job->c,
+                                        job->ldc,
+                                        jg,
+                                        min_size(SPARSE_GENERIC_COLS,
+                                                 j0 + num_cols - jg));
+                        }
+                }
+        }
+}
+
+rot_tensor_t ROT_sparse_matmul(rot_tensor_t result,
+                               const rot_sparse_t a,
+                               const rot_tensor_t b)
+{
+        if ((result == NULL) || (a == NULL) || (b == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (!sparse_check_dense(result, true) || !sparse_check_dense(b, true))
+                return NULL;
+
+        const size_t m = a->dims[0];
+        const size_t k = a->dims[1];
+        const size_t n = b->dims[1];
+        if ((b->dims[0] != k) ||
+            (result->dims[0] != m) ||
+            (result->dims[1] != n)) {
+                LOG_ERROR("Sparse matmul operands have incompatible "
+                          "dimensions.");
+                return NULL;
+        }
+
+        if (tensor_is_overlapping(result, b)) {
+                LOG_ERROR("Sparse matmul result must not overlap its dense "
+                          "operand.");
+                return NULL;
+        }
+
+        if ((m == 0) || (n == 0))
+                return result;
+
+        struct sparse_matmul_job job = {
+                .a = a,
+                .b = b->cpu.data,
+                .ldb = b->strides[0],
+                .c = result->cpu.data,
+                .ldc = result->strides[0],
+                .n = n,
+                .kernel = sparse_get_kernel(a->format)};
+
+        const size_t num_macs = ROT_sparse_get_nnz(a)*n;
+        if ((num_macs < SPARSE_MIN_PARALLEL_MACS) ||
+            (thread_get_num_workers() == 1)) {
+                sparse_matmul_range(&job, 0, a->num_block_rows);
+                return result;
+        }
+
+        const size_t macs_per_block_row = ceil_div(num_macs,
+                                                   a->num_block_rows);
+        const size_t grain = ceil_div(SPARSE_GRAIN_MACS, macs_per_block_row);
+        parallel_for_range(0,
+                           a->num_block_rows,
+                           grain,
+                           sparse_matmul_range,
+                           &job);
+
+        return result;
+}
+
+const size_t *ROT_sparse_get_dims(const rot_sparse_t sparse)
+{
+        if (sparse == NULL) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        return sparse->dims;
+}
+
+size_t ROT_sparse_get_nnz(const rot_sparse_t sparse)
+{
+        if (sparse == NULL) {
+                LOG_NULL();
+                return 0;
+        }
+
+        return (sparse->row_offsets[sparse->num_block_rows]*
+                sparse->block_rows*sparse->block_cols);
+}
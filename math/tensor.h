@@ -0,0 +1,311 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MATH_TENSOR_H
+#define MATH_TENSOR_H
+
+#include "rot_arena.h"     /* for rot_arena_t */
+#include "rot_math.h"      /* for rot_tensor_t */
+#include "rot_platform.h"  /* for rot_backend */
+#include <stddef.h>        /* for size_t */
+#include <stdint.h>        /* for uint32_t */
+
+/**
+ * tensor.h - Internal definition of `struct rot_tensor`, shared by the modules
+ * implementing ops on tensors. Users of the library only see the opaque
+ * `rot_tensor_t`.
+ */
+
+/**
+ * NOTE(brendan): CPU data is normally allocated directly after the tensor's
+ * metadata, but is reached through a pointer so that tensors can also point
+ * into memory placed by other means, e.g. a region shared by the memory
+ * planner.
+ */
+struct rot_cpu_tensor {
+        union {
+                float *data;
+                uint16_t *data_16;
+                uint8_t *data_8;
+        };
+};
+
+/**
+ * struct tensor_quant - Quantization of a tensor of 8-bit integers, where an
+ * integer q represents the real number scale*(q - zero_point).
+ * @scale: Scale shared by every element, when `channel_scales` is NULL.
+ * @zero_point: Integer representing zero.
+ * @channel_scales: Scales per channel, i.e. per index of dimension
+ * `channel_dim`, or NULL.
+ * @channel_dim: Dimension indexing `channel_scales`.
+ */
+struct tensor_quant {
+        float scale;
+        int32_t zero_point;
+        const float *channel_scales;
+        uint32_t channel_dim;
+};
+
+struct rot_gpu_tensor {
+        void *data;
+};
+
+/**
+ * rot_tensor: Container for tensor data.
+ *
+ * NOTE(brendan): Element (i_0, ..., i_{n-1}) of a tensor is at
+ * data + sum(i_d*strides[d]), with strides counted in elements of `dtype`.
+ * CPU data of 16-bit and 8-bit types is reached through `cpu.data_16` and
+ * `cpu.data_8`, and `quant` only applies to the 8-bit types. Tensors created
+ * by ROT_create_tensor are packed row-major, i.e. dims[0] represents the
+ * slowest changing dimension, dims[num_dims - 1] is the quickest changing
+ * dimension, and strides[d] is the product of dims[d + 1:]. Padding the
+ * leading dimension or taking a view of another tensor gives other strides.
+ *
+ * E.g. for a matrix, dims[0] would be the dimension of the rows, and dims[1]
+ * would be the dimension for the columns.
+ *
+ * Views share their data with the tensor they were taken from, and the view's
+ * offset into that data is folded into its data pointer.
+ *
+ * TODO(brendan): Supported dimensions?
+ */
+struct rot_tensor {
+        enum rot_backend backend;
+        enum rot_dtype dtype;
+        size_t *dims;
+        size_t *strides;
+        uint32_t num_dims;
+        union {
+                struct rot_cpu_tensor cpu;
+                struct rot_gpu_tensor gpu;
+        };
+        struct tensor_quant quant;
+};
+
+/**
+ * NOTE(brendan): Tensor data starts on a cache line by default, which is also
+ * the width of an AVX-512 vector.
+ */
+#define TENSOR_DEFAULT_ALIGN_BYTES 64
+
+struct gemm_epilogue;
+
+/**
+ * tensor_get_num_elems() - Returns the number of elements in `tensor`.
+ */
+static inline size_t
+tensor_get_num_elems(const struct rot_tensor *tensor)
+{
+        size_t num_elems = 1;
+        for (uint32_t i = 0;
+             i < tensor->num_dims;
+             ++i) {
+                num_elems *= tensor->dims[i];
+        }
+
+        return num_elems;
+}
+
+/**
+ * tensor_is_contiguous() - Is `tensor` packed row-major, with no gaps?
+ */
+static inline bool
+tensor_is_contiguous(const struct rot_tensor *tensor)
+{
+        size_t stride = 1;
+        for (uint32_t i = tensor->num_dims;
+             i > 0;
+             --i) {
+                if ((tensor->dims[i - 1] != 1) &&
+                    (tensor->strides[i - 1] != stride))
+                        return false;
+                stride *= tensor->dims[i - 1];
+        }
+
+        return true;
+}
+
+/**
+ * tensor_has_contiguous_rows() - Are the elements of each row of `tensor`'s
+ * last dimension next to each other in memory?
+ */
+static inline bool
+tensor_has_contiguous_rows(const struct rot_tensor *tensor)
+{
+        const uint32_t last = tensor->num_dims - 1;
+        return (tensor->dims[last] == 1) || (tensor->strides[last] == 1);
+}
+
+/**
+ * tensor_get_row_offset() - Returns the offset in elements from the start of
+ * `tensor`'s data to row `row` of its last dimension, with rows counted in
+ * row-major order.
+ */
+static inline size_t
+tensor_get_row_offset(const struct rot_tensor *tensor, size_t row)
+{
+        size_t offset = 0;
+        for (uint32_t i = tensor->num_dims - 1;
+             i > 0;
+             --i) {
+                const size_t dim = tensor->dims[i - 1];
+                offset += (row % dim)*tensor->strides[i - 1];
+                row /= dim;
+        }
+
+        return offset;
+}
+
+/**
+ * tensor_get_cpu_elem() - Returns a pointer to the element `offset` elements
+ * into the CPU data of `tensor`, whatever its type.
+ */
+static inline void *
+tensor_get_cpu_elem(const struct rot_tensor *tensor, size_t offset)
+{
+        switch (tensor->dtype) {
+        case ROT_DTYPE_FLOAT32:
+                return tensor->cpu.data + offset;
+        case ROT_DTYPE_INT8:
+        case ROT_DTYPE_UINT8:
+                return tensor->cpu.data_8 + offset;
+        default:
+                return tensor->cpu.data_16 + offset;
+        }
+}
+
+/**
+ * tensor_get_cpu_end() - Returns a pointer one past the last element of
+ * `tensor`'s CPU data, or to its first element if `tensor` is empty.
+ */
+static inline const uint8_t *
+tensor_get_cpu_end(const struct rot_tensor *tensor)
+{
+        size_t last_offset = 0;
+        for (uint32_t i = 0;
+             i < tensor->num_dims;
+             ++i) {
+                if (tensor->dims[i] == 0)
+                        return tensor->cpu.data_8;
+
+                last_offset += (tensor->dims[i] - 1)*tensor->strides[i];
+        }
+
+        return (const uint8_t *)tensor_get_cpu_elem(tensor, last_offset + 1);
+}
+
+/**
+ * tensor_is_overlapping() - Can the CPU data of `a` and `b` share any bytes?
+ *
+ * The byte ranges spanned by the two tensors are compared, so views of one
+ * buffer at different offsets are caught. Views that interleave without
+ * sharing elements, e.g. the even and odd columns of a matrix, also count as
+ * overlapping.
+ */
+static inline bool
+tensor_is_overlapping(const struct rot_tensor *a, const struct rot_tensor *b)
+{
+        const uint8_t *a_begin = a->cpu.data_8;
+        const uint8_t *a_end = tensor_get_cpu_end(a);
+        const uint8_t *b_begin = b->cpu.data_8;
+        const uint8_t *b_end = tensor_get_cpu_end(b);
+
+        return (a_begin < b_end) && (b_begin < a_end);
+}
+
+/**
+ * tensor_get_matrix() - Describes dims `row_dim` and `row_dim + 1` of `tensor`
+ * as a BLAS matrix.
+ * @is_trans: Set to true if the matrix is stored column-major, e.g. because it
+ * is a transposed view, and false if it is stored row-major.
+ * @ld: Set to the leading dimension of the matrix in its storage order.
+ *
+ * Returns false if neither the rows nor the columns are contiguous.
+ */
+static inline bool
+tensor_get_matrix(const struct rot_tensor *tensor,
+                  uint32_t row_dim,
+                  bool *is_trans,
+                  size_t *ld)
+{
+        const size_t rows = tensor->dims[row_dim];
+        const size_t cols = tensor->dims[row_dim + 1];
+        const size_t row_stride = tensor->strides[row_dim];
+        const size_t col_stride = tensor->strides[row_dim + 1];
+
+        if (((col_stride == 1) || (cols == 1)) &&
+            ((row_stride >= cols) || (rows == 1))) {
+                *is_trans = false;
+                *ld = (rows == 1) ? cols : row_stride;
+                return true;
+        }
+
+        if (((row_stride == 1) || (rows == 1)) &&
+            ((col_stride >= rows) || (cols == 1))) {
+                *is_trans = true;
+                *ld = (cols == 1) ? rows : col_stride;
+                return true;
+        }
+
+        return false;
+}
+
+/**
+ * tensor_gemm_cpu() - c <- alpha*op(a)*op(b) + beta*c for 2D CPU tensors,
+ * which may be views with any strides that tensor_get_matrix accepts.
+ * @trans_a, @trans_b: Whether op() transposes `a` and `b`.
+ * @epilogue: Passed through to gemm_cpu, or NULL.
+ *
+ * Transposed views are handed to the GEMM as transposed operands without
+ * copying. A transposed `c` is computed as c^T = op(b)^T*op(a)^T.
+ *
+ * Operands of 16-bit types always use the native engine, which widens them
+ * to single precision while packing. A 16-bit `c` is accumulated in a single
+ * precision copy, and rounded once at the end.
+ *
+ * Quantized `a` and `b` are multiplied by `qgemm`. Per-channel scales must be
+ * along the rows of op(a) and the columns of op(b), and a quantized `c` must
+ * have a single scale and `beta` zero.
+ *
+ * Dimensions must already have been checked by the caller. Returns false if a
+ * tensor's layout or types are not supported, or if the GEMM's scratch cannot
+ * be allocated.
+ */
+bool tensor_gemm_cpu(enum rot_matmul_engine engine,
+                     bool trans_a,
+                     bool trans_b,
+                     float alpha,
+                     const struct rot_tensor *a,
+                     const struct rot_tensor *b,
+                     float beta,
+                     struct rot_tensor *c,
+                     const struct gemm_epilogue *epilogue);
+
+/**
+ * tensor_create_unallocated() - Allocates the metadata of a CPU tensor from
+ * `arena`, leaving its data pointer NULL for the caller to set.
+ *
+ * Returns NULL on error.
+ */
+struct rot_tensor *
+tensor_create_unallocated(rot_arena_t arena,
+                          uint32_t num_dims,
+                          const size_t *dims);
+
+#endif /* MATH_TENSOR_H */
@@ -0,0 +1,754 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef MATH_VEC_MATH_H
+#define MATH_VEC_MATH_H
+
+#include "rot_nn.h"     /* for rot_activation, rot_unary_op */
+
+#include <float.h>      /* for FLT_MIN */
+#include <immintrin.h>  /* for __m256, __m512, _mm512_fmadd_ps, ... */
+#include <math.h>       /* for expf, logf, fmaf, copysignf */
+
+/**
+ * vec_math.h - Internal SIMD implementations of the elementwise functions used
+ * by activation kernels and fused epilogues.
+ *
+ * Each function comes in a scalar version and AVX2 and AVX-512 versions. The
+ * vector versions must only be called from functions compiled for the
+ * matching target, i.e. with `__attribute__((target(...)))` after checking
+ * `cpu_get_isa`.
+ *
+ * exp uses a Cephes-style range reduction, x = n*ln(2) + r with |r| <=
+ * ln(2)/2, followed by a degree 6 polynomial for e^r, on inputs clamped to
+ * [-87.3, 88.7]. Inputs below that range give 0 rather than a denormal, and
+ * inputs above it give +inf.
+ *
+ * Maximum errors of the vector versions, from evaluating every float in each
+ * range below against double precision, skipping results that are not
+ * normal floats:
+ *
+ *      exp             1.01 ULP        [-87.3, 88.7]
+ *      log             0.83 ULP        (0, FLT_MAX], denormals included
+ *      sigmoid         2.5 ULP         [-87, 87]
+ *      tanh            1.33 ULP        all x
+ *      gelu (tanh)     2.6 ULP         x >= 0
+ *                      15 ULP          [-3, 0)
+ *                      169 ULP         [-9, -3), where rounding the large
+ *                                      tanh argument dominates
+ *      gelu (erf)      8 ULP           all x
+ *
+ * Non-finite inputs give the limits of each function: exp(-inf) is 0,
+ * sigmoid(+-inf) is 1 and 0, tanh(+-inf) is +-1, log(+inf) is +inf, and both
+ * GELUs give +inf at +inf and -0 at -inf. NaN inputs give NaN, except for
+ * ReLU, which as max(x, 0) gives 0.
+ *
+ * The scalar versions are what the generic ISA uses. exp and log call libm,
+ * and the rest follow the vector versions, to within the same bounds except
+ * for 16.3 ULP on [-3, 0) for the tanh GELU and 8.5 ULP for the erf GELU,
+ * since their polynomials are not evaluated with FMA.
+ */
+
+#define VEC_EXP_MAX 88.72283935f
+#define VEC_EXP_MIN -87.33654022f
+#define VEC_LOG2E 1.44269504089f
+#define VEC_LN2_HI 0.693359375f
+#define VEC_LN2_LO -2.12194440e-4f
+#define VEC_EXP_P0 1.9875691500e-4f
+#define VEC_EXP_P1 1.3981999507e-3f
+#define VEC_EXP_P2 8.3334519073e-3f
+#define VEC_EXP_P3 4.1665795894e-2f
+#define VEC_EXP_P4 1.6666665459e-1f
+#define VEC_EXP_P5 5.0000001201e-1f
+
+/**
+ * NOTE(brendan): Below |x| = 0.625, tanh is evaluated with an odd polynomial
+ * instead of from exp, which would cancel catastrophically near zero.
+ */
+#define VEC_TANH_SMALL 0.625f
+#define VEC_TANH_P0 -5.70498872745e-3f
+#define VEC_TANH_P1 2.06390887954e-2f
+#define VEC_TANH_P2 -5.37397155531e-2f
+#define VEC_TANH_P3 1.33314422036e-1f
+#define VEC_TANH_P4 -3.33332819422e-1f
+
+/**
+ * NOTE(brendan): GELU uses the tanh approximation, rewritten as
+ * 0.5*x*(1 + tanh(u)) = x*sigmoid(2*u), which avoids cancellation for large
+ * negative x. VEC_GELU_SCALE is 2*sqrt(2/pi).
+ */
+#define VEC_GELU_SCALE 1.5957691216f
+#define VEC_GELU_CUBIC 0.044715f
+
+/**
+ * NOTE(brendan): log follows Cephes logf. x = m*2^e with m in [sqrt(1/2),
+ * sqrt(2)), and log(m) = f - f^2/2 + f^3*P(f) with f = m - 1 and P of degree
+ * 8. Denormal inputs are scaled by 2^23 first.
+ */
+#define VEC_LOG_SQRTHF 0.707106781186547524f
+#define VEC_LOG_DENORM_SCALE 8388608.0f
+#define VEC_LOG_P0 7.0376836292e-2f
+#define VEC_LOG_P1 -1.1514610310e-1f
+#define VEC_LOG_P2 1.1676998740e-1f
+#define VEC_LOG_P3 -1.2420140846e-1f
+#define VEC_LOG_P4 1.4249322787e-1f
+#define VEC_LOG_P5 -1.6668057665e-1f
+#define VEC_LOG_P6 2.0000714765e-1f
+#define VEC_LOG_P7 -2.4999993993e-1f
+#define VEC_LOG_P8 3.3333331174e-1f
+
+/**
+ * NOTE(brendan): The exact GELU, x*Phi(x), takes the upper tail from
+ * erfc(z) = t*e^(-z^2 + Q(t)) with t = 1/(1 + z/2) (Numerical Recipes
+ * erfcc, fractional error below 1.2e-7 for all z >= 0). Then
+ * Phi(x) = erfc(|x|/sqrt(2))/2 for x < 0, and 1 minus that for x >= 0.
+ * e^(-z^2) is split off as a separate exp of the exactly rounded float z^2,
+ * since rounding an argument as large as z^2 would cost tens of ULP.
+ */
+#define VEC_GELU_ERF_RSQRT2 0.70710678118654752f
+#define VEC_ERFC_Q0 0.17087277f
+#define VEC_ERFC_Q1 -0.82215223f
+#define VEC_ERFC_Q2 1.48851587f
+#define VEC_ERFC_Q3 -1.13520398f
+#define VEC_ERFC_Q4 0.27886807f
+#define VEC_ERFC_Q5 -0.18628806f
+#define VEC_ERFC_Q6 0.09678418f
+#define VEC_ERFC_Q7 0.37409196f
+#define VEC_ERFC_Q8 1.00002368f
+#define VEC_ERFC_Q9 -1.26551223f
+
+static inline float
+scalar_sigmoid(float x)
+{
+        return 1.0f/(1.0f + expf(-x));
+}
+
+static inline float
+scalar_tanh(float x)
+{
+        float abs_x = fabsf(x);
+        if (abs_x < VEC_TANH_SMALL) {
+                float z = x*x;
+                float p = VEC_TANH_P0;
+                p = p*z + VEC_TANH_P1;
+                p = p*z + VEC_TANH_P2;
+                p = p*z + VEC_TANH_P3;
+                p = p*z + VEC_TANH_P4;
+
+                return p*z*x + x;
+        }
+
+        /* NOTE(brendan): tanh(|x|) = 1 - 2/(e^(2|x|) + 1). */
+        return copysignf(1.0f - 2.0f/(expf(abs_x + abs_x) + 1.0f), x);
+}
+
+static inline float
+scalar_gelu(float x)
+{
+        /* NOTE(brendan): -inf*sigmoid(-inf) would be -inf*0 = NaN. */
+        if (x == -INFINITY)
+                return -0.0f;
+
+        float inner = VEC_GELU_SCALE*(x + VEC_GELU_CUBIC*x*x*x);
+
+        return x*scalar_sigmoid(inner);
+}
+
+static inline float
+scalar_gelu_erf(float x)
+{
+        if (x == -INFINITY)
+                return -0.0f;
+
+        float z = fabsf(x)*VEC_GELU_ERF_RSQRT2;
+        float t = 1.0f/(1.0f + 0.5f*z);
+        float q = VEC_ERFC_Q0;
+        q = q*t + VEC_ERFC_Q1;
+        q = q*t + VEC_ERFC_Q2;
+        q = q*t + VEC_ERFC_Q3;
+        q = q*t + VEC_ERFC_Q4;
+        q = q*t + VEC_ERFC_Q5;
+        q = q*t + VEC_ERFC_Q6;
+        q = q*t + VEC_ERFC_Q7;
+        q = q*t + VEC_ERFC_Q8;
+        q = q*t + VEC_ERFC_Q9;
+
+        float x2 = x*x;
+        float z2 = 0.5f*x2;
+        float z2_lo = 0.5f*fmaf(x, x, -x2);
+        float half_erfc = 0.0f;
+        if (z2 <= -VEC_EXP_MIN)
+                half_erfc = 0.5f*t*expf(q - z2_lo)*expf(-z2);
+
+        return x*((x < 0.0f) ? half_erfc : (1.0f - half_erfc));
+}
+
+static inline float
+scalar_activation(float x, enum rot_activation activation)
+{
+        switch (activation) {
+        case ROT_ACTIVATION_RELU:
+                return (x > 0.0f) ? x : 0.0f;
+        case ROT_ACTIVATION_SIGMOID:
+                return scalar_sigmoid(x);
+        case ROT_ACTIVATION_TANH:
+                return scalar_tanh(x);
+        case ROT_ACTIVATION_GELU:
+                return scalar_gelu(x);
+        case ROT_ACTIVATION_GELU_ERF:
+                return scalar_gelu_erf(x);
+        default:
+                return x;
+        }
+}
+
+static inline float
+scalar_unary(float x, enum rot_unary_op op)
+{
+        switch (op) {
+        case ROT_UNARY_RELU:
+                return (x > 0.0f) ? x : 0.0f;
+        case ROT_UNARY_EXP:
+                /* NOTE(brendan): Flushed to 0 below VEC_EXP_MIN, as in SIMD. */
+                return (x < VEC_EXP_MIN) ? 0.0f : expf(x);
+        case ROT_UNARY_LOG:
+                return logf(x);
+        case ROT_UNARY_SIGMOID:
+                return scalar_sigmoid(x);
+        case ROT_UNARY_TANH:
+                return scalar_tanh(x);
+        case ROT_UNARY_GELU:
+                return scalar_gelu(x);
+        case ROT_UNARY_GELU_ERF:
+                return scalar_gelu_erf(x);
+        default:
+                return x;
+        }
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256
+vec_exp_avx2(__m256 x)
+{
+        __m256 is_nan = _mm256_cmp_ps(x, x, _CMP_UNORD_Q);
+        __m256 is_tiny = _mm256_cmp_ps(x,
+                                       _mm256_set1_ps(VEC_EXP_MIN),
+                                       _CMP_LT_OQ);
+        __m256 is_huge = _mm256_cmp_ps(x,
+                                       _mm256_set1_ps(VEC_EXP_MAX),
+                                       _CMP_GT_OQ);
+        __m256 x_in = x;
+        x = _mm256_min_ps(x, _mm256_set1_ps(VEC_EXP_MAX));
+        x = _mm256_max_ps(x, _mm256_set1_ps(VEC_EXP_MIN));
+
+        __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(VEC_LOG2E)),
+                                   _MM_FROUND_TO_NEAREST_INT |
+                                   _MM_FROUND_NO_EXC);
+        __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(VEC_LN2_HI), x);
+        r = _mm256_fnmadd_ps(n, _mm256_set1_ps(VEC_LN2_LO), r);
+
+        __m256 p = _mm256_set1_ps(VEC_EXP_P0);
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(VEC_EXP_P1));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(VEC_EXP_P2));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(VEC_EXP_P3));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(VEC_EXP_P4));
+        p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(VEC_EXP_P5));
+        p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), r);
+        p = _mm256_add_ps(p, _mm256_set1_ps(1.0f));
+
+        /**
+         * NOTE(brendan): n reaches 128 near VEC_EXP_MAX, and 2^128 is not a
+         * float, so scale by 2^(n/2) and then 2^(n - n/2).
+         */
+        __m256i n_int = _mm256_cvtps_epi32(n);
+        __m256i n_half = _mm256_srai_epi32(n_int, 1);
+        __m256i bias = _mm256_set1_epi32(127);
+        __m256i pow2_half = _mm256_slli_epi32(
+                _mm256_add_epi32(n_half, bias),
+                23);
+        __m256i pow2_rest = _mm256_slli_epi32(
+                _mm256_add_epi32(_mm256_sub_epi32(n_int, n_half), bias),
+                23);
+        p = _mm256_mul_ps(p, _mm256_castsi256_ps(pow2_half));
+        p = _mm256_mul_ps(p, _mm256_castsi256_ps(pow2_rest));
+
+        p = _mm256_blendv_ps(p, _mm256_set1_ps(INFINITY), is_huge);
+        p = _mm256_andnot_ps(is_tiny, p);
+
+        return _mm256_blendv_ps(p, x_in, is_nan);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256
+vec_sigmoid_avx2(__m256 x)
+{
+        __m256 one = _mm256_set1_ps(1.0f);
+        __m256 exp_neg_x = vec_exp_avx2(_mm256_sub_ps(_mm256_setzero_ps(), x));
+
+        return _mm256_div_ps(one, _mm256_add_ps(one, exp_neg_x));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256
+vec_tanh_avx2(__m256 x)
+{
+        __m256 sign_mask = _mm256_set1_ps(-0.0f);
+        __m256 abs_x = _mm256_andnot_ps(sign_mask, x);
+
+        /* NOTE(brendan): tanh(|x|) = 1 - 2/(e^(2|x|) + 1). */
+        __m256 one = _mm256_set1_ps(1.0f);
+        __m256 exp_2x = vec_exp_avx2(_mm256_add_ps(abs_x, abs_x));
+        __m256 large = _mm256_sub_ps(
+                one,
+                _mm256_div_ps(_mm256_set1_ps(2.0f),
+                              _mm256_add_ps(exp_2x, one)));
+        large = _mm256_or_ps(large, _mm256_and_ps(sign_mask, x));
+
+        __m256 z = _mm256_mul_ps(x, x);
+        __m256 p = _mm256_set1_ps(VEC_TANH_P0);
+        p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(VEC_TANH_P1));
+        p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(VEC_TANH_P2));
+        p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(VEC_TANH_P3));
+        p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(VEC_TANH_P4));
+        __m256 small = _mm256_fmadd_ps(_mm256_mul_ps(p, z), x, x);
+
+        __m256 is_small = _mm256_cmp_ps(abs_x,
+                                        _mm256_set1_ps(VEC_TANH_SMALL),
+                                        _CMP_LT_OQ);
+
+        return _mm256_blendv_ps(large, small, is_small);
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256
+vec_gelu_avx2(__m256 x)
+{
+        __m256 x3 = _mm256_mul_ps(_mm256_mul_ps(x, x), x);
+        __m256 inner = _mm256_fmadd_ps(_mm256_set1_ps(VEC_GELU_CUBIC), x3, x);
+        inner = _mm256_mul_ps(inner, _mm256_set1_ps(VEC_GELU_SCALE));
+        __m256 result = _mm256_mul_ps(x, vec_sigmoid_avx2(inner));
+
+        /* NOTE(brendan): -inf*sigmoid(-inf) would be -inf*0 = NaN. */
+        __m256 neg_inf = _mm256_set1_ps(-INFINITY);
+        return _mm256_blendv_ps(result,
+                                _mm256_set1_ps(-0.0f),
+                                _mm256_cmp_ps(x, neg_inf, _CMP_EQ_OQ));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256
+vec_log_avx2(__m256 x)
+{
+        __m256 is_denormal = _mm256_cmp_ps(x,
+                                           _mm256_set1_ps(FLT_MIN),
+                                           _CMP_LT_OQ);
+        __m256 scaled = _mm256_mul_ps(x, _mm256_set1_ps(VEC_LOG_DENORM_SCALE));
+        __m256i bits = _mm256_castps_si256(
+                _mm256_blendv_ps(x, scaled, is_denormal));
+
+        /* NOTE(brendan): Splits x into m in [0.5, 1) and e. */
+        __m256i exponent = _mm256_sub_epi32(_mm256_srli_epi32(bits, 23),
+                                            _mm256_set1_epi32(126));
+        __m256 e = _mm256_cvtepi32_ps(exponent);
+        e = _mm256_sub_ps(e,
+                          _mm256_and_ps(is_denormal, _mm256_set1_ps(23.0f)));
+        __m256 m = _mm256_castsi256_ps(
+                _mm256_or_si256(
+                        _mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)),
+                        _mm256_set1_epi32(0x3F000000)));
+
+        __m256 one = _mm256_set1_ps(1.0f);
+        __m256 is_low = _mm256_cmp_ps(m,
+                                      _mm256_set1_ps(VEC_LOG_SQRTHF),
+                                      _CMP_LT_OQ);
+        e = _mm256_sub_ps(e, _mm256_and_ps(is_low, one));
+        __m256 f = _mm256_add_ps(_mm256_sub_ps(m, one),
+                                 _mm256_and_ps(is_low, m));
+
+        __m256 z = _mm256_mul_ps(f, f);
+        __m256 p = _mm256_set1_ps(VEC_LOG_P0);
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(VEC_LOG_P1));
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(VEC_LOG_P2));
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(VEC_LOG_P3));
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(VEC_LOG_P4));
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(VEC_LOG_P5));
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(VEC_LOG_P6));
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(VEC_LOG_P7));
+        p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(VEC_LOG_P8));
+        p = _mm256_mul_ps(_mm256_mul_ps(p, f), z);
+        p = _mm256_fmadd_ps(e, _mm256_set1_ps(VEC_LN2_LO), p);
+        p = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, p);
+        __m256 result = _mm256_add_ps(f, p);
+        result = _mm256_fmadd_ps(e, _mm256_set1_ps(VEC_LN2_HI), result);
+
+        __m256 zero = _mm256_setzero_ps();
+        __m256 inf = _mm256_set1_ps(INFINITY);
+        result = _mm256_blendv_ps(result,
+                                  inf,
+                                  _mm256_cmp_ps(x, inf, _CMP_EQ_OQ));
+        result = _mm256_blendv_ps(result,
+                                  _mm256_set1_ps(-INFINITY),
+                                  _mm256_cmp_ps(x, zero, _CMP_EQ_OQ));
+
+        return _mm256_blendv_ps(result,
+                                _mm256_set1_ps(NAN),
+                                _mm256_cmp_ps(x, zero, _CMP_NGE_UQ));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256
+vec_gelu_erf_avx2(__m256 x)
+{
+        __m256 one = _mm256_set1_ps(1.0f);
+        __m256 half = _mm256_set1_ps(0.5f);
+        __m256 abs_x = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+        __m256 z = _mm256_mul_ps(abs_x, _mm256_set1_ps(VEC_GELU_ERF_RSQRT2));
+        __m256 t = _mm256_div_ps(
+                one,
+                _mm256_fmadd_ps(z, half, one));
+
+        __m256 q = _mm256_set1_ps(VEC_ERFC_Q0);
+        q = _mm256_fmadd_ps(q, t, _mm256_set1_ps(VEC_ERFC_Q1));
+        q = _mm256_fmadd_ps(q, t, _mm256_set1_ps(VEC_ERFC_Q2));
+        q = _mm256_fmadd_ps(q, t, _mm256_set1_ps(VEC_ERFC_Q3));
+        q = _mm256_fmadd_ps(q, t, _mm256_set1_ps(VEC_ERFC_Q4));
+        q = _mm256_fmadd_ps(q, t, _mm256_set1_ps(VEC_ERFC_Q5));
+        q = _mm256_fmadd_ps(q, t, _mm256_set1_ps(VEC_ERFC_Q6));
+        q = _mm256_fmadd_ps(q, t, _mm256_set1_ps(VEC_ERFC_Q7));
+        q = _mm256_fmadd_ps(q, t, _mm256_set1_ps(VEC_ERFC_Q8));
+        q = _mm256_fmadd_ps(q, t, _mm256_set1_ps(VEC_ERFC_Q9));
+
+        /* NOTE(brendan): z^2 = x^2/2 = z2 + z2_lo exactly. */
+        __m256 x2 = _mm256_mul_ps(x, x);
+        __m256 z2 = _mm256_mul_ps(x2, half);
+        __m256 z2_lo = _mm256_mul_ps(_mm256_fmsub_ps(x, x, x2), half);
+        __m256 exp_z2 = vec_exp_avx2(_mm256_sub_ps(_mm256_setzero_ps(), z2));
+        __m256 exp_q = vec_exp_avx2(_mm256_sub_ps(q, z2_lo));
+        __m256 half_erfc = _mm256_mul_ps(
+                _mm256_mul_ps(_mm256_mul_ps(t, half), exp_q),
+                exp_z2);
+        half_erfc = _mm256_andnot_ps(
+                _mm256_cmp_ps(z2,
+                              _mm256_set1_ps(-VEC_EXP_MIN),
+                              _CMP_GT_OQ),
+                half_erfc);
+
+        __m256 is_neg = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ);
+        __m256 phi = _mm256_blendv_ps(_mm256_sub_ps(one, half_erfc),
+                                      half_erfc,
+                                      is_neg);
+        __m256 result = _mm256_mul_ps(x, phi);
+
+        __m256 neg_inf = _mm256_set1_ps(-INFINITY);
+        return _mm256_blendv_ps(result,
+                                _mm256_set1_ps(-0.0f),
+                                _mm256_cmp_ps(x, neg_inf, _CMP_EQ_OQ));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256
+vec_activation_avx2(__m256 x, enum rot_activation activation)
+{
+        switch (activation) {
+        case ROT_ACTIVATION_RELU:
+                return _mm256_max_ps(x, _mm256_setzero_ps());
+        case ROT_ACTIVATION_SIGMOID:
+                return vec_sigmoid_avx2(x);
+        case ROT_ACTIVATION_TANH:
+                return vec_tanh_avx2(x);
+        case ROT_ACTIVATION_GELU:
+                return vec_gelu_avx2(x);
+        case ROT_ACTIVATION_GELU_ERF:
+                return vec_gelu_erf_avx2(x);
+        default:
+                return x;
+        }
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256
+vec_unary_avx2(__m256 x, enum rot_unary_op op)
+{
+        switch (op) {
+        case ROT_UNARY_RELU:
+                return _mm256_max_ps(x, _mm256_setzero_ps());
+        case ROT_UNARY_EXP:
+                return vec_exp_avx2(x);
+        case ROT_UNARY_LOG:
+                return vec_log_avx2(x);
+        case ROT_UNARY_SIGMOID:
+                return vec_sigmoid_avx2(x);
+        case ROT_UNARY_TANH:
+                return vec_tanh_avx2(x);
+        case ROT_UNARY_GELU:
+                return vec_gelu_avx2(x);
+        case ROT_UNARY_GELU_ERF:
+                return vec_gelu_erf_avx2(x);
+        default:
+                return x;
+        }
+}
+
+__attribute__((target("avx512f")))
+static inline __m512
+vec_exp_avx512(__m512 x)
+{
+        __mmask16 is_nan = _mm512_cmp_ps_mask(x, x, _CMP_UNORD_Q);
+        __mmask16 is_tiny = _mm512_cmp_ps_mask(x,
+                                               _mm512_set1_ps(VEC_EXP_MIN),
+                                               _CMP_LT_OQ);
+        __mmask16 is_huge = _mm512_cmp_ps_mask(x,
+                                               _mm512_set1_ps(VEC_EXP_MAX),
+                                               _CMP_GT_OQ);
+        __m512 x_in = x;
+        x = _mm512_min_ps(x, _mm512_set1_ps(VEC_EXP_MAX));
+        x = _mm512_max_ps(x, _mm512_set1_ps(VEC_EXP_MIN));
+
+        __m512 n = _mm512_roundscale_ps(
+                _mm512_mul_ps(x, _mm512_set1_ps(VEC_LOG2E)),
+                _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m512 r = _mm512_fnmadd_ps(n, _mm512_set1_ps(VEC_LN2_HI), x);
+        r = _mm512_fnmadd_ps(n, _mm512_set1_ps(VEC_LN2_LO), r);
+
+        __m512 p = _mm512_set1_ps(VEC_EXP_P0);
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(VEC_EXP_P1));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(VEC_EXP_P2));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(VEC_EXP_P3));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(VEC_EXP_P4));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(VEC_EXP_P5));
+        p = _mm512_fmadd_ps(p, _mm512_mul_ps(r, r), r);
+        p = _mm512_add_ps(p, _mm512_set1_ps(1.0f));
+        p = _mm512_scalef_ps(p, n);
+
+        p = _mm512_mask_blend_ps(is_huge, p, _mm512_set1_ps(INFINITY));
+        p = _mm512_mask_blend_ps(is_tiny, p, _mm512_setzero_ps());
+
+        return _mm512_mask_blend_ps(is_nan, p, x_in);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512
+vec_sigmoid_avx512(__m512 x)
+{
+        __m512 one = _mm512_set1_ps(1.0f);
+        __m512 neg_x = _mm512_sub_ps(_mm512_setzero_ps(), x);
+        __m512 exp_neg_x = vec_exp_avx512(neg_x);
+
+        return _mm512_div_ps(one, _mm512_add_ps(one, exp_neg_x));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512
+vec_tanh_avx512(__m512 x)
+{
+        __m512 abs_x = _mm512_abs_ps(x);
+
+        /* NOTE(brendan): tanh(|x|) = 1 - 2/(e^(2|x|) + 1). */
+        __m512 one = _mm512_set1_ps(1.0f);
+        __m512 exp_2x = vec_exp_avx512(_mm512_add_ps(abs_x, abs_x));
+        __m512 large = _mm512_sub_ps(
+                one,
+                _mm512_div_ps(_mm512_set1_ps(2.0f),
+                              _mm512_add_ps(exp_2x, one)));
+        __m512i sign = _mm512_and_epi32(_mm512_castps_si512(x),
+                                        _mm512_set1_epi32(0x80000000));
+        large = _mm512_castsi512_ps(
+                _mm512_or_epi32(_mm512_castps_si512(large), sign));
+
+        __m512 z = _mm512_mul_ps(x, x);
+        __m512 p = _mm512_set1_ps(VEC_TANH_P0);
+        p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(VEC_TANH_P1));
+        p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(VEC_TANH_P2));
+        p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(VEC_TANH_P3));
+        p = _mm512_fmadd_ps(p, z, _mm512_set1_ps(VEC_TANH_P4));
+        __m512 small = _mm512_fmadd_ps(_mm512_mul_ps(p, z), x, x);
+
+        __mmask16 is_small = _mm512_cmp_ps_mask(abs_x,
+                                                _mm512_set1_ps(VEC_TANH_SMALL),
+                                                _CMP_LT_OQ);
+
+        return _mm512_mask_blend_ps(is_small, large, small);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512
+vec_gelu_avx512(__m512 x)
+{
+        __m512 x3 = _mm512_mul_ps(_mm512_mul_ps(x, x), x);
+        __m512 inner = _mm512_fmadd_ps(_mm512_set1_ps(VEC_GELU_CUBIC), x3, x);
+        inner = _mm512_mul_ps(inner, _mm512_set1_ps(VEC_GELU_SCALE));
+        __m512 result = _mm512_mul_ps(x, vec_sigmoid_avx512(inner));
+
+        /* NOTE(brendan): -inf*sigmoid(-inf) would be -inf*0 = NaN. */
+        __mmask16 is_neg_inf = _mm512_cmp_ps_mask(x,
+                                                  _mm512_set1_ps(-INFINITY),
+                                                  _CMP_EQ_OQ);
+        return _mm512_mask_blend_ps(is_neg_inf,
+                                    result,
+                                    _mm512_set1_ps(-0.0f));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512
+vec_log_avx512(__m512 x)
+{
+        /**
+         * NOTE(brendan): getexp and getmant handle denormals, and give
+         * m in [0.5, 1) and e - 1.
+         */
+        __m512 e = _mm512_add_ps(_mm512_getexp_ps(x), _mm512_set1_ps(1.0f));
+        __m512 m = _mm512_getmant_ps(x, _MM_MANT_NORM_p5_1, _MM_MANT_SIGN_zero);
+
+        __m512 one = _mm512_set1_ps(1.0f);
+        __mmask16 is_low = _mm512_cmp_ps_mask(m,
+                                              _mm512_set1_ps(VEC_LOG_SQRTHF),
+                                              _CMP_LT_OQ);
+        e = _mm512_mask_sub_ps(e, is_low, e, one);
+        __m512 f = _mm512_sub_ps(m, one);
+        f = _mm512_mask_add_ps(f, is_low, f, m);
+
+        __m512 z = _mm512_mul_ps(f, f);
+        __m512 p = _mm512_set1_ps(VEC_LOG_P0);
+        p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(VEC_LOG_P1));
+        p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(VEC_LOG_P2));
+        p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(VEC_LOG_P3));
+        p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(VEC_LOG_P4));
+        p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(VEC_LOG_P5));
+        p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(VEC_LOG_P6));
+        p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(VEC_LOG_P7));
+        p = _mm512_fmadd_ps(p, f, _mm512_set1_ps(VEC_LOG_P8));
+        p = _mm512_mul_ps(_mm512_mul_ps(p, f), z);
+        p = _mm512_fmadd_ps(e, _mm512_set1_ps(VEC_LN2_LO), p);
+        p = _mm512_fnmadd_ps(_mm512_set1_ps(0.5f), z, p);
+        __m512 result = _mm512_add_ps(f, p);
+        result = _mm512_fmadd_ps(e, _mm512_set1_ps(VEC_LN2_HI), result);
+
+        __m512 zero = _mm512_setzero_ps();
+        __m512 inf = _mm512_set1_ps(INFINITY);
+        result = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, inf, _CMP_EQ_OQ),
+                                      result,
+                                      inf);
+        result = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, zero, _CMP_EQ_OQ),
+                                      result,
+                                      _mm512_set1_ps(-INFINITY));
+
+        return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(x, zero, _CMP_NGE_UQ),
+                                    result,
+                                    _mm512_set1_ps(NAN));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512
+vec_gelu_erf_avx512(__m512 x)
+{
+        __m512 one = _mm512_set1_ps(1.0f);
+        __m512 half = _mm512_set1_ps(0.5f);
+        __m512 z = _mm512_mul_ps(_mm512_abs_ps(x),
+                                 _mm512_set1_ps(VEC_GELU_ERF_RSQRT2));
+        __m512 t = _mm512_div_ps(
+                one,
+                _mm512_fmadd_ps(z, half, one));
+
+        __m512 q = _mm512_set1_ps(VEC_ERFC_Q0);
+        q = _mm512_fmadd_ps(q, t, _mm512_set1_ps(VEC_ERFC_Q1));
+        q = _mm512_fmadd_ps(q, t, _mm512_set1_ps(VEC_ERFC_Q2));
+        q = _mm512_fmadd_ps(q, t, _mm512_set1_ps(VEC_ERFC_Q3));
+        q = _mm512_fmadd_ps(q, t, _mm512_set1_ps(VEC_ERFC_Q4));
+        q = _mm512_fmadd_ps(q, t, _mm512_set1_ps(VEC_ERFC_Q5));
+        q = _mm512_fmadd_ps(q, t, _mm512_set1_ps(VEC_ERFC_Q6));
+        q = _mm512_fmadd_ps(q, t, _mm512_set1_ps(VEC_ERFC_Q7));
+        q = _mm512_fmadd_ps(q, t, _mm512_set1_ps(VEC_ERFC_Q8));
+        q = _mm512_fmadd_ps(q, t, _mm512_set1_ps(VEC_ERFC_Q9));
+
+        /* NOTE(brendan): z^2 = x^2/2 = z2 + z2_lo exactly. */
+        __m512 x2 = _mm512_mul_ps(x, x);
+        __m512 z2 = _mm512_mul_ps(x2, half);
+        __m512 z2_lo = _mm512_mul_ps(_mm512_fmsub_ps(x, x, x2), half);
+        __m512 exp_z2 = vec_exp_avx512(_mm512_sub_ps(_mm512_setzero_ps(), z2));
+        __m512 exp_q = vec_exp_avx512(_mm512_sub_ps(q, z2_lo));
+        __m512 half_erfc = _mm512_mul_ps(
+                _mm512_mul_ps(_mm512_mul_ps(t, half), exp_q),
+                exp_z2);
+        __mmask16 is_tiny = _mm512_cmp_ps_mask(z2,
+                                               _mm512_set1_ps(-VEC_EXP_MIN),
+                                               _CMP_GT_OQ);
+        half_erfc = _mm512_mask_blend_ps(is_tiny,
+                                         half_erfc,
+                                         _mm512_setzero_ps());
+
+        __mmask16 is_neg = _mm512_cmp_ps_mask(x,
+                                              _mm512_setzero_ps(),
+                                              _CMP_LT_OQ);
+        __m512 phi = _mm512_mask_blend_ps(is_neg,
+                                          _mm512_sub_ps(one, half_erfc),
+                                          half_erfc);
+        __m512 result = _mm512_mul_ps(x, phi);
+
+        __mmask16 is_neg_inf = _mm512_cmp_ps_mask(x,
+                                                  _mm512_set1_ps(-INFINITY),
+                                                  _CMP_EQ_OQ);
+        return _mm512_mask_blend_ps(is_neg_inf,
+                                    result,
+                                    _mm512_set1_ps(-0.0f));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512
+vec_activation_avx512(__m512 x, enum rot_activation activation)
+{
+        switch (activation) {
+        case ROT_ACTIVATION_RELU:
+                return _mm512_max_ps(x, _mm512_setzero_ps());
+        case ROT_ACTIVATION_SIGMOID:
+                return vec_sigmoid_avx512(x);
+        case ROT_ACTIVATION_TANH:
+                return vec_tanh_avx512(x);
+        case ROT_ACTIVATION_GELU:
+                return vec_gelu_avx512(x);
+        case ROT_ACTIVATION_GELU_ERF:
+                return vec_gelu_erf_avx512(x);
+        default:
+                return x;
+        }
+}
+
+__attribute__((target("avx512f")))
+static inline __m512
+vec_unary_avx512(__m512 x, enum rot_unary_op op)
+{
+        switch (op) {
+        case ROT_UNARY_RELU:
+                return _mm512_max_ps(x, _mm512_setzero_ps());
+        case ROT_UNARY_EXP:
+                return vec_exp_avx512(x);
+        case ROT_UNARY_LOG:
+                return vec_log_avx512(x);
+        case ROT_UNARY_SIGMOID:
+                return vec_sigmoid_avx512(x);
+        case ROT_UNARY_TANH:
+                return vec_tanh_avx512(x);
+        case ROT_UNARY_GELU:
+                return vec_gelu_avx512(x);
+        case ROT_UNARY_GELU_ERF:
+                return vec_gelu_erf_avx512(x);
+        default:
+                return x;
+        }
+}
+
+#endif /* MATH_VEC_MATH_H */
@@ -19,11 +19,23 @@
 
 #include "rot_arena.h"
 #include "error/log_error.h"
+#include "platform/thread.h"  /* for parallel_for */
 
 #include <stdint.h>
+#include <sys/mman.h>         /* for madvise, mmap, munmap */
 
 #define ROT_ARENA_MIN_BYTES (sizeof(struct rot_arena) + 8)
+#define ARENA_PAGE_BYTES 4096
+#define ARENA_HUGE_PAGE_BYTES (2*1024*1024)
+#define ARENA_PREFAULT_BYTES_PER_TASK (32*ARENA_HUGE_PAGE_BYTES)
 
+/**
+ * NOTE(brendan): Allocation is lock free, so that many threads can allocate
+ * from one arena. Every `used_bytes` counter, CPU and GPU, is only advanced
+ * with a compare-and-swap, so concurrent allocations never overlap. Marking,
+ * rewinding and setting up the GPU region are not synchronised with
+ * allocation, and must not run concurrently with it.
+ */
 struct rot_arena_cpu {
         size_t mem_bytes;
         size_t used_bytes;
@@ -36,16 +48,46 @@ struct rot_arena_gpu {
         size_t *used_bytes;
 };
 
+/**
+ * struct rot_arena - Memory arena.
+ * @mapped_bytes: Size of the mapping holding the arena if it was created by
+ * ROT_arena_map, otherwise zero.
+ */
 struct rot_arena {
         struct rot_arena_cpu cpu;
         struct rot_arena_gpu gpu;
+        size_t mapped_bytes;
+};
+
+/**
+ * align_up() - Rounds `value` up to a multiple of `align`, a power of two.
+ */
+static size_t
+align_up(size_t value, size_t align)
+{
+        return (value + align - 1) & ~(align - 1);
+}
+
+/**
+ * struct rot_arena_mark - Snapshot of an arena's allocation state.
+ * @cpu_used_bytes: CPU region used bytes, from before the mark itself was
+ * allocated.
+ * @num_gpu_blocks: Number of GPU blocks when the mark was taken.
+ * @gpu_used_bytes: Used bytes of each of the `num_gpu_blocks` GPU blocks.
+ */
+struct rot_arena_mark {
+        size_t cpu_used_bytes;
+        uint32_t num_gpu_blocks;
+        size_t gpu_used_bytes[];
 };
 
 static bool
 arena_cpu_can_alloc(const struct rot_arena_cpu *arena_cpu,
                     size_t request_bytes)
 {
-        return request_bytes <= (arena_cpu->mem_bytes - arena_cpu->used_bytes);
+        size_t used_bytes = __atomic_load_n(&arena_cpu->used_bytes,
+                                            __ATOMIC_RELAXED);
+        return request_bytes <= (arena_cpu->mem_bytes - used_bytes);
 }
 
 /**
@@ -64,9 +106,10 @@ arena_gpu_can_alloc(const struct rot_arena_gpu *arena_gpu,
         for (uint32_t block_i = 0;
              block_i < arena_gpu->num_blocks;
              ++block_i) {
-                size_t avail_bytes = (arena_gpu->block_bytes -
-                                      arena_gpu->used_bytes[block_i]);
-                if (avail_bytes >= request_bytes)
+                size_t used_bytes =
+                        __atomic_load_n(arena_gpu->used_bytes + block_i,
+                                        __ATOMIC_RELAXED);
+                if (arena_gpu->block_bytes - used_bytes >= request_bytes)
                         return true;
         }
 
@@ -93,20 +136,55 @@ bool ROT_arena_can_alloc(const rot_arena_t arena,
         }
 }
 
+/**
+ * arena_cpu_malloc() - Bumps the CPU region by `malloc_bytes`, after padding
+ * to `align_bytes`.
+ *
+ * NOTE(brendan): The arena struct sits at the start of the CPU region, so
+ * offsets are relative to `arena`.
+ *
+ * NULL is returned if there is not enough space left.
+ */
 static void *
-arena_cpu_malloc(struct rot_arena_cpu *arena_cpu, size_t malloc_bytes)
+arena_cpu_malloc(struct rot_arena *arena,
+                 size_t malloc_bytes,
+                 size_t align_bytes)
 {
-        void *result = (char *)arena_cpu + arena_cpu->used_bytes;
-
-        arena_cpu->used_bytes += malloc_bytes;
+        struct rot_arena_cpu *arena_cpu = &arena->cpu;
+        size_t used_bytes = __atomic_load_n(&arena_cpu->used_bytes,
+                                            __ATOMIC_RELAXED);
+        for (;;) {
+                size_t offset = (align_up((uintptr_t)arena + used_bytes,
+                                          align_bytes) -
+                                 (uintptr_t)arena);
+                if ((offset > arena_cpu->mem_bytes) ||
+                    (arena_cpu->mem_bytes - offset < malloc_bytes))
+                        return NULL;
 
-        return result;
+                /**
+                 * NOTE(brendan): On failure `used_bytes` is reloaded with
+                 * the value another thread bumped it to, and the request is
+                 * re-aligned from there.
+                 */
+                if (__atomic_compare_exchange_n(&arena_cpu->used_bytes,
+                                                &used_bytes,
+                                                offset + malloc_bytes,
+                                                true,
+                                                __ATOMIC_RELAXED,
+                                                __ATOMIC_RELAXED))
+                        return (char *)arena + offset;
+        }
 }
 
 /**
  * arena_gpu_malloc() - Attempts to allocate `malloc_bytes` from `arena_gpu`.
  * @arena_gpu: GPU arena from which to allocate memory.
  * @malloc_bytes: Number of bytes to allocate.
+ * @align_bytes: Alignment of the allocation's offset into its memory block.
+ *
+ * Blocks are tried in order, and each block's used bytes are bumped with a
+ * compare-and-swap, so racing threads either get disjoint ranges of the same
+ * block or move on to the next block.
  *
  * NULL is returned on error, e.g. if there is no memory block in `arena_gpu`
  * that can be used to satisfy the request.
@@ -114,20 +192,31 @@ arena_cpu_malloc(struct rot_arena_cpu *arena_cpu, size_t malloc_bytes)
  * `arena_gpu` must be checked for NULL by the caller.
  */
 static void *
-arena_gpu_malloc(struct rot_arena_gpu *arena_gpu, size_t malloc_bytes)
+arena_gpu_malloc(struct rot_arena_gpu *arena_gpu,
+                 size_t malloc_bytes,
+                 size_t align_bytes)
 {
         for (uint32_t block_i = 0;
              block_i < arena_gpu->num_blocks;
              ++block_i) {
-                size_t avail_bytes = (arena_gpu->block_bytes -
-                                      arena_gpu->used_bytes[block_i]);
-                if (avail_bytes >= malloc_bytes) {
-                        void *result =
-                                ((char *)arena_gpu->mem_blocks[block_i] +
-                                 arena_gpu->used_bytes[block_i]);
-                        arena_gpu->used_bytes[block_i] += malloc_bytes;
-
-                        return result;
+                size_t *block_used = arena_gpu->used_bytes + block_i;
+                size_t used_bytes = __atomic_load_n(block_used,
+                                                    __ATOMIC_RELAXED);
+                for (;;) {
+                        size_t offset = align_up(used_bytes, align_bytes);
+                        if ((offset > arena_gpu->block_bytes) ||
+                            (arena_gpu->block_bytes - offset < malloc_bytes))
+                                break;
+
+                        if (__atomic_compare_exchange_n(block_used,
+                                                        &used_bytes,
+                                                        offset + malloc_bytes,
+                                                        true,
+                                                        __ATOMIC_RELAXED,
+                                                        __ATOMIC_RELAXED)) {
+                                return ((char *)arena_gpu->mem_blocks[block_i] +
+                                        offset);
+                        }
                 }
         }
 
@@ -138,24 +227,108 @@ void *ROT_arena_malloc(rot_arena_t arena,
                        size_t malloc_bytes,
                        enum rot_backend backend)
 {
-        /**
-         * NOTE(brendan): `arena is checked for NULL in `ROT_arena_can_alloc`.
-         */
-        if (!ROT_arena_can_alloc(arena, malloc_bytes, backend)) {
-                LOG_ERROR("Not enough space in arena to malloc.");
+        return ROT_arena_malloc_aligned(arena, malloc_bytes, 1, backend);
+}
+
+void *ROT_arena_malloc_aligned(rot_arena_t arena,
+                               size_t malloc_bytes,
+                               size_t align_bytes,
+                               enum rot_backend backend)
+{
+        if (arena == NULL) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if ((align_bytes == 0) || ((align_bytes & (align_bytes - 1)) != 0)) {
+                LOG_ERROR("Alignment must be a power of two.");
                 return NULL;
         }
 
+        void *result = NULL;
         switch (backend) {
         case ROT_BACKEND_CPU:
-                return arena_cpu_malloc(&arena->cpu, malloc_bytes);
+                result = arena_cpu_malloc(arena, malloc_bytes, align_bytes);
+                break;
         case ROT_BACKEND_CUDA:
         case ROT_BACKEND_ROC:
-                return arena_gpu_malloc(&arena->gpu, malloc_bytes);
+                result = arena_gpu_malloc(&arena->gpu,
+                                          malloc_bytes,
+                                          align_bytes);
+                break;
         default:
                 LOG_UNSUPPORTED();
                 return NULL;
         }
+
+        if (result == NULL)
+                LOG_ERROR("Not enough space in arena to malloc.");
+
+        return result;
+}
+
+rot_arena_mark_t ROT_arena_mark(rot_arena_t arena)
+{
+        if (arena == NULL) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        uint32_t num_gpu_blocks = arena->gpu.num_blocks;
+        size_t mark_bytes = (sizeof(struct rot_arena_mark) +
+                             num_gpu_blocks*sizeof(size_t));
+        struct rot_arena_mark *mark =
+                (struct rot_arena_mark *)ROT_arena_malloc_aligned(
+                        arena,
+                        mark_bytes,
+                        sizeof(size_t),
+                        ROT_BACKEND_CPU);
+        if (mark == NULL)
+                return NULL;
+
+        mark->cpu_used_bytes = (size_t)((char *)mark - (char *)arena);
+        mark->num_gpu_blocks = num_gpu_blocks;
+        for (uint32_t block_i = 0;
+             block_i < num_gpu_blocks;
+             ++block_i) {
+                mark->gpu_used_bytes[block_i] = arena->gpu.used_bytes[block_i];
+        }
+
+        return mark;
+}
+
+rot_arena_t ROT_arena_rewind(rot_arena_t arena, rot_arena_mark_t mark)
+{
+        if ((arena == NULL) || (mark == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        /**
+         * NOTE(brendan): A live mark sits exactly at the CPU used bytes it
+         * saved, below the current used bytes. This catches marks from
+         * another arena, and most marks that were already rewound past.
+         */
+        size_t mark_offset = (size_t)((char *)mark - (char *)arena);
+        if ((mark_offset != mark->cpu_used_bytes) ||
+            (mark_offset >= arena->cpu.used_bytes)) {
+                LOG_ERROR("Mark is not live in this arena.");
+                return NULL;
+        }
+
+        if (mark->num_gpu_blocks != arena->gpu.num_blocks) {
+                LOG_ERROR("Cannot rewind past creation of the GPU arena.");
+                return NULL;
+        }
+
+        for (uint32_t block_i = 0;
+             block_i < mark->num_gpu_blocks;
+             ++block_i) {
+                arena->gpu.used_bytes[block_i] = mark->gpu_used_bytes[block_i];
+        }
+        arena->cpu.used_bytes = mark->cpu_used_bytes;
+
+        return arena;
 }
 
 size_t ROT_arena_min_bytes(void)
@@ -163,6 +336,157 @@ size_t ROT_arena_min_bytes(void)
         return ROT_ARENA_MIN_BYTES;
 }
 
+/**
+ * arena_map_huge() - Maps `map_bytes`, a multiple of ARENA_HUGE_PAGE_BYTES,
+ * backed by huge pages if possible.
+ *
+ * Returns NULL on error.
+ */
+static void *
+arena_map_huge(size_t map_bytes)
+{
+#ifdef MAP_HUGETLB
+        void *memory = mmap(NULL,
+                            map_bytes,
+                            PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                            -1,
+                            0);
+        if (memory != MAP_FAILED)
+                return memory;
+#endif /* MAP_HUGETLB */
+
+        /**
+         * NOTE(brendan): The hugetlb pool is usually empty unless the admin
+         * reserved pages, so fall back to transparent huge pages. The kernel
+         * only backs 2 MB aligned ranges with huge pages, so over-map by one
+         * huge page and trim both ends to align the start.
+         */
+        size_t over_bytes = map_bytes + ARENA_HUGE_PAGE_BYTES;
+        char *raw = (char *)mmap(NULL,
+                                 over_bytes,
+                                 PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS,
+                                 -1,
+                                 0);
+        if (raw == MAP_FAILED)
+                return NULL;
+
+        char *aligned = (char *)align_up((uintptr_t)raw, ARENA_HUGE_PAGE_BYTES);
+        size_t head_bytes = aligned - raw;
+        size_t tail_bytes = over_bytes - head_bytes - map_bytes;
+        if (head_bytes > 0)
+                munmap(raw, head_bytes);
+        if (tail_bytes > 0)
+                munmap(aligned + map_bytes, tail_bytes);
+
+#ifdef MADV_HUGEPAGE
+        /* NOTE(brendan): Only advice, so this still works with THP off. */
+        madvise(aligned, map_bytes, MADV_HUGEPAGE);
+#endif /* MADV_HUGEPAGE */
+
+        return aligned;
+}
+
+/**
+ * struct arena_prefault - Memory to fault in, in tasks of
+ * ARENA_PREFAULT_BYTES_PER_TASK.
+ */
+struct arena_prefault {
+        char *memory;
+        size_t mem_bytes;
+};
+
+static void
+arena_prefault_task(void *context, size_t task_i)
+{
+        const struct arena_prefault *prefault =
+                (const struct arena_prefault *)context;
+
+        size_t start = task_i*ARENA_PREFAULT_BYTES_PER_TASK;
+        size_t end = start + ARENA_PREFAULT_BYTES_PER_TASK;
+        if (end > prefault->mem_bytes)
+                end = prefault->mem_bytes;
+
+        /**
+         * NOTE(brendan): Fresh anonymous memory is already zero, so writing a
+         * zero to every page faults it in without changing its contents.
+         */
+        for (size_t offset = start;
+             offset < end;
+             offset += ARENA_PAGE_BYTES) {
+                ((volatile char *)prefault->memory)[offset] = 0;
+        }
+}
+
+rot_arena_t ROT_arena_map(size_t mem_bytes, uint32_t flags)
+{
+        /**
+         * NOTE(brendan): Leaves room to round up to a huge page, and for
+         * arena_map_huge to over-map by one more.
+         */
+        if (mem_bytes > SIZE_MAX - 2*ARENA_HUGE_PAGE_BYTES) {
+                LOG_ERROR("Arena size is too large to map.");
+                return NULL;
+        }
+
+        size_t map_bytes = align_up(mem_bytes, ARENA_HUGE_PAGE_BYTES);
+        if (map_bytes < ROT_ARENA_MIN_BYTES)
+                map_bytes = ARENA_HUGE_PAGE_BYTES;
+
+        void *memory;
+        if (flags & ROT_ARENA_HUGE_PAGES) {
+                memory = arena_map_huge(map_bytes);
+        } else {
+                memory = mmap(NULL,
+                              map_bytes,
+                              PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS,
+                              -1,
+                              0);
+                if (memory == MAP_FAILED)
+                        memory = NULL;
+        }
+
+        if (memory == NULL) {
+                LOG_ERROR("Mapping arena memory failed.");
+                return NULL;
+        }
+
+        if (flags & ROT_ARENA_PREFAULT) {
+                struct arena_prefault prefault = {.memory = (char *)memory,
+                                                  .mem_bytes = map_bytes};
+                size_t num_tasks = ((map_bytes +
+                                     ARENA_PREFAULT_BYTES_PER_TASK - 1)/
+                                    ARENA_PREFAULT_BYTES_PER_TASK);
+                parallel_for(num_tasks, arena_prefault_task, &prefault);
+        }
+
+        struct rot_arena *arena = ROT_arena_new(memory, map_bytes);
+        if (arena == NULL) {
+                munmap(memory, map_bytes);
+                return NULL;
+        }
+        arena->mapped_bytes = map_bytes;
+
+        return arena;
+}
+
+void ROT_arena_unmap(rot_arena_t arena)
+{
+        if (arena == NULL) {
+                LOG_NULL();
+                return;
+        }
+
+        if (arena->mapped_bytes == 0) {
+                LOG_ERROR("Arena memory is owned by the caller.");
+                return;
+        }
+
+        munmap(arena, arena->mapped_bytes);
+}
+
 struct rot_arena *
 ROT_arena_gpu_new(struct rot_arena *arena,
                   void **memory,
@@ -227,6 +551,7 @@ rot_arena_t ROT_arena_new(void *memory, size_t mem_bytes)
         arena->gpu.mem_blocks = NULL;
         arena->gpu.num_blocks = 0;
         arena->gpu.used_bytes = NULL;
+        arena->mapped_bytes = 0;
 
         return (struct rot_arena *)memory;
 }
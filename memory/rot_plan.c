@@ -0,0 +1,386 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "rot_plan.h"
+#include "error/log_error.h"  /* for LOG_ERROR, LOG_NULL */
+#include "math/size_math.h"   /* for round_up */
+#include "math/tensor.h"      /* for rot_tensor, tensor_create_unallocated */
+
+#include <stdint.h>           /* for SIZE_MAX */
+#include <stdlib.h>           /* for qsort */
+
+#define PLAN_ALIGN_BYTES 64
+#define PLAN_NO_OP UINT32_MAX
+
+/**
+ * struct plan_tensor - A planned tensor.
+ * @tensor: The tensor, whose data pointer is set by ROT_plan_allocate.
+ * @bytes: Size of the tensor's data, rounded up to PLAN_ALIGN_BYTES.
+ * @first_op, @last_op: Lifetime of the tensor, as the indices of the first
+ * and last recorded ops that use it. PLAN_NO_OP if no op uses the tensor.
+ * @offset: Offset of the tensor's data in the planned region.
+ * @is_kept: Must the tensor stay alive until the end of the graph?
+ */
+struct plan_tensor {
+        struct rot_tensor *tensor;
+        size_t bytes;
+        uint32_t first_op;
+        uint32_t last_op;
+        size_t offset;
+        bool is_kept;
+};
+
+/**
+ * struct rot_plan - A static memory plan.
+ * @by_size: Scratch array of every planned tensor, sorted by decreasing size
+ * during allocation.
+ * @placed: Scratch array of the tensors placed so far during allocation,
+ * sorted by increasing offset.
+ */
+struct rot_plan {
+        rot_arena_t arena;
+        struct plan_tensor *tensors;
+        uint32_t num_tensors;
+        uint32_t max_tensors;
+        uint32_t num_ops;
+        struct plan_tensor **by_size;
+        struct plan_tensor **placed;
+        size_t peak_bytes;
+        size_t bump_bytes;
+        bool is_allocated;
+};
+
+static size_t
+plan_align(size_t bytes)
+{
+        return (bytes + PLAN_ALIGN_BYTES - 1) & ~(size_t)(PLAN_ALIGN_BYTES - 1);
+}
+
+/**
+ * plan_find_tensor() - Returns the planned tensor for `tensor`, or NULL if
+ * `tensor` is not planned by `plan`.
+ */
+static struct plan_tensor *
+plan_find_tensor(struct rot_plan *plan, const struct rot_tensor *tensor)
+{
+        for (uint32_t tensor_i = 0;
+             tensor_i < plan->num_tensors;
+             ++tensor_i) {
+                if (plan->tensors[tensor_i].tensor == tensor)
+                        return plan->tensors + tensor_i;
+        }
+
+        return NULL;
+}
+
+rot_plan_t ROT_plan_new(rot_arena_t arena, uint32_t max_tensors)
+{
+        if (arena == NULL) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        /**
+         * NOTE(brendan): struct plan_tensor is the largest element of the
+         * plan's arrays, so bounds the size of each.
+         */
+        if ((max_tensors == 0) ||
+            (max_tensors > SIZE_MAX/sizeof(struct plan_tensor))) {
+                LOG_ERROR("Plan must hold at least one tensor, and few enough "
+                          "for its arrays to be sized.");
+                return NULL;
+        }
+
+        struct rot_plan *plan = (struct rot_plan *)ROT_arena_malloc(
+                arena,
+                sizeof(struct rot_plan),
+                ROT_BACKEND_CPU);
+        if (plan == NULL)
+                return NULL;
+
+        plan->tensors = (struct plan_tensor *)ROT_arena_malloc(
+                arena,
+                max_tensors*sizeof(struct plan_tensor),
+                ROT_BACKEND_CPU);
+        plan->by_size = (struct plan_tensor **)ROT_arena_malloc(
+                arena,
+                max_tensors*sizeof(struct plan_tensor *),
+                ROT_BACKEND_CPU);
+        plan->placed = (struct plan_tensor **)ROT_arena_malloc(
+                arena,
+                max_tensors*sizeof(struct plan_tensor *),
+                ROT_BACKEND_CPU);
+        if ((plan->tensors == NULL) ||
+            (plan->by_size == NULL) ||
+            (plan->placed == NULL))
+                return NULL;
+
+        plan->arena = arena;
+        plan->num_tensors = 0;
+        plan->max_tensors = max_tensors;
+        plan->num_ops = 0;
+        plan->peak_bytes = 0;
+        plan->bump_bytes = 0;
+        plan->is_allocated = false;
+
+        return plan;
+}
+
+rot_tensor_t ROT_plan_create_tensor(rot_plan_t plan,
+                                    uint32_t num_dims,
+                                    const size_t *dims)
+{
+        if (plan == NULL) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (plan->is_allocated || (plan->num_tensors >= plan->max_tensors)) {
+                LOG_ERROR("Cannot add more tensors to memory plan.");
+                return NULL;
+        }
+
+        struct rot_tensor *tensor = tensor_create_unallocated(plan->arena,
+                                                              num_dims,
+                                                              dims);
+        if (tensor == NULL)
+                return NULL;
+
+        struct plan_tensor *planned = plan->tensors + plan->num_tensors;
+        planned->tensor = tensor;
+        planned->bytes = plan_align(ROT_tensor_get_size(tensor));
+        planned->first_op = PLAN_NO_OP;
+        planned->last_op = PLAN_NO_OP;
+        planned->offset = 0;
+        planned->is_kept = false;
+        ++plan->num_tensors;
+
+        /**
+         * NOTE(brendan): ROT_create_tensor aligns each tensor's data, so
+         * separate allocations are padded just as planned ones are.
+         */
+        plan->bump_bytes += round_up(ROT_tensor_get_size(tensor),
+                                     TENSOR_DEFAULT_ALIGN_BYTES);
+
+        return tensor;
+}
+
+rot_plan_t ROT_plan_record_op(rot_plan_t plan,
+                              const rot_tensor_t *tensors,
+                              uint32_t num_tensors)
+{
+        if ((plan == NULL) || ((num_tensors > 0) && (tensors == NULL))) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (plan->is_allocated) {
+                LOG_ERROR("Cannot record ops after the plan is allocated.");
+                return NULL;
+        }
+
+        for (uint32_t tensor_i = 0;
+             tensor_i < num_tensors;
+             ++tensor_i) {
+                struct plan_tensor *planned =
+                        plan_find_tensor(plan, tensors[tensor_i]);
+                if (planned == NULL)
+                        continue;
+
+                if (planned->first_op == PLAN_NO_OP)
+                        planned->first_op = plan->num_ops;
+                planned->last_op = plan->num_ops;
+        }
+
+        ++plan->num_ops;
+
+        return plan;
+}
+
+rot_plan_t ROT_plan_keep(rot_plan_t plan, const rot_tensor_t tensor)
+{
+        if ((plan == NULL) || (tensor == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        struct plan_tensor *planned = plan_find_tensor(plan, tensor);
+        if (planned == NULL) {
+                LOG_ERROR("Tensor is not part of the memory plan.");
+                return NULL;
+        }
+
+        planned->is_kept = true;
+
+        return plan;
+}
+
+/**
+ * plan_compare_size() - Orders planned tensors by decreasing size, breaking
+ * ties by lifetime so that the plan is deterministic.
+ */
+static int
+plan_compare_size(const void *a, const void *b)
+{
+        const struct plan_tensor *tensor_a = *(struct plan_tensor *const *)a;
+        const struct plan_tensor *tensor_b = *(struct plan_tensor *const *)b;
+
+        if (tensor_a->bytes != tensor_b->bytes)
+                return (tensor_a->bytes > tensor_b->bytes) ? -1 : 1;
+        if (tensor_a->first_op != tensor_b->first_op)
+                return (tensor_a->first_op < tensor_b->first_op) ? -1 : 1;
+
+        return 0;
+}
+
+static bool
+plan_lifetimes_intersect(const struct plan_tensor *a,
+                         const struct plan_tensor *b)
+{
+        return (a->first_op <= b->last_op) && (b->first_op <= a->last_op);
+}
+
+/**
+ * plan_place() - Places `tensor` at the lowest offset where it fits between
+ * the `num_placed` tensors placed so far whose lifetimes intersect its own,
+ * then inserts it into `placed`, which is sorted by offset.
+ */
+static void
+plan_place(struct plan_tensor *tensor,
+           struct plan_tensor **placed,
+           uint32_t num_placed)
+{
+        size_t offset = 0;
+        uint32_t insert_i = num_placed;
+        for (uint32_t placed_i = 0;
+             placed_i < num_placed;
+             ++placed_i) {
+                const struct plan_tensor *other = placed[placed_i];
+                if (!plan_lifetimes_intersect(tensor, other))
+                        continue;
+
+                if (offset + tensor->bytes <= other->offset)
+                        break;
+
+                size_t other_end = other->offset + other->bytes;
+                if (other_end > offset)
+                        offset = other_end;
+        }
+        tensor->offset = offset;
+
+        for (uint32_t placed_i = 0;
+             placed_i < num_placed;
+             ++placed_i) {
+                if (placed[placed_i]->offset > offset) {
+                        insert_i = placed_i;
+                        break;
+                }
+        }
+
+        for (uint32_t placed_i = num_placed;
+             placed_i > insert_i;
+             --placed_i) {
+                placed[placed_i] = placed[placed_i - 1];
+        }
+        placed[insert_i] = tensor;
+}
+
+rot_plan_t ROT_plan_allocate(rot_plan_t plan)
+{
+        if (plan == NULL) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (plan->is_allocated) {
+                LOG_ERROR("Memory plan is already allocated.");
+                return NULL;
+        }
+
+        for (uint32_t tensor_i = 0;
+             tensor_i < plan->num_tensors;
+             ++tensor_i) {
+                struct plan_tensor *planned = plan->tensors + tensor_i;
+                if (planned->first_op == PLAN_NO_OP)
+                        planned->first_op = 0;
+                if ((planned->last_op == PLAN_NO_OP) || planned->is_kept)
+                        planned->last_op = UINT32_MAX;
+
+                plan->by_size[tensor_i] = planned;
+        }
+
+        qsort(plan->by_size,
+              plan->num_tensors,
+              sizeof(struct plan_tensor *),
+              plan_compare_size);
+
+        size_t peak_bytes = 0;
+        for (uint32_t tensor_i = 0;
+             tensor_i < plan->num_tensors;
+             ++tensor_i) {
+                struct plan_tensor *planned = plan->by_size[tensor_i];
+                plan_place(planned, plan->placed, tensor_i);
+
+                size_t end = planned->offset + planned->bytes;
+                if (end > peak_bytes)
+                        peak_bytes = end;
+        }
+
+        if (peak_bytes > 0) {
+                char *region = (char *)ROT_arena_malloc_aligned(
+                        plan->arena,
+                        peak_bytes,
+                        PLAN_ALIGN_BYTES,
+                        ROT_BACKEND_CPU);
+                if (region == NULL)
+                        return NULL;
+
+                for (uint32_t tensor_i = 0;
+                     tensor_i < plan->num_tensors;
+                     ++tensor_i) {
+                        struct plan_tensor *planned = plan->tensors + tensor_i;
+                        planned->tensor->cpu.data =
+                                (float *)(region + planned->offset);
+                }
+        }
+
+        plan->peak_bytes = peak_bytes;
+        plan->is_allocated = true;
+
+        return plan;
+}
+
+size_t ROT_plan_get_peak_bytes(const rot_plan_t plan)
+{
+        if (plan == NULL) {
+                LOG_NULL();
+                return 0;
+        }
+
+        return plan->peak_bytes;
+}
+
+size_t ROT_plan_get_bump_bytes(const rot_plan_t plan)
+{
+        if (plan == NULL) {
+                LOG_NULL();
+                return 0;
+        }
+
+        return plan->bump_bytes;
+}
@@ -0,0 +1,718 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "nn/conv.h"
+#include "error/log_error.h"  /* for LOG_ERROR, LOG_NULL */
+#include "math/gemm.h"        /* for gemm_cpu, gemm_epilogue */
+#include "math/size_math.h"   /* for min_size, ceil_div */
+#include "math/tensor.h"      /* for rot_tensor, tensor_is_contiguous */
+#include "platform/context.h" /* for context_get_current, ... */
+#include "platform/thread.h"  /* for parallel_for, thread_get_worker_index */
+
+#include <stdint.h>           /* for uint32_t */
+#include <stdlib.h>           /* for aligned_alloc, free */
+#include <string.h>           /* for memcpy, memset */
+
+/**
+ * NOTE(brendan): Tiles of the im2col matrix hold at most CONV_TILE_BYTES,
+ * which leaves room in L2 for the GEMM's packed panels, except that a tile
+ * always covers at least CONV_MIN_TILE_PIXELS output pixels so that the GEMM
+ * has enough columns (rows, for NHWC) to fill its microkernel.
+ */
+#define CONV_TILE_BYTES (512*1024)
+#define CONV_MIN_TILE_PIXELS 64
+#define CONV_ALIGN_BYTES 64
+
+/**
+ * struct conv_job - A convolution split into tasks, one for each tile of
+ * output pixels of each group of each image.
+ * @is_pointwise: Whether the input is its own im2col matrix, in which case
+ * each image is one tile.
+ */
+struct conv_job {
+        struct conv_shape shape;
+        const struct rot_conv2d_params *params;
+        enum rot_matmul_engine engine;
+        const float *input;
+        const float *filter;
+        const float *bias;
+        float *output;
+        bool is_pointwise;
+        size_t tile_pixels;
+        size_t num_tiles;
+};
+
+float *
+conv_get_scratch(size_t num_floats, rot_arena_t *arena, rot_arena_mark_t *mark)
+{
+        size_t bytes = num_floats*sizeof(float);
+        *arena = context_get_scratch(context_get_current());
+        if ((*arena != NULL) &&
+            ROT_arena_can_alloc(*arena,
+                                bytes + 2*CONV_ALIGN_BYTES,
+                                ROT_BACKEND_CPU)) {
+                *mark = ROT_arena_mark(*arena);
+                void *scratch = ROT_arena_malloc_aligned(*arena,
+                                                         bytes,
+                                                         CONV_ALIGN_BYTES,
+                                                         ROT_BACKEND_CPU);
+                if (scratch != NULL)
+                        return (float *)scratch;
+
+                ROT_arena_rewind(*arena, *mark);
+        }
+
+        *arena = NULL;
+        return (float *)aligned_alloc(CONV_ALIGN_BYTES,
+                                      ceil_div(bytes, CONV_ALIGN_BYTES)*
+                                      CONV_ALIGN_BYTES);
+}
+
+void conv_put_scratch(float *scratch, rot_arena_t arena, rot_arena_mark_t mark)
+{
+        if (arena != NULL)
+                ROT_arena_rewind(arena, mark);
+        else
+                free(scratch);
+}
+
+/**
+ * struct conv_tiles - Arguments to `conv_run_tiles`, run by `parallel_for`.
+ * @scratch: One buffer of `scratch_stride` floats for each of `num_buffers`
+ * workers, or NULL.
+ * @is_failed: Set, atomically since tiles run on different threads, if any
+ * tile fails.
+ */
+struct conv_tiles {
+        conv_tile_fn *tile_fn;
+        void *context;
+        float *scratch;
+        size_t scratch_stride;
+        size_t num_buffers;
+        bool is_failed;
+};
+
+static void
+conv_tiles_task(void *context, size_t task_i)
+{
+        struct conv_tiles *tiles = (struct conv_tiles *)context;
+
+        /**
+         * NOTE(brendan): Tiles spread across the pool run on the calling
+         * thread, as worker zero, and on the pool's own threads. Otherwise
+         * they all run on one thread, which can be a pool thread of any index
+         * if this is a nested parallel region.
+         */
+        size_t worker = thread_get_worker_index();
+        if (worker >= tiles->num_buffers)
+                worker = 0;
+
+        if (!tiles->tile_fn(tiles->context,
+                            task_i,
+                            ((tiles->scratch != NULL) ?
+                             (tiles->scratch + worker*tiles->scratch_stride) :
+                             NULL)))
+                __atomic_store_n(&tiles->is_failed, true, __ATOMIC_RELAXED);
+}
+
+enum conv_run_result conv_run_tiles(enum rot_matmul_engine engine,
+                                    size_t num_tasks,
+                                    size_t scratch_floats,
+                                    conv_tile_fn *tile_fn,
+                                    void *context)
+{
+        /**
+         * NOTE(brendan): As for batched matmuls, with at least one tile per
+         * worker, tiles are spread across threads and each GEMM runs single
+         * threaded. Otherwise the tiles run one after another, each GEMM using
+         * all the threads itself.
+         */
+        const size_t num_workers = thread_get_num_workers();
+        const bool is_parallel = ((engine == ROT_MATMUL_ENGINE_NATIVE) &&
+                                  (num_tasks >= num_workers));
+        const size_t align_floats = CONV_ALIGN_BYTES/sizeof(float);
+        struct conv_tiles tiles = {
+                .tile_fn = tile_fn,
+                .context = context,
+                .scratch = NULL,
+                .scratch_stride = (ceil_div(scratch_floats, align_floats)*
+                                   align_floats),
+                .num_buffers = is_parallel ? num_workers : 1,
+                .is_failed = false};
+
+        rot_arena_t scratch_arena = NULL;
+        rot_arena_mark_t scratch_mark = NULL;
+        if (scratch_floats > 0) {
+                tiles.scratch = conv_get_scratch((tiles.num_buffers*
+                                                  tiles.scratch_stride),
+                                                 &scratch_arena,
+                                                 &scratch_mark);
+                if (tiles.scratch == NULL)
+                        return CONV_RUN_NO_SCRATCH;
+        }
+
+        if (is_parallel) {
+                parallel_for(num_tasks, conv_tiles_task, &tiles);
+        } else {
+                for (size_t task_i = 0;
+                     (task_i < num_tasks) && !tiles.is_failed;
+                     ++task_i) {
+                        tiles.is_failed = !tile_fn(context,
+                                                   task_i,
+                                                   tiles.scratch);
+                }
+        }
+
+        if (tiles.scratch != NULL)
+                conv_put_scratch(tiles.scratch, scratch_arena, scratch_mark);
+
+        return tiles.is_failed ? CONV_RUN_GEMM_FAILED : CONV_RUN_DONE;
+}
+
+/**
+ * im2col_nchw_row() - Fills row (`kh`, `kw`) of channel `in_plane` of an NCHW
+ * im2col tile, for output pixels [pixel0, pixel0 + num_pixels).
+ *
+ * The pixels are walked a row of output at a time, so that the input row is
+ * found once per output row, and the horizontal bounds are the only ones
+ * checked per pixel.
+ */
+static void
+im2col_nchw_row(const struct conv_job *job,
+                const float *in_plane,
+                size_t kh,
+                size_t kw,
+                size_t pixel0,
+                size_t num_pixels,
+                float *col_row)
+{
+        const struct conv_shape *shape = &job->shape;
+        const struct rot_conv2d_params *params = job->params;
+        size_t oh = pixel0/shape->out_w;
+        size_t ow = pixel0 % shape->out_w;
+        size_t p = 0;
+        while (p < num_pixels) {
+                const size_t run = min_size(shape->out_w - ow, num_pixels - p);
+                const size_t ih = conv_get_input_pos(oh,
+                                                     kh,
+                                                     params->stride[0],
+                                                     params->padding[0],
+                                                     params->dilation[0]);
+                if (ih >= shape->in_h) {
+                        memset(col_row + p, 0, run*sizeof(float));
+                } else {
+                        const float *in_row = in_plane + ih*shape->in_w;
+                        for (size_t i = 0;
+                             i < run;
+                             ++i) {
+                                const size_t iw = conv_get_input_pos(
+                                        ow + i,
+                                        kw,
+                                        params->stride[1],
+                                        params->padding[1],
+                                        params->dilation[1]);
+                                col_row[p + i] = ((iw < shape->in_w) ?
+                                                  in_row[iw] :
+                                                  0.0f);
+                        }
+                }
+
+                p += run;
+                ow = 0;
+                ++oh;
+        }
+}
+
+/**
+ * im2col_nchw() - Fills the kxnum_pixels im2col tile `col` for group `group`
+ * of NCHW image `image`, with rows ordered (channel, kh, kw).
+ */
+static void
+im2col_nchw(const struct conv_job *job,
+            const float *image,
+            size_t group,
+            size_t pixel0,
+            size_t num_pixels,
+            float *col)
+{
+        const struct conv_shape *shape = &job->shape;
+        const size_t plane = shape->in_h*shape->in_w;
+        for (size_t c = 0;
+             c < shape->group_in;
+             ++c) {
+                const float *in_plane = (image +
+                                         (group*shape->group_in + c)*plane);
+                for (size_t kh = 0;
+                     kh < shape->kernel_h;
+                     ++kh) {
+                        for (size_t kw = 0;
+                             kw < shape->kernel_w;
+                             ++kw) {
+                                im2col_nchw_row(job,
+                                                in_plane,
+                                                kh,
+                                                kw,
+                                                pixel0,
+                                                num_pixels,
+                                                col);
+                                col += num_pixels;
+                        }
+                }
+        }
+}
+
+/**
+ * im2col_nhwc() - Fills the num_pixelsxk im2col tile `col` for group `group`
+ * of NHWC image `image`, with columns ordered (kh, kw, channel), so that each
+ * tap copies a contiguous run of channels.
+ */
+static void
+im2col_nhwc(const struct conv_job *job,
+            const float *image,
+            size_t group,
+            size_t pixel0,
+            size_t num_pixels,
+            float *col)
+{
+        const struct conv_shape *shape = &job->shape;
+        const struct rot_conv2d_params *params = job->params;
+        const size_t run_bytes = shape->group_in*sizeof(float);
+        for (size_t p = pixel0;
+             p < pixel0 + num_pixels;
+             ++p) {
+                const size_t oh = p/shape->out_w;
+                const size_t ow = p % shape->out_w;
+                for (size_t kh = 0;
+                     kh < shape->kernel_h;
+                     ++kh) {
+                        const size_t ih = conv_get_input_pos(
+                                oh,
+                                kh,
+                                params->stride[0],
+                                params->padding[0],
+                                params->dilation[0]);
+                        for (size_t kw = 0;
+                             kw < shape->kernel_w;
+                             ++kw) {
+                                const size_t iw = conv_get_input_pos(
+                                        ow,
+                                        kw,
+                                        params->stride[1],
+                                        params->padding[1],
+                                        params->dilation[1]);
+                                if ((ih < shape->in_h) &&
+                                    (iw < shape->in_w)) {
+                                        const float *in_pixel =
+                                                (image +
+                                                 ((ih*shape->in_w + iw)*
+                                                  shape->in_channels) +
+                                                 group*shape->group_in);
+                                        memcpy(col, in_pixel, run_bytes);
+                                } else {
+                                        memset(col, 0, run_bytes);
+                                }
+                                col += shape->group_in;
+                        }
+                }
+        }
+}
+
+/**
+ * conv_task() - Computes one tile of output pixels of one group of one image.
+ * @scratch: Room for the tile's im2col matrix, unless the job is pointwise.
+ *
+ * For NCHW the tile is filter*col, with the filter's rows being the group's
+ * output channels, and for NHWC it is col*filter^T.
+ */
+static bool
+conv_task(void *context, size_t task_i, float *scratch)
+{
+        const struct conv_job *job = (const struct conv_job *)context;
+        const struct conv_shape *shape = &job->shape;
+        const size_t groups = job->params->groups;
+        const size_t tile = task_i % job->num_tiles;
+        const size_t group = (task_i/job->num_tiles) % groups;
+        const size_t image_i = task_i/(job->num_tiles*groups);
+        const size_t pixel0 = tile*job->tile_pixels;
+        const size_t num_pixels = min_size(job->tile_pixels,
+                                           shape->num_pixels - pixel0);
+        const bool is_nchw = (job->params->layout == ROT_LAYOUT_NCHW);
+
+        const size_t image_elems = (shape->in_channels*
+                                    shape->in_h*shape->in_w);
+        const float *image = job->input + image_i*image_elems;
+        const float *filter = job->filter + group*shape->group_out*shape->k;
+        const float *bias = ((job->bias != NULL) ?
+                             (job->bias + group*shape->group_out) :
+                             NULL);
+        struct gemm_epilogue epilogue = {
+                .row_bias = is_nchw ? bias : NULL,
+                .col_bias = is_nchw ? NULL : bias,
+                .activation = job->params->activation};
+
+        const float *col;
+        size_t ld_col;
+        if (job->is_pointwise) {
+                if (is_nchw) {
+                        col = (image +
+                               group*shape->group_in*shape->num_pixels +
+                               pixel0);
+                        ld_col = shape->num_pixels;
+                } else {
+                        col = (image +
+                               pixel0*shape->in_channels +
+                               group*shape->group_in);
+                        ld_col = shape->in_channels;
+                }
+        } else {
+                if (is_nchw) {
+                        im2col_nchw(job,
+                                    image,
+                                    group,
+                                    pixel0,
+                                    num_pixels,
+                                    scratch);
+                        ld_col = num_pixels;
+                } else {
+                        im2col_nhwc(job,
+                                    image,
+                                    group,
+                                    pixel0,
+                                    num_pixels,
+                                    scratch);
+                        ld_col = shape->k;
+                }
+                col = scratch;
+        }
+
+        const size_t out_image_elems = shape->out_channels*shape->num_pixels;
+        float *out_image = job->output + image_i*out_image_elems;
+        if (is_nchw) {
+                return gemm_cpu(job->engine,
+                                false,
+                                false,
+                                shape->group_out,
+                                num_pixels,
+                                shape->k,
+                                1.0f,
+                                filter,
+                                shape->k,
+                                col,
+                                ld_col,
+                                0.0f,
+                                (out_image +
+                                 group*shape->group_out*shape->num_pixels +
+                                 pixel0),
+                                shape->num_pixels,
+                                &epilogue);
+        } else {
+                return gemm_cpu(job->engine,
+                                false,
+                                true,
+                                num_pixels,
+                                shape->group_out,
+                                shape->k,
+                                1.0f,
+                                col,
+                                ld_col,
+                                filter,
+                                shape->k,
+                                0.0f,
+                                (out_image +
+                                 pixel0*shape->out_channels +
+                                 group*shape->group_out),
+                                shape->out_channels,
+                                &epilogue);
+        }
+}
+
+/**
+ * conv_fill_bias() - Computes a convolution with no input channels, whose
+ * output is the activation of the bias alone.
+ * @bias: Bias, or NULL.
+ */
+static void
+conv_fill_bias(const struct conv_shape *shape,
+               const struct rot_conv2d_params *params,
+               const float *bias,
+               float *output)
+{
+        const bool is_nchw = (params->layout == ROT_LAYOUT_NCHW);
+        const size_t image_elems = shape->out_channels*shape->num_pixels;
+        memset(output, 0, shape->batch*image_elems*sizeof(float));
+
+        struct gemm_epilogue epilogue = {
+                .row_bias = is_nchw ? bias : NULL,
+                .col_bias = is_nchw ? NULL : bias,
+                .activation = params->activation};
+        if (!is_nchw) {
+                gemm_apply_epilogue(shape->batch*shape->num_pixels,
+                                    shape->out_channels,
+                                    output,
+                                    shape->out_channels,
+                                    &epilogue);
+                return;
+        }
+
+        for (size_t image_i = 0;
+             image_i < shape->batch;
+             ++image_i) {
+                gemm_apply_epilogue(shape->out_channels,
+                                    shape->num_pixels,
+                                    output + image_i*image_elems,
+                                    shape->num_pixels,
+                                    &epilogue);
+        }
+}
+
+bool conv_check_tensor(const struct rot_tensor *tensor, uint32_t num_dims)
+{
+        return ((tensor->dtype == ROT_DTYPE_FLOAT32) &&
+                (tensor->backend == ROT_BACKEND_CPU) &&
+                (tensor->num_dims == num_dims) &&
+                tensor_is_contiguous(tensor));
+}
+
+/**
+ * conv_get_out_size() - Sets `out_size` to the number of windows of a filter
+ * with `kernel_size` taps along an input dimension of `in_size`.
+ *
+ * Returns false if the dilated filter does not fit in the padded input.
+ */
+static bool
+conv_get_out_size(size_t in_size,
+                  size_t kernel_size,
+                  uint32_t stride,
+                  uint32_t padding,
+                  uint32_t dilation,
+                  size_t *out_size)
+{
+        const size_t padded = in_size + 2*(size_t)padding;
+        const size_t extent = (size_t)dilation*(kernel_size - 1) + 1;
+        if ((kernel_size == 0) || (extent > padded))
+                return false;
+
+        *out_size = (padded - extent)/stride + 1;
+        return true;
+}
+
+bool conv_check_result(const struct conv_shape *shape,
+                       const struct rot_tensor *result,
+                       enum rot_layout layout,
+                       size_t channels)
+{
+        const bool is_nchw = (layout == ROT_LAYOUT_NCHW);
+        const uint32_t channel_dim = is_nchw ? 1 : 3;
+        const uint32_t h_dim = is_nchw ? 2 : 1;
+        if ((result->dims[0] != shape->batch) ||
+            (result->dims[channel_dim] != channels) ||
+            (result->dims[h_dim] != shape->out_h) ||
+            (result->dims[h_dim + 1] != shape->out_w)) {
+                LOG_ERROR("Convolution result has the wrong dimensions.");
+                return false;
+        }
+
+        return true;
+}
+
+bool conv_get_shape(struct conv_shape *shape,
+                    const struct rot_tensor *result,
+                    const struct rot_tensor *input,
+                    const struct rot_tensor *bias,
+                    const struct rot_conv2d_params *params)
+{
+        if ((params->stride[0] == 0) ||
+            (params->stride[1] == 0) ||
+            (params->dilation[0] == 0) ||
+            (params->dilation[1] == 0) ||
+            (params->groups == 0) ||
+            ((params->layout != ROT_LAYOUT_NCHW) &&
+             (params->layout != ROT_LAYOUT_NHWC))) {
+                LOG_ERROR("Convolution strides, dilations and groups must be "
+                          "non-zero, and the layout NCHW or NHWC.");
+                return false;
+        }
+
+        if (((result != NULL) && !conv_check_tensor(result, 4)) ||
+            !conv_check_tensor(input, 4) ||
+            ((bias != NULL) &&
+             ((bias->dtype != ROT_DTYPE_FLOAT32) ||
+              (bias->backend != ROT_BACKEND_CPU) ||
+              !tensor_is_contiguous(bias)))) {
+                LOG_ERROR("Convolution operands must be contiguous float32 "
+                          "CPU tensors, with 4 dimensions except for the "
+                          "bias.");
+                return false;
+        }
+
+        const bool is_nchw = (params->layout == ROT_LAYOUT_NCHW);
+        const uint32_t channel_dim = is_nchw ? 1 : 3;
+        const uint32_t h_dim = is_nchw ? 2 : 1;
+        shape->batch = input->dims[0];
+        shape->in_channels = input->dims[channel_dim];
+        shape->in_h = input->dims[h_dim];
+        shape->in_w = input->dims[h_dim + 1];
+        if ((shape->group_in*params->groups != shape->in_channels) ||
+            (shape->out_channels % params->groups != 0)) {
+                LOG_ERROR("Convolution filter must have in channels/groups "
+                          "channels, and groups must divide the out "
+                          "channels.");
+                return false;
+        }
+
+        shape->group_out = shape->out_channels/params->groups;
+        shape->k = shape->group_in*shape->kernel_h*shape->kernel_w;
+        if (!conv_get_out_size(shape->in_h,
+                               shape->kernel_h,
+                               params->stride[0],
+                               params->padding[0],
+                               params->dilation[0],
+                               &shape->out_h) ||
+            !conv_get_out_size(shape->in_w,
+                               shape->kernel_w,
+                               params->stride[1],
+                               params->padding[1],
+                               params->dilation[1],
+                               &shape->out_w)) {
+                LOG_ERROR("Dilated convolution filter is larger than the "
+                          "padded input.");
+                return false;
+        }
+        shape->num_pixels = shape->out_h*shape->out_w;
+
+        if ((result != NULL) &&
+            !conv_check_result(shape,
+                               result,
+                               params->layout,
+                               shape->out_channels))
+                return false;
+
+        if ((bias != NULL) &&
+            (tensor_get_num_elems(bias) != shape->out_channels)) {
+                LOG_ERROR("Convolution bias must have one element per output "
+                          "channel.");
+                return false;
+        }
+
+        return true;
+}
+
+rot_tensor_t ROT_conv2d(rot_tensor_t result,
+                        const rot_tensor_t input,
+                        const rot_tensor_t filter,
+                        const rot_tensor_t bias,
+                        const struct rot_conv2d_params *params)
+{
+        if ((result == NULL) ||
+            (input == NULL) ||
+            (filter == NULL) ||
+            (params == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (!conv_check_tensor(filter, 4)) {
+                LOG_ERROR("Convolution filter must be a contiguous float32 "
+                          "CPU tensor with 4 dimensions.");
+                return NULL;
+        }
+
+        struct conv_job job;
+        const bool is_nchw = (params->layout == ROT_LAYOUT_NCHW);
+        job.shape.out_channels = filter->dims[0];
+        job.shape.group_in = (is_nchw ? filter->dims[1] : filter->dims[3]);
+        job.shape.kernel_h = (is_nchw ? filter->dims[2] : filter->dims[1]);
+        job.shape.kernel_w = (is_nchw ? filter->dims[3] : filter->dims[2]);
+        if (!conv_get_shape(&job.shape, result, input, bias, params))
+                return NULL;
+
+        if (tensor_is_overlapping(result, input) ||
+            tensor_is_overlapping(result, filter) ||
+            ((bias != NULL) && tensor_is_overlapping(result, bias))) {
+                LOG_ERROR("Convolution result must not overlap its "
+                          "operands.");
+                return NULL;
+        }
+
+        const struct conv_shape *shape = &job.shape;
+        if ((shape->batch == 0) ||
+            (shape->num_pixels == 0) ||
+            (shape->out_channels == 0))
+                return result;
+
+        if (shape->k == 0) {
+                conv_fill_bias(shape,
+                               params,
+                               (bias != NULL) ? bias->cpu.data : NULL,
+                               result->cpu.data);
+                return result;
+        }
+
+        if (conv_depthwise_auto(shape,
+                                params,
+                                input->cpu.data,
+                                filter->cpu.data,
+                                (bias != NULL) ? bias->cpu.data : NULL,
+                                result->cpu.data))
+                return result;
+
+        if (conv_winograd_auto(shape,
+                               params,
+                               input->cpu.data,
+                               filter->cpu.data,
+                               (bias != NULL) ? bias->cpu.data : NULL,
+                               result->cpu.data))
+                return result;
+
+        job.params = params;
+        job.engine = gemm_resolve_engine(ROT_MATMUL_ENGINE_DEFAULT);
+        job.input = input->cpu.data;
+        job.filter = filter->cpu.data;
+        job.bias = (bias != NULL) ? bias->cpu.data : NULL;
+        job.output = result->cpu.data;
+        job.is_pointwise = ((shape->kernel_h == 1) &&
+                            (shape->kernel_w == 1) &&
+                            (params->stride[0] == 1) &&
+                            (params->stride[1] == 1) &&
+                            (params->padding[0] == 0) &&
+                            (params->padding[1] == 0));
+
+        size_t tile_pixels = CONV_TILE_BYTES/(shape->k*sizeof(float));
+        if (tile_pixels < CONV_MIN_TILE_PIXELS)
+                tile_pixels = CONV_MIN_TILE_PIXELS;
+        if (job.is_pointwise)
+                tile_pixels = shape->num_pixels;
+        job.tile_pixels = min_size(tile_pixels, shape->num_pixels);
+        job.num_tiles = ceil_div(shape->num_pixels, job.tile_pixels);
+
+        const size_t num_tasks = (shape->batch*params->groups*job.num_tiles);
+        switch (conv_run_tiles(job.engine,
+                               num_tasks,
+                               job.is_pointwise ? 0 : shape->k*job.tile_pixels,
+                               conv_task,
+                               &job)) {
+        case CONV_RUN_DONE:
+                return result;
+        case CONV_RUN_NO_SCRATCH:
+                LOG_ERROR("Failed to allocate im2col scratch.");
+                return NULL;
+        default:
+                LOG_ERROR("Convolution GEMM failed.");
+                return NULL;
+        }
+}
@@ -0,0 +1,199 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef NN_CONV_H
+#define NN_CONV_H
+
+#include "rot_arena.h"  /* for rot_arena_t, rot_arena_mark_t */
+#include "rot_nn.h"     /* for rot_conv2d_params, rot_matmul_engine */
+#include <stddef.h>     /* for size_t */
+#include <stdint.h>     /* for uint32_t */
+
+/**
+ * conv.h - Internal interface shared by the convolution algorithms: im2col
+ * with GEMM, in conv.c, Winograd, in winograd.c, and direct depthwise, in
+ * depthwise.c, some of which pooling and normalisation also use.
+ */
+
+struct rot_tensor;
+
+/**
+ * struct conv_shape - Sizes of a convolution, with channels per group.
+ * @out_channels: Number of filters.
+ * @kernel_h, @kernel_w: Height and width of the filter.
+ * @group_in, @group_out: Input and output channels of each group.
+ * @k: Depth of each im2col GEMM, i.e. the size of one group's input window.
+ * @num_pixels: Number of output pixels per image.
+ */
+struct conv_shape {
+        size_t batch;
+        size_t in_h;
+        size_t in_w;
+        size_t in_channels;
+        size_t out_h;
+        size_t out_w;
+        size_t out_channels;
+        size_t kernel_h;
+        size_t kernel_w;
+        size_t group_in;
+        size_t group_out;
+        size_t k;
+        size_t num_pixels;
+};
+
+/**
+ * conv_get_input_pos() - Returns the input position, along one dimension, of
+ * tap `tap` of the window of output position `out`.
+ *
+ * Positions in the padding wrap around to values past the end of the input,
+ * so one unsigned comparison with the input size tells whether a tap is
+ * inside the input.
+ */
+static inline size_t
+conv_get_input_pos(size_t out,
+                   size_t tap,
+                   uint32_t stride,
+                   uint32_t padding,
+                   uint32_t dilation)
+{
+        return out*stride + tap*dilation - padding;
+}
+
+/**
+ * conv_check_tensor() - Is `tensor` a contiguous float32 CPU tensor with
+ * `num_dims` dimensions?
+ */
+bool conv_check_tensor(const struct rot_tensor *tensor, uint32_t num_dims);
+
+/**
+ * conv_check_result() - Does `result` have the output dimensions of `shape`,
+ * with `channels` channels, in `layout`?
+ */
+bool conv_check_result(const struct conv_shape *shape,
+                       const struct rot_tensor *result,
+                       enum rot_layout layout,
+                       size_t channels);
+
+/**
+ * conv_get_shape() - Fills in `shape` from the convolution's tensors and
+ * `params`, and checks them against each other.
+ * @shape: Must have `out_channels`, `group_in`, `kernel_h` and `kernel_w`
+ * already filled in from the filter.
+ * @result: Result, or NULL for the caller to check with `conv_check_result`.
+ * @bias: Bias, or NULL.
+ */
+bool conv_get_shape(struct conv_shape *shape,
+                    const struct rot_tensor *result,
+                    const struct rot_tensor *input,
+                    const struct rot_tensor *bias,
+                    const struct rot_conv2d_params *params);
+
+/**
+ * conv_get_scratch() - Returns a buffer of `num_floats` floats for the calling
+ * thread, from its scratch arena in the current context if that has room and
+ * otherwise from the heap.
+ * @arena: Set to the arena the buffer came from, or NULL for the heap.
+ * @mark: Set to the mark to rewind `arena` to, see `conv_put_scratch`.
+ *
+ * Buffers must be released in the reverse order they were gotten in.
+ *
+ * NOTE(brendan): `gemm_get_scratch` is not used, since its heap buffer is
+ * reused by the GEMMs that read convolution scratch.
+ */
+float *
+conv_get_scratch(size_t num_floats, rot_arena_t *arena, rot_arena_mark_t *mark);
+
+/**
+ * conv_put_scratch() - Releases a buffer returned by `conv_get_scratch`.
+ */
+void conv_put_scratch(float *scratch, rot_arena_t arena, rot_arena_mark_t mark);
+
+/**
+ * conv_tile_fn - Computes one tile of a convolution, see `conv_run_tiles`.
+ * @context: Pointer passed through unchanged from `conv_run_tiles`.
+ * @task_i: Index of the tile, in [0, num_tasks).
+ * @scratch: Buffer of `scratch_floats` floats that no other tile is using at
+ * the same time, or NULL if no scratch was asked for.
+ *
+ * Returns false if the tile's GEMMs failed.
+ */
+typedef bool conv_tile_fn(void *context, size_t task_i, float *scratch);
+
+/**
+ * enum conv_run_result - Outcome of `conv_run_tiles`.
+ * @CONV_RUN_DONE: Every tile ran.
+ * @CONV_RUN_NO_SCRATCH: The scratch could not be allocated, and no tile ran.
+ * @CONV_RUN_GEMM_FAILED: Some tile's GEMMs failed, leaving the output partly
+ * written.
+ */
+enum conv_run_result {
+        CONV_RUN_DONE,
+        CONV_RUN_NO_SCRATCH,
+        CONV_RUN_GEMM_FAILED,
+};
+
+/**
+ * conv_run_tiles() - Runs `tile_fn` for every tile in [0, num_tasks), each
+ * given a scratch buffer of `scratch_floats` floats.
+ * @engine: Engine of the GEMMs run by the tiles.
+ *
+ * The scratch buffers are allocated up front, one per thread that can run
+ * tiles, so that tiles can only fail if their GEMMs' own packing buffers
+ * cannot be allocated.
+ */
+enum conv_run_result conv_run_tiles(enum rot_matmul_engine engine,
+                                    size_t num_tasks,
+                                    size_t scratch_floats,
+                                    conv_tile_fn *tile_fn,
+                                    void *context);
+
+/**
+ * conv_winograd_auto() - Runs the convolution with Winograd F(4x4, 3x3), if
+ * `params` and `shape` allow it and it is expected to be faster than im2col.
+ * @filter: Untransformed filter, in the layout given by `params`.
+ * @bias: Bias, or NULL.
+ *
+ * Returns false if the convolution is left to im2col, which includes when
+ * Winograd's scratch cannot be allocated. `output` may then be partly
+ * written, which im2col overwrites.
+ */
+bool conv_winograd_auto(const struct conv_shape *shape,
+                        const struct rot_conv2d_params *params,
+                        const float *input,
+                        const float *filter,
+                        const float *bias,
+                        float *output);
+
+/**
+ * conv_depthwise_auto() - Runs the convolution with the direct depthwise
+ * kernels, if it is an NHWC convolution with one group per channel and one
+ * filter per group.
+ * @filter: Filter, as [channels, height, width, 1].
+ * @bias: Bias, or NULL.
+ *
+ * Returns false, having done nothing, if the convolution is left to the other
+ * algorithms.
+ */
+bool conv_depthwise_auto(const struct conv_shape *shape,
+                         const struct rot_conv2d_params *params,
+                         const float *input,
+                         const float *filter,
+                         const float *bias,
+                         float *output);
+
+#endif /* NN_CONV_H */
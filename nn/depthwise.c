@@ -0,0 +1,655 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "nn/conv.h"
+#include "error/log_error.h"  /* for LOG_ERROR, LOG_NULL */
+#include "math/gemm.h"        /* for gemm_cpu, gemm_apply_epilogue */
+#include "math/size_math.h"   /* for min_size, ceil_div */
+#include "math/tensor.h"      /* for rot_tensor, tensor_is_overlapping */
+#include "platform/cpu.h"     /* for cpu_get_isa */
+#include "platform/thread.h"  /* for parallel_for_range, ... */
+
+#include <immintrin.h>        /* for __m256, __m512, _mm512_fmadd_ps, ... */
+#include <string.h>           /* for memcpy */
+
+/**
+ * NOTE(brendan): Depthwise filters with more taps than this are left to
+ * im2col, so that each pixel's taps can be gathered on the stack.
+ */
+#define DEPTHWISE_MAX_TAPS 64
+/**
+ * NOTE(brendan): Threads take rows of output in chunks of about
+ * DEPTHWISE_GRAIN_MACS multiply-adds.
+ */
+#define DEPTHWISE_GRAIN_MACS (64*1024)
+/**
+ * NOTE(brendan): The fused separable convolution keeps at most
+ * DEPTHWISE_TILE_BYTES of depthwise output, a whole number of rows of it, in
+ * scratch for the pointwise GEMM to read back from L2.
+ */
+#define DEPTHWISE_TILE_BYTES (256*1024)
+#define DEPTHWISE_GENERIC_CHANNELS 64
+
+/**
+ * depthwise_pixel_fn - Computes one output pixel of a depthwise convolution,
+ * out[c] = sum over taps t of inputs[t][c]*weights[t][c].
+ * @inputs: For each tap inside the input, its input pixel.
+ * @weights: For each tap inside the input, its weight for every channel.
+ * @num_taps: Number of taps inside the input.
+ */
+typedef void depthwise_pixel_fn(const float *const *inputs,
+                                const float *const *weights,
+                                uint32_t num_taps,
+                                size_t channels,
+                                float *out);
+
+/**
+ * struct depthwise_job - A depthwise convolution in NHWC, optionally followed
+ * by a pointwise convolution.
+ * @weights: Filter repacked as [taps, channels], so that every tap's weights
+ * for neighbouring channels are contiguous.
+ * @output: Depthwise output, or for the fused convolution, the pointwise
+ * output.
+ * @pointwise_filter: [out channels, channels] filter of the pointwise
+ * convolution, or NULL.
+ * @tile_rows: Rows of depthwise output computed per pointwise GEMM.
+ * @num_tiles: Tiles of `tile_rows` rows per image.
+ */
+struct depthwise_job {
+        const struct conv_shape *shape;
+        const struct rot_conv2d_params *params;
+        depthwise_pixel_fn *pixel;
+        const float *input;
+        const float *weights;
+        const float *bias;
+        float *output;
+        enum rot_matmul_engine engine;
+        const float *pointwise_filter;
+        const float *pointwise_bias;
+        enum rot_activation pointwise_activation;
+        size_t pointwise_channels;
+        size_t tile_rows;
+        size_t num_tiles;
+};
+
+/**
+ * depthwise_pixel_generic() - Depthwise pixel accumulated in blocks of
+ * DEPTHWISE_GENERIC_CHANNELS channels on the stack, which the compiler can
+ * vectorise since they cannot alias the input.
+ */
+static void
+depthwise_pixel_generic(const float *const *inputs,
+                        const float *const *weights,
+                        uint32_t num_taps,
+                        size_t channels,
+                        float *out)
+{
+        for (size_t c0 = 0;
+             c0 < channels;
+             c0 += DEPTHWISE_GENERIC_CHANNELS) {
+                const size_t width = min_size(DEPTHWISE_GENERIC_CHANNELS,
+                                              channels - c0);
+                float acc[DEPTHWISE_GENERIC_CHANNELS] = {};
+                for (uint32_t t = 0;
+                     t < num_taps;
+                     ++t) {
+                        const float *in = inputs[t] + c0;
+                        const float *w = weights[t] + c0;
+                        for (size_t c = 0;
+                             c < width;
+                             ++c) {
+                                acc[c] += in[c]*w[c];
+                        }
+                }
+
+                memcpy(out + c0, acc, width*sizeof(float));
+        }
+}
+
+/**
+ * depthwise_pixel_avx512() - Depthwise pixel with the channels in the lanes,
+ * 64 channels at a time, and then 16 at a time with the last vector masked.
+ */
+__attribute__((target("avx512f")))
+static void
+depthwise_pixel_avx512(const float *const *inputs,
+                       const float *const *weights,
+                       uint32_t num_taps,
+                       size_t channels,
+                       float *out)
+{
+        size_t c = 0;
+        for (;
+             c + 64 <= channels;
+             c += 64) {
+                __m512 acc[4];
+#pragma GCC unroll 4
+                for (uint32_t v = 0;
+                     v < 4;
+                     ++v) {
+                        acc[v] = _mm512_setzero_ps();
+                }
+
+                for (uint32_t t = 0;
+                     t < num_taps;
+                     ++t) {
+#pragma GCC unroll 4
+                        for (uint32_t v = 0;
+                             v < 4;
+                             ++v) {
+                                acc[v] = _mm512_fmadd_ps(
+                                        _mm512_loadu_ps(inputs[t] + c + 16*v),
+                                        _mm512_loadu_ps(weights[t] + c + 16*v),
+                                        acc[v]);
+                        }
+                }
+
+#pragma GCC unroll 4
+                for (uint32_t v = 0;
+                     v < 4;
+                     ++v) {
+                        _mm512_storeu_ps(out + c + 16*v, acc[v]);
+                }
+        }
+
+        for (;
+             c < channels;
+             c += 16) {
+                const size_t remaining = channels - c;
+                const __mmask16 mask = ((remaining >= 16) ?
+                                        (__mmask16)0xFFFF :
+                                        (__mmask16)((1u << remaining) - 1));
+                __m512 acc = _mm512_setzero_ps();
+                for (uint32_t t = 0;
+                     t < num_taps;
+                     ++t) {
+                        acc = _mm512_fmadd_ps(
+                                _mm512_maskz_loadu_ps(mask, inputs[t] + c),
+                                _mm512_maskz_loadu_ps(mask, weights[t] + c),
+                                acc);
+                }
+                _mm512_mask_storeu_ps(out + c, mask, acc);
+        }
+}
+
+/**
+ * depthwise_pixel_avx2() - Depthwise pixel with the channels in the lanes, 32
+ * channels at a time, then 8 at a time, and then the rest one at a time.
+ */
+__attribute__((target("avx2,fma")))
+static void
+depthwise_pixel_avx2(const float *const *inputs,
+                     const float *const *weights,
+                     uint32_t num_taps,
+                     size_t channels,
+                     float *out)
+{
+        size_t c = 0;
+        for (;
+             c + 32 <= channels;
+             c += 32) {
+                __m256 acc[4];
+#pragma GCC unroll 4
+                for (uint32_t v = 0;
+                     v < 4;
+                     ++v) {
+                        acc[v] = _mm256_setzero_ps();
+                }
+
+                for (uint32_t t = 0;
+                     t < num_taps;
+                     ++t) {
+#pragma GCC unroll 4
+                        for (uint32_t v = 0;
+                             v < 4;
+                             ++v) {
+                                acc[v] = _mm256_fmadd_ps(
+                                        _mm256_loadu_ps(inputs[t] + c + 8*v),
+                                        _mm256_loadu_ps(weights[t] + c + 8*v),
+                                        acc[v]);
+                        }
+                }
+
+#pragma GCC unroll 4
+                for (uint32_t v = 0;
+                     v < 4;
+                     ++v) {
+                        _mm256_storeu_ps(out + c + 8*v, acc[v]);
+                }
+        }
+
+        for (;
+             c + 8 <= channels;
+             c += 8) {
+                __m256 acc = _mm256_setzero_ps();
+                for (uint32_t t = 0;
+                     t < num_taps;
+                     ++t) {
+                        acc = _mm256_fmadd_ps(_mm256_loadu_ps(inputs[t] + c),
+                                              _mm256_loadu_ps(weights[t] + c),
+                                              acc);
+                }
+                _mm256_storeu_ps(out + c, acc);
+        }
+
+        for (;
+             c < channels;
+             ++c) {
+                float acc = 0.0f;
+                for (uint32_t t = 0;
+                     t < num_taps;
+                     ++t) {
+                        acc += inputs[t][c]*weights[t][c];
+                }
+                out[c] = acc;
+        }
+}
+
+static depthwise_pixel_fn *
+depthwise_get_kernel(void)
+{
+        enum cpu_isa isa = cpu_get_isa();
+        if (isa >= CPU_ISA_AVX512)
+                return depthwise_pixel_avx512;
+
+        if (isa >= CPU_ISA_AVX2)
+                return depthwise_pixel_avx2;
+
+        return depthwise_pixel_generic;
+}
+
+/**
+ * depthwise_is_supported() - Is the convolution described by `shape` and
+ * `params` a depthwise NHWC convolution with one filter per channel, and a
+ * filter small enough for the direct kernels?
+ */
+static bool
+depthwise_is_supported(const struct conv_shape *shape,
+                       const struct rot_conv2d_params *params)
+{
+        return ((params->layout == ROT_LAYOUT_NHWC) &&
+                (shape->group_in == 1) &&
+                (shape->group_out == 1) &&
+                (shape->kernel_h*shape->kernel_w <= DEPTHWISE_MAX_TAPS));
+}
+
+/**
+ * depthwise_pack_filter() - Repacks the [channels, taps] depthwise `filter`
+ * into [taps, channels] `weights`.
+ */
+static void
+depthwise_pack_filter(const float *filter,
+                      size_t channels,
+                      size_t num_taps,
+                      float *weights)
+{
+        for (size_t c = 0;
+             c < channels;
+             ++c) {
+                for (size_t t = 0;
+                     t < num_taps;
+                     ++t) {
+                        weights[t*channels + c] = filter[c*num_taps + t];
+                }
+        }
+}
+
+/**
+ * depthwise_row() - Computes row `oh` of the depthwise output of image
+ * `image` into `out_row`, with the bias and activation applied.
+ */
+static void
+depthwise_row(const struct depthwise_job *job,
+              size_t image,
+              size_t oh,
+              float *out_row)
+{
+        const struct conv_shape *shape = job->shape;
+        const struct rot_conv2d_params *params = job->params;
+        const size_t channels = shape->in_channels;
+        const float *in_image = (job->input +
+                                 image*shape->in_h*shape->in_w*channels);
+        const float *inputs[DEPTHWISE_MAX_TAPS];
+        const float *weights[DEPTHWISE_MAX_TAPS];
+        for (size_t ow = 0;
+             ow < shape->out_w;
+             ++ow) {
+                uint32_t num_taps = 0;
+                for (size_t kh = 0;
+                     kh < shape->kernel_h;
+                     ++kh) {
+                        const size_t ih = conv_get_input_pos(
+                                oh,
+                                kh,
+                                params->stride[0],
+                                params->padding[0],
+                                params->dilation[0]);
+                        if (ih >= shape->in_h)
+                                continue;
+
+                        for (size_t kw = 0;
+                             kw < shape->kernel_w;
+                             ++kw) {
+                                const size_t iw = conv_get_input_pos(
+                                        ow,
+                                        kw,
+                                        params->stride[1],
+                                        params->padding[1],
+                                        params->dilation[1]);
+                                if (iw >= shape->in_w)
+                                        continue;
+
+                                inputs[num_taps] = (in_image +
+                                                    (ih*shape->in_w + iw)*
+                                                    channels);
+                                weights[num_taps] = (job->weights +
+                                                     ((kh*shape->kernel_w +
+                                                       kw)*
+                                                      channels));
+                                ++num_taps;
+                        }
+                }
+
+                job->pixel(inputs,
+                           weights,
+                           num_taps,
+                           channels,
+                           out_row + ow*channels);
+        }
+
+        struct gemm_epilogue epilogue = {
+                .row_bias = NULL,
+                .col_bias = job->bias,
+                .activation = params->activation};
+        gemm_apply_epilogue(shape->out_w,
+                            channels,
+                            out_row,
+                            channels,
+                            &epilogue);
+}
+
+/**
+ * depthwise_rows_range() - Computes rows [begin, end) of the depthwise
+ * output, counted across the whole batch.
+ */
+static void
+depthwise_rows_range(void *context, size_t begin, size_t end)
+{
+        const struct depthwise_job *job = (const struct depthwise_job *)context;
+        const struct conv_shape *shape = job->shape;
+        const size_t row_elems = shape->out_w*shape->in_channels;
+        for (size_t row = begin;
+             row < end;
+             ++row) {
+                depthwise_row(job,
+                              row/shape->out_h,
+                              row % shape->out_h,
+                              job->output + row*row_elems);
+        }
+}
+
+/**
+ * separable_task() - Computes one tile of rows of the depthwise output of one
+ * image into `scratch`, and multiplies it by the pointwise filter.
+ */
+static bool
+separable_task(void *context, size_t task_i, float *scratch)
+{
+        const struct depthwise_job *job = (const struct depthwise_job *)context;
+        const struct conv_shape *shape = job->shape;
+        const size_t image = task_i/job->num_tiles;
+        const size_t oh0 = (task_i % job->num_tiles)*job->tile_rows;
+        const size_t num_rows = min_size(job->tile_rows, shape->out_h - oh0);
+        const size_t channels = shape->in_channels;
+        const size_t row_elems = shape->out_w*channels;
+
+        for (size_t r = 0;
+             r < num_rows;
+             ++r) {
+                depthwise_row(job, image, oh0 + r, scratch + r*row_elems);
+        }
+
+        struct gemm_epilogue epilogue = {
+                .row_bias = NULL,
+                .col_bias = job->pointwise_bias,
+                .activation = job->pointwise_activation};
+        float *out = (job->output +
+                      ((image*shape->out_h + oh0)*shape->out_w*
+                       job->pointwise_channels));
+        return gemm_cpu(job->engine,
+                        false,
+                        true,
+                        num_rows*shape->out_w,
+                        job->pointwise_channels,
+                        channels,
+                        1.0f,
+                        scratch,
+                        channels,
+                        job->pointwise_filter,
+                        channels,
+                        0.0f,
+                        out,
+                        job->pointwise_channels,
+                        &epilogue);
+}
+
+/**
+ * depthwise_init_job() - Fills in `job` for the depthwise part of a
+ * convolution, with its filter packed into `weights`.
+ */
+static void
+depthwise_init_job(struct depthwise_job *job,
+                   const struct conv_shape *shape,
+                   const struct rot_conv2d_params *params,
+                   const float *input,
+                   const float *filter,
+                   const float *bias,
+                   float *weights)
+{
+        const size_t num_taps = shape->kernel_h*shape->kernel_w;
+        depthwise_pack_filter(filter, shape->in_channels, num_taps, weights);
+
+        *job = (struct depthwise_job){};
+        job->shape = shape;
+        job->params = params;
+        job->pixel = depthwise_get_kernel();
+        job->input = input;
+        job->weights = weights;
+        job->bias = bias;
+}
+
+bool conv_depthwise_auto(const struct conv_shape *shape,
+                         const struct rot_conv2d_params *params,
+                         const float *input,
+                         const float *filter,
+                         const float *bias,
+                         float *output)
+{
+        if (!depthwise_is_supported(shape, params))
+                return false;
+
+        const size_t num_taps = shape->kernel_h*shape->kernel_w;
+        rot_arena_t scratch_arena;
+        rot_arena_mark_t scratch_mark;
+        float *weights = conv_get_scratch(num_taps*shape->in_channels,
+                                          &scratch_arena,
+                                          &scratch_mark);
+        if (weights == NULL)
+                return false;
+
+        struct depthwise_job job;
+        depthwise_init_job(&job,
+                           shape,
+                           params,
+                           input,
+                           filter,
+                           bias,
+                           weights);
+        job.output = output;
+
+        const size_t num_rows = shape->batch*shape->out_h;
+        const size_t row_macs = shape->out_w*shape->in_channels*num_taps;
+        const size_t grain = ceil_div(DEPTHWISE_GRAIN_MACS, row_macs);
+        if ((num_rows <= grain) || (thread_get_num_workers() == 1))
+                depthwise_rows_range(&job, 0, num_rows);
+        else
+                parallel_for_range(0,
+                                   num_rows,
+                                   grain,
+                                   depthwise_rows_range,
+                                   &job);
+
+        conv_put_scratch(weights, scratch_arena, scratch_mark);
+
+        return true;
+}
+
+rot_tensor_t
+ROT_conv2d_depthwise_separable(rot_tensor_t result,
+                               const rot_tensor_t input,
+                               const rot_tensor_t depthwise_filter,
+                               const rot_tensor_t depthwise_bias,
+                               const rot_tensor_t pointwise_filter,
+                               const rot_tensor_t pointwise_bias,
+                               const struct rot_conv2d_params *params,
+                               enum rot_activation pointwise_activation)
+{
+        if ((result == NULL) ||
+            (input == NULL) ||
+            (depthwise_filter == NULL) ||
+            (pointwise_filter == NULL) ||
+            (params == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (!conv_check_tensor(result, 4) ||
+            !conv_check_tensor(depthwise_filter, 4) ||
+            !conv_check_tensor(pointwise_filter, 4) ||
+            (params->layout != ROT_LAYOUT_NHWC)) {
+                LOG_ERROR("Separable convolution result and filters must be "
+                          "contiguous float32 CPU tensors with 4 dimensions, "
+                          "in NHWC.");
+                return NULL;
+        }
+
+        const size_t channels = depthwise_filter->dims[0];
+        if ((pointwise_filter->dims[1] != 1) ||
+            (pointwise_filter->dims[2] != 1) ||
+            (pointwise_filter->dims[3] != channels)) {
+                LOG_ERROR("Pointwise filter must be [out channels, 1, 1, "
+                          "depthwise channels].");
+                return NULL;
+        }
+
+        const size_t out_channels = pointwise_filter->dims[0];
+        struct conv_shape shape;
+        shape.out_channels = channels;
+        shape.group_in = depthwise_filter->dims[3];
+        shape.kernel_h = depthwise_filter->dims[1];
+        shape.kernel_w = depthwise_filter->dims[2];
+        if (!conv_get_shape(&shape, NULL, input, depthwise_bias, params) ||
+            !conv_check_result(&shape,
+                               result,
+                               ROT_LAYOUT_NHWC,
+                               out_channels))
+                return NULL;
+
+        if (!depthwise_is_supported(&shape, params)) {
+                LOG_ERROR("Separable convolution must have one group and "
+                          "one filter per channel, and at most 64 taps.");
+                return NULL;
+        }
+
+        if ((pointwise_bias != NULL) &&
+            (tensor_get_num_elems(pointwise_bias) != out_channels)) {
+                LOG_ERROR("Pointwise bias must have one element per output "
+                          "channel.");
+                return NULL;
+        }
+
+        if (tensor_is_overlapping(result, input) ||
+            tensor_is_overlapping(result, depthwise_filter) ||
+            tensor_is_overlapping(result, pointwise_filter)) {
+                LOG_ERROR("Convolution result must not overlap its "
+                          "operands.");
+                return NULL;
+        }
+
+        if ((shape.batch == 0) ||
+            (shape.num_pixels == 0) ||
+            (out_channels == 0))
+                return result;
+
+        rot_arena_t scratch_arena;
+        rot_arena_mark_t scratch_mark;
+        float *weights = conv_get_scratch(
+                shape.kernel_h*shape.kernel_w*channels,
+                &scratch_arena,
+                &scratch_mark);
+        if (weights == NULL) {
+                LOG_ERROR("Failed to allocate depthwise filter.");
+                return NULL;
+        }
+
+        struct depthwise_job job;
+        depthwise_init_job(&job,
+                           &shape,
+                           params,
+                           input->cpu.data,
+                           depthwise_filter->cpu.data,
+                           ((depthwise_bias != NULL) ?
+                            depthwise_bias->cpu.data :
+                            NULL),
+                           weights);
+        job.output = result->cpu.data;
+        job.engine = gemm_resolve_engine(ROT_MATMUL_ENGINE_DEFAULT);
+        job.pointwise_filter = pointwise_filter->cpu.data;
+        job.pointwise_bias = ((pointwise_bias != NULL) ?
+                              pointwise_bias->cpu.data :
+                              NULL);
+        job.pointwise_activation = pointwise_activation;
+        job.pointwise_channels = out_channels;
+
+        const size_t row_bytes = shape.out_w*channels*sizeof(float);
+        job.tile_rows = DEPTHWISE_TILE_BYTES/row_bytes;
+        if (job.tile_rows == 0)
+                job.tile_rows = 1;
+        job.tile_rows = min_size(job.tile_rows, shape.out_h);
+        job.num_tiles = ceil_div(shape.out_h, job.tile_rows);
+
+        const enum conv_run_result run_result = conv_run_tiles(
+                job.engine,
+                shape.batch*job.num_tiles,
+                job.tile_rows*shape.out_w*channels,
+                separable_task,
+                &job);
+
+        conv_put_scratch(weights, scratch_arena, scratch_mark);
+
+        switch (run_result) {
+        case CONV_RUN_DONE:
+                return result;
+        case CONV_RUN_NO_SCRATCH:
+                LOG_ERROR("Failed to allocate depthwise scratch.");
+                return NULL;
+        default:
+                LOG_ERROR("Pointwise GEMM failed.");
+                return NULL;
+        }
+}
@@ -0,0 +1,2169 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "rot_nn.h"
+#include "error/log_error.h"  /* for LOG_ERROR, LOG_NULL */
+#include "math/size_math.h"   /* for min_size, ceil_div */
+#include "math/tensor.h"      /* for tensor_is_contiguous, ... */
+#include "nn/conv.h"          /* for conv_get_scratch, conv_put_scratch */
+#include "platform/cpu.h"     /* for cpu_get_isa */
+#include "platform/thread.h"  /* for parallel_for_range, ... */
+
+#include <immintrin.h>        /* for __m256, __m512, _mm512_fmadd_ps, ... */
+#include <math.h>             /* for sqrt */
+#include <string.h>           /* for memcpy, memset */
+
+/**
+ * NOTE(brendan): Normalisations are memory bound, so as for the elementwise
+ * ops, threads take tasks in chunks of about NORM_GRAIN_ELEMS elements, and
+ * only once there are NORM_MIN_PARALLEL_ELEMS.
+ */
+#define NORM_GRAIN_ELEMS (16*1024)
+#define NORM_MIN_PARALLEL_ELEMS (4*NORM_GRAIN_ELEMS)
+/**
+ * NOTE(brendan): NHWC batch normalisation sums each block of this many
+ * channels over every pixel in one task, with the running sums on the stack.
+ */
+#define NORM_CHANNEL_BLOCK 64
+/**
+ * NOTE(brendan): Kernels keep their running statistics and sums in single
+ * precision, which only stays accurate over a limited count. So rows are
+ * handed to them NORM_BLOCK_ELEMS elements, and columns NORM_BLOCK_ROWS rows,
+ * at a time, and the partial results are combined in double precision.
+ */
+#define NORM_BLOCK_ELEMS 4096
+#define NORM_BLOCK_ROWS 256
+/**
+ * NOTE(brendan): Welford's update of each running mean depends on the last,
+ * so row kernels keep NORM_WELFORD_VECS independent vectors of running
+ * statistics, or NORM_GENERIC_LANES scalars, to hide the latency. Vectors are
+ * merged in registers, leaving at most NORM_GENERIC_LANES lanes to merge in
+ * double precision.
+ */
+#define NORM_WELFORD_VECS 4
+#define NORM_GENERIC_LANES 16
+
+/**
+ * struct norm_operand - A per-element parameter of a normalisation kernel.
+ * @data: The parameter of element i is data[i*step].
+ * @step: One for a parameter that differs per element, or zero for one that
+ * is the same for every element.
+ */
+struct norm_operand {
+        const float *data;
+        size_t step;
+};
+
+/**
+ * struct norm_row - Parameters of a run of elements that are normalised as
+ * x_hat = (x - mean)*rstd, y = x_hat*gamma + beta.
+ *
+ * A layer normalisation row has a single mean and rstd and per-element
+ * gamma and beta, an NCHW batch normalisation plane has a single value of
+ * each, and an NHWC pixel has a value of each per element, i.e. channel.
+ * @c1, @c2: Backward pass terms, see `norm_dx_generic`.
+ */
+struct norm_row {
+        struct norm_operand mean;
+        struct norm_operand rstd;
+        struct norm_operand gamma;
+        struct norm_operand beta;
+        struct norm_operand c1;
+        struct norm_operand c2;
+        bool relu;
+};
+
+/**
+ * struct welford - Count, mean and sum of squared deviations from the mean
+ * of a set of values.
+ */
+struct welford {
+        double count;
+        double mean;
+        double m2;
+};
+
+/**
+ * norm_welford_row_fn - Merges the statistics of the `num_elems` elements of
+ * `x` into `stats`.
+ */
+typedef void norm_welford_row_fn(const float *x,
+                                 size_t num_elems,
+                                 struct welford *stats);
+
+/**
+ * norm_welford_cols_fn - Sets `mean` and `m2` to the statistics of each of
+ * the `num_cols` columns of the `num_rows` rows of `x`, `stride` floats
+ * apart.
+ */
+typedef void norm_welford_cols_fn(const float *x,
+                                  size_t num_rows,
+                                  size_t stride,
+                                  size_t num_cols,
+                                  float *mean,
+                                  float *m2);
+
+/**
+ * norm_forward_fn - Writes y = x_hat*gamma + beta, optionally ReLUed, for
+ * `num_elems` elements of `x` described by `row`.
+ */
+typedef void norm_forward_fn(const struct norm_row *row,
+                             const float *x,
+                             float *y,
+                             size_t num_elems);
+
+/**
+ * norm_sums_fn - Adds sum(dy') to `sum_dy` and sum(dy'*x_hat) to
+ * `sum_dy_xhat`, where dy' is `dy` masked by ReLU, and scaled by gamma if
+ * `is_weighted`.
+ * @sum_step: Zero to add each sum over all elements to element zero, or one
+ * to add the terms of element i to element i.
+ */
+typedef void norm_sums_fn(const struct norm_row *row,
+                          const float *x,
+                          const float *dy,
+                          size_t num_elems,
+                          bool is_weighted,
+                          float *sum_dy,
+                          float *sum_dy_xhat,
+                          size_t sum_step);
+
+/**
+ * norm_dx_fn - Writes dx = rstd*(dy'*gamma - c1 - x_hat*c2).
+ */
+typedef void norm_dx_fn(const struct norm_row *row,
+                        const float *x,
+                        const float *dy,
+                        float *dx,
+                        size_t num_elems);
+
+/**
+ * struct norm_kernels - Kernels for one instruction set.
+ */
+struct norm_kernels {
+        norm_welford_row_fn *welford_row;
+        norm_welford_cols_fn *welford_cols;
+        norm_forward_fn *forward;
+        norm_sums_fn *sums;
+        norm_dx_fn *dx;
+};
+
+/**
+ * struct norm_job - A normalisation, or its backward pass, split into tasks
+ * by `parallel_for_range`.
+ * @num_rows, @row_elems: Layer normalisation rows.
+ * @batch, @channels, @pixels: Sizes of batch normalisation images.
+ * @num_blocks: Number of blocks of channels that batch normalisation sums
+ * over, each one channel for NCHW and NORM_CHANNEL_BLOCK channels for NHWC.
+ * @num_splits: Number of parts the rows of each sum are split into.
+ * @mean, @rstd: Statistics of each row or channel.
+ * @c1, @c2: Backward pass terms of each channel, see `norm_dx_generic`.
+ * @stats_partials: Batch normalisation statistics of each channel over each
+ * split, `channels` for each of `num_splits` splits.
+ * @partials: Per-task sums for the backward pass. For layer normalisation,
+ * the gradients of gamma and beta, 2*row_elems doubles for each of
+ * `num_splits` tasks. For batch normalisation, the sums of dy and dy*x_hat
+ * of each channel over each split, 2*channels doubles per split.
+ * @block_sums: Layer normalisation's float sums of the gradients of gamma and
+ * beta over the current block of rows, 2*row_elems floats for each split.
+ */
+struct norm_job {
+        const struct norm_kernels *kernels;
+        const struct rot_norm_params *params;
+        size_t num_rows;
+        size_t row_elems;
+        size_t batch;
+        size_t channels;
+        size_t pixels;
+        bool is_nchw;
+        size_t num_blocks;
+        size_t num_splits;
+        const float *input;
+        float *output;
+        const float *gamma;
+        const float *beta;
+        const float *output_grad;
+        float *input_grad;
+        float *mean;
+        float *rstd;
+        float *c1;
+        float *c2;
+        struct welford *stats_partials;
+        double *partials;
+        float *block_sums;
+};
+
+static const float norm_one = 1.0f;
+static const float norm_zero = 0.0f;
+
+/**
+ * welford_merge() - Merges the statistics `count`, `mean` and `m2` of another
+ * set into `stats`, with Chan et al.'s pairwise update.
+ */
+static void
+welford_merge(struct welford *stats, double count, double mean, double m2)
+{
+        if (count == 0.0)
+                return;
+
+        const double total = stats->count + count;
+        const double delta = mean - stats->mean;
+        stats->mean += delta*count/total;
+        stats->m2 += m2 + delta*delta*stats->count*count/total;
+        stats->count = total;
+}
+
+/**
+ * welford_merge_lanes() - Merges `num_lanes` sets of statistics, each over
+ * `count` values, into `stats`.
+ *
+ * Since every lane has the same count, lanes are merged pairwise in a tree,
+ * where Chan's update needs no division. `num_lanes` must be a power of two
+ * no more than NORM_GENERIC_LANES.
+ */
+static void
+welford_merge_lanes(const float *mean,
+                    const float *m2,
+                    uint32_t num_lanes,
+                    double count,
+                    struct welford *stats)
+{
+        if (count == 0.0)
+                return;
+
+        double tree_mean[NORM_GENERIC_LANES];
+        double tree_m2[NORM_GENERIC_LANES];
+        for (uint32_t lane = 0;
+             lane < num_lanes;
+             ++lane) {
+                tree_mean[lane] = mean[lane];
+                tree_m2[lane] = m2[lane];
+        }
+
+        for (uint32_t width = num_lanes/2;
+             width > 0;
+             width /= 2) {
+                for (uint32_t lane = 0;
+                     lane < width;
+                     ++lane) {
+                        double delta = tree_mean[lane + width] -
+                                       tree_mean[lane];
+                        tree_mean[lane] += 0.5*delta;
+                        tree_m2[lane] += (tree_m2[lane + width] +
+                                          0.5*count*delta*delta);
+                }
+                count *= 2.0;
+        }
+
+        welford_merge(stats, count, tree_mean[0], tree_m2[0]);
+}
+
+/**
+ * welford_merge_tail() - Merges the statistics of the `num_elems` elements of
+ * `x` left over by a row kernel into `stats`, found in two passes since
+ * there are few of them.
+ */
+static void
+welford_merge_tail(const float *x, size_t num_elems, struct welford *stats)
+{
+        if (num_elems == 0)
+                return;
+
+        double mean = 0.0;
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                mean += x[i];
+        }
+        mean /= num_elems;
+
+        double m2 = 0.0;
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                double delta = x[i] - mean;
+                m2 += delta*delta;
+        }
+
+        welford_merge(stats, num_elems, mean, m2);
+}
+
+static float
+norm_get(const struct norm_operand *operand, size_t i)
+{
+        return operand->data[i*operand->step];
+}
+
+/**
+ * norm_grad_generic() - Sets `x_hat` for element `i` with value `x`, and
+ * returns its output gradient `dy` masked by ReLU.
+ */
+static float
+norm_grad_generic(const struct norm_row *row,
+                  float x,
+                  float dy,
+                  size_t i,
+                  float *x_hat)
+{
+        *x_hat = (x - norm_get(&row->mean, i))*norm_get(&row->rstd, i);
+        if (!row->relu)
+                return dy;
+
+        float y = (*x_hat)*norm_get(&row->gamma, i) + norm_get(&row->beta, i);
+        return (y > 0.0f) ? dy : 0.0f;
+}
+
+static void
+norm_welford_row_generic(const float *x,
+                         size_t num_elems,
+                         struct welford *stats)
+{
+        float mean[NORM_GENERIC_LANES] = {};
+        float m2[NORM_GENERIC_LANES] = {};
+        size_t i = 0;
+        size_t count = 0;
+        for (;
+             i + NORM_GENERIC_LANES <= num_elems;
+             i += NORM_GENERIC_LANES) {
+                ++count;
+                const float inv_count = 1.0f/count;
+                for (uint32_t lane = 0;
+                     lane < NORM_GENERIC_LANES;
+                     ++lane) {
+                        float delta = x[i + lane] - mean[lane];
+                        mean[lane] += delta*inv_count;
+                        m2[lane] += delta*(x[i + lane] - mean[lane]);
+                }
+        }
+        welford_merge_lanes(mean, m2, NORM_GENERIC_LANES, count, stats);
+        welford_merge_tail(x + i, num_elems - i, stats);
+}
+
+static void
+norm_welford_cols_generic(const float *x,
+                          size_t num_rows,
+                          size_t stride,
+                          size_t num_cols,
+                          float *mean,
+                          float *m2)
+{
+        memset(mean, 0, num_cols*sizeof(float));
+        memset(m2, 0, num_cols*sizeof(float));
+        for (size_t r = 0;
+             r < num_rows;
+             ++r) {
+                const float *x_row = x + r*stride;
+                const float inv_count = 1.0f/(r + 1);
+                for (size_t c = 0;
+                     c < num_cols;
+                     ++c) {
+                        float delta = x_row[c] - mean[c];
+                        mean[c] += delta*inv_count;
+                        m2[c] += delta*(x_row[c] - mean[c]);
+                }
+        }
+}
+
+static void
+norm_forward_generic(const struct norm_row *row,
+                     const float *x,
+                     float *y,
+                     size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                float x_hat = ((x[i] - norm_get(&row->mean, i))*
+                               norm_get(&row->rstd, i));
+                float out = (x_hat*norm_get(&row->gamma, i) +
+                             norm_get(&row->beta, i));
+                y[i] = (row->relu && !(out > 0.0f)) ? 0.0f : out;
+        }
+}
+
+static void
+norm_sums_generic(const struct norm_row *row,
+                  const float *x,
+                  const float *dy,
+                  size_t num_elems,
+                  bool is_weighted,
+                  float *sum_dy,
+                  float *sum_dy_xhat,
+                  size_t sum_step)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                float x_hat;
+                float grad = norm_grad_generic(row, x[i], dy[i], i, &x_hat);
+                if (is_weighted)
+                        grad *= norm_get(&row->gamma, i);
+
+                sum_dy[i*sum_step] += grad;
+                sum_dy_xhat[i*sum_step] += grad*x_hat;
+        }
+}
+
+/**
+ * norm_dx_generic() - Input gradient of a normalisation.
+ *
+ * With x_hat = (x - mean)*rstd over a group of n elements, and g = dy'*gamma
+ * the gradient with respect to x_hat,
+ * dx = rstd*(g - sum(g)/n - x_hat*sum(g*x_hat)/n).
+ *
+ * Layer normalisation passes c1 = sum(g)/n and c2 = sum(g*x_hat)/n per row.
+ * Batch normalisation's gamma is the same over each group, so it passes
+ * c1 = gamma*sum(dy')/n and c2 = gamma*sum(dy'*x_hat)/n per channel.
+ */
+static void
+norm_dx_generic(const struct norm_row *row,
+                const float *x,
+                const float *dy,
+                float *dx,
+                size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                float x_hat;
+                float grad = norm_grad_generic(row, x[i], dy[i], i, &x_hat);
+                dx[i] = norm_get(&row->rstd, i)*(grad*norm_get(&row->gamma, i) -
+                                                 norm_get(&row->c1, i) -
+                                                 x_hat*norm_get(&row->c2, i));
+        }
+}
+
+__attribute__((target("avx2")))
+static __m256i
+norm_mask_avx2(size_t remaining)
+{
+        return _mm256_cmpgt_epi32(_mm256_set1_epi32((int32_t)min_size(remaining,
+                                                                      8)),
+                                  _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+__attribute__((target("avx2")))
+static __m256
+norm_load_avx2(const struct norm_operand *operand, size_t i, __m256i mask)
+{
+        if (operand->step == 0)
+                return _mm256_set1_ps(operand->data[0]);
+
+        return _mm256_maskload_ps(operand->data + i, mask);
+}
+
+__attribute__((target("avx2")))
+static float
+norm_hsum_avx2(__m256 v)
+{
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v),
+                                _mm256_extractf128_ps(v, 1));
+        sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+        sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+
+        return _mm_cvtss_f32(sum);
+}
+
+__attribute__((target("avx2,fma")))
+static __m256
+norm_grad_avx2(const struct norm_row *row,
+               __m256 x,
+               __m256 dy,
+               size_t i,
+               __m256i mask,
+               __m256 *x_hat)
+{
+        *x_hat = _mm256_mul_ps(_mm256_sub_ps(x, norm_load_avx2(&row->mean,
+                                                               i,
+                                                               mask)),
+                               norm_load_avx2(&row->rstd, i, mask));
+        if (!row->relu)
+                return dy;
+
+        __m256 y = _mm256_fmadd_ps(*x_hat,
+                                   norm_load_avx2(&row->gamma, i, mask),
+                                   norm_load_avx2(&row->beta, i, mask));
+        return _mm256_and_ps(dy,
+                             _mm256_cmp_ps(y,
+                                           _mm256_setzero_ps(),
+                                           _CMP_GT_OQ));
+}
+
+/**
+ * norm_welford_step_avx2() - Welford's update of the running `mean` and `m2`
+ * of each lane with the next 8 elements `x`.
+ */
+__attribute__((target("avx2,fma")))
+static void
+norm_welford_step_avx2(const float *x,
+                       __m256 inv_count,
+                       __m256 *mean,
+                       __m256 *m2)
+{
+        __m256 x_v = _mm256_loadu_ps(x);
+        __m256 delta = _mm256_sub_ps(x_v, *mean);
+        *mean = _mm256_fmadd_ps(delta, inv_count, *mean);
+        *m2 = _mm256_fmadd_ps(delta, _mm256_sub_ps(x_v, *mean), *m2);
+}
+
+/**
+ * norm_welford_pair_avx2() - Merges the running statistics `mean_b` and
+ * `m2_b` into `mean_a` and `m2_a`, lane by lane, where every lane is over
+ * `count` values.
+ */
+__attribute__((target("avx2,fma")))
+static void
+norm_welford_pair_avx2(__m256 *mean_a,
+                       __m256 *m2_a,
+                       __m256 mean_b,
+                       __m256 m2_b,
+                       float count)
+{
+        __m256 delta = _mm256_sub_ps(mean_b, *mean_a);
+        *mean_a = _mm256_fmadd_ps(delta, _mm256_set1_ps(0.5f), *mean_a);
+        *m2_a = _mm256_add_ps(*m2_a, m2_b);
+        *m2_a = _mm256_fmadd_ps(_mm256_mul_ps(delta, delta),
+                              _mm256_set1_ps(0.5f*count),
+                              *m2_a);
+}
+
+/**
+ * NOTE(brendan): The NORM_WELFORD_VECS accumulators are separate variables
+ * rather than an array, which the compiler would keep in memory.
+ */
+__attribute__((target("avx2,fma")))
+static void
+norm_welford_row_avx2(const float *x, size_t num_elems, struct welford *stats)
+{
+        __m256 mean0 = _mm256_setzero_ps();
+        __m256 mean1 = _mm256_setzero_ps();
+        __m256 mean2 = _mm256_setzero_ps();
+        __m256 mean3 = _mm256_setzero_ps();
+        __m256 m2_0 = _mm256_setzero_ps();
+        __m256 m2_1 = _mm256_setzero_ps();
+        __m256 m2_2 = _mm256_setzero_ps();
+        __m256 m2_3 = _mm256_setzero_ps();
+        const size_t step = 8*NORM_WELFORD_VECS;
+        size_t i = 0;
+        size_t count = 0;
+        for (;
+             i + step <= num_elems;
+             i += step) {
+                ++count;
+                const __m256 inv_count = _mm256_set1_ps(1.0f/count);
+                norm_welford_step_avx2(x + i, inv_count, &mean0, &m2_0);
+                norm_welford_step_avx2(x + i + 8, inv_count, &mean1, &m2_1);
+                norm_welford_step_avx2(x + i + 16, inv_count, &mean2, &m2_2);
+                norm_welford_step_avx2(x + i + 24, inv_count, &mean3, &m2_3);
+        }
+
+        norm_welford_pair_avx2(&mean0, &m2_0, mean1, m2_1, count);
+        norm_welford_pair_avx2(&mean2, &m2_2, mean3, m2_3, count);
+        norm_welford_pair_avx2(&mean0, &m2_0, mean2, m2_2, 2*count);
+
+        float lane_mean[8];
+        float lane_m2[8];
+        _mm256_storeu_ps(lane_mean, mean0);
+        _mm256_storeu_ps(lane_m2, m2_0);
+        welford_merge_lanes(lane_mean, lane_m2, 8, 4*count, stats);
+        welford_merge_tail(x + i, num_elems - i, stats);
+}
+
+__attribute__((target("avx2,fma")))
+static void
+norm_welford_cols_avx2(const float *x,
+                       size_t num_rows,
+                       size_t stride,
+                       size_t num_cols,
+                       float *mean,
+                       float *m2)
+{
+        memset(mean, 0, num_cols*sizeof(float));
+        memset(m2, 0, num_cols*sizeof(float));
+        for (size_t r = 0;
+             r < num_rows;
+             ++r) {
+                const float *x_row = x + r*stride;
+                const __m256 inv_count = _mm256_set1_ps(1.0f/(r + 1));
+                for (size_t c = 0;
+                     c < num_cols;
+                     c += 8) {
+                        __m256i mask = norm_mask_avx2(num_cols - c);
+                        __m256 x_c = _mm256_maskload_ps(x_row + c, mask);
+                        __m256 mean_c = _mm256_maskload_ps(mean + c, mask);
+                        __m256 m2_c = _mm256_maskload_ps(m2 + c, mask);
+                        __m256 delta = _mm256_sub_ps(x_c, mean_c);
+                        mean_c = _mm256_fmadd_ps(delta, inv_count, mean_c);
+                        m2_c = _mm256_fmadd_ps(delta,
+                                               _mm256_sub_ps(x_c, mean_c),
+                                               m2_c);
+                        _mm256_maskstore_ps(mean + c, mask, mean_c);
+                        _mm256_maskstore_ps(m2 + c, mask, m2_c);
+                }
+        }
+}
+
+__attribute__((target("avx2,fma")))
+static void
+norm_forward_avx2(const struct norm_row *row,
+                  const float *x,
+                  float *y,
+                  size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             i += 8) {
+                __m256i mask = norm_mask_avx2(num_elems - i);
+                __m256 x_hat = _mm256_mul_ps(
+                        _mm256_sub_ps(_mm256_maskload_ps(x + i, mask),
+                                      norm_load_avx2(&row->mean, i, mask)),
+                        norm_load_avx2(&row->rstd, i, mask));
+                __m256 out = _mm256_fmadd_ps(
+                        x_hat,
+                        norm_load_avx2(&row->gamma, i, mask),
+                        norm_load_avx2(&row->beta, i, mask));
+                if (row->relu)
+                        out = _mm256_max_ps(out, _mm256_setzero_ps());
+
+                _mm256_maskstore_ps(y + i, mask, out);
+        }
+}
+
+__attribute__((target("avx2,fma")))
+static void
+norm_sums_avx2(const struct norm_row *row,
+               const float *x,
+               const float *dy,
+               size_t num_elems,
+               bool is_weighted,
+               float *sum_dy,
+               float *sum_dy_xhat,
+               size_t sum_step)
+{
+        __m256 acc_dy = _mm256_setzero_ps();
+        __m256 acc_dy_xhat = _mm256_setzero_ps();
+        for (size_t i = 0;
+             i < num_elems;
+             i += 8) {
+                __m256i mask = norm_mask_avx2(num_elems - i);
+                __m256 x_hat;
+                __m256 grad = norm_grad_avx2(row,
+                                             _mm256_maskload_ps(x + i, mask),
+                                             _mm256_maskload_ps(dy + i, mask),
+                                             i,
+                                             mask,
+                                             &x_hat);
+                if (is_weighted)
+                        grad = _mm256_mul_ps(grad,
+                                             norm_load_avx2(&row->gamma,
+                                                            i,
+                                                            mask));
+
+                if (sum_step == 0) {
+                        acc_dy = _mm256_add_ps(acc_dy, grad);
+                        acc_dy_xhat = _mm256_fmadd_ps(grad, x_hat, acc_dy_xhat);
+                        continue;
+                }
+
+                __m256 sum = _mm256_maskload_ps(sum_dy + i, mask);
+                _mm256_maskstore_ps(sum_dy + i,
+                                    mask,
+                                    _mm256_add_ps(sum, grad));
+                sum = _mm256_maskload_ps(sum_dy_xhat + i, mask);
+                _mm256_maskstore_ps(sum_dy_xhat + i,
+                                    mask,
+                                    _mm256_fmadd_ps(grad, x_hat, sum));
+        }
+
+        if (sum_step == 0) {
+                *sum_dy += norm_hsum_avx2(acc_dy);
+                *sum_dy_xhat += norm_hsum_avx2(acc_dy_xhat);
+        }
+}
+
+__attribute__((target("avx2,fma")))
+static void
+norm_dx_avx2(const struct norm_row *row,
+             const float *x,
+             const float *dy,
+             float *dx,
+             size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             i += 8) {
+                __m256i mask = norm_mask_avx2(num_elems - i);
+                __m256 x_hat;
+                __m256 grad = norm_grad_avx2(row,
+                                             _mm256_maskload_ps(x + i, mask),
+                                             _mm256_maskload_ps(dy + i, mask),
+                                             i,
+                                             mask,
+                                             &x_hat);
+                __m256 t = _mm256_fmsub_ps(grad,
+                                           norm_load_avx2(&row->gamma,
+                                                          i,
+                                                          mask),
+                                           norm_load_avx2(&row->c1, i, mask));
+                t = _mm256_fnmadd_ps(x_hat,
+                                     norm_load_avx2(&row->c2, i, mask),
+                                     t);
+                _mm256_maskstore_ps(dx + i,
+                                    mask,
+                                    _mm256_mul_ps(t,
+                                                  norm_load_avx2(&row->rstd,
+                                                                 i,
+                                                                 mask)));
+        }
+}
+
+__attribute__((target("avx512f")))
+static __mmask16
+norm_mask_avx512(size_t remaining)
+{
+        return (remaining >= 16) ? 0xFFFF : ((1u << remaining) - 1);
+}
+
+__attribute__((target("avx512f")))
+static __m512
+norm_load_avx512(const struct norm_operand *operand, size_t i, __mmask16 mask)
+{
+        if (operand->step == 0)
+                return _mm512_set1_ps(operand->data[0]);
+
+        return _mm512_maskz_loadu_ps(mask, operand->data + i);
+}
+
+__attribute__((target("avx512f")))
+static __m512
+norm_grad_avx512(const struct norm_row *row,
+                 __m512 x,
+                 __m512 dy,
+                 size_t i,
+                 __mmask16 mask,
+                 __m512 *x_hat)
+{
+        *x_hat = _mm512_mul_ps(_mm512_sub_ps(x, norm_load_avx512(&row->mean,
+                                                                 i,
+                                                                 mask)),
+                               norm_load_avx512(&row->rstd, i, mask));
+        if (!row->relu)
+                return dy;
+
+        __m512 y = _mm512_fmadd_ps(*x_hat,
+                                   norm_load_avx512(&row->gamma, i, mask),
+                                   norm_load_avx512(&row->beta, i, mask));
+        __mmask16 is_positive = _mm512_cmp_ps_mask(y,
+                                                   _mm512_setzero_ps(),
+                                                   _CMP_GT_OQ);
+        return _mm512_maskz_mov_ps(is_positive, dy);
+}
+
+/**
+ * norm_welford_step_avx512() - Welford's update of the running `mean` and `m2`
+ * of each lane with the next 16 elements `x`.
+ */
+__attribute__((target("avx512f")))
+static void
+norm_welford_step_avx512(const float *x,
+                         __m512 inv_count,
+                         __m512 *mean,
+                         __m512 *m2)
+{
+        __m512 x_v = _mm512_loadu_ps(x);
+        __m512 delta = _mm512_sub_ps(x_v, *mean);
+        *mean = _mm512_fmadd_ps(delta, inv_count, *mean);
+        *m2 = _mm512_fmadd_ps(delta, _mm512_sub_ps(x_v, *mean), *m2);
+}
+
+/**
+ * norm_welford_pair_avx512() - Merges the running statistics `mean_b` and
+ * `m2_b` into `mean_a` and `m2_a`, lane by lane, where every lane is over
+ * `count` values.
+ */
+__attribute__((target("avx512f")))
+static void
+norm_welford_pair_avx512(__m512 *mean_a,
+                         __m512 *m2_a,
+                         __m512 mean_b,
+                         __m512 m2_b,
+                         float count)
+{
+        __m512 delta = _mm512_sub_ps(mean_b, *mean_a);
+        *mean_a = _mm512_fmadd_ps(delta, _mm512_set1_ps(0.5f), *mean_a);
+        *m2_a = _mm512_add_ps(*m2_a, m2_b);
+        *m2_a = _mm512_fmadd_ps(_mm512_mul_ps(delta, delta),
+                              _mm512_set1_ps(0.5f*count),
+                              *m2_a);
+}
+
+/**
+ * NOTE(brendan): The NORM_WELFORD_VECS accumulators are separate variables
+ * rather than an array, which the compiler would keep in memory.
+ */
+__attribute__((target("avx512f")))
+static void
+norm_welford_row_avx512(const float *x,
+                        size_t num_elems,
+                        struct welford *stats)
+{
+        __m512 mean0 = _mm512_setzero_ps();
+        __m512 mean1 = _mm512_setzero_ps();
+        __m512 mean2 = _mm512_setzero_ps();
+        __m512 mean3 = _mm512_setzero_ps();
+        __m512 m2_0 = _mm512_setzero_ps();
+        __m512 m2_1 = _mm512_setzero_ps();
+        __m512 m2_2 = _mm512_setzero_ps();
+        __m512 m2_3 = _mm512_setzero_ps();
+        const size_t step = 16*NORM_WELFORD_VECS;
+        size_t i = 0;
+        size_t count = 0;
+        for (;
+             i + step <= num_elems;
+             i += step) {
+                ++count;
+                const __m512 inv_count = _mm512_set1_ps(1.0f/count);
+                norm_welford_step_avx512(x + i, inv_count, &mean0, &m2_0);
+                norm_welford_step_avx512(x + i + 16, inv_count, &mean1, &m2_1);
+                norm_welford_step_avx512(x + i + 32, inv_count, &mean2, &m2_2);
+                norm_welford_step_avx512(x + i + 48, inv_count, &mean3, &m2_3);
+        }
+
+        norm_welford_pair_avx512(&mean0, &m2_0, mean1, m2_1, count);
+        norm_welford_pair_avx512(&mean2, &m2_2, mean3, m2_3, count);
+        norm_welford_pair_avx512(&mean0, &m2_0, mean2, m2_2, 2*count);
+
+        float lane_mean[16];
+        float lane_m2[16];
+        _mm512_storeu_ps(lane_mean, mean0);
+        _mm512_storeu_ps(lane_m2, m2_0);
+        welford_merge_lanes(lane_mean, lane_m2, 16, 4*count, stats);
+        welford_merge_tail(x + i, num_elems - i, stats);
+}
+
+__attribute__((target("avx512f")))
+static void
+norm_welford_cols_avx512(const float *x,
+                         size_t num_rows,
+                         size_t stride,
+                         size_t num_cols,
+                         float *mean,
+                         float *m2)
+{
+        memset(mean, 0, num_cols*sizeof(float));
+        memset(m2, 0, num_cols*sizeof(float));
+        for (size_t r = 0;
+             r < num_rows;
+             ++r) {
+                const float *x_row = x + r*stride;
+                const __m512 inv_count = _mm512_set1_ps(1.0f/(r + 1));
+                for (size_t c = 0;
+                     c < num_cols;
+                     c += 16) {
+                        __mmask16 mask = norm_mask_avx512(num_cols - c);
+                        __m512 x_c = _mm512_maskz_loadu_ps(mask, x_row + c);
+                        __m512 mean_c = _mm512_maskz_loadu_ps(mask, mean + c);
+                        __m512 m2_c = _mm512_maskz_loadu_ps(mask, m2 + c);
+                        __m512 delta = _mm512_sub_ps(x_c, mean_c);
+                        mean_c = _mm512_fmadd_ps(delta, inv_count, mean_c);
+                        m2_c = _mm512_fmadd_ps(delta,
+                                               _mm512_sub_ps(x_c, mean_c),
+                                               m2_c);
+                        _mm512_mask_storeu_ps(mean + c, mask, mean_c);
+                        _mm512_mask_storeu_ps(m2 + c, mask, m2_c);
+                }
+        }
+}
+
+__attribute__((target("avx512f")))
+static void
+norm_forward_avx512(const struct norm_row *row,
+                    const float *x,
+                    float *y,
+                    size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             i += 16) {
+                __mmask16 mask = norm_mask_avx512(num_elems - i);
+                __m512 x_hat = _mm512_mul_ps(
+                        _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, x + i),
+                                      norm_load_avx512(&row->mean, i, mask)),
+                        norm_load_avx512(&row->rstd, i, mask));
+                __m512 out = _mm512_fmadd_ps(
+                        x_hat,
+                        norm_load_avx512(&row->gamma, i, mask),
+                        norm_load_avx512(&row->beta, i, mask));
+                if (row->relu)
+                        out = _mm512_max_ps(out, _mm512_setzero_ps());
+
+                _mm512_mask_storeu_ps(y + i, mask, out);
+        }
+}
+
+__attribute__((target("avx512f")))
+static void
+norm_sums_avx512(const struct norm_row *row,
+                 const float *x,
+                 const float *dy,
+                 size_t num_elems,
+                 bool is_weighted,
+                 float *sum_dy,
+                 float *sum_dy_xhat,
+                 size_t sum_step)
+{
+        __m512 acc_dy = _mm512_setzero_ps();
+        __m512 acc_dy_xhat = _mm512_setzero_ps();
+        for (size_t i = 0;
+             i < num_elems;
+             i += 16) {
+                __mmask16 mask = norm_mask_avx512(num_elems - i);
+                __m512 x_hat;
+                __m512 grad = norm_grad_avx512(
+                        row,
+                        _mm512_maskz_loadu_ps(mask, x + i),
+                        _mm512_maskz_loadu_ps(mask, dy + i),
+                        i,
+                        mask,
+                        &x_hat);
+                if (is_weighted)
+                        grad = _mm512_mul_ps(grad,
+                                             norm_load_avx512(&row->gamma,
+                                                              i,
+                                                              mask));
+
+                if (sum_step == 0) {
+                        acc_dy = _mm512_add_ps(acc_dy, grad);
+                        acc_dy_xhat = _mm512_fmadd_ps(grad, x_hat, acc_dy_xhat);
+                        continue;
+                }
+
+                __m512 sum = _mm512_maskz_loadu_ps(mask, sum_dy + i);
+                _mm512_mask_storeu_ps(sum_dy + i,
+                                      mask,
+                                      _mm512_add_ps(sum, grad));
+                sum = _mm512_maskz_loadu_ps(mask, sum_dy_xhat + i);
+                _mm512_mask_storeu_ps(sum_dy_xhat + i,
+                                      mask,
+                                      _mm512_fmadd_ps(grad, x_hat, sum));
+        }
+
+        if (sum_step == 0) {
+                *sum_dy += _mm512_reduce_add_ps(acc_dy);
+                *sum_dy_xhat += _mm512_reduce_add_ps(acc_dy_xhat);
+        }
+}
+
+__attribute__((target("avx512f")))
+static void
+norm_dx_avx512(const struct norm_row *row,
+               const float *x,
+               const float *dy,
+               float *dx,
+               size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             i += 16) {
+                __mmask16 mask = norm_mask_avx512(num_elems - i);
+                __m512 x_hat;
+                __m512 grad = norm_grad_avx512(
+                        row,
+                        _mm512_maskz_loadu_ps(mask, x + i),
+                        _mm512_maskz_loadu_ps(mask, dy + i),
+                        i,
+                        mask,
+                        &x_hat);
+                __m512 t = _mm512_fmsub_ps(grad,
+                                           norm_load_avx512(&row->gamma,
+                                                            i,
+                                                            mask),
+                                           norm_load_avx512(&row->c1,
+                                                            i,
+                                                            mask));
+                t = _mm512_fnmadd_ps(x_hat,
+                                     norm_load_avx512(&row->c2, i, mask),
+                                     t);
+                _mm512_mask_storeu_ps(
+                        dx + i,
+                        mask,
+                        _mm512_mul_ps(t, norm_load_avx512(&row->rstd,
+                                                          i,
+                                                          mask)));
+        }
+}
+
+static const struct norm_kernels norm_kernels_generic = {
+        norm_welford_row_generic,
+        norm_welford_cols_generic,
+        norm_forward_generic,
+        norm_sums_generic,
+        norm_dx_generic};
+
+static const struct norm_kernels norm_kernels_avx2 = {
+        norm_welford_row_avx2,
+        norm_welford_cols_avx2,
+        norm_forward_avx2,
+        norm_sums_avx2,
+        norm_dx_avx2};
+
+static const struct norm_kernels norm_kernels_avx512 = {
+        norm_welford_row_avx512,
+        norm_welford_cols_avx512,
+        norm_forward_avx512,
+        norm_sums_avx512,
+        norm_dx_avx512};
+
+static const struct norm_kernels *
+norm_get_kernels(void)
+{
+        enum cpu_isa isa = cpu_get_isa();
+        if (isa >= CPU_ISA_AVX512)
+                return &norm_kernels_avx512;
+
+        if (isa >= CPU_ISA_AVX2)
+                return &norm_kernels_avx2;
+
+        return &norm_kernels_generic;
+}
+
+/**
+ * norm_add_stats() - Merges the statistics of the `num_elems` elements of `x`
+ * into `stats`, NORM_BLOCK_ELEMS elements at a time.
+ */
+static void
+norm_add_stats(const struct norm_job *job,
+               const float *x,
+               size_t num_elems,
+               struct welford *stats)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             i += NORM_BLOCK_ELEMS) {
+                job->kernels->welford_row(x + i,
+                                          min_size(num_elems - i,
+                                                   NORM_BLOCK_ELEMS),
+                                          stats);
+        }
+}
+
+static float
+norm_get_rstd(double variance, float epsilon)
+{
+        return (float)(1.0/sqrt(variance + epsilon));
+}
+
+/**
+ * norm_set_affine() - Points the gamma and beta of `row` at `gamma` and
+ * `beta` with `step`, or at one and zero if there are none.
+ */
+static void
+norm_set_affine(struct norm_row *row,
+                const float *gamma,
+                const float *beta,
+                size_t step)
+{
+        if (gamma == NULL) {
+                row->gamma = (struct norm_operand){&norm_one, 0};
+                row->beta = (struct norm_operand){&norm_zero, 0};
+                return;
+        }
+
+        row->gamma = (struct norm_operand){gamma, step};
+        row->beta = (struct norm_operand){beta, step};
+}
+
+/**
+ * norm_run() - Runs `range_fn` over [0, num_tasks), across threads if the
+ * `num_elems` elements touched are enough to pay for it.
+ */
+static void
+norm_run(size_t num_tasks,
+         size_t num_elems,
+         parallel_range_fn *range_fn,
+         struct norm_job *job)
+{
+        if ((num_elems < NORM_MIN_PARALLEL_ELEMS) ||
+            (thread_get_num_workers() == 1)) {
+                range_fn(job, 0, num_tasks);
+                return;
+        }
+
+        const size_t elems_per_task = ceil_div(num_elems, num_tasks);
+        parallel_for_range(0,
+                           num_tasks,
+                           ceil_div(NORM_GRAIN_ELEMS, elems_per_task),
+                           range_fn,
+                           job);
+}
+
+/**
+ * norm_check_tensor() - Is `tensor` a contiguous float32 CPU tensor?
+ */
+static bool
+norm_check_tensor(const struct rot_tensor *tensor)
+{
+        return ((tensor->backend == ROT_BACKEND_CPU) &&
+                (tensor->dtype == ROT_DTYPE_FLOAT32) &&
+                tensor_is_contiguous(tensor));
+}
+
+/**
+ * norm_check_same() - Are `a` and `b` contiguous float32 CPU tensors with the
+ * same dimensions?
+ */
+static bool
+norm_check_same(const struct rot_tensor *a, const struct rot_tensor *b)
+{
+        if (!norm_check_tensor(a) ||
+            !norm_check_tensor(b) ||
+            (a->num_dims != b->num_dims))
+                return false;
+
+        for (uint32_t dim = 0;
+             dim < a->num_dims;
+             ++dim) {
+                if (a->dims[dim] != b->dims[dim])
+                        return false;
+        }
+
+        return true;
+}
+
+/**
+ * norm_check_in_place() - Are `a` and `b`, checked by `norm_check_same`,
+ * either the same data or disjoint? The passes are elementwise so can run in
+ * place, but not on views of one buffer at different offsets.
+ */
+static bool
+norm_check_in_place(const struct rot_tensor *a, const struct rot_tensor *b)
+{
+        if ((a->cpu.data == b->cpu.data) || !tensor_is_overlapping(a, b))
+                return true;
+
+        LOG_ERROR("Normalisation operands must either be the same tensor or "
+                  "not overlap.");
+        return false;
+}
+
+/**
+ * norm_check_vector() - Is `tensor` NULL, or a contiguous float32 CPU tensor
+ * of `num_elems` elements?
+ */
+static bool
+norm_check_vector(const struct rot_tensor *tensor, size_t num_elems)
+{
+        return ((tensor == NULL) ||
+                (norm_check_tensor(tensor) &&
+                 (tensor_get_num_elems(tensor) == num_elems)));
+}
+
+/**
+ * norm_check_affine() - Checks that `gamma`, `beta`, and the gradients
+ * `gamma_grad` and `beta_grad` if they are not NULL, have `num_elems`
+ * elements, and that gamma and beta are either both given or both NULL.
+ */
+static bool
+norm_check_affine(const struct rot_tensor *gamma,
+                  const struct rot_tensor *beta,
+                  const struct rot_tensor *gamma_grad,
+                  const struct rot_tensor *beta_grad,
+                  size_t num_elems)
+{
+        if ((gamma == NULL) != (beta == NULL)) {
+                LOG_ERROR("Normalisation gamma and beta must both be given, "
+                          "or both be NULL.");
+                return false;
+        }
+
+        if (!norm_check_vector(gamma, num_elems) ||
+            !norm_check_vector(beta, num_elems) ||
+            !norm_check_vector(gamma_grad, num_elems) ||
+            !norm_check_vector(beta_grad, num_elems)) {
+                LOG_ERROR("Normalisation gamma, beta and their gradients "
+                          "must be contiguous float32 CPU tensors with one "
+                          "element per normalised feature.");
+                return false;
+        }
+
+        return true;
+}
+
+/**
+ * norm_alloc_stats() - Allocates `count` means and reciprocal standard
+ * deviations for `stats` from `arena`.
+ */
+static bool
+norm_alloc_stats(struct rot_norm_stats *stats, rot_arena_t arena, size_t count)
+{
+        stats->count = count;
+        stats->mean = (float *)ROT_arena_malloc(arena,
+                                                count*sizeof(float),
+                                                ROT_BACKEND_CPU);
+        stats->rstd = (float *)ROT_arena_malloc(arena,
+                                                count*sizeof(float),
+                                                ROT_BACKEND_CPU);
+
+        return (stats->mean != NULL) && (stats->rstd != NULL);
+}
+
+/**
+ * norm_flush_sums() - Adds the `num_elems` single precision sums of a block
+ * to the double precision totals `totals`, and clears them for the next
+ * block.
+ */
+static void
+norm_flush_sums(float *sums, double *totals, size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                totals[i] += sums[i];
+                sums[i] = 0.0f;
+        }
+}
+
+static void
+layernorm_range(void *context, size_t begin, size_t end)
+{
+        const struct norm_job *job = (const struct norm_job *)context;
+        const size_t row_elems = job->row_elems;
+        struct norm_row row = {};
+        norm_set_affine(&row, job->gamma, job->beta, 1);
+        row.relu = job->params->relu;
+
+        for (size_t r = begin;
+             r < end;
+             ++r) {
+                const float *x = job->input + r*row_elems;
+                struct welford stats = {};
+                norm_add_stats(job, x, row_elems, &stats);
+                float mean = (float)stats.mean;
+                float rstd = norm_get_rstd(stats.m2/row_elems,
+                                           job->params->epsilon);
+                if (job->mean != NULL) {
+                        job->mean[r] = mean;
+                        job->rstd[r] = rstd;
+                }
+
+                row.mean = (struct norm_operand){&mean, 0};
+                row.rstd = (struct norm_operand){&rstd, 0};
+                job->kernels->forward(&row,
+                                      x,
+                                      job->output + r*row_elems,
+                                      row_elems);
+        }
+}
+
+rot_tensor_t ROT_layernorm(rot_tensor_t result,
+                           struct rot_norm_stats *stats,
+                           rot_arena_t arena,
+                           const rot_tensor_t input,
+                           const rot_tensor_t gamma,
+                           const rot_tensor_t beta,
+                           const struct rot_norm_params *params)
+{
+        if ((result == NULL) ||
+            (input == NULL) ||
+            (params == NULL) ||
+            ((stats != NULL) && (arena == NULL))) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (!norm_check_same(result, input) || (input->num_dims == 0)) {
+                LOG_ERROR("Layer normalisation input and result must be "
+                          "contiguous float32 CPU tensors with the same "
+                          "dimensions.");
+                return NULL;
+        }
+
+        if (!norm_check_in_place(result, input))
+                return NULL;
+
+        const size_t row_elems = input->dims[input->num_dims - 1];
+        if (!norm_check_affine(gamma, beta, NULL, NULL, row_elems))
+                return NULL;
+
+        struct norm_job job = {};
+        job.kernels = norm_get_kernels();
+        job.params = params;
+        job.row_elems = row_elems;
+        job.num_rows = (row_elems == 0) ?
+                       0 : tensor_get_num_elems(input)/row_elems;
+        job.input = input->cpu.data;
+        job.output = result->cpu.data;
+        job.gamma = (gamma != NULL) ? gamma->cpu.data : NULL;
+        job.beta = (beta != NULL) ? beta->cpu.data : NULL;
+        if (stats != NULL) {
+                if (!norm_alloc_stats(stats, arena, job.num_rows))
+                        return NULL;
+
+                job.mean = stats->mean;
+                job.rstd = stats->rstd;
+        }
+
+        norm_run(job.num_rows,
+                 tensor_get_num_elems(input),
+                 layernorm_range,
+                 &job);
+
+        return result;
+}
+
+/**
+ * layernorm_backward_split() - Backward pass of split `split_i` of the rows,
+ * which also sums that split's part of the gradients of gamma and beta into
+ * its partials, if they are wanted.
+ */
+static void
+layernorm_backward_split(const struct norm_job *job, size_t split_i)
+{
+        const size_t row_elems = job->row_elems;
+        const size_t begin = split_i*job->num_rows/job->num_splits;
+        const size_t end = (split_i + 1)*job->num_rows/job->num_splits;
+
+        float *block_sums = NULL;
+        double *partials = NULL;
+        if (job->partials != NULL) {
+                partials = job->partials + 2*split_i*row_elems;
+                memset(partials, 0, 2*row_elems*sizeof(double));
+                block_sums = job->block_sums + 2*split_i*row_elems;
+                memset(block_sums, 0, 2*row_elems*sizeof(float));
+        }
+
+        struct norm_row row = {};
+        norm_set_affine(&row, job->gamma, job->beta, 1);
+        row.relu = job->params->relu;
+        for (size_t r = begin;
+             r < end;
+             ++r) {
+                const size_t offset = r*row_elems;
+                const float *x = job->input + offset;
+                const float *dy = job->output_grad + offset;
+                row.mean = (struct norm_operand){job->mean + r, 0};
+                row.rstd = (struct norm_operand){job->rstd + r, 0};
+
+                if ((block_sums != NULL) &&
+                    (r > begin) &&
+                    ((r - begin) % NORM_BLOCK_ROWS == 0))
+                        norm_flush_sums(block_sums, partials, 2*row_elems);
+
+                float sum_dy = 0.0f;
+                float sum_dy_xhat = 0.0f;
+                job->kernels->sums(&row,
+                                   x,
+                                   dy,
+                                   row_elems,
+                                   true,
+                                   &sum_dy,
+                                   &sum_dy_xhat,
+                                   0);
+                float c1 = sum_dy/row_elems;
+                float c2 = sum_dy_xhat/row_elems;
+                row.c1 = (struct norm_operand){&c1, 0};
+                row.c2 = (struct norm_operand){&c2, 0};
+
+                if (block_sums != NULL)
+                        job->kernels->sums(&row,
+                                           x,
+                                           dy,
+                                           row_elems,
+                                           false,
+                                           block_sums,
+                                           block_sums + row_elems,
+                                           1);
+
+                job->kernels->dx(&row,
+                                 x,
+                                 dy,
+                                 job->input_grad + offset,
+                                 row_elems);
+        }
+
+        if (block_sums != NULL)
+                norm_flush_sums(block_sums, partials, 2*row_elems);
+}
+
+static void
+layernorm_backward_range(void *context, size_t begin, size_t end)
+{
+        const struct norm_job *job = (const struct norm_job *)context;
+        for (size_t split_i = begin;
+             split_i < end;
+             ++split_i) {
+                layernorm_backward_split(job, split_i);
+        }
+}
+
+/**
+ * norm_get_num_splits() - Returns the number of parts to split each of
+ * `num_blocks` sums over `num_rows` rows into, so that there are a few tasks
+ * per thread but each task still touches about NORM_GRAIN_ELEMS of the
+ * `num_elems` elements.
+ */
+static size_t
+norm_get_num_splits(size_t num_blocks, size_t num_rows, size_t num_elems)
+{
+        const size_t num_workers = thread_get_num_workers();
+        if ((num_elems < NORM_MIN_PARALLEL_ELEMS) || (num_workers == 1))
+                return 1;
+
+        size_t num_splits = ceil_div(4*num_workers, num_blocks);
+        num_splits = min_size(num_splits,
+                              num_elems/(num_blocks*NORM_GRAIN_ELEMS));
+        num_splits = min_size(num_splits, num_rows);
+
+        return (num_splits > 0) ? num_splits : 1;
+}
+
+/**
+ * norm_get_doubles() - Returns a scratch buffer of `num_doubles` doubles, see
+ * `conv_get_scratch`.
+ */
+static double *
+norm_get_doubles(size_t num_doubles, rot_arena_t *arena, rot_arena_mark_t *mark)
+{
+        const size_t floats_per_double = sizeof(double)/sizeof(float);
+
+        return (double *)conv_get_scratch(floats_per_double*num_doubles,
+                                          arena,
+                                          mark);
+}
+
+rot_tensor_t ROT_layernorm_backward(rot_tensor_t input_grad,
+                                    rot_tensor_t gamma_grad,
+                                    rot_tensor_t beta_grad,
+                                    const rot_tensor_t output_grad,
+                                    const rot_tensor_t input,
+                                    const rot_tensor_t gamma,
+                                    const rot_tensor_t beta,
+                                    const struct rot_norm_stats *stats,
+                                    const struct rot_norm_params *params)
+{
+        if ((input_grad == NULL) ||
+            (output_grad == NULL) ||
+            (input == NULL) ||
+            (stats == NULL) ||
+            (params == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (!norm_check_same(input_grad, input) ||
+            !norm_check_same(output_grad, input) ||
+            (input->num_dims == 0)) {
+                LOG_ERROR("Layer normalisation gradients and input must be "
+                          "contiguous float32 CPU tensors with the same "
+                          "dimensions.");
+                return NULL;
+        }
+
+        if (!norm_check_in_place(input_grad, output_grad) ||
+            !norm_check_in_place(input_grad, input))
+                return NULL;
+
+        const size_t row_elems = input->dims[input->num_dims - 1];
+        if (!norm_check_affine(gamma, beta, gamma_grad, beta_grad, row_elems))
+                return NULL;
+
+        const size_t num_elems = tensor_get_num_elems(input);
+        const size_t num_rows = (row_elems == 0) ? 0 : num_elems/row_elems;
+        if (stats->count != num_rows) {
+                LOG_ERROR("Layer normalisation statistics must have one "
+                          "mean and rstd per row.");
+                return NULL;
+        }
+
+        struct norm_job job = {};
+        job.kernels = norm_get_kernels();
+        job.params = params;
+        job.row_elems = row_elems;
+        job.num_rows = num_rows;
+        job.input = input->cpu.data;
+        job.gamma = (gamma != NULL) ? gamma->cpu.data : NULL;
+        job.beta = (beta != NULL) ? beta->cpu.data : NULL;
+        job.output_grad = output_grad->cpu.data;
+        job.input_grad = input_grad->cpu.data;
+        job.mean = stats->mean;
+        job.rstd = stats->rstd;
+        job.num_splits = norm_get_num_splits(1, num_rows, num_elems);
+
+        const bool has_affine_grad = (gamma_grad != NULL) ||
+                                     (beta_grad != NULL);
+        rot_arena_t scratch_arena = NULL;
+        rot_arena_mark_t scratch_mark = NULL;
+        if (has_affine_grad) {
+                job.partials = norm_get_doubles(3*row_elems*job.num_splits,
+                                                &scratch_arena,
+                                                &scratch_mark);
+                if (job.partials == NULL) {
+                        LOG_ERROR("Failed to allocate layer normalisation "
+                                  "gradient sums.");
+                        return NULL;
+                }
+                job.block_sums = (float *)(job.partials +
+                                           2*row_elems*job.num_splits);
+        }
+
+        norm_run(job.num_splits,
+                 num_elems,
+                 layernorm_backward_range,
+                 &job);
+
+        if (!has_affine_grad)
+                return input_grad;
+
+        /**
+         * NOTE(brendan): The partials are reduced in a fixed order, so the
+         * gradients of gamma and beta only depend on the number of splits.
+         */
+        for (size_t i = 0;
+             i < row_elems;
+             ++i) {
+                double sum_dy = 0.0;
+                double sum_dy_xhat = 0.0;
+                for (size_t split_i = 0;
+                     split_i < job.num_splits;
+                     ++split_i) {
+                        const double *partials = (job.partials +
+                                                  2*split_i*row_elems);
+                        sum_dy += partials[i];
+                        sum_dy_xhat += partials[row_elems + i];
+                }
+
+                if (beta_grad != NULL)
+                        beta_grad->cpu.data[i] = (float)sum_dy;
+                if (gamma_grad != NULL)
+                        gamma_grad->cpu.data[i] = (float)sum_dy_xhat;
+        }
+
+        conv_put_scratch((float *)job.partials, scratch_arena, scratch_mark);
+
+        return input_grad;
+}
+
+/**
+ * batchnorm_get_rows() - Sets `begin` and `end` to the range of rows, i.e.
+ * images for NCHW and pixels for NHWC, in split `split_i`.
+ */
+static void
+batchnorm_get_rows(const struct norm_job *job,
+                   size_t split_i,
+                   size_t *begin,
+                   size_t *end)
+{
+        const size_t num_rows = job->is_nchw ?
+                                job->batch : job->batch*job->pixels;
+        *begin = split_i*num_rows/job->num_splits;
+        *end = (split_i + 1)*num_rows/job->num_splits;
+}
+
+/**
+ * batchnorm_set_row() - Points the operands of `row` at those of the
+ * channels from `channel`, with `step` zero for a single channel and one for
+ * consecutive channels.
+ */
+static void
+batchnorm_set_row(const struct norm_job *job,
+                  struct norm_row *row,
+                  size_t channel,
+                  size_t step)
+{
+        row->mean = (struct norm_operand){job->mean + channel, step};
+        row->rstd = (struct norm_operand){job->rstd + channel, step};
+        if (job->gamma != NULL)
+                norm_set_affine(row,
+                                job->gamma + channel,
+                                job->beta + channel,
+                                step);
+        else
+                norm_set_affine(row, NULL, NULL, step);
+        if (job->c1 != NULL) {
+                row->c1 = (struct norm_operand){job->c1 + channel, step};
+                row->c2 = (struct norm_operand){job->c2 + channel, step};
+        }
+        row->relu = job->params->relu;
+}
+
+/**
+ * batchnorm_stats_task() - Finds the statistics of block `block_i` of
+ * channels over split `split_i` of the rows.
+ */
+static void
+batchnorm_stats_task(const struct norm_job *job, size_t block_i, size_t split_i)
+{
+        const size_t channels = job->channels;
+        struct welford *partials = (job->stats_partials +
+                                    split_i*channels);
+        size_t begin;
+        size_t end;
+        batchnorm_get_rows(job, split_i, &begin, &end);
+
+        if (job->is_nchw) {
+                const size_t c = block_i;
+                struct welford stats = {};
+                for (size_t n = begin;
+                     n < end;
+                     ++n) {
+                        norm_add_stats(job,
+                                       (job->input +
+                                        (n*channels + c)*job->pixels),
+                                       job->pixels,
+                                       &stats);
+                }
+                partials[c] = stats;
+                return;
+        }
+
+        const size_t c0 = block_i*NORM_CHANNEL_BLOCK;
+        const size_t num_cols = min_size(channels - c0, NORM_CHANNEL_BLOCK);
+        struct welford stats[NORM_CHANNEL_BLOCK] = {};
+        float mean[NORM_CHANNEL_BLOCK];
+        float m2[NORM_CHANNEL_BLOCK];
+        for (size_t r = begin;
+             r < end;
+             r += NORM_BLOCK_ROWS) {
+                const size_t num_rows = min_size(end - r, NORM_BLOCK_ROWS);
+                job->kernels->welford_cols(job->input + r*channels + c0,
+                                           num_rows,
+                                           channels,
+                                           num_cols,
+                                           mean,
+                                           m2);
+                for (size_t c = 0;
+                     c < num_cols;
+                     ++c) {
+                        welford_merge(stats + c, num_rows, mean[c], m2[c]);
+                }
+        }
+        memcpy(partials + c0, stats, num_cols*sizeof(struct welford));
+}
+
+/**
+ * batchnorm_sums_task() - Sums dy' and dy'*x_hat of block `block_i` of
+ * channels over split `split_i` of the rows.
+ */
+static void
+batchnorm_sums_task(const struct norm_job *job, size_t block_i, size_t split_i)
+{
+        const size_t channels = job->channels;
+        double *partials = job->partials + 2*split_i*channels;
+        size_t begin;
+        size_t end;
+        batchnorm_get_rows(job, split_i, &begin, &end);
+
+        struct norm_row row = {};
+        if (job->is_nchw) {
+                const size_t c = block_i;
+                batchnorm_set_row(job, &row, c, 0);
+                double sum_dy = 0.0;
+                double sum_dy_xhat = 0.0;
+                for (size_t n = begin;
+                     n < end;
+                     ++n) {
+                        const size_t offset = (n*channels + c)*job->pixels;
+                        for (size_t i = 0;
+                             i < job->pixels;
+                             i += NORM_BLOCK_ELEMS) {
+                                float block_dy = 0.0f;
+                                float block_dy_xhat = 0.0f;
+                                job->kernels->sums(
+                                        &row,
+                                        job->input + offset + i,
+                                        job->output_grad + offset + i,
+                                        min_size(job->pixels - i,
+                                                 NORM_BLOCK_ELEMS),
+                                        false,
+                                        &block_dy,
+                                        &block_dy_xhat,
+                                        0);
+                                sum_dy += block_dy;
+                                sum_dy_xhat += block_dy_xhat;
+                        }
+                }
+                partials[c] = sum_dy;
+                partials[channels + c] = sum_dy_xhat;
+                return;
+        }
+
+        const size_t c0 = block_i*NORM_CHANNEL_BLOCK;
+        const size_t num_cols = min_size(channels - c0, NORM_CHANNEL_BLOCK);
+        batchnorm_set_row(job, &row, c0, 1);
+        float block_sums[2*NORM_CHANNEL_BLOCK] = {};
+        double sums[2*NORM_CHANNEL_BLOCK] = {};
+        for (size_t r = begin;
+             r < end;
+             ++r) {
+                if ((r > begin) && ((r - begin) % NORM_BLOCK_ROWS == 0))
+                        norm_flush_sums(block_sums,
+                                        sums,
+                                        2*NORM_CHANNEL_BLOCK);
+
+                job->kernels->sums(&row,
+                                   job->input + r*channels + c0,
+                                   job->output_grad + r*channels + c0,
+                                   num_cols,
+                                   false,
+                                   block_sums,
+                                   block_sums + NORM_CHANNEL_BLOCK,
+                                   1);
+        }
+        norm_flush_sums(block_sums, sums, 2*NORM_CHANNEL_BLOCK);
+
+        for (size_t c = 0;
+             c < num_cols;
+             ++c) {
+                partials[c0 + c] = sums[c];
+                partials[channels + c0 + c] = sums[NORM_CHANNEL_BLOCK + c];
+        }
+}
+
+static void
+batchnorm_stats_range(void *context, size_t begin, size_t end)
+{
+        const struct norm_job *job = (const struct norm_job *)context;
+        for (size_t task_i = begin;
+             task_i < end;
+             ++task_i) {
+                batchnorm_stats_task(job,
+                                     task_i % job->num_blocks,
+                                     task_i/job->num_blocks);
+        }
+}
+
+static void
+batchnorm_sums_range(void *context, size_t begin, size_t end)
+{
+        const struct norm_job *job = (const struct norm_job *)context;
+        for (size_t task_i = begin;
+             task_i < end;
+             ++task_i) {
+                batchnorm_sums_task(job,
+                                    task_i % job->num_blocks,
+                                    task_i/job->num_blocks);
+        }
+}
+
+/**
+ * batchnorm_apply() - Normalises planes (NCHW) or pixels (NHWC) [begin, end),
+ * or finds their input gradients if `is_backward`.
+ */
+static void
+batchnorm_apply(const struct norm_job *job,
+                size_t begin,
+                size_t end,
+                bool is_backward)
+{
+        const size_t row_elems = job->is_nchw ? job->pixels : job->channels;
+        struct norm_row row = {};
+        if (!job->is_nchw)
+                batchnorm_set_row(job, &row, 0, 1);
+
+        for (size_t r = begin;
+             r < end;
+             ++r) {
+                const size_t offset = r*row_elems;
+                if (job->is_nchw)
+                        batchnorm_set_row(job, &row, r % job->channels, 0);
+
+                if (is_backward)
+                        job->kernels->dx(&row,
+                                         job->input + offset,
+                                         job->output_grad + offset,
+                                         job->input_grad + offset,
+                                         row_elems);
+                else
+                        job->kernels->forward(&row,
+                                              job->input + offset,
+                                              job->output + offset,
+                                              row_elems);
+        }
+}
+
+static void
+batchnorm_forward_range(void *context, size_t begin, size_t end)
+{
+        batchnorm_apply((const struct norm_job *)context, begin, end, false);
+}
+
+static void
+batchnorm_dx_range(void *context, size_t begin, size_t end)
+{
+        batchnorm_apply((const struct norm_job *)context, begin, end, true);
+}
+
+/**
+ * batchnorm_run_apply() - Runs `range_fn` over every plane or pixel of the
+ * images.
+ */
+static void
+batchnorm_run_apply(struct norm_job *job, parallel_range_fn *range_fn)
+{
+        const size_t num_rows = job->is_nchw ?
+                                job->batch*job->channels :
+                                job->batch*job->pixels;
+
+        norm_run(num_rows,
+                 job->batch*job->channels*job->pixels,
+                 range_fn,
+                 job);
+}
+
+/**
+ * batchnorm_init_job() - Checks `input` and `result` against `params`, and
+ * fills in the image sizes and kernels of `job`.
+ */
+static bool
+batchnorm_init_job(struct norm_job *job,
+                   const struct rot_tensor *result,
+                   const struct rot_tensor *input,
+                   const struct rot_norm_params *params)
+{
+        if ((params->layout != ROT_LAYOUT_NCHW) &&
+            (params->layout != ROT_LAYOUT_NHWC)) {
+                LOG_ERROR("Batch normalisation layout must be NCHW or NHWC.");
+                return false;
+        }
+
+        if (!norm_check_same(result, input) || (input->num_dims != 4)) {
+                LOG_ERROR("Batch normalisation operands must be contiguous "
+                          "float32 CPU tensors with the same 4 dimensions.");
+                return false;
+        }
+
+        if (!norm_check_in_place(result, input))
+                return false;
+
+        job->kernels = norm_get_kernels();
+        job->params = params;
+        job->is_nchw = (params->layout == ROT_LAYOUT_NCHW);
+        job->batch = input->dims[0];
+        job->channels = input->dims[job->is_nchw ? 1 : 3];
+        job->pixels = (input->dims[job->is_nchw ? 2 : 1]*
+                       input->dims[job->is_nchw ? 3 : 2]);
+        job->num_blocks = job->is_nchw ?
+                          job->channels :
+                          ceil_div(job->channels, NORM_CHANNEL_BLOCK);
+        job->input = input->cpu.data;
+
+        return true;
+}
+
+/**
+ * batchnorm_split_sums() - Sets the number of splits of `job`'s per-channel
+ * sums, and returns the number of tasks they take.
+ */
+static size_t
+batchnorm_split_sums(struct norm_job *job)
+{
+        const size_t num_rows = job->is_nchw ?
+                                job->batch : job->batch*job->pixels;
+        job->num_splits = norm_get_num_splits(job->num_blocks,
+                                              num_rows,
+                                              (job->batch*job->channels*
+                                               job->pixels));
+
+        return job->num_blocks*job->num_splits;
+}
+
+rot_tensor_t ROT_batchnorm(rot_tensor_t result,
+                           struct rot_norm_stats *stats,
+                           rot_arena_t arena,
+                           const rot_tensor_t input,
+                           const rot_tensor_t gamma,
+                           const rot_tensor_t beta,
+                           rot_tensor_t running_mean,
+                           rot_tensor_t running_var,
+                           const struct rot_norm_params *params)
+{
+        if ((result == NULL) ||
+            (input == NULL) ||
+            (params == NULL) ||
+            ((stats != NULL) && (arena == NULL))) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        struct norm_job job = {};
+        if (!batchnorm_init_job(&job, result, input, params))
+                return NULL;
+
+        const size_t channels = job.channels;
+        if (!norm_check_affine(gamma, beta, NULL, NULL, channels))
+                return NULL;
+
+        if (!norm_check_vector(running_mean, channels) ||
+            !norm_check_vector(running_var, channels) ||
+            ((running_mean == NULL) != (running_var == NULL))) {
+                LOG_ERROR("Batch normalisation running mean and variance "
+                          "must both be NULL, or both be contiguous float32 "
+                          "CPU tensors with one element per channel.");
+                return NULL;
+        }
+
+        job.output = result->cpu.data;
+        job.gamma = (gamma != NULL) ? gamma->cpu.data : NULL;
+        job.beta = (beta != NULL) ? beta->cpu.data : NULL;
+
+        /**
+         * NOTE(brendan): The saved statistics are allocated before the
+         * scratch buffer, since `arena` may be the scratch arena.
+         */
+        if ((stats != NULL) && !norm_alloc_stats(stats, arena, channels))
+                return NULL;
+
+        const size_t num_tasks = batchnorm_split_sums(&job);
+        const size_t welford_floats = sizeof(struct welford)/sizeof(float);
+        rot_arena_t scratch_arena = NULL;
+        rot_arena_mark_t scratch_mark = NULL;
+        float *scratch = conv_get_scratch(2*channels +
+                                          (welford_floats*channels*
+                                           job.num_splits),
+                                          &scratch_arena,
+                                          &scratch_mark);
+        if (scratch == NULL) {
+                LOG_ERROR("Failed to allocate batch normalisation "
+                          "statistics.");
+                return NULL;
+        }
+
+        job.stats_partials = (struct welford *)scratch;
+        job.mean = scratch + welford_floats*channels*job.num_splits;
+        job.rstd = job.mean + channels;
+        if (stats != NULL) {
+                job.mean = stats->mean;
+                job.rstd = stats->rstd;
+        }
+        norm_run(num_tasks,
+                 job.batch*channels*job.pixels,
+                 batchnorm_stats_range,
+                 &job);
+
+        const double momentum = params->momentum;
+        for (size_t c = 0;
+             c < channels;
+             ++c) {
+                struct welford channel_stats = {};
+                for (size_t split_i = 0;
+                     split_i < job.num_splits;
+                     ++split_i) {
+                        const struct welford *partial =
+                                job.stats_partials + split_i*channels + c;
+                        welford_merge(&channel_stats,
+                                      partial->count,
+                                      partial->mean,
+                                      partial->m2);
+                }
+
+                const double count = channel_stats.count;
+                const double variance = (count > 0.0) ?
+                                        channel_stats.m2/count : 0.0;
+                job.mean[c] = (float)channel_stats.mean;
+                job.rstd[c] = norm_get_rstd(variance, params->epsilon);
+                if (running_mean == NULL)
+                        continue;
+
+                /**
+                 * NOTE(brendan): With a single value per channel there is no
+                 * unbiased variance, so the running variance decays to zero.
+                 */
+                const double unbiased = (count > 1.0) ?
+                                        channel_stats.m2/(count - 1.0) : 0.0;
+                float *run_mean = running_mean->cpu.data + c;
+                float *run_var = running_var->cpu.data + c;
+                *run_mean = (float)((1.0 - momentum)*(*run_mean) +
+                                    momentum*channel_stats.mean);
+                *run_var = (float)((1.0 - momentum)*(*run_var) +
+                                   momentum*unbiased);
+        }
+
+        batchnorm_run_apply(&job, batchnorm_forward_range);
+
+        conv_put_scratch(scratch, scratch_arena, scratch_mark);
+
+        return result;
+}
+
+rot_tensor_t ROT_batchnorm_inference(rot_tensor_t result,
+                                     const rot_tensor_t input,
+                                     const rot_tensor_t gamma,
+                                     const rot_tensor_t beta,
+                                     const rot_tensor_t running_mean,
+                                     const rot_tensor_t running_var,
+                                     const struct rot_norm_params *params)
+{
+        if ((result == NULL) ||
+            (input == NULL) ||
+            (running_mean == NULL) ||
+            (running_var == NULL) ||
+            (params == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        struct norm_job job = {};
+        if (!batchnorm_init_job(&job, result, input, params))
+                return NULL;
+
+        const size_t channels = job.channels;
+        if (!norm_check_affine(gamma, beta, NULL, NULL, channels))
+                return NULL;
+
+        if (!norm_check_vector(running_mean, channels) ||
+            !norm_check_vector(running_var, channels)) {
+                LOG_ERROR("Batch normalisation running mean and variance "
+                          "must be contiguous float32 CPU tensors with one "
+                          "element per channel.");
+                return NULL;
+        }
+
+        rot_arena_t scratch_arena = NULL;
+        rot_arena_mark_t scratch_mark = NULL;
+        float *rstd = conv_get_scratch(channels,
+                                       &scratch_arena,
+                                       &scratch_mark);
+        if (rstd == NULL) {
+                LOG_ERROR("Failed to allocate batch normalisation "
+                          "statistics.");
+                return NULL;
+        }
+
+        for (size_t c = 0;
+             c < channels;
+             ++c) {
+                rstd[c] = norm_get_rstd(running_var->cpu.data[c],
+                                        params->epsilon);
+        }
+
+        job.output = result->cpu.data;
+        job.gamma = (gamma != NULL) ? gamma->cpu.data : NULL;
+        job.beta = (beta != NULL) ? beta->cpu.data : NULL;
+        job.mean = running_mean->cpu.data;
+        job.rstd = rstd;
+        batchnorm_run_apply(&job, batchnorm_forward_range);
+
+        conv_put_scratch(rstd, scratch_arena, scratch_mark);
+
+        return result;
+}
+
+rot_tensor_t ROT_batchnorm_backward(rot_tensor_t input_grad,
+                                    rot_tensor_t gamma_grad,
+                                    rot_tensor_t beta_grad,
+                                    const rot_tensor_t output_grad,
+                                    const rot_tensor_t input,
+                                    const rot_tensor_t gamma,
+                                    const rot_tensor_t beta,
+                                    const struct rot_norm_stats *stats,
+                                    const struct rot_norm_params *params)
+{
+        if ((input_grad == NULL) ||
+            (output_grad == NULL) ||
+            (input == NULL) ||
+            (stats == NULL) ||
+            (params == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        struct norm_job job = {};
+        if (!batchnorm_init_job(&job, input_grad, input, params))
+                return NULL;
+
+        if (!norm_check_same(output_grad, input)) {
+                LOG_ERROR("Batch normalisation gradients and input must have "
+                          "the same dimensions.");
+                return NULL;
+        }
+
+        if (!norm_check_in_place(input_grad, output_grad))
+                return NULL;
+
+        const size_t channels = job.channels;
+        if (!norm_check_affine(gamma, beta, gamma_grad, beta_grad, channels))
+                return NULL;
+
+        if (stats->count != channels) {
+                LOG_ERROR("Batch normalisation statistics must have one "
+                          "mean and rstd per channel.");
+                return NULL;
+        }
+
+        job.gamma = (gamma != NULL) ? gamma->cpu.data : NULL;
+        job.beta = (beta != NULL) ? beta->cpu.data : NULL;
+        job.output_grad = output_grad->cpu.data;
+        job.input_grad = input_grad->cpu.data;
+        job.mean = stats->mean;
+        job.rstd = stats->rstd;
+
+        const size_t num_tasks = batchnorm_split_sums(&job);
+        rot_arena_t scratch_arena = NULL;
+        rot_arena_mark_t scratch_mark = NULL;
+        job.partials = norm_get_doubles(channels*(2*job.num_splits + 1),
+                                        &scratch_arena,
+                                        &scratch_mark);
+        if (job.partials == NULL) {
+                LOG_ERROR("Failed to allocate batch normalisation gradient "
+                          "sums.");
+                return NULL;
+        }
+
+        /**
+         * NOTE(brendan): The first pass must finish reading the input and
+         * output gradients before the second overwrites them, if
+         * `input_grad` is `output_grad`.
+         */
+        norm_run(num_tasks,
+                 job.batch*channels*job.pixels,
+                 batchnorm_sums_range,
+                 &job);
+
+        job.c1 = (float *)(job.partials + 2*channels*job.num_splits);
+        job.c2 = job.c1 + channels;
+        const double count = (double)job.batch*job.pixels;
+        for (size_t c = 0;
+             c < channels;
+             ++c) {
+                double sum_dy = 0.0;
+                double sum_dy_xhat = 0.0;
+                for (size_t split_i = 0;
+                     split_i < job.num_splits;
+                     ++split_i) {
+                        const double *partials = (job.partials +
+                                                  2*split_i*channels);
+                        sum_dy += partials[c];
+                        sum_dy_xhat += partials[channels + c];
+                }
+
+                if (beta_grad != NULL)
+                        beta_grad->cpu.data[c] = (float)sum_dy;
+                if (gamma_grad != NULL)
+                        gamma_grad->cpu.data[c] = (float)sum_dy_xhat;
+
+                const double weight = (job.gamma != NULL) ? job.gamma[c] : 1.0;
+                job.c1[c] = (float)(weight*sum_dy/count);
+                job.c2[c] = (float)(weight*sum_dy_xhat/count);
+        }
+
+        batchnorm_run_apply(&job, batchnorm_dx_range);
+
+        conv_put_scratch((float *)job.partials, scratch_arena, scratch_mark);
+
+        return input_grad;
+}
@@ -0,0 +1,549 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "rot_optim.h"
+#include "error/log_error.h"  /* for LOG_ERROR, LOG_NULL */
+#include "math/tensor.h"      /* for tensor_is_contiguous, ... */
+#include "platform/cpu.h"     /* for cpu_get_isa */
+#include "platform/thread.h"  /* for parallel_for_range */
+
+#include <immintrin.h>        /* for __m256, __m512, _mm512_fmadd_ps, ... */
+#include <math.h>             /* for pow, sqrtf */
+#include <string.h>           /* for memset */
+
+/**
+ * NOTE(brendan): An optimizer step is a memory bound elementwise op, so as
+ * for those it is split across threads in chunks of OPTIM_GRAIN_ELEMS
+ * elements, once there are OPTIM_MIN_PARALLEL_ELEMS.
+ */
+#define OPTIM_GRAIN_ELEMS (16*1024)
+#define OPTIM_MIN_PARALLEL_ELEMS (4*OPTIM_GRAIN_ELEMS)
+#define OPTIM_ALIGN_BYTES 64
+
+/**
+ * struct optim_coeffs - Scalars of one optimizer step.
+ * @learning_rate: SGD step size.
+ * @l2: Coefficient of the L2 penalty added to the gradient.
+ * @decay: Factor every parameter is scaled by before the update, which is
+ * 1 - learning_rate*weight_decay for AdamW and one otherwise.
+ * @step_size: Adam step size, learning_rate/(1 - beta1^t) at step t.
+ * @inv_bias2: Adam second moment bias correction, 1/(1 - beta2^t).
+ */
+struct optim_coeffs {
+        float learning_rate;
+        float l2;
+        float decay;
+        float momentum;
+        bool nesterov;
+        float beta1;
+        float beta2;
+        float epsilon;
+        float step_size;
+        float inv_bias2;
+};
+
+/**
+ * optim_sgd_fn - Updates `num_elems` parameters `param` and, if momentum is
+ * used, their velocities `velocity` from gradients `grad`.
+ */
+typedef void optim_sgd_fn(const struct optim_coeffs *coeffs,
+                          float *param,
+                          const float *grad,
+                          float *velocity,
+                          size_t num_elems);
+
+/**
+ * optim_adam_fn - Updates `num_elems` parameters `param` and their moment
+ * estimates `m` and `v` from gradients `grad`.
+ */
+typedef void optim_adam_fn(const struct optim_coeffs *coeffs,
+                           float *param,
+                           const float *grad,
+                           float *m,
+                           float *v,
+                           size_t num_elems);
+
+/**
+ * struct rot_optim - An optimizer.
+ * @state: Per-parameter state. SGD with momentum has velocities in state[0],
+ * and Adam has first and second moment estimates in state[0] and state[1].
+ * @step: Number of steps taken.
+ */
+struct rot_optim {
+        struct rot_optim_params params;
+        size_t num_params;
+        float *state[2];
+        uint64_t step;
+};
+
+/**
+ * struct optim_job - An optimizer step split into ranges of elements by
+ * `parallel_for_range`.
+ */
+struct optim_job {
+        const struct rot_optim *optim;
+        struct optim_coeffs coeffs;
+        float *param;
+        const float *grad;
+        optim_sgd_fn *sgd;
+        optim_adam_fn *adam;
+};
+
+static void
+optim_sgd_generic(const struct optim_coeffs *coeffs,
+                  float *param,
+                  const float *grad,
+                  float *velocity,
+                  size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                float g = grad[i] + coeffs->l2*param[i];
+                if (velocity != NULL) {
+                        float vel = coeffs->momentum*velocity[i] + g;
+                        velocity[i] = vel;
+                        g = coeffs->nesterov ? (g + coeffs->momentum*vel) : vel;
+                }
+                param[i] -= coeffs->learning_rate*g;
+        }
+}
+
+static void
+optim_adam_generic(const struct optim_coeffs *coeffs,
+                   float *param,
+                   const float *grad,
+                   float *m,
+                   float *v,
+                   size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                float g = grad[i] + coeffs->l2*param[i];
+                float m_i = coeffs->beta1*m[i] + (1.0f - coeffs->beta1)*g;
+                float v_i = coeffs->beta2*v[i] + (1.0f - coeffs->beta2)*g*g;
+                m[i] = m_i;
+                v[i] = v_i;
+                float denom = sqrtf(v_i*coeffs->inv_bias2) + coeffs->epsilon;
+                param[i] = (param[i]*coeffs->decay -
+                            coeffs->step_size*m_i/denom);
+        }
+}
+
+__attribute__((target("avx2")))
+static __m256i
+optim_mask_avx2(size_t remaining)
+{
+        int32_t count = (remaining < 8) ? (int32_t)remaining : 8;
+
+        return _mm256_cmpgt_epi32(_mm256_set1_epi32(count),
+                                  _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+__attribute__((target("avx2,fma")))
+static void
+optim_sgd_avx2(const struct optim_coeffs *coeffs,
+               float *param,
+               const float *grad,
+               float *velocity,
+               size_t num_elems)
+{
+        const __m256 l2 = _mm256_set1_ps(coeffs->l2);
+        const __m256 momentum = _mm256_set1_ps(coeffs->momentum);
+        const __m256 neg_lr = _mm256_set1_ps(-coeffs->learning_rate);
+        for (size_t i = 0;
+             i < num_elems;
+             i += 8) {
+                __m256i mask = optim_mask_avx2(num_elems - i);
+                __m256 p = _mm256_maskload_ps(param + i, mask);
+                __m256 g = _mm256_fmadd_ps(l2,
+                                           p,
+                                           _mm256_maskload_ps(grad + i, mask));
+                if (velocity != NULL) {
+                        __m256 vel = _mm256_maskload_ps(velocity + i, mask);
+                        vel = _mm256_fmadd_ps(momentum, vel, g);
+                        _mm256_maskstore_ps(velocity + i, mask, vel);
+                        g = coeffs->nesterov ?
+                            _mm256_fmadd_ps(momentum, vel, g) : vel;
+                }
+                _mm256_maskstore_ps(param + i,
+                                    mask,
+                                    _mm256_fmadd_ps(neg_lr, g, p));
+        }
+}
+
+__attribute__((target("avx2,fma")))
+static void
+optim_adam_avx2(const struct optim_coeffs *coeffs,
+                float *param,
+                const float *grad,
+                float *m,
+                float *v,
+                size_t num_elems)
+{
+        const __m256 l2 = _mm256_set1_ps(coeffs->l2);
+        const __m256 decay = _mm256_set1_ps(coeffs->decay);
+        const __m256 beta1 = _mm256_set1_ps(coeffs->beta1);
+        const __m256 beta2 = _mm256_set1_ps(coeffs->beta2);
+        const __m256 one_minus_beta1 = _mm256_set1_ps(1.0f - coeffs->beta1);
+        const __m256 one_minus_beta2 = _mm256_set1_ps(1.0f - coeffs->beta2);
+        const __m256 epsilon = _mm256_set1_ps(coeffs->epsilon);
+        const __m256 neg_step_size = _mm256_set1_ps(-coeffs->step_size);
+        const __m256 inv_bias2 = _mm256_set1_ps(coeffs->inv_bias2);
+        for (size_t i = 0;
+             i < num_elems;
+             i += 8) {
+                __m256i mask = optim_mask_avx2(num_elems - i);
+                __m256 p = _mm256_maskload_ps(param + i, mask);
+                __m256 g = _mm256_fmadd_ps(l2,
+                                           p,
+                                           _mm256_maskload_ps(grad + i, mask));
+                __m256 m_i = _mm256_mul_ps(one_minus_beta1, g);
+                m_i = _mm256_fmadd_ps(beta1,
+                                      _mm256_maskload_ps(m + i, mask),
+                                      m_i);
+                __m256 v_i = _mm256_mul_ps(one_minus_beta2,
+                                           _mm256_mul_ps(g, g));
+                v_i = _mm256_fmadd_ps(beta2,
+                                      _mm256_maskload_ps(v + i, mask),
+                                      v_i);
+                _mm256_maskstore_ps(m + i, mask, m_i);
+                _mm256_maskstore_ps(v + i, mask, v_i);
+
+                __m256 denom = _mm256_add_ps(
+                        _mm256_sqrt_ps(_mm256_mul_ps(v_i, inv_bias2)),
+                        epsilon);
+                __m256 update = _mm256_div_ps(_mm256_mul_ps(neg_step_size,
+                                                            m_i),
+                                              denom);
+                _mm256_maskstore_ps(param + i,
+                                    mask,
+                                    _mm256_fmadd_ps(p, decay, update));
+        }
+}
+
+__attribute__((target("avx512f")))
+static __mmask16
+optim_mask_avx512(size_t remaining)
+{
+        return (remaining >= 16) ? 0xFFFF : ((1u << remaining) - 1);
+}
+
+__attribute__((target("avx512f")))
+static void
+optim_sgd_avx512(const struct optim_coeffs *coeffs,
+                 float *param,
+                 const float *grad,
+                 float *velocity,
+                 size_t num_elems)
+{
+        const __m512 l2 = _mm512_set1_ps(coeffs->l2);
+        const __m512 momentum = _mm512_set1_ps(coeffs->momentum);
+        const __m512 neg_lr = _mm512_set1_ps(-coeffs->learning_rate);
+        for (size_t i = 0;
+             i < num_elems;
+             i += 16) {
+                __mmask16 mask = optim_mask_avx512(num_elems - i);
+                __m512 p = _mm512_maskz_loadu_ps(mask, param + i);
+                __m512 g = _mm512_fmadd_ps(l2,
+                                           p,
+                                           _mm512_maskz_loadu_ps(mask,
+                                                                 grad + i));
+                if (velocity != NULL) {
+                        __m512 vel = _mm512_maskz_loadu_ps(mask,
+                                                           velocity + i);
+                        vel = _mm512_fmadd_ps(momentum, vel, g);
+                        _mm512_mask_storeu_ps(velocity + i, mask, vel);
+                        g = coeffs->nesterov ?
+                            _mm512_fmadd_ps(momentum, vel, g) : vel;
+                }
+                _mm512_mask_storeu_ps(param + i,
+                                      mask,
+                                      _mm512_fmadd_ps(neg_lr, g, p));
+        }
+}
+
+__attribute__((target("avx512f")))
+static void
+optim_adam_avx512(const struct optim_coeffs *coeffs,
+                  float *param,
+                  const float *grad,
+                  float *m,
+                  float *v,
+                  size_t num_elems)
+{
+        const __m512 l2 = _mm512_set1_ps(coeffs->l2);
+        const __m512 decay = _mm512_set1_ps(coeffs->decay);
+        const __m512 beta1 = _mm512_set1_ps(coeffs->beta1);
+        const __m512 beta2 = _mm512_set1_ps(coeffs->beta2);
+        const __m512 one_minus_beta1 = _mm512_set1_ps(1.0f - coeffs->beta1);
+        const __m512 one_minus_beta2 = _mm512_set1_ps(1.0f - coeffs->beta2);
+        const __m512 epsilon = _mm512_set1_ps(coeffs->epsilon);
+        const __m512 neg_step_size = _mm512_set1_ps(-coeffs->step_size);
+        const __m512 inv_bias2 = _mm512_set1_ps(coeffs->inv_bias2);
+        for (size_t i = 0;
+             i < num_elems;
+             i += 16) {
+                __mmask16 mask = optim_mask_avx512(num_elems - i);
+                __m512 p = _mm512_maskz_loadu_ps(mask, param + i);
+                __m512 g = _mm512_fmadd_ps(l2,
+                                           p,
+                                           _mm512_maskz_loadu_ps(mask,
+                                                                 grad + i));
+                __m512 m_i = _mm512_mul_ps(one_minus_beta1, g);
+                m_i = _mm512_fmadd_ps(beta1,
+                                      _mm512_maskz_loadu_ps(mask, m + i),
+                                      m_i);
+                __m512 v_i = _mm512_mul_ps(one_minus_beta2,
+                                           _mm512_mul_ps(g, g));
+                v_i = _mm512_fmadd_ps(beta2,
+                                      _mm512_maskz_loadu_ps(mask, v + i),
+                                      v_i);
+                _mm512_mask_storeu_ps(m + i, mask, m_i);
+                _mm512_mask_storeu_ps(v + i, mask, v_i);
+
+                __m512 denom = _mm512_add_ps(
+                        _mm512_sqrt_ps(_mm512_mul_ps(v_i, inv_bias2)),
+                        epsilon);
+                __m512 update = _mm512_div_ps(_mm512_mul_ps(neg_step_size,
+                                                            m_i),
+                                              denom);
+                _mm512_mask_storeu_ps(param + i,
+                                      mask,
+                                      _mm512_fmadd_ps(p, decay, update));
+        }
+}
+
+static void
+optim_range(void *context, size_t begin, size_t end)
+{
+        const struct optim_job *job = (const struct optim_job *)context;
+        float *const *state = job->optim->state;
+        if (job->adam != NULL) {
+                job->adam(&job->coeffs,
+                          job->param + begin,
+                          job->grad + begin,
+                          state[0] + begin,
+                          state[1] + begin,
+                          end - begin);
+                return;
+        }
+
+        job->sgd(&job->coeffs,
+                 job->param + begin,
+                 job->grad + begin,
+                 (state[0] != NULL) ? (state[0] + begin) : NULL,
+                 end - begin);
+}
+
+/**
+ * optim_get_num_state() - Returns the number of per-parameter state buffers
+ * of the update rule in `params`.
+ */
+static uint32_t
+optim_get_num_state(const struct rot_optim_params *params)
+{
+        if (params->algo != ROT_OPTIM_SGD)
+                return 2;
+
+        return (params->momentum != 0.0f) ? 1 : 0;
+}
+
+rot_optim_t ROT_optim_new(rot_arena_t arena,
+                          size_t num_params,
+                          const struct rot_optim_params *params)
+{
+        if ((arena == NULL) || (params == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if ((params->algo != ROT_OPTIM_SGD) &&
+            (params->algo != ROT_OPTIM_ADAM) &&
+            (params->algo != ROT_OPTIM_ADAMW)) {
+                LOG_ERROR("Optimizer algorithm must be SGD, Adam or AdamW.");
+                return NULL;
+        }
+
+        struct rot_optim *optim = (struct rot_optim *)ROT_arena_malloc(
+                arena,
+                sizeof(struct rot_optim),
+                ROT_BACKEND_CPU);
+        if (optim == NULL)
+                return NULL;
+
+        optim->params = *params;
+        optim->num_params = num_params;
+        optim->step = 0;
+        optim->state[0] = NULL;
+        optim->state[1] = NULL;
+        for (uint32_t state_i = 0;
+             state_i < optim_get_num_state(params);
+             ++state_i) {
+                float *state = (float *)ROT_arena_malloc_aligned(
+                        arena,
+                        num_params*sizeof(float),
+                        OPTIM_ALIGN_BYTES,
+                        ROT_BACKEND_CPU);
+                if (state == NULL)
+                        return NULL;
+
+                memset(state, 0, num_params*sizeof(float));
+                optim->state[state_i] = state;
+        }
+
+        return optim;
+}
+
+rot_optim_t ROT_optim_set_learning_rate(rot_optim_t optim,
+                                        float learning_rate)
+{
+        if (optim == NULL) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        optim->params.learning_rate = learning_rate;
+
+        return optim;
+}
+
+/**
+ * optim_get_coeffs() - Fills in `coeffs` for step number `step`, counting
+ * from one.
+ */
+static void
+optim_get_coeffs(struct optim_coeffs *coeffs,
+                 const struct rot_optim_params *params,
+                 uint64_t step)
+{
+        const bool is_adamw = (params->algo == ROT_OPTIM_ADAMW);
+        coeffs->learning_rate = params->learning_rate;
+        coeffs->l2 = is_adamw ? 0.0f : params->weight_decay;
+        coeffs->decay = is_adamw ?
+                        (1.0f - params->learning_rate*params->weight_decay) :
+                        1.0f;
+        coeffs->momentum = params->momentum;
+        coeffs->nesterov = params->nesterov;
+        coeffs->beta1 = params->beta1;
+        coeffs->beta2 = params->beta2;
+        coeffs->epsilon = params->epsilon;
+        if (params->algo == ROT_OPTIM_SGD)
+                return;
+
+        const double bias1 = 1.0 - pow(params->beta1, (double)step);
+        const double bias2 = 1.0 - pow(params->beta2, (double)step);
+        coeffs->step_size = (float)(params->learning_rate/bias1);
+        coeffs->inv_bias2 = (float)(1.0/bias2);
+}
+
+/**
+ * optim_check_tensor() - Is `tensor` a contiguous float32 CPU tensor of
+ * `num_elems` elements?
+ */
+static bool
+optim_check_tensor(const struct rot_tensor *tensor, size_t num_elems)
+{
+        return ((tensor->backend == ROT_BACKEND_CPU) &&
+                (tensor->dtype == ROT_DTYPE_FLOAT32) &&
+                tensor_is_contiguous(tensor) &&
+                (tensor_get_num_elems(tensor) == num_elems));
+}
+
+/**
+ * optim_is_overlapping_state() - Does `tensor` share any bytes with the
+ * moment buffers of `optim`?
+ */
+static bool
+optim_is_overlapping_state(const struct rot_optim *optim,
+                           const struct rot_tensor *tensor)
+{
+        const uint8_t *begin = tensor->cpu.data_8;
+        const uint8_t *end = tensor_get_cpu_end(tensor);
+        for (uint32_t state_i = 0;
+             state_i < optim_get_num_state(&optim->params);
+             ++state_i) {
+                const uint8_t *state = (const uint8_t *)optim->state[state_i];
+                if ((begin < state + optim->num_params*sizeof(float)) &&
+                    (state < end))
+                        return true;
+        }
+
+        return false;
+}
+
+rot_optim_t ROT_optim_step(rot_optim_t optim,
+                           rot_tensor_t params,
+                           const rot_tensor_t grads)
+{
+        if ((optim == NULL) || (params == NULL) || (grads == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (!optim_check_tensor(params, optim->num_params) ||
+            !optim_check_tensor(grads, optim->num_params)) {
+                LOG_ERROR("Optimizer parameters and gradients must be "
+                          "contiguous float32 CPU tensors with the "
+                          "optimizer's number of parameters.");
+                return NULL;
+        }
+
+        if (tensor_is_overlapping(params, grads) ||
+            optim_is_overlapping_state(optim, params) ||
+            optim_is_overlapping_state(optim, grads)) {
+                LOG_ERROR("Optimizer parameters, gradients and moments must "
+                          "not overlap.");
+                return NULL;
+        }
+
+        ++optim->step;
+
+        struct optim_job job = {};
+        job.optim = optim;
+        optim_get_coeffs(&job.coeffs, &optim->params, optim->step);
+        job.param = params->cpu.data;
+        job.grad = grads->cpu.data;
+
+        const bool is_sgd = (optim->params.algo == ROT_OPTIM_SGD);
+        enum cpu_isa isa = cpu_get_isa();
+        if (isa >= CPU_ISA_AVX512) {
+                job.sgd = optim_sgd_avx512;
+                job.adam = is_sgd ? NULL : optim_adam_avx512;
+        } else if (isa >= CPU_ISA_AVX2) {
+                job.sgd = optim_sgd_avx2;
+                job.adam = is_sgd ? NULL : optim_adam_avx2;
+        } else {
+                job.sgd = optim_sgd_generic;
+                job.adam = is_sgd ? NULL : optim_adam_generic;
+        }
+
+        if (optim->num_params < OPTIM_MIN_PARALLEL_ELEMS) {
+                optim_range(&job, 0, optim->num_params);
+                return optim;
+        }
+
+        parallel_for_range(0,
+                           optim->num_params,
+                           OPTIM_GRAIN_ELEMS,
+                           optim_range,
+                           &job);
+
+        return optim;
+}
@@ -0,0 +1,1280 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "rot_nn.h"
+#include "error/log_error.h"  /* for LOG_ERROR, LOG_NULL */
+#include "math/size_math.h"   /* for min_size, ceil_div */
+#include "math/tensor.h"      /* for rot_tensor, tensor_is_contiguous */
+#include "nn/conv.h"          /* for conv_get_input_pos */
+#include "platform/cpu.h"     /* for cpu_get_isa */
+#include "platform/thread.h"  /* for parallel_for_range, ... */
+
+#include <float.h>            /* for FLT_MAX */
+#include <immintrin.h>        /* for __m256, __m512, _mm512_max_ps, ... */
+#include <string.h>           /* for memcpy, memset */
+
+/**
+ * NOTE(brendan): Argmax indices are stored in one byte each, as the offset
+ * kh*kernel_w + kw of the maximum in its window, which limits windows to
+ * POOL_MAX_TAPS taps.
+ */
+#define POOL_MAX_TAPS 256
+/**
+ * NOTE(brendan): Pooling is memory bound, so as for the elementwise ops,
+ * threads take tasks in chunks of about POOL_GRAIN_ELEMS input elements, and
+ * only once there are POOL_MIN_PARALLEL_ELEMS.
+ */
+#define POOL_GRAIN_ELEMS (16*1024)
+#define POOL_MIN_PARALLEL_ELEMS (4*POOL_GRAIN_ELEMS)
+/**
+ * NOTE(brendan): NHWC backward passes and global pooling are split into
+ * blocks of this many channels, which the generic kernels also accumulate on
+ * the stack.
+ */
+#define POOL_CHANNEL_BLOCK 64
+
+/**
+ * pool_pixel_fn - Pools one output pixel of an NHWC pooling.
+ * @inputs: For each tap of the window inside the input, its input pixel.
+ * @taps: For each of `inputs`, the offset of its tap in the window.
+ * @num_taps: Number of taps inside the input, which is at least one.
+ * @argmax: For max pooling, set to the tap offset of each channel's maximum,
+ * unless NULL.
+ *
+ * Average pooling uses neither `taps` nor `argmax`, so its kernels leave them
+ * unnamed.
+ */
+typedef void pool_pixel_fn(const float *const *inputs,
+                           const uint8_t *taps,
+                           uint32_t num_taps,
+                           size_t channels,
+                           float *out,
+                           uint8_t *argmax);
+
+/**
+ * struct pool_shape - Sizes of a pooling.
+ */
+struct pool_shape {
+        size_t batch;
+        size_t channels;
+        size_t in_h;
+        size_t in_w;
+        size_t out_h;
+        size_t out_w;
+};
+
+/**
+ * struct pool_job - A pooling, or its backward pass, split into ranges by
+ * `parallel_for_range`.
+ * @pixel: NHWC kernel of the forward pass.
+ * @input, @output: Operands of the forward pass, or for the backward pass, the
+ * gradients with respect to the forward input and output.
+ * @argmax: Argmax indices of max pooling, or NULL.
+ */
+struct pool_job {
+        struct pool_shape shape;
+        const struct rot_pool2d_params *params;
+        bool is_max;
+        pool_pixel_fn *pixel;
+        const float *input;
+        float *output;
+        uint8_t *argmax;
+        const float *output_grad;
+        float *input_grad;
+};
+
+static void
+pool_max_generic(const float *const *inputs,
+                 const uint8_t *taps,
+                 uint32_t num_taps,
+                 size_t channels,
+                 float *out,
+                 uint8_t *argmax)
+{
+        for (size_t c = 0;
+             c < channels;
+             ++c) {
+                float best = inputs[0][c];
+                uint8_t best_tap = taps[0];
+                for (uint32_t t = 1;
+                     t < num_taps;
+                     ++t) {
+                        if (inputs[t][c] > best) {
+                                best = inputs[t][c];
+                                best_tap = taps[t];
+                        }
+                }
+
+                out[c] = best;
+                if (argmax != NULL)
+                        argmax[c] = best_tap;
+        }
+}
+
+static void
+pool_avg_generic(const float *const *inputs,
+                 const uint8_t *,
+                 uint32_t num_taps,
+                 size_t channels,
+                 float *out,
+                 uint8_t *)
+{
+        const float scale = 1.0f/num_taps;
+        for (size_t c0 = 0;
+             c0 < channels;
+             c0 += POOL_CHANNEL_BLOCK) {
+                const size_t width = min_size(POOL_CHANNEL_BLOCK,
+                                              channels - c0);
+                float acc[POOL_CHANNEL_BLOCK] = {};
+                for (uint32_t t = 0;
+                     t < num_taps;
+                     ++t) {
+                        for (size_t c = 0;
+                             c < width;
+                             ++c) {
+                                acc[c] += inputs[t][c0 + c];
+                        }
+                }
+
+                for (size_t c = 0;
+                     c < width;
+                     ++c) {
+                        out[c0 + c] = acc[c]*scale;
+                }
+        }
+}
+
+/**
+ * pool_max_avx512() - Max pooling of 16 channels at a time, with the last
+ * vector masked. The tap of each lane's maximum is tracked alongside it, and
+ * narrowed to bytes on the way out.
+ */
+__attribute__((target("avx512f")))
+static void
+pool_max_avx512(const float *const *inputs,
+                const uint8_t *taps,
+                uint32_t num_taps,
+                size_t channels,
+                float *out,
+                uint8_t *argmax)
+{
+        for (size_t c = 0;
+             c < channels;
+             c += 16) {
+                const size_t remaining = channels - c;
+                const __mmask16 mask = ((remaining >= 16) ?
+                                        (__mmask16)0xFFFF :
+                                        (__mmask16)((1u << remaining) - 1));
+                __m512 best = _mm512_maskz_loadu_ps(mask, inputs[0] + c);
+                __m512i best_tap = _mm512_set1_epi32(taps[0]);
+                for (uint32_t t = 1;
+                     t < num_taps;
+                     ++t) {
+                        __m512 x = _mm512_maskz_loadu_ps(mask, inputs[t] + c);
+                        __mmask16 is_greater = _mm512_cmp_ps_mask(x,
+                                                                  best,
+                                                                  _CMP_GT_OQ);
+                        best = _mm512_mask_mov_ps(best, is_greater, x);
+                        best_tap = _mm512_mask_mov_epi32(
+                                best_tap,
+                                is_greater,
+                                _mm512_set1_epi32(taps[t]));
+                }
+                _mm512_mask_storeu_ps(out + c, mask, best);
+
+                if (argmax != NULL) {
+                        uint8_t best_bytes[16];
+                        _mm_storeu_si128((__m128i *)best_bytes,
+                                         _mm512_cvtepi32_epi8(best_tap));
+                        memcpy(argmax + c, best_bytes, min_size(remaining, 16));
+                }
+        }
+}
+
+__attribute__((target("avx512f")))
+static void
+pool_avg_avx512(const float *const *inputs,
+                const uint8_t *,
+                uint32_t num_taps,
+                size_t channels,
+                float *out,
+                uint8_t *)
+{
+        const __m512 scale = _mm512_set1_ps(1.0f/num_taps);
+        for (size_t c = 0;
+             c < channels;
+             c += 16) {
+                const size_t remaining = channels - c;
+                const __mmask16 mask = ((remaining >= 16) ?
+                                        (__mmask16)0xFFFF :
+                                        (__mmask16)((1u << remaining) - 1));
+                __m512 acc = _mm512_setzero_ps();
+                for (uint32_t t = 0;
+                     t < num_taps;
+                     ++t) {
+                        acc = _mm512_add_ps(
+                                acc,
+                                _mm512_maskz_loadu_ps(mask, inputs[t] + c));
+                }
+                _mm512_mask_storeu_ps(out + c, mask, _mm512_mul_ps(acc, scale));
+        }
+}
+
+/**
+ * pool_max_avx2() - Max pooling of 8 channels at a time, with the rest left
+ * to the generic kernel.
+ */
+__attribute__((target("avx2")))
+static void
+pool_max_avx2(const float *const *inputs,
+              const uint8_t *taps,
+              uint32_t num_taps,
+              size_t channels,
+              float *out,
+              uint8_t *argmax)
+{
+        size_t c = 0;
+        for (;
+             c + 8 <= channels;
+             c += 8) {
+                __m256 best = _mm256_loadu_ps(inputs[0] + c);
+                __m256 best_tap = _mm256_castsi256_ps(
+                        _mm256_set1_epi32(taps[0]));
+                for (uint32_t t = 1;
+                     t < num_taps;
+                     ++t) {
+                        __m256 x = _mm256_loadu_ps(inputs[t] + c);
+                        __m256 is_greater = _mm256_cmp_ps(x, best, _CMP_GT_OQ);
+                        best = _mm256_blendv_ps(best, x, is_greater);
+                        best_tap = _mm256_blendv_ps(
+                                best_tap,
+                                _mm256_castsi256_ps(
+                                        _mm256_set1_epi32(taps[t])),
+                                is_greater);
+                }
+                _mm256_storeu_ps(out + c, best);
+
+                if (argmax != NULL) {
+                        uint32_t best_taps[8];
+                        _mm256_storeu_si256((__m256i *)best_taps,
+                                            _mm256_castps_si256(best_tap));
+                        for (uint32_t i = 0;
+                             i < 8;
+                             ++i) {
+                                argmax[c + i] = (uint8_t)best_taps[i];
+                        }
+                }
+        }
+
+        if (c == channels)
+                return;
+
+        const float *tail_inputs[POOL_MAX_TAPS];
+        for (uint32_t t = 0;
+             t < num_taps;
+             ++t) {
+                tail_inputs[t] = inputs[t] + c;
+        }
+        pool_max_generic(tail_inputs,
+                         taps,
+                         num_taps,
+                         channels - c,
+                         out + c,
+                         (argmax != NULL) ? (argmax + c) : NULL);
+}
+
+__attribute__((target("avx2")))
+static void
+pool_avg_avx2(const float *const *inputs,
+              const uint8_t *,
+              uint32_t num_taps,
+              size_t channels,
+              float *out,
+              uint8_t *)
+{
+        const float scale = 1.0f/num_taps;
+        size_t c = 0;
+        for (;
+             c + 8 <= channels;
+             c += 8) {
+                __m256 acc = _mm256_setzero_ps();
+                for (uint32_t t = 0;
+                     t < num_taps;
+                     ++t) {
+                        acc = _mm256_add_ps(acc,
+                                            _mm256_loadu_ps(inputs[t] + c));
+                }
+                _mm256_storeu_ps(out + c,
+                                 _mm256_mul_ps(acc, _mm256_set1_ps(scale)));
+        }
+
+        for (;
+             c < channels;
+             ++c) {
+                float acc = 0.0f;
+                for (uint32_t t = 0;
+                     t < num_taps;
+                     ++t) {
+                        acc += inputs[t][c];
+                }
+                out[c] = acc*scale;
+        }
+}
+
+static pool_pixel_fn *
+pool_get_kernel(bool is_max)
+{
+        enum cpu_isa isa = cpu_get_isa();
+        if (isa >= CPU_ISA_AVX512)
+                return is_max ? pool_max_avx512 : pool_avg_avx512;
+
+        if (isa >= CPU_ISA_AVX2)
+                return is_max ? pool_max_avx2 : pool_avg_avx2;
+
+        return is_max ? pool_max_generic : pool_avg_generic;
+}
+
+/**
+ * pool_check_tensor() - Is `tensor` a contiguous float32 CPU tensor with
+ * `num_dims` dimensions?
+ */
+static bool
+pool_check_tensor(const struct rot_tensor *tensor, uint32_t num_dims)
+{
+        return ((tensor->backend == ROT_BACKEND_CPU) &&
+                (tensor->dtype == ROT_DTYPE_FLOAT32) &&
+                (tensor->num_dims == num_dims) &&
+                tensor_is_contiguous(tensor));
+}
+
+/**
+ * pool_get_images() - Sets `batch`, `channels`, `height` and `width` from the
+ * 4D `images` in `layout`.
+ */
+static void
+pool_get_images(const struct rot_tensor *images,
+                enum rot_layout layout,
+                size_t *batch,
+                size_t *channels,
+                size_t *height,
+                size_t *width)
+{
+        const bool is_nchw = (layout == ROT_LAYOUT_NCHW);
+        *batch = images->dims[0];
+        *channels = images->dims[is_nchw ? 1 : 3];
+        *height = images->dims[is_nchw ? 2 : 1];
+        *width = images->dims[is_nchw ? 3 : 2];
+}
+
+/**
+ * pool_get_shape() - Fills in `shape` for a pooling of `input` into `output`,
+ * and checks them against `params`.
+ */
+static bool
+pool_get_shape(struct pool_shape *shape,
+               const struct rot_tensor *output,
+               const struct rot_tensor *input,
+               const struct rot_pool2d_params *params)
+{
+        if ((params->layout != ROT_LAYOUT_NCHW) &&
+            (params->layout != ROT_LAYOUT_NHWC)) {
+                LOG_ERROR("Pooling layout must be NCHW or NHWC.");
+                return false;
+        }
+
+        if (!pool_check_tensor(output, 4) || !pool_check_tensor(input, 4)) {
+                LOG_ERROR("Pooling operands must be contiguous float32 CPU "
+                          "tensors with 4 dimensions.");
+                return false;
+        }
+
+        pool_get_images(input,
+                        params->layout,
+                        &shape->batch,
+                        &shape->channels,
+                        &shape->in_h,
+                        &shape->in_w);
+        const size_t in_size[] = {shape->in_h, shape->in_w};
+        size_t out_size[2];
+        for (uint32_t i = 0;
+             i < 2;
+             ++i) {
+                const size_t padded = in_size[i] + 2*(size_t)params->padding[i];
+                if ((in_size[i] == 0) ||
+                    (params->kernel[i] == 0) ||
+                    (params->stride[i] == 0) ||
+                    (2*params->padding[i] > params->kernel[i]) ||
+                    (params->kernel[i] > padded)) {
+                        LOG_ERROR("Pooling inputs, windows and strides "
+                                  "must be non-empty, padded by at most half "
+                                  "a window, and windows must fit in the "
+                                  "padded input.");
+                        return false;
+                }
+
+                out_size[i] = ((padded - params->kernel[i])/params->stride[i] +
+                               1);
+        }
+        shape->out_h = out_size[0];
+        shape->out_w = out_size[1];
+
+        if ((size_t)params->kernel[0]*params->kernel[1] > POOL_MAX_TAPS) {
+                LOG_ERROR("Pooling windows must have at most 256 taps.");
+                return false;
+        }
+
+        size_t batch;
+        size_t channels;
+        size_t out_h;
+        size_t out_w;
+        pool_get_images(output,
+                        params->layout,
+                        &batch,
+                        &channels,
+                        &out_h,
+                        &out_w);
+        if ((batch != shape->batch) ||
+            (channels != shape->channels) ||
+            (out_h != shape->out_h) ||
+            (out_w != shape->out_w)) {
+                LOG_ERROR("Pooling output has the wrong dimensions.");
+                return false;
+        }
+
+        return true;
+}
+
+/**
+ * pool_get_taps() - Gathers the taps of the window of output pixel (`oh`,
+ * `ow`) that are inside the input, as offsets of input pixels counted in
+ * pixels, and offsets in the window.
+ *
+ * Returns the number of taps, which is at least one since padding is at most
+ * half a window.
+ */
+static uint32_t
+pool_get_taps(const struct pool_job *job,
+              size_t oh,
+              size_t ow,
+              size_t *pixels,
+              uint8_t *taps)
+{
+        const struct rot_pool2d_params *params = job->params;
+        const struct pool_shape *shape = &job->shape;
+        uint32_t num_taps = 0;
+        for (uint32_t kh = 0;
+             kh < params->kernel[0];
+             ++kh) {
+                const size_t ih = conv_get_input_pos(oh,
+                                                     kh,
+                                                     params->stride[0],
+                                                     params->padding[0],
+                                                     1);
+                if (ih >= shape->in_h)
+                        continue;
+
+                for (uint32_t kw = 0;
+                     kw < params->kernel[1];
+                     ++kw) {
+                        const size_t iw = conv_get_input_pos(
+                                ow,
+                                kw,
+                                params->stride[1],
+                                params->padding[1],
+                                1);
+                        if (iw >= shape->in_w)
+                                continue;
+
+                        pixels[num_taps] = ih*shape->in_w + iw;
+                        taps[num_taps] = (uint8_t)(kh*params->kernel[1] + kw);
+                        ++num_taps;
+                }
+        }
+
+        return num_taps;
+}
+
+/**
+ * pool_tap_to_pixel() - Returns the input pixel of window offset `tap` of
+ * output pixel (`oh`, `ow`).
+ */
+static size_t
+pool_tap_to_pixel(const struct pool_job *job, size_t oh, size_t ow, size_t tap)
+{
+        const struct rot_pool2d_params *params = job->params;
+        const size_t ih = (oh*params->stride[0] + tap/params->kernel[1] -
+                           params->padding[0]);
+        const size_t iw = (ow*params->stride[1] + tap % params->kernel[1] -
+                           params->padding[1]);
+        return ih*job->shape.in_w + iw;
+}
+
+/**
+ * pool_get_window() - Sets [begin, end) to the taps of a window along one
+ * dimension that are inside the input, for the window of output position
+ * `out`, and returns the input position of its first tap, which may be in
+ * the padding.
+ */
+static long
+pool_get_window(size_t out,
+                uint32_t kernel,
+                uint32_t stride,
+                uint32_t padding,
+                size_t in_size,
+                uint32_t *begin,
+                uint32_t *end)
+{
+        const long first = (long)(out*stride) - (long)padding;
+        *begin = (first < 0) ? (uint32_t)-first : 0;
+        *end = kernel;
+        if (first + (long)kernel > (long)in_size)
+                *end = (uint32_t)((long)in_size - first);
+
+        return first;
+}
+
+/**
+ * struct pool_window - Taps [kh_begin, kh_end) x [kw_begin, kw_end) of a
+ * window of an NCHW plane that are inside the input.
+ * @first: Input element of tap (kh_begin, kw_begin).
+ * @row_stride: Distance between rows of the plane.
+ */
+struct pool_window {
+        const float *first;
+        size_t row_stride;
+        uint32_t kh_begin;
+        uint32_t kh_end;
+        uint32_t kw_begin;
+        uint32_t kw_end;
+};
+
+/**
+ * pool_window_max() - Returns the maximum of `window`, and sets `best_tap` to
+ * the offset kh*kernel_w + kw of its first occurrence.
+ */
+static float
+pool_window_max(const struct pool_window *window,
+                uint32_t kernel_w,
+                uint8_t *best_tap)
+{
+        const uint32_t rows = window->kh_end - window->kh_begin;
+        const uint32_t cols = window->kw_end - window->kw_begin;
+        float best = window->first[0];
+        uint32_t best_i = 0;
+        uint32_t best_j = 0;
+        for (uint32_t i = 0;
+             i < rows;
+             ++i) {
+                const float *row = window->first + i*window->row_stride;
+                for (uint32_t j = 0;
+                     j < cols;
+                     ++j) {
+                        if (row[j] > best) {
+                                best = row[j];
+                                best_i = i;
+                                best_j = j;
+                        }
+                }
+        }
+
+        *best_tap = (uint8_t)((window->kh_begin + best_i)*kernel_w +
+                              window->kw_begin + best_j);
+        return best;
+}
+
+/**
+ * pool_window_mean() - Returns the mean of `window`.
+ */
+static float
+pool_window_mean(const struct pool_window *window)
+{
+        const uint32_t rows = window->kh_end - window->kh_begin;
+        const uint32_t cols = window->kw_end - window->kw_begin;
+        float sum = 0.0f;
+        for (uint32_t i = 0;
+             i < rows;
+             ++i) {
+                const float *row = window->first + i*window->row_stride;
+                for (uint32_t j = 0;
+                     j < cols;
+                     ++j) {
+                        sum += row[j];
+                }
+        }
+
+        return sum/(rows*cols);
+}
+
+/**
+ * pool_nchw_range() - Pools planes [begin, end) of an NCHW pooling, counted
+ * across the batch.
+ *
+ * Each window is clamped to the input once, and its rows then read directly,
+ * since a plane's neighbouring pixels are in neighbouring elements.
+ */
+static void
+pool_nchw_range(void *context, size_t begin, size_t end)
+{
+        const struct pool_job *job = (const struct pool_job *)context;
+        const struct pool_shape *shape = &job->shape;
+        const struct rot_pool2d_params *params = job->params;
+        const size_t in_plane = shape->in_h*shape->in_w;
+        const size_t out_plane = shape->out_h*shape->out_w;
+        for (size_t plane = begin;
+             plane < end;
+             ++plane) {
+                const float *in = job->input + plane*in_plane;
+                float *out = job->output + plane*out_plane;
+                uint8_t *argmax = ((job->argmax != NULL) ?
+                                   (job->argmax + plane*out_plane) :
+                                   NULL);
+                struct pool_window window;
+                window.row_stride = shape->in_w;
+                for (size_t oh = 0;
+                     oh < shape->out_h;
+                     ++oh) {
+                        const long ih0 = pool_get_window(oh,
+                                                         params->kernel[0],
+                                                         params->stride[0],
+                                                         params->padding[0],
+                                                         shape->in_h,
+                                                         &window.kh_begin,
+                                                         &window.kh_end);
+                        for (size_t ow = 0;
+                             ow < shape->out_w;
+                             ++ow) {
+                                const long iw0 = pool_get_window(
+                                        ow,
+                                        params->kernel[1],
+                                        params->stride[1],
+                                        params->padding[1],
+                                        shape->in_w,
+                                        &window.kw_begin,
+                                        &window.kw_end);
+                                window.first = (in +
+                                                ((ih0 + window.kh_begin)*
+                                                 (long)shape->in_w) +
+                                                iw0 + window.kw_begin);
+                                const size_t o = oh*shape->out_w + ow;
+                                if (!job->is_max) {
+                                        out[o] = pool_window_mean(&window);
+                                        continue;
+                                }
+
+                                uint8_t best_tap;
+                                out[o] = pool_window_max(&window,
+                                                         params->kernel[1],
+                                                         &best_tap);
+                                if (argmax != NULL)
+                                        argmax[o] = best_tap;
+                        }
+                }
+        }
+}
+
+/**
+ * pool_nhwc_range() - Pools rows of output [begin, end) of an NHWC pooling,
+ * counted across the batch, with every channel of a pixel pooled at once.
+ */
+static void
+pool_nhwc_range(void *context, size_t begin, size_t end)
+{
+        const struct pool_job *job = (const struct pool_job *)context;
+        const struct pool_shape *shape = &job->shape;
+        const size_t channels = shape->channels;
+        size_t pixels[POOL_MAX_TAPS];
+        uint8_t taps[POOL_MAX_TAPS];
+        const float *inputs[POOL_MAX_TAPS];
+        for (size_t row = begin;
+             row < end;
+             ++row) {
+                const size_t image = row/shape->out_h;
+                const size_t oh = row % shape->out_h;
+                const float *in = (job->input +
+                                   image*shape->in_h*shape->in_w*channels);
+                for (size_t ow = 0;
+                     ow < shape->out_w;
+                     ++ow) {
+                        const uint32_t num_taps = pool_get_taps(job,
+                                                                oh,
+                                                                ow,
+                                                                pixels,
+                                                                taps);
+                        for (uint32_t t = 0;
+                             t < num_taps;
+                             ++t) {
+                                inputs[t] = in + pixels[t]*channels;
+                        }
+
+                        const size_t o = (row*shape->out_w + ow)*channels;
+                        job->pixel(inputs,
+                                   taps,
+                                   num_taps,
+                                   channels,
+                                   job->output + o,
+                                   (job->argmax != NULL) ?
+                                   (job->argmax + o) :
+                                   NULL);
+                }
+        }
+}
+
+/**
+ * pool_backward_range() - Backpropagates tasks [begin, end) of a pooling,
+ * each of which is one plane for NCHW, or one block of POOL_CHANNEL_BLOCK
+ * channels of one image for NHWC, so that tasks write disjoint gradients.
+ *
+ * The gradient of each output is added to the input under its argmax for max
+ * pooling, or spread evenly over the taps of its window inside the input for
+ * average pooling.
+ */
+static void
+pool_backward_range(void *context, size_t begin, size_t end)
+{
+        const struct pool_job *job = (const struct pool_job *)context;
+        const struct pool_shape *shape = &job->shape;
+        const bool is_nchw = (job->params->layout == ROT_LAYOUT_NCHW);
+        const size_t in_pixels = shape->in_h*shape->in_w;
+        const size_t out_pixels = shape->out_h*shape->out_w;
+        const size_t block = is_nchw ? 1 : POOL_CHANNEL_BLOCK;
+        const size_t num_blocks = ceil_div(shape->channels, block);
+        size_t pixels[POOL_MAX_TAPS];
+        uint8_t taps[POOL_MAX_TAPS];
+        for (size_t task_i = begin;
+             task_i < end;
+             ++task_i) {
+                const size_t image = task_i/num_blocks;
+                const size_t c0 = (task_i % num_blocks)*block;
+                const size_t width = min_size(block, shape->channels - c0);
+
+                /**
+                 * NOTE(brendan): In NCHW, the channel is a plane, and pixels
+                 * are one element apart. In NHWC, pixels are `channels`
+                 * elements apart, and the task's channels contiguous.
+                 */
+                const size_t pixel_stride = is_nchw ? 1 : shape->channels;
+                const size_t image_elems = shape->channels*in_pixels;
+                const size_t out_image_elems = shape->channels*out_pixels;
+                float *in_grad = (job->input_grad +
+                                  image*image_elems +
+                                  c0*(is_nchw ? in_pixels : 1));
+                const size_t out_offset = (image*out_image_elems +
+                                           c0*(is_nchw ? out_pixels : 1));
+                const float *out_grad = job->output_grad + out_offset;
+                const uint8_t *argmax = ((job->argmax != NULL) ?
+                                         (job->argmax + out_offset) :
+                                         NULL);
+
+                for (size_t p = 0;
+                     p < in_pixels;
+                     ++p) {
+                        memset(in_grad + p*pixel_stride,
+                               0,
+                               width*sizeof(float));
+                }
+
+                for (size_t oh = 0;
+                     oh < shape->out_h;
+                     ++oh) {
+                        for (size_t ow = 0;
+                             ow < shape->out_w;
+                             ++ow) {
+                                const size_t o = ((oh*shape->out_w + ow)*
+                                                  pixel_stride);
+                                if (job->is_max) {
+                                        for (size_t c = 0;
+                                             c < width;
+                                             ++c) {
+                                                const size_t p =
+                                                        pool_tap_to_pixel(
+                                                                job,
+                                                                oh,
+                                                                ow,
+                                                                argmax[o + c]);
+                                                in_grad[p*pixel_stride + c] +=
+                                                        out_grad[o + c];
+                                        }
+                                        continue;
+                                }
+
+                                const uint32_t num_taps = pool_get_taps(job,
+                                                                        oh,
+                                                                        ow,
+                                                                        pixels,
+                                                                        taps);
+                                const float scale = 1.0f/num_taps;
+                                for (uint32_t t = 0;
+                                     t < num_taps;
+                                     ++t) {
+                                        float *in_pixel = (in_grad +
+                                                           (pixels[t]*
+                                                            pixel_stride));
+                                        for (size_t c = 0;
+                                             c < width;
+                                             ++c) {
+                                                in_pixel[c] += (out_grad[o + c]*
+                                                                scale);
+                                        }
+                                }
+                        }
+                }
+        }
+}
+
+/**
+ * pool_run() - Runs `range_fn` over [0, num_tasks), across threads if the
+ * `num_elems` elements touched are enough to pay for it.
+ */
+static void
+pool_run(size_t num_tasks,
+         size_t num_elems,
+         parallel_range_fn *range_fn,
+         struct pool_job *job)
+{
+        if ((num_elems < POOL_MIN_PARALLEL_ELEMS) ||
+            (thread_get_num_workers() == 1)) {
+                range_fn(job, 0, num_tasks);
+                return;
+        }
+
+        const size_t elems_per_task = ceil_div(num_elems, num_tasks);
+        parallel_for_range(0,
+                           num_tasks,
+                           ceil_div(POOL_GRAIN_ELEMS, elems_per_task),
+                           range_fn,
+                           job);
+}
+
+/**
+ * pool_check_forward() - Gets the `shape` of pooling `input` into `result`,
+ * and checks that the two do not overlap.
+ */
+static bool
+pool_check_forward(struct pool_shape *shape,
+                   const rot_tensor_t result,
+                   const rot_tensor_t input,
+                   const struct rot_pool2d_params *params)
+{
+        if (!pool_get_shape(shape, result, input, params))
+                return false;
+
+        if (tensor_is_overlapping(result, input)) {
+                LOG_ERROR("Pooling result must not overlap its input.");
+                return false;
+        }
+
+        return true;
+}
+
+/**
+ * pool_forward() - Pools `input` into `result`, writing argmax indices to
+ * `argmax` if it is not NULL.
+ */
+static rot_tensor_t
+pool_forward(rot_tensor_t result,
+             uint8_t *argmax,
+             const rot_tensor_t input,
+             const struct rot_pool2d_params *params,
+             const struct pool_shape *shape,
+             bool is_max)
+{
+        struct pool_job job = {};
+        job.shape = *shape;
+        job.params = params;
+        job.is_max = is_max;
+        job.pixel = pool_get_kernel(is_max);
+        job.input = input->cpu.data;
+        job.output = result->cpu.data;
+        job.argmax = argmax;
+
+        const size_t num_elems = tensor_get_num_elems(input);
+        if (params->layout == ROT_LAYOUT_NCHW)
+                pool_run(shape->batch*shape->channels,
+                         num_elems,
+                         pool_nchw_range,
+                         &job);
+        else
+                pool_run(shape->batch*shape->out_h,
+                         num_elems,
+                         pool_nhwc_range,
+                         &job);
+
+        return result;
+}
+
+/**
+ * pool_backward() - Backpropagates `output_grad` through a pooling into
+ * `input_grad`.
+ */
+static rot_tensor_t
+pool_backward(rot_tensor_t input_grad,
+              const rot_tensor_t output_grad,
+              const uint8_t *argmax,
+              const struct rot_pool2d_params *params,
+              bool is_max)
+{
+        struct pool_shape shape;
+        if (!pool_get_shape(&shape, output_grad, input_grad, params))
+                return NULL;
+
+        if (tensor_is_overlapping(input_grad, output_grad)) {
+                LOG_ERROR("Pooling gradients must not overlap.");
+                return NULL;
+        }
+
+        struct pool_job job = {};
+        job.shape = shape;
+        job.params = params;
+        job.is_max = is_max;
+        job.argmax = (uint8_t *)argmax;
+        job.output_grad = output_grad->cpu.data;
+        job.input_grad = input_grad->cpu.data;
+
+        const size_t block = ((params->layout == ROT_LAYOUT_NCHW) ?
+                              1 :
+                              POOL_CHANNEL_BLOCK);
+        pool_run(shape.batch*ceil_div(shape.channels, block),
+                 tensor_get_num_elems(input_grad),
+                 pool_backward_range,
+                 &job);
+
+        return input_grad;
+}
+
+rot_tensor_t ROT_maxpool2d(rot_tensor_t result,
+                           uint8_t **argmax,
+                           rot_arena_t arena,
+                           const rot_tensor_t input,
+                           const struct rot_pool2d_params *params)
+{
+        if ((result == NULL) ||
+            (input == NULL) ||
+            (params == NULL) ||
+            ((argmax != NULL) && (arena == NULL))) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        struct pool_shape shape;
+        if (!pool_check_forward(&shape, result, input, params))
+                return NULL;
+
+        uint8_t *indices = NULL;
+        if (argmax != NULL) {
+                indices = (uint8_t *)ROT_arena_malloc(
+                        arena,
+                        tensor_get_num_elems(result),
+                        ROT_BACKEND_CPU);
+                if (indices == NULL)
+                        return NULL;
+
+                *argmax = indices;
+        }
+
+        return pool_forward(result, indices, input, params, &shape, true);
+}
+
+rot_tensor_t ROT_maxpool2d_backward(rot_tensor_t input_grad,
+                                    const rot_tensor_t output_grad,
+                                    const uint8_t *argmax,
+                                    const struct rot_pool2d_params *params)
+{
+        if ((input_grad == NULL) ||
+            (output_grad == NULL) ||
+            (argmax == NULL) ||
+            (params == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        return pool_backward(input_grad, output_grad, argmax, params, true);
+}
+
+rot_tensor_t ROT_avgpool2d(rot_tensor_t result,
+                           const rot_tensor_t input,
+                           const struct rot_pool2d_params *params)
+{
+        if ((result == NULL) || (input == NULL) || (params == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        struct pool_shape shape;
+        if (!pool_check_forward(&shape, result, input, params))
+                return NULL;
+
+        return pool_forward(result, NULL, input, params, &shape, false);
+}
+
+rot_tensor_t ROT_avgpool2d_backward(rot_tensor_t input_grad,
+                                    const rot_tensor_t output_grad,
+                                    const struct rot_pool2d_params *params)
+{
+        if ((input_grad == NULL) || (output_grad == NULL) || (params == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        return pool_backward(input_grad, output_grad, NULL, params, false);
+}
+
+/**
+ * global_pool_nchw_range() - Averages planes [begin, end), counted across
+ * the batch.
+ *
+ * Each plane is summed into 8 partial sums, which break the dependency chain
+ * and round less than one running sum.
+ */
+static void
+global_pool_nchw_range(void *context, size_t begin, size_t end)
+{
+        const struct pool_job *job = (const struct pool_job *)context;
+        const size_t plane_elems = job->shape.in_h*job->shape.in_w;
+        for (size_t plane = begin;
+             plane < end;
+             ++plane) {
+                const float *in = job->input + plane*plane_elems;
+                float sums[8] = {};
+                size_t i = 0;
+                for (;
+                     i + 8 <= plane_elems;
+                     i += 8) {
+                        for (uint32_t j = 0;
+                             j < 8;
+                             ++j) {
+                                sums[j] += in[i + j];
+                        }
+                }
+
+                for (;
+                     i < plane_elems;
+                     ++i) {
+                        sums[0] += in[i];
+                }
+
+                const float sum = (((sums[0] + sums[1]) +
+                                    (sums[2] + sums[3])) +
+                                   ((sums[4] + sums[5]) +
+                                    (sums[6] + sums[7])));
+                job->output[plane] = sum/plane_elems;
+        }
+}
+
+/**
+ * global_pool_nhwc_range() - Averages tasks [begin, end), each a block of
+ * POOL_CHANNEL_BLOCK channels of one image, accumulated on the stack.
+ */
+static void
+global_pool_nhwc_range(void *context, size_t begin, size_t end)
+{
+        const struct pool_job *job = (const struct pool_job *)context;
+        const size_t channels = job->shape.channels;
+        const size_t num_pixels = job->shape.in_h*job->shape.in_w;
+        const size_t num_blocks = ceil_div(channels, POOL_CHANNEL_BLOCK);
+        for (size_t task_i = begin;
+             task_i < end;
+             ++task_i) {
+                const size_t image = task_i/num_blocks;
+                const size_t c0 = (task_i % num_blocks)*POOL_CHANNEL_BLOCK;
+                const size_t width = min_size(POOL_CHANNEL_BLOCK,
+                                              channels - c0);
+                const float *in = (job->input +
+                                   image*num_pixels*channels +
+                                   c0);
+                float acc[POOL_CHANNEL_BLOCK] = {};
+                for (size_t p = 0;
+                     p < num_pixels;
+                     ++p) {
+                        for (size_t c = 0;
+                             c < width;
+                             ++c) {
+                                acc[c] += in[p*channels + c];
+                        }
+                }
+
+                float *out = job->output + image*channels + c0;
+                for (size_t c = 0;
+                     c < width;
+                     ++c) {
+                        out[c] = acc[c]/num_pixels;
+                }
+        }
+}
+
+/**
+ * global_pool_check() - Fills in `shape` for a global pooling of `images`
+ * into `pooled`, and checks them.
+ */
+static bool
+global_pool_check(struct pool_shape *shape,
+                  const struct rot_tensor *pooled,
+                  const struct rot_tensor *images,
+                  enum rot_layout layout)
+{
+        if ((layout != ROT_LAYOUT_NCHW) && (layout != ROT_LAYOUT_NHWC)) {
+                LOG_ERROR("Pooling layout must be NCHW or NHWC.");
+                return false;
+        }
+
+        if (!pool_check_tensor(images, 4) ||
+            (pooled->backend != ROT_BACKEND_CPU) ||
+            (pooled->dtype != ROT_DTYPE_FLOAT32) ||
+            !tensor_is_contiguous(pooled)) {
+                LOG_ERROR("Global pooling operands must be contiguous "
+                          "float32 CPU tensors, with 4 dimensions for the "
+                          "images.");
+                return false;
+        }
+
+        pool_get_images(images,
+                        layout,
+                        &shape->batch,
+                        &shape->channels,
+                        &shape->in_h,
+                        &shape->in_w);
+        shape->out_h = shape->out_w = 1;
+        if ((tensor_get_num_elems(pooled) != shape->batch*shape->channels) ||
+            (pooled->dims[0] != shape->batch)) {
+                LOG_ERROR("Global pooling output must be [batch, channels], "
+                          "with any trailing dimensions of 1.");
+                return false;
+        }
+
+        if ((shape->in_h == 0) || (shape->in_w == 0)) {
+                LOG_ERROR("Global pooling images must not be empty.");
+                return false;
+        }
+
+        return true;
+}
+
+rot_tensor_t ROT_global_avgpool2d(rot_tensor_t result,
+                                  const rot_tensor_t input,
+                                  enum rot_layout layout)
+{
+        if ((result == NULL) || (input == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        struct pool_shape shape;
+        if (!global_pool_check(&shape, result, input, layout))
+                return NULL;
+
+        if (tensor_is_overlapping(result, input)) {
+                LOG_ERROR("Pooling result must not overlap its input.");
+                return NULL;
+        }
+
+        struct pool_job job = {};
+        job.shape = shape;
+        job.input = input->cpu.data;
+        job.output = result->cpu.data;
+        const size_t num_elems = tensor_get_num_elems(input);
+        if (layout == ROT_LAYOUT_NCHW)
+                pool_run(shape.batch*shape.channels,
+                         num_elems,
+                         global_pool_nchw_range,
+                         &job);
+        else
+                pool_run(shape.batch*ceil_div(shape.channels,
+                                              POOL_CHANNEL_BLOCK),
+                         num_elems,
+                         global_pool_nhwc_range,
+                         &job);
+
+        return result;
+}
+
+/**
+ * global_pool_backward_range() - Spreads the gradient of each pooled channel
+ * evenly over images [begin, end).
+ */
+static void
+global_pool_backward_range(void *context, size_t begin, size_t end)
+{
+        const struct pool_job *job = (const struct pool_job *)context;
+        const struct pool_shape *shape = &job->shape;
+        const size_t num_pixels = shape->in_h*shape->in_w;
+        const size_t channels = shape->channels;
+        const float scale = 1.0f/num_pixels;
+        const bool is_nchw = (job->params->layout == ROT_LAYOUT_NCHW);
+        for (size_t image = begin;
+             image < end;
+             ++image) {
+                const float *out_grad = job->output_grad + image*channels;
+                float *in_grad = job->input_grad + image*channels*num_pixels;
+                if (is_nchw) {
+                        for (size_t c = 0;
+                             c < channels;
+                             ++c) {
+                                const float grad = out_grad[c]*scale;
+                                float *plane = in_grad + c*num_pixels;
+                                for (size_t p = 0;
+                                     p < num_pixels;
+                                     ++p) {
+                                        plane[p] = grad;
+                                }
+                        }
+                        continue;
+                }
+
+                for (size_t p = 0;
+                     p < num_pixels;
+                     ++p) {
+                        for (size_t c = 0;
+                             c < channels;
+                             ++c) {
+                                in_grad[p*channels + c] = out_grad[c]*scale;
+                        }
+                }
+        }
+}
+
+rot_tensor_t ROT_global_avgpool2d_backward(rot_tensor_t input_grad,
+                                           const rot_tensor_t output_grad,
+                                           enum rot_layout layout)
+{
+        if ((input_grad == NULL) || (output_grad == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        struct pool_shape shape;
+        if (!global_pool_check(&shape, output_grad, input_grad, layout))
+                return NULL;
+
+        if (tensor_is_overlapping(input_grad, output_grad)) {
+                LOG_ERROR("Pooling gradients must not overlap.");
+                return NULL;
+        }
+
+        struct rot_pool2d_params params = {};
+        params.layout = layout;
+        struct pool_job job = {};
+        job.shape = shape;
+        job.params = &params;
+        job.output_grad = output_grad->cpu.data;
+        job.input_grad = input_grad->cpu.data;
+        pool_run(shape.batch,
+                 tensor_get_num_elems(input_grad),
+                 global_pool_backward_range,
+                 &job);
+
+        return input_grad;
+}
@@ -17,69 +17,811 @@
  * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
  */
 #include "rot_nn.h"
+#include "error/log_error.h"  /* for LOG_ERROR, LOG_NULL, LOG_UNSUPPORTED */
+#include "math/dtype.h"       /* for dtype_to_float, dtype_from_float */
+#include "math/gemm.h"        /* for gemm_epilogue */
+#include "math/tensor.h"      /* for tensor_gemm_cpu, tensor_is_overlapping */
+#include "math/vec_math.h"    /* for vec_unary_avx512, scalar_unary, ... */
+
+#include "platform/cpu.h"     /* for cpu_get_isa */
+#include "platform/thread.h"  /* for parallel_for_range */
+
+#include <immintrin.h>        /* for __m256, __m512, _mm512_max_ps, ... */
 #include <stdint.h>
 
-rot_tensor_t ROT_relu(rot_tensor_t tensor)
+/**
+ * NOTE(brendan): Elementwise kernels are memory bound, so tensors are only
+ * split across threads once they are large enough for the extra memory
+ * bandwidth to pay for waking the threads. Threads then take NN_GRAIN_ELEMS
+ * at a time, which is small enough to balance uneven progress by stealing
+ * and big enough to amortise it.
+ */
+#define NN_GRAIN_ELEMS (16*1024)
+#define NN_MIN_PARALLEL_ELEMS (4*NN_GRAIN_ELEMS)
+
+/**
+ * NOTE(brendan): Operands of 16-bit types are widened into, and narrowed
+ * from, stack buffers of this many floats, which stay in L1.
+ */
+#define NN_CONVERT_ELEMS 512
+
+/**
+ * struct nn_unary_job - An elementwise op out[i] = f(in[i]) over `num_elems`
+ * elements, split into ranges by `parallel_for_range`. `in` and `out` may
+ * alias.
+ * @row_elems: Number of elements in each contiguous row of the operands, or
+ * `num_elems` if every operand is contiguous.
+ * @op: The function f.
+ */
+struct nn_unary_job {
+        const struct rot_tensor *in;
+        const struct rot_tensor *out;
+        size_t num_elems;
+        size_t row_elems;
+        enum rot_unary_op op;
+};
+
+/**
+ * struct nn_binary_job - An elementwise op out[i] = f(a[i], b[i]) over
+ * `num_elems` elements, split like struct nn_unary_job. `out` may alias `a` or
+ * `b`.
+ */
+struct nn_binary_job {
+        const struct rot_tensor *a;
+        const struct rot_tensor *b;
+        const struct rot_tensor *out;
+        size_t num_elems;
+        size_t row_elems;
+};
+
+/**
+ * nn_get_row_elems() - Returns the number of elements in each row that an
+ * elementwise op over `tensors` can process in one go, or 0 on error.
+ *
+ * Contiguous tensors are treated as one flat array, whatever their
+ * dimensions. Otherwise, e.g. for views, the op walks the rows of the last
+ * dimension, so every tensor must have the same dimensions and contiguous
+ * rows.
+ */
+static size_t
+nn_get_row_elems(const struct rot_tensor *const *tensors, uint32_t num_tensors)
 {
-        if (tensor == NULL)
-                return NULL;
+        const struct rot_tensor *first = tensors[0];
+        const size_t num_elems = tensor_get_num_elems(first);
+        bool is_contiguous = true;
+        for (uint32_t i = 0;
+             i < num_tensors;
+             ++i) {
+                if (tensor_get_num_elems(tensors[i]) != num_elems) {
+                        LOG_ERROR("Elementwise operands must have the same "
+                                  "number of elements.");
+                        return 0;
+                }
+
+                is_contiguous = is_contiguous &&
+                                tensor_is_contiguous(tensors[i]);
+        }
+
+        if (is_contiguous)
+                return num_elems;
 
-        /* TODO(brendan): speed test vs. NNPACK */
-        /* TODO(brendan): GPU implementations... */
-        float *data = ROT_tensor_get_data(tensor);
-        const size_t *dims = ROT_tensor_get_dims(tensor);
         for (uint32_t i = 0;
-             i < dims[0];
+             i < num_tensors;
              ++i) {
-                float val = data[i];
-                if (__builtin_signbit(val))
-                        data[i] = 0.0f;
+                const struct rot_tensor *t = tensors[i];
+                bool is_same_dims = (t->num_dims == first->num_dims);
+                for (uint32_t dim = 0;
+                     is_same_dims && (dim < t->num_dims);
+                     ++dim) {
+                        is_same_dims = (t->dims[dim] == first->dims[dim]);
+                }
+
+                if (!is_same_dims) {
+                        LOG_ERROR("Elementwise operands that are views must "
+                                  "have the same dimensions.");
+                        return 0;
+                }
+
+                if (!tensor_has_contiguous_rows(t)) {
+                        /* TODO(brendan): Gather/scatter for strided rows. */
+                        LOG_UNSUPPORTED();
+                        return 0;
+                }
         }
 
-        return tensor;
+        return first->dims[first->num_dims - 1];
 }
 
 /**
- * TODO(brendan): Replace this forward-propagated derivative with reverse mode.
+ * nn_is_float32() - Are all of `tensors` single precision?
  */
-rot_tensor_t ROT_relu_grad(rot_tensor_t out_grad,
-                           rot_tensor_t in_grad,
-                           rot_tensor_t activations)
+static bool
+nn_is_float32(const struct rot_tensor *const *tensors, uint32_t num_tensors)
 {
-        if ((out_grad == NULL) || (in_grad == NULL) || (activations == NULL)) {
+        for (uint32_t i = 0;
+             i < num_tensors;
+             ++i) {
+                if (tensors[i]->dtype != ROT_DTYPE_FLOAT32)
+                        return false;
+        }
+
+        return true;
+}
+
+/**
+ * nn_has_quantized() - Are any of `tensors` of 8-bit quantized types?
+ */
+static bool
+nn_has_quantized(const struct rot_tensor *const *tensors, uint32_t num_tensors)
+{
+        for (uint32_t i = 0;
+             i < num_tensors;
+             ++i) {
+                if (dtype_is_quantized(tensors[i]->dtype))
+                        return true;
+        }
+
+        return false;
+}
+
+/**
+ * nn_load() - Returns `num_elems` elements of `tensor` starting `offset`
+ * elements into its data as floats, widened into `chunk` unless `tensor` is
+ * already single precision.
+ */
+static const float *
+nn_load(const struct rot_tensor *tensor,
+        size_t offset,
+        float *chunk,
+        size_t num_elems)
+{
+        if (tensor->dtype == ROT_DTYPE_FLOAT32)
+                return tensor->cpu.data + offset;
+
+        dtype_to_float(tensor->dtype,
+                       tensor->cpu.data_16 + offset,
+                       chunk,
+                       num_elems);
+        return chunk;
+}
+
+/**
+ * nn_store() - Narrows `num_elems` floats computed in `chunk` into `tensor`,
+ * starting `offset` elements into its data.
+ */
+static void
+nn_store(const struct rot_tensor *tensor,
+         size_t offset,
+         const float *chunk,
+         size_t num_elems)
+{
+        dtype_from_float(tensor->dtype,
+                         chunk,
+                         tensor->cpu.data_16 + offset,
+                         num_elems);
+}
+
+/**
+ * nn_get_segment() - Finds the next run of elements from element `i` up to
+ * `end` that lies within one row, and sets `row` to that row and `col` to the
+ * offset of element `i` in it.
+ *
+ * Returns the number of elements in the run.
+ */
+static size_t
+nn_get_segment(size_t row_elems, size_t i, size_t end, size_t *row, size_t *col)
+{
+        *row = i/row_elems;
+        *col = i % row_elems;
+
+        size_t num_elems = row_elems - *col;
+        return (end - i < num_elems) ? (end - i) : num_elems;
+}
+
+/**
+ * nn_run_range() - Runs an elementwise job over `num_elems` elements, in
+ * parallel if it is big enough.
+ */
+static void
+nn_run_range(size_t num_elems, parallel_range_fn *range_fn, void *context)
+{
+        if (num_elems < NN_MIN_PARALLEL_ELEMS) {
+                range_fn(context, 0, num_elems);
+                return;
+        }
+
+        parallel_for_range(0, num_elems, NN_GRAIN_ELEMS, range_fn, context);
+}
+
+static void
+relu_generic(const float *in, float *out, size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                out[i] = (in[i] > 0.0f) ? in[i] : 0.0f;
+        }
+}
+
+__attribute__((target("avx2")))
+static void
+relu_avx2(const float *in, float *out, size_t num_elems)
+{
+        const __m256 zero = _mm256_setzero_ps();
+        size_t i = 0;
+        for (;
+             i + 32 <= num_elems;
+             i += 32) {
+                __m256 x0 = _mm256_loadu_ps(in + i);
+                __m256 x1 = _mm256_loadu_ps(in + i + 8);
+                __m256 x2 = _mm256_loadu_ps(in + i + 16);
+                __m256 x3 = _mm256_loadu_ps(in + i + 24);
+                _mm256_storeu_ps(out + i, _mm256_max_ps(x0, zero));
+                _mm256_storeu_ps(out + i + 8, _mm256_max_ps(x1, zero));
+                _mm256_storeu_ps(out + i + 16, _mm256_max_ps(x2, zero));
+                _mm256_storeu_ps(out + i + 24, _mm256_max_ps(x3, zero));
+        }
+
+        for (;
+             i + 8 <= num_elems;
+             i += 8) {
+                __m256 x = _mm256_loadu_ps(in + i);
+                _mm256_storeu_ps(out + i, _mm256_max_ps(x, zero));
+        }
+
+        relu_generic(in + i, out + i, num_elems - i);
+}
+
+__attribute__((target("avx512f")))
+static void
+relu_avx512(const float *in, float *out, size_t num_elems)
+{
+        const __m512 zero = _mm512_setzero_ps();
+        size_t i = 0;
+        for (;
+             i + 64 <= num_elems;
+             i += 64) {
+                __m512 x0 = _mm512_loadu_ps(in + i);
+                __m512 x1 = _mm512_loadu_ps(in + i + 16);
+                __m512 x2 = _mm512_loadu_ps(in + i + 32);
+                __m512 x3 = _mm512_loadu_ps(in + i + 48);
+                _mm512_storeu_ps(out + i, _mm512_max_ps(x0, zero));
+                _mm512_storeu_ps(out + i + 16, _mm512_max_ps(x1, zero));
+                _mm512_storeu_ps(out + i + 32, _mm512_max_ps(x2, zero));
+                _mm512_storeu_ps(out + i + 48, _mm512_max_ps(x3, zero));
+        }
+
+        for (;
+             i < num_elems;
+             i += 16) {
+                __mmask16 mask = ((num_elems - i >= 16) ?
+                                  0xFFFF : ((1u << (num_elems - i)) - 1));
+                __m512 x = _mm512_maskz_loadu_ps(mask, in + i);
+                _mm512_mask_storeu_ps(out + i, mask, _mm512_max_ps(x, zero));
+        }
+}
+
+static void
+relu_segment(const float *in, float *out, size_t num_elems)
+{
+        switch (cpu_get_isa()) {
+        case CPU_ISA_AVX512:
+                relu_avx512(in, out, num_elems);
+                break;
+        case CPU_ISA_AVX2:
+                relu_avx2(in, out, num_elems);
+                break;
+        default:
+                relu_generic(in, out, num_elems);
+                break;
+        }
+}
+
+static void
+unary_generic(enum rot_unary_op op,
+              const float *in,
+              float *out,
+              size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                out[i] = scalar_unary(in[i], op);
+        }
+}
+
+__attribute__((target("avx2,fma")))
+static void
+unary_avx2(enum rot_unary_op op, const float *in, float *out, size_t num_elems)
+{
+        size_t i = 0;
+        for (;
+             i + 8 <= num_elems;
+             i += 8) {
+                __m256 x = _mm256_loadu_ps(in + i);
+                _mm256_storeu_ps(out + i, vec_unary_avx2(x, op));
+        }
+
+        if (i == num_elems)
+                return;
+
+        __m256i mask = _mm256_cmpgt_epi32(
+                _mm256_set1_epi32((int32_t)(num_elems - i)),
+                _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+        __m256 x = _mm256_maskload_ps(in + i, mask);
+        _mm256_maskstore_ps(out + i, mask, vec_unary_avx2(x, op));
+}
+
+__attribute__((target("avx512f")))
+static void
+unary_avx512(enum rot_unary_op op,
+             const float *in,
+             float *out,
+             size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             i += 16) {
+                __mmask16 mask = ((num_elems - i >= 16) ?
+                                  0xFFFF : ((1u << (num_elems - i)) - 1));
+                __m512 x = _mm512_maskz_loadu_ps(mask, in + i);
+                _mm512_mask_storeu_ps(out + i,
+                                      mask,
+                                      vec_unary_avx512(x, op));
+        }
+}
+
+/**
+ * unary_segment() - Computes out[i] = op(in[i]) for `num_elems` contiguous
+ * single precision elements.
+ */
+static void
+unary_segment(enum rot_unary_op op,
+              const float *in,
+              float *out,
+              size_t num_elems)
+{
+        if (op == ROT_UNARY_RELU) {
+                relu_segment(in, out, num_elems);
+                return;
+        }
+
+        switch (cpu_get_isa()) {
+        case CPU_ISA_AVX512:
+                unary_avx512(op, in, out, num_elems);
+                break;
+        case CPU_ISA_AVX2:
+                unary_avx2(op, in, out, num_elems);
+                break;
+        default:
+                unary_generic(op, in, out, num_elems);
+                break;
+        }
+}
+
+/**
+ * unary_segment_dtype() - unary_segment for the `num_elems` elements starting
+ * at element offsets `in_offset` of `in` and `out_offset` of `out`, either of
+ * which may have a 16-bit type.
+ */
+static void
+unary_segment_dtype(enum rot_unary_op op,
+                    const struct rot_tensor *in,
+                    size_t in_offset,
+                    const struct rot_tensor *out,
+                    size_t out_offset,
+                    size_t num_elems)
+{
+        float in_chunk[NN_CONVERT_ELEMS];
+        float out_chunk[NN_CONVERT_ELEMS];
+        for (size_t i = 0;
+             i < num_elems;
+             i += NN_CONVERT_ELEMS) {
+                size_t chunk_elems = num_elems - i;
+                if (chunk_elems > NN_CONVERT_ELEMS)
+                        chunk_elems = NN_CONVERT_ELEMS;
+
+                const float *x = nn_load(in,
+                                         in_offset + i,
+                                         in_chunk,
+                                         chunk_elems);
+                if (out->dtype == ROT_DTYPE_FLOAT32) {
+                        unary_segment(op,
+                                      x,
+                                      out->cpu.data + out_offset + i,
+                                      chunk_elems);
+                        continue;
+                }
+
+                unary_segment(op, x, out_chunk, chunk_elems);
+                nn_store(out, out_offset + i, out_chunk, chunk_elems);
+        }
+}
+
+static void
+unary_range(void *context, size_t begin, size_t end)
+{
+        const struct nn_unary_job *job = (const struct nn_unary_job *)context;
+        const struct rot_tensor *operands[] = {job->in, job->out};
+        const bool is_float32 = nn_is_float32(operands, 2);
+
+        size_t i = begin;
+        while (i < end) {
+                size_t row;
+                size_t col;
+                size_t num_elems = nn_get_segment(job->row_elems,
+                                                  i,
+                                                  end,
+                                                  &row,
+                                                  &col);
+                size_t in_offset = tensor_get_row_offset(job->in, row) + col;
+                size_t out_offset = tensor_get_row_offset(job->out, row) + col;
+                if (is_float32) {
+                        unary_segment(job->op,
+                                      job->in->cpu.data + in_offset,
+                                      job->out->cpu.data + out_offset,
+                                      num_elems);
+                } else {
+                        unary_segment_dtype(job->op,
+                                            job->in,
+                                            in_offset,
+                                            job->out,
+                                            out_offset,
+                                            num_elems);
+                }
+                i += num_elems;
+        }
+}
+
+rot_tensor_t ROT_unary_out(rot_tensor_t result,
+                           const rot_tensor_t tensor,
+                           enum rot_unary_op op)
+{
+        if ((result == NULL) || (tensor == NULL)) {
                 LOG_NULL();
                 return NULL;
         }
 
-        /* TODO(brendan): What if activations are zero-length? */
-        size_t flattened_size = ROT_tensor_get_size(activations);
-        float *act_data = ROT_tensor_get_data(activations);
-        /* TODO(brendan): GPU implementation. */
-        bool is_zero = true;
-        for (uint32_t i = 0;
-             i < flattened_size;
+        /* TODO(brendan): GPU implementations... */
+        if ((result->backend != ROT_BACKEND_CPU) ||
+            (tensor->backend != ROT_BACKEND_CPU)) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        /* TODO(brendan): ReLU on quantized integers, as max(q, zero_point). */
+        const struct rot_tensor *operands[] = {result, tensor};
+        if (nn_has_quantized(operands, 2)) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        size_t row_elems = nn_get_row_elems(operands, 2);
+        if ((row_elems == 0) && (tensor_get_num_elems(tensor) != 0))
+                return NULL;
+
+        struct nn_unary_job job = {
+                .in = tensor,
+                .out = result,
+                .num_elems = tensor_get_num_elems(tensor),
+                .row_elems = row_elems,
+                .op = op};
+        nn_run_range(job.num_elems, unary_range, &job);
+
+        return result;
+}
+
+rot_tensor_t ROT_unary(rot_tensor_t tensor, enum rot_unary_op op)
+{
+        if (tensor == NULL)
+                return NULL;
+
+        return ROT_unary_out(tensor, tensor, op);
+}
+
+rot_tensor_t ROT_relu_out(rot_tensor_t result, const rot_tensor_t tensor)
+{
+        return ROT_unary_out(result, tensor, ROT_UNARY_RELU);
+}
+
+rot_tensor_t ROT_relu(rot_tensor_t tensor)
+{
+        return ROT_unary(tensor, ROT_UNARY_RELU);
+}
+
+static void
+relu_grad_generic(const float *in_grad,
+                  const float *act,
+                  float *out_grad,
+                  size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
              ++i) {
-                if (act_data[i] != 0.0f) {
-                        is_zero = false;
-                        break;
+                out_grad[i] = (act[i] > 0.0f) ? in_grad[i] : 0.0f;
+        }
+}
+
+__attribute__((target("avx2")))
+static void
+relu_grad_avx2(const float *in_grad,
+               const float *act,
+               float *out_grad,
+               size_t num_elems)
+{
+        const __m256 zero = _mm256_setzero_ps();
+        size_t i = 0;
+        for (;
+             i + 16 <= num_elems;
+             i += 16) {
+                __m256 mask0 = _mm256_cmp_ps(_mm256_loadu_ps(act + i),
+                                             zero,
+                                             _CMP_GT_OQ);
+                __m256 mask1 = _mm256_cmp_ps(_mm256_loadu_ps(act + i + 8),
+                                             zero,
+                                             _CMP_GT_OQ);
+                __m256 g0 = _mm256_loadu_ps(in_grad + i);
+                __m256 g1 = _mm256_loadu_ps(in_grad + i + 8);
+                _mm256_storeu_ps(out_grad + i, _mm256_and_ps(g0, mask0));
+                _mm256_storeu_ps(out_grad + i + 8, _mm256_and_ps(g1, mask1));
+        }
+
+        relu_grad_generic(in_grad + i, act + i, out_grad + i, num_elems - i);
+}
+
+__attribute__((target("avx512f")))
+static void
+relu_grad_avx512(const float *in_grad,
+                 const float *act,
+                 float *out_grad,
+                 size_t num_elems)
+{
+        const __m512 zero = _mm512_setzero_ps();
+        size_t i = 0;
+        for (;
+             i + 32 <= num_elems;
+             i += 32) {
+                __mmask16 mask0 = _mm512_cmp_ps_mask(_mm512_loadu_ps(act + i),
+                                                     zero,
+                                                     _CMP_GT_OQ);
+                __mmask16 mask1 = _mm512_cmp_ps_mask(
+                        _mm512_loadu_ps(act + i + 16),
+                        zero,
+                        _CMP_GT_OQ);
+                _mm512_storeu_ps(out_grad + i,
+                                 _mm512_maskz_loadu_ps(mask0, in_grad + i));
+                _mm512_storeu_ps(out_grad + i + 16,
+                                 _mm512_maskz_loadu_ps(mask1,
+                                                       in_grad + i + 16));
+        }
+
+        for (;
+             i < num_elems;
+             i += 16) {
+                __mmask16 tail = ((num_elems - i >= 16) ?
+                                  0xFFFF : ((1u << (num_elems - i)) - 1));
+                __mmask16 mask = _mm512_mask_cmp_ps_mask(
+                        tail,
+                        _mm512_maskz_loadu_ps(tail, act + i),
+                        zero,
+                        _CMP_GT_OQ);
+                _mm512_mask_storeu_ps(out_grad + i,
+                                      tail,
+                                      _mm512_maskz_loadu_ps(mask,
+                                                            in_grad + i));
+        }
+}
+
+static void
+relu_grad_segment(const float *in_grad,
+                  const float *act,
+                  float *out_grad,
+                  size_t num_elems)
+{
+        switch (cpu_get_isa()) {
+        case CPU_ISA_AVX512:
+                relu_grad_avx512(in_grad, act, out_grad, num_elems);
+                break;
+        case CPU_ISA_AVX2:
+                relu_grad_avx2(in_grad, act, out_grad, num_elems);
+                break;
+        default:
+                relu_grad_generic(in_grad, act, out_grad, num_elems);
+                break;
+        }
+}
+
+/**
+ * relu_grad_segment_dtype() - relu_grad_segment for `num_elems` elements of
+ * the operands of `job`, starting at element offsets `a_offset`, `b_offset`
+ * and `out_offset`, any of which may have a 16-bit type.
+ */
+static void
+relu_grad_segment_dtype(const struct nn_binary_job *job,
+                        size_t a_offset,
+                        size_t b_offset,
+                        size_t out_offset,
+                        size_t num_elems)
+{
+        float a_chunk[NN_CONVERT_ELEMS];
+        float b_chunk[NN_CONVERT_ELEMS];
+        float out_chunk[NN_CONVERT_ELEMS];
+        for (size_t i = 0;
+             i < num_elems;
+             i += NN_CONVERT_ELEMS) {
+                size_t chunk_elems = num_elems - i;
+                if (chunk_elems > NN_CONVERT_ELEMS)
+                        chunk_elems = NN_CONVERT_ELEMS;
+
+                const float *in_grad = nn_load(job->a,
+                                               a_offset + i,
+                                               a_chunk,
+                                               chunk_elems);
+                const float *act = nn_load(job->b,
+                                           b_offset + i,
+                                           b_chunk,
+                                           chunk_elems);
+                if (job->out->dtype == ROT_DTYPE_FLOAT32) {
+                        relu_grad_segment(in_grad,
+                                          act,
+                                          job->out->cpu.data + out_offset + i,
+                                          chunk_elems);
+                        continue;
                 }
+
+                relu_grad_segment(in_grad, act, out_chunk, chunk_elems);
+                nn_store(job->out, out_offset + i, out_chunk, chunk_elems);
         }
+}
 
-        if (is_zero) {
-                if (ROT_set_dims(out_grad,
-                                 in_grad->num_dims,
-                                 in_grad->dims) == NULL) {
-                        LOG_ERROR("Set dims failed.");
-                        return NULL;
+static void
+relu_grad_range(void *context, size_t begin, size_t end)
+{
+        const struct nn_binary_job *job = (const struct nn_binary_job *)context;
+        const struct rot_tensor *operands[] = {job->a, job->b, job->out};
+        const bool is_float32 = nn_is_float32(operands, 3);
+
+        size_t i = begin;
+        while (i < end) {
+                size_t row;
+                size_t col;
+                size_t num_elems = nn_get_segment(job->row_elems,
+                                                  i,
+                                                  end,
+                                                  &row,
+                                                  &col);
+                size_t a_offset = tensor_get_row_offset(job->a, row) + col;
+                size_t b_offset = tensor_get_row_offset(job->b, row) + col;
+                size_t out_offset = tensor_get_row_offset(job->out, row) + col;
+                if (is_float32) {
+                        relu_grad_segment(job->a->cpu.data + a_offset,
+                                          job->b->cpu.data + b_offset,
+                                          job->out->cpu.data + out_offset,
+                                          num_elems);
+                } else {
+                        relu_grad_segment_dtype(job,
+                                                a_offset,
+                                                b_offset,
+                                                out_offset,
+                                                num_elems);
                 }
+                i += num_elems;
+        }
+}
 
-                /**
-                 * TODO(brendan): presumably the dimensions should be the same
-                 * as the activations dimensions?
-                 *
-                 * Check reverse mode in autograd.
-                 */
+rot_tensor_t ROT_relu_grad(rot_tensor_t out_grad,
+                           const rot_tensor_t in_grad,
+                           const rot_tensor_t activations)
+{
+        if ((out_grad == NULL) || (in_grad == NULL) || (activations == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        /* TODO(brendan): GPU implementation. */
+        if ((out_grad->backend != ROT_BACKEND_CPU) ||
+            (in_grad->backend != ROT_BACKEND_CPU) ||
+            (activations->backend != ROT_BACKEND_CPU)) {
+                LOG_UNSUPPORTED();
+                return NULL;
         }
 
+        const struct rot_tensor *operands[] = {out_grad, in_grad, activations};
+        if (nn_has_quantized(operands, 3)) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        size_t row_elems = nn_get_row_elems(operands, 3);
+        if ((row_elems == 0) && (tensor_get_num_elems(activations) != 0))
+                return NULL;
+
+        struct nn_binary_job job = {
+                .a = in_grad,
+                .b = activations,
+                .out = out_grad,
+                .num_elems = tensor_get_num_elems(activations),
+                .row_elems = row_elems};
+        nn_run_range(job.num_elems, relu_grad_range, &job);
+
         return out_grad;
 }
+
+rot_tensor_t ROT_linear(rot_tensor_t result,
+                        const rot_tensor_t w,
+                        const rot_tensor_t x,
+                        const rot_tensor_t bias,
+                        enum rot_activation activation)
+{
+        if ((result == NULL) || (w == NULL) || (x == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if ((w->num_dims != 2) || (x->num_dims != 2)) {
+                LOG_ERROR("Linear layer weights and inputs must have "
+                          "dimension 2.");
+                return NULL;
+        }
+
+        const size_t m = w->dims[0];
+        const size_t k = w->dims[1];
+        const size_t n = x->dims[1];
+        if (k != x->dims[0]) {
+                LOG_ERROR("Matrix dimensions incompatible for "
+                          "multiplication.");
+                return NULL;
+        }
+
+        if ((result->num_dims != 2) ||
+            (result->dims[0] != m) ||
+            (result->dims[1] != n)) {
+                LOG_ERROR("Linear layer result must have dimensions mxn.");
+                return NULL;
+        }
+
+        if ((bias != NULL) &&
+            ((bias->dtype != ROT_DTYPE_FLOAT32) ||
+             (tensor_get_num_elems(bias) != m) ||
+             !tensor_is_contiguous(bias))) {
+                LOG_ERROR("Linear layer bias must have one float32 element "
+                          "per output row.");
+                return NULL;
+        }
+
+        if ((result->backend != ROT_BACKEND_CPU) ||
+            (w->backend != ROT_BACKEND_CPU) ||
+            (x->backend != ROT_BACKEND_CPU) ||
+            ((bias != NULL) && (bias->backend != ROT_BACKEND_CPU))) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        if (tensor_is_overlapping(result, w) ||
+            tensor_is_overlapping(result, x) ||
+            ((bias != NULL) && tensor_is_overlapping(result, bias))) {
+                LOG_ERROR("Result tensor of linear layer must not overlap "
+                          "its operands or bias.");
+                return NULL;
+        }
+
+        struct gemm_epilogue epilogue = {
+                .row_bias = (bias != NULL) ? bias->cpu.data : NULL,
+                .col_bias = NULL,
+                .activation = activation};
+        if (!tensor_gemm_cpu(ROT_MATMUL_ENGINE_DEFAULT,
+                             false,
+                             false,
+                             1.0f,
+                             w,
+                             x,
+                             0.0f,
+                             result,
+                             &epilogue)) {
+                LOG_ERROR("Linear layer operands must have contiguous rows "
+                          "or columns, and compatible types.");
+                return NULL;
+        }
+
+        return result;
+}
@@ -0,0 +1,489 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "rot_tape.h"
+#include "rot_nn.h"           /* for ROT_relu, ROT_relu_grad */
+#include "error/log_error.h"  /* for LOG_ERROR, LOG_NULL, LOG_UNSUPPORTED */
+#include "math/tensor.h"      /* for rot_tensor, tensor_gemm_cpu */
+
+#include <stdint.h>           /* for SIZE_MAX, UINT32_MAX */
+#include <string.h>           /* for memset */
+
+/**
+ * NOTE(brendan): An op reads at most two tensors and writes one, so this many
+ * tensor entries are enough for any sequence of `max_ops` ops, as long as the
+ * entries of tensors left over from earlier steps are recycled.
+ */
+#define TAPE_MAX_TENSORS_PER_OP 3
+
+enum tape_op_type {
+        TAPE_OP_MATMUL,
+        TAPE_OP_RELU,
+};
+
+/**
+ * struct tape_op - One recorded op.
+ * @type: Which op.
+ * @result_i: Index of the entry for the op's output tensor.
+ * @operand_i: Indices of the entries for the op's inputs. Unary ops only use
+ * the first, and in-place ops have `operand_i[0] == result_i`.
+ */
+struct tape_op {
+        enum tape_op_type type;
+        uint32_t result_i;
+        uint32_t operand_i[2];
+};
+
+/**
+ * struct tape_entry - A tensor seen by the tape, and its gradient.
+ * @tensor: The forward tensor.
+ * @grad: Gradient of the loss with respect to `tensor`, with the same
+ * dimensions.
+ * @is_grad_written: Has some adjoint written `grad` during the current
+ * backward pass? The first adjoint to reach a gradient overwrites it instead
+ * of accumulating, so gradients never need to be cleared up front.
+ * @is_recorded: Has `tensor` been recorded since the last reset? Entries that
+ * have not are stale, and are handed, with their gradient, to new tensors.
+ */
+struct tape_entry {
+        rot_tensor_t tensor;
+        rot_tensor_t grad;
+        bool is_grad_written;
+        bool is_recorded;
+};
+
+struct rot_tape {
+        rot_arena_t arena;
+        struct tape_op *ops;
+        uint32_t num_ops;
+        uint32_t max_ops;
+        struct tape_entry *entries;
+        uint32_t num_entries;
+        uint32_t max_entries;
+};
+
+/**
+ * tape_find_entry() - Returns the index of the entry for `tensor`, or
+ * `tape->num_entries` if there is none.
+ *
+ * NOTE(brendan): A linear scan is fine for the tens to hundreds of tensors in
+ * a layer graph, and keeps the tape free of any hashing.
+ */
+static uint32_t
+tape_find_entry(const struct rot_tape *tape, const struct rot_tensor *tensor)
+{
+        for (uint32_t entry_i = 0;
+             entry_i < tape->num_entries;
+             ++entry_i) {
+                if (tape->entries[entry_i].tensor == tensor)
+                        return entry_i;
+        }
+
+        return tape->num_entries;
+}
+
+/**
+ * tape_find_recorded() - Returns the index of the entry for `tensor`, or
+ * `tape->num_entries` if `tensor` has not been recorded since the last reset.
+ */
+static uint32_t
+tape_find_recorded(const struct rot_tape *tape,
+                   const struct rot_tensor *tensor)
+{
+        uint32_t entry_i = tape_find_entry(tape, tensor);
+        if ((entry_i < tape->num_entries) &&
+            !tape->entries[entry_i].is_recorded)
+                return tape->num_entries;
+
+        return entry_i;
+}
+
+/**
+ * tape_is_grad_of() - Does `grad` have the dimensions and backend of
+ * `tensor`, so that it can hold its gradient?
+ */
+static bool
+tape_is_grad_of(const struct rot_tensor *grad, const struct rot_tensor *tensor)
+{
+        if ((grad->backend != tensor->backend) ||
+            (grad->num_dims != tensor->num_dims))
+                return false;
+
+        for (uint32_t dim = 0;
+             dim < tensor->num_dims;
+             ++dim) {
+                if (grad->dims[dim] != tensor->dims[dim])
+                        return false;
+        }
+
+        return true;
+}
+
+/**
+ * tape_get_entry() - Finds the entry for `tensor`, and marks it recorded.
+ *
+ * If the tape has not seen `tensor`, it takes over a stale entry whose
+ * gradient fits it, so that steps recording fresh tensors of the same
+ * dimensions allocate nothing. Otherwise the gradient is allocated from the
+ * tape's arena, for a new entry or, if the tape is full, a stale one.
+ *
+ * Returns true and stores the index of the entry in `entry_i` on success.
+ */
+static bool
+tape_get_entry(struct rot_tape *tape, rot_tensor_t tensor, uint32_t *entry_i)
+{
+        *entry_i = tape_find_entry(tape, tensor);
+        if ((*entry_i < tape->num_entries) &&
+            !tape->entries[*entry_i].is_recorded &&
+            !tape_is_grad_of(tape->entries[*entry_i].grad, tensor)) {
+                /**
+                 * NOTE(brendan): A stale entry for a tensor that has since
+                 * been freed, whose memory now holds a different tensor.
+                 */
+                tape->entries[*entry_i].tensor = NULL;
+                *entry_i = tape->num_entries;
+        }
+
+        uint32_t stale_i = tape->num_entries;
+        for (uint32_t i = 0;
+             (*entry_i == tape->num_entries) && (i < tape->num_entries);
+             ++i) {
+                const struct tape_entry *entry = tape->entries + i;
+                if (entry->is_recorded)
+                        continue;
+
+                if (tape_is_grad_of(entry->grad, tensor))
+                        *entry_i = i;
+                else if (stale_i == tape->num_entries)
+                        stale_i = i;
+        }
+
+        if (*entry_i == tape->num_entries) {
+                if ((stale_i == tape->num_entries) &&
+                    (tape->num_entries >= tape->max_entries)) {
+                        LOG_ERROR("Too many tensors recorded on tape.");
+                        return false;
+                }
+
+                rot_tensor_t grad = ROT_create_tensor(tape->arena,
+                                                      tensor->num_dims,
+                                                      tensor->dims,
+                                                      tensor->backend);
+                if (grad == NULL)
+                        return false;
+
+                if (tape->num_entries < tape->max_entries) {
+                        *entry_i = tape->num_entries;
+                        ++tape->num_entries;
+                } else {
+                        *entry_i = stale_i;
+                }
+                tape->entries[*entry_i].grad = grad;
+        }
+
+        struct tape_entry *entry = tape->entries + *entry_i;
+        entry->tensor = tensor;
+        entry->is_grad_written = false;
+        entry->is_recorded = true;
+
+        return true;
+}
+
+/**
+ * tape_record() - Appends an op to the tape, creating entries for its
+ * tensors. `b` may be NULL for unary ops.
+ */
+static bool
+tape_record(struct rot_tape *tape,
+            enum tape_op_type type,
+            rot_tensor_t result,
+            rot_tensor_t a,
+            rot_tensor_t b)
+{
+        if (tape->num_ops >= tape->max_ops) {
+                LOG_ERROR("Tape is full.");
+                return false;
+        }
+
+        struct tape_op *op = tape->ops + tape->num_ops;
+        op->type = type;
+        if (!tape_get_entry(tape, result, &op->result_i) ||
+            !tape_get_entry(tape, a, &op->operand_i[0]))
+                return false;
+
+        op->operand_i[1] = op->operand_i[0];
+        if ((b != NULL) && !tape_get_entry(tape, b, &op->operand_i[1]))
+                return false;
+
+        ++tape->num_ops;
+
+        return true;
+}
+
+rot_tape_t ROT_tape_new(rot_arena_t arena, uint32_t max_ops)
+{
+        if (arena == NULL) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        /**
+         * NOTE(brendan): Entries are counted in uint32_t, and both arrays'
+         * sizes must fit in size_t.
+         */
+        const size_t max_entries = TAPE_MAX_TENSORS_PER_OP*(size_t)max_ops;
+        if ((max_ops == 0) ||
+            (max_entries > UINT32_MAX) ||
+            (max_ops > SIZE_MAX/sizeof(struct tape_op)) ||
+            (max_entries > SIZE_MAX/sizeof(struct tape_entry))) {
+                LOG_ERROR("Tape must hold at least one op, and few enough "
+                          "for its entries to be counted.");
+                return NULL;
+        }
+
+        struct rot_tape *tape = (struct rot_tape *)ROT_arena_malloc(
+                arena,
+                sizeof(struct rot_tape),
+                ROT_BACKEND_CPU);
+        if (tape == NULL)
+                return NULL;
+
+        tape->max_entries = (uint32_t)max_entries;
+        tape->ops = (struct tape_op *)ROT_arena_malloc(
+                arena,
+                max_ops*sizeof(struct tape_op),
+                ROT_BACKEND_CPU);
+        tape->entries = (struct tape_entry *)ROT_arena_malloc(
+                arena,
+                tape->max_entries*sizeof(struct tape_entry),
+                ROT_BACKEND_CPU);
+        if ((tape->ops == NULL) || (tape->entries == NULL))
+                return NULL;
+
+        tape->arena = arena;
+        tape->num_ops = 0;
+        tape->max_ops = max_ops;
+        tape->num_entries = 0;
+
+        return tape;
+}
+
+rot_tape_t ROT_tape_reset(rot_tape_t tape)
+{
+        if (tape == NULL) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        tape->num_ops = 0;
+        for (uint32_t entry_i = 0;
+             entry_i < tape->num_entries;
+             ++entry_i) {
+                tape->entries[entry_i].is_recorded = false;
+        }
+
+        return tape;
+}
+
+rot_tensor_t ROT_tape_matmul(rot_tape_t tape,
+                             rot_tensor_t result,
+                             const rot_tensor_t a,
+                             const rot_tensor_t b)
+{
+        if ((tape == NULL) || (result == NULL) || (a == NULL) || (b == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if ((result->backend != ROT_BACKEND_CPU) ||
+            (a->backend != ROT_BACKEND_CPU) ||
+            (b->backend != ROT_BACKEND_CPU)) {
+                LOG_UNSUPPORTED();
+                return NULL;
+        }
+
+        if (ROT_matmul(result, a, b) == NULL)
+                return NULL;
+
+        if (!tape_record(tape, TAPE_OP_MATMUL, result, a, b))
+                return NULL;
+
+        return result;
+}
+
+rot_tensor_t ROT_tape_relu(rot_tape_t tape, rot_tensor_t tensor)
+{
+        if ((tape == NULL) || (tensor == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (ROT_relu(tensor) == NULL)
+                return NULL;
+
+        if (!tape_record(tape, TAPE_OP_RELU, tensor, tensor, NULL))
+                return NULL;
+
+        return tensor;
+}
+
+/**
+ * tape_matmul_adjoint() - Adjoint of c = a*b, with a mxk and b kxn.
+ *
+ * grad_a (+)= grad_c*b^T and grad_b (+)= a^T*grad_c, as GEMMs that read the
+ * transposes in place and use beta to either overwrite or accumulate.
+ *
+ * Returns false if an operand's layout is not supported.
+ */
+static bool
+tape_matmul_adjoint(struct rot_tape *tape, const struct tape_op *op)
+{
+        const struct tape_entry *c = tape->entries + op->result_i;
+        struct tape_entry *a = tape->entries + op->operand_i[0];
+        struct tape_entry *b = tape->entries + op->operand_i[1];
+
+        if (!tensor_gemm_cpu(ROT_MATMUL_ENGINE_DEFAULT,
+                             false,
+                             true,
+                             1.0f,
+                             c->grad,
+                             b->tensor,
+                             a->is_grad_written ? 1.0f : 0.0f,
+                             a->grad,
+                             NULL)) {
+                return false;
+        }
+        a->is_grad_written = true;
+
+        if (!tensor_gemm_cpu(ROT_MATMUL_ENGINE_DEFAULT,
+                             true,
+                             false,
+                             1.0f,
+                             a->tensor,
+                             c->grad,
+                             b->is_grad_written ? 1.0f : 0.0f,
+                             b->grad,
+                             NULL)) {
+                return false;
+        }
+        b->is_grad_written = true;
+
+        return true;
+}
+
+rot_tape_t ROT_backward(rot_tape_t tape,
+                        const rot_tensor_t output,
+                        const rot_tensor_t output_grad)
+{
+        if ((tape == NULL) || (output == NULL) || (output_grad == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        uint32_t output_i = tape_find_recorded(tape, output);
+        if (output_i == tape->num_entries) {
+                LOG_ERROR("Output tensor was not recorded on tape.");
+                return NULL;
+        }
+
+        bool is_same_dims = (output_grad->num_dims == output->num_dims);
+        for (uint32_t dim = 0;
+             is_same_dims && (dim < output->num_dims);
+             ++dim) {
+                is_same_dims = (output_grad->dims[dim] == output->dims[dim]);
+        }
+
+        if ((output_grad->backend != ROT_BACKEND_CPU) ||
+            !is_same_dims ||
+            !tensor_has_contiguous_rows(output_grad)) {
+                LOG_ERROR("Output gradient must be a CPU tensor with the "
+                          "dimensions of the output, and contiguous rows.");
+                return NULL;
+        }
+
+        for (uint32_t entry_i = 0;
+             entry_i < tape->num_entries;
+             ++entry_i) {
+                tape->entries[entry_i].is_grad_written = false;
+        }
+
+        struct tape_entry *output_entry = tape->entries + output_i;
+        /* NOTE(brendan): Also widens an output gradient of another type. */
+        if (ROT_tensor_convert(output_entry->grad, output_grad) == NULL)
+                return NULL;
+
+        output_entry->is_grad_written = true;
+
+        for (uint32_t op_i = tape->num_ops;
+             op_i > 0;
+             --op_i) {
+                const struct tape_op *op = tape->ops + (op_i - 1);
+                struct tape_entry *result = tape->entries + op->result_i;
+                /**
+                 * NOTE(brendan): An unwritten gradient is zero, so the op
+                 * contributes nothing to its operands' gradients.
+                 */
+                if (!result->is_grad_written)
+                        continue;
+
+                switch (op->type) {
+                case TAPE_OP_MATMUL:
+                        if (!tape_matmul_adjoint(tape, op)) {
+                                LOG_UNSUPPORTED();
+                                return NULL;
+                        }
+                        break;
+                case TAPE_OP_RELU:
+                        if (ROT_relu_grad(result->grad,
+                                          result->grad,
+                                          result->tensor) == NULL)
+                                return NULL;
+                        break;
+                default:
+                        LOG_UNSUPPORTED();
+                        return NULL;
+                }
+        }
+
+        for (uint32_t entry_i = 0;
+             entry_i < tape->num_entries;
+             ++entry_i) {
+                struct tape_entry *entry = tape->entries + entry_i;
+                if (entry->is_recorded && !entry->is_grad_written) {
+                        memset(entry->grad->cpu.data,
+                               0,
+                               ROT_tensor_get_size(entry->grad));
+                }
+        }
+
+        return tape;
+}
+
+rot_tensor_t ROT_tape_get_grad(rot_tape_t tape, const rot_tensor_t tensor)
+{
+        if ((tape == NULL) || (tensor == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        uint32_t entry_i = tape_find_recorded(tape, tensor);
+        if (entry_i == tape->num_entries)
+                return NULL;
+
+        return tape->entries[entry_i].grad;
+}
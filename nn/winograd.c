@@ -0,0 +1,816 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "nn/conv.h"
+#include "error/log_error.h"  /* for LOG_ERROR, LOG_NULL */
+#include "math/gemm.h"        /* for gemm_cpu, gemm_apply_epilogue */
+#include "math/size_math.h"   /* for min_size, ceil_div */
+#include "math/tensor.h"      /* for rot_tensor, tensor_is_overlapping */
+#include "platform/thread.h"  /* for parallel_for_range */
+
+#include <string.h>           /* for memcpy, memset */
+
+/**
+ * NOTE(brendan): Winograd F(4x4, 3x3) computes each 4x4 tile of output from a
+ * 6x6 window of input, as Y = A^T[(G g G^T) * (B^T d B)]A, where * is
+ * elementwise over the 36 points of the transform, and with
+ *
+ *         | 4  0 -5  0  1  0 |         | 1/4     0     0 |
+ *         | 0 -4 -4  1  1  0 |         | -1/6 -1/6  -1/6 |
+ * B^T =   | 0  4 -4 -1  1  0 |     G = | -1/6  1/6  -1/6 |
+ *         | 0 -2 -1  2  1  0 |         | 1/24 1/12   1/6 |
+ *         | 0  2 -1 -2  1  0 |         | 1/24 -1/12  1/6 |
+ *         | 0  4  0 -5  0  1 |         | 0       0     1 |
+ *
+ *         | 1  1  1  1  1  0 |
+ * A^T =   | 0  1 -1  2 -2  0 |
+ *         | 0  1  1  4  4  0 |
+ *         | 0  1 -1  8 -8  1 |
+ *
+ * Summed over input channels, the elementwise products become 36 GEMMs.
+ */
+#define WINO_TILE 4
+#define WINO_WINDOW 6
+#define WINO_POINTS (WINO_WINDOW*WINO_WINDOW)
+/**
+ * NOTE(brendan): Transforms are computed for WINO_CHANNEL_BLOCK channels at a
+ * time, vectorised across the channels.
+ */
+#define WINO_CHANNEL_BLOCK 16
+/**
+ * NOTE(brendan): A block of tiles' transformed inputs and outputs take up at
+ * most WINO_BLOCK_BYTES, so that they stay in cache between the transforms
+ * and the GEMMs, except that a block has at least WINO_MIN_BLOCK_TILES tiles
+ * so that the GEMMs have enough rows. Blocks of 1 MiB were measured to be
+ * slower, since the 36 GEMMs then each repack their filter for fewer rows.
+ */
+#define WINO_BLOCK_BYTES (2*1024*1024)
+#define WINO_MIN_BLOCK_TILES 24
+/**
+ * NOTE(brendan): With fewer channels than this, the GEMMs are too small for
+ * the saved multiplies to pay for the transforms.
+ */
+#define WINO_MIN_CHANNELS 16
+/**
+ * NOTE(brendan): ALGO_AUTO transforms the filter on every call, which costs
+ * as much as about 100 tiles' worth of the multiplies that Winograd saves, so
+ * it only picks Winograd for at least WINO_MIN_AUTO_TILES output tiles. With
+ * the filter transformed up front, Winograd measured faster from about 16
+ * tiles.
+ */
+#define WINO_MIN_AUTO_TILES 128
+/**
+ * NOTE(brendan): Filter transforms are split across threads in chunks of
+ * output channels holding about WINO_FILTER_GRAIN 3x3 filters.
+ */
+#define WINO_FILTER_GRAIN 256
+
+/**
+ * struct wino_job - A Winograd convolution split into tasks, one for each
+ * block of `block_tiles` output tiles, counted across the whole batch.
+ * @filter: Transformed filter, as 36 [out channels, in channels] matrices.
+ */
+struct wino_job {
+        const struct conv_shape *shape;
+        const struct rot_conv2d_params *params;
+        enum rot_matmul_engine engine;
+        const float *input;
+        const float *filter;
+        const float *bias;
+        float *output;
+        size_t tiles_h;
+        size_t tiles_w;
+        size_t num_tiles;
+        size_t block_tiles;
+};
+
+/**
+ * wino_input_1d() - Multiplies the 6 vectors of `width` floats at `in`,
+ * `in_stride` apart, by B^T, into `out`.
+ */
+static void
+wino_input_1d(const float *in,
+              size_t in_stride,
+              float *out,
+              size_t out_stride,
+              size_t width)
+{
+        for (size_t c = 0;
+             c < width;
+             ++c) {
+                const float d0 = in[c];
+                const float d1 = in[in_stride + c];
+                const float d2 = in[2*in_stride + c];
+                const float d3 = in[3*in_stride + c];
+                const float d4 = in[4*in_stride + c];
+                const float d5 = in[5*in_stride + c];
+                out[c] = 4.0f*d0 - 5.0f*d2 + d4;
+                out[out_stride + c] = -4.0f*(d1 + d2) + d3 + d4;
+                out[2*out_stride + c] = 4.0f*(d1 - d2) - d3 + d4;
+                out[3*out_stride + c] = 2.0f*(d3 - d1) - d2 + d4;
+                out[4*out_stride + c] = 2.0f*(d1 - d3) - d2 + d4;
+                out[5*out_stride + c] = 4.0f*d1 - 5.0f*d3 + d5;
+        }
+}
+
+/**
+ * wino_output_1d() - Multiplies the 6 vectors of `width` floats at `in`,
+ * `in_stride` apart, by A^T, into `out`.
+ */
+static void
+wino_output_1d(const float *in,
+               size_t in_stride,
+               float *out,
+               size_t out_stride,
+               size_t width)
+{
+        for (size_t c = 0;
+             c < width;
+             ++c) {
+                const float m0 = in[c];
+                const float m1 = in[in_stride + c];
+                const float m2 = in[2*in_stride + c];
+                const float m3 = in[3*in_stride + c];
+                const float m4 = in[4*in_stride + c];
+                const float m5 = in[5*in_stride + c];
+                out[c] = m0 + (m1 + m2) + (m3 + m4);
+                out[out_stride + c] = (m1 - m2) + 2.0f*(m3 - m4);
+                out[2*out_stride + c] = (m1 + m2) + 4.0f*(m3 + m4);
+                out[3*out_stride + c] = (m1 - m2) + 8.0f*(m3 - m4) + m5;
+        }
+}
+
+/**
+ * wino_filter_1d() - Multiplies the 3 floats at `in`, `in_stride` apart, by G,
+ * into `out`.
+ */
+static void
+wino_filter_1d(const float *in, size_t in_stride, float *out, size_t out_stride)
+{
+        const float g0 = in[0];
+        const float g1 = in[in_stride];
+        const float g2 = in[2*in_stride];
+        out[0] = g0/4.0f;
+        out[out_stride] = -(g0 + g1 + g2)/6.0f;
+        out[2*out_stride] = -(g0 - g1 + g2)/6.0f;
+        out[3*out_stride] = g0/24.0f + g1/12.0f + g2/6.0f;
+        out[4*out_stride] = g0/24.0f - g1/12.0f + g2/6.0f;
+        out[5*out_stride] = g2;
+}
+
+/**
+ * struct wino_filter_job - A filter transform split into ranges of output
+ * channels, see `wino_transform_filter`.
+ */
+struct wino_filter_job {
+        const float *filter;
+        enum rot_layout layout;
+        size_t out_channels;
+        size_t in_channels;
+        float *transformed;
+};
+
+/**
+ * wino_filter_range() - Transforms the filters of output channels
+ * [begin, end).
+ */
+static void
+wino_filter_range(void *context, size_t begin, size_t end)
+{
+        const struct wino_filter_job *job =
+                (const struct wino_filter_job *)context;
+        const float *filter = job->filter;
+        const size_t in_channels = job->in_channels;
+        const size_t point_stride = job->out_channels*in_channels;
+        for (size_t o = begin;
+             o < end;
+             ++o) {
+                for (size_t c = 0;
+                     c < in_channels;
+                     ++c) {
+                        /**
+                         * NOTE(brendan): g is the 3x3 filter at (o, c), of
+                         * which rows are 3 taps apart for OIHW, and
+                         * 3*in_channels apart for OHWI.
+                         */
+                        const float *g;
+                        size_t tap_stride;
+                        if (job->layout == ROT_LAYOUT_NCHW) {
+                                g = filter + (o*in_channels + c)*9;
+                                tap_stride = 1;
+                        } else {
+                                g = filter + o*9*in_channels + c;
+                                tap_stride = in_channels;
+                        }
+
+                        float tmp[WINO_WINDOW][3];
+                        for (uint32_t j = 0;
+                             j < 3;
+                             ++j) {
+                                wino_filter_1d(g + j*tap_stride,
+                                               3*tap_stride,
+                                               &tmp[0][j],
+                                               3);
+                        }
+
+                        float u[WINO_POINTS];
+                        for (uint32_t i = 0;
+                             i < WINO_WINDOW;
+                             ++i) {
+                                wino_filter_1d(tmp[i],
+                                               1,
+                                               u + i*WINO_WINDOW,
+                                               1);
+                        }
+
+                        float *out = job->transformed + o*in_channels + c;
+                        for (uint32_t p = 0;
+                             p < WINO_POINTS;
+                             ++p) {
+                                out[p*point_stride] = u[p];
+                        }
+                }
+        }
+}
+
+/**
+ * wino_transform_filter() - Transforms the 3x3 `filter` into 36 matrices of
+ * [out_channels, in_channels] at `transformed`.
+ */
+static void
+wino_transform_filter(const float *filter,
+                      enum rot_layout layout,
+                      size_t out_channels,
+                      size_t in_channels,
+                      float *transformed)
+{
+        struct wino_filter_job job = {
+                .filter = filter,
+                .layout = layout,
+                .out_channels = out_channels,
+                .in_channels = in_channels,
+                .transformed = transformed};
+        const size_t grain = ((in_channels > 0) ?
+                              ceil_div(WINO_FILTER_GRAIN, in_channels) :
+                              out_channels);
+
+        parallel_for_range(0, out_channels, grain, wino_filter_range, &job);
+}
+
+/**
+ * wino_get_tile() - Sets `image`, `tile_y` and `tile_x` to the position of
+ * tile `tile` of the batch.
+ */
+static void
+wino_get_tile(const struct wino_job *job,
+              size_t tile,
+              size_t *image,
+              size_t *tile_y,
+              size_t *tile_x)
+{
+        const size_t tiles_per_image = job->tiles_h*job->tiles_w;
+        *image = tile/tiles_per_image;
+        *tile_y = (tile % tiles_per_image)/job->tiles_w;
+        *tile_x = tile % job->tiles_w;
+}
+
+/**
+ * wino_load_window() - Gathers the 6x6 input window of a tile for channels
+ * [c0, c0 + width) into `d`, as 36 vectors of WINO_CHANNEL_BLOCK floats, with
+ * zeros for the padding.
+ */
+static void
+wino_load_window(const struct wino_job *job,
+                 size_t image,
+                 size_t tile_y,
+                 size_t tile_x,
+                 size_t c0,
+                 size_t width,
+                 float *d)
+{
+        const struct conv_shape *shape = job->shape;
+        const bool is_nchw = (job->params->layout == ROT_LAYOUT_NCHW);
+        const size_t plane = shape->in_h*shape->in_w;
+        const float *in_image = (job->input +
+                                 image*shape->in_channels*plane);
+        for (uint32_t wy = 0;
+             wy < WINO_WINDOW;
+             ++wy) {
+                const size_t y = conv_get_input_pos(tile_y,
+                                                    wy,
+                                                    WINO_TILE,
+                                                    job->params->padding[0],
+                                                    1);
+                for (uint32_t wx = 0;
+                     wx < WINO_WINDOW;
+                     ++wx) {
+                        const size_t x = conv_get_input_pos(
+                                tile_x,
+                                wx,
+                                WINO_TILE,
+                                job->params->padding[1],
+                                1);
+                        float *d_point = (d +
+                                          ((wy*WINO_WINDOW + wx)*
+                                           WINO_CHANNEL_BLOCK));
+                        if ((y >= shape->in_h) || (x >= shape->in_w)) {
+                                memset(d_point, 0, width*sizeof(float));
+                                continue;
+                        }
+
+                        const size_t pixel = y*shape->in_w + x;
+                        if (!is_nchw) {
+                                memcpy(d_point,
+                                       (in_image +
+                                        pixel*shape->in_channels +
+                                        c0),
+                                       width*sizeof(float));
+                                continue;
+                        }
+
+                        for (size_t c = 0;
+                             c < width;
+                             ++c) {
+                                d_point[c] = in_image[(c0 + c)*plane + pixel];
+                        }
+                }
+        }
+}
+
+/**
+ * wino_store_tile() - Scatters the 4x4 output tile `y`, of 16 vectors of
+ * WINO_CHANNEL_BLOCK floats for channels [c0, c0 + width), into the output,
+ * cropped to its edges.
+ */
+static void
+wino_store_tile(const struct wino_job *job,
+                size_t image,
+                size_t tile_y,
+                size_t tile_x,
+                size_t c0,
+                size_t width,
+                const float *y)
+{
+        const struct conv_shape *shape = job->shape;
+        const bool is_nchw = (job->params->layout == ROT_LAYOUT_NCHW);
+        const size_t out_image_elems = shape->out_channels*shape->num_pixels;
+        float *out_image = job->output + image*out_image_elems;
+        const size_t rows = min_size(WINO_TILE,
+                                     shape->out_h - tile_y*WINO_TILE);
+        const size_t cols = min_size(WINO_TILE,
+                                     shape->out_w - tile_x*WINO_TILE);
+        for (size_t ty = 0;
+             ty < rows;
+             ++ty) {
+                for (size_t tx = 0;
+                     tx < cols;
+                     ++tx) {
+                        const size_t pixel = ((tile_y*WINO_TILE + ty)*
+                                              shape->out_w +
+                                              tile_x*WINO_TILE + tx);
+                        const float *y_point = (y +
+                                                ((ty*WINO_TILE + tx)*
+                                                 WINO_CHANNEL_BLOCK));
+                        if (!is_nchw) {
+                                memcpy((out_image +
+                                        pixel*shape->out_channels +
+                                        c0),
+                                       y_point,
+                                       width*sizeof(float));
+                                continue;
+                        }
+
+                        for (size_t c = 0;
+                             c < width;
+                             ++c) {
+                                out_image[(c0 + c)*shape->num_pixels +
+                                          pixel] = y_point[c];
+                        }
+                }
+        }
+}
+
+/**
+ * wino_transform_inputs() - Transforms the input windows of tiles
+ * [tile0, tile0 + num_tiles) into `v`, as 36 [num_tiles, in_channels]
+ * matrices.
+ */
+static void
+wino_transform_inputs(const struct wino_job *job,
+                      size_t tile0,
+                      size_t num_tiles,
+                      float *v)
+{
+        const size_t in_channels = job->shape->in_channels;
+        const size_t point_stride = num_tiles*in_channels;
+        float d[WINO_POINTS*WINO_CHANNEL_BLOCK];
+        float tmp[WINO_POINTS*WINO_CHANNEL_BLOCK];
+        for (size_t t = 0;
+             t < num_tiles;
+             ++t) {
+                size_t image;
+                size_t tile_y;
+                size_t tile_x;
+                wino_get_tile(job, tile0 + t, &image, &tile_y, &tile_x);
+                for (size_t c0 = 0;
+                     c0 < in_channels;
+                     c0 += WINO_CHANNEL_BLOCK) {
+                        const size_t width = min_size(WINO_CHANNEL_BLOCK,
+                                                      in_channels - c0);
+                        wino_load_window(job,
+                                         image,
+                                         tile_y,
+                                         tile_x,
+                                         c0,
+                                         width,
+                                         d);
+
+                        /* NOTE(brendan): tmp <- B^T d, then v <- tmp B. */
+                        for (uint32_t j = 0;
+                             j < WINO_WINDOW;
+                             ++j) {
+                                wino_input_1d(d + j*WINO_CHANNEL_BLOCK,
+                                              (WINO_WINDOW*
+                                               WINO_CHANNEL_BLOCK),
+                                              tmp + j*WINO_CHANNEL_BLOCK,
+                                              (WINO_WINDOW*
+                                               WINO_CHANNEL_BLOCK),
+                                              width);
+                        }
+
+                        float *v_tile = v + t*in_channels + c0;
+                        for (uint32_t i = 0;
+                             i < WINO_WINDOW;
+                             ++i) {
+                                wino_input_1d((tmp +
+                                               (i*WINO_WINDOW*
+                                                WINO_CHANNEL_BLOCK)),
+                                              WINO_CHANNEL_BLOCK,
+                                              (v_tile +
+                                               i*WINO_WINDOW*point_stride),
+                                              point_stride,
+                                              width);
+                        }
+                }
+        }
+}
+
+/**
+ * wino_transform_outputs() - Transforms the 36 [num_tiles, out_channels]
+ * matrices `m` back into tiles [tile0, tile0 + num_tiles) of the output, and
+ * applies the bias and activation.
+ */
+static void
+wino_transform_outputs(const struct wino_job *job,
+                       size_t tile0,
+                       size_t num_tiles,
+                       const float *m)
+{
+        const size_t out_channels = job->shape->out_channels;
+        const size_t point_stride = num_tiles*out_channels;
+        float tmp[WINO_TILE*WINO_WINDOW*WINO_CHANNEL_BLOCK];
+        float y[WINO_TILE*WINO_TILE*WINO_CHANNEL_BLOCK];
+        for (size_t t = 0;
+             t < num_tiles;
+             ++t) {
+                size_t image;
+                size_t tile_y;
+                size_t tile_x;
+                wino_get_tile(job, tile0 + t, &image, &tile_y, &tile_x);
+                for (size_t c0 = 0;
+                     c0 < out_channels;
+                     c0 += WINO_CHANNEL_BLOCK) {
+                        const size_t width = min_size(WINO_CHANNEL_BLOCK,
+                                                      out_channels - c0);
+
+                        /* NOTE(brendan): tmp <- A^T m, then y <- tmp A. */
+                        const float *m_tile = m + t*out_channels + c0;
+                        for (uint32_t j = 0;
+                             j < WINO_WINDOW;
+                             ++j) {
+                                wino_output_1d(m_tile + j*point_stride,
+                                               WINO_WINDOW*point_stride,
+                                               tmp + j*WINO_CHANNEL_BLOCK,
+                                               (WINO_WINDOW*
+                                                WINO_CHANNEL_BLOCK),
+                                               width);
+                        }
+
+                        for (uint32_t i = 0;
+                             i < WINO_TILE;
+                             ++i) {
+                                wino_output_1d((tmp +
+                                                (i*WINO_WINDOW*
+                                                 WINO_CHANNEL_BLOCK)),
+                                               WINO_CHANNEL_BLOCK,
+                                               (y +
+                                                (i*WINO_TILE*
+                                                 WINO_CHANNEL_BLOCK)),
+                                               WINO_CHANNEL_BLOCK,
+                                               width);
+                        }
+
+                        struct gemm_epilogue epilogue = {
+                                .row_bias = NULL,
+                                .col_bias = ((job->bias != NULL) ?
+                                             (job->bias + c0) :
+                                             NULL),
+                                .activation = job->params->activation};
+                        gemm_apply_epilogue(WINO_TILE*WINO_TILE,
+                                            width,
+                                            y,
+                                            WINO_CHANNEL_BLOCK,
+                                            &epilogue);
+
+                        wino_store_tile(job,
+                                        image,
+                                        tile_y,
+                                        tile_x,
+                                        c0,
+                                        width,
+                                        y);
+                }
+        }
+}
+
+/**
+ * wino_task() - Computes one block of output tiles, by transforming its
+ * inputs, multiplying each of the 36 points by the transformed filter, and
+ * transforming the products back.
+ * @scratch: Room for the transformed inputs and outputs of a block.
+ */
+static bool
+wino_task(void *context, size_t block_i, float *scratch)
+{
+        const struct wino_job *job = (const struct wino_job *)context;
+        const struct conv_shape *shape = job->shape;
+        const size_t tile0 = block_i*job->block_tiles;
+        const size_t num_tiles = min_size(job->block_tiles,
+                                          job->num_tiles - tile0);
+        float *v = scratch;
+        float *m = v + WINO_POINTS*num_tiles*shape->in_channels;
+
+        wino_transform_inputs(job, tile0, num_tiles, v);
+
+        for (uint32_t p = 0;
+             p < WINO_POINTS;
+             ++p) {
+                if (!gemm_cpu(job->engine,
+                              false,
+                              true,
+                              num_tiles,
+                              shape->out_channels,
+                              shape->in_channels,
+                              1.0f,
+                              v + p*num_tiles*shape->in_channels,
+                              shape->in_channels,
+                              (job->filter +
+                               p*shape->out_channels*shape->in_channels),
+                              shape->in_channels,
+                              0.0f,
+                              m + p*num_tiles*shape->out_channels,
+                              shape->out_channels,
+                              NULL))
+                        return false;
+        }
+
+        wino_transform_outputs(job, tile0, num_tiles, m);
+
+        return true;
+}
+
+/**
+ * wino_is_supported() - Can the convolution described by `shape` and
+ * `params` be computed with Winograd F(4x4, 3x3)?
+ */
+static bool
+wino_is_supported(const struct conv_shape *shape,
+                  const struct rot_conv2d_params *params)
+{
+        return ((shape->kernel_h == 3) &&
+                (shape->kernel_w == 3) &&
+                (params->stride[0] == 1) &&
+                (params->stride[1] == 1) &&
+                (params->dilation[0] == 1) &&
+                (params->dilation[1] == 1) &&
+                (params->groups == 1));
+}
+
+/**
+ * wino_is_profitable() - Is Winograd, including the filter transform, expected
+ * to beat im2col for `shape`?
+ *
+ * Besides having enough channels and tiles, the output must fill most of its
+ * tiles, since a tile's transforms cost the same however much of it is
+ * cropped.
+ */
+static bool
+wino_is_profitable(const struct conv_shape *shape)
+{
+        const size_t num_tiles = (ceil_div(shape->out_h, WINO_TILE)*
+                                  ceil_div(shape->out_w, WINO_TILE));
+        const size_t tiled_pixels = num_tiles*WINO_TILE*WINO_TILE;
+        return ((shape->in_channels >= WINO_MIN_CHANNELS) &&
+                (shape->out_channels >= WINO_MIN_CHANNELS) &&
+                (shape->batch*num_tiles >= WINO_MIN_AUTO_TILES) &&
+                (2*tiled_pixels <= 3*shape->num_pixels));
+}
+
+/**
+ * wino_run() - Computes the convolution with the transformed `filter`.
+ *
+ * Returns, as `conv_run_tiles` does, whether the transforms' scratch or a
+ * GEMM's packing buffers could not be allocated.
+ */
+static enum conv_run_result
+wino_run(const struct conv_shape *shape,
+         const struct rot_conv2d_params *params,
+         const float *input,
+         const float *filter,
+         const float *bias,
+         float *output)
+{
+        const size_t tiles_h = ceil_div(shape->out_h, WINO_TILE);
+        const size_t tiles_w = ceil_div(shape->out_w, WINO_TILE);
+        const size_t num_tiles = shape->batch*tiles_h*tiles_w;
+        const size_t tile_bytes = (WINO_POINTS*
+                                   (shape->in_channels + shape->out_channels)*
+                                   sizeof(float));
+        size_t block_tiles = WINO_BLOCK_BYTES/tile_bytes;
+        if (block_tiles < WINO_MIN_BLOCK_TILES)
+                block_tiles = WINO_MIN_BLOCK_TILES;
+
+        struct wino_job job = {
+                .shape = shape,
+                .params = params,
+                .engine = gemm_resolve_engine(ROT_MATMUL_ENGINE_DEFAULT),
+                .input = input,
+                .filter = filter,
+                .bias = bias,
+                .output = output,
+                .tiles_h = tiles_h,
+                .tiles_w = tiles_w,
+                .num_tiles = num_tiles,
+                .block_tiles = min_size(block_tiles, num_tiles)};
+        return conv_run_tiles(job.engine,
+                              ceil_div(job.num_tiles, job.block_tiles),
+                              (WINO_POINTS*job.block_tiles*
+                               (shape->in_channels + shape->out_channels)),
+                              wino_task,
+                              &job);
+}
+
+bool conv_winograd_auto(const struct conv_shape *shape,
+                        const struct rot_conv2d_params *params,
+                        const float *input,
+                        const float *filter,
+                        const float *bias,
+                        float *output)
+{
+        if ((params->algo == ROT_CONV2D_ALGO_IM2COL) ||
+            !wino_is_supported(shape, params) ||
+            ((params->algo == ROT_CONV2D_ALGO_AUTO) &&
+             !wino_is_profitable(shape)))
+                return false;
+
+        rot_arena_t scratch_arena;
+        rot_arena_mark_t scratch_mark;
+        float *transformed = conv_get_scratch(WINO_POINTS*
+                                              shape->out_channels*
+                                              shape->in_channels,
+                                              &scratch_arena,
+                                              &scratch_mark);
+        if (transformed == NULL)
+                return false;
+
+        wino_transform_filter(filter,
+                              params->layout,
+                              shape->out_channels,
+                              shape->in_channels,
+                              transformed);
+        const bool is_done = (wino_run(shape,
+                                       params,
+                                       input,
+                                       transformed,
+                                       bias,
+                                       output) == CONV_RUN_DONE);
+
+        conv_put_scratch(transformed, scratch_arena, scratch_mark);
+
+        return is_done;
+}
+
+rot_tensor_t ROT_winograd_transform_filter(rot_arena_t arena,
+                                           const rot_tensor_t filter,
+                                           enum rot_layout layout)
+{
+        if ((arena == NULL) || (filter == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        const bool is_nchw = (layout == ROT_LAYOUT_NCHW);
+        if (!conv_check_tensor(filter, 4) ||
+            (filter->dims[is_nchw ? 2 : 1] != 3) ||
+            (filter->dims[is_nchw ? 3 : 2] != 3)) {
+                LOG_ERROR("Winograd filters must be contiguous float32 CPU "
+                          "tensors of 3x3 filters.");
+                return NULL;
+        }
+
+        const size_t out_channels = filter->dims[0];
+        const size_t in_channels = filter->dims[is_nchw ? 1 : 3];
+        const size_t dims[] = {WINO_POINTS, out_channels, in_channels};
+        rot_tensor_t result = ROT_create_tensor(arena,
+                                                3,
+                                                dims,
+                                                ROT_BACKEND_CPU);
+        if (result == NULL)
+                return NULL;
+
+        wino_transform_filter(filter->cpu.data,
+                              layout,
+                              out_channels,
+                              in_channels,
+                              result->cpu.data);
+
+        return result;
+}
+
+rot_tensor_t ROT_conv2d_winograd(rot_tensor_t result,
+                                 const rot_tensor_t input,
+                                 const rot_tensor_t transformed_filter,
+                                 const rot_tensor_t bias,
+                                 const struct rot_conv2d_params *params)
+{
+        if ((result == NULL) ||
+            (input == NULL) ||
+            (transformed_filter == NULL) ||
+            (params == NULL)) {
+                LOG_NULL();
+                return NULL;
+        }
+
+        if (!conv_check_tensor(transformed_filter, 3) ||
+            (transformed_filter->dims[0] != WINO_POINTS)) {
+                LOG_ERROR("Winograd filter must come from "
+                          "ROT_winograd_transform_filter.");
+                return NULL;
+        }
+
+        struct conv_shape shape;
+        shape.out_channels = transformed_filter->dims[1];
+        shape.group_in = transformed_filter->dims[2];
+        shape.kernel_h = 3;
+        shape.kernel_w = 3;
+        if (!conv_get_shape(&shape, result, input, bias, params))
+                return NULL;
+
+        if (!wino_is_supported(&shape, params)) {
+                LOG_ERROR("Winograd convolutions must have unit strides and "
+                          "dilations, and one group.");
+                return NULL;
+        }
+
+        if (tensor_is_overlapping(result, input)) {
+                LOG_ERROR("Convolution result must not overlap its "
+                          "operands.");
+                return NULL;
+        }
+
+        if ((shape.batch == 0) ||
+            (shape.num_pixels == 0) ||
+            (shape.out_channels == 0))
+                return result;
+
+        switch (wino_run(&shape,
+                         params,
+                         input->cpu.data,
+                         transformed_filter->cpu.data,
+                         (bias != NULL) ? bias->cpu.data : NULL,
+                         result->cpu.data)) {
+        case CONV_RUN_DONE:
+                return result;
+        case CONV_RUN_NO_SCRATCH:
+                LOG_ERROR("Failed to allocate Winograd scratch.");
+                return NULL;
+        default:
+                LOG_ERROR("Winograd GEMM failed.");
+                return NULL;
+        }
+}
@@ -0,0 +1,220 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "platform/context.h"
+#include "error/log_error.h"  /* for LOG_ERROR, LOG_NULL */
+#include "platform/thread.h"  /* for thread_pool_new, ... */
+
+#include "cblas.h"            /* for openblas_set_num_threads */
+
+#include <stdlib.h>           /* for calloc, free */
+
+#ifdef PLATFORM_CUDNN
+#include "platform/cudnn.h"   /* for cuda_handle_new, cuda_handle_free */
+#else
+static void *
+cuda_handle_new(void)
+{
+        return NULL;
+}
+
+static void
+cuda_handle_free(void *)
+{
+}
+#endif /* PLATFORM_CUDNN */
+
+#ifdef PLATFORM_MIOPEN
+#include "platform/miopen.h"  /* for roc_handle_new, roc_handle_free */
+#else
+static void *
+roc_handle_new(void)
+{
+        return NULL;
+}
+
+static void
+roc_handle_free(void *)
+{
+}
+#endif /* PLATFORM_MIOPEN */
+
+static thread_local struct rot_context *context_current;
+
+static struct rot_context *context_default;
+static pthread_once_t context_default_once = PTHREAD_ONCE_INIT;
+
+static void
+context_create_default(void)
+{
+        context_default = ROT_context_new(0, 0);
+}
+
+struct rot_context *context_get_current(void)
+{
+        if (context_current != NULL)
+                return context_current;
+
+        /**
+         * NOTE(brendan): The default context lives for the whole process, and
+         * has no scratch arenas, since any number of threads may be using it
+         * at once.
+         */
+        pthread_once(&context_default_once, context_create_default);
+
+        return context_default;
+}
+
+void context_set_current(struct rot_context *context)
+{
+        context_current = context;
+}
+
+rot_arena_t context_get_scratch(struct rot_context *context)
+{
+        if ((context == NULL) || (context->scratch == NULL))
+                return NULL;
+
+        return context->scratch[thread_get_worker_index()];
+}
+
+void *context_get_cuda_handle(struct rot_context *context)
+{
+        pthread_mutex_lock(&context->handle_lock);
+        if (context->cuda_handle == NULL)
+                context->cuda_handle = cuda_handle_new();
+        void *handle = context->cuda_handle;
+        pthread_mutex_unlock(&context->handle_lock);
+
+        return handle;
+}
+
+void *context_get_roc_handle(struct rot_context *context)
+{
+        pthread_mutex_lock(&context->handle_lock);
+        if (context->roc_handle == NULL)
+                context->roc_handle = roc_handle_new();
+        void *handle = context->roc_handle;
+        pthread_mutex_unlock(&context->handle_lock);
+
+        return handle;
+}
+
+rot_context_t ROT_context_new(uint32_t num_threads, size_t scratch_bytes)
+{
+        struct rot_context *context =
+                (struct rot_context *)calloc(1, sizeof(*context));
+        if (context == NULL)
+                return NULL;
+
+        pthread_mutex_init(&context->handle_lock, NULL);
+
+        if (num_threads == 0)
+                num_threads = thread_get_default_num_workers();
+        context->num_workers = num_threads;
+
+        if (scratch_bytes > 0) {
+                context->scratch = (rot_arena_t *)calloc(num_threads,
+                                                         sizeof(rot_arena_t));
+                if (context->scratch == NULL) {
+                        ROT_context_free(context);
+                        return NULL;
+                }
+
+                for (uint32_t worker_i = 0;
+                     worker_i < num_threads;
+                     ++worker_i) {
+                        context->scratch[worker_i] =
+                                ROT_arena_map(scratch_bytes, 0);
+                        if (context->scratch[worker_i] == NULL) {
+                                ROT_context_free(context);
+                                return NULL;
+                        }
+                }
+        }
+
+        /**
+         * NOTE(brendan): The pool is created last, since its threads start
+         * using the context as soon as they are created.
+         */
+        context->pool = thread_pool_new(num_threads, context);
+        if (context->pool == NULL) {
+                ROT_context_free(context);
+                return NULL;
+        }
+
+        return context;
+}
+
+void ROT_context_free(rot_context_t context)
+{
+        if (context == NULL)
+                return;
+
+        if (context_current == context)
+                context_current = NULL;
+
+        thread_pool_free(context->pool);
+
+        if (context->scratch != NULL) {
+                for (uint32_t worker_i = 0;
+                     worker_i < context->num_workers;
+                     ++worker_i) {
+                        if (context->scratch[worker_i] != NULL)
+                                ROT_arena_unmap(context->scratch[worker_i]);
+                }
+                free(context->scratch);
+        }
+
+        if (context->cuda_handle != NULL)
+                cuda_handle_free(context->cuda_handle);
+        if (context->roc_handle != NULL)
+                roc_handle_free(context->roc_handle);
+
+        pthread_mutex_destroy(&context->handle_lock);
+        free(context);
+}
+
+rot_context_t ROT_context_bind(rot_context_t context)
+{
+        struct rot_context *previous = context_current;
+        context_current = context;
+
+        return previous;
+}
+
+void ROT_context_set_blas_threads(rot_context_t context, uint32_t num_threads)
+{
+        if (context == NULL) {
+                LOG_NULL();
+                return;
+        }
+
+        if (num_threads > 0)
+                openblas_set_num_threads(num_threads);
+}
+
+uint32_t ROT_context_get_num_threads(const rot_context_t context)
+{
+        if (context == NULL) {
+                LOG_NULL();
+                return 0;
+        }
+
+        return context->num_workers;
+}
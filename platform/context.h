@@ -0,0 +1,80 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PLATFORM_CONTEXT_H
+#define PLATFORM_CONTEXT_H
+
+#include "rot_arena.h"         /* for rot_arena_t */
+#include "rot_context.h"
+
+#include <pthread.h>           /* for pthread_mutex_t */
+
+/**
+ * struct rot_context - Resources shared by the ops run in a context.
+ * @pool: Worker threads for `parallel_for`.
+ * @num_workers: Number of threads in `pool`, plus the calling thread.
+ * @scratch: One scratch arena per worker, indexed by
+ * `thread_get_worker_index`, or NULL if the context has none.
+ * @handle_lock: Serialises creating the BLAS handles.
+ * @cuda_handle: cuBLAS handle, or NULL until first used.
+ * @roc_handle: rocBLAS handle, or NULL until first used.
+ */
+struct rot_context {
+        struct thread_pool *pool;
+        uint32_t num_workers;
+        rot_arena_t *scratch;
+        pthread_mutex_t handle_lock;
+        void *cuda_handle;
+        void *roc_handle;
+};
+
+/**
+ * context_get_current() - Returns the context bound to the calling thread, or
+ * the default context if none is, which is NULL if it failed to be created.
+ */
+struct rot_context *context_get_current(void);
+
+/**
+ * context_set_current() - Binds `context` to the calling thread, or unbinds
+ * the current context if `context` is NULL.
+ */
+void context_set_current(struct rot_context *context);
+
+/**
+ * context_get_scratch() - Returns the calling thread's scratch arena in
+ * `context`, or NULL if `context` is NULL or has none.
+ */
+rot_arena_t context_get_scratch(struct rot_context *context);
+
+/**
+ * context_get_cuda_handle() - Returns the context's cuBLAS handle, creating it
+ * on first use.
+ *
+ * Returns NULL if no handle could be created, e.g. in a build without CUDA.
+ */
+void *context_get_cuda_handle(struct rot_context *context);
+
+/**
+ * context_get_roc_handle() - Returns the context's rocBLAS handle, creating
+ * it on first use.
+ *
+ * Returns NULL if no handle could be created, e.g. in a build without ROCm.
+ */
+void *context_get_roc_handle(struct rot_context *context);
+
+#endif /* PLATFORM_CONTEXT_H */
@@ -0,0 +1,98 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "platform/cpu.h"
+
+#include <stdlib.h>  /* for getenv */
+#include <string.h>  /* for strcmp */
+
+static enum cpu_isa
+cpu_detect_isa(void)
+{
+        __builtin_cpu_init();
+
+        bool has_avx2 = (__builtin_cpu_supports("avx2") &&
+                         __builtin_cpu_supports("fma"));
+        if (!has_avx2)
+                return CPU_ISA_GENERIC;
+
+        if (__builtin_cpu_supports("avx512f"))
+                return CPU_ISA_AVX512;
+
+        return CPU_ISA_AVX2;
+}
+
+/**
+ * cpu_limit_isa() - Caps `isa` at the ISA named by the ROT_CPU_ISA environment
+ * variable, if set, so that narrower code paths can be exercised on machines
+ * supporting wider ones.
+ */
+static enum cpu_isa
+cpu_limit_isa(enum cpu_isa isa)
+{
+        const char *env_isa = getenv("ROT_CPU_ISA");
+        if (env_isa == NULL)
+                return isa;
+
+        enum cpu_isa limit = isa;
+        if (strcmp(env_isa, "generic") == 0)
+                limit = CPU_ISA_GENERIC;
+        else if (strcmp(env_isa, "avx2") == 0)
+                limit = CPU_ISA_AVX2;
+
+        return (limit < isa) ? limit : isa;
+}
+
+enum cpu_isa cpu_get_isa(void)
+{
+        /**
+         * NOTE(brendan): Detection is idempotent, so racing threads at worst
+         * both do the detection and store the same value.
+         */
+        static enum cpu_isa isa;
+        static bool is_detected;
+
+        if (!__atomic_load_n(&is_detected, __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&isa,
+                                 cpu_limit_isa(cpu_detect_isa()),
+                                 __ATOMIC_RELAXED);
+                __atomic_store_n(&is_detected, true, __ATOMIC_RELEASE);
+        }
+
+        return isa;
+}
+
+bool cpu_has_feature(enum cpu_feature feature)
+{
+        enum cpu_isa isa = cpu_get_isa();
+
+        switch (feature) {
+        case CPU_FEATURE_F16C:
+                return ((isa >= CPU_ISA_AVX2) &&
+                        __builtin_cpu_supports("f16c"));
+        case CPU_FEATURE_AVX512_BF16:
+                return ((isa >= CPU_ISA_AVX512) &&
+                        __builtin_cpu_supports("avx512bf16"));
+        case CPU_FEATURE_AVX512_VNNI:
+                return ((isa >= CPU_ISA_AVX512) &&
+                        __builtin_cpu_supports("avx512bw") &&
+                        __builtin_cpu_supports("avx512vnni"));
+        default:
+                return false;
+        }
+}
@@ -0,0 +1,70 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PLATFORM_CPU_H
+#define PLATFORM_CPU_H
+
+/**
+ * cpu.h - Internal interfaces for querying the instruction set extensions of
+ * the CPU the library is running on, so that kernels can dispatch to their
+ * fastest implementation at runtime.
+ */
+
+enum cpu_isa {
+        CPU_ISA_GENERIC = 0,
+        CPU_ISA_AVX2 = 1,
+        CPU_ISA_AVX512 = 2,
+};
+
+/**
+ * cpu_get_isa() - Returns the widest vector instruction set supported by the
+ * running CPU.
+ *
+ * AVX2 implies FMA3 support, and AVX512 implies AVX512F plus everything
+ * required for AVX2.
+ *
+ * Setting the ROT_CPU_ISA environment variable to "generic" or "avx2" limits
+ * the result to at most that ISA.
+ */
+enum cpu_isa cpu_get_isa(void);
+
+/**
+ * enum cpu_feature - Instruction set extensions that kernels use on top of
+ * their ISA.
+ * @CPU_FEATURE_F16C: Conversions between half and single precision, with
+ * AVX2.
+ * @CPU_FEATURE_AVX512_BF16: Conversions to bfloat16, and bfloat16 dot
+ * products, with AVX-512.
+ * @CPU_FEATURE_AVX512_VNNI: Dot products of unsigned and signed bytes,
+ * accumulated into 32-bit integers, with AVX-512.
+ */
+enum cpu_feature {
+        CPU_FEATURE_F16C = 0,
+        CPU_FEATURE_AVX512_BF16 = 1,
+        CPU_FEATURE_AVX512_VNNI = 2,
+};
+
+/**
+ * cpu_has_feature() - Does the running CPU support `feature`?
+ *
+ * A feature is only reported if the ISA it extends is at most `cpu_get_isa`,
+ * so that ROT_CPU_ISA disables it along with its ISA.
+ */
+bool cpu_has_feature(enum cpu_feature feature);
+
+#endif /* PLATFORM_CPU_H */
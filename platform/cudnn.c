@@ -19,59 +19,151 @@
 #include "platform/cudnn.h"
 #include "error/log_error.h"  /* for LOG_ERROR */
 
-#include "cublas_v2.h"  /* for CUBLAS_OP_N, CUBLAS_STATUS_SUCCESS */
+#include "cublas_v2.h"  /* for CUBLAS_OP_N, CUBLAS_OP_T, ... */
 
 #include <stddef.h>  /* for NULL, size_t */
 
+void *cuda_handle_new(void)
+{
+        cublasHandle_t handle;
+        cublasStatus_t cublas_status = cublasCreate(&handle);
+        if (cublas_status != CUBLAS_STATUS_SUCCESS) {
+                LOG_ERROR("cublasCreate error.");
+                return NULL;
+        }
+
+        return handle;
+}
+
+void cuda_handle_free(void *handle)
+{
+        cublasStatus_t cublas_status = cublasDestroy((cublasHandle_t)handle);
+        if (cublas_status != CUBLAS_STATUS_SUCCESS)
+                LOG_ERROR("cuBLAS error destroying handle.");
+}
+
 rot_tensor_t
-matmul_cuda(rot_tensor_t result, const rot_tensor_t a, const rot_tensor_t b)
+gemm_cuda(struct rot_context *context,
+          rot_tensor_t c,
+          const rot_tensor_t a,
+          const rot_tensor_t b,
+          bool trans_a,
+          bool trans_b,
+          float alpha,
+          float beta)
 {
         const float *a_dev = (const float *)ROT_tensor_get_data(a);
         const float *b_dev = (const float *)ROT_tensor_get_data(b);
-        float *result_dev = (float *)ROT_tensor_get_data(result);
-        if ((a_dev == NULL) || (b_dev == NULL) || (result_dev == NULL)) {
+        float *c_dev = (float *)ROT_tensor_get_data(c);
+        if ((a_dev == NULL) || (b_dev == NULL) || (c_dev == NULL)) {
                 LOG_ERROR("CUDA tensor argument has uninitialized memory.");
                 return NULL;
         }
 
-        cublasHandle_t handle;
-        cublasStatus_t cublas_status = cublasCreate(&handle);
-        if (cublas_status != CUBLAS_STATUS_SUCCESS) {
-                LOG_ERROR("cublasCreate error.");
+        cublasHandle_t handle =
+                (cublasHandle_t)context_get_cuda_handle(context);
+        if (handle == NULL) {
+                LOG_ERROR("No cuBLAS handle.");
                 return NULL;
         }
 
         const size_t *a_dims = ROT_tensor_get_dims(a);
         const size_t *b_dims = ROT_tensor_get_dims(b);
-        if ((a_dims == NULL) || (b_dims == NULL)) {
-                LOG_ERROR("a or b dims uninitialized.");
+        const size_t *c_dims = ROT_tensor_get_dims(c);
+        if ((a_dims == NULL) || (b_dims == NULL) || (c_dims == NULL)) {
+                LOG_ERROR("a, b or c dims uninitialized.");
                 return NULL;
         }
 
-        const float alpha = 1.0;
-        const float beta = 0.0;
+        /**
+         * NOTE(brendan): cuBLAS is column-major, and a row-major matrix read
+         * as column-major is its transpose, so the row-major product is
+         * computed as C^T = op(B)^T*op(A)^T. The transpose flags carry over
+         * unchanged, and the leading dimensions are the row-major row
+         * lengths.
+         */
+        const size_t k = trans_a ? a_dims[0] : a_dims[1];
+        cublasStatus_t cublas_status;
         cublas_status = cublasSgemm(handle,
-                                    CUBLAS_OP_N,
-                                    CUBLAS_OP_N,
-                                    b_dims[1],
-                                    a_dims[0],
-                                    a_dims[1],
+                                    trans_b ? CUBLAS_OP_T : CUBLAS_OP_N,
+                                    trans_a ? CUBLAS_OP_T : CUBLAS_OP_N,
+                                    c_dims[1],
+                                    c_dims[0],
+                                    k,
                                     &alpha,
                                     b_dev,
                                     b_dims[1],
                                     a_dev,
                                     a_dims[1],
                                     &beta,
-                                    result_dev,
-                                    b_dims[1]);
+                                    c_dev,
+                                    c_dims[1]);
         if (cublas_status != CUBLAS_STATUS_SUCCESS) {
                 LOG_ERROR("cuBLAS sgemm error.");
                 return NULL;
         }
 
-        cublas_status = cublasDestroy(handle);
+        return c;
+}
+
+rot_tensor_t
+matmul_batched_cuda(struct rot_context *context,
+                    rot_tensor_t result,
+                    const rot_tensor_t a,
+                    const rot_tensor_t b,
+                    size_t batch_size,
+                    bool is_a_broadcast,
+                    bool is_b_broadcast)
+{
+        const float *a_dev = (const float *)ROT_tensor_get_data(a);
+        const float *b_dev = (const float *)ROT_tensor_get_data(b);
+        float *result_dev = (float *)ROT_tensor_get_data(result);
+        if ((a_dev == NULL) || (b_dev == NULL) || (result_dev == NULL)) {
+                LOG_ERROR("CUDA tensor argument has uninitialized memory.");
+                return NULL;
+        }
+
+        const size_t *a_dims = ROT_tensor_get_dims(a);
+        const size_t *result_dims = ROT_tensor_get_dims(result);
+        const size_t m = result_dims[1];
+        const size_t n = result_dims[2];
+        const size_t k = is_a_broadcast ? a_dims[1] : a_dims[2];
+
+        cublasHandle_t handle =
+                (cublasHandle_t)context_get_cuda_handle(context);
+        if (handle == NULL) {
+                LOG_ERROR("No cuBLAS handle.");
+                return NULL;
+        }
+
+        /**
+         * NOTE(brendan): cuBLAS is column-major, so as in `gemm_cuda` the
+         * row-major product is computed as C^T = B^T*A^T. A stride of zero
+         * reuses the broadcast operand for every matrix in the batch.
+         */
+        const float alpha = 1.0;
+        const float beta = 0.0;
+        cublasStatus_t cublas_status;
+        cublas_status = cublasSgemmStridedBatched(handle,
+                                                  CUBLAS_OP_N,
+                                                  CUBLAS_OP_N,
+                                                  n,
+                                                  m,
+                                                  k,
+                                                  &alpha,
+                                                  b_dev,
+                                                  n,
+                                                  is_b_broadcast ? 0 : k*n,
+                                                  a_dev,
+                                                  k,
+                                                  is_a_broadcast ? 0 : m*k,
+                                                  &beta,
+                                                  result_dev,
+                                                  n,
+                                                  m*n,
+                                                  batch_size);
         if (cublas_status != CUBLAS_STATUS_SUCCESS) {
-                LOG_ERROR("cuBLAS error destroying handle.");
+                LOG_ERROR("cuBLAS strided batched sgemm error.");
                 return NULL;
         }
 
@@ -19,13 +19,55 @@
 #ifndef CUDNN_H
 #define CUDNN_H
 
-#include "rot_math.h"  /* for rot_tensor_t */
+#include "rot_math.h"         /* for rot_tensor_t */
+#include "platform/context.h" /* for rot_context, context_get_cuda_handle */
 
 /**
- * matmul_cuda() - Matmul on NVIDIA hardware.
+ * cuda_handle_new() - Creates a cuBLAS handle, for `context_get_cuda_handle`.
+ *
+ * Returns NULL on error.
+ */
+void *cuda_handle_new(void);
+
+/**
+ * cuda_handle_free() - Destroys a handle created by `cuda_handle_new`.
+ */
+void cuda_handle_free(void *handle);
+
+/**
+ * gemm_cuda() - c <- alpha*op(a)*op(b) + beta*c on NVIDIA hardware.
+ * @trans_a, @trans_b: Whether op() transposes `a` and `b`.
+ *
+ * Dimensions are assumed to have been validated by the caller, and the
+ * tensors to be contiguous. The cuBLAS handle comes from `context`.
+ */
+rot_tensor_t gemm_cuda(struct rot_context *context,
+                       rot_tensor_t c,
+                       const rot_tensor_t a,
+                       const rot_tensor_t b,
+                       bool trans_a,
+                       bool trans_b,
+                       float alpha,
+                       float beta);
+
+/**
+ * matmul_batched_cuda() - Batched matrix multiplication on NVIDIA hardware.
+ * @result: Output tensor of dimensions [batch, m, n].
+ * @a: Left operand, [batch, m, k] or mxk if `is_a_broadcast`.
+ * @b: Right operand, [batch, k, n] or kxn if `is_b_broadcast`.
+ * @batch_size: Number of matrices in the batch.
+ * @is_a_broadcast: Is `a` a single matrix shared by the whole batch?
+ * @is_b_broadcast: Is `b` a single matrix shared by the whole batch?
+ *
+ * Dimensions are assumed to have been validated by the caller. The cuBLAS
+ * handle comes from `context`.
  */
-rot_tensor_t matmul_cuda(rot_tensor_t result,
-                         const rot_tensor_t a,
-                         const rot_tensor_t b);
+rot_tensor_t matmul_batched_cuda(struct rot_context *context,
+                                 rot_tensor_t result,
+                                 const rot_tensor_t a,
+                                 const rot_tensor_t b,
+                                 size_t batch_size,
+                                 bool is_a_broadcast,
+                                 bool is_b_broadcast);
 
 #endif /* CUDNN_H */
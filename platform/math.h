@@ -20,22 +20,61 @@
 #define PLATFORM_MATH_H
 
 #include "rot_math.h"
+#include "platform/context.h"  /* for rot_context */
 
 #ifdef PLATFORM_MIOPEN
 #include "platform/miopen.h"
 #else
 rot_tensor_t
-matmul_roc(rot_tensor_t result, const rot_tensor_t a, const rot_tensor_t b)
+gemm_roc(struct rot_context *context,
+         rot_tensor_t c,
+         const rot_tensor_t a,
+         const rot_tensor_t b,
+         bool trans_a,
+         bool trans_b,
+         float alpha,
+         float beta)
+{
+        return NULL;
+}
+
+rot_tensor_t
+matmul_batched_roc(struct rot_context *context,
+                   rot_tensor_t result,
+                   const rot_tensor_t a,
+                   const rot_tensor_t b,
+                   size_t batch_size,
+                   bool is_a_broadcast,
+                   bool is_b_broadcast)
 {
         return NULL;
 }
 #endif /* PLATFORM_MIOPEN */
 
 #ifdef PLATFORM_CUDNN
-#include "platform/cudnn.h"   /* for matmul_cuda */
+#include "platform/cudnn.h"   /* for gemm_cuda */
 #else
 rot_tensor_t
-matmul_cuda(rot_tensor_t result, const rot_tensor_t a, const rot_tensor_t b)
+gemm_cuda(struct rot_context *context,
+          rot_tensor_t c,
+          const rot_tensor_t a,
+          const rot_tensor_t b,
+          bool trans_a,
+          bool trans_b,
+          float alpha,
+          float beta)
+{
+        return NULL;
+}
+
+rot_tensor_t
+matmul_batched_cuda(struct rot_context *context,
+                    rot_tensor_t result,
+                    const rot_tensor_t a,
+                    const rot_tensor_t b,
+                    size_t batch_size,
+                    bool is_a_broadcast,
+                    bool is_b_broadcast)
 {
         return NULL;
 }
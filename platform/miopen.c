@@ -17,52 +17,144 @@
  * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
  */
 #include "platform/miopen.h"
+#include "error/log_error.h"  /* for LOG_ERROR */
 
 #include "hip/hip_runtime_api.h"
 #include "rocblas.h"
 
+void *roc_handle_new(void)
+{
+        rocblas_handle handle;
+        rocblas_status rblas_err = rocblas_create_handle(&handle);
+        if (rblas_err != rocblas_status_success) {
+                LOG_ERROR("ROC error creating handle.");
+                return NULL;
+        }
+
+        return handle;
+}
+
+void roc_handle_free(void *handle)
+{
+        rocblas_status rblas_err =
+                rocblas_destroy_handle((rocblas_handle)handle);
+        if (rblas_err != rocblas_status_success)
+                LOG_ERROR("ROC error destroying handle.");
+}
+
 rot_tensor_t
-matmul_roc(rot_tensor_t result, const rot_tensor_t a, const rot_tensor_t b)
+gemm_roc(struct rot_context *context,
+         rot_tensor_t c,
+         const rot_tensor_t a,
+         const rot_tensor_t b,
+         bool trans_a,
+         bool trans_b,
+         float alpha,
+         float beta)
 {
         const float *a_dev = (const float *)ROT_tensor_get_data(a);
         const float *b_dev = (const float *)ROT_tensor_get_data(b);
-        float *result_dev = (float *)ROT_tensor_get_data(result);
-        if ((a_dev == NULL) || (b_dev == NULL) || (result_dev == NULL)) {
+        float *c_dev = (float *)ROT_tensor_get_data(c);
+        if ((a_dev == NULL) || (b_dev == NULL) || (c_dev == NULL)) {
                 LOG_ERROR("ROC tensor argument has uninitialized memory.");
                 return NULL;
         }
 
-        rocblas_handle handle;
-        rocblas_status rblas_err = rocblas_create_handle(&handle);
-        if (rblas_err != rocblas_status_success) {
-                LOG_ERROR("ROC error creating handle.");
+        rocblas_handle handle =
+                (rocblas_handle)context_get_roc_handle(context);
+        if (handle == NULL) {
+                LOG_ERROR("No rocBLAS handle.");
                 return NULL;
         }
 
-        const float alpha = 1.0f;
-        const float beta = 0.0f;
+        /**
+         * NOTE(brendan): As for cuBLAS, the row-major product is computed
+         * column-major as C^T = op(B)^T*op(A)^T.
+         */
+        const size_t *a_dims = ROT_tensor_get_dims(a);
+        const size_t *b_dims = ROT_tensor_get_dims(b);
+        const size_t *c_dims = ROT_tensor_get_dims(c);
+        const size_t k = trans_a ? a_dims[0] : a_dims[1];
+        rocblas_status rblas_err;
         rblas_err = rocblas_sgemm(handle,
-                                  rocblas_operation_none,
-                                  rocblas_operation_none,
-                                  b->dims[1],
-                                  a->dims[0],
-                                  a->dims[1],
+                                  (trans_b ?
+                                   rocblas_operation_transpose :
+                                   rocblas_operation_none),
+                                  (trans_a ?
+                                   rocblas_operation_transpose :
+                                   rocblas_operation_none),
+                                  c_dims[1],
+                                  c_dims[0],
+                                  k,
                                   &alpha,
                                   b_dev,
-                                  b->dims[1],
+                                  b_dims[1],
                                   a_dev,
-                                  a->dims[1],
+                                  a_dims[1],
                                   &beta,
-                                  result_dev,
-                                  b->dims[1]);
+                                  c_dev,
+                                  c_dims[1]);
         if (rblas_err != rocblas_status_success) {
                 LOG_ERROR("ROC sgemm error.");
                 return NULL;
         }
 
-        rblas_err = rocblas_destroy_handle(handle);
+        return c;
+}
+
+rot_tensor_t
+matmul_batched_roc(struct rot_context *context,
+                   rot_tensor_t result,
+                   const rot_tensor_t a,
+                   const rot_tensor_t b,
+                   size_t batch_size,
+                   bool is_a_broadcast,
+                   bool is_b_broadcast)
+{
+        const float *a_dev = (const float *)ROT_tensor_get_data(a);
+        const float *b_dev = (const float *)ROT_tensor_get_data(b);
+        float *result_dev = (float *)ROT_tensor_get_data(result);
+        if ((a_dev == NULL) || (b_dev == NULL) || (result_dev == NULL)) {
+                LOG_ERROR("ROC tensor argument has uninitialized memory.");
+                return NULL;
+        }
+
+        const size_t *a_dims = ROT_tensor_get_dims(a);
+        const size_t *result_dims = ROT_tensor_get_dims(result);
+        const size_t m = result_dims[1];
+        const size_t n = result_dims[2];
+        const size_t k = is_a_broadcast ? a_dims[1] : a_dims[2];
+
+        rocblas_handle handle =
+                (rocblas_handle)context_get_roc_handle(context);
+        if (handle == NULL) {
+                LOG_ERROR("No rocBLAS handle.");
+                return NULL;
+        }
+
+        const float alpha = 1.0f;
+        const float beta = 0.0f;
+        rocblas_status rblas_err;
+        rblas_err = rocblas_sgemm_strided_batched(handle,
+                                                  rocblas_operation_none,
+                                                  rocblas_operation_none,
+                                                  n,
+                                                  m,
+                                                  k,
+                                                  &alpha,
+                                                  b_dev,
+                                                  n,
+                                                  is_b_broadcast ? 0 : k*n,
+                                                  a_dev,
+                                                  k,
+                                                  is_a_broadcast ? 0 : m*k,
+                                                  &beta,
+                                                  result_dev,
+                                                  n,
+                                                  m*n,
+                                                  batch_size);
         if (rblas_err != rocblas_status_success) {
-                LOG_ERROR("ROC error destroying handle.");
+                LOG_ERROR("ROC strided batched sgemm error.");
                 return NULL;
         }
 
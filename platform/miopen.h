@@ -19,13 +19,55 @@
 #ifndef MI_OPEN_H
 #define MI_OPEN_H
 
-#include "rot_math.h"
+#include "rot_math.h"         /* for rot_tensor_t */
+#include "platform/context.h" /* for rot_context, context_get_roc_handle */
 
 /**
- * matmul_roc() - Matrix multiplication using ROCm backend.
+ * roc_handle_new() - Creates a rocBLAS handle, for `context_get_roc_handle`.
+ *
+ * Returns NULL on error.
+ */
+void *roc_handle_new(void);
+
+/**
+ * roc_handle_free() - Destroys a handle created by `roc_handle_new`.
+ */
+void roc_handle_free(void *handle);
+
+/**
+ * gemm_roc() - c <- alpha*op(a)*op(b) + beta*c on AMD hardware.
+ * @trans_a, @trans_b: Whether op() transposes `a` and `b`.
+ *
+ * Dimensions are assumed to have been validated by the caller, and the
+ * tensors to be contiguous. The rocBLAS handle comes from `context`.
+ */
+rot_tensor_t gemm_roc(struct rot_context *context,
+                      rot_tensor_t c,
+                      const rot_tensor_t a,
+                      const rot_tensor_t b,
+                      bool trans_a,
+                      bool trans_b,
+                      float alpha,
+                      float beta);
+
+/**
+ * matmul_batched_roc() - Batched matrix multiplication on AMD hardware.
+ * @result: Output tensor of dimensions [batch, m, n].
+ * @a: Left operand, [batch, m, k] or mxk if `is_a_broadcast`.
+ * @b: Right operand, [batch, k, n] or kxn if `is_b_broadcast`.
+ * @batch_size: Number of matrices in the batch.
+ * @is_a_broadcast: Is `a` a single matrix shared by the whole batch?
+ * @is_b_broadcast: Is `b` a single matrix shared by the whole batch?
+ *
+ * Dimensions are assumed to have been validated by the caller. The rocBLAS
+ * handle comes from `context`.
  */
-rot_tensor_t matmul_roc(rot_tensor_t result,
-                        const rot_tensor_t a,
-                        const rot_tensor_t b);
+rot_tensor_t matmul_batched_roc(struct rot_context *context,
+                                rot_tensor_t result,
+                                const rot_tensor_t a,
+                                const rot_tensor_t b,
+                                size_t batch_size,
+                                bool is_a_broadcast,
+                                bool is_b_broadcast);
 
 #endif /* MI_OPEN_H */
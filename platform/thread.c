@@ -0,0 +1,661 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "platform/thread.h"
+#include "error/log_error.h"  /* for LOG_ERROR */
+#include "platform/context.h" /* for context_get_current, ... */
+
+#include <immintrin.h>        /* for _mm_pause */
+#include <pthread.h>          /* for pthread_create, pthread_cond_wait, ... */
+#include <stdlib.h>           /* for aligned_alloc, calloc, free, getenv */
+#include <string.h>           /* for memset */
+#include <unistd.h>           /* for sysconf */
+
+#define THREAD_MAX_WORKERS 256
+#define THREAD_CACHE_LINE_BYTES 64
+/**
+ * NOTE(brendan): Number of times an idle thread polls for work before going to
+ * sleep. At tens of cycles per poll this is tens of microseconds, which covers
+ * the gap between most back to back ops.
+ */
+#define THREAD_SPIN_ITERS (16*1024)
+/**
+ * NOTE(brendan): Stored as the number of joined workers once a job is closed,
+ * which is more than any job has slots for.
+ */
+#define THREAD_JOIN_CLOSED (THREAD_MAX_WORKERS + 1)
+
+/**
+ * NOTE(brendan): Set while a thread is running `parallel_for_range` chunks, so
+ * that nested parallel regions, e.g. a GEMM inside a batched matmul task, run
+ * inline rather than oversubscribing the CPUs.
+ */
+static thread_local bool thread_is_in_parallel_region;
+
+/**
+ * NOTE(brendan): Index of the calling thread in the pool that owns it, or
+ * zero for threads that were not created by a pool.
+ */
+static thread_local uint32_t thread_worker_index;
+
+/**
+ * struct thread_range - The part of a job that one thread has yet to run,
+ * which other threads may steal from.
+ * @lock: Spinlock protecting `begin` and `end`.
+ * @begin: Next index for the owning thread to run.
+ * @end: One past the last index left, which thieves take from.
+ *
+ * Each range is on its own cache line, so that threads working through their
+ * own ranges do not contend with each other.
+ */
+struct thread_range {
+        uint32_t lock;
+        size_t begin;
+        size_t end;
+} __attribute__((aligned(THREAD_CACHE_LINE_BYTES)));
+
+/**
+ * struct parallel_job - State shared between all threads running a single
+ * `parallel_for_range`.
+ * @grain: Number of indices that threads take from their own range at once.
+ * @range_fn: Function to run for each chunk.
+ * @context: Argument passed through to `range_fn`.
+ */
+struct parallel_job {
+        size_t grain;
+        parallel_range_fn *range_fn;
+        void *context;
+};
+
+/**
+ * struct thread_worker - Arguments to a pool worker's thread.
+ */
+struct thread_worker {
+        struct thread_pool *pool;
+        uint32_t index;
+};
+
+/**
+ * struct thread_pool - Worker threads that wait for `parallel_for_range` to
+ * hand them a job.
+ * @owner: Context that the workers run ops on behalf of.
+ * @num_workers: Number of threads jobs run on, including the thread calling
+ * `parallel_for_range`, which is not one of `threads`.
+ * @num_spin_iters: Number of times idle threads poll before sleeping.
+ * @ranges: One range per slot of the current job, with slot zero belonging
+ * to the thread that submitted it.
+ * @submit_lock: Held by the thread whose job the pool is running.
+ * @job: The current job.
+ * @num_slots: Number of threads that can work on the current job. Accessed
+ * atomically, since a worker still trying to join the previous job can read
+ * it while the next job is set up.
+ * @state: Generation of the current job in the upper 32 bits, which wakes the
+ * workers when it changes, and the number of workers that have joined the
+ * job in the lower 32 bits.
+ * @num_finished: Number of workers that have finished the current job.
+ * @num_parked: Number of workers sleeping on `work_cond`.
+ * @is_submitter_parked: Whether the submitting thread sleeps on `done_cond`.
+ * @is_park_requested: Tells spinning workers to sleep straight away, e.g.
+ * while a BLAS call needs their CPUs.
+ * @lock: Mutex for `work_cond` and `done_cond`.
+ */
+struct thread_pool {
+        struct rot_context *owner;
+        uint32_t num_workers;
+        uint32_t num_spin_iters;
+        pthread_t *threads;
+        struct thread_worker *workers;
+        uint32_t num_threads;
+        struct thread_range *ranges;
+        pthread_mutex_t submit_lock;
+        struct parallel_job *job;
+        uint32_t num_slots;
+        uint64_t state;
+        uint32_t num_finished;
+        uint32_t num_parked;
+        bool is_submitter_parked;
+        bool is_park_requested;
+        bool is_shutdown;
+        pthread_mutex_t lock;
+        pthread_cond_t work_cond;
+        pthread_cond_t done_cond;
+};
+
+static void
+thread_range_lock(struct thread_range *range)
+{
+        while (__atomic_exchange_n(&range->lock, 1, __ATOMIC_ACQUIRE) != 0) {
+                while (__atomic_load_n(&range->lock, __ATOMIC_RELAXED) != 0)
+                        _mm_pause();
+        }
+}
+
+static void
+thread_range_unlock(struct thread_range *range)
+{
+        __atomic_store_n(&range->lock, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * thread_range_pop() - Takes the next `grain` indices from the front of
+ * `range`.
+ *
+ * Returns false if `range` is empty.
+ */
+static bool
+thread_range_pop(struct thread_range *range,
+                 size_t grain,
+                 size_t *begin,
+                 size_t *end)
+{
+        thread_range_lock(range);
+        *begin = range->begin;
+        *end = ((range->end - range->begin > grain) ?
+                (range->begin + grain) : range->end);
+        range->begin = *end;
+        thread_range_unlock(range);
+
+        return *begin < *end;
+}
+
+/**
+ * thread_range_steal() - Moves the back half of the first non-empty range
+ * after slot `slot_i` into that slot's own range.
+ *
+ * The split is rounded to a multiple of `grain` from the start of the victim's
+ * range, so that chunks stay aligned however often they are stolen.
+ *
+ * Returns false if every range is empty.
+ */
+static bool
+thread_range_steal(struct thread_pool *pool, size_t grain, uint32_t slot_i)
+{
+        for (uint32_t victim_offset = 1;
+             victim_offset < pool->num_slots;
+             ++victim_offset) {
+                struct thread_range *victim =
+                        pool->ranges + ((slot_i + victim_offset) %
+                                        pool->num_slots);
+
+                thread_range_lock(victim);
+                size_t remaining = victim->end - victim->begin;
+                size_t mid = victim->begin + ((remaining/2 + grain - 1)/
+                                              grain)*grain;
+                if (mid >= victim->end)
+                        mid = victim->begin;
+                size_t stolen_end = victim->end;
+                victim->end = mid;
+                thread_range_unlock(victim);
+
+                if (mid == stolen_end)
+                        continue;
+
+                struct thread_range *own = pool->ranges + slot_i;
+                thread_range_lock(own);
+                own->begin = mid;
+                own->end = stolen_end;
+                thread_range_unlock(own);
+
+                return true;
+        }
+
+        return false;
+}
+
+/**
+ * parallel_job_run() - Runs chunks of the current job, starting with the
+ * range of slot `slot_i`, until there is nothing left to run or steal.
+ */
+static void
+parallel_job_run(struct thread_pool *pool,
+                 const struct parallel_job *job,
+                 uint32_t slot_i)
+{
+        bool was_in_parallel_region = thread_is_in_parallel_region;
+        thread_is_in_parallel_region = true;
+
+        struct thread_range *own = pool->ranges + slot_i;
+        for (;;) {
+                size_t begin;
+                size_t end;
+                if (thread_range_pop(own, job->grain, &begin, &end)) {
+                        job->range_fn(job->context, begin, end);
+                        continue;
+                }
+
+                if (!thread_range_steal(pool, job->grain, slot_i))
+                        break;
+        }
+
+        thread_is_in_parallel_region = was_in_parallel_region;
+}
+
+/**
+ * thread_pool_wait_for_job() - Spins, then sleeps, until the generation of
+ * `pool`'s job differs from `seen_generation`.
+ *
+ * Returns the pool's state.
+ */
+static uint64_t
+thread_pool_wait_for_job(struct thread_pool *pool, uint32_t seen_generation)
+{
+        for (uint32_t spin_i = 0;
+             spin_i < pool->num_spin_iters;
+             ++spin_i) {
+                uint64_t state = __atomic_load_n(&pool->state,
+                                                 __ATOMIC_ACQUIRE);
+                if ((uint32_t)(state >> 32) != seen_generation)
+                        return state;
+
+                if (__atomic_load_n(&pool->is_park_requested,
+                                    __ATOMIC_RELAXED))
+                        break;
+
+                _mm_pause();
+        }
+
+        /**
+         * NOTE(brendan): The submitter publishes the job before checking
+         * `num_parked`, and this thread counts itself as parked before
+         * checking the job, so at least one of them sees the other.
+         */
+        __atomic_fetch_add(&pool->num_parked, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&pool->lock);
+        uint64_t state;
+        for (;;) {
+                state = __atomic_load_n(&pool->state, __ATOMIC_SEQ_CST);
+                if ((uint32_t)(state >> 32) != seen_generation)
+                        break;
+
+                pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        __atomic_fetch_sub(&pool->num_parked, 1, __ATOMIC_RELAXED);
+
+        return state;
+}
+
+/**
+ * thread_pool_join() - Claims a slot in the job of generation `state`, unless
+ * all of its slots are taken or the job has been closed.
+ */
+static bool
+thread_pool_join(struct thread_pool *pool, uint64_t state, uint32_t *slot_i)
+{
+        const uint64_t generation = state >> 32;
+        for (;;) {
+                uint32_t num_joined = (uint32_t)state;
+                if (num_joined + 1 >= __atomic_load_n(&pool->num_slots,
+                                                      __ATOMIC_RELAXED))
+                        return false;
+
+                if (__atomic_compare_exchange_n(&pool->state,
+                                                &state,
+                                                state + 1,
+                                                false,
+                                                __ATOMIC_ACQ_REL,
+                                                __ATOMIC_ACQUIRE)) {
+                        *slot_i = num_joined + 1;
+                        return true;
+                }
+
+                if ((state >> 32) != generation)
+                        return false;
+        }
+}
+
+/**
+ * thread_pool_finish() - Tells the submitter that a worker is done with the
+ * current job. The worker must not touch the job afterwards.
+ */
+static void
+thread_pool_finish(struct thread_pool *pool)
+{
+        __atomic_fetch_add(&pool->num_finished, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pool->is_submitter_parked, __ATOMIC_SEQ_CST)) {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_signal(&pool->done_cond);
+                pthread_mutex_unlock(&pool->lock);
+        }
+}
+
+/**
+ * thread_pool_wait_done() - Spins, then sleeps, until `num_joined` workers
+ * have finished the current job.
+ */
+static void
+thread_pool_wait_done(struct thread_pool *pool, uint32_t num_joined)
+{
+        for (uint32_t spin_i = 0;
+             spin_i < pool->num_spin_iters;
+             ++spin_i) {
+                if (__atomic_load_n(&pool->num_finished,
+                                    __ATOMIC_ACQUIRE) == num_joined)
+                        return;
+
+                _mm_pause();
+        }
+
+        __atomic_store_n(&pool->is_submitter_parked, true, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&pool->lock);
+        while (__atomic_load_n(&pool->num_finished,
+                               __ATOMIC_SEQ_CST) != num_joined) {
+                pthread_cond_wait(&pool->done_cond, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+        __atomic_store_n(&pool->is_submitter_parked, false, __ATOMIC_RELAXED);
+}
+
+static void *
+thread_pool_worker_main(void *arg)
+{
+        const struct thread_worker *worker = (const struct thread_worker *)arg;
+        struct thread_pool *pool = worker->pool;
+
+        thread_worker_index = worker->index;
+        context_set_current(pool->owner);
+
+        uint32_t seen_generation = 0;
+        for (;;) {
+                uint64_t state = thread_pool_wait_for_job(pool,
+                                                          seen_generation);
+                if (__atomic_load_n(&pool->is_shutdown, __ATOMIC_ACQUIRE))
+                        break;
+
+                seen_generation = state >> 32;
+
+                uint32_t slot_i;
+                if (!thread_pool_join(pool, state, &slot_i))
+                        continue;
+
+                parallel_job_run(pool, pool->job, slot_i);
+                thread_pool_finish(pool);
+        }
+
+        return NULL;
+}
+
+uint32_t thread_get_default_num_workers(void)
+{
+        const char *env_threads = getenv("ROT_NUM_THREADS");
+        if (env_threads != NULL) {
+                unsigned long num_threads = strtoul(env_threads, NULL, 10);
+                if (num_threads > 0)
+                        return (num_threads < THREAD_MAX_WORKERS) ?
+                                num_threads : THREAD_MAX_WORKERS;
+        }
+
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (num_cpus < 1)
+                return 1;
+
+        return (num_cpus < THREAD_MAX_WORKERS) ? num_cpus : THREAD_MAX_WORKERS;
+}
+
+struct thread_pool *
+thread_pool_new(uint32_t num_workers, struct rot_context *owner)
+{
+        if ((num_workers == 0) || (num_workers > THREAD_MAX_WORKERS)) {
+                LOG_ERROR("Thread pools must have between 1 and 256 "
+                          "workers.");
+                return NULL;
+        }
+
+        struct thread_pool *pool =
+                (struct thread_pool *)calloc(1, sizeof(*pool));
+        if (pool == NULL)
+                return NULL;
+
+        pool->owner = owner;
+        pool->num_workers = num_workers;
+        pthread_mutex_init(&pool->submit_lock, NULL);
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->work_cond, NULL);
+        pthread_cond_init(&pool->done_cond, NULL);
+
+        /**
+         * NOTE(brendan): Spinning only pays off when each worker has a CPU to
+         * itself. Otherwise, spinning workers take time away from the threads
+         * with work to do.
+         */
+        long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        pool->num_spin_iters = ((num_workers <= num_cpus) ?
+                                THREAD_SPIN_ITERS : 0);
+
+        size_t ranges_bytes = num_workers*sizeof(struct thread_range);
+        pool->ranges = (struct thread_range *)aligned_alloc(
+                THREAD_CACHE_LINE_BYTES,
+                ranges_bytes);
+        pool->threads = (pthread_t *)calloc(num_workers, sizeof(pthread_t));
+        pool->workers = (struct thread_worker *)calloc(num_workers,
+                                                       sizeof(*pool->workers));
+        if ((pool->ranges == NULL) ||
+            (pool->threads == NULL) ||
+            (pool->workers == NULL)) {
+                thread_pool_free(pool);
+                return NULL;
+        }
+        memset(pool->ranges, 0, ranges_bytes);
+
+        /**
+         * NOTE(brendan): The thread calling `parallel_for_range` runs chunks
+         * as well, so only num_workers - 1 threads are created, with indices
+         * from 1.
+         */
+        for (uint32_t worker_i = 1;
+             worker_i < num_workers;
+             ++worker_i) {
+                struct thread_worker *worker = pool->workers + worker_i;
+                worker->pool = pool;
+                worker->index = worker_i;
+                int32_t status = pthread_create(pool->threads +
+                                                pool->num_threads,
+                                                NULL,
+                                                thread_pool_worker_main,
+                                                worker);
+                if (status != 0) {
+                        LOG_ERROR("Failed to create worker thread.");
+                        thread_pool_free(pool);
+                        return NULL;
+                }
+
+                ++pool->num_threads;
+        }
+
+        return pool;
+}
+
+void thread_pool_free(struct thread_pool *pool)
+{
+        if (pool == NULL)
+                return;
+
+        /**
+         * NOTE(brendan): Bumping the generation wakes spinning and sleeping
+         * workers alike, which then see the shutdown flag.
+         */
+        __atomic_store_n(&pool->is_shutdown, true, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&pool->state, 1ull << 32, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->work_cond);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (uint32_t thread_i = 0;
+             thread_i < pool->num_threads;
+             ++thread_i) {
+                pthread_join(pool->threads[thread_i], NULL);
+        }
+
+        pthread_cond_destroy(&pool->done_cond);
+        pthread_cond_destroy(&pool->work_cond);
+        pthread_mutex_destroy(&pool->lock);
+        pthread_mutex_destroy(&pool->submit_lock);
+        free(pool->workers);
+        free(pool->threads);
+        free(pool->ranges);
+        free(pool);
+}
+
+/**
+ * thread_get_pool() - Returns the current context's pool, or NULL if there is
+ * no current context, in which case work runs on the calling thread.
+ */
+static struct thread_pool *
+thread_get_pool(void)
+{
+        struct rot_context *context = context_get_current();
+
+        return (context != NULL) ? context->pool : NULL;
+}
+
+uint32_t thread_get_num_workers(void)
+{
+        struct thread_pool *pool = thread_get_pool();
+
+        return (pool != NULL) ? pool->num_workers : 1;
+}
+
+uint32_t thread_get_worker_index(void)
+{
+        return thread_worker_index;
+}
+
+void thread_blas_begin(void)
+{
+        struct thread_pool *pool = thread_get_pool();
+        if (thread_is_in_parallel_region || (pool == NULL))
+                return;
+
+        __atomic_store_n(&pool->is_park_requested, true, __ATOMIC_RELAXED);
+}
+
+void thread_blas_end(void)
+{
+        struct thread_pool *pool = thread_get_pool();
+        if (thread_is_in_parallel_region || (pool == NULL))
+                return;
+
+        __atomic_store_n(&pool->is_park_requested, false, __ATOMIC_RELAXED);
+}
+
+void parallel_for_range(size_t begin,
+                        size_t end,
+                        size_t grain,
+                        parallel_range_fn *range_fn,
+                        void *context)
+{
+        if (begin >= end)
+                return;
+
+        if (grain == 0)
+                grain = 1;
+
+        struct thread_pool *pool = thread_get_pool();
+        if (pool == NULL) {
+                range_fn(context, begin, end);
+                return;
+        }
+
+        size_t num_chunks = (end - begin + grain - 1)/grain;
+        uint32_t num_slots = ((num_chunks < pool->num_workers) ?
+                              num_chunks : pool->num_workers);
+
+        /**
+         * NOTE(brendan): A pool runs one job at a time. If another thread
+         * sharing the context already has it busy, the range runs on the
+         * calling thread instead of waiting.
+         */
+        if (thread_is_in_parallel_region ||
+            (num_slots <= 1) ||
+            (pthread_mutex_trylock(&pool->submit_lock) != 0)) {
+                range_fn(context, begin, end);
+                return;
+        }
+
+        struct parallel_job job = {.grain = grain,
+                                   .range_fn = range_fn,
+                                   .context = context};
+
+        size_t slot_chunks = (num_chunks + num_slots - 1)/num_slots;
+        for (uint32_t slot_i = 0;
+             slot_i < num_slots;
+             ++slot_i) {
+                size_t slot_begin = begin + slot_i*slot_chunks*grain;
+                size_t slot_end = slot_begin + slot_chunks*grain;
+                pool->ranges[slot_i].begin = (slot_begin < end) ?
+                                             slot_begin : end;
+                pool->ranges[slot_i].end = (slot_end < end) ? slot_end : end;
+        }
+
+        pool->job = &job;
+        __atomic_store_n(&pool->num_slots, num_slots, __ATOMIC_RELAXED);
+        pool->num_finished = 0;
+        __atomic_store_n(&pool->is_park_requested, false, __ATOMIC_RELAXED);
+
+        uint64_t generation = (__atomic_load_n(&pool->state,
+                                               __ATOMIC_RELAXED) >> 32) + 1;
+        __atomic_store_n(&pool->state, generation << 32, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&pool->num_parked, __ATOMIC_SEQ_CST) > 0) {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->work_cond);
+                pthread_mutex_unlock(&pool->lock);
+        }
+
+        parallel_job_run(pool, &job, 0);
+
+        /**
+         * NOTE(brendan): Every index has been handed out by now, so workers
+         * that have not joined yet are shut out, and only those that did are
+         * waited for.
+         */
+        uint64_t closed_state = (generation << 32) | THREAD_JOIN_CLOSED;
+        uint64_t state = __atomic_exchange_n(&pool->state,
+                                             closed_state,
+                                             __ATOMIC_ACQ_REL);
+        thread_pool_wait_done(pool, (uint32_t)state);
+
+        pthread_mutex_unlock(&pool->submit_lock);
+}
+
+/**
+ * struct parallel_tasks - Arguments to `parallel_for`, run as a range.
+ */
+struct parallel_tasks {
+        parallel_task_fn *task_fn;
+        void *context;
+};
+
+static void
+parallel_tasks_range(void *context, size_t begin, size_t end)
+{
+        const struct parallel_tasks *tasks =
+                (const struct parallel_tasks *)context;
+
+        for (size_t task_i = begin;
+             task_i < end;
+             ++task_i) {
+                tasks->task_fn(tasks->context, task_i);
+        }
+}
+
+void parallel_for(size_t num_tasks, parallel_task_fn *task_fn, void *context)
+{
+        struct parallel_tasks tasks = {.task_fn = task_fn, .context = context};
+
+        parallel_for_range(0, num_tasks, 1, parallel_tasks_range, &tasks);
+}
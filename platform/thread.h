@@ -0,0 +1,141 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef PLATFORM_THREAD_H
+#define PLATFORM_THREAD_H
+
+#include <stddef.h>  /* for size_t */
+#include <stdint.h>  /* for uint32_t */
+
+/**
+ * thread.h - Internal interfaces for splitting CPU kernels across threads.
+ */
+
+/**
+ * parallel_task_fn - A unit of work run by `parallel_for`.
+ * @context: Pointer passed through unchanged from `parallel_for`.
+ * @task_i: Index of the task, in [0, num_tasks).
+ */
+typedef void parallel_task_fn(void *context, size_t task_i);
+
+/**
+ * parallel_range_fn - A chunk of work run by `parallel_for_range`.
+ * @context: Pointer passed through unchanged from `parallel_for_range`.
+ * @begin: First index of the chunk.
+ * @end: One past the last index of the chunk.
+ */
+typedef void parallel_range_fn(void *context, size_t begin, size_t end);
+
+struct rot_context;
+struct thread_pool;
+
+/**
+ * thread_get_default_num_workers() - Returns the number of online CPUs, unless
+ * overridden by the ROT_NUM_THREADS environment variable.
+ */
+uint32_t thread_get_default_num_workers(void);
+
+/**
+ * thread_pool_new() - Creates a pool of `num_workers` - 1 threads, which wait
+ * for `parallel_for_range` to give them work.
+ * @owner: Context made current on each of the pool's threads, so that ops
+ * run by tasks use the same context as the thread that started them.
+ *
+ * Idle workers spin for a short while before sleeping, so that back to back
+ * parallel ops do not pay for waking them, unless the pool has more workers
+ * than there are CPUs.
+ *
+ * Returns NULL on error.
+ */
+struct thread_pool *
+thread_pool_new(uint32_t num_workers, struct rot_context *owner);
+
+/**
+ * thread_pool_free() - Joins the pool's threads and frees the pool.
+ */
+void thread_pool_free(struct thread_pool *pool);
+
+/**
+ * thread_get_num_workers() - Returns the maximum number of threads, including
+ * the calling thread, that `parallel_for` will run tasks on, i.e. the size of
+ * the current context's pool, or one if there is no current context.
+ */
+uint32_t thread_get_num_workers(void);
+
+/**
+ * thread_get_worker_index() - Returns the index of the calling thread in its
+ * pool, in [1, num_workers), or zero if the calling thread is not a pool
+ * thread.
+ */
+uint32_t thread_get_worker_index(void);
+
+/**
+ * thread_blas_begin() - Hands the current context's CPUs over to a threaded
+ * BLAS call about to be made from the calling thread, until `thread_blas_end`.
+ *
+ * The pool's spinning workers are put to sleep, so that they do not compete
+ * with the BLAS library's own threads. Inside a parallel region, where the
+ * workers are busy anyway, this does nothing.
+ */
+void thread_blas_begin(void);
+
+/**
+ * thread_blas_end() - Lets the current context's idle workers spin again,
+ * once the BLAS call handed the CPUs by `thread_blas_begin` has returned.
+ */
+void thread_blas_end(void);
+
+/**
+ * parallel_for_range() - Runs `range_fn` over disjoint chunks covering
+ * [begin, end), and returns once all of them have completed.
+ * @begin: First index of the range.
+ * @end: One past the last index of the range.
+ * @grain: Number of indices below which a chunk is not split any further.
+ * Chunks are at least this big, except at the end of the range.
+ * @range_fn: Function to run for each chunk.
+ * @context: Pointer passed to each invocation of `range_fn`.
+ *
+ * The range starts out split evenly between the threads of the current
+ * context's pool, see `context_get_current`. Each thread runs its share
+ * `grain` indices at a time, and threads that run out of work steal half of
+ * what another thread has left. So chunks may run in any order and on any
+ * thread, including the calling thread, and must be independent of each
+ * other.
+ *
+ * A `parallel_for_range` called from inside a chunk, or with no current
+ * context, runs the whole range on the calling thread, in one call to
+ * `range_fn`.
+ */
+void parallel_for_range(size_t begin,
+                        size_t end,
+                        size_t grain,
+                        parallel_range_fn *range_fn,
+                        void *context);
+
+/**
+ * parallel_for() - Runs `task_fn(context, i)` for every i in [0, num_tasks),
+ * and returns once all of the tasks have completed.
+ * @num_tasks: Number of tasks to run.
+ * @task_fn: Function to run for each task.
+ * @context: Pointer passed to each invocation of `task_fn`.
+ *
+ * Equivalent to `parallel_for_range` with a grain of one task.
+ */
+void parallel_for(size_t num_tasks, parallel_task_fn *task_fn, void *context);
+
+#endif /* PLATFORM_THREAD_H */
@@ -0,0 +1,379 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "tests/test_context.h"
+#include "rot_arena.h"        /* for rot_arena_t, ROT_arena_map, ... */
+#include "rot_context.h"      /* for rot_context_t, ROT_context_new, ... */
+#include "rot_math.h"         /* for ROT_matmul_with_engine, ... */
+#include "rot_nn.h"           /* for ROT_relu_out, ROT_relu_grad */
+#include "rot_platform.h"     /* for ROT_BACKEND_CPU */
+#include "tests/test_math.h"  /* for rand_dim */
+
+#include <assert.h>           /* for assert */
+#include <math.h>             /* for fabsf */
+#include <pthread.h>          /* for pthread_create, pthread_join */
+#include <stdlib.h>           /* for rand */
+#include <string.h>           /* for memcpy */
+
+#define CONTEXT_NUM_THREADS 4
+
+/**
+ * create_context_tensor() - Allocates a CPU tensor from `arena` filled with
+ * samples from a uniform distribution over [-1, 1].
+ */
+static rot_tensor_t
+create_context_tensor(rot_arena_t arena,
+                      uint32_t num_dims,
+                      const size_t *dims)
+{
+        rot_tensor_t tensor = ROT_create_tensor(arena,
+                                                num_dims,
+                                                dims,
+                                                ROT_BACKEND_CPU);
+        assert(tensor != NULL);
+
+        float *data = ROT_tensor_get_data(tensor);
+        size_t num_elems = ROT_tensor_get_size(tensor)/sizeof(float);
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                data[i] = 2.0f*rand()/(float)RAND_MAX - 1.0f;
+        }
+
+        return tensor;
+}
+
+/**
+ * run_native_matmul() - Multiplies random matrices of dimensions mxk and kxn
+ * with the native engine, in whichever context is bound, and returns the
+ * largest difference from OpenBLAS.
+ */
+static float
+run_native_matmul(rot_arena_t arena, size_t m, size_t n, size_t k)
+{
+        const size_t a_dims[] = {m, k};
+        const size_t b_dims[] = {k, n};
+        const size_t c_dims[] = {m, n};
+        rot_tensor_t a = create_context_tensor(arena, 2, a_dims);
+        rot_tensor_t b = create_context_tensor(arena, 2, b_dims);
+        rot_tensor_t c = create_context_tensor(arena, 2, c_dims);
+        rot_tensor_t expected = create_context_tensor(arena, 2, c_dims);
+
+        if ((ROT_matmul_with_engine(c,
+                                    a,
+                                    b,
+                                    ROT_MATMUL_ENGINE_NATIVE) == NULL) ||
+            (ROT_matmul_with_engine(expected,
+                                    a,
+                                    b,
+                                    ROT_MATMUL_ENGINE_BLAS) == NULL))
+                return INFINITY;
+
+        const float *c_data = ROT_tensor_get_data(c);
+        const float *expected_data = ROT_tensor_get_data(expected);
+        float max_diff = 0.0f;
+        for (size_t i = 0;
+             i < m*n;
+             ++i) {
+                float diff = fabsf(c_data[i] - expected_data[i]);
+                max_diff = (diff > max_diff) ? diff : max_diff;
+        }
+
+        return max_diff;
+}
+
+/**
+ * test_context() - Tests running CPU ops in an explicit context.
+ *
+ * Pass criteria: binding a context must return the previous binding, and
+ * native GEMMs big enough to be split across threads, with packing buffers
+ * that both do and do not fit in the scratch arenas, must match OpenBLAS.
+ * Batched matmuls, whose tasks run GEMMs on the pool's threads, must match
+ * OpenBLAS as well.
+ */
+MIN_UNIT_TEST_FUNC(test_context)
+{
+        rot_arena_t arena = ROT_arena_map(64*1024*1024, 0);
+        assert(arena != NULL);
+
+        rot_context_t context = ROT_context_new(CONTEXT_NUM_THREADS,
+                                                1024*1024);
+        MIN_UNIT_ASSERT(context != NULL, "ROT_context_new failed\n");
+        MIN_UNIT_ASSERT(ROT_context_get_num_threads(context) ==
+                        CONTEXT_NUM_THREADS,
+                        "Context has the wrong number of threads\n");
+        MIN_UNIT_ASSERT(ROT_context_bind(context) == NULL,
+                        "A context was already bound\n");
+
+        const size_t small_dim = 96 + rand_dim(64);
+        const size_t big_dim = 512 + rand_dim(256);
+        for (uint32_t iter = 0;
+             iter < 4;
+             ++iter) {
+                float small_diff = run_native_matmul(arena,
+                                                     small_dim,
+                                                     small_dim,
+                                                     small_dim);
+                float big_diff = run_native_matmul(arena,
+                                                   big_dim,
+                                                   small_dim,
+                                                   big_dim);
+                MIN_UNIT_ASSERT((small_diff < 1e-3f) && (big_diff < 1e-3f),
+                                "Native GEMM in a context differs from "
+                                "OpenBLAS by %f, %f\n",
+                                small_diff,
+                                big_diff);
+        }
+
+        const size_t batch_size = 2*CONTEXT_NUM_THREADS;
+        const size_t a_dims[] = {batch_size, small_dim, small_dim};
+        rot_tensor_t a = create_context_tensor(arena, 3, a_dims);
+        rot_tensor_t b = create_context_tensor(arena, 3, a_dims);
+        rot_tensor_t c = create_context_tensor(arena, 3, a_dims);
+        MIN_UNIT_ASSERT(ROT_matmul_batched(c, a, b) == c,
+                        "Batched matmul in a context failed\n");
+
+        const size_t matrix_elems = small_dim*small_dim;
+        const size_t matrix_dims[] = {small_dim, small_dim};
+        rot_tensor_t expected = create_context_tensor(arena, 2, matrix_dims);
+        for (size_t batch_i = 0;
+             batch_i < batch_size;
+             ++batch_i) {
+                rot_tensor_t a_i = ROT_tensor_view_slice(arena,
+                                                         a,
+                                                         0,
+                                                         batch_i,
+                                                         batch_i + 1);
+                rot_tensor_t b_i = ROT_tensor_view_slice(arena,
+                                                         b,
+                                                         0,
+                                                         batch_i,
+                                                         batch_i + 1);
+                a_i = ROT_tensor_view_reshape(arena, a_i, 2, matrix_dims);
+                b_i = ROT_tensor_view_reshape(arena, b_i, 2, matrix_dims);
+                ROT_matmul_with_engine(expected,
+                                       a_i,
+                                       b_i,
+                                       ROT_MATMUL_ENGINE_BLAS);
+
+                const float *c_data = (ROT_tensor_get_data(c) +
+                                       batch_i*matrix_elems);
+                const float *expected_data = ROT_tensor_get_data(expected);
+                for (size_t i = 0;
+                     i < matrix_elems;
+                     ++i) {
+                        MIN_UNIT_ASSERT(fabsf(c_data[i] -
+                                              expected_data[i]) < 1e-3f,
+                                        "Batched matmul in a context "
+                                        "differs in matrix %zu\n",
+                                        batch_i);
+                }
+        }
+
+        MIN_UNIT_ASSERT(ROT_context_bind(NULL) == context,
+                        "Unbinding returned the wrong context\n");
+        ROT_context_free(context);
+
+        ROT_arena_unmap(arena);
+}
+
+/**
+ * test_context_parallel_ops() - Tests elementwise ops split across a context's
+ * threads, over whole tensors and over views, with BLAS sharing the context's
+ * threads.
+ *
+ * Pass criteria: ReLU and its gradient must exactly match a serial reference
+ * for every element, however the work was split and stolen, and must leave
+ * elements outside of a view untouched. GEMMs must still match OpenBLAS
+ * afterwards.
+ */
+MIN_UNIT_TEST_FUNC(test_context_parallel_ops)
+{
+        rot_arena_t arena = ROT_arena_map(64*1024*1024, 0);
+        assert(arena != NULL);
+
+        rot_context_t context = ROT_context_new(CONTEXT_NUM_THREADS, 0);
+        MIN_UNIT_ASSERT(context != NULL, "ROT_context_new failed\n");
+        ROT_context_set_blas_threads(context, CONTEXT_NUM_THREADS);
+        ROT_context_bind(context);
+
+        for (uint32_t iter = 0;
+             iter < 8;
+             ++iter) {
+                rot_arena_mark_t mark = ROT_arena_mark(arena);
+                const size_t dims[] = {512 + rand_dim(512),
+                                       257 + rand_dim(512)};
+                const size_t num_elems = dims[0]*dims[1];
+                rot_tensor_t x = create_context_tensor(arena, 2, dims);
+                rot_tensor_t y = create_context_tensor(arena, 2, dims);
+                rot_tensor_t grad = create_context_tensor(arena, 2, dims);
+                const float *x_data = ROT_tensor_get_data(x);
+                const float *grad_data = ROT_tensor_get_data(grad);
+
+                MIN_UNIT_ASSERT(ROT_relu_out(y, x) == y,
+                                "Parallel ReLU failed\n");
+                const float *y_data = ROT_tensor_get_data(y);
+                for (size_t i = 0;
+                     i < num_elems;
+                     ++i) {
+                        float expected = (x_data[i] > 0.0f) ? x_data[i] : 0.0f;
+                        MIN_UNIT_ASSERT(y_data[i] == expected,
+                                        "Parallel ReLU wrong at %zu\n",
+                                        i);
+                }
+
+                MIN_UNIT_ASSERT(ROT_relu_grad(y, grad, x) == y,
+                                "Parallel ReLU gradient failed\n");
+                for (size_t i = 0;
+                     i < num_elems;
+                     ++i) {
+                        float expected = (x_data[i] > 0.0f) ? grad_data[i] :
+                                                              0.0f;
+                        MIN_UNIT_ASSERT(y_data[i] == expected,
+                                        "Parallel ReLU gradient wrong at "
+                                        "%zu\n",
+                                        i);
+                }
+
+                const size_t col_begin = rand_dim(64);
+                const size_t col_end = dims[1] - rand_dim(64);
+                rot_tensor_t x_view = ROT_tensor_view_slice(arena,
+                                                            x,
+                                                            1,
+                                                            col_begin,
+                                                            col_end);
+                rot_tensor_t y_view = ROT_tensor_view_slice(arena,
+                                                            y,
+                                                            1,
+                                                            col_begin,
+                                                            col_end);
+                memcpy(ROT_tensor_get_data(y),
+                       grad_data,
+                       num_elems*sizeof(float));
+                MIN_UNIT_ASSERT(ROT_relu_out(y_view, x_view) == y_view,
+                                "Parallel ReLU over a view failed\n");
+                for (size_t i = 0;
+                     i < num_elems;
+                     ++i) {
+                        size_t col = i % dims[1];
+                        float expected = grad_data[i];
+                        if ((col >= col_begin) && (col < col_end))
+                                expected = ((x_data[i] > 0.0f) ?
+                                            x_data[i] : 0.0f);
+                        MIN_UNIT_ASSERT(y_data[i] == expected,
+                                        "Parallel ReLU over a view wrong at "
+                                        "%zu\n",
+                                        i);
+                }
+
+                float diff = run_native_matmul(arena, 256, 256, 256);
+                MIN_UNIT_ASSERT(diff < 1e-3f,
+                                "GEMM after parallel ops differs from "
+                                "OpenBLAS by %f\n",
+                                diff);
+
+                ROT_arena_rewind(arena, mark);
+        }
+
+        ROT_context_bind(NULL);
+        ROT_context_free(context);
+
+        ROT_arena_unmap(arena);
+}
+
+/**
+ * struct context_thread_state - A thread running GEMMs in its own context.
+ */
+struct context_thread_state {
+        rot_arena_t arena;
+        size_t dim;
+        float max_diff;
+};
+
+static void *
+context_thread_main(void *arg)
+{
+        struct context_thread_state *state =
+                (struct context_thread_state *)arg;
+
+        rot_context_t context = ROT_context_new(2, 512*1024);
+        assert(context != NULL);
+        ROT_context_bind(context);
+
+        state->max_diff = 0.0f;
+        for (uint32_t iter = 0;
+             iter < 8;
+             ++iter) {
+                float diff = run_native_matmul(state->arena,
+                                               state->dim,
+                                               state->dim,
+                                               state->dim);
+                state->max_diff = ((diff > state->max_diff) ?
+                                   diff : state->max_diff);
+        }
+
+        ROT_context_free(context);
+
+        return NULL;
+}
+
+/**
+ * test_context_threads() - Tests several threads running ops at once, each in
+ * its own context, alongside the default context on the calling thread.
+ *
+ * Pass criteria: every thread's native GEMMs must match OpenBLAS.
+ */
+MIN_UNIT_TEST_FUNC(test_context_threads)
+{
+        rot_arena_t arena = ROT_arena_map(64*1024*1024, 0);
+        assert(arena != NULL);
+
+        struct context_thread_state states[CONTEXT_NUM_THREADS];
+        pthread_t threads[CONTEXT_NUM_THREADS];
+        for (uint32_t thread_i = 0;
+             thread_i < CONTEXT_NUM_THREADS;
+             ++thread_i) {
+                states[thread_i].arena = arena;
+                states[thread_i].dim = 64 + rand_dim(128);
+                int status = pthread_create(threads + thread_i,
+                                            NULL,
+                                            context_thread_main,
+                                            states + thread_i);
+                assert(status == 0);
+        }
+
+        float default_diff = run_native_matmul(arena, 256, 256, 256);
+
+        for (uint32_t thread_i = 0;
+             thread_i < CONTEXT_NUM_THREADS;
+             ++thread_i) {
+                pthread_join(threads[thread_i], NULL);
+                MIN_UNIT_ASSERT(states[thread_i].max_diff < 1e-3f,
+                                "GEMM in thread %u differs from OpenBLAS by "
+                                "%f\n",
+                                thread_i,
+                                states[thread_i].max_diff);
+        }
+
+        MIN_UNIT_ASSERT(default_diff < 1e-3f,
+                        "GEMM in the default context differs from OpenBLAS "
+                        "by %f\n",
+                        default_diff);
+
+        ROT_arena_unmap(arena);
+}
@@ -17,11 +17,15 @@
  * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
  */
 #include "tests/test_math.h"
+#include "tests/test_context.h" /* for test_context, ... */
 #include "tests/test_cudnn.h" /* for test_matmul_small_cudnn */
+#include "tests/test_memory.h" /* for test_plan_chain, ... */
+#include "tests/test_nn.h"    /* for test_linear */
 #include "tests/min_unit.h"   /* for MIN_UNIT_ASSERT, min_unit_run_test */
 #include "rot_math.h"         /* for ROT_matmul, ROT_create_tensor, ... */
-#include "rot_nn.h"           /* for ROT_relu */
+#include "rot_nn.h"           /* for ROT_linear */
 #include "rot_platform.h"     /* for ROT_BACKEND_CPU */
+#include "rot_sparse.h"       /* for ROT_sparse_from_dense, ... */
 
 #include "gsl/gsl_rng.h"      /* for gsl_rng, gsl_rng_alloc, gsl_rng_free */
 #include "gsl/gsl_randist.h"  /* for gsl_ran_flat */
@@ -29,10 +33,10 @@
 
 #include <assert.h>           /* for assert */
 #include <float.h>            /* for FLT_EPSILON */
-#include <math.h>             /* for fabs */
+#include <math.h>             /* for fabs, fabsf, fmaxf, fminf */
 #include <stdio.h>            /* for printf */
 #include <stdlib.h>           /* for size_t, NULL, free, malloc, rand, srand */
-#include <string.h>           /* for memcpy */
+#include <string.h>           /* for memcmp, memcpy */
 #include <sys/time.h>         /* for timeval, gettimeofday */
 
 /**
@@ -297,7 +301,7 @@ static MIN_UNIT_TEST_FUNC(test_matmul_small)
 {
         uint8_t memory[512*1024];
         struct matmul_test_state state;
-        struct matmul_dims dims;
+        struct matmul_dims dims =
                 setup_matmul_test_state_small(&state, memory, sizeof(memory));
 
         state.c.tensor = ROT_matmul(state.c.tensor,
@@ -307,13 +311,1025 @@ static MIN_UNIT_TEST_FUNC(test_matmul_small)
                         "NULL returned from ROT_matmul, expected "
                         "rot_tensor\n");
 
-        check_state_matches(&state, &dims, FLT_EPSILON);
+        /**
+         * NOTE(brendan): ROT_matmul uses the native engine unless built with
+         * -Dmatmul_engine=blas, so allow for its summation order.
+         */
+        check_state_matches(&state, &dims, 128*FLT_EPSILON);
+
+        THFloatTensor_free(state.th_a);
+        THFloatTensor_free(state.th_b);
+        THFloatTensor_free(state.th_c);
+}
+
+/**
+ * test_matmul_small_native() - Correctness test for the in-tree GEMM engine.
+ *
+ * Pass criteria: the same as `test_matmul_small`, with the product computed by
+ * `ROT_MATMUL_ENGINE_NATIVE`. The tolerance is looser than for BLAS, since the
+ * native engine sums over k in a different order to TH.
+ */
+static MIN_UNIT_TEST_FUNC(test_matmul_small_native)
+{
+        uint8_t memory[512*1024];
+        struct matmul_test_state state;
+        struct matmul_dims dims =
+                setup_matmul_test_state_small(&state, memory, sizeof(memory));
+
+        state.c.tensor = ROT_matmul_with_engine(state.c.tensor,
+                                                state.a.tensor,
+                                                state.b.tensor,
+                                                ROT_MATMUL_ENGINE_NATIVE);
+        MIN_UNIT_ASSERT(state.c.tensor != NULL,
+                        "NULL returned from ROT_matmul_with_engine, expected "
+                        "rot_tensor\n");
+
+        check_state_matches(&state, &dims, 128*FLT_EPSILON);
 
         THFloatTensor_free(state.th_a);
         THFloatTensor_free(state.th_b);
         THFloatTensor_free(state.th_c);
 }
 
+/**
+ * check_batched_matches() - Checks every matrix of the batched product `c`
+ * against a naive matrix multiply.
+ * @a_stride, @b_stride: Floats between consecutive matrices of `a` and `b`, or
+ * zero if the operand is broadcast.
+ */
+static void
+check_batched_matches(const float *a,
+                      size_t a_stride,
+                      const float *b,
+                      size_t b_stride,
+                      const float *c,
+                      size_t batch_size,
+                      const struct matmul_dims *dims,
+                      float epsilon)
+{
+        for (size_t batch_i = 0;
+             batch_i < batch_size;
+             ++batch_i) {
+                const float *a_i = a + batch_i*a_stride;
+                const float *b_i = b + batch_i*b_stride;
+                const float *c_i = c + batch_i*dims->m*dims->n;
+                for (size_t row = 0;
+                     row < dims->m;
+                     ++row) {
+                        for (size_t col = 0;
+                             col < dims->n;
+                             ++col) {
+                                double expected = 0.0;
+                                for (size_t p = 0;
+                                     p < dims->k;
+                                     ++p) {
+                                        expected += (a_i[row*dims->k + p]*
+                                                     b_i[p*dims->n + col]);
+                                }
+
+                                float diff = c_i[row*dims->n + col] - expected;
+                                MIN_UNIT_ASSERT(fabs(diff) < epsilon,
+                                                "ROT_matmul_batched mismatch "
+                                                "in matrix %zu\n",
+                                                batch_i);
+                        }
+                }
+        }
+}
+
+/**
+ * test_matmul_batched() - Correctness test for batched matrix multiplication,
+ * with and without broadcasting.
+ *
+ * Pass criteria: for a random batch of random (small and valid) dimensions,
+ * [batch, m, k]x[batch, k, n] and [batch, m, k]x[k, n] products must match a
+ * naive reference for every matrix in the batch. Mismatched batch sizes must
+ * be rejected.
+ */
+static MIN_UNIT_TEST_FUNC(test_matmul_batched)
+{
+        const size_t memory_size = 64*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const size_t batch_size = rand_dim(32);
+        struct matmul_dims dims = {.n = rand_dim(64),
+                                   .m = rand_dim(64),
+                                   .k = rand_dim(64)};
+
+        const size_t a_dims[] = {batch_size, dims.m, dims.k};
+        const size_t b_dims[] = {batch_size, dims.k, dims.n};
+        const size_t b_shared_dims[] = {dims.k, dims.n};
+        const size_t c_dims[] = {batch_size, dims.m, dims.n};
+        rot_tensor_t a = ROT_create_tensor(arena, 3, a_dims, ROT_BACKEND_CPU);
+        rot_tensor_t b = ROT_create_tensor(arena, 3, b_dims, ROT_BACKEND_CPU);
+        rot_tensor_t b_shared = ROT_create_tensor(arena,
+                                                  2,
+                                                  b_shared_dims,
+                                                  ROT_BACKEND_CPU);
+        rot_tensor_t c = ROT_create_tensor(arena, 3, c_dims, ROT_BACKEND_CPU);
+        assert((a != NULL) && (b != NULL) && (b_shared != NULL) && (c != NULL));
+
+        gsl_rng *rng = get_gsl_rng();
+        const size_t a_mat_dims[] = {batch_size*dims.m, dims.k};
+        const size_t b_mat_dims[] = {batch_size*dims.k, dims.n};
+        init_data_uniform(ROT_tensor_get_data(a), rng, a_mat_dims, 1);
+        init_data_uniform(ROT_tensor_get_data(b), rng, b_mat_dims, 1);
+        init_data_uniform(ROT_tensor_get_data(b_shared), rng, b_shared_dims, 1);
+        gsl_rng_free(rng);
+
+        rot_tensor_t result = ROT_matmul_batched(c, a, b);
+        MIN_UNIT_ASSERT(result != NULL,
+                        "NULL returned from ROT_matmul_batched, expected "
+                        "rot_tensor\n");
+        check_batched_matches(ROT_tensor_get_data(a),
+                              dims.m*dims.k,
+                              ROT_tensor_get_data(b),
+                              dims.k*dims.n,
+                              ROT_tensor_get_data(c),
+                              batch_size,
+                              &dims,
+                              128*FLT_EPSILON);
+
+        result = ROT_matmul_batched(c, a, b_shared);
+        MIN_UNIT_ASSERT(result != NULL,
+                        "NULL returned from broadcast ROT_matmul_batched, "
+                        "expected rot_tensor\n");
+        check_batched_matches(ROT_tensor_get_data(a),
+                              dims.m*dims.k,
+                              ROT_tensor_get_data(b_shared),
+                              0,
+                              ROT_tensor_get_data(c),
+                              batch_size,
+                              &dims,
+                              128*FLT_EPSILON);
+
+        const size_t bad_b_dims[] = {batch_size + 1, dims.k, dims.n};
+        rot_tensor_t bad_b = ROT_create_tensor(arena,
+                                               3,
+                                               bad_b_dims,
+                                               ROT_BACKEND_CPU);
+        assert(bad_b != NULL);
+        MIN_UNIT_ASSERT(ROT_matmul_batched(c, a, bad_b) == NULL,
+                        "ROT_matmul_batched accepted mismatched batches\n");
+
+        free(memory);
+}
+
+/**
+ * test_gemm() - Correctness test for ROT_gemm's transposes, alpha and beta.
+ *
+ * Pass criteria: for random (small and valid) dimensions, every combination of
+ * transposed and non-transposed operands must match a naive reference for
+ * alpha*op(A)*op(B) + beta*C, with C holding random values beforehand.
+ * Operands with dimensions that only fit without the transposes must be
+ * rejected, as must a C that is a different view overlapping A.
+ */
+static MIN_UNIT_TEST_FUNC(test_gemm)
+{
+        const size_t memory_size = 16*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        gsl_rng *rng = get_gsl_rng();
+        /**
+         * NOTE(brendan): m is more than any kernel's mc, so that op(A) is
+         * packed in more than one row block.
+         */
+        const size_t m = 480 + rand_dim(96);
+        const size_t k = rand_dim(96);
+        /* NOTE(brendan): n != k, so that a missing transpose is detected. */
+        const size_t n = k + rand_dim(32);
+        const float alpha = gsl_ran_flat(rng, -2, 2);
+        const float beta = gsl_ran_flat(rng, -2, 2);
+        const size_t c_dims[] = {m, n};
+        float *c_old = (float *)malloc(m*n*sizeof(float));
+        assert(c_old != NULL);
+
+        for (uint32_t trans_i = 0;
+             trans_i < 4;
+             ++trans_i) {
+                const bool trans_a = (trans_i & 1);
+                const bool trans_b = (trans_i & 2);
+                const size_t a_dims[] = {trans_a ? k : m, trans_a ? m : k};
+                const size_t b_dims[] = {trans_b ? n : k, trans_b ? k : n};
+                struct tensor_data a;
+                struct tensor_data b;
+                struct tensor_data c;
+                get_tensor_data(&a, arena, a_dims);
+                get_tensor_data(&b, arena, b_dims);
+                get_tensor_data(&c, arena, c_dims);
+                init_data_uniform(a.data, rng, a_dims, 1);
+                init_data_uniform(b.data, rng, b_dims, 1);
+                init_data_uniform(c.data, rng, c_dims, 1);
+                memcpy(c_old, c.data, m*n*sizeof(float));
+
+                MIN_UNIT_ASSERT(ROT_gemm(c.tensor,
+                                         a.tensor,
+                                         b.tensor,
+                                         trans_a,
+                                         trans_b,
+                                         alpha,
+                                         beta) == c.tensor,
+                                "ROT_gemm failed for trans_a %d, trans_b %d\n",
+                                trans_a,
+                                trans_b);
+
+                for (size_t row = 0;
+                     row < m;
+                     ++row) {
+                        for (size_t col = 0;
+                             col < n;
+                             ++col) {
+                                double expected = 0.0;
+                                for (size_t p = 0;
+                                     p < k;
+                                     ++p) {
+                                        float a_rp = trans_a ?
+                                                     a.data[p*m + row] :
+                                                     a.data[row*k + p];
+                                        float b_pc = trans_b ?
+                                                     b.data[col*k + p] :
+                                                     b.data[p*n + col];
+                                        expected += a_rp*b_pc;
+                                }
+                                expected = (alpha*expected +
+                                            beta*c_old[row*n + col]);
+
+                                float diff = c.data[row*n + col] - expected;
+                                MIN_UNIT_ASSERT(fabs(diff) < 1e-4,
+                                                "ROT_gemm mismatch for "
+                                                "trans_a %d, trans_b %d\n",
+                                                trans_a,
+                                                trans_b);
+                        }
+                }
+
+                if (trans_b) {
+                        MIN_UNIT_ASSERT(ROT_gemm(c.tensor,
+                                                 a.tensor,
+                                                 b.tensor,
+                                                 trans_a,
+                                                 false,
+                                                 alpha,
+                                                 beta) == NULL,
+                                        "ROT_gemm accepted mismatched "
+                                        "dimensions\n");
+                }
+        }
+
+        const size_t square_dims[] = {k, k};
+        const size_t shared_dims[] = {k + 1, k};
+        struct tensor_data shared;
+        struct tensor_data square;
+        get_tensor_data(&shared, arena, shared_dims);
+        get_tensor_data(&square, arena, square_dims);
+        rot_tensor_t a_rows = ROT_tensor_view_slice(arena,
+                                                    shared.tensor,
+                                                    0,
+                                                    0,
+                                                    k);
+        rot_tensor_t c_rows = ROT_tensor_view_slice(arena,
+                                                    shared.tensor,
+                                                    0,
+                                                    1,
+                                                    k + 1);
+        assert((a_rows != NULL) && (c_rows != NULL));
+        MIN_UNIT_ASSERT(ROT_gemm(c_rows,
+                                 a_rows,
+                                 square.tensor,
+                                 false,
+                                 false,
+                                 alpha,
+                                 beta) == NULL,
+                        "ROT_gemm accepted a result overlapping an operand\n");
+
+        free(c_old);
+        gsl_rng_free(rng);
+        free(memory);
+}
+
+/**
+ * create_padded_matrix() - Returns a rows x cols view of the first columns of
+ * a rows x (cols + 3) matrix allocated from `arena` and filled from a
+ * uniform distribution over [-1, 1], so that its rows are not contiguous with
+ * each other.
+ * @data: Set to the data of the matrix, whose rows are cols + 3 floats apart.
+ */
+static rot_tensor_t
+create_padded_matrix(rot_arena_t arena,
+                     gsl_rng *rng,
+                     size_t rows,
+                     size_t cols,
+                     float **data)
+{
+        const size_t dims[] = {rows, cols + 3};
+        struct tensor_data parent;
+        get_tensor_data(&parent, arena, dims);
+        init_data_uniform(parent.data, rng, dims, 1);
+
+        rot_tensor_t view = ROT_tensor_view_slice(arena,
+                                                  parent.tensor,
+                                                  1,
+                                                  0,
+                                                  cols);
+        assert(view != NULL);
+        *data = parent.data;
+
+        return view;
+}
+
+/**
+ * test_gemm_small() - Correctness test for the unpacked kernels ROT_gemm uses
+ * for products of shallow or vector operands.
+ *
+ * Pass criteria: for every depth the unrolled kernels are specialised for,
+ * for matrix-vector and vector-matrix products long enough to be gathered in
+ * blocks, and for a matrix-vector product split across threads, every
+ * combination of transposes matches a naive reference for
+ * alpha*op(A)*op(B) + beta*C. Operands and results have rows that are not
+ * contiguous with each other, so vectors may be strided. With beta zero, C
+ * is not read, so NaNs in it do not propagate.
+ */
+static MIN_UNIT_TEST_FUNC(test_gemm_small)
+{
+        const size_t memory_size = 64*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        gsl_rng *rng = get_gsl_rng();
+        /**
+         * NOTE(brendan): Each case is {m, k, n}. The first 16 cases are
+         * replaced by random shapes of depths 1 to 16.
+         */
+        const size_t long_k = 600 + rand_dim(64);
+        const size_t vector_cases[][3] = {{16, 3, 1},
+                                          {1, 16, 1},
+                                          {16, 1, 3},
+                                          {rand_dim(300), long_k, 1},
+                                          {1, long_k, rand_dim(300)},
+                                          {2048, 128 + rand_dim(64), 1}};
+        const uint32_t num_cases = 16 + array_size(vector_cases);
+        for (uint32_t case_i = 0;
+             case_i < num_cases;
+             ++case_i) {
+                size_t m = rand_dim(16);
+                size_t k = case_i + 1;
+                size_t n = rand_dim(64);
+                if (case_i >= 16) {
+                        m = vector_cases[case_i - 16][0];
+                        k = vector_cases[case_i - 16][1];
+                        n = vector_cases[case_i - 16][2];
+                }
+
+                for (uint32_t trans_i = 0;
+                     trans_i < 8;
+                     ++trans_i) {
+                        const bool trans_a = (trans_i & 1);
+                        const bool trans_b = (trans_i & 2);
+                        const float alpha = gsl_ran_flat(rng, -2, 2);
+                        const float beta = ((trans_i & 4) ?
+                                            0.0f : gsl_ran_flat(rng, -2, 2));
+                        const size_t lda = (trans_a ? m : k) + 3;
+                        const size_t ldb = (trans_b ? k : n) + 3;
+                        const size_t ldc = n + 3;
+
+                        rot_arena_mark_t mark = ROT_arena_mark(arena);
+                        float *a;
+                        float *b;
+                        float *c_data;
+                        rot_tensor_t a_view =
+                                create_padded_matrix(arena,
+                                                     rng,
+                                                     trans_a ? k : m,
+                                                     trans_a ? m : k,
+                                                     &a);
+                        rot_tensor_t b_view =
+                                create_padded_matrix(arena,
+                                                     rng,
+                                                     trans_b ? n : k,
+                                                     trans_b ? k : n,
+                                                     &b);
+                        rot_tensor_t c_view = create_padded_matrix(arena,
+                                                                   rng,
+                                                                   m,
+                                                                   n,
+                                                                   &c_data);
+                        float *c_old = (float *)malloc(m*ldc*sizeof(float));
+                        assert(c_old != NULL);
+                        if (beta == 0.0f) {
+                                for (size_t i = 0;
+                                     i < m*ldc;
+                                     ++i) {
+                                        c_data[i] = NAN;
+                                }
+                        }
+                        memcpy(c_old, c_data, m*ldc*sizeof(float));
+
+                        MIN_UNIT_ASSERT(ROT_gemm(c_view,
+                                                 a_view,
+                                                 b_view,
+                                                 trans_a,
+                                                 trans_b,
+                                                 alpha,
+                                                 beta) == c_view,
+                                        "ROT_gemm failed for %zux%zux%zu\n",
+                                        m,
+                                        k,
+                                        n);
+
+                        for (size_t row = 0;
+                             row < m;
+                             ++row) {
+                                for (size_t col = 0;
+                                     col < n;
+                                     ++col) {
+                                        double expected = 0.0;
+                                        for (size_t p = 0;
+                                             p < k;
+                                             ++p) {
+                                                float a_rp = trans_a ?
+                                                             a[p*lda + row] :
+                                                             a[row*lda + p];
+                                                float b_pc = trans_b ?
+                                                             b[col*ldb + p] :
+                                                             b[p*ldb + col];
+                                                expected += a_rp*b_pc;
+                                        }
+                                        expected *= alpha;
+                                        if (beta != 0.0f)
+                                                expected += (beta*
+                                                             c_old[row*ldc +
+                                                                   col]);
+
+                                        float diff = (c_data[row*ldc + col] -
+                                                      expected);
+                                        MIN_UNIT_ASSERT(
+                                                fabs(diff) < 1e-5*(1.0 + k),
+                                                "ROT_gemm mismatch for "
+                                                "%zux%zux%zu, trans %u\n",
+                                                m,
+                                                k,
+                                                n,
+                                                trans_i);
+                                }
+
+                                MIN_UNIT_ASSERT(
+                                        memcmp(c_data + row*ldc + n,
+                                               c_old + row*ldc + n,
+                                               3*sizeof(float)) == 0,
+                                        "ROT_gemm wrote past row %zu of C\n",
+                                        row);
+                        }
+
+                        free(c_old);
+                        ROT_arena_rewind(arena, mark);
+                }
+        }
+
+        gsl_rng_free(rng);
+        free(memory);
+}
+
+/**
+ * dtype_round_trip_bound() - Returns the most a float `x` may change by when
+ * rounded to `dtype` and widened again.
+ */
+static double
+dtype_round_trip_bound(enum rot_dtype dtype, float x)
+{
+        /**
+         * NOTE(brendan): Half an ulp, with a floor for the denormals of half
+         * precision.
+         */
+        if (dtype == ROT_DTYPE_BFLOAT16)
+                return fabs(x)/256.0;
+
+        return fabs(x)/2048.0 + 1.0/(1 << 24);
+}
+
+/**
+ * check_matmul_dtype() - Checks `c`, the product of the mxk matrix `a` and the
+ * kxn matrix `b`, against a double precision product.
+ * @relative: Relative tolerance for rounding of `c` to its type.
+ */
+static bool
+check_matmul_dtype(const float *c,
+                   const float *a,
+                   const float *b,
+                   size_t m,
+                   size_t n,
+                   size_t k,
+                   double relative)
+{
+        for (size_t row = 0;
+             row < m;
+             ++row) {
+                for (size_t col = 0;
+                     col < n;
+                     ++col) {
+                        double expected = 0.0;
+                        for (size_t p = 0;
+                             p < k;
+                             ++p) {
+                                expected += (double)a[row*k + p]*b[p*n + col];
+                        }
+
+                        double diff = fabs(c[row*n + col] - expected);
+                        if (diff > (1e-4 + relative*fabs(expected)))
+                                return false;
+                }
+        }
+
+        return true;
+}
+
+/**
+ * test_tensor_dtypes() - Tests bfloat16 and half precision tensors.
+ *
+ * Pass criteria: converting to a 16-bit type rounds every element to within
+ * half an ulp. Matmuls of 16-bit operands, alone or mixed with float32,
+ * match a double precision product of the rounded operands to within float32
+ * accumulation error, plus a rounding of the result if that is 16-bit. ReLU
+ * of a 16-bit tensor is exact, in place or into a float32 tensor.
+ */
+static MIN_UNIT_TEST_FUNC(test_tensor_dtypes)
+{
+        const size_t memory_size = 16*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+
+        gsl_rng *rng = get_gsl_rng();
+        const enum rot_dtype dtypes[] = {ROT_DTYPE_BFLOAT16,
+                                         ROT_DTYPE_FLOAT16};
+        for (uint32_t dtype_i = 0;
+             dtype_i < array_size(dtypes);
+             ++dtype_i) {
+                const enum rot_dtype dtype = dtypes[dtype_i];
+                rot_arena_t arena = ROT_arena_new(memory, memory_size);
+                assert(arena != NULL);
+
+                const size_t m = rand_dim(96);
+                const size_t k = rand_dim(96);
+                const size_t n = rand_dim(96);
+                const size_t a_dims[] = {m, k};
+                const size_t b_dims[] = {k, n};
+                const size_t c_dims[] = {m, n};
+                struct tensor_data a;
+                struct tensor_data b;
+                struct tensor_data c;
+                get_tensor_data(&a, arena, a_dims);
+                get_tensor_data(&b, arena, b_dims);
+                get_tensor_data(&c, arena, c_dims);
+                init_data_uniform(a.data, rng, a_dims, 1);
+                init_data_uniform(b.data, rng, b_dims, 1);
+
+                rot_tensor_t a_16 = ROT_create_tensor_dtype(arena,
+                                                            2,
+                                                            a_dims,
+                                                            ROT_BACKEND_CPU,
+                                                            dtype);
+                rot_tensor_t b_16 = ROT_create_tensor_dtype(arena,
+                                                            2,
+                                                            b_dims,
+                                                            ROT_BACKEND_CPU,
+                                                            dtype);
+                rot_tensor_t c_16 = ROT_create_tensor_dtype(arena,
+                                                            2,
+                                                            c_dims,
+                                                            ROT_BACKEND_CPU,
+                                                            dtype);
+                assert((a_16 != NULL) && (b_16 != NULL) && (c_16 != NULL));
+                MIN_UNIT_ASSERT((ROT_tensor_get_dtype(a_16) == dtype) &&
+                                (ROT_tensor_get_data(a_16) == NULL) &&
+                                (ROT_tensor_get_size(a_16) ==
+                                 m*k*sizeof(uint16_t)),
+                                "Wrong 16-bit tensor metadata\n");
+
+                /* NOTE(brendan): The rounded operands replace the originals. */
+                float *a_orig = (float *)malloc(m*k*sizeof(float));
+                assert(a_orig != NULL);
+                memcpy(a_orig, a.data, m*k*sizeof(float));
+                MIN_UNIT_ASSERT((ROT_tensor_convert(a_16, a.tensor) == a_16) &&
+                                (ROT_tensor_convert(b_16, b.tensor) == b_16) &&
+                                (ROT_tensor_convert(a.tensor, a_16) ==
+                                 a.tensor) &&
+                                (ROT_tensor_convert(b.tensor, b_16) ==
+                                 b.tensor),
+                                "ROT_tensor_convert failed\n");
+                for (size_t i = 0;
+                     i < m*k;
+                     ++i) {
+                        MIN_UNIT_ASSERT(fabs(a.data[i] - a_orig[i]) <=
+                                        dtype_round_trip_bound(dtype,
+                                                               a_orig[i]),
+                                        "Rounding of %f not to nearest\n",
+                                        a_orig[i]);
+                }
+                free(a_orig);
+
+                MIN_UNIT_ASSERT((ROT_matmul(c.tensor, a_16, b_16) ==
+                                 c.tensor) &&
+                                check_matmul_dtype(c.data,
+                                                   a.data,
+                                                   b.data,
+                                                   m,
+                                                   n,
+                                                   k,
+                                                   0.0),
+                                "16-bit matmul mismatch for dtype %d\n",
+                                dtype);
+
+                MIN_UNIT_ASSERT((ROT_matmul(c.tensor, a_16, b.tensor) ==
+                                 c.tensor) &&
+                                check_matmul_dtype(c.data,
+                                                   a.data,
+                                                   b.data,
+                                                   m,
+                                                   n,
+                                                   k,
+                                                   0.0),
+                                "Mixed matmul mismatch for dtype %d\n",
+                                dtype);
+
+                MIN_UNIT_ASSERT((ROT_matmul(c_16, a_16, b_16) == c_16) &&
+                                (ROT_tensor_convert(c.tensor, c_16) ==
+                                 c.tensor) &&
+                                check_matmul_dtype(c.data,
+                                                   a.data,
+                                                   b.data,
+                                                   m,
+                                                   n,
+                                                   k,
+                                                   1.0/128),
+                                "16-bit result mismatch for dtype %d\n",
+                                dtype);
+
+                MIN_UNIT_ASSERT((ROT_relu_out(b.tensor, b_16) == b.tensor) &&
+                                (ROT_relu(b_16) == b_16),
+                                "ReLU of 16-bit tensors failed\n");
+                float *b_relu = (float *)malloc(k*n*sizeof(float));
+                assert(b_relu != NULL);
+                memcpy(b_relu, b.data, k*n*sizeof(float));
+                MIN_UNIT_ASSERT(ROT_tensor_convert(b.tensor, b_16) == b.tensor,
+                                "ROT_tensor_convert failed\n");
+                for (size_t i = 0;
+                     i < k*n;
+                     ++i) {
+                        MIN_UNIT_ASSERT((b_relu[i] >= 0.0f) &&
+                                        (b.data[i] == b_relu[i]),
+                                        "16-bit ReLU mismatch at %zu\n",
+                                        i);
+                }
+                free(b_relu);
+        }
+
+        gsl_rng_free(rng);
+        free(memory);
+}
+
+/**
+ * create_quantized() - Allocates from `arena` a rows x cols tensor of type
+ * `dtype`, and quantizes `data` into it with calibrated parameters.
+ */
+static rot_tensor_t
+create_quantized(rot_arena_t arena,
+                 const struct tensor_data *data,
+                 enum rot_dtype dtype)
+{
+        rot_tensor_t result = ROT_create_tensor_dtype(
+                arena,
+                2,
+                ROT_tensor_get_dims(data->tensor),
+                ROT_BACKEND_CPU,
+                dtype);
+        assert(result != NULL);
+
+        rot_tensor_t calibrated = ROT_calibrate_quantization(result,
+                                                             data->tensor);
+        assert(calibrated == result);
+        rot_tensor_t converted = ROT_tensor_convert(result, data->tensor);
+        assert(converted == result);
+
+        return result;
+}
+
+/**
+ * test_quantized_matmul() - Tests matmuls of 8-bit quantized tensors.
+ *
+ * Pass criteria: weights quantized per row dequantize to within half a step
+ * of their row's scale. The product of int8 weights and uint8 activations,
+ * dequantized to float32 or computed as its transpose through ROT_gemm,
+ * matches the double precision product of the dequantized operands to within
+ * float32 error. Requantized to uint8, it matches to within half a step.
+ * ROT_linear with quantized operands applies its bias and ReLU. Mixing
+ * quantized and float32 operands is an error.
+ */
+static MIN_UNIT_TEST_FUNC(test_quantized_matmul)
+{
+        const size_t memory_size = 16*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        gsl_rng *rng = get_gsl_rng();
+        /* NOTE(brendan): m is more than the rows of op(A) packed at once. */
+        const size_t m = 96 + rand_dim(96);
+        const size_t k = rand_dim(300);
+        const size_t n = rand_dim(96);
+        const size_t w_dims[] = {m, k};
+        const size_t x_dims[] = {k, n};
+        const size_t c_dims[] = {m, n};
+        const size_t c_t_dims[] = {n, m};
+        struct tensor_data w;
+        struct tensor_data x;
+        struct tensor_data c;
+        struct tensor_data c_t;
+        struct tensor_data bias;
+        get_tensor_data(&w, arena, w_dims);
+        get_tensor_data(&x, arena, x_dims);
+        get_tensor_data(&c, arena, c_dims);
+        get_tensor_data(&c_t, arena, c_t_dims);
+        const size_t bias_dims[] = {m, 1};
+        get_tensor_data(&bias, arena, bias_dims);
+        init_data_uniform(w.data, rng, w_dims, 1);
+        init_data_uniform(bias.data, rng, bias_dims, 1);
+        for (size_t i = 0;
+             i < k*n;
+             ++i) {
+                x.data[i] = gsl_ran_flat(rng, -0.5, 2);
+        }
+
+        rot_tensor_t w_q = ROT_quantize_weights(arena, w.tensor);
+        rot_tensor_t x_q = create_quantized(arena, &x, ROT_DTYPE_UINT8);
+        MIN_UNIT_ASSERT((w_q != NULL) &&
+                        (ROT_tensor_get_dtype(w_q) == ROT_DTYPE_INT8) &&
+                        (ROT_tensor_get_size(w_q) == m*k),
+                        "ROT_quantize_weights failed\n");
+
+        /* NOTE(brendan): The dequantized operands replace the originals. */
+        float *w_orig = (float *)malloc(m*k*sizeof(float));
+        assert(w_orig != NULL);
+        memcpy(w_orig, w.data, m*k*sizeof(float));
+        MIN_UNIT_ASSERT(ROT_tensor_convert(w.tensor, w_q) == w.tensor,
+                        "Dequantizing weights failed\n");
+        for (size_t row = 0;
+             row < m;
+             ++row) {
+                const float *orig_row = w_orig + row*k;
+                float max_abs = 0.0f;
+                for (size_t col = 0;
+                     col < k;
+                     ++col) {
+                        max_abs = fmaxf(max_abs, fabsf(orig_row[col]));
+                }
+
+                for (size_t col = 0;
+                     col < k;
+                     ++col) {
+                        float diff = w.data[row*k + col] - orig_row[col];
+                        MIN_UNIT_ASSERT(fabs(diff) <= 0.5001*max_abs/127,
+                                        "Weight row %zu rounded too far\n",
+                                        row);
+                }
+        }
+        free(w_orig);
+        MIN_UNIT_ASSERT(ROT_tensor_convert(x.tensor, x_q) == x.tensor,
+                        "Dequantizing activations failed\n");
+
+        MIN_UNIT_ASSERT((ROT_matmul(c.tensor, w_q, x_q) == c.tensor) &&
+                        check_matmul_dtype(c.data,
+                                           w.data,
+                                           x.data,
+                                           m,
+                                           n,
+                                           k,
+                                           1e-5),
+                        "Quantized matmul mismatch\n");
+
+        MIN_UNIT_ASSERT(ROT_gemm(c_t.tensor,
+                                 x_q,
+                                 w_q,
+                                 true,
+                                 true,
+                                 1.0f,
+                                 0.0f) == c_t.tensor,
+                        "Transposed quantized GEMM failed\n");
+        for (size_t i = 0;
+             i < m;
+             ++i) {
+                for (size_t j = 0;
+                     j < n;
+                     ++j) {
+                        float diff = c_t.data[j*m + i] - c.data[i*n + j];
+                        MIN_UNIT_ASSERT(fabs(diff) <= 1e-4,
+                                        "Transposed quantized GEMM "
+                                        "mismatch\n");
+                }
+        }
+
+        rot_tensor_t c_q = create_quantized(arena, &c, ROT_DTYPE_UINT8);
+        rot_tensor_t c_scale_probe = ROT_create_tensor_dtype(arena,
+                                                             2,
+                                                             c_dims,
+                                                             ROT_BACKEND_CPU,
+                                                             ROT_DTYPE_UINT8);
+        assert(c_scale_probe != NULL);
+        float *c_expected = (float *)malloc(m*n*sizeof(float));
+        assert(c_expected != NULL);
+        memcpy(c_expected, c.data, m*n*sizeof(float));
+        float c_lo = 0.0f;
+        float c_hi = 0.0f;
+        for (size_t i = 0;
+             i < m*n;
+             ++i) {
+                c_lo = fminf(c_lo, c_expected[i]);
+                c_hi = fmaxf(c_hi, c_expected[i]);
+        }
+        const float c_step = (c_hi - c_lo)/255;
+        MIN_UNIT_ASSERT((ROT_matmul(c_q, w_q, x_q) == c_q) &&
+                        (ROT_tensor_convert(c.tensor, c_q) == c.tensor),
+                        "Requantized matmul failed\n");
+        for (size_t i = 0;
+             i < m*n;
+             ++i) {
+                MIN_UNIT_ASSERT(fabs(c.data[i] - c_expected[i]) <=
+                                0.5001*c_step + 1e-4,
+                                "Requantized matmul mismatch at %zu\n",
+                                i);
+        }
+
+        MIN_UNIT_ASSERT(ROT_linear(c.tensor,
+                                   w_q,
+                                   x_q,
+                                   bias.tensor,
+                                   ROT_ACTIVATION_RELU) == c.tensor,
+                        "Quantized ROT_linear failed\n");
+        for (size_t i = 0;
+             i < m;
+             ++i) {
+                for (size_t j = 0;
+                     j < n;
+                     ++j) {
+                        float expected = fmaxf(c_expected[i*n + j] +
+                                               bias.data[i],
+                                               0.0f);
+                        MIN_UNIT_ASSERT(fabs(c.data[i*n + j] - expected) <=
+                                        1e-4,
+                                        "Quantized ROT_linear mismatch\n");
+                }
+        }
+
+        MIN_UNIT_ASSERT((ROT_matmul(c.tensor, w_q, x.tensor) == NULL) &&
+                        (ROT_gemm(c_scale_probe,
+                                  w_q,
+                                  x_q,
+                                  false,
+                                  false,
+                                  1.0f,
+                                  1.0f) == NULL),
+                        "Unsupported quantized matmuls were accepted\n");
+
+        /**
+         * NOTE(brendan): Past a depth of 2^16, 32-bit sums of byte products
+         * may overflow.
+         */
+        const size_t deep_a_dims[] = {1, (1 << 16) + 1};
+        const size_t deep_b_dims[] = {(1 << 16) + 1, 1};
+        const size_t deep_c_dims[] = {1, 1};
+        rot_tensor_t deep_a = ROT_create_tensor_dtype(arena,
+                                                      2,
+                                                      deep_a_dims,
+                                                      ROT_BACKEND_CPU,
+                                                      ROT_DTYPE_INT8);
+        rot_tensor_t deep_b = ROT_create_tensor_dtype(arena,
+                                                      2,
+                                                      deep_b_dims,
+                                                      ROT_BACKEND_CPU,
+                                                      ROT_DTYPE_UINT8);
+        rot_tensor_t deep_c = ROT_create_tensor(arena,
+                                                2,
+                                                deep_c_dims,
+                                                ROT_BACKEND_CPU);
+        assert((deep_a != NULL) && (deep_b != NULL) && (deep_c != NULL));
+        MIN_UNIT_ASSERT(ROT_matmul(deep_c, deep_a, deep_b) == NULL,
+                        "Quantized matmul accepted a depth that may "
+                        "overflow\n");
+
+        free(c_expected);
+        gsl_rng_free(rng);
+        free(memory);
+}
+
+/**
+ * test_sparse_matmul() - Tests sparse matrices in each format, converted from
+ * pruned dense matrices.
+ *
+ * Pass criteria: converting to sparse and back to dense is exact, CSR stores
+ * only the nonzeros, and the product with a dense matrix matches the double
+ * precision product of the dense matrices. Operands of mismatched
+ * dimensions are rejected.
+ */
+static MIN_UNIT_TEST_FUNC(test_sparse_matmul)
+{
+        const size_t memory_size = 8*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        gsl_rng *rng = get_gsl_rng();
+        const size_t m = rand_dim(100);
+        const size_t k = rand_dim(200);
+        const size_t n = rand_dim(150);
+        const size_t w_dims[] = {m, k};
+        const size_t x_dims[] = {k, n};
+        const size_t c_dims[] = {m, n};
+        struct tensor_data w;
+        struct tensor_data w_round_trip;
+        struct tensor_data x;
+        struct tensor_data c;
+        struct tensor_data x_bad;
+        get_tensor_data(&w, arena, w_dims);
+        get_tensor_data(&w_round_trip, arena, w_dims);
+        const size_t x_bad_dims[] = {k + 1, n};
+        get_tensor_data(&x_bad, arena, x_bad_dims);
+        get_tensor_data(&x, arena, x_dims);
+        get_tensor_data(&c, arena, c_dims);
+        init_data_uniform(x.data, rng, x_dims, 1);
+
+        size_t num_nonzeros = 0;
+        for (size_t i = 0;
+             i < m*k;
+             ++i) {
+                bool is_pruned = (gsl_ran_flat(rng, 0, 1) < 0.9);
+                w.data[i] = is_pruned ? 0.0f : gsl_ran_flat(rng, -1, 1);
+                num_nonzeros += (w.data[i] != 0.0f);
+        }
+
+        const enum rot_sparse_format formats[] = {ROT_SPARSE_CSR,
+                                                  ROT_SPARSE_BSR_4X4,
+                                                  ROT_SPARSE_BSR_8X1};
+        for (uint32_t f = 0;
+             f < array_size(formats);
+             ++f) {
+                rot_sparse_t w_sparse = ROT_sparse_from_dense(arena,
+                                                              w.tensor,
+                                                              formats[f]);
+                MIN_UNIT_ASSERT((w_sparse != NULL) &&
+                                (ROT_sparse_get_dims(w_sparse)[0] == m) &&
+                                (ROT_sparse_get_dims(w_sparse)[1] == k),
+                                "ROT_sparse_from_dense failed\n");
+
+                size_t nnz = ROT_sparse_get_nnz(w_sparse);
+                MIN_UNIT_ASSERT((formats[f] == ROT_SPARSE_CSR) ?
+                                (nnz == num_nonzeros) :
+                                ((nnz >= num_nonzeros) && (nnz % 8 == 0)),
+                                "Format %u stores %zu values for %zu "
+                                "nonzeros\n",
+                                (uint32_t)formats[f],
+                                nnz,
+                                num_nonzeros);
+
+                MIN_UNIT_ASSERT((ROT_sparse_to_dense(w_round_trip.tensor,
+                                                     w_sparse) ==
+                                 w_round_trip.tensor) &&
+                                (memcmp(w_round_trip.data,
+                                        w.data,
+                                        m*k*sizeof(float)) == 0),
+                                "Format %u round trip mismatch\n",
+                                (uint32_t)formats[f]);
+
+                MIN_UNIT_ASSERT((ROT_sparse_matmul(c.tensor,
+                                                   w_sparse,
+                                                   x.tensor) == c.tensor) &&
+                                check_matmul_dtype(c.data,
+                                                   w.data,
+                                                   x.data,
+                                                   m,
+                                                   n,
+                                                   k,
+                                                   1e-5),
+                                "Format %u sparse matmul mismatch\n",
+                                (uint32_t)formats[f]);
+
+                MIN_UNIT_ASSERT(ROT_sparse_matmul(c.tensor,
+                                                  w_sparse,
+                                                  x_bad.tensor) == NULL,
+                                "Mismatched sparse matmul accepted\n");
+        }
+
+        gsl_rng_free(rng);
+        free(memory);
+}
+
 /**
  * test_matmul_small_perf() - Test for speed for small matrix multiplication.
  *
@@ -378,6 +1394,88 @@ static MIN_UNIT_TEST_FUNC(test_matmul_small_perf)
         free(memory);
 }
 
+/**
+ * get_matmul_elapsed_sec() - Returns the time in seconds taken to run
+ * `num_iters` matmuls of the matrices in `state` using `engine`.
+ */
+static double
+get_matmul_elapsed_sec(struct matmul_test_state *state,
+                       enum rot_matmul_engine engine,
+                       uint32_t num_iters)
+{
+        struct timeval start;
+        get_and_check_time_of_day(&start);
+
+        for (uint32_t i = 0;
+             i < num_iters;
+             ++i) {
+                rot_tensor_t c = ROT_matmul_with_engine(state->c.tensor,
+                                                        state->a.tensor,
+                                                        state->b.tensor,
+                                                        engine);
+                MIN_UNIT_ASSERT(c != NULL,
+                                "NULL returned from ROT_matmul_with_engine, "
+                                "expected rot_tensor\n");
+        }
+
+        struct timeval end;
+        get_and_check_time_of_day(&end);
+
+        return get_elapsed_sec(start, end);
+}
+
+/**
+ * test_matmul_native_perf() - Compares the speed of the in-tree GEMM engine
+ * against OpenBLAS.
+ *
+ * Pass criteria: for matrices with each dimension in [256, 4096], the native
+ * engine must be at least as fast as `cblas_sgemm`.
+ */
+static MIN_UNIT_TEST_FUNC(test_matmul_native_perf)
+{
+        const size_t memory_size = 1024*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        struct matmul_dims dims = {.n = 255 + rand_dim(4096 - 255),
+                                   .m = 255 + rand_dim(4096 - 255),
+                                   .k = 255 + rand_dim(4096 - 255)};
+
+        struct matmul_test_state state;
+        setup_matmul_test_state(&state, memory, memory_size, &dims);
+
+        /* NOTE(brendan): Warm up both engines' threads and buffers. */
+        get_matmul_elapsed_sec(&state, ROT_MATMUL_ENGINE_BLAS, 1);
+        get_matmul_elapsed_sec(&state, ROT_MATMUL_ENGINE_NATIVE, 1);
+
+        constexpr uint32_t num_iters = 8;
+        double blas_elapsed_sec =
+                get_matmul_elapsed_sec(&state,
+                                       ROT_MATMUL_ENGINE_BLAS,
+                                       num_iters);
+        double native_elapsed_sec =
+                get_matmul_elapsed_sec(&state,
+                                       ROT_MATMUL_ENGINE_NATIVE,
+                                       num_iters);
+
+        printf("%zux%zux%zu: native %.5f s, OpenBLAS %.5f s\n",
+               dims.m,
+               dims.k,
+               dims.n,
+               native_elapsed_sec,
+               blas_elapsed_sec);
+
+        MIN_UNIT_ASSERT(native_elapsed_sec <= blas_elapsed_sec,
+                        "Native (%.5f) slower than OpenBLAS (%.5f)\n",
+                        native_elapsed_sec,
+                        blas_elapsed_sec);
+
+        THFloatTensor_free(state.th_a);
+        THFloatTensor_free(state.th_b);
+        THFloatTensor_free(state.th_c);
+
+        free(memory);
+}
+
 template<size_t N>
 static void
 init_layer(struct linear_layer *layer,
@@ -413,7 +1511,7 @@ init_layer(struct linear_layer *layer,
  */
 static MIN_UNIT_TEST_FUNC(test_feedforward_backward)
 {
-        constexpr size_t memory_size = 1024;
+        constexpr size_t memory_size = 2048;
         uint8_t memory[memory_size];
         rot_arena_t arena = ROT_arena_new(memory, memory_size);
 
@@ -459,14 +1557,18 @@ static MIN_UNIT_TEST_FUNC(test_feedforward_backward)
                 input_data[1] = datum->alpha;
                 input_data[2] = datum->beta;
 
-                ROT_matmul(layer0.a, layer0.w, input_tensor);
-
-                ROT_relu(layer0.a);
-
-                ROT_matmul(out_layer.a, out_layer.w, layer0.a);
-                /* TODO(brendan): find faster sigmoid and benchmark */
+                ROT_linear(layer0.a,
+                           layer0.w,
+                           input_tensor,
+                           NULL,
+                           ROT_ACTIVATION_RELU);
+
+                ROT_linear(out_layer.a,
+                           out_layer.w,
+                           layer0.a,
+                           NULL,
+                           ROT_ACTIVATION_SIGMOID);
                 float *pred_data = ROT_tensor_get_data(out_layer.a);
-                pred_data[0] = 1.0f/(1.0f + exp(-pred_data[0]));
 
                 float error = pred_data[0] - datum->y;
                 error = 0.5f*error*error;
@@ -546,6 +1648,34 @@ run_test(min_unit_test_func test)
 int main(void)
 {
         run_test(test_matmul_small);
+        run_test(test_matmul_small_native);
+        run_test(test_matmul_batched);
+        run_test(test_gemm);
+        run_test(test_gemm_small);
+        run_test(test_tensor_dtypes);
+        run_test(test_quantized_matmul);
+        run_test(test_sparse_matmul);
+        run_test(test_context);
+        run_test(test_context_threads);
+        run_test(test_context_parallel_ops);
+        run_test(test_linear);
+        run_test(test_relu);
+        run_test(test_relu_grad);
+        run_test(test_unary);
+        run_test(test_tape_backward);
+        run_test(test_conv2d);
+        run_test(test_conv2d_winograd);
+        run_test(test_conv2d_depthwise_separable);
+        run_test(test_pool2d);
+        run_test(test_layernorm);
+        run_test(test_batchnorm);
+        run_test(test_optim);
+        run_test(test_arena_rewind);
+        run_test(test_arena_map);
+        run_test(test_arena_concurrent);
+        run_test(test_tensor_padded);
+        run_test(test_tensor_views);
+        run_test(test_plan_chain);
 #ifdef PLATFORM_CUDNN
         run_test(test_matmul_small_cudnn);
 #endif /* PLATFORM_CUDNN */
@@ -553,6 +1683,9 @@ int main(void)
         run_test(test_matmul_small_miopen);
 #endif /* PLATFORM_MIOPEN */
         run_test(test_matmul_small_perf);
+        run_test(test_matmul_native_perf);
+        run_test(test_relu_perf);
+        run_test(test_unary_perf);
         run_test(test_feedforward_backward);
 
         printf("All tests passed!\n");
@@ -0,0 +1,708 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "tests/test_memory.h"
+#include "rot_arena.h"        /* for rot_arena_t, ROT_arena_map, ... */
+#include "rot_math.h"         /* for ROT_create_tensor_aligned, ... */
+#include "rot_nn.h"           /* for ROT_relu, ROT_relu_out */
+#include "rot_plan.h"         /* for rot_plan_t, ROT_plan_allocate, ... */
+#include "rot_platform.h"     /* for ROT_BACKEND_CPU */
+#include "tests/test_math.h"  /* for rand_dim */
+
+#include <assert.h>           /* for assert */
+#include <math.h>             /* for fabsf */
+#include <pthread.h>          /* for pthread_create, pthread_join */
+#include <stdint.h>           /* for SIZE_MAX, uint8_t, uintptr_t, ... */
+#include <stdio.h>            /* for printf */
+#include <stdlib.h>           /* for free, malloc, rand */
+#include <string.h>           /* for memcmp, memcpy, memset */
+
+#define PLAN_CHAIN_NUM_LAYERS 16
+
+/**
+ * create_random_tensor() - Allocates a CPU tensor from `arena` filled with
+ * samples from a uniform distribution over [-1, 1].
+ */
+static rot_tensor_t
+create_random_tensor(rot_arena_t arena, uint32_t num_dims, const size_t *dims)
+{
+        rot_tensor_t tensor = ROT_create_tensor(arena,
+                                                num_dims,
+                                                dims,
+                                                ROT_BACKEND_CPU);
+        assert(tensor != NULL);
+
+        float *data = ROT_tensor_get_data(tensor);
+        size_t num_elems = ROT_tensor_get_size(tensor)/sizeof(float);
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                data[i] = 2.0f*rand()/(float)RAND_MAX - 1.0f;
+        }
+
+        return tensor;
+}
+
+/**
+ * test_arena_rewind() - Tests nested arena marks.
+ *
+ * Pass criteria: rewinding to a mark must make the next CPU and GPU
+ * allocations land where the first allocations after the mark did, for both
+ * an inner and an outer mark, and a mark that was rewound past must be
+ * rejected.
+ *
+ * NOTE(brendan): The GPU region only does bookkeeping on the block pointers,
+ * so host buffers stand in for device memory here.
+ */
+MIN_UNIT_TEST_FUNC(test_arena_rewind)
+{
+        const size_t memory_size = 64*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const uint32_t num_blocks = 2;
+        const size_t block_bytes = 4096;
+        uint8_t gpu_memory[num_blocks][block_bytes];
+        void *gpu_blocks[] = {gpu_memory[0], gpu_memory[1]};
+        MIN_UNIT_ASSERT(ROT_arena_gpu_new(arena,
+                                          gpu_blocks,
+                                          block_bytes,
+                                          num_blocks) == arena,
+                        "ROT_arena_gpu_new failed\n");
+
+        rot_arena_mark_t outer = ROT_arena_mark(arena);
+        MIN_UNIT_ASSERT(outer != NULL, "ROT_arena_mark failed\n");
+        void *outer_cpu = ROT_arena_malloc(arena, 100, ROT_BACKEND_CPU);
+        void *outer_gpu = ROT_arena_malloc(arena, 3000, ROT_BACKEND_CUDA);
+
+        rot_arena_mark_t inner = ROT_arena_mark(arena);
+        MIN_UNIT_ASSERT(inner != NULL, "ROT_arena_mark failed\n");
+        void *inner_cpu = ROT_arena_malloc(arena, 200, ROT_BACKEND_CPU);
+        void *inner_gpu = ROT_arena_malloc(arena, 3000, ROT_BACKEND_CUDA);
+        MIN_UNIT_ASSERT((outer_cpu != NULL) && (outer_gpu != NULL) &&
+                        (inner_cpu != NULL) && (inner_gpu != NULL) &&
+                        (inner_gpu != outer_gpu),
+                        "Arena allocation failed\n");
+        MIN_UNIT_ASSERT(ROT_arena_malloc(arena,
+                                         3000,
+                                         ROT_BACKEND_CUDA) == NULL,
+                        "GPU arena allocated past the end of its blocks\n");
+
+        MIN_UNIT_ASSERT(ROT_arena_rewind(arena, inner) == arena,
+                        "Rewinding to inner mark failed\n");
+        MIN_UNIT_ASSERT((ROT_arena_mark(arena) == inner) &&
+                        (ROT_arena_malloc(arena,
+                                          200,
+                                          ROT_BACKEND_CPU) == inner_cpu) &&
+                        (ROT_arena_malloc(arena,
+                                          3000,
+                                          ROT_BACKEND_CUDA) == inner_gpu),
+                        "Allocation after inner rewind moved\n");
+
+        MIN_UNIT_ASSERT(ROT_arena_rewind(arena, outer) == arena,
+                        "Rewinding to outer mark failed\n");
+        MIN_UNIT_ASSERT(ROT_arena_rewind(arena, inner) == NULL,
+                        "Rewinding to a discarded mark succeeded\n");
+        MIN_UNIT_ASSERT((ROT_arena_mark(arena) == outer) &&
+                        (ROT_arena_malloc(arena,
+                                          100,
+                                          ROT_BACKEND_CPU) == outer_cpu) &&
+                        (ROT_arena_malloc(arena,
+                                          3000,
+                                          ROT_BACKEND_CUDA) == outer_gpu),
+                        "Allocation after outer rewind moved\n");
+
+        free(memory);
+}
+
+/**
+ * test_arena_map() - Tests arenas that map their own memory.
+ *
+ * Pass criteria: for every combination of huge pages and pre-faulting, the
+ * mapped arena must hand out tensors whose data is 64 byte aligned, that can
+ * be written end to end, and must refuse allocations beyond its size. Sizes
+ * that overflow when rounded up to a huge page are rejected.
+ */
+MIN_UNIT_TEST_FUNC(test_arena_map)
+{
+        const size_t mem_bytes = 3*1024*1024;
+        const uint32_t all_flags[] = {0,
+                                      ROT_ARENA_HUGE_PAGES,
+                                      ROT_ARENA_PREFAULT,
+                                      (ROT_ARENA_HUGE_PAGES |
+                                       ROT_ARENA_PREFAULT)};
+        for (uint32_t flags_i = 0;
+             flags_i < sizeof(all_flags)/sizeof(all_flags[0]);
+             ++flags_i) {
+                rot_arena_t arena = ROT_arena_map(mem_bytes,
+                                                  all_flags[flags_i]);
+                MIN_UNIT_ASSERT(arena != NULL,
+                                "ROT_arena_map failed for flags %u\n",
+                                all_flags[flags_i]);
+
+                const size_t dims[] = {1000, 1000};
+                rot_tensor_t tensor = ROT_create_tensor(arena,
+                                                        2,
+                                                        dims,
+                                                        ROT_BACKEND_CPU);
+                MIN_UNIT_ASSERT(tensor != NULL,
+                                "ROT_create_tensor failed in mapped arena\n");
+
+                float *data = ROT_tensor_get_data(tensor);
+                MIN_UNIT_ASSERT(((uintptr_t)data % 64) == 0,
+                                "Tensor data is not 64 byte aligned\n");
+                memset(data, 0xFF, ROT_tensor_get_size(tensor));
+
+                MIN_UNIT_ASSERT(ROT_arena_malloc(arena,
+                                                 4*1024*1024,
+                                                 ROT_BACKEND_CPU) == NULL,
+                                "Mapped arena allocated beyond its size\n");
+
+                ROT_arena_unmap(arena);
+        }
+
+        MIN_UNIT_ASSERT(ROT_arena_map(SIZE_MAX, 0) == NULL,
+                        "ROT_arena_map accepted a size that overflows\n");
+}
+
+/**
+ * test_tensor_padded() - Tests tensors with padded leading dimensions.
+ *
+ * Pass criteria: padded tensors must start every row on a 64 byte line, with
+ * rows not a multiple of 4 KB apart, and ROT_matmul and ROT_relu on padded
+ * tensors must give exactly the same elements as on packed tensors.
+ */
+MIN_UNIT_TEST_FUNC(test_tensor_padded)
+{
+        const size_t memory_size = 16*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const size_t m = rand_dim(64);
+        const size_t k = (rand() % 2) ? 1024 : rand_dim(256);
+        /* NOTE(brendan): Odd, so that the padded result has a different ld. */
+        const size_t n = 2*rand_dim(32) + 1;
+        const size_t a_dims[] = {m, k};
+        const size_t b_dims[] = {k, n};
+        const size_t c_dims[] = {m, n};
+        rot_tensor_t a = create_random_tensor(arena, 2, a_dims);
+        rot_tensor_t b = create_random_tensor(arena, 2, b_dims);
+        rot_tensor_t c = create_random_tensor(arena, 2, c_dims);
+
+        rot_tensor_t padded[3];
+        const size_t *padded_dims[] = {a_dims, b_dims, c_dims};
+        rot_tensor_t packed[] = {a, b, c};
+        for (uint32_t i = 0;
+             i < 3;
+             ++i) {
+                padded[i] = ROT_create_tensor_aligned(arena,
+                                                      2,
+                                                      padded_dims[i],
+                                                      ROT_BACKEND_CPU,
+                                                      64,
+                                                      true);
+                MIN_UNIT_ASSERT(padded[i] != NULL,
+                                "ROT_create_tensor_aligned failed\n");
+
+                size_t ld = ROT_tensor_get_ld(padded[i]);
+                float *data = ROT_tensor_get_data(padded[i]);
+                MIN_UNIT_ASSERT((((uintptr_t)data % 64) == 0) &&
+                                ((ld*sizeof(float)) % 64 == 0) &&
+                                ((ld*sizeof(float)) % 4096 != 0) &&
+                                (ld >= padded_dims[i][1]),
+                                "Bad padded layout, ld %zu\n",
+                                ld);
+
+                const float *packed_data = ROT_tensor_get_data(packed[i]);
+                for (size_t row = 0;
+                     row < padded_dims[i][0];
+                     ++row) {
+                        memcpy(data + row*ld,
+                               packed_data + row*padded_dims[i][1],
+                               padded_dims[i][1]*sizeof(float));
+                }
+        }
+
+        MIN_UNIT_ASSERT((ROT_matmul(c, a, b) == c) &&
+                        (ROT_relu(c) == c) &&
+                        (ROT_matmul(padded[2], padded[0], padded[1]) ==
+                         padded[2]) &&
+                        (ROT_relu(padded[2]) == padded[2]),
+                        "Ops on padded tensors failed\n");
+
+        const float *c_data = ROT_tensor_get_data(c);
+        const float *padded_c_data = ROT_tensor_get_data(padded[2]);
+        size_t ldc = ROT_tensor_get_ld(padded[2]);
+        for (size_t row = 0;
+             row < m;
+             ++row) {
+                MIN_UNIT_ASSERT(memcmp(c_data + row*n,
+                                       padded_c_data + row*ldc,
+                                       n*sizeof(float)) == 0,
+                                "Padded result differs from packed\n");
+        }
+
+        memset(ROT_tensor_get_data(c), 0, ROT_tensor_get_size(c));
+        MIN_UNIT_ASSERT(ROT_relu_out(c, padded[2]) == c,
+                        "ReLU from a padded to a packed tensor failed\n");
+        for (size_t row = 0;
+             row < m;
+             ++row) {
+                MIN_UNIT_ASSERT(memcmp(c_data + row*n,
+                                       padded_c_data + row*ldc,
+                                       n*sizeof(float)) == 0,
+                                "Packed ReLU result differs from padded\n");
+        }
+
+        free(memory);
+}
+
+/**
+ * view_elem() - Returns element (i0, i1, i2) of a 3D view.
+ */
+static float
+view_elem(rot_tensor_t view, size_t i0, size_t i1, size_t i2)
+{
+        const size_t *strides = ROT_tensor_get_strides(view);
+        const float *data = ROT_tensor_get_data(view);
+
+        return data[i0*strides[0] + i1*strides[1] + i2*strides[2]];
+}
+
+/**
+ * test_tensor_views() - Tests slice, transpose, permute and reshape views.
+ *
+ * Pass criteria: views must index the same elements as their source tensor,
+ * ReLU on a column slice must leave the other columns untouched, matmuls of
+ * transposed views, including into a transposed result, must match matmuls
+ * of packed copies, and reshapes that would need a copy must fail.
+ */
+MIN_UNIT_TEST_FUNC(test_tensor_views)
+{
+        const size_t memory_size = 16*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const size_t x_dims[] = {4, 6, 8};
+        rot_tensor_t x = create_random_tensor(arena, 3, x_dims);
+        rot_tensor_t slice = ROT_tensor_view_slice(arena, x, 1, 2, 5);
+        const uint32_t perm[] = {2, 0, 1};
+        rot_tensor_t permuted = ROT_tensor_view_permute(arena, x, perm);
+        MIN_UNIT_ASSERT((slice != NULL) && (permuted != NULL),
+                        "Creating views failed\n");
+        MIN_UNIT_ASSERT((ROT_tensor_get_dims(slice)[1] == 3) &&
+                        (ROT_tensor_get_dims(permuted)[0] == 8),
+                        "Views have wrong dimensions\n");
+        for (size_t i0 = 0;
+             i0 < 4;
+             ++i0) {
+                for (size_t i1 = 0;
+                     i1 < 3;
+                     ++i1) {
+                        for (size_t i2 = 0;
+                             i2 < 8;
+                             ++i2) {
+                                MIN_UNIT_ASSERT(
+                                        (view_elem(slice, i0, i1, i2) ==
+                                         view_elem(x, i0, i1 + 2, i2)) &&
+                                        (view_elem(permuted, i2, i0, i1) ==
+                                         view_elem(x, i0, i1, i2)),
+                                        "View elements differ\n");
+                        }
+                }
+        }
+
+        const size_t rows_dims[] = {24, 4};
+        const size_t flat_dims[] = {96};
+        rot_tensor_t columns = ROT_tensor_view_slice(arena, x, 2, 0, 4);
+        rot_tensor_t rows = ROT_tensor_view_reshape(arena,
+                                                    columns,
+                                                    2,
+                                                    rows_dims);
+        MIN_UNIT_ASSERT((rows != NULL) &&
+                        (ROT_tensor_get_strides(rows)[0] == 8) &&
+                        (ROT_tensor_get_data(rows) ==
+                         ROT_tensor_get_data(columns)),
+                        "Reshaping a strided view failed\n");
+        MIN_UNIT_ASSERT((ROT_tensor_view_reshape(arena,
+                                                 columns,
+                                                 1,
+                                                 flat_dims) == NULL) &&
+                        (ROT_tensor_view_reshape(arena,
+                                                 slice,
+                                                 2,
+                                                 rows_dims) == NULL) &&
+                        (ROT_tensor_view_reshape(arena,
+                                                 permuted,
+                                                 1,
+                                                 flat_dims) == NULL),
+                        "Reshape that needs a copy succeeded\n");
+
+        const size_t m = rand_dim(64);
+        const size_t k = rand_dim(64);
+        const size_t n = rand_dim(64);
+        const size_t at_dims[] = {k, m};
+        const size_t a_dims[] = {m, k};
+        const size_t b_dims[] = {k, 2*n};
+        const size_t b_packed_dims[] = {k, n};
+        const size_t c_dims[] = {m, n};
+        const size_t ct_dims[] = {n, m};
+        rot_tensor_t at = create_random_tensor(arena, 2, at_dims);
+        rot_tensor_t a = create_random_tensor(arena, 2, a_dims);
+        rot_tensor_t b = create_random_tensor(arena, 2, b_dims);
+        rot_tensor_t b_packed = create_random_tensor(arena, 2, b_packed_dims);
+        rot_tensor_t c = create_random_tensor(arena, 2, c_dims);
+        rot_tensor_t ct = create_random_tensor(arena, 2, ct_dims);
+
+        float *at_data = ROT_tensor_get_data(at);
+        float *a_data = ROT_tensor_get_data(a);
+        const float *b_data = ROT_tensor_get_data(b);
+        float *b_packed_data = ROT_tensor_get_data(b_packed);
+        for (size_t row = 0;
+             row < k;
+             ++row) {
+                for (size_t col = 0;
+                     col < m;
+                     ++col) {
+                        a_data[col*k + row] = at_data[row*m + col];
+                }
+
+                for (size_t col = 0;
+                     col < n;
+                     ++col) {
+                        b_packed_data[row*n + col] = b_data[row*2*n + n + col];
+                }
+        }
+
+        rot_tensor_t a_view = ROT_tensor_view_transpose(arena, at, 0, 1);
+        rot_tensor_t b_view = ROT_tensor_view_slice(arena, b, 1, n, 2*n);
+        rot_tensor_t c_view = ROT_tensor_view_transpose(arena, ct, 0, 1);
+        MIN_UNIT_ASSERT((ROT_matmul(c, a, b_packed) == c) &&
+                        (ROT_matmul(c_view, a_view, b_view) == c_view),
+                        "Matmul of views failed\n");
+
+        const float *c_data = ROT_tensor_get_data(c);
+        for (size_t row = 0;
+             row < m;
+             ++row) {
+                for (size_t col = 0;
+                     col < n;
+                     ++col) {
+                        float expected = c_data[row*n + col];
+                        float actual = ROT_tensor_get_data(ct)[col*m + row];
+                        MIN_UNIT_ASSERT(fabsf(expected - actual) < 1e-4f,
+                                        "Matmul of views differs at (%zu, "
+                                        "%zu): %f vs %f\n",
+                                        row,
+                                        col,
+                                        expected,
+                                        actual);
+                }
+        }
+
+        float *saved = (float *)malloc(ROT_tensor_get_size(b));
+        assert(saved != NULL);
+        memcpy(saved, b_data, ROT_tensor_get_size(b));
+        MIN_UNIT_ASSERT(ROT_relu(b_view) == b_view,
+                        "ReLU of a column slice failed\n");
+        for (size_t i = 0;
+             i < k*2*n;
+             ++i) {
+                bool is_in_view = ((i % (2*n)) >= n);
+                float expected = (is_in_view && (saved[i] < 0.0f)) ?
+                                 0.0f : saved[i];
+                MIN_UNIT_ASSERT(b_data[i] == expected,
+                                "ReLU of a column slice wrote element %zu\n",
+                                i);
+        }
+
+        free(saved);
+        free(memory);
+}
+
+#define CONCURRENT_NUM_THREADS 8
+#define CONCURRENT_ALLOCS_PER_THREAD 2048
+
+/**
+ * struct concurrent_alloc_state - Arena shared by the threads of
+ * test_arena_concurrent, and the allocations made by one thread.
+ */
+struct concurrent_alloc_state {
+        rot_arena_t arena;
+        uint8_t thread_i;
+        uint8_t *cpu[CONCURRENT_ALLOCS_PER_THREAD];
+        uint8_t *gpu[CONCURRENT_ALLOCS_PER_THREAD];
+};
+
+/**
+ * concurrent_alloc_size() - Size of the `alloc_i`th allocation of a thread,
+ * varied so that threads race with different alignments.
+ */
+static size_t
+concurrent_alloc_size(uint32_t alloc_i)
+{
+        return 1 + (alloc_i % 37);
+}
+
+/**
+ * concurrent_alloc() - Allocates from the shared arena and fills every
+ * allocation with the thread's index.
+ */
+static void *
+concurrent_alloc(void *context)
+{
+        struct concurrent_alloc_state *state =
+                (struct concurrent_alloc_state *)context;
+
+        for (uint32_t alloc_i = 0;
+             alloc_i < CONCURRENT_ALLOCS_PER_THREAD;
+             ++alloc_i) {
+                size_t size = concurrent_alloc_size(alloc_i);
+                state->cpu[alloc_i] =
+                        (uint8_t *)ROT_arena_malloc_aligned(state->arena,
+                                                            size,
+                                                            1 << (alloc_i % 4),
+                                                            ROT_BACKEND_CPU);
+                state->gpu[alloc_i] =
+                        (uint8_t *)ROT_arena_malloc(state->arena,
+                                                    size,
+                                                    ROT_BACKEND_CUDA);
+                if (state->cpu[alloc_i] != NULL)
+                        memset(state->cpu[alloc_i], state->thread_i, size);
+                if (state->gpu[alloc_i] != NULL)
+                        memset(state->gpu[alloc_i], state->thread_i, size);
+        }
+
+        return NULL;
+}
+
+/**
+ * test_arena_concurrent() - Tests allocation from one arena by many threads.
+ *
+ * Pass criteria: with threads racing to allocate CPU memory and GPU blocks
+ * from the same arena, every CPU allocation must succeed, no two allocations
+ * may overlap, so each still holds its thread's index afterwards, and the GPU
+ * blocks, which are too small for every request, must fill up without
+ * handing out overlapping ranges.
+ *
+ * NOTE(brendan): As in test_arena_rewind, host buffers stand in for GPU
+ * blocks.
+ */
+MIN_UNIT_TEST_FUNC(test_arena_concurrent)
+{
+        const size_t memory_size = 4*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const uint32_t num_blocks = 4;
+        const size_t block_bytes = 64*1024;
+        uint8_t *gpu_memory = (uint8_t *)malloc(num_blocks*block_bytes);
+        assert(gpu_memory != NULL);
+        void *gpu_blocks[num_blocks];
+        for (uint32_t block_i = 0;
+             block_i < num_blocks;
+             ++block_i) {
+                gpu_blocks[block_i] = gpu_memory + block_i*block_bytes;
+        }
+        MIN_UNIT_ASSERT(ROT_arena_gpu_new(arena,
+                                          gpu_blocks,
+                                          block_bytes,
+                                          num_blocks) == arena,
+                        "ROT_arena_gpu_new failed\n");
+
+        struct concurrent_alloc_state *states =
+                (struct concurrent_alloc_state *)malloc(
+                        CONCURRENT_NUM_THREADS*sizeof(*states));
+        assert(states != NULL);
+        pthread_t threads[CONCURRENT_NUM_THREADS];
+        for (uint32_t thread_i = 0;
+             thread_i < CONCURRENT_NUM_THREADS;
+             ++thread_i) {
+                states[thread_i].arena = arena;
+                states[thread_i].thread_i = (uint8_t)(thread_i + 1);
+                int status = pthread_create(threads + thread_i,
+                                            NULL,
+                                            concurrent_alloc,
+                                            states + thread_i);
+                assert(status == 0);
+        }
+
+        for (uint32_t thread_i = 0;
+             thread_i < CONCURRENT_NUM_THREADS;
+             ++thread_i) {
+                pthread_join(threads[thread_i], NULL);
+        }
+
+        size_t num_gpu_allocs = 0;
+        for (uint32_t thread_i = 0;
+             thread_i < CONCURRENT_NUM_THREADS;
+             ++thread_i) {
+                const struct concurrent_alloc_state *state = states + thread_i;
+                for (uint32_t alloc_i = 0;
+                     alloc_i < CONCURRENT_ALLOCS_PER_THREAD;
+                     ++alloc_i) {
+                        size_t size = concurrent_alloc_size(alloc_i);
+                        MIN_UNIT_ASSERT(state->cpu[alloc_i] != NULL,
+                                        "Concurrent CPU allocation failed\n");
+                        for (size_t i = 0;
+                             i < size;
+                             ++i) {
+                                MIN_UNIT_ASSERT(
+                                        (state->cpu[alloc_i][i] ==
+                                         state->thread_i) &&
+                                        ((state->gpu[alloc_i] == NULL) ||
+                                         (state->gpu[alloc_i][i] ==
+                                          state->thread_i)),
+                                        "Concurrent allocations overlap\n");
+                        }
+
+                        if (state->gpu[alloc_i] != NULL)
+                                ++num_gpu_allocs;
+                }
+        }
+
+        const size_t total_allocs = (CONCURRENT_NUM_THREADS*
+                                     CONCURRENT_ALLOCS_PER_THREAD);
+        MIN_UNIT_ASSERT((num_gpu_allocs > 0) && (num_gpu_allocs < total_allocs),
+                        "Expected the GPU blocks to fill up, got %zu of %zu "
+                        "allocations\n",
+                        num_gpu_allocs,
+                        total_allocs);
+
+        free(states);
+        free(gpu_memory);
+        free(memory);
+}
+
+/**
+ * run_chain() - Runs x -> relu(w[0]*x) -> ... -> relu(w[L - 1]*...), with
+ * the activation of layer i stored in `act[i]`.
+ */
+static rot_tensor_t
+run_chain(rot_tensor_t *act, rot_tensor_t *w, rot_tensor_t x)
+{
+        rot_tensor_t input = x;
+        for (uint32_t layer_i = 0;
+             layer_i < PLAN_CHAIN_NUM_LAYERS;
+             ++layer_i) {
+                if ((ROT_matmul(act[layer_i], w[layer_i], input) == NULL) ||
+                    (ROT_relu(act[layer_i]) == NULL))
+                        return NULL;
+                input = act[layer_i];
+        }
+
+        return input;
+}
+
+/**
+ * test_plan_chain() - Tests static memory planning of a chain of layers.
+ *
+ * Pass criteria: for a chain of matmul and ReLU layers, the planned region
+ * must be at least 3x smaller than the sum of the activations, the output
+ * computed in the planned region must be identical to the output computed in
+ * separately allocated tensors, and an activation kept with ROT_plan_keep must
+ * not be overwritten by later layers. A plan of no tensors is rejected.
+ */
+MIN_UNIT_TEST_FUNC(test_plan_chain)
+{
+        const size_t memory_size = 16*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const size_t h = 16 + rand_dim(48);
+        const size_t n = rand_dim(32);
+        const size_t w_dims[] = {h, h};
+        const size_t act_dims[] = {h, n};
+        rot_tensor_t x = create_random_tensor(arena, 2, act_dims);
+        rot_tensor_t w[PLAN_CHAIN_NUM_LAYERS];
+        rot_tensor_t act[PLAN_CHAIN_NUM_LAYERS];
+        rot_tensor_t planned_act[PLAN_CHAIN_NUM_LAYERS];
+
+        rot_plan_t plan = ROT_plan_new(arena, PLAN_CHAIN_NUM_LAYERS);
+        MIN_UNIT_ASSERT(plan != NULL, "ROT_plan_new failed\n");
+
+        const uint32_t kept_i = PLAN_CHAIN_NUM_LAYERS/2;
+        for (uint32_t layer_i = 0;
+             layer_i < PLAN_CHAIN_NUM_LAYERS;
+             ++layer_i) {
+                w[layer_i] = create_random_tensor(arena, 2, w_dims);
+                act[layer_i] = create_random_tensor(arena, 2, act_dims);
+                planned_act[layer_i] = ROT_plan_create_tensor(plan,
+                                                              2,
+                                                              act_dims);
+                MIN_UNIT_ASSERT(planned_act[layer_i] != NULL,
+                                "ROT_plan_create_tensor failed\n");
+
+                rot_tensor_t input = ((layer_i == 0) ?
+                                      x : planned_act[layer_i - 1]);
+                rot_tensor_t matmul_tensors[] = {planned_act[layer_i],
+                                                 w[layer_i],
+                                                 input};
+                MIN_UNIT_ASSERT((ROT_plan_record_op(plan,
+                                                    matmul_tensors,
+                                                    3) == plan) &&
+                                (ROT_plan_record_op(plan,
+                                                    &planned_act[layer_i],
+                                                    1) == plan),
+                                "ROT_plan_record_op failed\n");
+        }
+
+        MIN_UNIT_ASSERT(ROT_plan_keep(plan, planned_act[kept_i]) == plan,
+                        "ROT_plan_keep failed\n");
+        MIN_UNIT_ASSERT(ROT_plan_allocate(plan) == plan,
+                        "ROT_plan_allocate failed\n");
+
+        size_t peak_bytes = ROT_plan_get_peak_bytes(plan);
+        size_t bump_bytes = ROT_plan_get_bump_bytes(plan);
+        printf("Memory plan: %zu bytes planned, %zu bytes bump-allocated\n",
+               peak_bytes,
+               bump_bytes);
+        MIN_UNIT_ASSERT((peak_bytes > 0) && (3*peak_bytes <= bump_bytes),
+                        "Planned peak %zu bytes is not 3x smaller than bump "
+                        "peak %zu bytes\n",
+                        peak_bytes,
+                        bump_bytes);
+
+        rot_tensor_t out = run_chain(act, w, x);
+        rot_tensor_t planned_out = run_chain(planned_act, w, x);
+        MIN_UNIT_ASSERT((out != NULL) && (planned_out != NULL),
+                        "Running chain failed\n");
+        MIN_UNIT_ASSERT(memcmp(ROT_tensor_get_data(out),
+                               ROT_tensor_get_data(planned_out),
+                               ROT_tensor_get_size(out)) == 0,
+                        "Planned output differs\n");
+        MIN_UNIT_ASSERT(memcmp(ROT_tensor_get_data(act[kept_i]),
+                               ROT_tensor_get_data(planned_act[kept_i]),
+                               ROT_tensor_get_size(out)) == 0,
+                        "Kept activation was overwritten\n");
+
+        MIN_UNIT_ASSERT(ROT_plan_new(arena, 0) == NULL,
+                        "ROT_plan_new accepted no tensors\n");
+
+        free(memory);
+}
@@ -0,0 +1,2782 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "tests/test_nn.h"
+#include "rot_arena.h"        /* for rot_arena_t, ROT_arena_new */
+#include "rot_math.h"         /* for ROT_create_tensor, ROT_tensor_get_data */
+#include "rot_nn.h"           /* for ROT_linear, ROT_relu, ROT_unary, ... */
+#include "rot_optim.h"        /* for rot_optim_t, ROT_optim_step */
+#include "rot_platform.h"     /* for ROT_BACKEND_CPU */
+#include "rot_tape.h"         /* for rot_tape_t, ROT_backward */
+#include "tests/test_math.h"  /* for rand_dim */
+
+#include <assert.h>           /* for assert */
+#include <float.h>            /* for FLT_EPSILON, FLT_MIN, FLT_MAX */
+#include <math.h>             /* for exp, fabs, tanh, erfc, frexp */
+#include <stdint.h>           /* for UINT32_MAX, uint8_t, uint32_t */
+#include <stdio.h>            /* for printf */
+#include <stdlib.h>           /* for free, malloc, rand */
+#include <string.h>           /* for memcmp, memcpy, memset */
+#include <time.h>             /* for clock_gettime, timespec */
+
+/**
+ * create_uniform_tensor() - Allocates a CPU tensor from `arena` and fills it
+ * with samples from a uniform distribution over [-a, a].
+ */
+static rot_tensor_t
+create_uniform_tensor(rot_arena_t arena,
+                      uint32_t num_dims,
+                      const size_t *dims,
+                      float a)
+{
+        rot_tensor_t tensor = ROT_create_tensor(arena,
+                                                num_dims,
+                                                dims,
+                                                ROT_BACKEND_CPU);
+        assert(tensor != NULL);
+
+        float *data = ROT_tensor_get_data(tensor);
+        size_t num_elems = ROT_tensor_get_size(tensor)/sizeof(float);
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                data[i] = a*(2.0f*rand()/(float)RAND_MAX - 1.0f);
+        }
+
+        return tensor;
+}
+
+/**
+ * reference_activation() - Double precision reference for `activation`.
+ */
+static double
+reference_activation(double x, enum rot_activation activation)
+{
+        switch (activation) {
+        case ROT_ACTIVATION_RELU:
+                return (x > 0.0) ? x : 0.0;
+        case ROT_ACTIVATION_SIGMOID:
+                return 1.0/(1.0 + exp(-x));
+        case ROT_ACTIVATION_TANH:
+                return tanh(x);
+        case ROT_ACTIVATION_GELU:
+                return 0.5*x*(1.0 + tanh(0.7978845608*(x + 0.044715*x*x*x)));
+        case ROT_ACTIVATION_GELU_ERF:
+                return 0.5*x*erfc(-x/sqrt(2.0));
+        default:
+                return x;
+        }
+}
+
+/**
+ * test_linear() - Correctness test for the fused linear layer.
+ *
+ * Pass criteria: for random (small and valid) dimensions, and for every
+ * activation, ROT_linear must match activation(w*x + bias) computed in double
+ * precision, both with and without a bias.
+ */
+MIN_UNIT_TEST_FUNC(test_linear)
+{
+        const size_t memory_size = 16*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const size_t m = rand_dim(64);
+        const size_t k = rand_dim(64);
+        const size_t n = rand_dim(64);
+        const size_t w_dims[] = {m, k};
+        const size_t x_dims[] = {k, n};
+        const size_t bias_dims[] = {m};
+        const size_t result_dims[] = {m, n};
+        rot_tensor_t w = create_uniform_tensor(arena, 2, w_dims, 1.0f);
+        rot_tensor_t x = create_uniform_tensor(arena, 2, x_dims, 1.0f);
+        rot_tensor_t bias = create_uniform_tensor(arena, 1, bias_dims, 1.0f);
+        rot_tensor_t result = create_uniform_tensor(arena,
+                                                    2,
+                                                    result_dims,
+                                                    1.0f);
+
+        const float *w_data = ROT_tensor_get_data(w);
+        const float *x_data = ROT_tensor_get_data(x);
+        const float *bias_data = ROT_tensor_get_data(bias);
+        const float *result_data = ROT_tensor_get_data(result);
+
+        const enum rot_activation activations[] = {ROT_ACTIVATION_NONE,
+                                                   ROT_ACTIVATION_RELU,
+                                                   ROT_ACTIVATION_SIGMOID,
+                                                   ROT_ACTIVATION_TANH,
+                                                   ROT_ACTIVATION_GELU,
+                                                   ROT_ACTIVATION_GELU_ERF};
+        for (uint32_t act_i = 0;
+             act_i < sizeof(activations)/sizeof(activations[0]);
+             ++act_i) {
+                for (uint32_t has_bias = 0;
+                     has_bias < 2;
+                     ++has_bias) {
+                        rot_tensor_t out = ROT_linear(result,
+                                                      w,
+                                                      x,
+                                                      has_bias ? bias : NULL,
+                                                      activations[act_i]);
+                        MIN_UNIT_ASSERT(out == result,
+                                        "ROT_linear failed for activation "
+                                        "%u\n",
+                                        activations[act_i]);
+
+                        for (size_t i = 0;
+                             i < m;
+                             ++i) {
+                                for (size_t j = 0;
+                                     j < n;
+                                     ++j) {
+                                        double expected =
+                                                has_bias ? bias_data[i] : 0.0;
+                                        for (size_t p = 0;
+                                             p < k;
+                                             ++p) {
+                                                expected += (w_data[i*k + p]*
+                                                             x_data[p*n + j]);
+                                        }
+                                        expected = reference_activation(
+                                                expected,
+                                                activations[act_i]);
+
+                                        double diff = (result_data[i*n + j] -
+                                                       expected);
+                                        MIN_UNIT_ASSERT(
+                                                fabs(diff) < 128*FLT_EPSILON,
+                                                "ROT_linear mismatch for "
+                                                "activation %u\n",
+                                                activations[act_i]);
+                                }
+                        }
+                }
+        }
+
+        const size_t bad_bias_dims[] = {m + 1};
+        rot_tensor_t bad_bias = create_uniform_tensor(arena,
+                                                      1,
+                                                      bad_bias_dims,
+                                                      1.0f);
+        MIN_UNIT_ASSERT(ROT_linear(result,
+                                   w,
+                                   x,
+                                   bad_bias,
+                                   ROT_ACTIVATION_NONE) == NULL,
+                        "ROT_linear accepted a bias of the wrong size\n");
+
+        free(memory);
+}
+
+/**
+ * get_time_sec() - Monotonic wall clock time in seconds.
+ */
+static double
+get_time_sec(void)
+{
+        struct timespec now;
+        int status = clock_gettime(CLOCK_MONOTONIC, &now);
+        assert(status == 0);
+
+        return now.tv_sec + 1e-9*now.tv_nsec;
+}
+
+/**
+ * check_relu() - Returns true if `out` is max(`in`, 0) elementwise.
+ */
+static bool
+check_relu(const float *in, const float *out, size_t num_elems)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                float expected = (in[i] > 0.0f) ? in[i] : 0.0f;
+                if (out[i] != expected)
+                        return false;
+        }
+
+        return true;
+}
+
+/**
+ * test_relu() - Correctness test for in-place and out-of-place ReLU.
+ *
+ * Pass criteria: ROT_relu_out and ROT_relu must clamp every element of a
+ * multi-column tensor (not just the first column), for sizes both smaller and
+ * larger than the threshold where ReLU goes multi-threaded, and ReLU must
+ * reject mismatched output sizes.
+ */
+MIN_UNIT_TEST_FUNC(test_relu)
+{
+        const size_t memory_size = 64*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const size_t small_dims[] = {rand_dim(64), rand_dim(64)};
+        const size_t large_dims[] = {1024 + rand_dim(64), 1024};
+        const size_t *all_dims[] = {small_dims, large_dims};
+        for (uint32_t dims_i = 0;
+             dims_i < sizeof(all_dims)/sizeof(all_dims[0]);
+             ++dims_i) {
+                rot_tensor_t in = create_uniform_tensor(arena,
+                                                        2,
+                                                        all_dims[dims_i],
+                                                        1.0f);
+                rot_tensor_t out = create_uniform_tensor(arena,
+                                                         2,
+                                                         all_dims[dims_i],
+                                                         1.0f);
+                const float *in_data = ROT_tensor_get_data(in);
+                float *out_data = ROT_tensor_get_data(out);
+                size_t num_elems = ROT_tensor_get_size(in)/sizeof(float);
+
+                MIN_UNIT_ASSERT(ROT_relu_out(out, in) == out,
+                                "ROT_relu_out failed\n");
+                MIN_UNIT_ASSERT(check_relu(in_data, out_data, num_elems),
+                                "ROT_relu_out mismatch\n");
+
+                memcpy(out_data, in_data, ROT_tensor_get_size(in));
+                MIN_UNIT_ASSERT(ROT_relu(out) == out, "ROT_relu failed\n");
+                MIN_UNIT_ASSERT(check_relu(in_data, out_data, num_elems),
+                                "ROT_relu mismatch\n");
+        }
+
+        const size_t bad_dims[] = {small_dims[0] + 1, small_dims[1]};
+        rot_tensor_t in = create_uniform_tensor(arena, 2, small_dims, 1.0f);
+        rot_tensor_t bad_out = create_uniform_tensor(arena, 2, bad_dims, 1.0f);
+        MIN_UNIT_ASSERT(ROT_relu_out(bad_out, in) == NULL,
+                        "ROT_relu_out accepted an output of the wrong size\n");
+
+        free(memory);
+}
+
+/**
+ * test_relu_grad() - Correctness test for the ReLU backward pass.
+ *
+ * Pass criteria: ROT_relu_grad must zero exactly the gradient elements whose
+ * activations are not positive, both out of place and in place, for sizes
+ * both smaller and larger than the threshold where it goes multi-threaded, and
+ * must reject mismatched sizes.
+ */
+MIN_UNIT_TEST_FUNC(test_relu_grad)
+{
+        const size_t memory_size = 64*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const size_t small_dims[] = {rand_dim(64), rand_dim(64)};
+        const size_t large_dims[] = {1024 + rand_dim(64), 1024};
+        const size_t *all_dims[] = {small_dims, large_dims};
+        for (uint32_t dims_i = 0;
+             dims_i < sizeof(all_dims)/sizeof(all_dims[0]);
+             ++dims_i) {
+                const size_t *dims = all_dims[dims_i];
+                rot_tensor_t act = create_uniform_tensor(arena, 2, dims, 1.0f);
+                rot_tensor_t in_grad = create_uniform_tensor(arena,
+                                                             2,
+                                                             dims,
+                                                             1.0f);
+                rot_tensor_t out_grad = create_uniform_tensor(arena,
+                                                              2,
+                                                              dims,
+                                                              1.0f);
+                MIN_UNIT_ASSERT(ROT_relu(act) == act, "ROT_relu failed\n");
+
+                const float *act_data = ROT_tensor_get_data(act);
+                float *in_data = ROT_tensor_get_data(in_grad);
+                const float *out_data = ROT_tensor_get_data(out_grad);
+                size_t num_elems = ROT_tensor_get_size(act)/sizeof(float);
+
+                MIN_UNIT_ASSERT(ROT_relu_grad(out_grad,
+                                              in_grad,
+                                              act) == out_grad,
+                                "ROT_relu_grad failed\n");
+                for (size_t i = 0;
+                     i < num_elems;
+                     ++i) {
+                        float expected = ((act_data[i] > 0.0f) ?
+                                          in_data[i] : 0.0f);
+                        MIN_UNIT_ASSERT(out_data[i] == expected,
+                                        "ROT_relu_grad mismatch\n");
+                }
+
+                MIN_UNIT_ASSERT(ROT_relu_grad(in_grad,
+                                              in_grad,
+                                              act) == in_grad,
+                                "In-place ROT_relu_grad failed\n");
+                MIN_UNIT_ASSERT(memcmp(in_data,
+                                       out_data,
+                                       ROT_tensor_get_size(act)) == 0,
+                                "In-place ROT_relu_grad mismatch\n");
+        }
+
+        const size_t bad_dims[] = {small_dims[0] + 1, small_dims[1]};
+        rot_tensor_t act = create_uniform_tensor(arena, 2, small_dims, 1.0f);
+        rot_tensor_t bad_grad = create_uniform_tensor(arena, 2, bad_dims, 1.0f);
+        MIN_UNIT_ASSERT(ROT_relu_grad(bad_grad, bad_grad, act) == NULL,
+                        "ROT_relu_grad accepted a gradient of the wrong "
+                        "size\n");
+
+        free(memory);
+}
+
+/**
+ * test_relu_perf() - Benchmarks ReLU against memory bandwidth.
+ *
+ * NNPACK-class ReLU implementations are bound by memory bandwidth, so the
+ * baseline is a memcpy of the same buffer: both read and write every byte
+ * once.
+ *
+ * Pass criteria: out-of-place ReLU on a tensor much larger than the last level
+ * cache reaches at least half of memcpy throughput.
+ */
+MIN_UNIT_TEST_FUNC(test_relu_perf)
+{
+        const size_t dims[] = {4096, 4096};
+        const size_t memory_size = 3*dims[0]*dims[1]*sizeof(float);
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        rot_tensor_t in = create_uniform_tensor(arena, 2, dims, 1.0f);
+        rot_tensor_t out = create_uniform_tensor(arena, 2, dims, 1.0f);
+        const size_t size = ROT_tensor_get_size(in);
+
+        /* NOTE(brendan): Warm up both paths to fault in pages and threads. */
+        memcpy(ROT_tensor_get_data(out), ROT_tensor_get_data(in), size);
+        ROT_relu_out(out, in);
+
+        constexpr uint32_t num_iters = 16;
+        double start = get_time_sec();
+        for (uint32_t i = 0;
+             i < num_iters;
+             ++i) {
+                memcpy(ROT_tensor_get_data(out), ROT_tensor_get_data(in), size);
+        }
+        double memcpy_sec = get_time_sec() - start;
+
+        start = get_time_sec();
+        for (uint32_t i = 0;
+             i < num_iters;
+             ++i) {
+                MIN_UNIT_ASSERT(ROT_relu_out(out, in) == out,
+                                "ROT_relu_out failed\n");
+        }
+        double relu_sec = get_time_sec() - start;
+
+        const double gbytes = 2.0*num_iters*size/1e9;
+        printf("ReLU: %.2f GB/s, memcpy: %.2f GB/s\n",
+               gbytes/relu_sec,
+               gbytes/memcpy_sec);
+        MIN_UNIT_ASSERT(relu_sec < 2.0*memcpy_sec,
+                        "ReLU is less than half as fast as memcpy\n");
+
+        free(memory);
+}
+
+/**
+ * struct unary_test - An op of ROT_unary, with the input range it is tested
+ * on and the error bound documented for that range.
+ */
+struct unary_test {
+        enum rot_unary_op op;
+        float lo;
+        float hi;
+        double max_ulp;
+};
+
+static const struct unary_test unary_tests[] = {
+        {ROT_UNARY_EXP, -87.3f, 88.7f, 1.01},
+        {ROT_UNARY_LOG, -149.0f, 127.9f, 0.83},
+        {ROT_UNARY_SIGMOID, -87.0f, 87.0f, 2.5},
+        {ROT_UNARY_TANH, -20.0f, 20.0f, 1.33},
+        {ROT_UNARY_GELU, -3.0f, 20.0f, 16.5},
+        {ROT_UNARY_GELU_ERF, -13.0f, 13.0f, 8.5},
+};
+
+/**
+ * struct unary_special_test - An op of ROT_unary, with its results for the
+ * inputs in `unary_special_inputs`, where NAN stands for any NaN.
+ */
+struct unary_special_test {
+        enum rot_unary_op op;
+        float expected[4];
+};
+
+/**
+ * NOTE(brendan): -100 is below the range of exp, so it checks that exp
+ * flushes to 0.
+ */
+static const float unary_special_inputs[] = {NAN,
+                                             INFINITY,
+                                             -INFINITY,
+                                             -100.0f};
+
+static const struct unary_special_test unary_special_tests[] = {
+        {ROT_UNARY_RELU, {0.0f, INFINITY, 0.0f, 0.0f}},
+        {ROT_UNARY_EXP, {NAN, INFINITY, 0.0f, 0.0f}},
+        {ROT_UNARY_LOG, {NAN, INFINITY, NAN, NAN}},
+        {ROT_UNARY_SIGMOID, {NAN, 1.0f, 0.0f, 0.0f}},
+        {ROT_UNARY_TANH, {NAN, 1.0f, -1.0f, -1.0f}},
+        {ROT_UNARY_GELU, {NAN, INFINITY, -0.0f, -0.0f}},
+        {ROT_UNARY_GELU_ERF, {NAN, INFINITY, -0.0f, -0.0f}},
+};
+
+/**
+ * is_same_special() - Returns true if `actual` is `expected`, including the
+ * sign of zeros, or if both are NaN.
+ */
+static bool
+is_same_special(float actual, float expected)
+{
+        if (isnan(expected))
+                return isnan(actual);
+
+        return ((actual == expected) &&
+                (signbit(actual) == signbit(expected)));
+}
+
+/**
+ * reference_unary() - Double precision reference for `op`.
+ */
+static double
+reference_unary(double x, enum rot_unary_op op)
+{
+        switch (op) {
+        case ROT_UNARY_RELU:
+                return (x > 0.0) ? x : 0.0;
+        case ROT_UNARY_EXP:
+                return exp(x);
+        case ROT_UNARY_LOG:
+                return log(x);
+        case ROT_UNARY_SIGMOID:
+                return 1.0/(1.0 + exp(-x));
+        case ROT_UNARY_TANH:
+                return tanh(x);
+        case ROT_UNARY_GELU:
+                /* NOTE(brendan): As x*sigmoid(2u), which does not cancel. */
+                return x/(1.0 + exp(-1.5957691216057308*
+                                    (x + 0.044715*x*x*x)));
+        case ROT_UNARY_GELU_ERF:
+                return 0.5*x*erfc(-x/sqrt(2.0));
+        default:
+                return x;
+        }
+}
+
+/**
+ * libm_unary() - `op` written with single precision libm calls, as the
+ * baseline for ROT_unary.
+ */
+static float
+libm_unary(float x, enum rot_unary_op op)
+{
+        switch (op) {
+        case ROT_UNARY_RELU:
+                return fmaxf(x, 0.0f);
+        case ROT_UNARY_EXP:
+                return expf(x);
+        case ROT_UNARY_LOG:
+                return logf(x);
+        case ROT_UNARY_SIGMOID:
+                return 1.0f/(1.0f + expf(-x));
+        case ROT_UNARY_TANH:
+                return tanhf(x);
+        case ROT_UNARY_GELU:
+                return 0.5f*x*(1.0f + tanhf(0.7978845608f*
+                                            (x + 0.044715f*x*x*x)));
+        case ROT_UNARY_GELU_ERF:
+                return 0.5f*x*erfcf(-x*0.7071067812f);
+        default:
+                return x;
+        }
+}
+
+/**
+ * fill_unary_inputs() - Fills `data` with `num_elems` evenly spaced inputs
+ * over the range of `test`. For log, the range is of exponents, so that the
+ * inputs are spread over every binade including the denormals.
+ */
+static void
+fill_unary_inputs(float *data, size_t num_elems, const struct unary_test *test)
+{
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                double t = test->lo + (test->hi - test->lo)*i/(num_elems - 1.0);
+                data[i] = (test->op == ROT_UNARY_LOG) ? exp2(t) : t;
+        }
+}
+
+/**
+ * max_ulp_error() - Returns the largest error of `actual` in units in the last
+ * place of the double precision reference for `op`, over the elements whose
+ * reference is a normal float.
+ */
+static double
+max_ulp_error(const float *in,
+              const float *actual,
+              size_t num_elems,
+              enum rot_unary_op op)
+{
+        double max_error = 0.0;
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                double expected = reference_unary(in[i], op);
+                double magnitude = fabs(expected);
+                if (!(magnitude >= FLT_MIN) || !(magnitude <= FLT_MAX))
+                        continue;
+
+                int exponent;
+                frexp(expected, &exponent);
+                double error = fabs(actual[i] - expected)/ldexp(1.0,
+                                                                exponent - 24);
+                if (!(error <= max_error))
+                        max_error = error;
+        }
+
+        return max_error;
+}
+
+/**
+ * test_unary() - Accuracy test for the SIMD elementwise math ops.
+ *
+ * Pass criteria: out-of-place and in-place ROT_unary must be within the error
+ * bounds documented in enum rot_unary_op over evenly spaced inputs, for
+ * tensors both smaller and larger than the threshold where elementwise ops go
+ * multi-threaded, log must get its special values right, every op must give
+ * its documented results for NaN and infinite inputs, and ROT_unary_out must
+ * reject mismatched output sizes.
+ */
+MIN_UNIT_TEST_FUNC(test_unary)
+{
+        const size_t memory_size = 64*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const size_t small_dims[] = {rand_dim(64), rand_dim(64)};
+        const size_t large_dims[] = {1024 + rand_dim(64), 1021};
+        const size_t *all_dims[] = {small_dims, large_dims};
+        for (uint32_t dims_i = 0;
+             dims_i < sizeof(all_dims)/sizeof(all_dims[0]);
+             ++dims_i) {
+                rot_tensor_t in = ROT_create_tensor(arena,
+                                                    2,
+                                                    all_dims[dims_i],
+                                                    ROT_BACKEND_CPU);
+                rot_tensor_t out = ROT_create_tensor(arena,
+                                                     2,
+                                                     all_dims[dims_i],
+                                                     ROT_BACKEND_CPU);
+                assert((in != NULL) && (out != NULL));
+                float *in_data = ROT_tensor_get_data(in);
+                float *out_data = ROT_tensor_get_data(out);
+                size_t num_elems = ROT_tensor_get_size(in)/sizeof(float);
+
+                for (uint32_t test_i = 0;
+                     test_i < sizeof(unary_tests)/sizeof(unary_tests[0]);
+                     ++test_i) {
+                        const struct unary_test *test = unary_tests + test_i;
+                        fill_unary_inputs(in_data, num_elems, test);
+
+                        MIN_UNIT_ASSERT(ROT_unary_out(out, in, test->op) == out,
+                                        "ROT_unary_out failed for op %u\n",
+                                        test->op);
+                        double error = max_ulp_error(in_data,
+                                                     out_data,
+                                                     num_elems,
+                                                     test->op);
+                        MIN_UNIT_ASSERT(error <= test->max_ulp,
+                                        "ROT_unary_out op %u off by %.2f "
+                                        "ULP\n",
+                                        test->op,
+                                        error);
+
+                        memcpy(out_data, in_data, ROT_tensor_get_size(in));
+                        MIN_UNIT_ASSERT(ROT_unary(out, test->op) == out,
+                                        "ROT_unary failed for op %u\n",
+                                        test->op);
+                        error = max_ulp_error(in_data,
+                                              out_data,
+                                              num_elems,
+                                              test->op);
+                        MIN_UNIT_ASSERT(error <= test->max_ulp,
+                                        "ROT_unary op %u off by %.2f ULP\n",
+                                        test->op,
+                                        error);
+                }
+        }
+
+        const size_t special_dims[] = {4};
+        rot_tensor_t special = ROT_create_tensor(arena,
+                                                 1,
+                                                 special_dims,
+                                                 ROT_BACKEND_CPU);
+        assert(special != NULL);
+        float *special_data = ROT_tensor_get_data(special);
+        special_data[0] = 0.0f;
+        special_data[1] = -1.0f;
+        special_data[2] = INFINITY;
+        special_data[3] = NAN;
+        MIN_UNIT_ASSERT(ROT_unary(special, ROT_UNARY_LOG) == special,
+                        "ROT_unary failed for log special values\n");
+        MIN_UNIT_ASSERT((special_data[0] == -INFINITY) &&
+                        isnan(special_data[1]) &&
+                        (special_data[2] == INFINITY) &&
+                        isnan(special_data[3]),
+                        "log special values mismatch\n");
+
+        const size_t num_special = (sizeof(unary_special_inputs)/
+                                    sizeof(unary_special_inputs[0]));
+        for (uint32_t test_i = 0;
+             test_i < (sizeof(unary_special_tests)/
+                       sizeof(unary_special_tests[0]));
+             ++test_i) {
+                const struct unary_special_test *test =
+                        unary_special_tests + test_i;
+                memcpy(special_data,
+                       unary_special_inputs,
+                       sizeof(unary_special_inputs));
+                MIN_UNIT_ASSERT(ROT_unary(special, test->op) == special,
+                                "ROT_unary failed for op %u special values\n",
+                                test->op);
+                for (size_t i = 0;
+                     i < num_special;
+                     ++i) {
+                        MIN_UNIT_ASSERT(is_same_special(special_data[i],
+                                                        test->expected[i]),
+                                        "op %u gave %g for %g\n",
+                                        test->op,
+                                        special_data[i],
+                                        unary_special_inputs[i]);
+                }
+        }
+
+        const size_t bad_dims[] = {small_dims[0] + 1, small_dims[1]};
+        rot_tensor_t in = create_uniform_tensor(arena, 2, small_dims, 1.0f);
+        rot_tensor_t bad_out = create_uniform_tensor(arena, 2, bad_dims, 1.0f);
+        MIN_UNIT_ASSERT(ROT_unary_out(bad_out, in, ROT_UNARY_EXP) == NULL,
+                        "ROT_unary_out accepted an output of the wrong "
+                        "size\n");
+
+        free(memory);
+}
+
+/**
+ * test_unary_perf() - Benchmarks the SIMD elementwise math ops against libm.
+ *
+ * For each op, prints the throughput and the largest error in ULP on the
+ * op's test range of both ROT_unary_out and a loop of the equivalent libm
+ * calls.
+ *
+ * Pass criteria: every op is at least half as fast as libm, which it can only
+ * fall below if dispatch overhead swamps the kernels on CPUs without SIMD
+ * kernels.
+ */
+MIN_UNIT_TEST_FUNC(test_unary_perf)
+{
+        const size_t dims[] = {1024, 1024};
+        const size_t memory_size = 4*dims[0]*dims[1]*sizeof(float);
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        rot_tensor_t in = ROT_create_tensor(arena, 2, dims, ROT_BACKEND_CPU);
+        rot_tensor_t out = ROT_create_tensor(arena, 2, dims, ROT_BACKEND_CPU);
+        assert((in != NULL) && (out != NULL));
+        float *in_data = ROT_tensor_get_data(in);
+        float *out_data = ROT_tensor_get_data(out);
+        const size_t num_elems = dims[0]*dims[1];
+
+        for (uint32_t test_i = 0;
+             test_i < sizeof(unary_tests)/sizeof(unary_tests[0]);
+             ++test_i) {
+                const struct unary_test *test = unary_tests + test_i;
+                fill_unary_inputs(in_data, num_elems, test);
+
+                /* NOTE(brendan): Warm up to fault in pages and threads. */
+                ROT_unary_out(out, in, test->op);
+
+                constexpr uint32_t num_iters = 4;
+                double start = get_time_sec();
+                for (uint32_t i = 0;
+                     i < num_iters;
+                     ++i) {
+                        MIN_UNIT_ASSERT(ROT_unary_out(out, in, test->op) == out,
+                                        "ROT_unary_out failed\n");
+                }
+                double rot_sec = get_time_sec() - start;
+                double rot_error = max_ulp_error(in_data,
+                                                 out_data,
+                                                 num_elems,
+                                                 test->op);
+
+                start = get_time_sec();
+                for (uint32_t i = 0;
+                     i < num_iters;
+                     ++i) {
+                        for (size_t j = 0;
+                             j < num_elems;
+                             ++j) {
+                                out_data[j] = libm_unary(in_data[j], test->op);
+                        }
+                }
+                double libm_sec = get_time_sec() - start;
+                double libm_error = max_ulp_error(in_data,
+                                                  out_data,
+                                                  num_elems,
+                                                  test->op);
+
+                const double gelems = 1e-9*num_iters*num_elems;
+                printf("op %u: %.2f Gelem/s, %.2f ULP; libm: %.2f Gelem/s, "
+                       "%.2f ULP\n",
+                       test->op,
+                       gelems/rot_sec,
+                       rot_error,
+                       gelems/libm_sec,
+                       libm_error);
+                MIN_UNIT_ASSERT(rot_sec < 2.0*libm_sec,
+                                "ROT_unary op %u is less than half as fast "
+                                "as libm\n",
+                                test->op);
+        }
+
+        free(memory);
+}
+
+/**
+ * check_grad() - Returns true if every element of `grad` is within `tolerance`
+ * of `expected`.
+ */
+static bool
+check_grad(rot_tensor_t grad, const double *expected, double tolerance)
+{
+        const float *grad_data = ROT_tensor_get_data(grad);
+        size_t num_elems = ROT_tensor_get_size(grad)/sizeof(float);
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                if (fabs(grad_data[i] - expected[i]) > tolerance)
+                        return false;
+        }
+
+        return true;
+}
+
+/**
+ * test_tape_backward() - Checks reverse-mode gradients of a two layer ReLU
+ * network recorded on a tape.
+ *
+ * The network is v1 = relu(w0*x), v2 = w1*v1, with w0 hxk, x kxn and w1 oxh.
+ * Given dL/dv2 = g, the reverse sweep is:
+ *
+ *     w1' = g*v1^T
+ *     v1' = (w1^T*g) masked by v1 > 0
+ *     w0' = v1'*x^T
+ *     x' = w0^T*v1'
+ *
+ * Pass criteria: for several steps on the same tape, each recording fresh
+ * activation tensors, ROT_backward must match the gradients above computed in
+ * double precision, must reuse the same gradient tensors after the first
+ * step, and must zero the gradient of a recorded tensor that the output does
+ * not depend on. Tapes of no ops, or of too many ops to count their entries,
+ * are rejected.
+ */
+MIN_UNIT_TEST_FUNC(test_tape_backward)
+{
+        const size_t memory_size = 16*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const size_t k = rand_dim(48);
+        const size_t h = rand_dim(48);
+        const size_t o = rand_dim(48);
+        const size_t n = rand_dim(16);
+        const size_t w0_dims[] = {h, k};
+        const size_t x_dims[] = {k, n};
+        const size_t w1_dims[] = {o, h};
+        const size_t v1_dims[] = {h, n};
+        const size_t v2_dims[] = {o, n};
+        rot_tensor_t w0 = create_uniform_tensor(arena, 2, w0_dims, 1.0f);
+        rot_tensor_t x = create_uniform_tensor(arena, 2, x_dims, 1.0f);
+        rot_tensor_t w1 = create_uniform_tensor(arena, 2, w1_dims, 1.0f);
+        rot_tensor_t g = create_uniform_tensor(arena, 2, v2_dims, 1.0f);
+        rot_tensor_t unused = create_uniform_tensor(arena, 2, v1_dims, 1.0f);
+
+        rot_tape_t tape = ROT_tape_new(arena, 4);
+        MIN_UNIT_ASSERT(tape != NULL, "ROT_tape_new failed\n");
+
+        double *w0_grad = (double *)malloc(h*k*sizeof(double));
+        double *x_grad = (double *)malloc(k*n*sizeof(double));
+        double *w1_grad = (double *)malloc(o*h*sizeof(double));
+        double *v1_grad = (double *)malloc(h*n*sizeof(double));
+        assert((w0_grad != NULL) && (x_grad != NULL) &&
+               (w1_grad != NULL) && (v1_grad != NULL));
+
+        rot_tensor_t first_w0_grad = NULL;
+        rot_tensor_t first_v1_grad = NULL;
+        for (uint32_t step = 0;
+             step < 8;
+             ++step) {
+                rot_tensor_t v1 = create_uniform_tensor(arena,
+                                                        2,
+                                                        v1_dims,
+                                                        1.0f);
+                rot_tensor_t v2 = create_uniform_tensor(arena,
+                                                        2,
+                                                        v2_dims,
+                                                        1.0f);
+                MIN_UNIT_ASSERT(ROT_tape_reset(tape) == tape,
+                                "ROT_tape_reset failed\n");
+                MIN_UNIT_ASSERT((ROT_tape_matmul(tape, v1, w0, x) == v1) &&
+                                (ROT_tape_relu(tape, v1) == v1) &&
+                                (ROT_tape_matmul(tape, v2, w1, v1) == v2) &&
+                                (ROT_tape_relu(tape, unused) == unused),
+                                "Recording on tape failed\n");
+                MIN_UNIT_ASSERT(ROT_backward(tape, v2, g) == tape,
+                                "ROT_backward failed\n");
+
+                const float *w0_data = ROT_tensor_get_data(w0);
+                const float *x_data = ROT_tensor_get_data(x);
+                const float *w1_data = ROT_tensor_get_data(w1);
+                const float *v1_data = ROT_tensor_get_data(v1);
+                const float *g_data = ROT_tensor_get_data(g);
+                for (size_t i = 0;
+                     i < o;
+                     ++i) {
+                        for (size_t j = 0;
+                             j < h;
+                             ++j) {
+                                double sum = 0.0;
+                                for (size_t p = 0;
+                                     p < n;
+                                     ++p) {
+                                        sum += g_data[i*n + p]*v1_data[j*n + p];
+                                }
+                                w1_grad[i*h + j] = sum;
+                        }
+                }
+
+                for (size_t i = 0;
+                     i < h;
+                     ++i) {
+                        for (size_t j = 0;
+                             j < n;
+                             ++j) {
+                                double sum = 0.0;
+                                for (size_t p = 0;
+                                     p < o;
+                                     ++p) {
+                                        sum += w1_data[p*h + i]*g_data[p*n + j];
+                                }
+                                v1_grad[i*n + j] =
+                                        (v1_data[i*n + j] > 0.0f) ? sum : 0.0;
+                        }
+                }
+
+                for (size_t i = 0;
+                     i < h;
+                     ++i) {
+                        for (size_t j = 0;
+                             j < k;
+                             ++j) {
+                                double sum = 0.0;
+                                for (size_t p = 0;
+                                     p < n;
+                                     ++p) {
+                                        sum += v1_grad[i*n + p]*x_data[j*n + p];
+                                }
+                                w0_grad[i*k + j] = sum;
+                        }
+                }
+
+                for (size_t i = 0;
+                     i < k;
+                     ++i) {
+                        for (size_t j = 0;
+                             j < n;
+                             ++j) {
+                                double sum = 0.0;
+                                for (size_t p = 0;
+                                     p < h;
+                                     ++p) {
+                                        sum += (w0_data[p*k + i]*
+                                                v1_grad[p*n + j]);
+                                }
+                                x_grad[i*n + j] = sum;
+                        }
+                }
+
+                const double tolerance = 1024*FLT_EPSILON;
+                MIN_UNIT_ASSERT(check_grad(ROT_tape_get_grad(tape, w1),
+                                           w1_grad,
+                                           tolerance) &&
+                                check_grad(ROT_tape_get_grad(tape, v1),
+                                           v1_grad,
+                                           tolerance) &&
+                                check_grad(ROT_tape_get_grad(tape, w0),
+                                           w0_grad,
+                                           tolerance) &&
+                                check_grad(ROT_tape_get_grad(tape, x),
+                                           x_grad,
+                                           tolerance),
+                                "Tape gradients mismatch on step %u\n",
+                                step);
+
+                const float *unused_grad =
+                        ROT_tensor_get_data(ROT_tape_get_grad(tape, unused));
+                for (size_t i = 0;
+                     i < h*n;
+                     ++i) {
+                        MIN_UNIT_ASSERT(unused_grad[i] == 0.0f,
+                                        "Gradient of unused tensor is not "
+                                        "zero\n");
+                }
+
+                if (step == 0) {
+                        first_w0_grad = ROT_tape_get_grad(tape, w0);
+                        first_v1_grad = ROT_tape_get_grad(tape, v1);
+                }
+                MIN_UNIT_ASSERT((ROT_tape_get_grad(tape, w0) ==
+                                 first_w0_grad) &&
+                                (ROT_tape_get_grad(tape, v1) ==
+                                 first_v1_grad),
+                                "Tape reallocated a gradient tensor\n");
+        }
+
+        MIN_UNIT_ASSERT((ROT_tape_new(arena, 0) == NULL) &&
+                        (ROT_tape_new(arena, UINT32_MAX) == NULL),
+                        "ROT_tape_new accepted a bad number of ops\n");
+
+        free(v1_grad);
+        free(w1_grad);
+        free(x_grad);
+        free(w0_grad);
+        free(memory);
+}
+
+/**
+ * struct conv_test - A convolution under test, with the dimensions of its
+ * tensors unpacked from their layout.
+ */
+struct conv_test {
+        struct rot_conv2d_params params;
+        size_t batch;
+        size_t in_c;
+        size_t in_h;
+        size_t in_w;
+        size_t out_c;
+        size_t out_h;
+        size_t out_w;
+        size_t kernel_h;
+        size_t kernel_w;
+        const float *input;
+        const float *filter;
+        const float *bias;
+};
+
+/**
+ * image_index() - Returns the offset of element (n, c, h, w) of a batch of
+ * images with `channels` channels of height x width, in `layout`.
+ */
+static size_t
+image_index(enum rot_layout layout,
+            size_t channels,
+            size_t height,
+            size_t width,
+            size_t n,
+            size_t c,
+            size_t h,
+            size_t w)
+{
+        if (layout == ROT_LAYOUT_NCHW)
+                return ((n*channels + c)*height + h)*width + w;
+
+        return ((n*height + h)*width + w)*channels + c;
+}
+
+/**
+ * reference_conv2d() - Double precision direct convolution at output element
+ * (n, oc, oh, ow), before the activation.
+ * @magnitude: Set to the sum of the magnitudes of the terms of the result.
+ */
+static double
+reference_conv2d(const struct conv_test *test,
+                 size_t n,
+                 size_t oc,
+                 size_t oh,
+                 size_t ow,
+                 double *magnitude)
+{
+        const struct rot_conv2d_params *params = &test->params;
+        const size_t group_in = test->in_c/params->groups;
+        const size_t group = oc/(test->out_c/params->groups);
+        double result = (test->bias != NULL) ? test->bias[oc] : 0.0;
+        *magnitude = fabs(result);
+        for (size_t gc = 0;
+             gc < group_in;
+             ++gc) {
+                for (size_t kh = 0;
+                     kh < test->kernel_h;
+                     ++kh) {
+                        long ih = ((long)(oh*params->stride[0] +
+                                          kh*params->dilation[0]) -
+                                   (long)params->padding[0]);
+                        if ((ih < 0) || (ih >= (long)test->in_h))
+                                continue;
+
+                        for (size_t kw = 0;
+                             kw < test->kernel_w;
+                             ++kw) {
+                                long iw = ((long)(ow*params->stride[1] +
+                                                  kw*params->dilation[1]) -
+                                           (long)params->padding[1]);
+                                if ((iw < 0) || (iw >= (long)test->in_w))
+                                        continue;
+
+                                size_t f;
+                                if (params->layout == ROT_LAYOUT_NCHW)
+                                        f = (((oc*group_in + gc)*
+                                              test->kernel_h + kh)*
+                                             test->kernel_w + kw);
+                                else
+                                        f = (((oc*test->kernel_h + kh)*
+                                              test->kernel_w + kw)*
+                                             group_in + gc);
+                                size_t x = image_index(params->layout,
+                                                       test->in_c,
+                                                       test->in_h,
+                                                       test->in_w,
+                                                       n,
+                                                       group*group_in + gc,
+                                                       ih,
+                                                       iw);
+                                double product = ((double)test->filter[f]*
+                                                  test->input[x]);
+                                result += product;
+                                *magnitude += fabs(product);
+                        }
+                }
+        }
+
+        return result;
+}
+
+/**
+ * check_conv2d() - Returns true if every element of `result` is within 1e-5
+ * of the reference convolution, relative to the magnitude of its terms, or
+ * within 1e-4 for Winograd, whose transforms lose more precision.
+ */
+static bool
+check_conv2d(const struct conv_test *test, const float *result)
+{
+        const double tolerance = ((test->params.algo ==
+                                   ROT_CONV2D_ALGO_WINOGRAD) ? 1e-4 : 1e-5);
+        for (size_t n = 0;
+             n < test->batch;
+             ++n) {
+                for (size_t oc = 0;
+                     oc < test->out_c;
+                     ++oc) {
+                        for (size_t i = 0;
+                             i < test->out_h*test->out_w;
+                             ++i) {
+                                const size_t oh = i/test->out_w;
+                                const size_t ow = i % test->out_w;
+                                double magnitude;
+                                double expected = reference_activation(
+                                        reference_conv2d(test,
+                                                         n,
+                                                         oc,
+                                                         oh,
+                                                         ow,
+                                                         &magnitude),
+                                        test->params.activation);
+                                size_t out = image_index(test->params.layout,
+                                                         test->out_c,
+                                                         test->out_h,
+                                                         test->out_w,
+                                                         n,
+                                                         oc,
+                                                         oh,
+                                                         ow);
+                                double diff = fabs(result[out] - expected);
+                                if (diff > tolerance*(1.0 + magnitude))
+                                        return false;
+                        }
+                }
+        }
+
+        return true;
+}
+
+/**
+ * run_conv2d_test() - Creates random tensors for `test`, whose params and
+ * input and filter sizes are filled in, and runs ROT_conv2d on them.
+ * Winograd tests also run ROT_conv2d_winograd with a transformed filter.
+ *
+ * Returns true if the result matches the reference.
+ */
+static bool
+run_conv2d_test(rot_arena_t arena, struct conv_test *test, bool has_bias)
+{
+        const struct rot_conv2d_params *params = &test->params;
+        const bool is_nchw = (params->layout == ROT_LAYOUT_NCHW);
+        test->out_h = ((test->in_h + 2*params->padding[0] -
+                        params->dilation[0]*(test->kernel_h - 1) - 1)/
+                       params->stride[0] + 1);
+        test->out_w = ((test->in_w + 2*params->padding[1] -
+                        params->dilation[1]*(test->kernel_w - 1) - 1)/
+                       params->stride[1] + 1);
+
+        const size_t group_in = test->in_c/params->groups;
+        const size_t in_nchw[] = {test->batch,
+                                  test->in_c,
+                                  test->in_h,
+                                  test->in_w};
+        const size_t in_nhwc[] = {test->batch,
+                                  test->in_h,
+                                  test->in_w,
+                                  test->in_c};
+        const size_t filter_nchw[] = {test->out_c,
+                                      group_in,
+                                      test->kernel_h,
+                                      test->kernel_w};
+        const size_t filter_nhwc[] = {test->out_c,
+                                      test->kernel_h,
+                                      test->kernel_w,
+                                      group_in};
+        const size_t out_nchw[] = {test->batch,
+                                   test->out_c,
+                                   test->out_h,
+                                   test->out_w};
+        const size_t out_nhwc[] = {test->batch,
+                                   test->out_h,
+                                   test->out_w,
+                                   test->out_c};
+        const size_t bias_dims[] = {test->out_c};
+        rot_tensor_t input = create_uniform_tensor(arena,
+                                                   4,
+                                                   is_nchw ? in_nchw : in_nhwc,
+                                                   1.0f);
+        rot_tensor_t filter = create_uniform_tensor(
+                arena,
+                4,
+                is_nchw ? filter_nchw : filter_nhwc,
+                1.0f);
+        rot_tensor_t bias = create_uniform_tensor(arena, 1, bias_dims, 1.0f);
+        rot_tensor_t result = create_uniform_tensor(
+                arena,
+                4,
+                is_nchw ? out_nchw : out_nhwc,
+                1.0f);
+        test->input = ROT_tensor_get_data(input);
+        test->filter = ROT_tensor_get_data(filter);
+        test->bias = has_bias ? ROT_tensor_get_data(bias) : NULL;
+
+        if ((ROT_conv2d(result,
+                        input,
+                        filter,
+                        has_bias ? bias : NULL,
+                        params) != result) ||
+            !check_conv2d(test, ROT_tensor_get_data(result)))
+                return false;
+
+        if (params->algo != ROT_CONV2D_ALGO_WINOGRAD)
+                return true;
+
+        rot_tensor_t transformed = ROT_winograd_transform_filter(
+                arena,
+                filter,
+                params->layout);
+        memset(ROT_tensor_get_data(result),
+               0,
+               test->batch*test->out_c*test->out_h*test->out_w*sizeof(float));
+        return ((transformed != NULL) &&
+                (ROT_conv2d_winograd(result,
+                                     input,
+                                     transformed,
+                                     has_bias ? bias : NULL,
+                                     params) == result) &&
+                check_conv2d(test, ROT_tensor_get_data(result)));
+}
+
+/**
+ * test_conv2d() - Correctness test for 2D convolution.
+ *
+ * Pass criteria: for both layouts, and for plain, strided, padded, dilated,
+ * grouped, depthwise and pointwise convolutions of random sizes, ROT_conv2d
+ * matches a double precision direct convolution, including a bias and ReLU.
+ * Groups with no input channels give the activation of the bias. Images large
+ * enough to split into several im2col tiles are covered by the last case. A
+ * result of the wrong size is rejected.
+ */
+MIN_UNIT_TEST_FUNC(test_conv2d)
+{
+        const size_t memory_size = 32*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        /**
+         * NOTE(brendan): Each case is {kernel h, kernel w, stride h, stride w,
+         * padding h, padding w, dilation h, dilation w, groups}, with channels
+         * per group.
+         */
+        const uint32_t cases[][11] = {{3, 3, 1, 1, 1, 1, 1, 1, 1, 3, 8},
+                                      {5, 3, 2, 1, 2, 1, 1, 2, 2, 3, 4},
+                                      {3, 3, 2, 2, 0, 0, 2, 2, 4, 2, 3},
+                                      {3, 3, 1, 1, 1, 1, 1, 1, 6, 1, 1},
+                                      {1, 1, 1, 1, 0, 0, 1, 1, 1, 16, 24},
+                                      {1, 1, 2, 2, 0, 0, 1, 1, 2, 5, 3},
+                                      {3, 3, 1, 1, 1, 1, 1, 1, 2, 0, 4},
+                                      {3, 3, 1, 1, 1, 1, 1, 1, 1, 64, 16}};
+        const enum rot_layout layouts[] = {ROT_LAYOUT_NCHW, ROT_LAYOUT_NHWC};
+        for (uint32_t case_i = 0;
+             case_i < sizeof(cases)/sizeof(cases[0]);
+             ++case_i) {
+                const uint32_t *c = cases[case_i];
+                for (uint32_t layout_i = 0;
+                     layout_i < 2;
+                     ++layout_i) {
+                        struct conv_test test = {};
+                        test.params.stride[0] = c[2];
+                        test.params.stride[1] = c[3];
+                        test.params.padding[0] = c[4];
+                        test.params.padding[1] = c[5];
+                        test.params.dilation[0] = c[6];
+                        test.params.dilation[1] = c[7];
+                        test.params.groups = c[8];
+                        test.params.layout = layouts[layout_i];
+                        test.params.algo = ROT_CONV2D_ALGO_IM2COL;
+                        test.params.activation = (layout_i ?
+                                                  ROT_ACTIVATION_RELU :
+                                                  ROT_ACTIVATION_NONE);
+                        test.kernel_h = c[0];
+                        test.kernel_w = c[1];
+                        test.batch = rand_dim(3);
+                        test.in_c = c[8]*c[9];
+                        test.out_c = c[8]*c[10];
+                        test.in_h = c[0]*c[6] + rand_dim(24);
+                        test.in_w = c[1]*c[7] + rand_dim(24);
+                        if (case_i == sizeof(cases)/sizeof(cases[0]) - 1) {
+                                test.in_h += 40;
+                                test.in_w += 40;
+                        }
+
+                        rot_arena_mark_t mark = ROT_arena_mark(arena);
+                        MIN_UNIT_ASSERT(run_conv2d_test(arena,
+                                                        &test,
+                                                        (case_i % 2) == 0),
+                                        "ROT_conv2d mismatch for case %u, "
+                                        "layout %u\n",
+                                        case_i,
+                                        layout_i);
+                        ROT_arena_rewind(arena, mark);
+                }
+        }
+
+        const size_t in_dims[] = {1, 2, 5, 5};
+        const size_t filter_dims[] = {4, 2, 3, 3};
+        const size_t bad_out_dims[] = {1, 4, 5, 5};
+        rot_tensor_t input = create_uniform_tensor(arena, 4, in_dims, 1.0f);
+        rot_tensor_t filter = create_uniform_tensor(arena,
+                                                    4,
+                                                    filter_dims,
+                                                    1.0f);
+        rot_tensor_t bad_out = create_uniform_tensor(arena,
+                                                     4,
+                                                     bad_out_dims,
+                                                     1.0f);
+        struct rot_conv2d_params params = {};
+        params.stride[0] = params.stride[1] = 1;
+        params.dilation[0] = params.dilation[1] = 1;
+        params.groups = 1;
+        params.layout = ROT_LAYOUT_NCHW;
+        MIN_UNIT_ASSERT(ROT_conv2d(bad_out, input, filter, NULL, &params) ==
+                        NULL,
+                        "ROT_conv2d accepted a result of the wrong size\n");
+
+        free(memory);
+}
+
+/**
+ * test_conv2d_winograd() - Correctness test for Winograd convolution.
+ *
+ * Pass criteria: for both layouts, with and without padding, and for image
+ * sizes that are not multiples of the 4x4 output tile, Winograd convolutions
+ * through ROT_conv2d and through ROT_conv2d_winograd with a transformed filter
+ * match a double precision direct convolution. Strided convolutions and
+ * non-3x3 filters are rejected by ROT_conv2d_winograd, and left to im2col by
+ * ROT_conv2d.
+ */
+MIN_UNIT_TEST_FUNC(test_conv2d_winograd)
+{
+        const size_t memory_size = 32*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        /**
+         * NOTE(brendan): Each case is {padding, in channels, out channels,
+         * extra height and width}, where the extra size makes the blocks of
+         * tiles split across images.
+         */
+        const uint32_t cases[][4] = {{1, 3, 5, 0},
+                                     {0, 16, 24, 0},
+                                     {1, 37, 19, 0},
+                                     {1, 32, 48, 40}};
+        const enum rot_layout layouts[] = {ROT_LAYOUT_NCHW, ROT_LAYOUT_NHWC};
+        for (uint32_t case_i = 0;
+             case_i < sizeof(cases)/sizeof(cases[0]);
+             ++case_i) {
+                const uint32_t *c = cases[case_i];
+                for (uint32_t layout_i = 0;
+                     layout_i < 2;
+                     ++layout_i) {
+                        struct conv_test test = {};
+                        test.params.stride[0] = test.params.stride[1] = 1;
+                        test.params.padding[0] = c[0];
+                        test.params.padding[1] = c[0];
+                        test.params.dilation[0] = 1;
+                        test.params.dilation[1] = 1;
+                        test.params.groups = 1;
+                        test.params.layout = layouts[layout_i];
+                        test.params.algo = ROT_CONV2D_ALGO_WINOGRAD;
+                        test.params.activation = (layout_i ?
+                                                  ROT_ACTIVATION_RELU :
+                                                  ROT_ACTIVATION_NONE);
+                        test.kernel_h = 3;
+                        test.kernel_w = 3;
+                        test.batch = rand_dim(3);
+                        test.in_c = c[1];
+                        test.out_c = c[2];
+                        test.in_h = 2 + rand_dim(24) + c[3];
+                        test.in_w = 2 + rand_dim(24) + c[3];
+
+                        rot_arena_mark_t mark = ROT_arena_mark(arena);
+                        MIN_UNIT_ASSERT(run_conv2d_test(arena,
+                                                        &test,
+                                                        (case_i % 2) == 0),
+                                        "Winograd mismatch for case %u, "
+                                        "layout %u\n",
+                                        case_i,
+                                        layout_i);
+                        ROT_arena_rewind(arena, mark);
+                }
+        }
+
+        /**
+         * NOTE(brendan): With a strided Winograd request, ROT_conv2d falls
+         * back to im2col, whose result must be exact.
+         */
+        struct conv_test test = {};
+        test.params.stride[0] = test.params.stride[1] = 2;
+        test.params.dilation[0] = test.params.dilation[1] = 1;
+        test.params.groups = 1;
+        test.params.algo = ROT_CONV2D_ALGO_WINOGRAD;
+        test.kernel_h = test.kernel_w = 3;
+        test.batch = 1;
+        test.in_c = test.out_c = 16;
+        test.in_h = test.in_w = 9;
+        rot_arena_mark_t mark = ROT_arena_mark(arena);
+        MIN_UNIT_ASSERT(!run_conv2d_test(arena, &test, true),
+                        "ROT_conv2d_winograd accepted a strided "
+                        "convolution\n");
+        ROT_arena_rewind(arena, mark);
+
+        const size_t filter_dims[] = {4, 2, 5, 5};
+        rot_tensor_t filter = create_uniform_tensor(arena,
+                                                    4,
+                                                    filter_dims,
+                                                    1.0f);
+        MIN_UNIT_ASSERT(ROT_winograd_transform_filter(arena,
+                                                      filter,
+                                                      ROT_LAYOUT_NCHW) ==
+                        NULL,
+                        "ROT_winograd_transform_filter accepted a 5x5 "
+                        "filter\n");
+
+        free(memory);
+}
+
+/**
+ * test_conv2d_depthwise_separable() - Correctness test for depthwise and
+ * fused depthwise separable convolutions.
+ *
+ * Pass criteria: depthwise NHWC convolutions of channel counts that are not
+ * multiples of the SIMD width, with strides, padding and dilation, match a
+ * double precision direct convolution. The fused separable convolution
+ * matches a depthwise ROT_conv2d with ReLU followed by a pointwise ROT_conv2d,
+ * for images split into several tiles of rows, and a pointwise filter of the
+ * wrong depth is rejected.
+ */
+MIN_UNIT_TEST_FUNC(test_conv2d_depthwise_separable)
+{
+        const size_t memory_size = 32*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        /**
+         * NOTE(brendan): Each case is {kernel size, stride, padding,
+         * dilation, channels}.
+         */
+        const uint32_t cases[][5] = {{3, 1, 1, 1, 37},
+                                     {5, 2, 2, 1, 80},
+                                     {3, 1, 2, 2, 7}};
+        for (uint32_t case_i = 0;
+             case_i < sizeof(cases)/sizeof(cases[0]);
+             ++case_i) {
+                const uint32_t *c = cases[case_i];
+                struct conv_test test = {};
+                test.params.stride[0] = test.params.stride[1] = c[1];
+                test.params.padding[0] = test.params.padding[1] = c[2];
+                test.params.dilation[0] = test.params.dilation[1] = c[3];
+                test.params.groups = c[4];
+                test.params.layout = ROT_LAYOUT_NHWC;
+                test.params.activation = ROT_ACTIVATION_RELU;
+                test.kernel_h = test.kernel_w = c[0];
+                test.batch = rand_dim(3);
+                test.in_c = test.out_c = c[4];
+                test.in_h = c[0]*c[3] + rand_dim(24);
+                test.in_w = c[0]*c[3] + rand_dim(24);
+
+                rot_arena_mark_t mark = ROT_arena_mark(arena);
+                MIN_UNIT_ASSERT(run_conv2d_test(arena,
+                                                &test,
+                                                (case_i % 2) == 0),
+                                "Depthwise mismatch for case %u\n",
+                                case_i);
+                ROT_arena_rewind(arena, mark);
+        }
+
+        const size_t batch = rand_dim(3);
+        const size_t height = 40 + rand_dim(16);
+        const size_t width = 40 + rand_dim(16);
+        const size_t channels = 64;
+        const size_t out_channels = 24;
+        const size_t in_dims[] = {batch, height, width, channels};
+        const size_t dw_dims[] = {channels, 3, 3, 1};
+        const size_t pw_dims[] = {out_channels, 1, 1, channels};
+        const size_t bad_pw_dims[] = {out_channels, 1, 1, channels + 1};
+        const size_t mid_dims[] = {batch, height, width, channels};
+        const size_t out_dims[] = {batch, height, width, out_channels};
+        const size_t dw_bias_dims[] = {channels};
+        const size_t pw_bias_dims[] = {out_channels};
+        rot_tensor_t input = create_uniform_tensor(arena, 4, in_dims, 1.0f);
+        rot_tensor_t dw_filter = create_uniform_tensor(arena,
+                                                       4,
+                                                       dw_dims,
+                                                       1.0f);
+        rot_tensor_t pw_filter = create_uniform_tensor(arena,
+                                                       4,
+                                                       pw_dims,
+                                                       1.0f);
+        rot_tensor_t bad_pw_filter = create_uniform_tensor(arena,
+                                                           4,
+                                                           bad_pw_dims,
+                                                           1.0f);
+        rot_tensor_t dw_bias = create_uniform_tensor(arena,
+                                                     1,
+                                                     dw_bias_dims,
+                                                     1.0f);
+        rot_tensor_t pw_bias = create_uniform_tensor(arena,
+                                                     1,
+                                                     pw_bias_dims,
+                                                     1.0f);
+        rot_tensor_t mid = create_uniform_tensor(arena, 4, mid_dims, 1.0f);
+        rot_tensor_t expected = create_uniform_tensor(arena,
+                                                      4,
+                                                      out_dims,
+                                                      1.0f);
+        rot_tensor_t result = create_uniform_tensor(arena, 4, out_dims, 1.0f);
+
+        struct rot_conv2d_params dw_params = {};
+        dw_params.stride[0] = dw_params.stride[1] = 1;
+        dw_params.padding[0] = dw_params.padding[1] = 1;
+        dw_params.dilation[0] = dw_params.dilation[1] = 1;
+        dw_params.groups = channels;
+        dw_params.layout = ROT_LAYOUT_NHWC;
+        dw_params.activation = ROT_ACTIVATION_RELU;
+        struct rot_conv2d_params pw_params = dw_params;
+        pw_params.padding[0] = pw_params.padding[1] = 0;
+        pw_params.groups = 1;
+        pw_params.activation = ROT_ACTIVATION_TANH;
+        MIN_UNIT_ASSERT((ROT_conv2d(mid,
+                                    input,
+                                    dw_filter,
+                                    dw_bias,
+                                    &dw_params) == mid) &&
+                        (ROT_conv2d(expected,
+                                    mid,
+                                    pw_filter,
+                                    pw_bias,
+                                    &pw_params) == expected),
+                        "Unfused separable convolution failed\n");
+
+        MIN_UNIT_ASSERT(ROT_conv2d_depthwise_separable(result,
+                                                       input,
+                                                       dw_filter,
+                                                       dw_bias,
+                                                       pw_filter,
+                                                       pw_bias,
+                                                       &dw_params,
+                                                       ROT_ACTIVATION_TANH) ==
+                        result,
+                        "ROT_conv2d_depthwise_separable failed\n");
+
+        const float *expected_data = ROT_tensor_get_data(expected);
+        const float *result_data = ROT_tensor_get_data(result);
+        for (size_t i = 0;
+             i < batch*height*width*out_channels;
+             ++i) {
+                MIN_UNIT_ASSERT(fabs(result_data[i] - expected_data[i]) <=
+                                1e-5*(1.0 + fabs(expected_data[i])),
+                                "Separable convolution mismatch at %zu\n",
+                                i);
+        }
+
+        MIN_UNIT_ASSERT(ROT_conv2d_depthwise_separable(result,
+                                                       input,
+                                                       dw_filter,
+                                                       dw_bias,
+                                                       bad_pw_filter,
+                                                       pw_bias,
+                                                       &dw_params,
+                                                       ROT_ACTIVATION_NONE) ==
+                        NULL,
+                        "ROT_conv2d_depthwise_separable accepted a "
+                        "pointwise filter of the wrong depth\n");
+
+        free(memory);
+}
+
+/**
+ * struct pool_test - A pooling test case.
+ */
+struct pool_test {
+        struct rot_pool2d_params params;
+        size_t batch;
+        size_t channels;
+        size_t in_h;
+        size_t in_w;
+        size_t out_h;
+        size_t out_w;
+        const float *input;
+};
+
+/**
+ * reference_pool2d() - Double precision max or average of the window of
+ * output element (n, c, oh, ow), which also adds the backward pass of
+ * `grad`, the gradient of that output, to `input_grad`.
+ */
+static double
+reference_pool2d(const struct pool_test *test,
+                 bool is_max,
+                 size_t n,
+                 size_t c,
+                 size_t oh,
+                 size_t ow,
+                 double grad,
+                 double *input_grad)
+{
+        const struct rot_pool2d_params *params = &test->params;
+        size_t taps[256] = {};
+        size_t num_taps = 0;
+        for (size_t kh = 0;
+             kh < params->kernel[0];
+             ++kh) {
+                long ih = ((long)(oh*params->stride[0] + kh) -
+                           (long)params->padding[0]);
+                for (size_t kw = 0;
+                     kw < params->kernel[1];
+                     ++kw) {
+                        long iw = ((long)(ow*params->stride[1] + kw) -
+                                   (long)params->padding[1]);
+                        if ((ih < 0) ||
+                            (ih >= (long)test->in_h) ||
+                            (iw < 0) ||
+                            (iw >= (long)test->in_w))
+                                continue;
+
+                        taps[num_taps] = image_index(params->layout,
+                                                     test->channels,
+                                                     test->in_h,
+                                                     test->in_w,
+                                                     n,
+                                                     c,
+                                                     ih,
+                                                     iw);
+                        ++num_taps;
+                }
+        }
+
+        if (is_max) {
+                size_t best = taps[0];
+                for (size_t t = 1;
+                     t < num_taps;
+                     ++t) {
+                        if (test->input[taps[t]] > test->input[best])
+                                best = taps[t];
+                }
+                input_grad[best] += grad;
+
+                return test->input[best];
+        }
+
+        double sum = 0.0;
+        for (size_t t = 0;
+             t < num_taps;
+             ++t) {
+                sum += test->input[taps[t]];
+                input_grad[taps[t]] += grad/num_taps;
+        }
+
+        return sum/num_taps;
+}
+
+/**
+ * run_pool2d_test() - Creates random tensors for `test`, whose params and
+ * input sizes are filled in, and runs max or average pooling forwards and
+ * backwards on them.
+ *
+ * Returns true if the output and input gradient are within 1e-5 of the
+ * reference, relative to their magnitude.
+ */
+static bool
+run_pool2d_test(rot_arena_t arena, struct pool_test *test, bool is_max)
+{
+        const struct rot_pool2d_params *params = &test->params;
+        const bool is_nchw = (params->layout == ROT_LAYOUT_NCHW);
+        test->out_h = ((test->in_h + 2*params->padding[0] - params->kernel[0])/
+                       params->stride[0] + 1);
+        test->out_w = ((test->in_w + 2*params->padding[1] - params->kernel[1])/
+                       params->stride[1] + 1);
+
+        const size_t in_nchw[] = {test->batch,
+                                  test->channels,
+                                  test->in_h,
+                                  test->in_w};
+        const size_t in_nhwc[] = {test->batch,
+                                  test->in_h,
+                                  test->in_w,
+                                  test->channels};
+        const size_t out_nchw[] = {test->batch,
+                                   test->channels,
+                                   test->out_h,
+                                   test->out_w};
+        const size_t out_nhwc[] = {test->batch,
+                                   test->out_h,
+                                   test->out_w,
+                                   test->channels};
+        const size_t *in_dims = is_nchw ? in_nchw : in_nhwc;
+        const size_t *out_dims = is_nchw ? out_nchw : out_nhwc;
+        rot_tensor_t input = create_uniform_tensor(arena, 4, in_dims, 1.0f);
+        rot_tensor_t result = create_uniform_tensor(arena, 4, out_dims, 1.0f);
+        rot_tensor_t output_grad = create_uniform_tensor(arena,
+                                                         4,
+                                                         out_dims,
+                                                         1.0f);
+        rot_tensor_t input_grad = create_uniform_tensor(arena,
+                                                        4,
+                                                        in_dims,
+                                                        1.0f);
+        test->input = ROT_tensor_get_data(input);
+
+        uint8_t *argmax = NULL;
+        if (is_max) {
+                if ((ROT_maxpool2d(result, &argmax, arena, input, params) !=
+                     result) ||
+                    (ROT_maxpool2d_backward(input_grad,
+                                            output_grad,
+                                            argmax,
+                                            params) != input_grad))
+                        return false;
+        } else {
+                if ((ROT_avgpool2d(result, input, params) != result) ||
+                    (ROT_avgpool2d_backward(input_grad,
+                                            output_grad,
+                                            params) != input_grad))
+                        return false;
+        }
+
+        const size_t in_elems = (test->batch*test->channels*
+                                 test->in_h*test->in_w);
+        double *expected_grad = (double *)calloc(in_elems, sizeof(double));
+        assert(expected_grad != NULL);
+
+        const float *result_data = ROT_tensor_get_data(result);
+        const float *output_grad_data = ROT_tensor_get_data(output_grad);
+        bool is_match = true;
+        for (size_t n = 0;
+             n < test->batch;
+             ++n) {
+                for (size_t c = 0;
+                     c < test->channels;
+                     ++c) {
+                        for (size_t i = 0;
+                             i < test->out_h*test->out_w;
+                             ++i) {
+                                const size_t oh = i/test->out_w;
+                                const size_t ow = i % test->out_w;
+                                size_t out = image_index(params->layout,
+                                                         test->channels,
+                                                         test->out_h,
+                                                         test->out_w,
+                                                         n,
+                                                         c,
+                                                         oh,
+                                                         ow);
+                                double expected = reference_pool2d(
+                                        test,
+                                        is_max,
+                                        n,
+                                        c,
+                                        oh,
+                                        ow,
+                                        output_grad_data[out],
+                                        expected_grad);
+                                if (fabs(result_data[out] - expected) >
+                                    1e-5*(1.0 + fabs(expected)))
+                                        is_match = false;
+                        }
+                }
+        }
+
+        const float *input_grad_data = ROT_tensor_get_data(input_grad);
+        for (size_t i = 0;
+             i < in_elems;
+             ++i) {
+                if (fabs(input_grad_data[i] - expected_grad[i]) >
+                    1e-5*(1.0 + fabs(expected_grad[i])))
+                        is_match = false;
+        }
+
+        free(expected_grad);
+
+        return is_match;
+}
+
+/**
+ * test_pool2d() - Correctness test for max, average and global average
+ * pooling, and their backward passes.
+ *
+ * Pass criteria: for both layouts, for overlapping, strided and padded
+ * windows, and for channel counts that are not multiples of the SIMD width,
+ * pooling and its backward pass match a double precision reference, with
+ * max pooling's gradient routed through the argmax indices. Global average
+ * pooling and its backward pass match the mean of each channel. Padding of
+ * more than half a window, and views of one buffer that overlap, are
+ * rejected, the latter before any argmax indices are allocated.
+ */
+MIN_UNIT_TEST_FUNC(test_pool2d)
+{
+        const size_t memory_size = 32*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        /* NOTE(brendan): Each case is {kernel size, stride, padding}. */
+        const uint32_t cases[][3] = {{2, 2, 0},
+                                     {3, 2, 1},
+                                     {3, 1, 1},
+                                     {5, 3, 2}};
+        const enum rot_layout layouts[] = {ROT_LAYOUT_NCHW, ROT_LAYOUT_NHWC};
+        for (uint32_t case_i = 0;
+             case_i < sizeof(cases)/sizeof(cases[0]);
+             ++case_i) {
+                for (uint32_t layout_i = 0;
+                     layout_i < 2;
+                     ++layout_i) {
+                        for (uint32_t is_max = 0;
+                             is_max < 2;
+                             ++is_max) {
+                                const uint32_t *c = cases[case_i];
+                                struct pool_test test = {};
+                                test.params.kernel[0] = c[0];
+                                test.params.kernel[1] = c[0];
+                                test.params.stride[0] = c[1];
+                                test.params.stride[1] = c[1];
+                                test.params.padding[0] = c[2];
+                                test.params.padding[1] = c[2];
+                                test.params.layout = layouts[layout_i];
+                                test.batch = rand_dim(3);
+                                test.channels = rand_dim(40);
+                                test.in_h = c[0] + rand_dim(20);
+                                test.in_w = c[0] + rand_dim(20);
+
+                                rot_arena_mark_t mark = ROT_arena_mark(arena);
+                                MIN_UNIT_ASSERT(run_pool2d_test(arena,
+                                                                &test,
+                                                                is_max),
+                                                "Pooling mismatch for case "
+                                                "%u, layout %u, max %u\n",
+                                                case_i,
+                                                layout_i,
+                                                is_max);
+                                ROT_arena_rewind(arena, mark);
+                        }
+                }
+        }
+
+        for (uint32_t layout_i = 0;
+             layout_i < 2;
+             ++layout_i) {
+                const enum rot_layout layout = layouts[layout_i];
+                const size_t batch = rand_dim(3);
+                const size_t channels = rand_dim(80);
+                const size_t height = rand_dim(12);
+                const size_t width = rand_dim(12);
+                const size_t nchw[] = {batch, channels, height, width};
+                const size_t nhwc[] = {batch, height, width, channels};
+                const size_t *image_dims = ((layout == ROT_LAYOUT_NCHW) ?
+                                            nchw :
+                                            nhwc);
+                const size_t pooled_dims[] = {batch, channels};
+                rot_arena_mark_t mark = ROT_arena_mark(arena);
+                rot_tensor_t input = create_uniform_tensor(arena,
+                                                           4,
+                                                           image_dims,
+                                                           1.0f);
+                rot_tensor_t input_grad = create_uniform_tensor(arena,
+                                                                4,
+                                                                image_dims,
+                                                                1.0f);
+                rot_tensor_t pooled = create_uniform_tensor(arena,
+                                                            2,
+                                                            pooled_dims,
+                                                            1.0f);
+                rot_tensor_t pooled_grad = create_uniform_tensor(arena,
+                                                                 2,
+                                                                 pooled_dims,
+                                                                 1.0f);
+                MIN_UNIT_ASSERT((ROT_global_avgpool2d(pooled,
+                                                      input,
+                                                      layout) == pooled) &&
+                                (ROT_global_avgpool2d_backward(
+                                        input_grad,
+                                        pooled_grad,
+                                        layout) == input_grad),
+                                "Global pooling failed\n");
+
+                const float *in = ROT_tensor_get_data(input);
+                const float *in_grad = ROT_tensor_get_data(input_grad);
+                const float *out = ROT_tensor_get_data(pooled);
+                const float *out_grad = ROT_tensor_get_data(pooled_grad);
+                const size_t num_pixels = height*width;
+                for (size_t i = 0;
+                     i < batch*channels;
+                     ++i) {
+                        const size_t n = i/channels;
+                        const size_t c = i % channels;
+                        double sum = 0.0;
+                        for (size_t p = 0;
+                             p < num_pixels;
+                             ++p) {
+                                size_t x = image_index(layout,
+                                                       channels,
+                                                       height,
+                                                       width,
+                                                       n,
+                                                       c,
+                                                       p/width,
+                                                       p % width);
+                                sum += in[x];
+                                MIN_UNIT_ASSERT(fabs(in_grad[x] -
+                                                     out_grad[i]/num_pixels) <=
+                                                1e-6,
+                                                "Global pooling gradient "
+                                                "mismatch\n");
+                        }
+                        MIN_UNIT_ASSERT(fabs(out[i] - sum/num_pixels) <= 1e-5,
+                                        "Global pooling mismatch at %zu\n",
+                                        i);
+                }
+                ROT_arena_rewind(arena, mark);
+        }
+
+        const size_t in_dims[] = {1, 2, 6, 6};
+        const size_t out_dims[] = {1, 2, 4, 4};
+        rot_tensor_t input = create_uniform_tensor(arena, 4, in_dims, 1.0f);
+        rot_tensor_t result = create_uniform_tensor(arena, 4, out_dims, 1.0f);
+        struct rot_pool2d_params params = {};
+        params.kernel[0] = params.kernel[1] = 3;
+        params.stride[0] = params.stride[1] = 2;
+        params.padding[0] = params.padding[1] = 2;
+        params.layout = ROT_LAYOUT_NCHW;
+        MIN_UNIT_ASSERT(ROT_avgpool2d(result, input, &params) == NULL,
+                        "ROT_avgpool2d accepted padding of more than half a "
+                        "window\n");
+
+        const size_t buffer_dims[] = {3, 2, 6, 6};
+        rot_tensor_t buffer = create_uniform_tensor(arena,
+                                                    4,
+                                                    buffer_dims,
+                                                    1.0f);
+        params.kernel[0] = params.kernel[1] = 1;
+        params.stride[0] = params.stride[1] = 1;
+        params.padding[0] = params.padding[1] = 0;
+        MIN_UNIT_ASSERT(ROT_avgpool2d(ROT_tensor_view_slice(arena,
+                                                            buffer,
+                                                            0,
+                                                            1,
+                                                            3),
+                                      ROT_tensor_view_slice(arena,
+                                                            buffer,
+                                                            0,
+                                                            0,
+                                                            2),
+                                      &params) == NULL,
+                        "ROT_avgpool2d accepted overlapping views\n");
+        uint8_t *argmax = NULL;
+        MIN_UNIT_ASSERT((ROT_maxpool2d(ROT_tensor_view_slice(arena,
+                                                             buffer,
+                                                             0,
+                                                             1,
+                                                             3),
+                                       &argmax,
+                                       arena,
+                                       ROT_tensor_view_slice(arena,
+                                                             buffer,
+                                                             0,
+                                                             0,
+                                                             2),
+                                       &params) == NULL) &&
+                        (argmax == NULL),
+                        "ROT_maxpool2d accepted overlapping views\n");
+        rot_tensor_t second = ROT_tensor_view_slice(arena, buffer, 0, 1, 2);
+        MIN_UNIT_ASSERT(ROT_avgpool2d(second,
+                                      ROT_tensor_view_slice(arena,
+                                                            buffer,
+                                                            0,
+                                                            0,
+                                                            1),
+                                      &params) == second,
+                        "ROT_avgpool2d rejected disjoint views\n");
+
+        free(memory);
+}
+
+/**
+ * struct norm_test - A normalisation to check. Element i is in group
+ * (i/group_div) % num_groups, and is scaled by gamma[(i/affine_div) %
+ * num_affine].
+ * @input, @output_grad: Copies of the operands, which may be overwritten in
+ * place.
+ */
+struct norm_test {
+        size_t num_elems;
+        size_t group_div;
+        size_t num_groups;
+        size_t affine_div;
+        size_t num_affine;
+        struct rot_norm_params params;
+        const float *input;
+        const float *gamma;
+        const float *beta;
+        const float *output_grad;
+};
+
+static size_t
+norm_test_group(const struct norm_test *test, size_t i)
+{
+        return (i/test->group_div) % test->num_groups;
+}
+
+static size_t
+norm_test_affine(const struct norm_test *test, size_t i)
+{
+        return (i/test->affine_div) % test->num_affine;
+}
+
+/**
+ * check_norm() - Checks the `output`, saved statistics `stats` and gradients
+ * of a normalisation against a double precision reference.
+ * @gamma_grad, @beta_grad: Gradients to check if `test->gamma` is not NULL.
+ */
+static bool
+check_norm(const struct norm_test *test,
+           const float *output,
+           const struct rot_norm_stats *stats,
+           const float *input_grad,
+           const float *gamma_grad,
+           const float *beta_grad)
+{
+        const size_t num_groups = test->num_groups;
+        const size_t num_affine = test->num_affine;
+        double *group_sums = (double *)calloc(5*num_groups, sizeof(double));
+        double *affine_sums = (double *)calloc(3*num_affine, sizeof(double));
+        assert((group_sums != NULL) && (affine_sums != NULL));
+        double *count = group_sums;
+        double *mean = count + num_groups;
+        double *variance = mean + num_groups;
+        double *sum_g = variance + num_groups;
+        double *sum_g_xhat = sum_g + num_groups;
+        double *sum_dy = affine_sums;
+        double *sum_dy_xhat = sum_dy + num_affine;
+        double *sum_abs = sum_dy_xhat + num_affine;
+
+        const float *x = test->input;
+        for (size_t i = 0;
+             i < test->num_elems;
+             ++i) {
+                const size_t g = norm_test_group(test, i);
+                count[g] += 1.0;
+                mean[g] += x[i];
+        }
+        for (size_t i = 0;
+             i < test->num_elems;
+             ++i) {
+                const size_t g = norm_test_group(test, i);
+                const double delta = x[i] - mean[g]/count[g];
+                variance[g] += delta*delta;
+        }
+
+        bool is_match = (stats->count == num_groups);
+        for (size_t g = 0;
+             is_match && (g < num_groups);
+             ++g) {
+                mean[g] /= count[g];
+                variance[g] /= count[g];
+                const double rstd = 1.0/sqrt(variance[g] +
+                                             test->params.epsilon);
+                if ((fabs(stats->mean[g] - mean[g]) >
+                     1e-5*(1.0 + fabs(mean[g]))) ||
+                    (fabs(stats->rstd[g] - rstd) > 1e-4*rstd))
+                        is_match = false;
+        }
+
+        double *grad = (double *)malloc(test->num_elems*sizeof(double));
+        assert(grad != NULL);
+        for (size_t i = 0;
+             is_match && (i < test->num_elems);
+             ++i) {
+                const size_t g = norm_test_group(test, i);
+                const size_t a = norm_test_affine(test, i);
+                const double gamma = (test->gamma != NULL) ?
+                                     test->gamma[a] : 1.0;
+                const double beta = (test->beta != NULL) ? test->beta[a] : 0.0;
+                const double x_hat = ((x[i] - mean[g])/
+                                      sqrt(variance[g] + test->params.epsilon));
+                double expected = x_hat*gamma + beta;
+                if (test->params.relu && (expected <= 0.0))
+                        expected = 0.0;
+
+                /**
+                 * NOTE(brendan): The ReLU mask is taken from the output under
+                 * test, since outputs within rounding of zero may be masked
+                 * either way, and each flip moves the sums of a whole group.
+                 */
+                double dy = test->output_grad[i];
+                if (test->params.relu && !(output[i] > 0.0f))
+                        dy = 0.0;
+                if (fabs(output[i] - expected) > 1e-4*(1.0 + fabs(expected)))
+                        is_match = false;
+
+                grad[i] = dy*gamma;
+                sum_g[g] += dy*gamma;
+                sum_g_xhat[g] += dy*gamma*x_hat;
+                sum_dy[a] += dy;
+                sum_dy_xhat[a] += dy*x_hat;
+                sum_abs[a] += fabs(dy) + fabs(dy*x_hat);
+        }
+
+        for (size_t i = 0;
+             is_match && (i < test->num_elems);
+             ++i) {
+                const size_t g = norm_test_group(test, i);
+                const double rstd = 1.0/sqrt(variance[g] +
+                                             test->params.epsilon);
+                const double x_hat = (x[i] - mean[g])*rstd;
+                const double c1 = sum_g[g]/count[g];
+                const double c2 = x_hat*sum_g_xhat[g]/count[g];
+                const double expected = rstd*(grad[i] - c1 - c2);
+                const double scale = rstd*(fabs(grad[i]) +
+                                           fabs(c1) +
+                                           fabs(c2));
+                if (fabs(input_grad[i] - expected) > 1e-4*(1.0 + scale))
+                        is_match = false;
+        }
+
+        for (size_t a = 0;
+             is_match && (test->gamma != NULL) && (a < num_affine);
+             ++a) {
+                const double tolerance = 1e-5*(1.0 + sum_abs[a]);
+                if ((fabs(beta_grad[a] - sum_dy[a]) > tolerance) ||
+                    (fabs(gamma_grad[a] - sum_dy_xhat[a]) > tolerance))
+                        is_match = false;
+        }
+
+        free(grad);
+        free(affine_sums);
+        free(group_sums);
+
+        return is_match;
+}
+
+/**
+ * create_norm_input() - Creates a uniform tensor offset by 3, so that a
+ * variance found naively from sums of squares would lose precision.
+ */
+static rot_tensor_t
+create_norm_input(rot_arena_t arena, uint32_t num_dims, const size_t *dims)
+{
+        rot_tensor_t input = create_uniform_tensor(arena,
+                                                   num_dims,
+                                                   dims,
+                                                   1.0f);
+        float *data = ROT_tensor_get_data(input);
+        size_t num_elems = ROT_tensor_get_size(input)/sizeof(float);
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                data[i] += 3.0f;
+        }
+
+        return input;
+}
+
+/**
+ * copy_tensor_data() - Returns a heap copy of the data of `tensor`.
+ */
+static float *
+copy_tensor_data(const rot_tensor_t tensor)
+{
+        size_t bytes = ROT_tensor_get_size(tensor);
+        float *copy = (float *)malloc(bytes);
+        assert(copy != NULL);
+        memcpy(copy, ROT_tensor_get_data(tensor), bytes);
+
+        return copy;
+}
+
+/**
+ * run_norm_test() - Runs a layer normalisation of `num_rows` rows of
+ * `row_elems`, or a batch normalisation of images `dims` in
+ * `test->params.layout`, forward and backward, and checks the results.
+ * @has_affine: Use a random gamma and beta, rather than none.
+ * @is_in_place: Overwrite the input with the output, and the output gradient
+ * with the input gradient.
+ */
+static bool
+run_norm_test(rot_arena_t arena,
+              struct norm_test *test,
+              bool is_batch,
+              const size_t *dims,
+              bool has_affine,
+              bool is_in_place)
+{
+        const bool is_nchw = (test->params.layout == ROT_LAYOUT_NCHW);
+        const uint32_t num_dims = is_batch ? 4 : 2;
+        const size_t num_affine = is_batch ? dims[is_nchw ? 1 : 3] : dims[1];
+        const size_t affine_dims[] = {num_affine};
+        rot_tensor_t input = create_norm_input(arena, num_dims, dims);
+        rot_tensor_t output_grad = create_uniform_tensor(arena,
+                                                         num_dims,
+                                                         dims,
+                                                         1.0f);
+        rot_tensor_t gamma = NULL;
+        rot_tensor_t beta = NULL;
+        rot_tensor_t gamma_grad = NULL;
+        rot_tensor_t beta_grad = NULL;
+        if (has_affine) {
+                gamma = create_uniform_tensor(arena, 1, affine_dims, 2.0f);
+                beta = create_uniform_tensor(arena, 1, affine_dims, 1.0f);
+                gamma_grad = create_uniform_tensor(arena, 1, affine_dims, 1.0f);
+                beta_grad = create_uniform_tensor(arena, 1, affine_dims, 1.0f);
+        }
+        rot_tensor_t output = input;
+        rot_tensor_t input_grad = output_grad;
+        if (!is_in_place) {
+                output = create_uniform_tensor(arena, num_dims, dims, 1.0f);
+                input_grad = create_uniform_tensor(arena, num_dims, dims, 1.0f);
+        }
+
+        float *input_copy = copy_tensor_data(input);
+        float *output_grad_copy = copy_tensor_data(output_grad);
+        test->num_elems = ROT_tensor_get_size(input)/sizeof(float);
+        test->num_affine = num_affine;
+        test->affine_div = (is_batch && is_nchw) ? dims[2]*dims[3] : 1;
+        test->group_div = is_batch ? test->affine_div : dims[1];
+        test->num_groups = is_batch ? num_affine : dims[0];
+        test->input = input_copy;
+        test->output_grad = output_grad_copy;
+        test->gamma = has_affine ? ROT_tensor_get_data(gamma) : NULL;
+        test->beta = has_affine ? ROT_tensor_get_data(beta) : NULL;
+
+        /**
+         * NOTE(brendan): The backward pass reads the input, so in place
+         * forward passes are checked apart from backward passes.
+         */
+        struct rot_norm_stats stats = {};
+        bool is_ok;
+        if (is_batch)
+                is_ok = (ROT_batchnorm(output,
+                                       &stats,
+                                       arena,
+                                       input,
+                                       gamma,
+                                       beta,
+                                       NULL,
+                                       NULL,
+                                       &test->params) == output);
+        else
+                is_ok = (ROT_layernorm(output,
+                                       &stats,
+                                       arena,
+                                       input,
+                                       gamma,
+                                       beta,
+                                       &test->params) == output);
+        float *output_copy = copy_tensor_data(output);
+        memcpy(ROT_tensor_get_data(input),
+               input_copy,
+               test->num_elems*sizeof(float));
+
+        if (is_ok && is_batch)
+                is_ok = (ROT_batchnorm_backward(input_grad,
+                                                gamma_grad,
+                                                beta_grad,
+                                                output_grad,
+                                                input,
+                                                gamma,
+                                                beta,
+                                                &stats,
+                                                &test->params) == input_grad);
+        else if (is_ok)
+                is_ok = (ROT_layernorm_backward(input_grad,
+                                                gamma_grad,
+                                                beta_grad,
+                                                output_grad,
+                                                input,
+                                                gamma,
+                                                beta,
+                                                &stats,
+                                                &test->params) == input_grad);
+
+        is_ok = is_ok &&
+                check_norm(test,
+                           output_copy,
+                           &stats,
+                           ROT_tensor_get_data(input_grad),
+                           has_affine ? ROT_tensor_get_data(gamma_grad) : NULL,
+                           has_affine ? ROT_tensor_get_data(beta_grad) : NULL);
+
+        free(output_copy);
+        free(output_grad_copy);
+        free(input_copy);
+
+        return is_ok;
+}
+
+/**
+ * test_layernorm() - Correctness test for layer normalisation and its
+ * backward pass.
+ *
+ * Pass criteria: with and without gamma and beta, with and without the fused
+ * ReLU, in place and not, and for rows that are shorter than, not a multiple
+ * of, and longer than the kernels' blocks, the output, saved statistics and
+ * gradients match a double precision reference, on inputs whose mean is
+ * large next to their standard deviation. Rows are numerous enough for the
+ * large case to be split across threads. Views of one buffer that overlap
+ * without being the same data are rejected.
+ */
+MIN_UNIT_TEST_FUNC(test_layernorm)
+{
+        const size_t memory_size = 64*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const size_t all_dims[][2] = {{rand_dim(8), rand_dim(15)},
+                                      {rand_dim(64), 16*rand_dim(8)},
+                                      {rand_dim(4), 4096 + rand_dim(4096)},
+                                      {256 + rand_dim(64), 509}};
+        for (uint32_t dims_i = 0;
+             dims_i < sizeof(all_dims)/sizeof(all_dims[0]);
+             ++dims_i) {
+                for (uint32_t flags = 0;
+                     flags < 8;
+                     ++flags) {
+                        struct norm_test test = {};
+                        test.params.epsilon = 1e-5f;
+                        test.params.relu = ((flags & 1) != 0);
+
+                        rot_arena_mark_t mark = ROT_arena_mark(arena);
+                        MIN_UNIT_ASSERT(run_norm_test(arena,
+                                                      &test,
+                                                      false,
+                                                      all_dims[dims_i],
+                                                      (flags & 2) != 0,
+                                                      (flags & 4) != 0),
+                                        "Layer normalisation mismatch for "
+                                        "%zux%zu, flags %u\n",
+                                        all_dims[dims_i][0],
+                                        all_dims[dims_i][1],
+                                        flags);
+                        ROT_arena_rewind(arena, mark);
+                }
+        }
+
+        const size_t dims[] = {4, 8};
+        const size_t affine_dims[] = {8};
+        rot_tensor_t input = create_uniform_tensor(arena, 2, dims, 1.0f);
+        rot_tensor_t gamma = create_uniform_tensor(arena, 1, affine_dims, 1.0f);
+        struct rot_norm_params params = {};
+        MIN_UNIT_ASSERT(ROT_layernorm(input,
+                                      NULL,
+                                      NULL,
+                                      input,
+                                      gamma,
+                                      NULL,
+                                      &params) == NULL,
+                        "ROT_layernorm accepted gamma without beta\n");
+
+        const size_t buffer_dims[] = {5, 8};
+        rot_tensor_t buffer = create_uniform_tensor(arena,
+                                                    2,
+                                                    buffer_dims,
+                                                    1.0f);
+        MIN_UNIT_ASSERT(ROT_layernorm(ROT_tensor_view_slice(arena,
+                                                            buffer,
+                                                            0,
+                                                            1,
+                                                            5),
+                                      NULL,
+                                      NULL,
+                                      ROT_tensor_view_slice(arena,
+                                                            buffer,
+                                                            0,
+                                                            0,
+                                                            4),
+                                      NULL,
+                                      NULL,
+                                      &params) == NULL,
+                        "ROT_layernorm accepted overlapping views\n");
+
+        free(memory);
+}
+
+/**
+ * test_batchnorm() - Correctness test for batch normalisation, its running
+ * statistics, its inference mode and its backward pass.
+ *
+ * Pass criteria: for both layouts, with and without gamma and beta, with and
+ * without the fused ReLU, in place and not, and for channel counts that are
+ * not multiples of the SIMD width or of the NHWC channel blocks, the output,
+ * saved statistics and gradients match a double precision reference. The
+ * running mean and unbiased variance move towards the batch statistics by
+ * the momentum, and inference mode normalises by them. The large case is
+ * split across threads.
+ */
+MIN_UNIT_TEST_FUNC(test_batchnorm)
+{
+        const size_t memory_size = 64*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        /* NOTE(brendan): Each case is {batch, channels, height, width}. */
+        const size_t cases[][4] = {{rand_dim(3), rand_dim(20), rand_dim(9), 5},
+                                   {rand_dim(3), 64 + rand_dim(80), 7, 7},
+                                   {4, 70, 16, 16},
+                                   {1, 3, 64, 64 + rand_dim(64)}};
+        const enum rot_layout layouts[] = {ROT_LAYOUT_NCHW, ROT_LAYOUT_NHWC};
+        for (uint32_t case_i = 0;
+             case_i < sizeof(cases)/sizeof(cases[0]);
+             ++case_i) {
+                for (uint32_t flags = 0;
+                     flags < 16;
+                     ++flags) {
+                        const size_t *c = cases[case_i];
+                        const size_t nchw[] = {c[0], c[1], c[2], c[3]};
+                        const size_t nhwc[] = {c[0], c[2], c[3], c[1]};
+                        struct norm_test test = {};
+                        test.params.epsilon = 1e-3f;
+                        test.params.relu = ((flags & 1) != 0);
+                        test.params.layout = layouts[(flags & 8) != 0];
+
+                        rot_arena_mark_t mark = ROT_arena_mark(arena);
+                        MIN_UNIT_ASSERT(run_norm_test(arena,
+                                                      &test,
+                                                      true,
+                                                      ((flags & 8) != 0) ?
+                                                      nhwc : nchw,
+                                                      (flags & 2) != 0,
+                                                      (flags & 4) != 0),
+                                        "Batch normalisation mismatch for "
+                                        "case %u, flags %u\n",
+                                        case_i,
+                                        flags);
+                        ROT_arena_rewind(arena, mark);
+                }
+        }
+
+        for (uint32_t layout_i = 0;
+             layout_i < 2;
+             ++layout_i) {
+                const size_t batch = 1 + rand_dim(3);
+                const size_t channels = rand_dim(80);
+                const size_t height = rand_dim(12);
+                const size_t width = rand_dim(12);
+                const size_t nchw[] = {batch, channels, height, width};
+                const size_t nhwc[] = {batch, height, width, channels};
+                const size_t channel_dims[] = {channels};
+                struct rot_norm_params params = {};
+                params.epsilon = 1e-3f;
+                params.momentum = 0.1f;
+                params.relu = true;
+                params.layout = layouts[layout_i];
+                const size_t *image_dims = ((params.layout == ROT_LAYOUT_NCHW) ?
+                                            nchw :
+                                            nhwc);
+
+                rot_arena_mark_t mark = ROT_arena_mark(arena);
+                rot_tensor_t input = create_norm_input(arena, 4, image_dims);
+                rot_tensor_t output = create_uniform_tensor(arena,
+                                                            4,
+                                                            image_dims,
+                                                            1.0f);
+                rot_tensor_t gamma = create_uniform_tensor(arena,
+                                                           1,
+                                                           channel_dims,
+                                                           2.0f);
+                rot_tensor_t beta = create_uniform_tensor(arena,
+                                                          1,
+                                                          channel_dims,
+                                                          1.0f);
+                rot_tensor_t running_mean = create_uniform_tensor(arena,
+                                                                  1,
+                                                                  channel_dims,
+                                                                  1.0f);
+                rot_tensor_t running_var = create_norm_input(arena,
+                                                             1,
+                                                             channel_dims);
+                float *old_mean = copy_tensor_data(running_mean);
+                float *old_var = copy_tensor_data(running_var);
+                struct rot_norm_stats stats = {};
+                MIN_UNIT_ASSERT(ROT_batchnorm(output,
+                                              &stats,
+                                              arena,
+                                              input,
+                                              gamma,
+                                              beta,
+                                              running_mean,
+                                              running_var,
+                                              &params) == output,
+                                "ROT_batchnorm failed\n");
+
+                const float *run_mean = ROT_tensor_get_data(running_mean);
+                const float *run_var = ROT_tensor_get_data(running_var);
+                const double count = batch*height*width;
+                for (size_t c = 0;
+                     c < channels;
+                     ++c) {
+                        double variance = (1.0/(stats.rstd[c]*stats.rstd[c]) -
+                                           params.epsilon);
+                        double expected_mean = (0.9*old_mean[c] +
+                                                0.1*stats.mean[c]);
+                        double expected_var = (0.9*old_var[c] +
+                                               0.1*variance*count/(count - 1));
+                        MIN_UNIT_ASSERT((fabs(run_mean[c] - expected_mean) <=
+                                         1e-5*(1.0 + fabs(expected_mean))) &&
+                                        (fabs(run_var[c] - expected_var) <=
+                                         1e-4*expected_var),
+                                        "Running statistics mismatch at %zu\n",
+                                        c);
+                }
+
+                MIN_UNIT_ASSERT(ROT_batchnorm_inference(output,
+                                                        input,
+                                                        gamma,
+                                                        beta,
+                                                        running_mean,
+                                                        running_var,
+                                                        &params) == output,
+                                "ROT_batchnorm_inference failed\n");
+
+                const float *in = ROT_tensor_get_data(input);
+                const float *out = ROT_tensor_get_data(output);
+                const float *g = ROT_tensor_get_data(gamma);
+                const float *b = ROT_tensor_get_data(beta);
+                for (size_t n = 0;
+                     n < batch;
+                     ++n) {
+                        for (size_t i = 0;
+                             i < channels*height*width;
+                             ++i) {
+                                const size_t c = i % channels;
+                                const size_t p = i/channels;
+                                size_t x = image_index(params.layout,
+                                                       channels,
+                                                       height,
+                                                       width,
+                                                       n,
+                                                       c,
+                                                       p/width,
+                                                       p % width);
+                                double expected = ((in[x] - run_mean[c])/
+                                                   sqrt(run_var[c] +
+                                                        params.epsilon)*
+                                                   g[c] + b[c]);
+                                if (expected < 0.0)
+                                        expected = 0.0;
+                                MIN_UNIT_ASSERT(fabs(out[x] - expected) <=
+                                                1e-4*(1.0 + fabs(expected)),
+                                                "Batch normalisation "
+                                                "inference mismatch at %zu\n",
+                                                x);
+                        }
+                }
+
+                free(old_var);
+                free(old_mean);
+                ROT_arena_rewind(arena, mark);
+        }
+
+        free(memory);
+}
+
+/**
+ * reference_optim_step() - Double precision reference for one step number
+ * `step` of the optimizer `params` on `num_elems` parameters `param` with
+ * state `state0` and `state1`.
+ */
+static void
+reference_optim_step(const struct rot_optim_params *params,
+                     uint64_t step,
+                     double *param,
+                     const float *grad,
+                     double *state0,
+                     double *state1,
+                     size_t num_elems)
+{
+        const bool is_adamw = (params->algo == ROT_OPTIM_ADAMW);
+        const double lr = params->learning_rate;
+        const double b1 = params->beta1;
+        const double b2 = params->beta2;
+        for (size_t i = 0;
+             i < num_elems;
+             ++i) {
+                double g = grad[i];
+                if (!is_adamw)
+                        g += params->weight_decay*param[i];
+
+                if (params->algo == ROT_OPTIM_SGD) {
+                        state0[i] = params->momentum*state0[i] + g;
+                        if (params->nesterov)
+                                g += params->momentum*state0[i];
+                        else if (params->momentum != 0.0f)
+                                g = state0[i];
+                        param[i] -= lr*g;
+                        continue;
+                }
+
+                if (is_adamw)
+                        param[i] *= 1.0 - lr*params->weight_decay;
+                state0[i] = b1*state0[i] + (1.0 - b1)*g;
+                state1[i] = b2*state1[i] + (1.0 - b2)*g*g;
+                double m_hat = state0[i]/(1.0 - pow(b1, (double)step));
+                double v_hat = state1[i]/(1.0 - pow(b2, (double)step));
+                param[i] -= lr*m_hat/(sqrt(v_hat) + params->epsilon);
+        }
+}
+
+/**
+ * test_optim() - Correctness test for the fused optimizer steps.
+ *
+ * Pass criteria: for SGD with and without (Nesterov) momentum, Adam and
+ * AdamW, with and without weight decay, several steps of ROT_optim_step
+ * match a double precision reference, including after the learning rate
+ * changes. Sizes with a tail shorter than the SIMD width and a size split
+ * across threads are covered. Gradients of the wrong size, or overlapping
+ * the parameters, are rejected.
+ */
+MIN_UNIT_TEST_FUNC(test_optim)
+{
+        const size_t memory_size = 16*1024*1024;
+        uint8_t *memory = (uint8_t *)malloc(memory_size);
+        assert(memory != NULL);
+        rot_arena_t arena = ROT_arena_new(memory, memory_size);
+        assert(arena != NULL);
+
+        const uint32_t num_steps = 4;
+        const size_t sizes[] = {rand_dim(37), 1000 + rand_dim(64), 300007};
+        struct rot_optim_params algos[5] = {};
+        algos[0].algo = ROT_OPTIM_SGD;
+        algos[1].algo = ROT_OPTIM_SGD;
+        algos[1].momentum = 0.9f;
+        algos[2].algo = ROT_OPTIM_SGD;
+        algos[2].momentum = 0.9f;
+        algos[2].nesterov = true;
+        algos[3].algo = ROT_OPTIM_ADAM;
+        algos[4].algo = ROT_OPTIM_ADAMW;
+        for (uint32_t algo_i = 3;
+             algo_i < 5;
+             ++algo_i) {
+                algos[algo_i].beta1 = 0.9f;
+                algos[algo_i].beta2 = 0.999f;
+                algos[algo_i].epsilon = 1e-8f;
+        }
+
+        for (uint32_t size_i = 0;
+             size_i < sizeof(sizes)/sizeof(sizes[0]);
+             ++size_i) {
+                for (uint32_t test_i = 0;
+                     test_i < 2*sizeof(algos)/sizeof(algos[0]);
+                     ++test_i) {
+                        const size_t num_elems = sizes[size_i];
+                        struct rot_optim_params params = algos[test_i/2];
+                        params.learning_rate = 0.01f;
+                        params.weight_decay = (test_i % 2) ? 0.1f : 0.0f;
+
+                        rot_arena_mark_t mark = ROT_arena_mark(arena);
+                        rot_optim_t optim = ROT_optim_new(arena,
+                                                          num_elems,
+                                                          &params);
+                        MIN_UNIT_ASSERT(optim != NULL,
+                                        "ROT_optim_new failed\n");
+
+                        rot_tensor_t param =
+                                create_uniform_tensor(arena,
+                                                      1,
+                                                      &num_elems,
+                                                      1.0f);
+                        rot_tensor_t grad = ROT_create_tensor(arena,
+                                                              1,
+                                                              &num_elems,
+                                                              ROT_BACKEND_CPU);
+                        assert(grad != NULL);
+
+                        double *expected = (double *)malloc(
+                                3*num_elems*sizeof(double));
+                        assert(expected != NULL);
+                        double *state0 = expected + num_elems;
+                        double *state1 = state0 + num_elems;
+                        float *p = ROT_tensor_get_data(param);
+                        float *g = ROT_tensor_get_data(grad);
+                        for (size_t i = 0;
+                             i < num_elems;
+                             ++i) {
+                                expected[i] = p[i];
+                                state0[i] = 0.0;
+                                state1[i] = 0.0;
+                        }
+
+                        for (uint32_t step = 1;
+                             step <= num_steps;
+                             ++step) {
+                                if (step == num_steps) {
+                                        params.learning_rate = 0.003f;
+                                        MIN_UNIT_ASSERT(
+                                                ROT_optim_set_learning_rate(
+                                                        optim,
+                                                        0.003f) == optim,
+                                                "Setting rate failed\n");
+                                }
+
+                                for (size_t i = 0;
+                                     i < num_elems;
+                                     ++i) {
+                                        g[i] = 2.0f*rand()/(float)RAND_MAX -
+                                               1.0f;
+                                }
+
+                                MIN_UNIT_ASSERT(ROT_optim_step(optim,
+                                                               param,
+                                                               grad) == optim,
+                                                "ROT_optim_step failed\n");
+                                reference_optim_step(&params,
+                                                     step,
+                                                     expected,
+                                                     g,
+                                                     state0,
+                                                     state1,
+                                                     num_elems);
+                        }
+
+                        for (size_t i = 0;
+                             i < num_elems;
+                             ++i) {
+                                MIN_UNIT_ASSERT(fabs(p[i] - expected[i]) <=
+                                                1e-5*(1.0 + fabs(expected[i])),
+                                                "Optimizer step mismatch at "
+                                                "%zu\n",
+                                                i);
+                        }
+
+                        const size_t wrong_size = num_elems + 1;
+                        rot_tensor_t wrong = ROT_create_tensor(arena,
+                                                               1,
+                                                               &wrong_size,
+                                                               ROT_BACKEND_CPU);
+                        assert(wrong != NULL);
+                        MIN_UNIT_ASSERT(ROT_optim_step(optim,
+                                                       param,
+                                                       wrong) == NULL,
+                                        "Wrong gradient size accepted\n");
+
+                        rot_tensor_t shared = ROT_create_tensor(
+                                arena,
+                                1,
+                                &wrong_size,
+                                ROT_BACKEND_CPU);
+                        assert(shared != NULL);
+                        MIN_UNIT_ASSERT(
+                                ROT_optim_step(
+                                        optim,
+                                        ROT_tensor_view_slice(arena,
+                                                              shared,
+                                                              0,
+                                                              0,
+                                                              num_elems),
+                                        ROT_tensor_view_slice(arena,
+                                                              shared,
+                                                              0,
+                                                              1,
+                                                              wrong_size)) ==
+                                NULL,
+                                "Overlapping gradients accepted\n");
+
+                        free(expected);
+                        ROT_arena_rewind(arena, mark);
+                }
+        }
+
+        free(memory);
+}
@@ -0,0 +1,39 @@
+/**
+ * Copyright 2017 Brendan Duke.
+ *
+ * This file is part of ROT ML Library.
+ *
+ * ROT ML Library is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your option)
+ * any later version.
+ *
+ * ROT ML Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * ROT ML Library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef TEST_NN_H
+#define TEST_NN_H
+
+#include "tests/min_unit.h"
+
+MIN_UNIT_TEST_FUNC(test_linear);
+MIN_UNIT_TEST_FUNC(test_relu);
+MIN_UNIT_TEST_FUNC(test_relu_grad);
+MIN_UNIT_TEST_FUNC(test_relu_perf);
+MIN_UNIT_TEST_FUNC(test_unary);
+MIN_UNIT_TEST_FUNC(test_unary_perf);
+MIN_UNIT_TEST_FUNC(test_tape_backward);
+MIN_UNIT_TEST_FUNC(test_conv2d);
+MIN_UNIT_TEST_FUNC(test_conv2d_winograd);
+MIN_UNIT_TEST_FUNC(test_conv2d_depthwise_separable);
+MIN_UNIT_TEST_FUNC(test_pool2d);
+MIN_UNIT_TEST_FUNC(test_layernorm);
+MIN_UNIT_TEST_FUNC(test_batchnorm);
+MIN_UNIT_TEST_FUNC(test_optim);
+
+#endif /* TEST_NN_H */